@@ -7,12 +7,21 @@
 /* Defined if MQTT handling is enabled. */
 #cmakedefine HAVE_MQTT
 
+/* Defined if zlib is available for HTTP compression. */
+#cmakedefine HAVE_ZLIB
+
 /* Defined if ppoll() is available. */
 #cmakedefine HAVE_PPOLL
 
 /* Defined if pselect() is available. */
 #cmakedefine HAVE_PSELECT
 
+/* Defined if sys/epoll.h is available. */
+#cmakedefine HAVE_SYS_EPOLL_H
+
+/* Defined if sys/eventfd.h is available. */
+#cmakedefine HAVE_SYS_EVENTFD_H
+
 /* Defined if linux/serial.h is available. */
 #cmakedefine HAVE_LINUX_SERIAL
 
@@ -22,6 +31,15 @@
 /* Defined if pthread_setname_np is available. */
 #cmakedefine HAVE_PTHREAD_SETNAME_NP
 
+/* Defined if pthread_setaffinity_np is available. */
+#cmakedefine HAVE_PTHREAD_SETAFFINITY_NP
+
+/* Defined if pthread_rwlockattr_setkind_np is available. */
+#cmakedefine HAVE_PTHREAD_RWLOCKATTR_SETKIND_NP
+
+/* Defined if mlockall() is available. */
+#cmakedefine HAVE_MLOCKALL
+
 /* The name of package. */
 #cmakedefine PACKAGE "${PACKAGE_NAME}"
 
@@ -0,0 +1,185 @@
+/*
+ * ebusd - daemon for communication with eBUS heating systems.
+ * Copyright (C) 2021 John Baier <ebusd@ebusd.eu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EBUSD_BINARYPROTOCOL_H_
+#define EBUSD_BINARYPROTOCOL_H_
+
+#include <stdint.h>
+#include <cstring>
+#include <string>
+#include "lib/ebus/result.h"
+
+namespace ebusd {
+
+/** @file ebusd/binaryprotocol.h
+ * The compact binary client protocol offered alongside the text protocol on the command port.
+ *
+ * A connection switches to the binary protocol when the very first byte received is @a BINARY_MAGIC. From then
+ * on, each request and response is a frame consisting of an 8 byte header followed by the payload:
+ *   u8 magic, u8 type (@a BinaryFrameType), u16 payload length, u32 request ID.
+ * All numbers are transferred in big endian byte order. Responses carry the request ID of the request they
+ * belong to and may be sent in a different order than the requests were received. Updates pushed for
+ * subscribed messages carry the request ID 0.
+ *
+ * Payloads by frame type:
+ *   resolve:     circuit name and message name, each terminated by a zero byte.
+ *   handle:      u32 handle of the resolved message.
+ *   read:        u32 handle, u16 maximum age in seconds of a cached value, u8 flags (@a BINARY_FLAG_RAW).
+ *   subscribe:   u32 handle, u8 flags (@a BINARY_FLAG_RAW).
+ *   unsubscribe: u32 handle, or 0 for all.
+ *   ok:          empty.
+ *   value/update: u32 handle, u32 last update time, u8 flags, followed by either
+ *                the raw data: u8 master length, master symbols, u8 slave length, slave symbols,
+ *                or the typed field values: u8 count, and per field u8 type (@a FieldValueType)
+ *                followed by an 8 byte IEEE double for numbers or a u16 length and the characters for strings.
+ *   error:       u32 result code (@a result_t), followed by the result code text.
+ * A response whose payload would exceed @a BINARY_MAX_PAYLOAD is replaced by an error frame with the result code
+ * @a RESULT_ERR_OUT_OF_RANGE.
+ *
+ * All frames of a request and all subscriptions of a connection have to refer to messages of the same bus. With
+ * additional buses, the request is served by the bus the circuit name prefix of its subscriptions, or otherwise of
+ * its first frame, refers to. Frames referring to another bus are answered with an error frame with the result
+ * code @a RESULT_ERR_INVALID_ARG.
+ */
+
+using std::string;
+
+/** the magic byte starting each frame. */
+#define BINARY_MAGIC 0xeb
+
+/** the size of the frame header in bytes. */
+#define BINARY_HEADER_SIZE 8
+
+/** the maximum payload size of a frame in bytes. */
+#define BINARY_MAX_PAYLOAD 0xffff
+
+/** flag for read and subscribe: transfer the raw master and slave data instead of the typed field values. */
+#define BINARY_FLAG_RAW 0x01
+
+/** the binary frame types. */
+enum BinaryFrameType {
+  bft_resolve = 0x01,      //!< request: resolve a circuit and message name to a handle
+  bft_read = 0x02,         //!< request: read the value of a handle
+  bft_subscribe = 0x03,    //!< request: subscribe to updates of a handle
+  bft_unsubscribe = 0x04,  //!< request: unsubscribe from updates of a handle
+  bft_ok = 0x80,           //!< response: request succeeded
+  bft_handle = 0x81,       //!< response: the resolved handle
+  bft_value = 0x82,        //!< response: the value of a handle
+  bft_update = 0x83,       //!< push: the updated value of a subscribed handle
+  bft_error = 0xff,        //!< response: request failed
+};
+
+/**
+ * Append an unsigned number in big endian byte order.
+ * @param value the number to append.
+ * @param bytes the number of bytes to append (at most 8).
+ * @param output the @a string to append to.
+ */
+inline void appendBinaryNumber(uint64_t value, size_t bytes, string* output) {
+  for (size_t pos = bytes; pos > 0; pos--) {
+    output->push_back(static_cast<char>((value >> (8*(pos-1))) & 0xff));
+  }
+}
+
+/**
+ * Append a double as 8 byte IEEE value in big endian byte order.
+ * @param value the double to append.
+ * @param output the @a string to append to.
+ */
+inline void appendBinaryDouble(double value, string* output) {
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  appendBinaryNumber(bits, 8, output);
+}
+
+/**
+ * Read an unsigned number in big endian byte order.
+ * @param data the data to read from.
+ * @param pos the position in @a data to read from.
+ * @param bytes the number of bytes to read (at most 8).
+ * @return the number.
+ */
+inline uint64_t readBinaryNumber(const string& data, size_t pos, size_t bytes) {
+  uint64_t value = 0;
+  for (size_t idx = 0; idx < bytes; idx++) {
+    value = (value << 8) | static_cast<uint8_t>(data[pos+idx]);
+  }
+  return value;
+}
+
+/**
+ * Read an 8 byte IEEE double in big endian byte order.
+ * @param data the data to read from.
+ * @param pos the position in @a data to read from.
+ * @return the double.
+ */
+inline double readBinaryDouble(const string& data, size_t pos) {
+  uint64_t bits = readBinaryNumber(data, pos, 8);
+  double value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+/**
+ * Append a complete frame, or an error frame if the payload exceeds @a BINARY_MAX_PAYLOAD.
+ * @param type the @a BinaryFrameType.
+ * @param requestId the request ID.
+ * @param payload the payload.
+ * @param output the @a string to append to.
+ * @return true when the frame was appended, false when the overflow error frame was appended instead.
+ */
+inline bool appendBinaryFrame(BinaryFrameType type, uint32_t requestId, const string& payload, string* output) {
+  bool overflow = payload.length() > BINARY_MAX_PAYLOAD;
+  static const string overflowText = "ERR: argument value out of valid range";
+  output->push_back(static_cast<char>(BINARY_MAGIC));
+  output->push_back(static_cast<char>(overflow ? bft_error : type));
+  appendBinaryNumber(overflow ? 4 + overflowText.length() : payload.length(), 2, output);
+  appendBinaryNumber(requestId, 4, output);
+  if (overflow) {
+    appendBinaryNumber(static_cast<uint32_t>(RESULT_ERR_OUT_OF_RANGE), 4, output);
+    output->append(overflowText);
+    return false;
+  }
+  output->append(payload);
+  return true;
+}
+
+/**
+ * Get the size of the frame at the start of the data.
+ * @param data the data to check.
+ * @param pos the position in @a data where the frame starts.
+ * @return the size of the complete frame including the header, 0 if the frame is not yet complete, or
+ * @a string::npos if the data does not start with a frame.
+ */
+inline size_t getBinaryFrameSize(const string& data, size_t pos) {
+  if (pos >= data.length()) {
+    return 0;
+  }
+  if (static_cast<uint8_t>(data[pos]) != BINARY_MAGIC) {
+    return string::npos;
+  }
+  if (data.length() - pos < BINARY_HEADER_SIZE) {
+    return 0;
+  }
+  size_t size = BINARY_HEADER_SIZE + static_cast<size_t>(readBinaryNumber(data, pos+2, 2));
+  return data.length() - pos < size ? 0 : size;
+}
+
+}  // namespace ebusd
+
+#endif  // EBUSD_BINARYPROTOCOL_H_
@@ -21,9 +21,12 @@
 #endif
 
 #include "ebusd/bushandler.h"
+#include <algorithm>
+#include <cstring>
 #include <iomanip>
 #include "ebusd/main.h"
 #include "lib/utils/log.h"
+#include "lib/utils/trace.h"
 
 namespace ebusd {
 
@@ -36,6 +39,16 @@ using std::endl;
 // the string used for answering to a scan request (07h 04h)
 #define SCAN_ANSWER ("ebusd.eu;" PACKAGE_NAME ";" SCAN_VERSION ";100")
 
+/**
+ * Return the number of microseconds between two times.
+ * @param from the earlier time.
+ * @param to the later time.
+ * @return the number of microseconds between the two times (negative on clock skew).
+ */
+static long long getMicrosBetween(const struct timespec* from, const struct timespec* to) {
+  return (to->tv_sec*1000000000LL + to->tv_nsec - from->tv_sec*1000000000LL - from->tv_nsec)/1000;
+}
+
 /**
  * Return the string corresponding to the @a BusState.
  * @param state the @a BusState.
@@ -63,6 +76,16 @@ const char* getStateCode(BusState state) {
   }
 }
 
+const char* getRequestLaneName(RequestLane lane) {
+  switch (lane) {
+  case rl_write: return "write";
+  case rl_read:  return "read";
+  case rl_poll:  return "poll";
+  case rl_scan:  return "scan";
+  default:       return "unknown";
+  }
+}
+
 result_t PollRequest::prepare(symbol_t ownMasterAddress) {
   istringstream input;
   result_t result = m_message->prepareMaster(m_index, ownMasterAddress, SYN, UI_FIELD_SEPARATOR, &input, &m_master);
@@ -82,6 +105,8 @@ bool PollRequest::notify(result_t result, const SlaveSymbolString& slave) {
       if (result >= RESULT_OK) {
         return true;
       }
+    } else if (result >= RESULT_OK) {
+      m_messageMap->notifyUpdate(m_message);
     }
   }
   if (result < RESULT_OK) {
@@ -127,6 +152,8 @@ bool ScanRequest::notify(result_t result, const SlaveSymbolString& slave) {
       if (result >= RESULT_OK) {
         return true;
       }
+    } else if (result >= RESULT_OK) {
+      m_messageMap->notifyUpdate(m_message);
     }
     if (result == RESULT_OK) {
       ostringstream output;
@@ -200,6 +227,122 @@ void GrabbedMessage::setLastData(const MasterSymbolString& master, const SlaveSy
 }
 
 
+void GrabStore::update(uint64_t key, const MasterSymbolString& master, const SlaveSymbolString& slave) {
+  if (m_buckets.empty()) {
+    if (m_capacity == 0) {
+      return;
+    }
+    // keep the load factor at or below 50%
+    unsigned int bits = 1;
+    while (((size_t)1 << bits) < m_capacity*2) {
+      bits++;
+    }
+    m_buckets.resize((size_t)1 << bits, 0);
+    m_shift = 64-bits;
+    m_entries.reserve(m_capacity);
+  }
+  size_t pos = findBucket(key);
+  uint32_t number = m_buckets[pos];
+  if (number == 0) {
+    if (m_size < m_capacity) {
+      m_entries.push_back(Entry{0, GrabbedMessage(), 0, 0});
+      number = static_cast<uint32_t>(m_entries.size());
+    } else {
+      // reuse the least recently seen entry
+      number = m_oldest;
+      unlink(number);
+      eraseBucket(findBucket(m_entries[number-1].m_key));
+      m_entries[number-1].m_message.clear();
+      m_evicted++;
+      m_size--;
+      pos = findBucket(key);
+    }
+    m_entries[number-1].m_key = key;
+    m_buckets[pos] = number;
+    m_size++;
+  } else if (number != m_newest) {
+    unlink(number);
+  }
+  Entry& entry = m_entries[number-1];
+  if (number != m_newest) {
+    // link as newest
+    entry.m_older = m_newest;
+    if (m_newest != 0) {
+      m_entries[m_newest-1].m_newer = number;
+    } else {
+      m_oldest = number;
+    }
+    m_newest = number;
+  }
+  entry.m_message.setLastData(master, slave);
+}
+
+void GrabStore::collect(time_t since, time_t until, vector<const GrabbedMessage*>* found) const {
+  vector<const Entry*> entries;
+  for (uint32_t number = m_newest; number != 0; ) {
+    const Entry& entry = m_entries[number-1];
+    time_t lastTime = entry.m_message.getLastTime();
+    if (since > 0 && lastTime < since) {
+      break;  // all others are older
+    }
+    if (until <= 0 || lastTime < until) {
+      entries.push_back(&entry);
+    }
+    number = entry.m_older;
+  }
+  sort(entries.begin(), entries.end(), [](const Entry* a, const Entry* b) { return a->m_key < b->m_key; });
+  found->reserve(found->size()+entries.size());
+  for (const auto entry : entries) {
+    found->push_back(&entry->m_message);
+  }
+}
+
+void GrabStore::clear() {
+  m_entries.clear();
+  m_buckets.clear();
+  m_size = 0;
+  m_newest = m_oldest = 0;
+  m_shift = 64;
+}
+
+size_t GrabStore::findBucket(uint64_t key) const {
+  size_t mask = m_buckets.size()-1;
+  size_t pos = getSlot(key);
+  while (m_buckets[pos] != 0 && m_entries[m_buckets[pos]-1].m_key != key) {
+    pos = (pos+1) & mask;
+  }
+  return pos;
+}
+
+void GrabStore::eraseBucket(size_t pos) {
+  // shift back following entries of the same probe sequence instead of leaving a tombstone
+  size_t mask = m_buckets.size()-1;
+  for (size_t next = (pos+1) & mask; m_buckets[next] != 0; next = (next+1) & mask) {
+    size_t slot = getSlot(m_entries[m_buckets[next]-1].m_key);
+    if (((next-slot) & mask) >= ((next-pos) & mask)) {
+      m_buckets[pos] = m_buckets[next];
+      pos = next;
+    }
+  }
+  m_buckets[pos] = 0;
+}
+
+void GrabStore::unlink(uint32_t number) {
+  Entry& entry = m_entries[number-1];
+  if (entry.m_newer != 0) {
+    m_entries[entry.m_newer-1].m_older = entry.m_older;
+  } else {
+    m_newest = entry.m_older;
+  }
+  if (entry.m_older != 0) {
+    m_entries[entry.m_older-1].m_newer = entry.m_newer;
+  } else {
+    m_oldest = entry.m_newer;
+  }
+  entry.m_newer = entry.m_older = 0;
+}
+
+
 /**
  * Decode the input @a SymbolString with the specified @a DataType and length.
  * @param type the @a DataType.
@@ -320,21 +463,93 @@ bool GrabbedMessage::dump(bool unknown, MessageMap* messages, bool first, bool d
 
 
 void BusHandler::clear() {
-  memset(m_seenAddresses, 0, sizeof(m_seenAddresses));
+  for (auto& seen : m_seenAddresses) {
+    seen = 0;
+  }
   m_masterCount = 1;
   m_scanResults.clear();
 }
 
-result_t BusHandler::sendAndWait(const MasterSymbolString& master, SlaveSymbolString* slave) {
-  result_t result = RESULT_ERR_NO_SIGNAL;
+result_t BusHandler::sendAndWait(const MasterSymbolString& master, SlaveSymbolString* slave, bool shared) {
   slave->clear();
-  ActiveBusRequest request(master, slave);
+  ActiveBusRequest request(master, slave, shared ? rl_read : rl_write);
+  struct timespec startTime;
+  clockGettime(&startTime);
+  result_t result;
+  if (shared && shareRequest(&request, &result)) {
+    return result;
+  }
   logInfo(lf_bus, "send message: %s", master.getStr().c_str());
+  return waitForRequest(&request, shared, false, startTime);
+}
+
+bool BusHandler::shareRequest(ActiveBusRequest* request, result_t* result) {
+  SharedFollower follower = {nullptr, request->m_slave, RESULT_EMPTY, false};
+  if (!attachRequest(request, &follower)) {
+    return false;
+  }
+  *result = waitForFollower(&follower);
+  return true;
+}
+
+bool BusHandler::attachRequest(ActiveBusRequest* request, SharedFollower* follower) {
+  pthread_mutex_lock(&m_sharedMutex);
+  for (const auto other : m_sharedRequests) {
+    if (other->m_master.compareTo(request->m_master) != 0) {
+      continue;
+    }
+    // attach to the identical pending request
+    logInfo(lf_bus, "send message: %s (shared)", request->m_master.getStr().c_str());
+    follower->owner = other;
+    follower->slave = request->m_slave;
+    follower->finished = false;
+    other->m_followers.push_back(follower);
+    pthread_mutex_unlock(&m_sharedMutex);
+    return true;
+  }
+  m_sharedRequests.push_back(request);
+  pthread_mutex_unlock(&m_sharedMutex);
+  return false;
+}
+
+result_t BusHandler::waitForFollower(SharedFollower* follower) {
+  pthread_mutex_lock(&m_sharedMutex);
+  while (!follower->finished) {
+    pthread_cond_wait(&m_sharedCond, &m_sharedMutex);
+  }
+  pthread_mutex_unlock(&m_sharedMutex);
+  return follower->result;
+}
 
+void BusHandler::releaseFollower(SharedFollower* follower) {
+  pthread_mutex_lock(&m_sharedMutex);
+  if (!follower->finished) {
+    vector<SharedFollower*>& followers = follower->owner->m_followers;
+    for (auto it = followers.begin(); it != followers.end(); it++) {
+      if (*it == follower) {
+        followers.erase(it);
+        break;
+      }
+    }
+    follower->result = RESULT_ERR_TIMEOUT;
+    follower->finished = true;
+  }
+  pthread_mutex_unlock(&m_sharedMutex);
+}
+
+result_t BusHandler::waitForRequest(ActiveBusRequest* request, bool shared, bool queued,
+    const struct timespec& startTime) {
+  result_t result = RESULT_ERR_NO_SIGNAL;
+  const MasterSymbolString& master = request->m_master;
+  TraceScope traceScope("sendAndWait");
   for (int sendRetries = m_failedSendRetries + 1; sendRetries > 0; sendRetries--) {
-    m_nextRequests.push(&request);
-    bool success = m_finishedRequests.remove(&request, true);
-    result = success ? request.m_result : RESULT_ERR_TIMEOUT;
+    if (!queued) {
+      m_queueDepthHistogram.observe(m_nextRequests.size());
+      queueRequest(request);
+    }
+    queued = false;
+    bool success = m_finishedRequests.remove(request, true);
+    result = success ? request->m_result : RESULT_ERR_TIMEOUT;
     if (result == RESULT_OK) {
       break;
     }
@@ -343,26 +558,90 @@ result_t BusHandler::sendAndWait(const MasterSymbolString& master, SlaveSymbolSt
       break;
     }
     logError(lf_bus, "send to %2.2x: %s%s", master[1], getResultCode(result), sendRetries > 1 ? ", retry" : "");
-    request.m_busLostRetries = 0;
+    request->m_busLostRetries = 0;
+  }
+  struct timespec endTime;
+  clockGettime(&endTime);
+  long long sendTime = (endTime.tv_sec-startTime.tv_sec)*1000LL + (endTime.tv_nsec-startTime.tv_nsec)/1000000;
+  if (sendTime >= 0) {
+    m_sendTimeHistogram.observe(static_cast<uint64_t>(sendTime));
+  }
+  if (shared) {
+    finishSharedRequest(request, result);
   }
   return result;
 }
 
+void BusHandler::finishSharedRequest(ActiveBusRequest* request, result_t result) {
+  // pass the result to the attached requesters without waiting for them
+  pthread_mutex_lock(&m_sharedMutex);
+  m_sharedRequests.remove(request);
+  request->m_result = result;
+  for (const auto follower : request->m_followers) {
+    *follower->slave = *request->m_slave;
+    follower->result = result;
+    follower->finished = true;
+  }
+  request->m_followers.clear();
+  pthread_cond_broadcast(&m_sharedCond);
+  pthread_mutex_unlock(&m_sharedMutex);
+}
+
+void BusHandler::cancelRequest(ActiveBusRequest* request) {
+  result_t result = RESULT_ERR_TIMEOUT;  // not sent at all
+  if (!m_nextRequests.remove(request)) {
+    // already taken for sending
+    result = m_finishedRequests.remove(request, true) ? request->m_result : RESULT_ERR_TIMEOUT;
+  }
+  finishSharedRequest(request, result);
+}
+
 result_t BusHandler::readFromBus(Message* message, const string& inputStr, symbol_t dstAddress,
     symbol_t srcAddress) {
+  return readPartsFromBus(message, &inputStr, nullptr, dstAddress, srcAddress);
+}
+
+result_t BusHandler::readFromBus(Message* message, const FieldValues& values, symbol_t dstAddress,
+    symbol_t srcAddress) {
+  return readPartsFromBus(message, nullptr, &values, dstAddress, srcAddress);
+}
+
+result_t BusHandler::readPartsFromBus(Message* message, const string* inputStr, const FieldValues* values,
+    symbol_t dstAddress, symbol_t srcAddress) {
   symbol_t masterAddress = srcAddress == SYN ? m_ownMasterAddress : srcAddress;
   result_t ret = RESULT_EMPTY;
+  if (message->getCount() > 1 && !message->isWrite()) {
+    // prepare all parts first to send them back to back
+    vector<MasterSymbolString> masters(message->getCount());
+    for (size_t index = 0; index < masters.size(); index++) {
+      if (inputStr != nullptr) {
+        istringstream input(*inputStr);
+        ret = message->prepareMaster(index, masterAddress, dstAddress, UI_FIELD_SEPARATOR, &input, &masters[index]);
+      } else {
+        ret = message->prepareMaster(index, masterAddress, dstAddress, *values, &masters[index]);
+      }
+      if (ret != RESULT_OK) {
+        logError(lf_bus, "prepare message part %d: %s", index, getResultCode(ret));
+        return ret;
+      }
+    }
+    return readChainedFromBus(message, masters);
+  }
   MasterSymbolString master;
   SlaveSymbolString slave;
   for (size_t index = 0; index < message->getCount(); index++) {
-    istringstream input(inputStr);
-    ret = message->prepareMaster(index, masterAddress, dstAddress, UI_FIELD_SEPARATOR, &input, &master);
+    if (inputStr != nullptr) {
+      istringstream input(*inputStr);
+      ret = message->prepareMaster(index, masterAddress, dstAddress, UI_FIELD_SEPARATOR, &input, &master);
+    } else {
+      ret = message->prepareMaster(index, masterAddress, dstAddress, *values, &master);
+    }
     if (ret != RESULT_OK) {
       logError(lf_bus, "prepare message part %d: %s", index, getResultCode(ret));
       break;
     }
-    // send message
-    ret = sendAndWait(master, &slave);
+    // send message (identical pending reads are shared)
+    ret = sendAndWait(master, &slave, !message->isWrite());
     if (ret != RESULT_OK) {
       logError(lf_bus, "send message part %d: %s", index, getResultCode(ret));
       break;
@@ -373,9 +652,156 @@ result_t BusHandler::readFromBus(Message* message, const string& inputStr, symbo
       break;
     }
   }
+  if (ret >= RESULT_OK) {
+    m_messages->notifyUpdate(message);
+  }
+  return ret;
+}
+
+result_t BusHandler::readChainedFromBus(Message* message, const vector<MasterSymbolString>& masters) {
+  size_t count = masters.size();
+  vector<SlaveSymbolString> slaves(count);
+  vector<ActiveBusRequest*> requests(count, nullptr);
+  vector<SharedFollower> followers(count, {nullptr, nullptr, RESULT_EMPTY, false});
+  vector<result_t> results(count, RESULT_EMPTY);
+  struct timespec startTime;
+  clockGettime(&startTime);
+  // queue all parts at once (identical pending reads are shared)
+  for (size_t index = 0; index < count; index++) {
+    ActiveBusRequest* request = new ActiveBusRequest(masters[index], &slaves[index], rl_read);
+    if (attachRequest(request, &followers[index])) {
+      delete request;
+      continue;
+    }
+    logInfo(lf_bus, "send message part %d: %s (pipelined)", index, masters[index].getStr().c_str());
+    m_queueDepthHistogram.observe(m_nextRequests.size());
+    queueRequest(request);
+    requests[index] = request;
+  }
+  // finish the own parts first, as others might be attached to them while this one is attached to theirs
+  bool failed = false;
+  for (size_t index = 0; index < count; index++) {
+    ActiveBusRequest* request = requests[index];
+    if (!request) {
+      continue;
+    }
+    if (failed) {
+      cancelRequest(request);  // no longer needed
+    } else {
+      results[index] = waitForRequest(request, true, true, startTime);
+      failed = results[index] != RESULT_OK;
+    }
+    delete request;
+  }
+  for (size_t index = 0; index < count; index++) {
+    if (requests[index]) {
+      continue;
+    }
+    if (failed) {
+      releaseFollower(&followers[index]);
+    } else {
+      results[index] = waitForFollower(&followers[index]);
+      failed = results[index] != RESULT_OK;
+    }
+  }
+  // store the parts in order
+  result_t ret = RESULT_OK;
+  for (size_t index = 0; index < count; index++) {
+    ret = results[index];
+    if (ret != RESULT_OK) {
+      logError(lf_bus, "send message part %d: %s", index, getResultCode(ret));
+      break;
+    }
+    ret = message->storeLastData(index, slaves[index]);
+    if (ret < RESULT_OK) {
+      logError(lf_bus, "store message part %d: %s", index, getResultCode(ret));
+      break;
+    }
+  }
+  if (ret >= RESULT_OK) {
+    m_messages->notifyUpdate(message);
+  }
   return ret;
 }
 
+void BusHandler::readFromBus(const vector<Message*>& messages, vector<result_t>* results) {
+  size_t count = messages.size();
+  results->assign(count, RESULT_EMPTY);
+  vector<MasterSymbolString> masters(count);
+  vector<SlaveSymbolString> slaves(count);
+  vector<ActiveBusRequest*> requests(count, nullptr);
+  vector<SharedFollower> followers(count, {nullptr, nullptr, RESULT_EMPTY, false});
+  vector<size_t> firstIndex(count);
+  map<const Message*, size_t> indexByMessage;
+  struct timespec startTime;
+  clockGettime(&startTime);
+  // queue all single part messages at once without waiting for any other request
+  for (size_t idx = 0; idx < count; idx++) {
+    Message* message = messages[idx];
+    firstIndex[idx] = indexByMessage.insert({message, idx}).first->second;
+    if (firstIndex[idx] != idx || message->getCount() != 1 || message->isWrite()) {
+      continue;  // duplicate, or read later on one by one
+    }
+    istringstream input;
+    result_t ret = message->prepareMaster(0, m_ownMasterAddress, SYN, UI_FIELD_SEPARATOR, &input, &masters[idx]);
+    if (ret != RESULT_OK) {
+      logError(lf_bus, "prepare message part %d: %s", 0, getResultCode(ret));
+      (*results)[idx] = ret;
+      continue;
+    }
+    ActiveBusRequest* request = new ActiveBusRequest(masters[idx], &slaves[idx], rl_read);
+    if (attachRequest(request, &followers[idx])) {
+      delete request;
+      continue;
+    }
+    logInfo(lf_bus, "send message: %s (batch)", masters[idx].getStr().c_str());
+    m_queueDepthHistogram.observe(m_nextRequests.size());
+    queueRequest(request);
+    requests[idx] = request;
+  }
+  // finish the own requests first, as others might be attached to them while this one is attached to theirs
+  for (size_t idx = 0; idx < count; idx++) {
+    ActiveBusRequest* request = requests[idx];
+    if (!request) {
+      continue;
+    }
+    result_t ret = waitForRequest(request, true, true, startTime);
+    delete request;
+    (*results)[idx] = storeBatchResult(messages[idx], ret, slaves[idx]);
+  }
+  for (size_t idx = 0; idx < count; idx++) {
+    if (requests[idx] || firstIndex[idx] != idx || (*results)[idx] != RESULT_EMPTY) {
+      continue;
+    }
+    Message* message = messages[idx];
+    if (followers[idx].owner) {
+      result_t ret = waitForFollower(&followers[idx]);
+      (*results)[idx] = storeBatchResult(message, ret, slaves[idx]);
+    } else {
+      (*results)[idx] = readFromBus(message, "");
+    }
+  }
+  for (size_t idx = 0; idx < count; idx++) {
+    if (firstIndex[idx] != idx) {
+      (*results)[idx] = (*results)[firstIndex[idx]];
+    }
+  }
+}
+
+result_t BusHandler::storeBatchResult(Message* message, result_t result, const SlaveSymbolString& slave) {
+  if (result != RESULT_OK) {
+    logError(lf_bus, "send message part %d: %s", 0, getResultCode(result));
+    return result;
+  }
+  result = message->storeLastData(0, slave);
+  if (result < RESULT_OK) {
+    logError(lf_bus, "store message part %d: %s", 0, getResultCode(result));
+  } else {
+    m_messages->notifyUpdate(message);
+  }
+  return result;
+}
+
 void BusHandler::run() {
   unsigned int symCount = 0;
   time_t now, lastTime;
@@ -383,16 +809,38 @@ void BusHandler::run() {
   lastTime += 2;
   logNotice(lf_bus, "bus started with own address %2.2x/%2.2x%s", m_ownMasterAddress, m_ownSlaveAddress,
       m_answer?" in answer mode":"");
+  if (m_schedPolicy != SCHED_OTHER || m_schedCpu >= 0) {
+    int error = Thread::setScheduling(m_schedPolicy, m_schedPriority, m_schedCpu);
+    if (error != 0) {
+      logError(lf_bus, "unable to set bus thread scheduling: %s", strerror(error));
+    } else {
+      logNotice(lf_bus, "bus thread scheduling set to %s priority %d, CPU %d",
+          m_schedPolicy == SCHED_RR ? "round-robin" : m_schedPolicy == SCHED_FIFO ? "FIFO" : "default",
+          m_schedPriority, m_schedCpu);
+    }
+  }
+  if (m_lockMemory) {
+    int error = Thread::lockMemory();
+    if (error != 0) {
+      logError(lf_bus, "unable to lock memory: %s", strerror(error));
+    } else {
+      logNotice(lf_bus, "memory locked");
+    }
+  }
 
   do {
     if (m_device->isValid() && !m_reconnect) {
       result_t result = handleSymbol();
       time(&now);
-      if (result != RESULT_ERR_TIMEOUT && now >= lastTime) {
-        symCount++;
+      if (result != RESULT_ERR_TIMEOUT) {
+        m_symbolsReceived.add();
+        if (now >= lastTime) {
+          symCount++;
+        }
       }
       if (now > lastTime) {
         m_symPerSec = symCount / (unsigned int)(now-lastTime);
+        m_symPerSecMeasured = true;
         if (m_symPerSec > m_maxSymPerSec) {
           m_maxSymPerSec = m_symPerSec;
           if (m_maxSymPerSec > 100) {
@@ -418,7 +866,14 @@ void BusHandler::run() {
         setState(bs_noSignal, result);
       }
       symCount = 0;
+      m_symPerSecMeasured = false;
       m_symbolLatencyMin = m_symbolLatencyMax = m_arbitrationDelayMin = m_arbitrationDelayMax = -1;
+      if (m_autoTune) {
+        // the new connection may have a different latency
+        m_device->setLatency(m_device->getConfiguredLatency());
+        m_symbolLatencyWindow.clear();
+        m_symbolLatencySamples = 0;
+      }
       time(&lastTime);
       lastTime += 2;
     }
@@ -443,61 +898,33 @@ result_t BusHandler::handleSymbol() {
       setState(bs_ready, RESULT_ERR_TIMEOUT);  // just to be sure an old BusRequest is cleaned up
     }
     if (!m_device->isArbitrating() && m_currentRequest == nullptr && m_remainLockCount == 0) {
-      BusRequest* startRequest = m_nextRequests.peek();
-      if (startRequest == nullptr && m_pollInterval > 0) {  // check for poll/scan
-        time_t now;
-        time(&now);
-        if (m_lastPoll == 0 || difftime(now, m_lastPoll) > m_pollInterval) {
-          Message* message = m_messages->getNextPoll();
-          if (message != nullptr) {
-            m_lastPoll = now;
-            auto request = new PollRequest(message);
-            result_t ret = request->prepare(m_ownMasterAddress);
-            if (ret != RESULT_OK) {
-              logError(lf_bus, "prepare poll message: %s", getResultCode(ret));
-              delete request;
-            } else {
-              startRequest = request;
-              m_nextRequests.push(request);
-            }
-          }
-        }
-      }
+      BusRequest* startRequest = peekNextRequest();
       if (startRequest != nullptr) {  // initiate arbitration
-        logDebug(lf_bus, "start request %2.2x", startRequest->m_master[0]);
-        result_t ret = m_device->startArbitration(startRequest->m_master[0]);
-        if (ret == RESULT_OK) {
-          logDebug(lf_bus, "arbitration start with %2.2x", startRequest->m_master[0]);
-        } else {
-          logError(lf_bus, "arbitration start: %s", getResultCode(ret));
-          m_nextRequests.remove(startRequest);
-          m_currentRequest = startRequest;
-          setState(bs_ready, ret);  // force the failed request to be notified
-        }
+        startArbitration(startRequest);
       }
     }
     break;
 
   case bs_recvCmd:
   case bs_recvCmdCrc:
-    timeout = m_slaveRecvTimeout;
+    timeout = m_effectiveSlaveRecvTimeout;
     break;
 
   case bs_recvCmdAck:
-    timeout = m_slaveRecvTimeout;
+    timeout = m_effectiveSlaveRecvTimeout;
     break;
 
   case bs_recvRes:
   case bs_recvResCrc:
-    if (m_response.size() > 0 || m_slaveRecvTimeout > SYN_TIMEOUT) {
-      timeout = m_slaveRecvTimeout;
+    if (m_response.size() > 0 || m_effectiveSlaveRecvTimeout > SYN_TIMEOUT) {
+      timeout = m_effectiveSlaveRecvTimeout;
     } else {
       timeout = SYN_TIMEOUT;
     }
     break;
 
   case bs_recvResAck:
-    timeout = m_slaveRecvTimeout;
+    timeout = m_effectiveSlaveRecvTimeout;
     break;
 
   case bs_sendCmd:
@@ -580,9 +1007,38 @@ result_t BusHandler::handleSymbol() {
   // receive next symbol (optionally check reception of sent symbol)
   symbol_t recvSymbol;
   ArbitrationState arbitrationState = as_none;
-  result = m_device->recv(timeout, &recvSymbol, &arbitrationState);
+  bool arbitrating = m_device->isArbitrating() && !m_device->isEnhancedProto();
+  {
+    TraceScope traceRecv("recv");
+    result = m_device->recv(timeout, &recvSymbol, &arbitrationState);
+  }
+  TraceScope traceHandle("handleSymbol");
+  clockGettime(&recvTime);
+  if (arbitrating && m_lastRecvEnd.tv_sec != 0
+      && getMicrosBetween(&m_lastRecvEnd, &sentTime) > SYMBOL_DURATION_MICROS) {
+    // the SYN for the arbitration may have been received too late
+    m_missedDeadlines.add();
+  }
+  if (result == RESULT_ERR_TIMEOUT
+      && getMicrosBetween(&sentTime, &recvTime) > (timeout+m_device->getLatency())*1000LL + SYMBOL_DURATION_MICROS) {
+    m_lateWakeups.add();
+  }
+  m_lastRecvEnd = recvTime;
   if (sending) {
+    // recvTime already set
+  } else if (m_autoTune && result == RESULT_OK && recvSymbol != SYN && m_currentRequest != nullptr
+      && (m_state == bs_recvCmdAck || (m_state == bs_recvRes && m_response.size() == 0 && !m_escape))) {
     clockGettime(&recvTime);
+    measureAnswerDelay(&sentTime, &recvTime);
+  } else if (m_autoTune && result == RESULT_ERR_TIMEOUT && m_currentRequest != nullptr
+      && (m_state == bs_recvCmdAck || (m_state == bs_recvRes && m_response.size() == 0))
+      && m_effectiveSlaveRecvTimeout < m_slaveRecvTimeout) {
+    // the slave did not answer within the tuned timeout, which was probably too short: start over
+    logInfo(lf_bus, "auto-tuned receive timeout %d ms exceeded, back to %d ms",
+        m_effectiveSlaveRecvTimeout.load(), m_slaveRecvTimeout);
+    m_effectiveSlaveRecvTimeout = m_slaveRecvTimeout;
+    m_answerDelayWindow.clear();
+    m_answerDelaySamples = 0;
   }
   bool sentAutoSyn = false;
   if (!sending && result == RESULT_ERR_TIMEOUT && m_generateSynInterval > 0
@@ -620,7 +1076,7 @@ result_t BusHandler::handleSymbol() {
       logDebug(lf_bus, "arbitration lost");
       if (m_currentRequest == nullptr) {
         BusRequest *startRequest = m_nextRequests.peek();
-        if (startRequest != nullptr && m_nextRequests.remove(startRequest)) {
+        if (startRequest != nullptr && takeRequest(startRequest)) {
           m_currentRequest = startRequest;  // force the failed request to be notified
         }
       }
@@ -632,7 +1088,7 @@ result_t BusHandler::handleSymbol() {
         setState(bs_ready, RESULT_OK);  // force the current request to be notified
       } else {
         BusRequest *startRequest = m_nextRequests.peek();
-        if (m_state != bs_ready || startRequest == nullptr || !m_nextRequests.remove(startRequest)) {
+        if (m_state != bs_ready || startRequest == nullptr || !takeRequest(startRequest)) {
           logNotice(lf_bus, "arbitration won in invalid state %s", getStateCode(m_state));
           setState(bs_ready, RESULT_ERR_TIMEOUT);
         } else {
@@ -650,7 +1106,7 @@ result_t BusHandler::handleSymbol() {
       // cancel request
       if (!m_currentRequest) {
         BusRequest *startRequest = m_nextRequests.peek();
-        if (startRequest && m_nextRequests.remove(startRequest)) {
+        if (startRequest && takeRequest(startRequest)) {
           m_currentRequest = startRequest;
         }
       }
@@ -667,6 +1123,14 @@ result_t BusHandler::handleSymbol() {
   time_t now;
   time(&now);
   if (result != RESULT_OK) {
+    if (sending && m_autoTune && result == RESULT_ERR_TIMEOUT
+        && m_device->getLatency() < m_device->getConfiguredLatency()) {
+      // the sent symbol was not received back in time: fall back to the configured latency
+      m_device->setLatency(m_device->getConfiguredLatency());
+      m_symbolLatencyWindow.clear();
+      m_symbolLatencySamples = 0;
+      logNotice(lf_bus, "auto-tuned latency reset to %d ms", m_device->getLatency());
+    }
     if ((m_generateSynInterval != SYN_TIMEOUT && difftime(now, m_lastReceive) > 1)
       // at least one full second has passed since last received symbol
       || m_state == bs_noSignal) {
@@ -741,6 +1205,7 @@ result_t BusHandler::handleSymbol() {
         if (latencyLong >= 0 && latencyLong <= 10000) {  // skip clock skew or out of reasonable range
           auto latency = static_cast<int>(latencyLong);
           logDebug(lf_bus, "arbitration delay %d micros", latency);
+          m_arbitrationDelayHistogram.observe(static_cast<uint64_t>(latency));
           if (m_arbitrationDelayMin < 0 || (latency < m_arbitrationDelayMin || latency > m_arbitrationDelayMax)) {
             if (m_arbitrationDelayMin == -1 || latency < m_arbitrationDelayMin) {
               m_arbitrationDelayMin = latency;
@@ -756,6 +1221,7 @@ result_t BusHandler::handleSymbol() {
         return setState(bs_sendCmd, RESULT_OK);
       }
       // arbitration lost. if same priority class found, try again after next AUTO-SYN
+      m_arbitrationLost.add();
       m_remainLockCount = isMaster(recvSymbol) ? 2 : 1;  // number of SYN to wait for before next send try
       if ((recvSymbol & 0x0f) != (sendSymbol & 0x0f) && m_lockCount > m_remainLockCount) {
         // if different priority class found, try again after N AUTO-SYN symbols (at least next AUTO-SYN)
@@ -810,6 +1276,7 @@ result_t BusHandler::handleSymbol() {
         return setState(bs_skip, RESULT_ERR_ACK);
       }
       if (m_currentRequest != nullptr) {
+        prepareNextRequest();  // while waiting for the answer
         if (isMaster(m_currentRequest->m_master[1])) {
           messageCompleted();
           return setState(bs_sendSyn, RESULT_OK);
@@ -897,6 +1364,7 @@ result_t BusHandler::handleSymbol() {
 
   case bs_sendCmdCrc:
     if (m_currentRequest->m_master[1] == BROADCAST) {
+      prepareNextRequest();
       messageCompleted();
       return setState(bs_sendSyn, RESULT_OK);
     }
@@ -985,26 +1453,109 @@ result_t BusHandler::handleSymbol() {
     if (!sending) {
       return setState(bs_skip, RESULT_ERR_INVALID_ARG);
     }
-    return setState(bs_skip, RESULT_OK);
+    result = setState(bs_skip, RESULT_OK);
+    if (m_nextPrepared) {
+      // back-to-back: arbitrate for the prepared request on the next SYN, i.e. the first one after our own
+      m_nextPrepared = false;
+      BusRequest* startRequest = m_nextRequests.peek();
+      if (startRequest != nullptr && m_currentRequest == nullptr && m_remainLockCount == 0
+          && !m_device->isArbitrating()) {
+        m_pipelinedRequests.add();
+        startArbitration(startRequest);
+      }
+    }
+    return result;
   }
   return RESULT_OK;
 }
 
+bool BusHandler::takeRequest(BusRequest* request) {
+  uint64_t waitMillis = 0;
+  if (!m_nextRequests.remove(request, &waitMillis)) {
+    return false;
+  }
+  m_laneWaitHistograms[request->m_lane]->observe(waitMillis);
+  return true;
+}
+
+BusRequest* BusHandler::peekNextRequest() {
+  BusRequest* startRequest = m_nextRequests.peek();
+  if (startRequest != nullptr || m_pollInterval == 0) {
+    return startRequest;
+  }
+  // check for poll
+  time_t now;
+  time(&now);
+  unsigned int pollInterval = m_pollInterval;
+  if (m_adaptPollInterval && m_symPerSecMeasured && m_symPerSec < POLL_IDLE_SYMBOL_RATE) {
+    // use idle bus time for polling more frequently
+    pollInterval = 1 + (m_pollInterval-1)*m_symPerSec/POLL_IDLE_SYMBOL_RATE;
+  }
+  if (m_lastPoll != 0 && difftime(now, m_lastPoll) <= pollInterval) {
+    return nullptr;
+  }
+  Message* message = m_messages->getNextPoll();
+  if (message == nullptr) {
+    return nullptr;
+  }
+  m_lastPoll = now;
+  if (message->getLastUpdateTime() > 0 && now >= message->getLastUpdateTime()) {
+    m_pollStalenessHistogram.observe(static_cast<uint64_t>(now-message->getLastUpdateTime()));
+  }
+  auto request = new PollRequest(m_messages, message);
+  result_t ret = request->prepare(m_ownMasterAddress);
+  if (ret != RESULT_OK) {
+    logError(lf_bus, "prepare poll message: %s", getResultCode(ret));
+    delete request;
+    return nullptr;
+  }
+  queueRequest(request);
+  return m_nextRequests.peek();
+}
+
+void BusHandler::startArbitration(BusRequest* startRequest) {
+  logDebug(lf_bus, "start request %2.2x", startRequest->m_master[0]);
+  result_t ret = m_device->startArbitration(startRequest->m_master[0]);
+  if (ret == RESULT_OK) {
+    logDebug(lf_bus, "arbitration start with %2.2x", startRequest->m_master[0]);
+  } else {
+    logError(lf_bus, "arbitration start: %s", getResultCode(ret));
+    takeRequest(startRequest);
+    m_currentRequest = startRequest;
+    setState(bs_ready, ret);  // force the failed request to be notified
+  }
+}
+
+void BusHandler::prepareNextRequest() {
+  if (!m_pipeline) {
+    return;
+  }
+  BusRequest* nextRequest = peekNextRequest();
+  if (nextRequest != nullptr) {
+    nextRequest->m_master.calcCrc();  // done now while the bus is busy with the current request
+    m_nextPrepared = true;
+  }
+}
+
 result_t BusHandler::setState(BusState state, result_t result, bool firstRepetition) {
+  if (result == RESULT_ERR_CRC) {
+    m_crcErrors.add();
+  }
   if (m_currentRequest != nullptr) {
     if (result == RESULT_ERR_BUS_LOST && m_currentRequest->m_busLostRetries < m_busLostRetries) {
       logDebug(lf_bus, "%s during %s, retry", getResultCode(result), getStateCode(m_state));
       m_currentRequest->m_busLostRetries++;
-      m_nextRequests.push(m_currentRequest);  // repeat
+      queueRequest(m_currentRequest);  // repeat
       m_currentRequest = nullptr;
     } else if (state == bs_sendSyn || (result != RESULT_OK && !firstRepetition)) {
       logDebug(lf_bus, "notify request: %s", getResultCode(result));
+      m_busLostRetriesHistogram.observe(m_currentRequest->m_busLostRetries);
       bool restart = m_currentRequest->notify(
         result == RESULT_ERR_SYN && (m_state == bs_recvCmdAck || m_state == bs_recvRes)
         ? RESULT_ERR_TIMEOUT : result, m_response);
       if (restart) {
         m_currentRequest->m_busLostRetries = 0;
-        m_nextRequests.push(m_currentRequest);
+        queueRequest(m_currentRequest);
       } else if (m_currentRequest->m_deleteOnFinish) {
         delete m_currentRequest;
       } else {
@@ -1018,12 +1569,13 @@ result_t BusHandler::setState(BusState state, result_t result, bool firstRepetit
   }
 
   if (state == bs_noSignal) {  // notify all requests
+    m_nextPrepared = false;
     m_response.clear();  // notify with empty response
     while ((m_currentRequest = m_nextRequests.pop()) != nullptr) {
       bool restart = m_currentRequest->notify(RESULT_ERR_NO_SIGNAL, m_response);
       if (restart) {  // should not occur with no signal
         m_currentRequest->m_busLostRetries = 0;
-        m_nextRequests.push(m_currentRequest);
+        queueRequest(m_currentRequest);
       } else if (m_currentRequest->m_deleteOnFinish) {
         delete m_currentRequest;
       } else {
@@ -1036,6 +1588,7 @@ result_t BusHandler::setState(BusState state, result_t result, bool firstRepetit
   if (state == m_state) {
     return result;
   }
+  traceInstant("setState", getStateCode(state));
   if ((result < RESULT_OK && !(result == RESULT_ERR_TIMEOUT && state == bs_skip && m_state == bs_ready))
       || (result != RESULT_OK && state == bs_skip && m_state != bs_ready)) {
     logDebug(lf_bus, "%s during %s, switching to %s", getResultCode(result), getStateCode(m_state),
@@ -1066,10 +1619,19 @@ result_t BusHandler::setState(BusState state, result_t result, bool firstRepetit
 
 void BusHandler::measureLatency(struct timespec* sentTime, struct timespec* recvTime) {
   long long latencyLong = (recvTime->tv_sec*1000000000 + recvTime->tv_nsec
-      - sentTime->tv_sec*1000000000 - sentTime->tv_nsec)/1000000;
-  if (latencyLong < 0 || latencyLong > 1000) {
+      - sentTime->tv_sec*1000000000 - sentTime->tv_nsec)/1000;
+  if (latencyLong < 0 || latencyLong > 1000000) {
     return;  // clock skew or out of reasonable range
   }
+  m_symbolLatencyHistogram.observe(static_cast<uint64_t>(latencyLong));
+  if (m_autoTune) {
+    m_symbolLatencyWindow.observe(static_cast<uint64_t>(latencyLong));
+    if (++m_symbolLatencySamples >= AUTOTUNE_INTERVAL) {
+      m_symbolLatencySamples = 0;
+      tuneLatency();
+    }
+  }
+  latencyLong /= 1000;
   auto latency = static_cast<int>(latencyLong);
   logDebug(lf_bus, "send/receive symbol latency %d ms", latency);
   if (m_symbolLatencyMin >= 0 && (latency >= m_symbolLatencyMin && latency <= m_symbolLatencyMax)) {
@@ -1084,6 +1646,50 @@ void BusHandler::measureLatency(struct timespec* sentTime, struct timespec* recv
   logInfo(lf_bus, "send/receive symbol latency %d - %d ms", m_symbolLatencyMin, m_symbolLatencyMax);
 }
 
+void BusHandler::measureAnswerDelay(struct timespec* waitTime, struct timespec* recvTime) {
+  long long delayLong = (recvTime->tv_sec*1000000000 + recvTime->tv_nsec
+      - waitTime->tv_sec*1000000000 - waitTime->tv_nsec)/1000;
+  if (delayLong < 0 || delayLong > 1000000) {
+    return;  // clock skew or out of reasonable range
+  }
+  m_answerDelayWindow.observe(static_cast<uint64_t>(delayLong));
+  if (++m_answerDelaySamples >= AUTOTUNE_INTERVAL) {
+    m_answerDelaySamples = 0;
+    tuneSlaveRecvTimeout();
+  }
+}
+
+void BusHandler::tuneLatency() {
+  uint64_t latency = m_symbolLatencyWindow.getPercentile(AUTOTUNE_PERCENTILE);
+  // a sent symbol is expected back within SEND_TIMEOUT plus the device latency, keep 50% headroom
+  auto needed = static_cast<unsigned int>((latency*3/2+999)/1000);
+  unsigned int value = needed > SEND_TIMEOUT ? needed-SEND_TIMEOUT : 0;
+  unsigned int maxValue = std::max(m_device->getConfiguredLatency(), static_cast<unsigned int>(AUTOTUNE_MAX_LATENCY));
+  value = std::min(std::max(value, static_cast<unsigned int>(HOST_LATENCY_MS)), maxValue);
+  if (value == m_device->getLatency()) {
+    return;
+  }
+  logInfo(lf_bus, "auto-tuned latency %d ms (%d%% of symbol latencies within %d micros)", value,
+      AUTOTUNE_PERCENTILE, static_cast<int>(latency));
+  m_device->setLatency(value);
+}
+
+void BusHandler::tuneSlaveRecvTimeout() {
+  uint64_t delay = m_answerDelayWindow.getPercentile(AUTOTUNE_PERCENTILE);
+  // the measured delay includes the device latency that is added to the receive timeout anyway
+  auto needed = static_cast<unsigned int>((delay*3/2+999)/1000);
+  unsigned int latency = m_device->getLatency();
+  unsigned int value = (needed > latency ? needed-latency : 0) + SYMBOL_DURATION;
+  unsigned int maxValue = std::max(m_slaveRecvTimeout, static_cast<unsigned int>(SYN_TIMEOUT));
+  value = std::min(std::max(value, static_cast<unsigned int>(SLAVE_RECV_TIMEOUT)), maxValue);
+  if (value == m_effectiveSlaveRecvTimeout) {
+    return;
+  }
+  logInfo(lf_bus, "auto-tuned receive timeout %d ms (%d%% of answers within %d micros)", value,
+      AUTOTUNE_PERCENTILE, static_cast<int>(delay));
+  m_effectiveSlaveRecvTimeout = value;
+}
+
 bool BusHandler::addSeenAddress(symbol_t address) {
   if (!isValidAddress(address, false)) {
     return false;
@@ -1121,6 +1727,7 @@ bool BusHandler::addSeenAddress(symbol_t address) {
 }
 
 void BusHandler::messageCompleted() {
+  TraceScope traceScope("messageCompleted");
   const char* prefix = m_currentRequest ? "sent" : "received";
   if (m_currentRequest) {
     m_command = m_currentRequest->m_master;
@@ -1155,6 +1762,7 @@ void BusHandler::messageCompleted() {
           }
           result = message->storeLastData(0, idData);
           if (result == RESULT_OK) {
+            m_messages->notifyUpdate(message);
             ostringstream output;
             result = message->decodeLastData(true, nullptr, -1, 0, &output);
             if (result == RESULT_OK) {
@@ -1175,6 +1783,7 @@ void BusHandler::messageCompleted() {
       if (message && (message->getLastUpdateTime() == 0 || message->getLastSlaveData().getDataSize() < 10)) {
         result_t result = message->storeLastData(m_command, m_response);
         if (result == RESULT_OK) {
+          m_messages->notifyUpdate(message);
           ostringstream output;
           result = message->decodeLastData(true, nullptr, -1, 0, &output);
           if (result == RESULT_OK) {
@@ -1194,7 +1803,9 @@ void BusHandler::messageCompleted() {
     } else {
       key = Message::createKey(m_command, m_command[1] == BROADCAST ? 1 : 4);  // up to 4 DD bytes (1 for broadcast)
     }
-    m_grabbedMessages[key].setLastData(m_command, m_response);
+    m_grabMutex.lock();
+    m_grabbedMessages.update(key, m_command, m_response);
+    m_grabMutex.unlock();
   }
   if (message == nullptr) {
     if (dstAddress == BROADCAST) {
@@ -1216,7 +1827,14 @@ void BusHandler::messageCompleted() {
     result_t result = message->storeLastData(m_command, m_response);
     ostringstream output;
     if (result == RESULT_OK) {
-      result = message->decodeLastData(false, nullptr, -1, 0, &output);
+      if (!m_currentRequest) {
+        message->setPassiveUpdate();
+      }
+      m_messages->notifyUpdate(message);
+      if (needsLog(lf_update, ll_notice)) {
+        // otherwise decoding is left to the consumers sharing the decoded value of the message
+        result = message->decodeLastData(false, nullptr, -1, 0, &output);
+      }
     }
     if (result < RESULT_OK) {
       logError(lf_update, "unable to parse %s %s %s from %s / %s: %s", mode, circuit.c_str(), name.c_str(),
@@ -1245,7 +1863,7 @@ void BusHandler::messageCompleted() {
 }
 
 result_t BusHandler::prepareScan(symbol_t slave, bool full, const string& levels, bool* reload,
-    ScanRequest** request) {
+    ScanRequest** request, bool background) {
   Message* scanMessage = m_messages->getScanMessage();
   if (scanMessage == nullptr) {
     return RESULT_ERR_NOTFOUND;
@@ -1254,6 +1872,7 @@ result_t BusHandler::prepareScan(symbol_t slave, bool full, const string& levels
     return RESULT_OK;
   }
   deque<Message*> messages;
+  m_messages->lock();  // the scan config might be loaded in the background meanwhile
   m_messages->findAll("scan", "", levels, true, true, false, false, true, true, 0, 0, false, &messages);
   auto it = messages.begin();
   while (it != messages.end()) {
@@ -1293,10 +1912,12 @@ result_t BusHandler::prepareScan(symbol_t slave, bool full, const string& levels
     messages.push_front(scanMessage);
   }
   if (messages.empty()) {
+    m_messages->unlock();
     return RESULT_OK;
   }
-  *request = new ScanRequest(slave == SYN, m_messages, messages, slaves, this, *reload ? 0 : 1);
+  *request = new ScanRequest(slave == SYN || background, m_messages, messages, slaves, this, *reload ? 0 : 1);
   result_t result = (*request)->prepare(m_ownMasterAddress);
+  m_messages->unlock();
   if (result < RESULT_OK) {
     delete *request;
     *request = nullptr;
@@ -1320,7 +1941,29 @@ result_t BusHandler::startScan(bool full, const string& levels) {
   }
   m_scanResults.clear();
   m_runningScans++;
-  m_nextRequests.push(request);
+  queueRequest(request);
+  return RESULT_OK;
+}
+
+result_t BusHandler::startScan(symbol_t slave) {
+  if (!isValidAddress(slave, false) || isMaster(slave)) {
+    return RESULT_ERR_INVALID_ADDR;
+  }
+  if (m_runningScans > 0) {
+    return RESULT_ERR_DUPLICATE;
+  }
+  ScanRequest* request = nullptr;
+  bool reload = true;
+  result_t result = prepareScan(slave, false, "", &reload, &request, true);
+  if (result != RESULT_OK) {
+    return result;
+  }
+  if (!request) {
+    return RESULT_ERR_NOTFOUND;
+  }
+  m_scanResults.erase(slave);
+  m_runningScans++;
+  queueRequest(request);
   return RESULT_OK;
 }
 
@@ -1462,12 +2105,15 @@ void BusHandler::formatUpdateInfo(ostringstream* output) const {
           << ",\"co\":" << (m_addressConflict ? 1 : 0);
   if (m_grabMessages) {
     size_t unknownCnt = 0;
-    for (auto it : m_grabbedMessages) {
-      Message* message = m_messages->find(it.second.getLastMasterData());
-      if (!message) {
+    vector<const GrabbedMessage*> grabbed;
+    m_grabMutex.lock();
+    m_grabbedMessages.collect(0, 0, &grabbed);
+    for (const auto it : grabbed) {
+      if (!m_messages->find(it->getLastMasterData())) {
         unknownCnt++;
       }
     }
+    m_grabMutex.unlock();
     *output << ",\"gu\":" << unknownCnt;
   }
   unsigned char address = 0;
@@ -1542,16 +2188,26 @@ void BusHandler::formatUpdateInfo(ostringstream* output) const {
 }
 
 result_t BusHandler::scanAndWait(symbol_t dstAddress, bool loadScanConfig, bool reload) {
+  bool hasAdditionalScanMessages = m_messages->hasAdditionalScanMessages();
+  bool requestExecuted = false;
+  result_t result = sendScanAndWait(dstAddress, reload, &requestExecuted);
+  if (loadScanConfig) {
+    m_seenAddresses[dstAddress] |= LOAD_QUEUED;
+    DeferredScanLoad load(dstAddress, result, requestExecuted, hasAdditionalScanMessages);
+    result = this->loadScanConfig(&load);
+  }
+  return result;
+}
+
+result_t BusHandler::sendScanAndWait(symbol_t dstAddress, bool reload, bool* requestExecuted) {
   if (!isValidAddress(dstAddress, false) || isMaster(dstAddress)) {
     return RESULT_ERR_INVALID_ADDR;
   }
   ScanRequest* request = nullptr;
-  bool hasAdditionalScanMessages = m_messages->hasAdditionalScanMessages();
   result_t result = prepareScan(dstAddress, false, "", &reload, &request);
   if (result != RESULT_OK) {
     return result;
   }
-  bool requestExecuted = false;
   if (request) {
     if (reload) {
       m_scanResults.erase(dstAddress);
@@ -1559,43 +2215,101 @@ result_t BusHandler::scanAndWait(symbol_t dstAddress, bool loadScanConfig, bool
       m_scanResults[dstAddress].resize(1);
     }
     m_runningScans++;
-    m_nextRequests.push(request);
-    requestExecuted = m_finishedRequests.remove(request, true);
-    result = requestExecuted ? request->m_result : RESULT_ERR_TIMEOUT;
+    queueRequest(request);
+    *requestExecuted = m_finishedRequests.remove(request, true);
+    result = *requestExecuted ? request->m_result : RESULT_ERR_TIMEOUT;
     delete request;
     request = nullptr;
   }
-  if (loadScanConfig) {
-    string file;
-    bool timedOut = result == RESULT_ERR_TIMEOUT;
-    bool loadFailed = false;
-    if (timedOut || result == RESULT_OK) {
-      result = loadScanConfigFile(m_messages, dstAddress, false, &file);  // try to load even if one message timed out
-      loadFailed = result != RESULT_OK;
-      if (timedOut && loadFailed) {
-        result = RESULT_ERR_TIMEOUT;  // back to previous result
-      }
+  return result;
+}
+
+result_t BusHandler::scanAndDeferLoad(symbol_t dstAddress, DeferredScanLoad** load) {
+  *load = nullptr;
+  bool hasAdditionalScanMessages = m_messages->hasAdditionalScanMessages();
+  bool requestExecuted = false;
+  result_t result = sendScanAndWait(dstAddress, false, &requestExecuted);
+  if (result == RESULT_OK || result == RESULT_ERR_TIMEOUT || result == RESULT_ERR_NOTAUTHORIZED) {
+    // anything else would not change the loaded state in loadScanConfig()
+    m_seenAddresses[dstAddress] |= LOAD_QUEUED;
+    *load = new DeferredScanLoad(dstAddress, result, requestExecuted, hasAdditionalScanMessages);
+  }
+  return result;
+}
+
+result_t BusHandler::loadScanConfig(const DeferredScanLoad* load) {
+  symbol_t dstAddress = load->m_address;
+  result_t result = load->m_result;
+  if ((m_seenAddresses[dstAddress]&LOAD_QUEUED) == 0) {
+    return RESULT_EMPTY;  // seen state was cleared meanwhile
+  }
+  m_seenAddresses[dstAddress] &= static_cast<symbol_t>(~LOAD_QUEUED);
+  string file;
+  bool timedOut = result == RESULT_ERR_TIMEOUT;
+  bool loadFailed = false;
+  if (timedOut || result == RESULT_OK) {
+    result = loadScanConfigFile(m_messages, dstAddress, false, &file);  // try to load even if one message timed out
+    loadFailed = result != RESULT_OK;
+    if (timedOut && loadFailed) {
+      result = RESULT_ERR_TIMEOUT;  // back to previous result
     }
-    if (result == RESULT_OK) {
-      executeInstructions(m_messages);
-      setScanConfigLoaded(dstAddress, file);
-      if (!hasAdditionalScanMessages && m_messages->hasAdditionalScanMessages()) {
-        // additional scan messages now available
-        scanAndWait(dstAddress, false, false);
-      }
-    } else if (loadFailed || (requestExecuted && timedOut) || result == RESULT_ERR_NOTAUTHORIZED) {
-      setScanConfigLoaded(dstAddress, "");
+  }
+  if (result == RESULT_OK) {
+    executeInstructions(m_messages);
+    setScanConfigLoaded(dstAddress, file);
+    if (!load->m_hadAdditionalScanMessages && m_messages->hasAdditionalScanMessages()) {
+      // additional scan messages now available
+      scanAndWait(dstAddress, false, false);
     }
+  } else if (loadFailed || (load->m_requestExecuted && timedOut) || result == RESULT_ERR_NOTAUTHORIZED) {
+    setScanConfigLoaded(dstAddress, "");
   }
   return result;
 }
 
+void BusHandler::formatMetrics(ostringstream* output) {
+  m_symbolLatencyHistogram.format("ebusd_bus_symbol_latency_seconds",
+      "Latency between sending and receiving back a symbol.", "", output);
+  m_arbitrationDelayHistogram.format("ebusd_bus_arbitration_delay_seconds",
+      "Delay between the received SYN and the sent own master address.", "", output);
+  m_sendTimeHistogram.format("ebusd_bus_send_duration_seconds",
+      "Time from queuing a request until its result is available including retries.", "", output);
+  m_busLostRetriesHistogram.format("ebusd_bus_request_retries",
+      "Number of retries due to lost arbitration per finished request.", "", output);
+  m_queueDepthHistogram.format("ebusd_bus_queue_depth",
+      "Number of requests already queued when adding a new one.", "", output);
+  m_pollStalenessHistogram.format("ebusd_bus_poll_staleness_seconds",
+      "Time since the last update of a message when it is polled.", "", output);
+  for (size_t lane = 0; lane < REQUEST_LANE_COUNT; lane++) {
+    m_laneWaitHistograms[lane]->format("ebusd_bus_queue_wait_seconds",
+        lane == 0 ? "Time a request waited in its queue lane until it was handled." : nullptr,
+        string("lane=\"") + getRequestLaneName(static_cast<RequestLane>(lane)) + "\"", output);
+  }
+  formatMetricHeader("ebusd_bus_queue_size", "gauge", "Number of currently queued requests.", output);
+  formatMetricValue("ebusd_bus_queue_size", "", static_cast<double>(m_nextRequests.size()), output);
+  m_symbolsReceived.format("ebusd_bus_symbols_received", "Number of received symbols.", output);
+  m_crcErrors.format("ebusd_bus_crc_errors", "Number of CRC errors in received or sent telegrams.", output);
+  m_arbitrationLost.format("ebusd_bus_arbitration_lost", "Number of lost arbitrations.", output);
+  m_pipelinedRequests.format("ebusd_bus_pipelined_requests",
+      "Number of own requests prepared during and arbitrated directly after the previous one.", output);
+  m_missedDeadlines.format("ebusd_bus_missed_deadlines",
+      "Number of times the bus thread was not waiting for the next symbol in time while arbitrating.", output);
+  m_lateWakeups.format("ebusd_bus_late_wakeups",
+      "Number of times waiting for a symbol returned more than a symbol duration after the timeout.", output);
+  formatMetricHeader("ebusd_bus_symbol_rate", "gauge", "Number of received symbols in the last second.", output);
+  formatMetricValue("ebusd_bus_symbol_rate", "", m_symPerSec, output);
+  formatMetricHeader("ebusd_bus_signal", "gauge", "Whether a signal on the bus is available.", output);
+  formatMetricValue("ebusd_bus_signal", "", hasSignal() ? 1 : 0, output);
+}
+
 bool BusHandler::enableGrab(bool enable) {
   if (enable == m_grabMessages) {
     return false;
   }
   if (!enable) {
+    m_grabMutex.lock();
     m_grabbedMessages.clear();
+    m_grabMutex.unlock();
   }
   m_grabMessages = enable;
   return true;
@@ -1610,21 +2324,21 @@ void BusHandler::formatGrabResult(bool unknown, bool decode, ostringstream* outp
     return;
   }
   bool first = true;
-  for (const auto& it : m_grabbedMessages) {
-    if ((since > 0 && it.second.getLastTime() < since)
-    || (until > 0 && it.second.getLastTime() >= until)) {
-      continue;
-    }
-    if (it.second.dump(unknown, m_messages, first, decode, output, isDirectMode)) {
+  vector<const GrabbedMessage*> grabbed;
+  m_grabMutex.lock();
+  m_grabbedMessages.collect(since, until, &grabbed);
+  for (const auto it : grabbed) {
+    if (it->dump(unknown, m_messages, first, decode, output, isDirectMode)) {
       first = false;
     }
   }
+  m_grabMutex.unlock();
   if (isDirectMode && !first) {
     *output << endl;
   }
 }
 
-symbol_t BusHandler::getNextScanAddress(symbol_t lastAddress) const {
+symbol_t BusHandler::getNextScanAddress(symbol_t lastAddress, bool seenOnly) const {
   if (lastAddress == SYN) {
     return SYN;
   }
@@ -1632,20 +2346,48 @@ symbol_t BusHandler::getNextScanAddress(symbol_t lastAddress) const {
     if (!isValidAddress(lastAddress, false) || isMaster(lastAddress)) {
       continue;
     }
-    if ((m_seenAddresses[lastAddress]&(SEEN|LOAD_INIT)) == SEEN) {
+    symbol_t state = m_seenAddresses[lastAddress];
+    if ((state&(LOAD_INIT|LOAD_QUEUED)) != 0) {
+      continue;
+    }
+    if ((state&SEEN) != 0) {
       return lastAddress;
     }
-    symbol_t master = getMasterAddress(lastAddress);
-    if (master == SYN || (m_seenAddresses[master]&SEEN) == 0) {
+    if (seenOnly) {
       continue;
     }
-    if ((m_seenAddresses[lastAddress]&LOAD_INIT) == 0) {
+    symbol_t master = getMasterAddress(lastAddress);
+    if (master != SYN && (m_seenAddresses[master]&SEEN) != 0) {
       return lastAddress;
     }
   }
   return SYN;
 }
 
+unsigned int BusHandler::getScanProgress(unsigned int* loaded, unsigned int* queued) const {
+  unsigned int total = 0;
+  *loaded = *queued = 0;
+  for (symbol_t address = 1; address != 0; address++) {  // 0 is known to be a master
+    if (!isValidAddress(address, false) || isMaster(address)) {
+      continue;
+    }
+    symbol_t state = m_seenAddresses[address];
+    if ((state&SEEN) == 0) {
+      symbol_t master = getMasterAddress(address);
+      if (master == SYN || (m_seenAddresses[master]&SEEN) == 0) {
+        continue;
+      }
+    }
+    total++;
+    if ((state&LOAD_INIT) != 0) {
+      (*loaded)++;
+    } else if ((state&LOAD_QUEUED) != 0) {
+      (*queued)++;
+    }
+  }
+  return total;
+}
+
 void BusHandler::setScanConfigLoaded(symbol_t address, const string& file) {
   m_seenAddresses[address] |= LOAD_INIT;
   if (!file.empty()) {
@@ -1654,4 +2396,22 @@ void BusHandler::setScanConfigLoaded(symbol_t address, const string& file) {
   }
 }
 
+void BusHandler::prepareScanConfigReload(vector<symbol_t>* loadedAddresses) {
+  for (symbol_t address = 1; address != 0; address++) {  // 0 is known to be a master
+    if (!isValidAddress(address, false) || isMaster(address)) {
+      continue;
+    }
+    symbol_t state = m_seenAddresses[address];
+    if ((state&LOAD_DONE) != 0) {
+      loadedAddresses->push_back(address);
+    } else if ((state&LOAD_INIT) != 0) {
+      resetScanConfigLoaded(address);
+    }
+  }
+}
+
+void BusHandler::resetScanConfigLoaded(symbol_t address) {
+  m_seenAddresses[address] &= static_cast<symbol_t>(~(LOAD_INIT|LOAD_DONE));
+}
+
 }  // namespace ebusd
@@ -20,16 +20,20 @@
 #define EBUSD_BUSHANDLER_H_
 
 #include <pthread.h>
+#include <sched.h>
 #include <stdint.h>
+#include <atomic>
 #include <string>
 #include <vector>
 #include <map>
 #include <deque>
+#include <list>
 #include "lib/ebus/message.h"
 #include "lib/ebus/data.h"
 #include "lib/ebus/symbol.h"
 #include "lib/ebus/result.h"
 #include "lib/ebus/device.h"
+#include "lib/utils/metrics.h"
 #include "lib/utils/queue.h"
 #include "lib/utils/thread.h"
 
@@ -63,6 +67,18 @@ using std::string;
 /** the maximum allowed time [ms] for retrieving back a sent symbol (2x symbol duration). */
 #define SEND_TIMEOUT ((int)((2*SYMBOL_DURATION_MICROS+999)/1000))
 
+/** the number of new measurements after which the auto-tuned timing is recalculated. */
+#define AUTOTUNE_INTERVAL 32
+
+/** the percentile of the measurements the auto-tuned timing is based on. */
+#define AUTOTUNE_PERCENTILE 99
+
+/** the maximum auto-tuned device latency [ms] unless a higher one is configured. */
+#define AUTOTUNE_MAX_LATENCY 200
+
+/** the symbol rate per second below which the poll interval is shortened to make use of the idle bus time. */
+#define POLL_IDLE_SYMBOL_RATE 60
+
 /** the possible bus states. */
 enum BusState {
   bs_noSignal,  //!< no signal on the bus
@@ -98,8 +114,29 @@ enum BusState {
 /** bit for the seen state: configuration loaded. */
 #define LOAD_DONE 0x10
 
+/** bit for the seen state: configuration loading queued. */
+#define LOAD_QUEUED 0x20
+
 class BusHandler;
 
+/** the lanes of the @a BusHandler request queue in descending priority. */
+enum RequestLane {
+  rl_write,  //!< writes and other directly sent messages
+  rl_read,   //!< interactive reads
+  rl_poll,   //!< poll requests
+  rl_scan,   //!< scan requests
+};
+
+/** the number of @a RequestLane values. */
+#define REQUEST_LANE_COUNT 4
+
+/**
+ * Return the name of the @a RequestLane.
+ * @param lane the @a RequestLane.
+ * @return the name of the @a RequestLane.
+ */
+const char* getRequestLaneName(RequestLane lane);
+
 /**
  * Generic request for sending to and receiving from the bus.
  */
@@ -111,10 +148,11 @@ class BusRequest {
    * Constructor.
    * @param master the master data @a MasterSymbolString to send.
    * @param deleteOnFinish whether to automatically delete this @a BusRequest when finished.
+   * @param lane the @a RequestLane to queue this @a BusRequest in.
    */
-  BusRequest(const MasterSymbolString& master, bool deleteOnFinish)
+  BusRequest(const MasterSymbolString& master, bool deleteOnFinish, RequestLane lane)
     : m_master(master), m_busLostRetries(0),
-      m_deleteOnFinish(deleteOnFinish) {}
+      m_deleteOnFinish(deleteOnFinish), m_lane(lane) {}
 
   /**
    * Destructor.
@@ -139,6 +177,9 @@ class BusRequest {
 
   /** whether to automatically delete this @a BusRequest when finished. */
   const bool m_deleteOnFinish;
+
+  /** the @a RequestLane to queue this @a BusRequest in. */
+  const RequestLane m_lane;
 };
 
 
@@ -151,10 +192,11 @@ class PollRequest : public BusRequest {
  public:
   /**
    * Constructor.
+   * @param messageMap the @a MessageMap instance.
    * @param message the associated @a Message.
    */
-  explicit PollRequest(Message* message)
-    : BusRequest(m_master, true), m_message(message), m_index(0) {}
+  PollRequest(MessageMap* messageMap, Message* message)
+    : BusRequest(m_master, true, rl_poll), m_messageMap(messageMap), m_message(message), m_index(0) {}
 
   /**
    * Destructor.
@@ -176,6 +218,9 @@ class PollRequest : public BusRequest {
   /** the master data @a MasterSymbolString. */
   MasterSymbolString m_master;
 
+  /** the @a MessageMap instance. */
+  MessageMap* m_messageMap;
+
   /** the associated @a Message. */
   Message* m_message;
 
@@ -202,7 +247,7 @@ class ScanRequest : public BusRequest {
    */
   ScanRequest(bool deleteOnFinish, MessageMap* messageMap, const deque<Message*>& messages,
       const deque<symbol_t>& slaves, BusHandler* busHandler, size_t notifyIndex = 0)
-    : BusRequest(m_master, deleteOnFinish), m_messageMap(messageMap), m_index(0), m_allMessages(messages),
+    : BusRequest(m_master, deleteOnFinish, rl_scan), m_messageMap(messageMap), m_index(0), m_allMessages(messages),
       m_messages(messages), m_slaves(slaves), m_busHandler(busHandler), m_notifyIndex(notifyIndex),
       m_result(RESULT_ERR_NO_SIGNAL) {
     m_message = m_messages.front();
@@ -258,6 +303,20 @@ class ScanRequest : public BusRequest {
 };
 
 
+class ActiveBusRequest;
+
+/**
+ * A requester attached to an identical pending @a ActiveBusRequest of another requester. The result is copied over
+ * to the follower, so that the owner never has to wait for its followers.
+ */
+struct SharedFollower {
+  ActiveBusRequest* owner;   //!< the @a ActiveBusRequest attached to (only valid while not finished)
+  SlaveSymbolString* slave;  //!< the @a SlaveSymbolString in which to store the received slave data
+  result_t result;           //!< the result of the shared request
+  bool finished;             //!< whether the shared request is finished
+};
+
+
 /**
  * An active @a BusRequest that can be waited for.
  */
@@ -269,9 +328,10 @@ class ActiveBusRequest : public BusRequest {
    * Constructor.
    * @param master the master data @a MasterSymbolString to send.
    * @param slave reference to @a SlaveSymbolString for filling in the received slave data.
+   * @param lane the @a RequestLane to queue this @a ActiveBusRequest in.
    */
-  ActiveBusRequest(const MasterSymbolString& master, SlaveSymbolString* slave)
-    : BusRequest(master, false), m_result(RESULT_ERR_NO_SIGNAL), m_slave(slave) {}
+  ActiveBusRequest(const MasterSymbolString& master, SlaveSymbolString* slave, RequestLane lane)
+    : BusRequest(master, false, lane), m_result(RESULT_ERR_NO_SIGNAL), m_slave(slave) {}
 
   /**
    * Destructor.
@@ -288,6 +348,9 @@ class ActiveBusRequest : public BusRequest {
 
   /** reference to @a SlaveSymbolString for filling in the received slave data. */
   SlaveSymbolString* m_slave;
+
+  /** the other requesters waiting for the result of this shared request. */
+  vector<SharedFollower*> m_followers;
 };
 
 
@@ -305,11 +368,21 @@ class GrabbedMessage {
    * Copy constructor.
    * @param other the @a GrabbedMessage to copy from.
    */
-  GrabbedMessage(const GrabbedMessage& other) : m_count(other.m_count) {
+  GrabbedMessage(const GrabbedMessage& other) : m_lastTime(other.m_lastTime), m_count(other.m_count) {
     m_lastMaster = other.m_lastMaster;
     m_lastSlave = other.m_lastSlave;
   }
 
+  /**
+   * Forget the received data and reset the message count.
+   */
+  void clear() {
+    m_lastTime = 0;
+    m_lastMaster.clear();
+    m_lastSlave.clear();
+    m_count = 0;
+  }
+
   /**
    * Set the last received data.
    * @param master the last @a MasterSymbolString.
@@ -327,7 +400,7 @@ class GrabbedMessage {
    * Get the last @a MasterSymbolString.
    * @return the last @a MasterSymbolString.
    */
-  MasterSymbolString& getLastMasterData() { return m_lastMaster; }
+  const MasterSymbolString& getLastMasterData() const { return m_lastMaster; }
 
   /**
    * Dump the last received data and message count to the output.
@@ -358,6 +431,161 @@ class GrabbedMessage {
 };
 
 
+/** the maximum number of distinct messages kept in a @a GrabStore. */
+#define GRAB_STORE_CAPACITY 1024
+
+/**
+ * A bounded store of @a GrabbedMessage instances by key that evicts the least recently seen message when full.
+ * The entries are allocated once in a contiguous array, found by key via an open addressing table, and kept in a
+ * list ordered by last seen time so that looking up recent messages only touches those.
+ */
+class GrabStore {
+ public:
+  /**
+   * Construct a new empty instance.
+   * @param capacity the maximum number of messages to keep.
+   */
+  explicit GrabStore(size_t capacity = GRAB_STORE_CAPACITY)
+    : m_capacity(capacity), m_size(0), m_newest(0), m_oldest(0), m_evicted(0),
+      m_shift(64) {}
+
+  /**
+   * Update the last received data of the message with the key (adding or evicting as needed).
+   * @param key the key of the message.
+   * @param master the last @a MasterSymbolString.
+   * @param slave the last @a SlaveSymbolString.
+   */
+  void update(uint64_t key, const MasterSymbolString& master, const SlaveSymbolString& slave);
+
+  /**
+   * Collect the messages by ascending key.
+   * @param since the start time from which to collect, or 0 for all.
+   * @param until the end time to which to collect (exclusive), or 0 for all.
+   * @param found the vector to add the @a GrabbedMessage instances to.
+   */
+  void collect(time_t since, time_t until, vector<const GrabbedMessage*>* found) const;
+
+  /**
+   * Remove all messages.
+   */
+  void clear();
+
+  /**
+   * Get the number of stored messages.
+   * @return the number of stored messages.
+   */
+  size_t size() const { return m_size; }
+
+  /**
+   * Get the number of messages evicted so far for making room.
+   * @return the number of evicted messages.
+   */
+  size_t getEvictedCount() const { return m_evicted; }
+
+
+ private:
+  /**
+   * A single stored message.
+   */
+  struct Entry {
+    /** the key of the message. */
+    uint64_t m_key;
+
+    /** the @a GrabbedMessage. */
+    GrabbedMessage m_message;
+
+    /** the number of the next newer @a Entry, or 0 for the newest. */
+    uint32_t m_newer;
+
+    /** the number of the next older @a Entry, or 0 for the oldest. */
+    uint32_t m_older;
+  };
+
+  /**
+   * Get the preferred bucket position for the key.
+   * @param key the key of the message.
+   * @return the preferred bucket position.
+   */
+  size_t getSlot(uint64_t key) const {
+    return static_cast<size_t>((key * 0x9e3779b97f4a7c15ULL) >> m_shift);
+  }
+
+  /**
+   * Find the bucket position of the key.
+   * @param key the key of the message.
+   * @return the bucket position of the key, or of the empty bucket where to insert it.
+   */
+  size_t findBucket(uint64_t key) const;
+
+  /**
+   * Remove the bucket at the specified position.
+   * @param pos the bucket position.
+   */
+  void eraseBucket(size_t pos);
+
+  /**
+   * Unlink the @a Entry from the list ordered by last seen time.
+   * @param number the number of the @a Entry.
+   */
+  void unlink(uint32_t number);
+
+  /** the maximum number of messages. */
+  const size_t m_capacity;
+
+  /** the number of stored messages. */
+  size_t m_size;
+
+  /** the number of the newest @a Entry, or 0. */
+  uint32_t m_newest;
+
+  /** the number of the oldest @a Entry, or 0. */
+  uint32_t m_oldest;
+
+  /** the number of messages evicted so far. */
+  size_t m_evicted;
+
+  /** the shift for getting the bucket position from the hashed key. */
+  unsigned int m_shift;
+
+  /** the entries (allocated to @a m_capacity on first use, the @a Entry number is the index plus one). */
+  vector<Entry> m_entries;
+
+  /** the buckets with the @a Entry number, or 0 for an empty bucket (size is a power of two, or zero). */
+  vector<uint32_t> m_buckets;
+};
+
+
+/**
+ * The outcome of a scan for a single slave whose configuration is to be loaded later on by
+ * @a BusHandler::loadScanConfig().
+ */
+class DeferredScanLoad {
+ public:
+  /**
+   * Constructor.
+   * @param address the scanned slave address.
+   * @param result the result code of the scan.
+   * @param requestExecuted whether the scan request was executed on the bus.
+   * @param hadAdditionalScanMessages whether additional scan messages were available before the scan.
+   */
+  DeferredScanLoad(symbol_t address, result_t result, bool requestExecuted, bool hadAdditionalScanMessages)
+    : m_address(address), m_result(result), m_requestExecuted(requestExecuted),
+      m_hadAdditionalScanMessages(hadAdditionalScanMessages) {}
+
+  /** the scanned slave address. */
+  const symbol_t m_address;
+
+  /** the result code of the scan. */
+  const result_t m_result;
+
+  /** whether the scan request was executed on the bus. */
+  const bool m_requestExecuted;
+
+  /** whether additional scan messages were available before the scan. */
+  const bool m_hadAdditionalScanMessages;
+};
+
+
 /**
  * Handles input from and output to the bus with respect to the eBUS protocol.
  */
@@ -376,13 +604,17 @@ class BusHandler : public WaitThread {
    * @param lockCount the number of AUTO-SYN symbols before sending is allowed after lost arbitration, or 0 for auto detection.
    * @param generateSyn whether to enable AUTO-SYN symbol generation.
    * @param pollInterval the interval in seconds in which poll messages are cycled, or 0 if disabled.
+   * @param adaptPollInterval whether to shorten the poll interval while the bus is mostly idle.
+   * @param pipeline whether to prepare the next own request while the current one is still running and to
+   * arbitrate for it directly on the next SYN.
+   * @param autoTune whether to adjust the device latency and the slave receive timeout to the measured timing.
    */
   BusHandler(Device* device, MessageMap* messages,
       symbol_t ownAddress, bool answer,
       unsigned int busLostRetries, unsigned int failedSendRetries,
       unsigned int busAcquireTimeout, unsigned int slaveRecvTimeout,
       unsigned int lockCount, bool generateSyn,
-      unsigned int pollInterval)
+      unsigned int pollInterval, bool adaptPollInterval, bool pipeline, bool autoTune = false)
     : WaitThread(), m_device(device), m_reconnect(false), m_messages(messages),
       m_ownMasterAddress(ownAddress), m_ownSlaveAddress(getSlaveAddress(ownAddress)),
       m_answer(answer), m_addressConflict(false),
@@ -391,15 +623,35 @@ class BusHandler : public WaitThread {
       m_masterCount(device->isReadOnly()?0:1), m_autoLockCount(lockCount == 0),
       m_lockCount(lockCount <= 3 ? 3 : lockCount), m_remainLockCount(m_autoLockCount ? 1 : 0),
       m_generateSynInterval(generateSyn ? SYN_TIMEOUT*getMasterNumber(ownAddress)+SYMBOL_DURATION : 0),
-      m_pollInterval(pollInterval), m_symbolLatencyMin(-1), m_symbolLatencyMax(-1), m_arbitrationDelayMin(-1),
-      m_arbitrationDelayMax(-1), m_lastReceive(0), m_lastPoll(0),
+      m_pollInterval(pollInterval), m_adaptPollInterval(adaptPollInterval), m_pipeline(pipeline), m_nextPrepared(false),
+      m_autoTune(autoTune), m_effectiveSlaveRecvTimeout(slaveRecvTimeout), m_symbolLatencySamples(0),
+      m_answerDelaySamples(0),
+      m_symbolLatencyMin(-1), m_symbolLatencyMax(-1), m_arbitrationDelayMin(-1), m_arbitrationDelayMax(-1), m_lastReceive(0), m_lastPoll(0),
       m_currentRequest(nullptr), m_currentAnswering(false), m_runningScans(0), m_nextSendPos(0),
-      m_symPerSec(0), m_maxSymPerSec(0),
+      m_symPerSec(0), m_symPerSecMeasured(false), m_maxSymPerSec(0),
       m_state(bs_noSignal), m_escape(0), m_crc(0), m_crcValid(false), m_repeat(false),
-      m_grabMessages(true) {
-    memset(m_seenAddresses, 0, sizeof(m_seenAddresses));
+      m_grabMessages(true),
+      m_symbolLatencyHistogram({500, 1000, 2000, 5000, 10000, 20000, 50000, 100000, 200000, 500000, 1000000},
+        0.000001),
+      m_arbitrationDelayHistogram({100, 200, 300, 500, 1000, 2000, 5000, 10000}, 0.000001),
+      m_sendTimeHistogram({20, 50, 100, 200, 500, 1000, 2000, 5000, 10000, 30000}, 0.001),
+      m_busLostRetriesHistogram({0, 1, 2, 3, 5, 10}),
+      m_queueDepthHistogram({0, 1, 2, 3, 5, 10, 20, 50}),
+      m_pollStalenessHistogram({10, 30, 60, 120, 300, 600, 1800, 3600, 7200, 86400}),
+      m_schedPolicy(SCHED_OTHER), m_schedPriority(0), m_schedCpu(-1), m_lockMemory(false) {
+    for (size_t lane = 0; lane < REQUEST_LANE_COUNT; lane++) {
+      m_laneWaitHistograms[lane] = new Histogram({5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000, 30000},
+        0.001);
+    }
+    pthread_mutex_init(&m_sharedMutex, nullptr);
+    pthread_cond_init(&m_sharedCond, nullptr);
+    for (auto& seen : m_seenAddresses) {
+      seen = 0;
+    }
     m_lastSynReceiveTime.tv_sec = 0;
     m_lastSynReceiveTime.tv_nsec = 0;
+    m_lastRecvEnd.tv_sec = 0;
+    m_lastRecvEnd.tv_nsec = 0;
   }
 
   /**
@@ -421,6 +673,11 @@ class BusHandler : public WaitThread {
       delete m_currentRequest;
       m_currentRequest = nullptr;
     }
+    for (size_t lane = 0; lane < REQUEST_LANE_COUNT; lane++) {
+      delete m_laneWaitHistograms[lane];
+    }
+    pthread_mutex_destroy(&m_sharedMutex);
+    pthread_cond_destroy(&m_sharedCond);
   }
 
   /**
@@ -445,9 +702,12 @@ class BusHandler : public WaitThread {
    * Send a message on the bus and wait for the answer.
    * @param master the @a MasterSymbolString with the master data to send.
    * @param slave the @a SlaveSymbolString that will be filled with retrieved slave data.
+   * @param shared whether the request may be shared with other identical shared requests already pending, i.e.
+   * instead of sending the same master data again, the answer of the pending request is used (this also queues
+   * the request in the read lane instead of the write lane).
    * @return the result code.
    */
-  result_t sendAndWait(const MasterSymbolString& master, SlaveSymbolString* slave);
+  result_t sendAndWait(const MasterSymbolString& master, SlaveSymbolString* slave, bool shared = false);
 
   /**
    * Prepare the master part for the @a Message, send it to the bus and wait for the answer.
@@ -460,6 +720,26 @@ class BusHandler : public WaitThread {
   result_t readFromBus(Message* message, const string& inputStr, symbol_t dstAddress = SYN,
       symbol_t srcAddress = SYN);
 
+  /**
+   * Prepare the master part for the @a Message from typed values, send it to the bus and wait for the answer.
+   * @param message the @a Message instance.
+   * @param values the @a FieldValues indexed by master field (excluding ignored fields).
+   * @param dstAddress the destination address to set, or @a SYN to keep the address defined during construction.
+   * @param srcAddress the source address to set, or @a SYN for the own master address.
+   * @return the result code.
+   */
+  result_t readFromBus(Message* message, const FieldValues& values, symbol_t dstAddress = SYN,
+      symbol_t srcAddress = SYN);
+
+  /**
+   * Read several @a Message instances without master values from the bus at once.
+   * The single part messages are queued together so that the bus can handle them back to back, while identical
+   * pending reads are shared as with @a sendAndWait(). A @a Message passed several times is only read once.
+   * @param messages the @a Message instances to read.
+   * @param results the @a vector in which to store the result code for each @a Message.
+   */
+  void readFromBus(const vector<Message*>& messages, vector<result_t>* results);
+
   /**
    * Main thread entry.
    */
@@ -473,6 +753,19 @@ class BusHandler : public WaitThread {
    */
   result_t startScan(bool full, const string& levels);
 
+  /**
+   * Initiate a scan of the identification of a single slave address without waiting for the answer.
+   * @param slave the slave address to scan.
+   * @return the result code.
+   */
+  result_t startScan(symbol_t slave);
+
+  /**
+   * Return whether a scan is currently running.
+   * @return whether a scan is currently running.
+   */
+  bool isScanRunning() const { return m_runningScans > 0; }
+
   /**
    * Set the scan result @a string for a scanned slave address.
    * @param dstAddress the scanned slave address.
@@ -513,6 +806,49 @@ class BusHandler : public WaitThread {
    */
   void formatUpdateInfo(ostringstream* output) const;
 
+  /**
+   * Format the bus metrics in the Prometheus text exposition format to the @a ostringstream.
+   * @param output the @a ostringstream to append the metrics to.
+   */
+  void formatMetrics(ostringstream* output);
+
+  /**
+   * Set the scheduling parameters of a @a RequestLane.
+   * @param lane the @a RequestLane.
+   * @param weight the number of consecutive requests taken from the lane while a lower lane is waiting.
+   * @param maxWait the maximum time in milliseconds a request may wait before its lane is preferred over all
+   * others, or 0 for no limit.
+   */
+  void setRequestLane(RequestLane lane, unsigned int weight, unsigned int maxWait) {
+    m_nextRequests.setLane(lane, weight, maxWait);
+  }
+
+  /**
+   * Set the scheduling of the bus thread (including the @a Device reads) to apply when it is started.
+   * @param policy the scheduling policy (SCHED_FIFO or SCHED_RR), or SCHED_OTHER to keep the scheduling.
+   * @param priority the realtime priority.
+   * @param cpu the CPU to pin the thread to, or -1 to keep the affinity.
+   * @param lockMemory whether to lock the memory of the process and prefault the stack of the thread.
+   */
+  void setScheduling(int policy, int priority, int cpu, bool lockMemory) {
+    m_schedPolicy = policy;
+    m_schedPriority = priority;
+    m_schedCpu = cpu;
+    m_lockMemory = lockMemory;
+  }
+
+  /**
+   * Return the number of times the bus thread was not waiting for the next symbol in time while arbitrating.
+   * @return the number of missed arbitration deadlines.
+   */
+  uint64_t getMissedDeadlines() const { return m_missedDeadlines.get(); }
+
+  /**
+   * Return the number of times waiting for a symbol returned considerably later than the timeout.
+   * @return the number of late wakeups.
+   */
+  uint64_t getLateWakeups() const { return m_lateWakeups.get(); }
+
   /**
    * Send a scan message on the bus and wait for the answer.
    * @param dstAddress the destination slave address to send to.
@@ -522,6 +858,23 @@ class BusHandler : public WaitThread {
    */
   result_t scanAndWait(symbol_t dstAddress, bool loadScanConfig = false, bool reload = false);
 
+  /**
+   * Send a scan message on the bus and wait for the answer, but leave loading the message definitions matching the
+   * scan result to a later call of @a loadScanConfig() (e.g. from another thread).
+   * @param dstAddress the destination slave address to send to.
+   * @param load set to the new @a DeferredScanLoad to pass to @a loadScanConfig(), or nullptr if there is nothing
+   * to load.
+   * @return the result code of the scan.
+   */
+  result_t scanAndDeferLoad(symbol_t dstAddress, DeferredScanLoad** load);
+
+  /**
+   * Load the message definitions matching the scan result of a previous call to @a scanAndDeferLoad().
+   * @param load the @a DeferredScanLoad (remains in the ownership of the caller).
+   * @return the result code.
+   */
+  result_t loadScanConfig(const DeferredScanLoad* load);
+
   /**
    * Start or stop grabbing unknown messages.
    * @param enable true to enable grabbing, false to disable it.
@@ -594,6 +947,18 @@ class BusHandler : public WaitThread {
    */
   int getMaxArbitrationDelay() const { return m_arbitrationDelayMax; }
 
+  /**
+   * Return whether the device latency and the slave receive timeout are adjusted to the measured timing.
+   * @return whether the device latency and the slave receive timeout are adjusted to the measured timing.
+   */
+  bool isAutoTune() const { return m_autoTune; }
+
+  /**
+   * Return the effective time an addressed slave is expected to answer within.
+   * @return the effective slave receive timeout in milliseconds.
+   */
+  unsigned int getSlaveRecvTimeout() const { return m_effectiveSlaveRecvTimeout; }
+
   /**
    * Return the number of masters already seen.
    * @return the number of masters already seen (including ebusd itself).
@@ -601,11 +966,21 @@ class BusHandler : public WaitThread {
   unsigned int getMasterCount() const { return m_masterCount; }
 
   /**
-   * Get the next slave address that still needs to be scanned or loaded.
+   * Get the next slave address that still needs to be scanned or loaded and is not already queued for loading.
    * @param lastAddress the last returned slave address, or 0 for returning the first one.
+   * @param seenOnly true to return only slave addresses seen on the bus themselves, false to also return the slave
+   * addresses of seen masters.
    * @return the next slave address that still needs to be scanned or loaded, or @a SYN.
    */
-  symbol_t getNextScanAddress(symbol_t lastAddress) const;
+  symbol_t getNextScanAddress(symbol_t lastAddress, bool seenOnly = false) const;
+
+  /**
+   * Get the progress of scanning and loading the slave addresses returned by @a getNextScanAddress().
+   * @param loaded set to the number of slave addresses with the configuration loading finished.
+   * @param queued set to the number of slave addresses with the configuration loading queued.
+   * @return the total number of slave addresses to scan and load.
+   */
+  unsigned int getScanProgress(unsigned int* loaded, unsigned int* queued) const;
 
   /**
    * Set the state of the participant to configuration @a LOADED.
@@ -614,8 +989,149 @@ class BusHandler : public WaitThread {
    */
   void setScanConfigLoaded(symbol_t address, const string& file);
 
+  /**
+   * Prepare the configuration state of the participants for reloading the configuration files: collect the slave
+   * addresses with a loaded configuration file and reset the state of those without one to be scanned for again.
+   * @param loadedAddresses the vector to add the slave addresses with a loaded configuration file to.
+   */
+  void prepareScanConfigReload(vector<symbol_t>* loadedAddresses);
+
+  /**
+   * Reset the configuration state of the participant so that it is scanned for and loaded again.
+   * @param address the slave address.
+   */
+  void resetScanConfigLoaded(symbol_t address);
+
 
  private:
+  /**
+   * Send a scan message on the bus and wait for the answer.
+   * @param dstAddress the destination slave address to send to.
+   * @param reload true to fully reload the scan results, false when the slave ID was already retrieved.
+   * @param requestExecuted set to true when the scan request was executed on the bus.
+   * @return the result code.
+   */
+  result_t sendScanAndWait(symbol_t dstAddress, bool reload, bool* requestExecuted);
+
+  /**
+   * Prepare all master parts for the @a Message, send them to the bus and wait for the answers.
+   * @param message the @a Message instance.
+   * @param inputStr the input @a string from which to read master values, or nullptr to use @p values.
+   * @param values the @a FieldValues to use when @p inputStr is nullptr.
+   * @param dstAddress the destination address to set, or @a SYN to keep the address defined during construction.
+   * @param srcAddress the source address to set, or @a SYN for the own master address.
+   * @return the result code.
+   */
+  result_t readPartsFromBus(Message* message, const string* inputStr, const FieldValues* values,
+      symbol_t dstAddress, symbol_t srcAddress);
+
+  /**
+   * Send all prepared read parts of a multi-part @a Message to the bus back to back and wait for the answers.
+   * Each part is retried on its own and stored as soon as it arrived, so that the parts are only combined when
+   * all of them were received within the maximum time difference of the @a Message.
+   * @param message the @a Message instance.
+   * @param masters the prepared @a MasterSymbolString of each part.
+   * @return the result code.
+   */
+  result_t readChainedFromBus(Message* message, const vector<MasterSymbolString>& masters);
+
+  /**
+   * Share the result of an identical pending request, or register the @a ActiveBusRequest for sharing otherwise.
+   * Note: this blocks until the identical pending request is finished, so it may only be called while not having
+   * any other unfinished shared @a ActiveBusRequest registered.
+   * @param request the @a ActiveBusRequest to share.
+   * @param result the variable in which to store the result code of the identical pending request.
+   * @return true when the result of an identical pending request was taken, false when the @a ActiveBusRequest
+   * was registered and needs to be executed.
+   */
+  bool shareRequest(ActiveBusRequest* request, result_t* result);
+
+  /**
+   * Store the result of a single part @a Message read in a batch.
+   * @param message the @a Message instance.
+   * @param result the result code of the bus request.
+   * @param slave the received @a SlaveSymbolString.
+   * @return the result code.
+   */
+  result_t storeBatchResult(Message* message, result_t result, const SlaveSymbolString& slave);
+
+  /**
+   * Attach to an identical pending request without waiting for it, or register the @a ActiveBusRequest for sharing
+   * otherwise.
+   * @param request the @a ActiveBusRequest to share.
+   * @param follower the @a SharedFollower to attach when an identical pending request was found (has to stay valid
+   * until finished or released).
+   * @return true when the @a SharedFollower was attached to an identical pending request, false when the
+   * @a ActiveBusRequest was registered and needs to be executed.
+   */
+  bool attachRequest(ActiveBusRequest* request, SharedFollower* follower);
+
+  /**
+   * Wait for the identical pending request a @a SharedFollower was attached to.
+   * @param follower the @a SharedFollower attached in @a attachRequest().
+   * @return the result code of the identical request.
+   */
+  result_t waitForFollower(SharedFollower* follower);
+
+  /**
+   * Detach a @a SharedFollower from the identical pending request when the result is no longer needed.
+   * @param follower the @a SharedFollower attached in @a attachRequest().
+   */
+  void releaseFollower(SharedFollower* follower);
+
+  /**
+   * Wait for the result of an @a ActiveBusRequest including retries.
+   * @param request the @a ActiveBusRequest to wait for.
+   * @param shared whether the @a ActiveBusRequest was registered in @a shareRequest().
+   * @param queued whether the @a ActiveBusRequest was already queued.
+   * @param startTime the time the request was started.
+   * @return the result code.
+   */
+  result_t waitForRequest(ActiveBusRequest* request, bool shared, bool queued, const struct timespec& startTime);
+
+  /**
+   * Set the result of a shared @a ActiveBusRequest and pass it to the attached requesters.
+   * @param request the @a ActiveBusRequest registered in @a shareRequest().
+   * @param result the result code.
+   */
+  void finishSharedRequest(ActiveBusRequest* request, result_t result);
+
+  /**
+   * Cancel a queued shared @a ActiveBusRequest that is no longer needed, or wait for it when already being sent.
+   * @param request the @a ActiveBusRequest registered in @a shareRequest() and queued.
+   */
+  void cancelRequest(ActiveBusRequest* request);
+
+  /**
+   * Add a @a BusRequest to the end of its lane in the queue.
+   * @param request the @a BusRequest to add.
+   */
+  void queueRequest(BusRequest* request) { m_nextRequests.push(request, request->m_lane); }
+
+  /**
+   * Remove a @a BusRequest from the queue for handling it and record the time it waited.
+   * @param request the @a BusRequest to remove.
+   * @return whether the @a BusRequest was removed.
+   */
+  bool takeRequest(BusRequest* request);
+
+  /**
+   * Return the @a BusRequest to be started next, queuing the next poll request if due and nothing else is queued.
+   * @return the @a BusRequest to be started next, or nullptr.
+   */
+  BusRequest* peekNextRequest();
+
+  /**
+   * Start the arbitration for the @a BusRequest and notify it on failure.
+   * @param startRequest the @a BusRequest to start the arbitration for.
+   */
+  void startArbitration(BusRequest* startRequest);
+
+  /**
+   * Prepare the next @a BusRequest while the current one is still running (only in pipeline mode).
+   */
+  void prepareNextRequest();
+
   /**
    * Handle the next symbol on the bus.
    * @return RESULT_OK on success, or an error code.
@@ -645,6 +1161,23 @@ class BusHandler : public WaitThread {
    */
   void measureLatency(struct timespec* sentTime, struct timespec* recvTime);
 
+  /**
+   * Called to measure the delay until an addressed slave started answering.
+   * @param waitTime the time waiting for the answer was started.
+   * @param recvTime the time the first symbol of the answer was received.
+   */
+  void measureAnswerDelay(struct timespec* waitTime, struct timespec* recvTime);
+
+  /**
+   * Adjust the device latency to the measured symbol latency.
+   */
+  void tuneLatency();
+
+  /**
+   * Adjust the slave receive timeout to the measured answer delay.
+   */
+  void tuneSlaveRecvTimeout();
+
   /**
    * Called when a message sending or reception was successfully completed.
    */
@@ -657,9 +1190,11 @@ class BusHandler : public WaitThread {
    * @param levels the current user's access levels.
    * @param reload true to force sending the scan message, false to send only if necessary (only for single slave).
    * @param request the created @a ScanRequest (may be nullptr with positive result if scan is not needed).
+   * @param background true to delete the @a ScanRequest of a single slave when finished instead of waiting for it.
    * @return the result code.
    */
-  result_t prepareScan(symbol_t slave, bool full, const string& levels, bool* reload, ScanRequest** request);
+  result_t prepareScan(symbol_t slave, bool full, const string& levels, bool* reload, ScanRequest** request,
+      bool background = false);
 
   /** the @a Device instance for accessing the bus. */
   Device* m_device;
@@ -712,6 +1247,33 @@ class BusHandler : public WaitThread {
   /** the interval in seconds in which poll messages are cycled, or 0 if disabled. */
   const unsigned int m_pollInterval;
 
+  /** whether to shorten the poll interval while the bus is mostly idle. */
+  const bool m_adaptPollInterval;
+
+  /** whether to prepare the next own request while the current one is still running. */
+  const bool m_pipeline;
+
+  /** whether the next request was prepared while the current one was running. */
+  bool m_nextPrepared;
+
+  /** whether to adjust the device latency and the slave receive timeout to the measured timing. */
+  const bool m_autoTune;
+
+  /** the effective time in milliseconds an addressed slave is expected to answer within. */
+  std::atomic<unsigned int> m_effectiveSlaveRecvTimeout;
+
+  /** the recent send/receive symbol latencies in microseconds for auto-tuning. */
+  PercentileWindow m_symbolLatencyWindow;
+
+  /** the number of symbol latencies measured since the last auto-tuning. */
+  unsigned int m_symbolLatencySamples;
+
+  /** the recent delays until an addressed slave started answering in microseconds for auto-tuning. */
+  PercentileWindow m_answerDelayWindow;
+
+  /** the number of answer delays measured since the last auto-tuning. */
+  unsigned int m_answerDelaySamples;
+
   /** the minimal measured latency between send and receive of a symbol in milliseconds, -1 if not yet known. */
   int m_symbolLatencyMin;
 
@@ -739,8 +1301,8 @@ class BusHandler : public WaitThread {
   /** the time of the last poll, or 0 for never. */
   time_t m_lastPoll;
 
-  /** the queue of @a BusRequests that shall be handled. */
-  Queue<BusRequest*> m_nextRequests;
+  /** the queue of @a BusRequests that shall be handled with one lane per @a RequestLane. */
+  LaneQueue<BusRequest*, REQUEST_LANE_COUNT> m_nextRequests;
 
   /** the currently handled BusRequest, or nullptr. */
   BusRequest* m_currentRequest;
@@ -751,8 +1313,17 @@ class BusHandler : public WaitThread {
   /** the queue of @a BusRequests that are already finished. */
   Queue<BusRequest*> m_finishedRequests;
 
+  /** the pending shared @a ActiveBusRequest instances other identical requests may attach to. */
+  list<ActiveBusRequest*> m_sharedRequests;
+
+  /** the mutex for @a m_sharedRequests and the state of its entries. */
+  pthread_mutex_t m_sharedMutex;
+
+  /** the condition for waiting on a shared @a ActiveBusRequest to finish. */
+  pthread_cond_t m_sharedCond;
+
   /** the number of scan request currently running. */
-  unsigned int m_runningScans;
+  std::atomic<unsigned int> m_runningScans;
 
   /** the offset of the next symbol that needs to be sent from the command or response,
    * (only relevant if m_request is set and state is @a bs_command or @a bs_response). */
@@ -761,6 +1332,9 @@ class BusHandler : public WaitThread {
   /** the number of received symbols in the last second. */
   unsigned int m_symPerSec;
 
+  /** whether @a m_symPerSec was measured over a complete period with a valid device. */
+  bool m_symPerSecMeasured;
+
   /** the maximum number of received symbols per second ever seen. */
   unsigned int m_maxSymPerSec;
 
@@ -785,8 +1359,11 @@ class BusHandler : public WaitThread {
   /** the received response @a SlaveSymbolString or response to send. */
   SlaveSymbolString m_response;
 
-  /** the participating bus addresses seen so far (0 if not seen yet, or combination of @a SEEN bits). */
-  symbol_t m_seenAddresses[256];
+  /**
+   * the participating bus addresses seen so far (0 if not seen yet, or combination of @a SEEN bits), also updated
+   * by the @a ScanConfigLoader.
+   */
+  std::atomic<symbol_t> m_seenAddresses[256];
 
   /** the scan results by slave address and index. */
   map<symbol_t, vector<string>> m_scanResults;
@@ -794,8 +1371,65 @@ class BusHandler : public WaitThread {
   /** whether to grab messages. */
   bool m_grabMessages;
 
+  /** the @a Mutex for accessing @a m_grabbedMessages. */
+  mutable Mutex m_grabMutex;
+
   /** the grabbed messages by key.*/
-  map<uint64_t, GrabbedMessage> m_grabbedMessages;
+  GrabStore m_grabbedMessages;
+
+  /** the @a Histogram of the send/receive symbol latency in microseconds. */
+  Histogram m_symbolLatencyHistogram;
+
+  /** the @a Histogram of the delay between received SYN and sent own master address in microseconds. */
+  Histogram m_arbitrationDelayHistogram;
+
+  /** the @a Histogram of the time in milliseconds from queuing a request in @a sendAndWait() to its result. */
+  Histogram m_sendTimeHistogram;
+
+  /** the @a Histogram of the number of retries due to lost arbitration per finished request. */
+  Histogram m_busLostRetriesHistogram;
+
+  /** the @a Histogram of the number of requests already queued when a new one is added in @a sendAndWait(). */
+  Histogram m_queueDepthHistogram;
+
+  /** the @a Histogram of the time in seconds since the last update of a message when it is polled. */
+  Histogram m_pollStalenessHistogram;
+
+  /** the @a Histogram per @a RequestLane of the time in milliseconds a request waited in the queue. */
+  Histogram* m_laneWaitHistograms[REQUEST_LANE_COUNT];
+
+  /** the number of received symbols. */
+  Counter m_symbolsReceived;
+
+  /** the number of CRC errors in received or sent telegrams. */
+  Counter m_crcErrors;
+
+  /** the number of lost arbitrations. */
+  Counter m_arbitrationLost;
+
+  /** the number of own requests arbitrated directly after the previous one in pipeline mode. */
+  Counter m_pipelinedRequests;
+
+  /** the number of times the bus thread was not waiting for the next symbol in time while arbitrating. */
+  Counter m_missedDeadlines;
+
+  /** the number of times waiting for a symbol returned considerably later than the timeout. */
+  Counter m_lateWakeups;
+
+  /** the scheduling policy of the bus thread, or SCHED_OTHER to keep the scheduling. */
+  int m_schedPolicy;
+
+  /** the realtime priority of the bus thread. */
+  int m_schedPriority;
+
+  /** the CPU to pin the bus thread to, or -1 to keep the affinity. */
+  int m_schedCpu;
+
+  /** whether to lock the memory of the process and prefault the stack of the bus thread. */
+  bool m_lockMemory;
+
+  /** the time the last wait for a symbol ended, or 0 for never. */
+  struct timespec m_lastRecvEnd;
 };
 
 }  // namespace ebusd
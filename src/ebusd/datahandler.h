@@ -112,6 +112,17 @@ class DataHandler {
    */
   virtual void start() = 0;
 
+  /**
+   * Create the @a DataHandler for an additional bus sharing the front end (e.g. the broker connection) of this one.
+   * @param userInfo the @a UserInfo instance of the additional bus.
+   * @param busHandler the @a BusHandler instance of the additional bus.
+   * @param messages the @a MessageMap instance of the additional bus.
+   * @param busId the ID of the additional bus.
+   * @return the new @a DataHandler instance (started together with this one), or nullptr if not supported.
+   */
+  virtual DataHandler* createBusHandler(UserInfo* /*userInfo*/, BusHandler* /*busHandler*/,
+      MessageMap* /*messages*/, const string& /*busId*/) { return nullptr; }
+
   /**
    * Return whether this is a @a DataSink instance.
    * @return whether this is a @a DataSink instance.
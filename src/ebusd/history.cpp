@@ -0,0 +1,295 @@
+/*
+ * ebusd - daemon for communication with eBUS heating systems.
+ * Copyright (C) 2021 John Baier <ebusd@ebusd.eu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "ebusd/history.h"
+#include <cmath>
+#include <sstream>
+#include "lib/utils/log.h"
+
+namespace ebusd {
+
+using std::ostringstream;
+
+/** the names of the @a HistoryTier values. */
+static const char* s_tierNames[HISTORY_TIER_COUNT] = {"raw", "1m", "15m"};
+
+/** the names of the @a HistoryAggregate values. */
+static const char* s_aggregateNames[] = {"avg", "min", "max", "last", "count"};
+
+/** the number of @a HistoryAggregate values. */
+#define HISTORY_AGGREGATE_COUNT 5
+
+const char* getHistoryTierName(HistoryTier tier) {
+  return s_tierNames[tier];
+}
+
+bool parseHistoryTier(const string& name, HistoryTier* tier) {
+  for (int i = 0; i < HISTORY_TIER_COUNT; i++) {
+    if (name == s_tierNames[i]) {
+      *tier = static_cast<HistoryTier>(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+const char* getHistoryAggregateName(HistoryAggregate aggregate) {
+  return s_aggregateNames[aggregate];
+}
+
+bool parseHistoryAggregate(const string& name, HistoryAggregate* aggregate) {
+  for (int i = 0; i < HISTORY_AGGREGATE_COUNT; i++) {
+    if (name == s_aggregateNames[i]) {
+      *aggregate = static_cast<HistoryAggregate>(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+
+void HistoryBucket::reset(time_t time, double value) {
+  m_time = time;
+  m_min = m_max = m_last = static_cast<float>(value);
+  m_count = 1;
+  m_sum = value;
+}
+
+void HistoryBucket::merge(const HistoryBucket& other) {
+  if (other.m_min < m_min) {
+    m_min = other.m_min;
+  }
+  if (other.m_max > m_max) {
+    m_max = other.m_max;
+  }
+  m_last = other.m_last;
+  m_count += other.m_count;
+  m_sum += other.m_sum;
+}
+
+double HistoryBucket::get(HistoryAggregate aggregate) const {
+  switch (aggregate) {
+  case ha_min:
+    return m_min;
+  case ha_max:
+    return m_max;
+  case ha_last:
+    return m_last;
+  case ha_count:
+    return m_count;
+  default:
+    return m_count == 0 ? 0 : m_sum / m_count;
+  }
+}
+
+
+const time_t HistorySeries::s_periods[HISTORY_TIER_COUNT] = {0, 60, 15*60};
+
+HistorySeries::HistorySeries(size_t size)
+  : m_samples(0) {
+  for (int tier = 0; tier < HISTORY_TIER_COUNT; tier++) {
+    m_buckets[tier].resize(size);
+    m_next[tier] = 0;
+    m_count[tier] = 0;
+    m_current[tier].m_count = 0;
+  }
+}
+
+void HistorySeries::add(time_t time, double value) {
+  HistoryBucket sample;
+  sample.reset(time, value);
+  m_samples++;
+  size_t size = m_buckets[0].size();
+  for (int tier = 0; tier < HISTORY_TIER_COUNT; tier++) {
+    HistoryBucket* complete = &sample;
+    if (tier != ht_raw) {
+      HistoryBucket& current = m_current[tier];
+      time_t start = time - time % s_periods[tier];
+      if (current.m_count == 0) {
+        current.reset(start, value);
+        continue;
+      }
+      if (start <= current.m_time) {
+        current.merge(sample);  // same period (or clock went backwards)
+        continue;
+      }
+      complete = &current;
+    }
+    m_buckets[tier][m_next[tier]] = *complete;
+    m_next[tier] = (m_next[tier] + 1) % size;
+    if (m_count[tier] < size) {
+      m_count[tier]++;
+    }
+    if (tier != ht_raw) {
+      m_current[tier].reset(time - time % s_periods[tier], value);
+    }
+  }
+}
+
+void HistorySeries::query(HistoryTier tier, time_t since, time_t until, time_t interval,
+    vector<HistoryBucket>* result) const {
+  const vector<HistoryBucket>& buckets = m_buckets[tier];
+  size_t size = buckets.size();
+  size_t count = m_count[tier];
+  time_t period = s_periods[tier] > 0 ? s_periods[tier] : 1;
+  bool merging = false;
+  time_t mergeStart = 0;
+  for (size_t i = 0; i <= count; i++) {
+    const HistoryBucket* bucket;
+    if (i < count) {
+      bucket = &buckets[(m_next[tier] + size - count + i) % size];
+    } else if (tier != ht_raw && m_current[tier].m_count > 0) {
+      bucket = &m_current[tier];  // the period still being aggregated
+    } else {
+      break;
+    }
+    if ((since > 0 && bucket->m_time + period <= since) || (until > 0 && bucket->m_time > until)) {
+      continue;
+    }
+    if (interval <= 0) {
+      result->push_back(*bucket);
+      continue;
+    }
+    time_t start = bucket->m_time - bucket->m_time % interval;
+    if (merging && start == mergeStart) {
+      result->back().merge(*bucket);
+      continue;
+    }
+    result->push_back(*bucket);
+    result->back().m_time = start;
+    merging = true;
+    mergeStart = start;
+  }
+}
+
+
+History::~History() {
+  for (const auto& it : m_series) {
+    for (const auto& field : it.second) {
+      delete field.second;
+    }
+  }
+  m_series.clear();
+}
+
+void History::update(const Message* message) {
+  time_t time = message->getLastUpdateTime();
+  if (time == 0) {
+    return;
+  }
+  // decode all fields at once outside of the lock
+  vector<double> decoded;
+  message->decodeLastNumericValues(&decoded);  // undecodable fields are NaN
+  vector<std::pair<string, double>> values;
+  for (size_t index = 0; index < decoded.size(); index++) {
+    double value = decoded[index];
+    if (!std::isfinite(value)) {
+      continue;  // not numeric or not set
+    }
+    string fieldName = message->getFieldName(static_cast<ssize_t>(index));
+    bool duplicate = false;
+    for (const auto& it : values) {
+      if (it.first == fieldName) {
+        duplicate = true;
+        break;
+      }
+    }
+    if (fieldName.empty() || duplicate) {
+      ostringstream indexed;
+      indexed << fieldName << (fieldName.empty() ? "" : ".") << index;
+      fieldName = indexed.str();
+    }
+    values.push_back(std::make_pair(fieldName, value));
+  }
+  if (values.empty()) {
+    return;
+  }
+  string key = message->getCircuit() + "\t" + message->getName();
+  m_lock.lock();
+  vector<std::pair<string, HistorySeries*>>& fields = m_series[key];
+  for (const auto& it : values) {
+    HistorySeries* series = nullptr;
+    for (const auto& field : fields) {
+      if (field.first == it.first) {
+        series = field.second;
+        break;
+      }
+    }
+    if (!series) {
+      if (m_seriesCount >= m_maxSeries) {
+        if (!m_limitLogged) {
+          m_limitLogged = true;
+          logNotice(lf_main, "history limit of %d fields reached", m_maxSeries);
+        }
+        continue;
+      }
+      series = new HistorySeries(m_size);
+      fields.push_back(std::make_pair(it.first, series));
+      m_seriesCount++;
+    }
+    series->add(time, it.second);
+  }
+  if (fields.empty()) {
+    m_series.erase(key);
+  }
+  m_lock.unlock();
+}
+
+result_t History::query(const string& circuit, const string& name, const string& field, HistoryTier tier,
+    time_t since, time_t until, time_t interval, string* usedField, vector<HistoryBucket>* result) {
+  result_t ret = RESULT_ERR_NOTFOUND;
+  m_lock.lock();
+  const auto it = m_series.find(circuit + "\t" + name);
+  if (it != m_series.end()) {
+    for (const auto& entry : it->second) {
+      if (field.empty() || entry.first == field) {
+        *usedField = entry.first;
+        entry.second->query(tier, since, until, interval, result);
+        ret = RESULT_OK;
+        break;
+      }
+    }
+  }
+  m_lock.unlock();
+  return ret;
+}
+
+void History::list(ostream* output) {
+  m_lock.lock();
+  for (const auto& it : m_series) {
+    size_t pos = it.first.find('\t');
+    for (const auto& field : it.second) {
+      *output << it.first.substr(0, pos) << " " << it.first.substr(pos+1) << " " << field.first
+              << " = " << field.second->getSampleCount() << " samples\n";
+    }
+  }
+  m_lock.unlock();
+}
+
+size_t History::getMemorySize() {
+  m_lock.lock();
+  size_t count = m_seriesCount;
+  m_lock.unlock();
+  return count * (sizeof(HistorySeries) + HISTORY_TIER_COUNT * m_size * sizeof(HistoryBucket));
+}
+
+}  // namespace ebusd
@@ -0,0 +1,270 @@
+/*
+ * ebusd - daemon for communication with eBUS heating systems.
+ * Copyright (C) 2021 John Baier <ebusd@ebusd.eu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EBUSD_HISTORY_H_
+#define EBUSD_HISTORY_H_
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include "lib/ebus/message.h"
+#include "lib/utils/thread.h"
+
+namespace ebusd {
+
+/** @file ebusd/history.h
+ * An in-process history of the numeric field values.
+ *
+ * Each numeric field of an updated @a Message gets its own @a HistorySeries
+ * keeping the raw samples as well as the values downsampled to 1 minute and
+ * 15 minutes in ring buffers of fixed size allocated on creation. The number
+ * of series is limited as well, so that the memory stays bounded.
+ */
+
+using std::map;
+using std::string;
+using std::vector;
+
+/** the downsampling tiers of a @a HistorySeries. */
+enum HistoryTier {
+  ht_raw,      //!< the raw samples
+  ht_minute,   //!< the samples aggregated per minute
+  ht_quarter,  //!< the samples aggregated per 15 minutes
+};
+
+/** the number of @a HistoryTier values. */
+#define HISTORY_TIER_COUNT 3
+
+/** the aggregate functions for querying a @a HistorySeries. */
+enum HistoryAggregate {
+  ha_avg,    //!< the average value
+  ha_min,    //!< the minimum value
+  ha_max,    //!< the maximum value
+  ha_last,   //!< the last value
+  ha_count,  //!< the number of samples
+};
+
+/**
+ * Get the name of the @a HistoryTier.
+ * @param tier the @a HistoryTier.
+ * @return the name of the @a HistoryTier.
+ */
+const char* getHistoryTierName(HistoryTier tier);
+
+/**
+ * Parse the name of a @a HistoryTier.
+ * @param name the name to parse.
+ * @param tier the variable in which to store the @a HistoryTier.
+ * @return true on success, false if the name is unknown.
+ */
+bool parseHistoryTier(const string& name, HistoryTier* tier);
+
+/**
+ * Get the name of the @a HistoryAggregate.
+ * @param aggregate the @a HistoryAggregate.
+ * @return the name of the @a HistoryAggregate.
+ */
+const char* getHistoryAggregateName(HistoryAggregate aggregate);
+
+/**
+ * Parse the name of a @a HistoryAggregate.
+ * @param name the name to parse.
+ * @param aggregate the variable in which to store the @a HistoryAggregate.
+ * @return true on success, false if the name is unknown.
+ */
+bool parseHistoryAggregate(const string& name, HistoryAggregate* aggregate);
+
+
+/**
+ * The aggregated samples within a certain period (or a single raw sample).
+ */
+struct HistoryBucket {
+  /** the start time of the period (or the time of the raw sample). */
+  time_t m_time;
+
+  /** the minimum value. */
+  float m_min;
+
+  /** the maximum value. */
+  float m_max;
+
+  /** the last value. */
+  float m_last;
+
+  /** the number of samples. */
+  uint32_t m_count;
+
+  /** the sum of all values. */
+  double m_sum;
+
+  /**
+   * Start the bucket with a single sample.
+   * @param time the start time of the period.
+   * @param value the sample value.
+   */
+  void reset(time_t time, double value);
+
+  /**
+   * Add the aggregated samples of another bucket.
+   * @param other the other @a HistoryBucket.
+   */
+  void merge(const HistoryBucket& other);
+
+  /**
+   * Get the aggregated value.
+   * @param aggregate the @a HistoryAggregate to use.
+   * @return the aggregated value.
+   */
+  double get(HistoryAggregate aggregate) const;
+};
+
+
+/**
+ * The history of a single numeric field value.
+ */
+class HistorySeries {
+ public:
+  /**
+   * Constructor.
+   * @param size the number of buckets per @a HistoryTier.
+   */
+  explicit HistorySeries(size_t size);
+
+  /**
+   * Add a sample.
+   * @param time the time of the sample.
+   * @param value the sample value.
+   */
+  void add(time_t time, double value);
+
+  /**
+   * Get the number of raw samples added so far.
+   * @return the number of raw samples added so far.
+   */
+  uint64_t getSampleCount() const { return m_samples; }
+
+  /**
+   * Get the buckets within a time range.
+   * @param tier the @a HistoryTier to use.
+   * @param since the start time (inclusive), or 0 for no limit.
+   * @param until the end time (inclusive), or 0 for no limit.
+   * @param interval the interval in seconds to merge the buckets into, or 0 to keep the buckets of the tier.
+   * @param result the @a vector to which the buckets are appended in ascending time order.
+   */
+  void query(HistoryTier tier, time_t since, time_t until, time_t interval, vector<HistoryBucket>* result) const;
+
+
+ private:
+  /** the period in seconds of each @a HistoryTier (0 for raw). */
+  static const time_t s_periods[HISTORY_TIER_COUNT];
+
+  /** the ring buffers of completed buckets per @a HistoryTier. */
+  vector<HistoryBucket> m_buckets[HISTORY_TIER_COUNT];
+
+  /** the position of the next bucket to write per @a HistoryTier. */
+  size_t m_next[HISTORY_TIER_COUNT];
+
+  /** the number of completed buckets per @a HistoryTier. */
+  size_t m_count[HISTORY_TIER_COUNT];
+
+  /** the currently aggregated bucket per @a HistoryTier (unused for raw). */
+  HistoryBucket m_current[HISTORY_TIER_COUNT];
+
+  /** the number of raw samples added so far. */
+  uint64_t m_samples;
+};
+
+
+/**
+ * The history of all numeric field values.
+ */
+class History {
+ public:
+  /**
+   * Constructor.
+   * @param size the number of buckets per @a HistoryTier and field.
+   * @param maxSeries the maximum number of fields to keep the history for.
+   */
+  History(size_t size, size_t maxSeries) : m_size(size), m_maxSeries(maxSeries), m_limitLogged(false),
+    m_seriesCount(0) {}
+
+  /**
+   * Destructor.
+   */
+  virtual ~History();
+
+  /**
+   * Add the numeric field values of an updated @a Message.
+   * @param message the updated @a Message.
+   */
+  void update(const Message* message);
+
+  /**
+   * Get the history of a field.
+   * @param circuit the circuit name.
+   * @param name the message name.
+   * @param field the field name (or index for unnamed fields), or empty for the first field with history.
+   * @param tier the @a HistoryTier to use.
+   * @param since the start time (inclusive), or 0 for no limit.
+   * @param until the end time (inclusive), or 0 for no limit.
+   * @param interval the interval in seconds to merge the buckets into, or 0 to keep the buckets of the tier.
+   * @param usedField the string in which to store the field name actually used.
+   * @param result the @a vector to which the buckets are appended in ascending time order.
+   * @return @a RESULT_OK on success, or @a RESULT_ERR_NOTFOUND if no history is available.
+   */
+  result_t query(const string& circuit, const string& name, const string& field, HistoryTier tier, time_t since,
+      time_t until, time_t interval, string* usedField, vector<HistoryBucket>* result);
+
+  /**
+   * Write the list of fields with history to the @a ostream.
+   * @param output the @a ostream to write to.
+   */
+  void list(ostream* output);
+
+  /**
+   * Get the approximate memory used by the buckets.
+   * @return the approximate memory used in bytes.
+   */
+  size_t getMemorySize();
+
+
+ private:
+  /** the number of buckets per @a HistoryTier and field. */
+  const size_t m_size;
+
+  /** the maximum number of fields to keep the history for. */
+  const size_t m_maxSeries;
+
+  /** whether reaching the maximum number of fields was already logged. */
+  bool m_limitLogged;
+
+  /** the mutex for accessing the series. */
+  Mutex m_lock;
+
+  /** the number of @a HistorySeries in @a m_series. */
+  size_t m_seriesCount;
+
+  /** the field names and @a HistorySeries in field order by circuit and message name (separated by tab). */
+  map<string, vector<std::pair<string, HistorySeries*>>> m_series;
+};
+
+}  // namespace ebusd
+
+#endif  // EBUSD_HISTORY_H_
@@ -22,10 +22,13 @@
 
 #include "ebusd/main.h"
 #include <dirent.h>
+#include <sched.h>
 #include <sys/stat.h>
+#include <unistd.h>
 #include <argp.h>
 #include <csignal>
 #include <iostream>
+#include <fstream>
 #include <algorithm>
 #include <iomanip>
 #include <map>
@@ -33,6 +36,7 @@
 #include "ebusd/mainloop.h"
 #include "lib/utils/log.h"
 #include "lib/utils/httpclient.h"
+#include "lib/utils/dumpreader.h"
 
 
 /** the version string of the program. */
@@ -76,6 +80,7 @@ static bool isDaemon = false;
 /** the program options. */
 static struct options opt = {
   "/dev/ttyUSB0",  // device
+  "",  // busId
   false,  // noDeviceCheck
   false,  // readOnly
   false,  // initialSend
@@ -87,8 +92,17 @@ static struct options opt = {
   getenv("LANG"),  // preferLanguage
   false,  // checkConfig
   false,  // dumpConfig
+  "",  // configCache
+  "",  // valueStore
+  "",  // scanCache
+  "",  // sharedValues
+  "",  // sharedValuesGroup
   5,  // pollInterval
+  true,  // adaptPollInterval
   false,  // injectMessages
+  nullptr,  // injectDump
+  1,  // injectSpeed
+  1,  // injectLoop
 
   0x31,  // address
   false,  // answer
@@ -96,8 +110,16 @@ static struct options opt = {
   3,  // acquireRetries
   2,  // sendRetries
   SLAVE_RECV_TIMEOUT*5/3,  // receiveTimeout
+  false,  // autoTune
   0,  // masterCount
   false,  // generateSyn
+  false,  // pipeline
+  {8, 4, 2, 1},  // laneWeights
+  {1000, 2000, 10000, 30000},  // laneMaxWaits
+  SCHED_OTHER,  // rtPolicy
+  0,  // rtPriority
+  -1,  // cpuAffinity
+  false,  // lockMemory
 
   "",  // accessLevel
   "",  // aclFile
@@ -110,20 +132,26 @@ static struct options opt = {
   0,  // httpPort
   "/var/" PACKAGE "/html",  // htmlPath
   true,  // updateCheck
+  0,  // historySize
+  256,  // historyFields
 
   PACKAGE_LOGFILE,  // logFile
   -1,  // logAreas
   ll_COUNT,  // logLevel
   false,  // multiLog
+  false,  // logAsync
 
   0,  // logRaw
   PACKAGE_LOGFILE,  // logRawFile
   100,  // logRawSize
+  false,  // logRawAsync
 
   false,  // dump
   "/tmp/" PACKAGE "_dump.bin",  // dumpFile
   100,  // dumpSize
   false,  // dumpFlush
+  false,  // dumpAsync
+  false,  // dumpTimed
 };
 
 /** the @a MessageMap instance, or nullptr. */
@@ -132,6 +160,33 @@ static MessageMap* s_messageMap = nullptr;
 /** the @a MainLoop instance, or nullptr. */
 static MainLoop* s_mainLoop = nullptr;
 
+/** the maximum number of additional buses. */
+#define MAX_EXTRA_BUSES 7
+
+/** the ID and device name of each additional bus. */
+static vector<std::pair<string, string>> s_extraBuses;
+
+/** the @a MainLoop instances of the additional buses. */
+static vector<MainLoop*> s_extraMainLoops;
+
+/** the @a MessageMap instances of the additional buses. */
+static vector<MessageMap*> s_extraMessageMaps;
+
+/** the mutex for loading configuration files (shared by all buses). */
+static Mutex s_configMutex;
+
+/** the most recently parsed @a MessageMap the buses copy their definitions from (only with additional buses). */
+static MessageMap* s_sharedMessageMap = nullptr;
+
+/** the parsed @a MessageMap instances still referenced by a bus (guarded by @a s_configMutex). */
+static vector<MessageMap*> s_sharedMessageMaps;
+
+/** the parsed @a MessageMap each bus @a MessageMap copied its definitions from (guarded by @a s_configMutex). */
+static map<const MessageMap*, MessageMap*> s_sharedMessageMapByBus;
+
+/** the @a MessageMap the instructions are currently executed for by this thread. */
+static thread_local MessageMap* s_instructionMessages = nullptr;
+
 /** the path prefix (including trailing "/") for retrieving configuration files from local files (empty for HTTP). */
 static string s_configLocalPrefix;
 
@@ -141,24 +196,45 @@ static string s_configUriPrefix;
 /** the @a HttpClient for retrieving configuration files from HTTP. */
 static HttpClient s_configHttpClient;
 
+/** the host name for retrieving configuration files from HTTP. */
+static string s_configHost;
+
+/** the port for retrieving configuration files from HTTP. */
+static uint16_t s_configPort = 80;
+
 /** the documentation of the program. */
 static const char argpdoc[] =
   "A daemon for communication with eBUS heating systems.";
 
-#define O_INISND 1
+#define O_INISND 0x100
 #define O_DEVLAT (O_INISND+1)
 #define O_CFGLNG (O_DEVLAT+1)
 #define O_CHKCFG (O_CFGLNG+1)
 #define O_DMPCFG (O_CHKCFG+1)
-#define O_POLINT (O_DMPCFG+1)
-#define O_ANSWER (O_POLINT+1)
+#define O_CFGCAC (O_DMPCFG+1)
+#define O_VALSTO (O_CFGCAC+1)
+#define O_SCNCAC (O_VALSTO+1)
+#define O_SHMVAL (O_SCNCAC+1)
+#define O_SHMGRP (O_SHMVAL+1)
+#define O_POLINT (O_SHMGRP+1)
+#define O_INJDMP (O_POLINT+1)
+#define O_INJSPD (O_INJDMP+1)
+#define O_INJLOP (O_INJSPD+1)
+#define O_ANSWER (O_INJLOP+1)
 #define O_ACQTIM (O_ANSWER+1)
 #define O_ACQRET (O_ACQTIM+1)
 #define O_SNDRET (O_ACQRET+1)
 #define O_RCVTIM (O_SNDRET+1)
-#define O_MASCNT (O_RCVTIM+1)
+#define O_AUTTUN (O_RCVTIM+1)
+#define O_MASCNT (O_AUTTUN+1)
 #define O_GENSYN (O_MASCNT+1)
-#define O_ACLDEF (O_GENSYN+1)
+#define O_PIPELN (O_GENSYN+1)
+#define O_LANWGT (O_PIPELN+1)
+#define O_LANWAI (O_LANWGT+1)
+#define O_RTPRIO (O_LANWAI+1)
+#define O_CPUAFF (O_RTPRIO+1)
+#define O_MEMLCK (O_CPUAFF+1)
+#define O_ACLDEF (O_MEMLCK+1)
 #define O_ACLFIL (O_ACLDEF+1)
 #define O_HEXCMD (O_ACLFIL+1)
 #define O_DEFCMD (O_HEXCMD+1)
@@ -167,15 +243,22 @@ static const char argpdoc[] =
 #define O_HTTPPT (O_LOCAL+1)
 #define O_HTMLPA (O_HTTPPT+1)
 #define O_UPDCHK (O_HTMLPA+1)
-#define O_LOG    (O_UPDCHK+1)
+#define O_HISSIZ (O_UPDCHK+1)
+#define O_HISFLD (O_HISSIZ+1)
+#define O_LOG    (O_HISFLD+1)
 #define O_LOGARE (O_LOG+1)
 #define O_LOGLEV (O_LOGARE+1)
-#define O_RAW    (O_LOGLEV+1)
+#define O_LOGASY (O_LOGLEV+1)
+#define O_RAW    (O_LOGASY+1)
 #define O_RAWFIL (O_RAW+1)
 #define O_RAWSIZ (O_RAWFIL+1)
-#define O_DMPFIL (O_RAWSIZ+1)
+#define O_RAWASY (O_RAWSIZ+1)
+#define O_DMPFIL (O_RAWASY+1)
 #define O_DMPSIZ (O_DMPFIL+1)
 #define O_DMPFLU (O_DMPSIZ+1)
+#define O_DMPASY (O_DMPFLU+1)
+#define O_DMPTIM (O_DMPASY+1)
+#define O_BUS    (O_DMPTIM+1)
 
 /** the definition of the known program arguments. */
 static const struct argp_option argpoptions[] = {
@@ -185,6 +268,8 @@ static const struct argp_option argpoptions[] = {
   {"readonly",       'r',      nullptr,    0, "Only read from device, never write to it", 0 },
   {"initsend",       O_INISND, nullptr,    0, "Send an initial escape symbol after connecting device", 0 },
   {"latency",        O_DEVLAT, "MSEC",     0, "Extra transfer latency in ms [0]", 0 },
+  {"bus",            O_BUS,    "ID:DEV",   0, "Additionally use DEV as eBUS device for the bus with identifier ID "
+      "(repeatable, the circuit names of the bus are prefixed with \"ID.\" for routing MQTT, commands, and HTTP)", 0 },
 
   {nullptr,          0,        nullptr,    0, "Message configuration options:", 2 },
   {"configpath",     'c',      "PATH",     0, "Read CSV config files from PATH (local folder or HTTP URL) [" CONFIG_PATH
@@ -197,9 +282,24 @@ static const struct argp_option argpoptions[] = {
       "Prefer LANG in multilingual configuration files [system default language]", 0 },
   {"checkconfig",    O_CHKCFG, nullptr,    0, "Check CSV config files, then stop", 0 },
   {"dumpconfig",     O_DMPCFG, nullptr,    0, "Check and dump CSV config files, then stop", 0 },
+  {"configcache",    O_CFGCAC, "PATH",     0, "Cache the parsed CSV config files (and the downloaded ones for an "
+      "HTTP configpath) in PATH for faster loading when unchanged (no default)", 0 },
+  {"valuestore",     O_VALSTO, "FILE",     0, "Persist the last seen message data in FILE and restore it on start "
+      "and reload (no default)", 0 },
+  {"scancache",      O_SCNCAC, "FILE",     0, "Cache the scan identification of the slaves in FILE for loading their "
+      "scan config files on start without scanning (verified by a background scan later on, no default)", 0 },
+  {"sharedvalues",   O_SHMVAL, "NAME",     0, "Export the last seen message data read-only in the shared memory "
+      "object NAME for local consumers (e.g. \"/ebusd\", no default)", 0 },
+  {"sharedvaluesgroup", O_SHMGRP, "GROUP", 0, "Allow read access to the shared values for members of GROUP "
+      "(default: owner only)", 0 },
   {"pollinterval",   O_POLINT, "SEC",      0, "Poll for data every SEC seconds (0=disable) [5]", 0 },
   {"inject",         'i',      nullptr,    0, "Inject remaining arguments as already seen messages (e.g. "
       "\"FF08070400/0AB5454850303003277201\")", 0 },
+  {"injectdump",     O_INJDMP, "FILE",     0, "Inject the telegrams from dump FILE (plain or timed) as already seen "
+      "messages, e.g. for load testing with an unconnected device", 0 },
+  {"injectspeed",    O_INJSPD, "FACTOR",   0, "Inject the telegrams from a timed dump FACTOR times faster than "
+      "recorded (0=as fast as possible) [1]", 0 },
+  {"injectloop",     O_INJLOP, "COUNT",    0, "Inject the telegrams from the dump COUNT times (0=endless) [1]", 0 },
 
   {nullptr,          0,        nullptr,    0, "eBUS options:", 3 },
   {"address",        'a',      "ADDR",     0, "Use ADDR as own bus address [31]", 0 },
@@ -208,8 +308,19 @@ static const struct argp_option argpoptions[] = {
   {"acquireretries", O_ACQRET, "COUNT",    0, "Retry bus acquisition COUNT times [3]", 0 },
   {"sendretries",    O_SNDRET, "COUNT",    0, "Repeat failed sends COUNT times [2]", 0 },
   {"receivetimeout", O_RCVTIM, "MSEC",     0, "Expect a slave to answer within MSEC us [25]", 0 },
+  {"autotune",       O_AUTTUN, nullptr,    0, "Adjust latency and receivetimeout to the measured bus timing", 0 },
   {"numbermasters",  O_MASCNT, "COUNT",    0, "Expect COUNT masters on the bus, 0 for auto detection [0]", 0 },
   {"generatesyn",    O_GENSYN, nullptr,    0, "Enable AUTO-SYN symbol generation", 0 },
+  {"pipeline",       O_PIPELN, nullptr,    0, "Prepare the next own telegram while the current one is running and "
+      "arbitrate for it on the next SYN", 0 },
+  {"laneweights",    O_LANWGT, "W,R,P,S",  0, "Take up to W writes, R reads, P polls, and S scans in a row while "
+      "other requests are waiting [8,4,2,1]", 0 },
+  {"lanemaxwait",    O_LANWAI, "W,R,P,S",  0, "Prefer writes, reads, polls, and scans waiting longer than the "
+      "specified ms (0=no limit) [1000,2000,10000,30000]", 0 },
+  {"rtpriority",     O_RTPRIO, "[rr:]PRIO", 0, "Run the bus thread with realtime priority PRIO (1-99) using FIFO or "
+      "round-robin scheduling", 0 },
+  {"cpuaffinity",    O_CPUAFF, "CPU",      0, "Pin the bus thread to CPU", 0 },
+  {"lockmemory",     O_MEMLCK, nullptr,    0, "Lock the memory of the process and prefault the bus thread stack", 0 },
 
   {nullptr,          0,        nullptr,    0, "Daemon options:", 4 },
   {"accesslevel",    O_ACLDEF, "LEVEL",    0, "Set default access level to LEVEL (\"*\" for everything) [\"\"]", 0 },
@@ -223,6 +334,9 @@ static const struct argp_option argpoptions[] = {
   {"httpport",       O_HTTPPT, "PORT",     0, "Listen for HTTP connections on PORT, 0 to disable [0]", 0 },
   {"htmlpath",       O_HTMLPA, "PATH",     0, "Path for HTML files served by HTTP port [/var/ebusd/html]", 0 },
   {"updatecheck",    O_UPDCHK, "MODE",     0, "Set automatic update check to MODE (on|off) [on]", 0 },
+  {"history",        O_HISSIZ, "COUNT",    0, "Keep COUNT raw, 1 minute, and 15 minute values of each numeric field "
+      "for the history command and HTTP (0=disable) [0]", 0 },
+  {"historyfields",  O_HISFLD, "COUNT",    0, "Keep the history of up to COUNT numeric fields [256]", 0 },
 
   {nullptr,          0,        nullptr,    0, "Log options:", 5 },
   {"logfile",        'l',      "FILE",     0, "Write log to FILE (only for daemon, empty string for using syslog) ["
@@ -233,18 +347,23 @@ static const struct argp_option argpoptions[] = {
       "|all [all]", 0 },
   {"loglevel",       O_LOGLEV, "LEVEL",    0, "Only write log below or equal to LEVEL: error|notice|info|debug"
       " [notice]", 0 },
+  {"logasync",       O_LOGASY, nullptr,    0, "Write log asynchronously from a background thread (drops lines when "
+      "overloaded instead of delaying)", 0 },
 
   {nullptr,          0,        nullptr,    0, "Raw logging options:", 6 },
   {"lograwdata",     O_RAW,    "bytes", OPTION_ARG_OPTIONAL,
       "Log messages or all received/sent bytes on the bus", 0 },
   {"lograwdatafile", O_RAWFIL, "FILE",     0, "Write raw log to FILE [" PACKAGE_LOGFILE "]", 0 },
   {"lograwdatasize", O_RAWSIZ, "SIZE",     0, "Make raw log file no larger than SIZE kB [100]", 0 },
+  {"lograwdataasync", O_RAWASY, nullptr,   0, "Write raw log file in batches from a background thread", 0 },
 
   {nullptr,          0,        nullptr,    0, "Binary dump options:", 7 },
   {"dump",           'D',      nullptr,    0, "Enable binary dump of received bytes", 0 },
   {"dumpfile",       O_DMPFIL, "FILE",     0, "Dump received bytes to FILE [/tmp/" PACKAGE "_dump.bin]", 0 },
   {"dumpsize",       O_DMPSIZ, "SIZE",     0, "Make dump file no larger than SIZE kB [100]", 0 },
   {"dumpflush",      O_DMPFLU, nullptr,    0, "Flush each byte", 0 },
+  {"dumpasync",      O_DMPASY, nullptr,    0, "Write dump file in batches from a background thread", 0 },
+  {"dumptimed",      O_DMPTIM, nullptr,    0, "Dump in compact binary format with a timestamp per telegram", 0 },
 
   {nullptr,          0,        nullptr,    0, nullptr, 0 },
 };
@@ -258,6 +377,44 @@ static DataFieldTemplates s_globalTemplates;
  */
 static map<string, DataFieldTemplates*> s_templatesByPath;
 
+/**
+ * the private copies of the loaded @a DataFieldTemplates by the shared instance for the configuration check running
+ * in this thread, or nullptr for using the shared instances.
+ */
+static thread_local map<const DataFieldTemplates*, DataFieldTemplates*>* s_threadTemplates = nullptr;
+
+/**
+ * Parse a comma separated list of one value per request lane.
+ * @param arg the argument to parse.
+ * @param minValue the minimum allowed value.
+ * @param maxValue the maximum allowed value.
+ * @param values the array in which to store the values.
+ * @return true on success, false if the argument is invalid.
+ */
+static bool parseLaneValues(const char* arg, unsigned int minValue, unsigned int maxValue, unsigned int* values) {
+  istringstream stream(arg);
+  string token;
+  unsigned int parsed[REQUEST_LANE_COUNT];
+  size_t count = 0;
+  while (getline(stream, token, ',')) {
+    result_t result = RESULT_OK;
+    if (count >= REQUEST_LANE_COUNT) {
+      return false;
+    }
+    parsed[count++] = parseInt(token.c_str(), 10, minValue, maxValue, &result);
+    if (result != RESULT_OK) {
+      return false;
+    }
+  }
+  if (count != REQUEST_LANE_COUNT) {
+    return false;
+  }
+  for (size_t lane = 0; lane < REQUEST_LANE_COUNT; lane++) {
+    values[lane] = parsed[lane];
+  }
+  return true;
+}
+
 /**
  * The program argument parsing function.
  * @param key the key from @a argpoptions.
@@ -304,6 +461,32 @@ error_t parse_opt(int key, char *arg, struct argp_state *state) {
     }
     opt->extraLatency = value > 1000 ? value/1000 : value;  // backwards compatible (micros)
     break;
+  case O_BUS: {  // --bus=ID:DEV
+    const char* sep = arg == nullptr ? nullptr : strchr(arg, ':');
+    if (sep == nullptr || sep == arg || sep[1] == 0) {
+      argp_error(state, "invalid bus");
+      return EINVAL;
+    }
+    string busId(arg, sep-arg);
+    for (const auto ch : busId) {
+      if (!isalnum(ch) && ch != '_' && ch != '-') {
+        argp_error(state, "invalid bus ID");
+        return EINVAL;
+      }
+    }
+    if (s_extraBuses.size() >= MAX_EXTRA_BUSES) {
+      argp_error(state, "too many buses");
+      return EINVAL;
+    }
+    for (const auto& bus : s_extraBuses) {
+      if (bus.first == busId) {
+        argp_error(state, "duplicate bus ID");
+        return EINVAL;
+      }
+    }
+    s_extraBuses.push_back(std::make_pair(busId, string(sep+1)));
+    break;
+  }
 
   // Message configuration options:
   case 'c':  // --configpath=http://ebusd.eu/config/
@@ -348,12 +531,48 @@ error_t parse_opt(int key, char *arg, struct argp_state *state) {
     opt->checkConfig = true;
     opt->dumpConfig = true;
     break;
+  case O_CFGCAC:  // --configcache=/var/cache/ebusd
+    if (arg == nullptr || arg[0] == 0 || strcmp("/", arg) == 0) {
+      argp_error(state, "invalid configcache");
+      return EINVAL;
+    }
+    opt->configCache = arg;
+    break;
+  case O_VALSTO:  // --valuestore=/var/lib/ebusd/values
+    if (arg == nullptr || arg[0] == 0) {
+      argp_error(state, "invalid valuestore");
+      return EINVAL;
+    }
+    opt->valueStore = arg;
+    break;
+  case O_SCNCAC:  // --scancache=/var/lib/ebusd/scan
+    if (arg == nullptr || arg[0] == 0) {
+      argp_error(state, "invalid scancache");
+      return EINVAL;
+    }
+    opt->scanCache = arg;
+    break;
+  case O_SHMVAL:  // --sharedvalues=/ebusd
+    if (arg == nullptr || arg[0] != '/' || arg[1] == 0 || strchr(arg+1, '/') != nullptr) {
+      argp_error(state, "invalid sharedvalues");
+      return EINVAL;
+    }
+    opt->sharedValues = arg;
+    break;
+  case O_SHMGRP:  // --sharedvaluesgroup=ebusd
+    if (arg == nullptr || arg[0] == 0) {
+      argp_error(state, "invalid sharedvaluesgroup");
+      return EINVAL;
+    }
+    opt->sharedValuesGroup = arg;
+    break;
   case O_POLINT:  // --pollinterval=5
     opt->pollInterval = parseInt(arg, 10, 0, 3600, &result);
     if (result != RESULT_OK) {
       argp_error(state, "invalid pollinterval");
       return EINVAL;
     }
+    opt->adaptPollInterval = false;  // keep the explicitly requested interval
     if (opt->pollInterval == 0 && opt->scanConfig) {
       argp_error(state, "scanconfig without polling may lead to invalid files included for certain products!");
       return EINVAL;
@@ -362,6 +581,27 @@ error_t parse_opt(int key, char *arg, struct argp_state *state) {
   case 'i':  // --inject
     opt->injectMessages = true;
     break;
+  case O_INJDMP:  // --injectdump=/tmp/ebus_dump.bin
+    if (arg == nullptr || arg[0] == 0 || strcmp("/", arg) == 0) {
+      argp_error(state, "invalid injectdump");
+      return EINVAL;
+    }
+    opt->injectDump = arg;
+    break;
+  case O_INJSPD:  // --injectspeed=1
+    opt->injectSpeed = parseInt(arg, 10, 0, 1000000, &result);
+    if (result != RESULT_OK) {
+      argp_error(state, "invalid injectspeed");
+      return EINVAL;
+    }
+    break;
+  case O_INJLOP:  // --injectloop=1
+    opt->injectLoop = parseInt(arg, 10, 0, 1000000, &result);
+    if (result != RESULT_OK) {
+      argp_error(state, "invalid injectloop");
+      return EINVAL;
+    }
+    break;
 
   // eBUS options:
   case 'a':  // --address=31
@@ -408,6 +648,9 @@ error_t parse_opt(int key, char *arg, struct argp_state *state) {
     }
     opt->receiveTimeout =  value > 1000 ? value/1000 : value;  // backwards compatible (micros)
     break;
+  case O_AUTTUN:  // --autotune
+    opt->autoTune = true;
+    break;
   case O_MASCNT:  // --numbermasters=0
     opt->masterCount = parseInt(arg, 10, 0, 25, &result);
     if (result != RESULT_OK) {
@@ -422,6 +665,49 @@ error_t parse_opt(int key, char *arg, struct argp_state *state) {
     }
     opt->generateSyn = true;
     break;
+  case O_PIPELN:  // --pipeline
+    opt->pipeline = true;
+    break;
+  case O_LANWGT:  // --laneweights=8,4,2,1
+    if (!parseLaneValues(arg, 1, 1000, opt->laneWeights)) {
+      argp_error(state, "invalid laneweights");
+      return EINVAL;
+    }
+    break;
+  case O_LANWAI:  // --lanemaxwait=1000,2000,10000,30000
+    if (!parseLaneValues(arg, 0, 3600000, opt->laneMaxWaits)) {
+      argp_error(state, "invalid lanemaxwait");
+      return EINVAL;
+    }
+    break;
+  case O_RTPRIO:  // --rtpriority=[rr:]50
+    if (arg == nullptr || arg[0] == 0) {
+      argp_error(state, "invalid rtpriority");
+      return EINVAL;
+    }
+    opt->rtPolicy = SCHED_FIFO;
+    if (strncmp(arg, "rr:", 3) == 0) {
+      opt->rtPolicy = SCHED_RR;
+      arg += 3;
+    } else if (strncmp(arg, "fifo:", 5) == 0) {
+      arg += 5;
+    }
+    opt->rtPriority = static_cast<int>(parseInt(arg, 10, 1, 99, &result));
+    if (result != RESULT_OK) {
+      argp_error(state, "invalid rtpriority");
+      return EINVAL;
+    }
+    break;
+  case O_CPUAFF:  // --cpuaffinity=1
+    opt->cpuAffinity = static_cast<int>(parseInt(arg, 10, 0, 1023, &result));
+    if (result != RESULT_OK) {
+      argp_error(state, "invalid cpuaffinity");
+      return EINVAL;
+    }
+    break;
+  case O_MEMLCK:  // --lockmemory
+    opt->lockMemory = true;
+    break;
 
   // Daemon options:
   case O_ACLDEF:  // --accesslevel=*
@@ -492,6 +778,20 @@ error_t parse_opt(int key, char *arg, struct argp_state *state) {
       return EINVAL;
     }
     break;
+  case O_HISSIZ:  // --history=0
+    opt->historySize = parseInt(arg, 10, 0, 100000, &result);
+    if (result != RESULT_OK) {
+      argp_error(state, "invalid history");
+      return EINVAL;
+    }
+    break;
+  case O_HISFLD:  // --historyfields=256
+    opt->historyFields = parseInt(arg, 10, 1, 100000, &result);
+    if (result != RESULT_OK) {
+      argp_error(state, "invalid historyfields");
+      return EINVAL;
+    }
+    break;
 
   // Log options:
   case 'l':  // --logfile=/var/log/ebusd.log
@@ -550,6 +850,10 @@ error_t parse_opt(int key, char *arg, struct argp_state *state) {
     }
     break;
 
+  case O_LOGASY:  // --logasync
+    opt->logAsync = true;
+    break;
+
   // Raw logging options:
   case O_RAW:  // --lograwdata
     opt->logRaw = arg && strcmp("bytes", arg) == 0 ? 2 : 1;
@@ -568,6 +872,9 @@ error_t parse_opt(int key, char *arg, struct argp_state *state) {
       return EINVAL;
     }
     break;
+  case O_RAWASY:  // --lograwdataasync
+    opt->logRawAsync = true;
+    break;
 
 
   // Binary dump options:
@@ -591,6 +898,12 @@ error_t parse_opt(int key, char *arg, struct argp_state *state) {
   case O_DMPFLU:  // --dumpflush
     opt->dumpFlush = true;
     break;
+  case O_DMPASY:  // --dumpasync
+    opt->dumpAsync = true;
+    break;
+  case O_DMPTIM:  // --dumptimed
+    opt->dumpTimed = true;
+    break;
 
   case ARGP_KEY_ARG:
     if (opt->injectMessages || (opt->checkConfig && opt->scanConfig)) {
@@ -673,7 +986,15 @@ void closePidFile() {
  * Helper method performing shutdown.
  */
 void shutdown(bool error = false) {
-  // stop main loop and all dependent components
+  // stop main loop and all dependent components, starting with the additional buses
+  for (const auto mainLoop : s_extraMainLoops) {
+    delete mainLoop;
+  }
+  s_extraMainLoops.clear();
+  for (const auto messages : s_extraMessageMaps) {
+    delete messages;
+  }
+  s_extraMessageMaps.clear();
   if (s_mainLoop) {
     delete s_mainLoop;
     s_mainLoop = nullptr;
@@ -682,6 +1003,13 @@ void shutdown(bool error = false) {
     delete s_messageMap;
     s_messageMap = nullptr;
   }
+  // the parsed definitions are referenced by the bus instances freed above
+  for (const auto messages : s_sharedMessageMaps) {
+    delete messages;
+  }
+  s_sharedMessageMaps.clear();
+  s_sharedMessageMapByBus.clear();
+  s_sharedMessageMap = nullptr;
   // free templates
   for (const auto it : s_templatesByPath) {
     if (it.second != &s_globalTemplates) {
@@ -739,6 +1067,123 @@ void signalHandler(int sig) {
   }
 }
 
+/**
+ * Get the name of the @a RowCache file (or other cache file) for a configuration file.
+ * @param filename the relative name of the configuration file.
+ * @param suffix the suffix of the cache file.
+ * @return the name of the cache file, or empty if caching is disabled.
+ */
+static string getConfigCacheFile(const string& filename, const string& suffix = ".bin") {
+  if (!opt.configCache[0]) {
+    return "";
+  }
+  string name = filename;
+  replace(name.begin(), name.end(), '/', '%');
+  string path = opt.configCache;
+  return path + (path[path.length()-1] == '/' ? "" : "/") + name + suffix;
+}
+
+/**
+ * Get the key identifying the state of a local configuration file for its @a RowCache.
+ * @param st the status of the configuration file.
+ * @return the key changing with the modification time in nanoseconds, the inode, and the size of the file.
+ */
+static uint64_t getConfigFileKey(const struct stat& st) {
+#ifdef __MACH__
+  uint64_t nanos = static_cast<uint64_t>(st.st_mtimespec.tv_nsec);
+#else
+  uint64_t nanos = static_cast<uint64_t>(st.st_mtim.tv_nsec);
+#endif
+  uint64_t key = static_cast<uint64_t>(st.st_size);
+  for (const auto value : {nanos, static_cast<uint64_t>(st.st_ino), static_cast<uint64_t>(st.st_dev)}) {
+    key = (key ^ value) * 0x100000001b3ULL;  // FNV-1a style mixing
+  }
+  return key;
+}
+
+/**
+ * Get the key identifying the content of a configuration file retrieved from HTTP for its @a RowCache.
+ * @param content the content of the configuration file.
+ * @return the key changing with the content, as the server might not send a modification time.
+ */
+static uint64_t getConfigContentKey(const string& content) {
+  uint64_t key = 0xcbf29ce484222325ULL;
+  for (const auto ch : content) {
+    key = (key ^ static_cast<uint8_t>(ch)) * 0x100000001b3ULL;  // FNV-1a
+  }
+  return key;
+}
+
+/** the first line of a downloaded file in the config cache path. */
+#define HTTP_CACHE_MAGIC "EBHC1"
+
+/**
+ * Retrieve a resource from the configuration server, revalidating a previously downloaded copy in the config cache
+ * path if available.
+ * @param client the @a HttpClient to use.
+ * @param name the name of the resource relative to the configuration URI prefix.
+ * @param content the string in which to store the content.
+ * @param mtime optional pointer to a @a time_t value for storing the modification time, or nullptr.
+ * @return true on success, false on error.
+ */
+static bool getFromConfigServer(HttpClient* client, const string& name, string* content, time_t* mtime = nullptr) {
+  const string cacheFile = getConfigCacheFile(name, ".http");
+  if (cacheFile.empty()) {
+    return client->get(s_configUriPrefix + name, "", content, mtime);
+  }
+  string etag, cachedContent;
+  time_t time = 0;
+  bool cached = false;
+  ifstream in(cacheFile.c_str(), ifstream::in | ifstream::binary);
+  if (in.is_open()) {
+    string magic, timeStr;
+    if (getline(in, magic) && magic == HTTP_CACHE_MAGIC && getline(in, etag) && getline(in, timeStr)) {
+      time = static_cast<time_t>(strtoll(timeStr.c_str(), nullptr, 10));
+      ostringstream str;
+      str << in.rdbuf();
+      cachedContent = str.str();
+      cached = !in.bad();
+    }
+    in.close();
+  }
+  if (!cached) {
+    etag.clear();
+    time = 0;
+  }
+  bool notModified = false;
+  string response;
+  if (!client->getIfModified(s_configUriPrefix + name, &response, &time, &etag, &notModified)) {
+    if (!cached) {
+      *content = response;
+      return false;
+    }
+    logNotice(lf_main, "unable to revalidate %s: %s, using cached copy", name.c_str(), response.c_str());
+    notModified = true;
+  }
+  if (mtime) {
+    *mtime = time;
+  }
+  if (notModified) {
+    *content = cachedContent;
+    return true;
+  }
+  *content = response;
+  if (etag.empty() && time == 0) {
+    return true;  // not revalidatable
+  }
+  const string tempFile = cacheFile + ".tmp";
+  std::ofstream out(tempFile.c_str(), std::ofstream::out | std::ofstream::binary | std::ofstream::trunc);
+  if (out.is_open()) {
+    out << HTTP_CACHE_MAGIC << "\n" << etag << "\n" << static_cast<int64_t>(time) << "\n" << response;
+    out.close();
+    if (out.fail() || rename(tempFile.c_str(), cacheFile.c_str()) != 0) {
+      unlink(tempFile.c_str());
+      logDebug(lf_main, "unable to write config cache file %s", cacheFile.c_str());
+    }
+  }
+  return true;
+}
+
 /**
  * Collect configuration files matching the prefix and extension from the specified path.
  * @param relPath the relative path from which to collect the files (without trailing "/").
@@ -755,9 +1200,8 @@ static result_t collectConfigFiles(const string& relPath, const string& prefix,
     vector<string>* dirs = nullptr, bool* hasTemplates = nullptr) {
   const string relPathWithSlash = relPath.empty() ? "" : relPath + "/";
   if (!s_configUriPrefix.empty()) {
-    string uri = s_configUriPrefix + relPathWithSlash + "?t=" + extension.substr(1) + query;
     string names;
-    if (!s_configHttpClient.get(uri, "", &names)) {
+    if (!getFromConfigServer(&s_configHttpClient, relPathWithSlash + "?t=" + extension.substr(1) + query, &names)) {
       return RESULT_ERR_NOTFOUND;
     }
     istringstream stream(names);
@@ -818,7 +1262,12 @@ static result_t collectConfigFiles(const string& relPath, const string& prefix,
   return RESULT_OK;
 }
 
-DataFieldTemplates* getTemplates(const string& filename) {
+/**
+ * Get the shared @a DataFieldTemplates for the specified file name.
+ * @param filename the name of the file being read, or "*" for the ones of any loaded path.
+ * @return the shared @a DataFieldTemplates.
+ */
+static DataFieldTemplates* getSharedTemplates(const string& filename) {
   if (filename == "*") {
     unsigned long maxLength = 0;
     DataFieldTemplates* best = nullptr;
@@ -844,6 +1293,18 @@ DataFieldTemplates* getTemplates(const string& filename) {
   return &s_globalTemplates;
 }
 
+DataFieldTemplates* getTemplates(const string& filename) {
+  DataFieldTemplates* templates = getSharedTemplates(filename);
+  if (!s_threadTemplates) {
+    return templates;
+  }
+  DataFieldTemplates*& copy = (*s_threadTemplates)[templates];
+  if (!copy) {
+    copy = new DataFieldTemplates(*templates);
+  }
+  return copy;
+}
+
 /**
  * Read the @a DataFieldTemplates for the specified path if necessary.
  * @param relPath the relative path from which to read the files (without trailing "/").
@@ -883,6 +1344,200 @@ static bool readTemplates(const string relPath, const string extension, bool ava
   return false;
 }
 
+/** the maximum number of threads for splitting configuration files in parallel. */
+#define CONFIG_SPLIT_THREADS 4
+
+/**
+ * A @a FileReader only splitting the rows of a configuration file into a @a RowCache.
+ */
+class RowSplitter : public FileReader {
+ public:
+  // @copydoc
+  result_t addFromFile(const string& filename, unsigned int lineNo, vector<string>* row,
+      string* errorDescription, bool replace) override {
+    return RESULT_OK;
+  }
+};
+
+/**
+ * Split the rows of a configuration file, preferably from its @a RowCache file when still valid.
+ * @param filename the relative name of the configuration file.
+ * @param client the @a HttpClient to use for retrieving the file from HTTP.
+ * @return the complete @a RowCache ready for replay (to be freed by the caller), or nullptr when the file has to be
+ * read directly instead.
+ */
+static RowCache* splitConfigFile(const string& filename, HttpClient* client) {
+  const string cacheFile = getConfigCacheFile(filename);
+  istream* stream = nullptr;
+  time_t mtime = 0;
+  size_t sourceSize = 0;
+  uint64_t sourceKey = 0;
+  string errorDescription;
+  if (s_configUriPrefix.empty()) {
+    struct stat st;
+    const string path = s_configLocalPrefix + filename;
+    if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+      return nullptr;
+    }
+    mtime = st.st_mtime;
+    sourceSize = static_cast<size_t>(st.st_size);
+    sourceKey = getConfigFileKey(st);
+    if (!cacheFile.empty()) {
+      RowCache* cache = new RowCache(cacheFile, mtime, sourceKey);
+      if (cache->load()) {
+        return cache;
+      }
+      delete cache;
+    }
+    stream = FileReader::openFile(path, &errorDescription);
+  } else {
+    string content;
+    if (!getFromConfigServer(client, filename, &content, &mtime)) {
+      return nullptr;
+    }
+    sourceSize = content.length();
+    sourceKey = getConfigContentKey(content);
+    if (!cacheFile.empty()) {
+      RowCache* cache = new RowCache(cacheFile, mtime, sourceKey);
+      if (cache->load()) {
+        return cache;
+      }
+      delete cache;
+    }
+    stream = new istringstream(content);
+  }
+  if (!stream) {
+    return nullptr;
+  }
+  RowCache* cache = new RowCache(cacheFile, mtime, sourceKey);
+  RowSplitter splitter;
+  result_t result = splitter.readFromStream(stream, filename, mtime, false, nullptr, &errorDescription, false,
+      nullptr, nullptr, cache);
+  delete(stream);
+  if (result != RESULT_OK) {
+    // let the serial load report the error
+    delete cache;
+    return nullptr;
+  }
+  if (!cacheFile.empty() && sourceSize > 0 && !cache->save()) {
+    logDebug(lf_main, "unable to write config cache file %s", cacheFile.c_str());
+  }
+  return cache;
+}
+
+/**
+ * A @a Thread splitting the rows of the pending configuration files.
+ */
+class ConfigSplitThread : public Thread {
+ public:
+  /**
+   * Constructor.
+   * @param files the relative names of the configuration files to split.
+   * @param caches the @a vector in which to store the @a RowCache per file.
+   * @param nextFile the index of the next file to split (shared between all threads).
+   * @param mutex the @a Mutex for accessing @a nextFile.
+   */
+  ConfigSplitThread(const vector<string>& files, vector<RowCache*>* caches, size_t* nextFile, Mutex* mutex)
+    : Thread(), m_files(files), m_caches(caches), m_nextFile(nextFile), m_mutex(mutex) {
+    if (!s_configUriPrefix.empty()) {
+      m_client.connect(s_configHost, s_configPort, PACKAGE_NAME "/" PACKAGE_VERSION);
+    }
+  }
+
+
+ protected:
+  // @copydoc
+  void run() override {
+    while (true) {
+      m_mutex->lock();
+      size_t index = (*m_nextFile)++;
+      m_mutex->unlock();
+      if (index >= m_files.size()) {
+        break;
+      }
+      (*m_caches)[index] = splitConfigFile(m_files[index], &m_client);
+    }
+    m_client.disconnect();
+  }
+
+
+ private:
+  /** the relative names of the configuration files to split. */
+  const vector<string>& m_files;
+
+  /** the @a vector in which to store the @a RowCache per file. */
+  vector<RowCache*>* m_caches;
+
+  /** the index of the next file to split. */
+  size_t* m_nextFile;
+
+  /** the @a Mutex for accessing @a m_nextFile. */
+  Mutex* m_mutex;
+
+  /** the own @a HttpClient for retrieving configuration files from HTTP in parallel. */
+  HttpClient m_client;
+};
+
+/**
+ * Split the rows of several configuration files in parallel for a subsequent serial load.
+ * @param files the relative names of the configuration files to split.
+ * @param caches the @a vector in which to store the @a RowCache per file (nullptr for files to read directly).
+ */
+static void splitConfigFiles(const vector<string>& files, vector<RowCache*>* caches) {
+  caches->assign(files.size(), nullptr);
+  if (files.size() < 2) {
+    return;
+  }
+  size_t count = files.size();
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  if (s_configUriPrefix.empty() && cpus > 0 && count > static_cast<size_t>(cpus)) {
+    // only limit local files to the CPUs as remote ones are mostly waiting for the server
+    count = static_cast<size_t>(cpus);
+  }
+  if (count > CONFIG_SPLIT_THREADS) {
+    count = CONFIG_SPLIT_THREADS;
+  }
+  if (count < 2) {
+    return;
+  }
+  size_t nextFile = 0;
+  Mutex mutex;
+  vector<ConfigSplitThread*> threads;
+  for (size_t i = 0; i < count; i++) {
+    ConfigSplitThread* thread = new ConfigSplitThread(files, caches, &nextFile, &mutex);
+    if (!thread->start("cfgsplit")) {
+      delete thread;
+      break;
+    }
+    threads.push_back(thread);
+  }
+  for (auto thread : threads) {
+    thread->join();
+    delete thread;
+  }
+}
+
+/**
+ * Load the definitions of a configuration file from the rows split before, or directly if not split.
+ * @param reader the @a FileReader instance to load with the definitions.
+ * @param filename the relative name of the file being read.
+ * @param cache the @a RowCache with the split rows (freed afterwards), or nullptr to read the file directly.
+ * @param verbose whether to verbosely add all problems to the error description.
+ * @param defaults the default values by name (potentially overwritten by file name), or nullptr to not use defaults.
+ * @param errorDescription a string in which to store the error description in case of error.
+ * @return @a RESULT_OK on success, or an error code.
+ */
+static result_t loadSplitDefinitions(FileReader* reader, const string& filename, RowCache* cache, bool verbose,
+    map<string, string>* defaults, string* errorDescription) {
+  if (!cache) {
+    return loadDefinitionsFromConfigPath(reader, filename, verbose, defaults, errorDescription);
+  }
+  result_t result = reader->readFromStream(nullptr, filename, cache->getMtime(), verbose, defaults,
+      errorDescription, false, nullptr, nullptr, cache);
+  delete cache;
+  return result;
+}
+
 /**
  * Read the configuration files from the specified path.
  * @param relPath the relative path from which to read the files (without trailing "/").
@@ -902,13 +1557,22 @@ static result_t readConfigFiles(const string& relPath, const string& extension,
     return result;
   }
   readTemplates(relPath, extension, hasTemplates, verbose);
-  for (const auto& name : files) {
-    logInfo(lf_main, "reading file %s", name.c_str());
-    result_t result = loadDefinitionsFromConfigPath(messages, name, verbose, nullptr, errorDescription);
-    if (result != RESULT_OK) {
-      return result;
+  vector<RowCache*> caches;
+  splitConfigFiles(files, &caches);
+  for (size_t index = 0; index < files.size(); index++) {
+    if (result == RESULT_OK) {
+      const string& name = files[index];
+      logInfo(lf_main, "reading file %s", name.c_str());
+      result = loadSplitDefinitions(messages, name, caches[index], verbose, nullptr, errorDescription);
+      if (result == RESULT_OK) {
+        logInfo(lf_main, "successfully read file %s", name.c_str());
+      }
+    } else {
+      delete caches[index];
     }
-    logInfo(lf_main, "successfully read file %s", name.c_str());
+  }
+  if (result != RESULT_OK) {
+    return result;
   }
   if (recursive) {
     for (const auto& name : dirs) {
@@ -923,6 +1587,202 @@ static result_t readConfigFiles(const string& relPath, const string& extension,
   return RESULT_OK;
 }
 
+/** the maximum number of threads for checking configuration files in parallel. */
+#define CONFIG_CHECK_THREADS 64
+
+/** the maximum number of threads fetching remote configuration files in parallel from the same server. */
+#define CONFIG_CHECK_REMOTE_THREADS 4
+
+/**
+ * The outcome of loading a single configuration file into a separate @a MessageMap for the configuration check.
+ */
+struct ConfigCheckResult {
+  MessageMap* messages;     //!< the separate @a MessageMap with the definitions, or nullptr to load serially
+  result_t result;          //!< the result code of loading the file
+  string errorDescription;  //!< the error description in case of error
+  string problems;          //!< the problems written while loading the file verbosely
+};
+
+/**
+ * A @a Thread loading the pending configuration files into separate @a MessageMap instances for the configuration
+ * check, using own copies of the @a DataFieldTemplates.
+ */
+class ConfigCheckThread : public Thread {
+ public:
+  /**
+   * Constructor.
+   * @param files the relative names of the configuration files to load.
+   * @param results the @a vector in which to store the @a ConfigCheckResult per file.
+   * @param nextFile the index of the next file to load (shared between all threads).
+   * @param mutex the @a Mutex for accessing @a nextFile.
+   */
+  ConfigCheckThread(const vector<string>& files, vector<ConfigCheckResult>* results, size_t* nextFile,
+      Mutex* mutex)
+    : Thread(), m_files(files), m_results(results), m_nextFile(nextFile), m_mutex(mutex) {
+    if (!s_configUriPrefix.empty()) {
+      m_client.connect(s_configHost, s_configPort, PACKAGE_NAME "/" PACKAGE_VERSION);
+    }
+  }
+
+  /**
+   * Destructor.
+   */
+  virtual ~ConfigCheckThread() {
+    for (const auto& it : m_templates) {
+      delete it.second;
+    }
+    m_templates.clear();
+  }
+
+
+ protected:
+  // @copydoc
+  void run() override {
+    s_threadTemplates = &m_templates;
+    while (true) {
+      m_mutex->lock();
+      size_t index = (*m_nextFile)++;
+      m_mutex->unlock();
+      if (index >= m_files.size()) {
+        break;
+      }
+      const string& name = m_files[index];
+      RowCache* cache = splitConfigFile(name, &m_client);
+      if (!cache) {
+        continue;  // let the serial load report the error
+      }
+      ConfigCheckResult& check = (*m_results)[index];
+      ostringstream problems;
+      check.messages = new MessageMap(true, "", false);
+      check.messages->setVerboseOutput(&problems);
+      check.result = loadSplitDefinitions(check.messages, name, cache, true, nullptr, &check.errorDescription);
+      check.messages->setVerboseOutput(nullptr);
+      check.problems = problems.str();
+    }
+    s_threadTemplates = nullptr;
+    m_client.disconnect();
+  }
+
+
+ private:
+  /** the relative names of the configuration files to load. */
+  const vector<string>& m_files;
+
+  /** the @a vector in which to store the @a ConfigCheckResult per file. */
+  vector<ConfigCheckResult>* m_results;
+
+  /** the index of the next file to load. */
+  size_t* m_nextFile;
+
+  /** the @a Mutex for accessing @a m_nextFile. */
+  Mutex* m_mutex;
+
+  /** the own @a HttpClient for retrieving configuration files from HTTP in parallel. */
+  HttpClient m_client;
+
+  /** the own copies of the @a DataFieldTemplates by the shared instance. */
+  map<const DataFieldTemplates*, DataFieldTemplates*> m_templates;
+};
+
+/**
+ * Collect the configuration files to check from the specified path and read the templates on the way.
+ * @param relPath the relative path from which to collect the files (without trailing "/").
+ * @param extension the filename extension of the files to collect.
+ * @param recursive whether to collect all files recursively.
+ * @param files the @a vector to which to add the files in the order of the serial load.
+ * @return the result code.
+ */
+static result_t collectCheckFiles(const string& relPath, const string& extension, const bool recursive,
+    vector<string>* files) {
+  vector<string> dirs;
+  bool hasTemplates = false;
+  result_t result = collectConfigFiles(relPath, "", extension, files, false, "", &dirs, &hasTemplates);
+  if (result != RESULT_OK) {
+    return result;
+  }
+  readTemplates(relPath, extension, hasTemplates, true);
+  if (recursive) {
+    for (const auto& name : dirs) {
+      result = collectCheckFiles(name, extension, true, files);
+      if (result != RESULT_OK) {
+        return result;
+      }
+    }
+  }
+  return RESULT_OK;
+}
+
+/**
+ * Check the configuration files from the specified path by loading them in parallel into separate @a MessageMap
+ * instances and moving these over in the order of the files.
+ * @param relPath the relative path from which to read the files (without trailing "/").
+ * @param extension the filename extension of the files to read.
+ * @param recursive whether to load all files recursively.
+ * @param errorDescription a string in which to store the error description of the first failed file.
+ * @param messages the @a MessageMap to load the messages into.
+ * @return the result code of the first failed file, or @a RESULT_OK.
+ */
+static result_t checkConfigFiles(const string& relPath, const string& extension, const bool recursive,
+    string* errorDescription, MessageMap* messages) {
+  vector<string> files;
+  result_t result = collectCheckFiles(relPath, extension, recursive, &files);
+  if (result != RESULT_OK) {
+    return result;
+  }
+  vector<ConfigCheckResult> results(files.size(), {nullptr, RESULT_OK, "", ""});
+  size_t count = files.size();
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  if (s_configUriPrefix.empty() && cpus > 0 && count > static_cast<size_t>(cpus)) {
+    count = static_cast<size_t>(cpus);
+  }
+  size_t maxCount = s_configUriPrefix.empty() ? CONFIG_CHECK_THREADS : CONFIG_CHECK_REMOTE_THREADS;
+  if (count > maxCount) {
+    count = maxCount;
+  }
+  if (count < 2) {
+    count = 0;  // moving over would only add overhead, so load all serially
+  }
+  size_t nextFile = 0;
+  Mutex mutex;
+  vector<ConfigCheckThread*> threads;
+  for (size_t i = 0; i < count; i++) {
+    ConfigCheckThread* thread = new ConfigCheckThread(files, &results, &nextFile, &mutex);
+    if (!thread->start("cfgcheck")) {
+      delete thread;
+      break;
+    }
+    threads.push_back(thread);
+  }
+  for (auto thread : threads) {
+    thread->join();
+    delete thread;
+  }
+  logInfo(lf_main, "loaded %d config files in %d threads", files.size(), threads.size());
+  // report and move over in the order of the serial load
+  for (size_t index = 0; index < files.size(); index++) {
+    const string& name = files[index];
+    ConfigCheckResult& check = results[index];
+    logInfo(lf_main, "reading file %s", name.c_str());
+    if (check.messages) {
+      cout << check.problems;
+      result_t moveResult = messages->takeDefinitions(check.messages);
+      delete check.messages;
+      if (check.result == RESULT_OK) {
+        check.result = moveResult;
+      }
+    } else {
+      check.result = loadSplitDefinitions(messages, name, nullptr, true, nullptr, &check.errorDescription);
+    }
+    if (check.result == RESULT_OK) {
+      logInfo(lf_main, "successfully read file %s", name.c_str());
+    } else if (result == RESULT_OK) {
+      result = check.result;
+      *errorDescription = check.errorDescription;
+    }
+  }
+  return result;
+}
+
 /**
  * Helper method for immediate reading of a @a Message from the bus.
  * @param message the @a Message to read.
@@ -931,7 +1791,14 @@ void readMessage(Message* message) {
   if (!s_mainLoop || !message) {
     return;
   }
-  BusHandler* busHandler = s_mainLoop->getBusHandler();
+  MainLoop* mainLoop = s_mainLoop;
+  for (const auto extraLoop : s_extraMainLoops) {
+    if (extraLoop->getMessages() == s_instructionMessages) {
+      mainLoop = extraLoop;
+      break;
+    }
+  }
+  BusHandler* busHandler = mainLoop->getBusHandler();
   result_t result = busHandler->readFromBus(message, "");
   if (result != RESULT_OK) {
     logError(lf_main, "error reading message %s %s: %s", message->getCircuit().c_str(), message->getName().c_str(),
@@ -947,7 +1814,9 @@ result_t executeInstructions(MessageMap* messages, bool verbose) {
         errorDescription.c_str());
   }
   ostringstream log;
+  s_instructionMessages = messages;
   result = messages->executeInstructions(readMessage, &log);
+  s_instructionMessages = nullptr;
   if (result != RESULT_OK) {
     logError(lf_main, "error executing instructions: %s, last error: %s", getResultCode(result),
         log.str().c_str());
@@ -963,17 +1832,49 @@ result_t loadDefinitionsFromConfigPath(FileReader* reader, const string& filenam
     map<string, string>* defaults, string* errorDescription, bool replace) {
   istream* stream = nullptr;
   time_t mtime = 0;
+  size_t sourceSize = 0;
+  uint64_t sourceKey = 0;
+  string cacheFile = getConfigCacheFile(filename);
   if (s_configUriPrefix.empty()) {
+    struct stat st;
+    if (!cacheFile.empty() && stat((s_configLocalPrefix + filename).c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+      sourceSize = static_cast<size_t>(st.st_size);
+      sourceKey = getConfigFileKey(st);
+      RowCache cache(cacheFile, st.st_mtime, sourceKey);
+      if (cache.load()) {
+        // unchanged since cached, so the file itself does not need to be read
+        return reader->readFromStream(nullptr, filename, st.st_mtime, verbose, defaults, errorDescription, replace,
+            nullptr, nullptr, &cache);
+      }
+    }
     stream = FileReader::openFile(s_configLocalPrefix + filename, errorDescription, &mtime);
   } else {
     string content;
-    if (s_configHttpClient.get(s_configUriPrefix + filename, "", &content, &mtime)) {
+    if (getFromConfigServer(&s_configHttpClient, filename, &content, &mtime)) {
+      sourceSize = content.length();
+      sourceKey = getConfigContentKey(content);
+      if (!cacheFile.empty()) {
+        RowCache cache(cacheFile, mtime, sourceKey);
+        if (cache.load()) {
+          return reader->readFromStream(nullptr, filename, mtime, verbose, defaults, errorDescription, replace,
+              nullptr, nullptr, &cache);
+        }
+      }
       stream = new istringstream(content);
     }
   }
   result_t result;
   if (stream) {
-    result = reader->readFromStream(stream, filename, mtime, verbose, defaults, errorDescription, replace);
+    if (cacheFile.empty() || sourceSize == 0) {
+      result = reader->readFromStream(stream, filename, mtime, verbose, defaults, errorDescription, replace);
+    } else {
+      RowCache cache(cacheFile, mtime, sourceKey);
+      result = reader->readFromStream(stream, filename, mtime, verbose, defaults, errorDescription, replace,
+          nullptr, nullptr, &cache);
+      if (result == RESULT_OK && !cache.save()) {
+        logDebug(lf_main, "unable to write config cache file %s", cacheFile.c_str());
+      }
+    }
     delete(stream);
   } else {
     result = RESULT_ERR_NOTFOUND;
@@ -981,10 +1882,10 @@ result_t loadDefinitionsFromConfigPath(FileReader* reader, const string& filenam
   return result;
 }
 
-result_t loadConfigFiles(MessageMap* messages, bool verbose, bool denyRecursive) {
-  logInfo(lf_main, "loading configuration files from %s", opt.configPath);
-  messages->lock();
-  messages->clear();
+/**
+ * Drop all loaded templates while holding the config mutex.
+ */
+static void clearTemplatesLocked() {
   s_globalTemplates.clear();
   for (auto& it : s_templatesByPath) {
     if (it.second != &s_globalTemplates) {
@@ -993,10 +1894,22 @@ result_t loadConfigFiles(MessageMap* messages, bool verbose, bool denyRecursive)
     it.second = nullptr;
   }
   s_templatesByPath.clear();
+}
+
+result_t loadConfigFiles(MessageMap* messages, bool verbose, bool denyRecursive) {
+  logInfo(lf_main, "loading configuration files from %s", opt.configPath);
+  s_configMutex.lock();
+  messages->lock();
+  messages->clear();
+  clearTemplatesLocked();
 
   string errorDescription;
-  result_t result = readConfigFiles("", ".csv",
-      (!opt.scanConfig || opt.checkConfig) && !denyRecursive, verbose, &errorDescription, messages);
+  result_t result;
+  if (opt.checkConfig) {
+    result = checkConfigFiles("", ".csv", !denyRecursive, &errorDescription, messages);
+  } else {
+    result = readConfigFiles("", ".csv", !opt.scanConfig && !denyRecursive, verbose, &errorDescription, messages);
+  }
   if (result == RESULT_OK) {
     logInfo(lf_main, "read config files");
   } else {
@@ -1004,10 +1917,21 @@ result_t loadConfigFiles(MessageMap* messages, bool verbose, bool denyRecursive)
         getResultCode(result), errorDescription.c_str());
   }
   messages->unlock();
+  s_configHttpClient.disconnect();
+  s_configMutex.unlock();
   return opt.checkConfig ? result : RESULT_OK;
 }
 
-result_t loadScanConfigFile(MessageMap* messages, symbol_t address, bool verbose, string* relativeFile) {
+/**
+ * Load the message definitions from a configuration file matching the scan result while holding the config mutex.
+ * @param messages the @a MessageMap to load the messages into.
+ * @param address the address of the scan participant.
+ * @param verbose whether to verbosely log problems.
+ * @param relativeFile the string in which the name of the configuration file is stored on success.
+ * @return the result code.
+ */
+static result_t loadScanConfigFileLocked(MessageMap* messages, symbol_t address, bool verbose,
+    string* relativeFile) {
   Message* message = messages->getScanMessage(address);
   if (!message || message->getLastUpdateTime() == 0) {
     return RESULT_ERR_NOTFOUND;
@@ -1147,6 +2071,7 @@ result_t loadScanConfigFile(MessageMap* messages, symbol_t address, bool verbose
 
   // found the right file. load the templates if necessary, then load the file itself
   bool readCommon = readTemplates(manufStr, ".csv", hasTemplates, opt.checkConfig);
+  vector<string> loadFiles;
   if (readCommon) {
     result = collectConfigFiles(manufStr, "", ".csv", &files, true, "&a=-");
     if (result == RESULT_OK && !files.empty()) {
@@ -1156,21 +2081,30 @@ result_t loadScanConfigFile(MessageMap* messages, symbol_t address, bool verbose
           continue;
         }
         if (baseName.length() < 3 || baseName.find_first_of('.') != 2) {  // different from the scheme "ZZ."
-          string errorDescription;
-          result = loadDefinitionsFromConfigPath(messages, name, verbose, nullptr, &errorDescription);
-          if (result == RESULT_OK) {
-            logNotice(lf_main, "read common config file %s", name.c_str());
-          } else {
-            logError(lf_main, "error reading common config file %s: %s, %s", name.c_str(), getResultCode(result),
-                errorDescription.c_str());
-          }
+          loadFiles.push_back(name);
         }
       }
     }
   }
+  loadFiles.push_back(best);
+  vector<RowCache*> caches;
+  splitConfigFiles(loadFiles, &caches);
+  size_t bestIndex = loadFiles.size()-1;
+  for (size_t index = 0; index < bestIndex; index++) {
+    const string& name = loadFiles[index];
+    string errorDescription;
+    result = loadSplitDefinitions(messages, name, caches[index], verbose, nullptr, &errorDescription);
+    if (result == RESULT_OK) {
+      logNotice(lf_main, "read common config file %s", name.c_str());
+    } else {
+      logError(lf_main, "error reading common config file %s: %s, %s", name.c_str(), getResultCode(result),
+          errorDescription.c_str());
+    }
+  }
   bestDefaults["name"] = ident;
   string errorDescription;
-  result = loadDefinitionsFromConfigPath(messages, best, verbose, &bestDefaults, &errorDescription);
+  result = loadSplitDefinitions(messages, best, caches[bestIndex], verbose, &bestDefaults, &errorDescription);
+  s_configHttpClient.disconnect();
   if (result != RESULT_OK) {
     logError(lf_main, "error reading scan config file %s for ID \"%s\", SW%4.4d, HW%4.4d: %s, %s", best.c_str(),
         ident.c_str(), sw, hw, getResultCode(result), errorDescription.c_str());
@@ -1181,6 +2115,154 @@ result_t loadScanConfigFile(MessageMap* messages, symbol_t address, bool verbose
   return RESULT_OK;
 }
 
+result_t loadScanConfigFile(MessageMap* messages, symbol_t address, bool verbose, string* relativeFile) {
+  s_configMutex.lock();
+  result_t result = loadScanConfigFileLocked(messages, address, verbose, relativeFile);
+  s_configMutex.unlock();
+  return result;
+}
+
+/**
+ * Log the configuration files that were added, changed, or removed between two loads.
+ * @param before the @a MessageMap with the previously loaded files.
+ * @param after the @a MessageMap with the newly loaded files.
+ * @return the number of added, changed, or removed files.
+ */
+static size_t logChangedConfigFiles(const MessageMap* before, const MessageMap* after) {
+  size_t changed = 0;
+  string comment;
+  size_t hash, size, previousHash, previousSize;
+  time_t time;
+  for (const auto& name : after->getLoadedFiles()) {
+    after->getLoadedFileInfo(name, &comment, &hash, &size, &time);
+    if (!before->getLoadedFileInfo(name, &comment, &previousHash, &previousSize, &time)) {
+      logInfo(lf_main, "config file %s added", name.c_str());
+      changed++;
+    } else if (hash != previousHash || size != previousSize) {
+      logInfo(lf_main, "config file %s changed", name.c_str());
+      changed++;
+    }
+  }
+  for (const auto& name : before->getLoadedFiles()) {
+    if (!after->getLoadedFileInfo(name, &comment)) {
+      logInfo(lf_main, "config file %s removed", name.c_str());
+      changed++;
+    }
+  }
+  return changed;
+}
+
+/**
+ * Copy the definitions parsed into a shared @a MessageMap to the @a MessageMap of a bus while holding the config
+ * mutex.
+ * @param shared the parsed @a MessageMap to copy from.
+ * @param messages the @a MessageMap of the bus to copy to.
+ */
+static void copySharedConfigLocked(MessageMap* shared, MessageMap* messages) {
+  messages->lock();
+  messages->clear();
+  result_t result = messages->copyDefinitions(*shared);
+  messages->unlock();
+  if (result != RESULT_OK) {
+    logError(lf_main, "error copying config for bus %s: %s", messages->getCircuitPrefix().c_str(),
+        getResultCode(result));
+  }
+  s_sharedMessageMapByBus[messages] = shared;
+}
+
+/**
+ * Free the parsed @a MessageMap instances no longer referenced by any bus while holding the config mutex.
+ */
+static void freeSharedConfigsLocked() {
+  for (auto it = s_sharedMessageMaps.begin(); it != s_sharedMessageMaps.end(); ) {
+    bool used = *it == s_sharedMessageMap;
+    for (const auto& bus : s_sharedMessageMapByBus) {
+      used = used || bus.second == *it;
+    }
+    if (used) {
+      it++;
+    } else {
+      delete *it;
+      it = s_sharedMessageMaps.erase(it);
+    }
+  }
+}
+
+result_t reloadConfigFiles(MessageMap* messages, const vector<symbol_t>& scanAddresses,
+    vector<symbol_t>* failedAddresses) {
+  logInfo(lf_main, "reloading configuration files from %s", opt.configPath);
+  s_configMutex.lock();
+  clearTemplatesLocked();
+  // build the replacement without blocking the lookups in the active instance
+  MessageMap* replacement = new MessageMap(false, "", false);
+  // with additional buses, the files are parsed into a separate instance the definitions are copied from
+  MessageMap* shared = s_sharedMessageMap ? new MessageMap(false, "", false) : nullptr;
+  string errorDescription;
+  result_t result = readConfigFiles("", ".csv", !opt.scanConfig, false, &errorDescription,
+      shared ? shared : replacement);
+  if (result != RESULT_OK) {
+    logError(lf_main, "error reading config files from %s: %s, last error: %s", opt.configPath,
+        getResultCode(result), errorDescription.c_str());
+  }
+  if (shared) {
+    replacement->setCircuitPrefix(messages->getCircuitPrefix());
+    result_t copyResult = replacement->copyDefinitions(*shared);
+    if (copyResult != RESULT_OK) {
+      logError(lf_main, "error copying config: %s", getResultCode(copyResult));
+    }
+  }
+  for (const auto address : scanAddresses) {
+    // the scan data is needed for finding the matching file again
+    messages->lock();
+    Message* scanMessage = messages->getScanMessage(address);
+    MasterSymbolString master;
+    SlaveSymbolString slave;
+    master = scanMessage->getLastMasterData();
+    slave = scanMessage->getLastSlaveData();
+    time_t updateTime = scanMessage->getLastUpdateTime(), changeTime = scanMessage->getLastChangeTime();
+    messages->unlock();
+    replacement->getScanMessage(address)->restoreLastData(master, slave, updateTime, changeTime);
+    string file;
+    if (loadScanConfigFileLocked(replacement, address, false, &file) == RESULT_OK) {
+      replacement->addLoadedFile(address, file, "");
+    } else {
+      failedAddresses->push_back(address);
+    }
+  }
+  s_configHttpClient.disconnect();
+  s_configMutex.unlock();
+
+  ostringstream previousDump, dump;
+  replacement->dump(true, &dump);
+  messages->lock();
+  size_t changed = logChangedConfigFiles(messages, replacement);
+  messages->dump(true, &previousDump);
+  bool swapped = false;
+  if (changed == 0 && failedAddresses->empty() && previousDump.str() == dump.str()) {
+    messages->unlock();
+    logNotice(lf_main, "configuration unchanged");
+  } else {
+    size_t carried = messages->swapDefinitions(replacement);
+    messages->unlock();
+    swapped = true;
+    logNotice(lf_main, "configuration replaced: %d files changed, took over data of %d messages", changed, carried);
+  }
+  delete replacement;
+  if (shared) {
+    s_configMutex.lock();
+    if (swapped) {
+      s_sharedMessageMaps.push_back(shared);
+      s_sharedMessageMapByBus[messages] = shared;
+      s_sharedMessageMap = shared;
+      freeSharedConfigsLocked();
+    } else {
+      delete shared;
+    }
+    s_configMutex.unlock();
+  }
+  return result;
+}
+
 /**
  * Helper method for parsing a master/slave message pair from a command line argument.
  * @param arg the argument to parse.
@@ -1218,6 +2300,36 @@ bool parseMessage(const string& arg, bool onlyMasterSlave, MasterSymbolString* m
   return true;
 }
 
+/**
+ * Inject the telegrams from the dump file passed via @a options::injectDump into the @a BusHandler while the
+ * @a MainLoop is running.
+ * @param mainLoop the running @a MainLoop.
+ */
+void injectDumpFile(MainLoop* mainLoop) {
+  DumpReader reader(opt.injectDump, opt.injectSpeed, opt.injectLoop);
+  if (!reader.open()) {
+    logError(lf_main, "unable to open inject dump %s", opt.injectDump);
+    return;
+  }
+  logNotice(lf_main, "injecting telegrams from %s dump %s", reader.isTimed() ? "timed" : "plain", opt.injectDump);
+  BusHandler* busHandler = mainLoop->getBusHandler();
+  vector<uint8_t> data;
+  MasterSymbolString master;
+  SlaveSymbolString slave;
+  unsigned int injected = 0, invalid = 0;
+  while (!mainLoop->isShutdown() && reader.next(&data)) {
+    result_t result = splitTelegram(data.data(), data.size(), &master, &slave);
+    if (result == RESULT_OK && isMaster(master[0])) {
+      busHandler->injectMessage(master, slave);
+      injected++;
+    } else if (result != RESULT_EMPTY) {
+      invalid++;
+    }
+  }
+  logNotice(lf_main, "injected %d telegrams in %d passes, skipped %d invalid ones", injected, reader.getPasses(),
+      invalid);
+}
+
 /**
  * Main function.
  * @param argc the number of command line arguments.
@@ -1234,6 +2346,10 @@ int main(int argc, char* argv[]) {
     return EINVAL;
   }
 
+  if (opt.configCache[0] && mkdir(opt.configCache, 0755) != 0 && errno != EEXIST) {
+    logError(lf_main, "unable to create config cache path %s", opt.configCache);
+    opt.configCache = "";
+  }
   string configPath = string(opt.configPath);
   if (configPath.find("://") == string::npos) {
     s_configLocalPrefix = configPath[configPath.length()-1] == '/' ? configPath : configPath + "/";
@@ -1249,10 +2365,15 @@ int main(int argc, char* argv[]) {
       return EINVAL;
     }
     if (!s_configHttpClient.connect(configHost, configPort, PACKAGE_NAME "/" PACKAGE_VERSION)) {
-      logError(lf_main, "invalid configPath URL");
-      return EINVAL;
+      if (!opt.configCache[0]) {
+        logError(lf_main, "invalid configPath URL");
+        return EINVAL;
+      }
+      logNotice(lf_main, "unable to connect to configPath URL, using cached files");
     }
     s_configHttpClient.disconnect();
+    s_configHost = configHost;
+    s_configPort = configPort;
   }
   if (!opt.readOnly && opt.scanConfig && opt.initialScan == 0) {
     opt.initialScan = BROADCAST;
@@ -1315,6 +2436,16 @@ int main(int argc, char* argv[]) {
     logError(lf_main, "unable to create device %s", opt.device);
     return EINVAL;
   }
+  vector<Device*> extraDevices;
+  for (const auto& bus : s_extraBuses) {
+    Device *extraDevice = Device::create(bus.second.c_str(), opt.extraLatency, !opt.noDeviceCheck, opt.readOnly,
+        opt.initialSend);
+    if (extraDevice == nullptr) {
+      logError(lf_main, "unable to create device %s for bus %s", bus.second.c_str(), bus.first.c_str());
+      return EINVAL;
+    }
+    extraDevices.push_back(extraDevice);
+  }
 
   if (!opt.foreground) {
     if (!setLogFile(opt.logFile)) {
@@ -1323,6 +2454,9 @@ int main(int argc, char* argv[]) {
     }
     daemonize();  // make me daemon
   }
+  if (opt.logAsync && !setLogAsync(true)) {
+    logError(lf_main, "unable to start asynchronous log writer");
+  }
 
   // trap signals that we expect to receive
   signal(SIGHUP, signalHandler);
@@ -1335,9 +2469,19 @@ int main(int argc, char* argv[]) {
       : " with single scan" : "");
 
   // load configuration files
-  loadConfigFiles(s_messageMap);
+  if (s_extraBuses.empty()) {
+    loadConfigFiles(s_messageMap);
+  } else {
+    // parse the files only once and copy the definitions to the MessageMap of each bus
+    s_sharedMessageMap = new MessageMap(false, "", false);
+    loadConfigFiles(s_sharedMessageMap);
+    s_configMutex.lock();
+    s_sharedMessageMaps.push_back(s_sharedMessageMap);
+    copySharedConfigLocked(s_sharedMessageMap, s_messageMap);
+    s_configMutex.unlock();
+  }
 
-  // create the MainLoop and start it
+  // create the MainLoop
   s_mainLoop = new MainLoop(opt, device, s_messageMap);
   if (opt.injectMessages) {
     BusHandler* busHandler = s_mainLoop->getBusHandler();
@@ -1351,7 +2495,33 @@ int main(int argc, char* argv[]) {
       busHandler->injectMessage(master, slave);
     }
   }
+
+  // create the MainLoop of each additional bus with its own MessageMap copied from the same configuration and served
+  // by the network and data handlers of the primary MainLoop
+  for (size_t idx = 0; idx < s_extraBuses.size(); idx++) {
+    struct options busOpt = opt;
+    busOpt.busId = s_extraBuses[idx].first.c_str();
+    busOpt.device = s_extraBuses[idx].second.c_str();
+    busOpt.dumpFile = "";  // dump and raw log file are only available on the primary bus
+    busOpt.logRawFile = "";
+    busOpt.updateCheck = false;
+    logNotice(lf_main, "starting bus %s on device %s", busOpt.busId, busOpt.device);
+    // the ident fields of the scan message are shared with the primary MessageMap
+    MessageMap* busMessages = new MessageMap(false, "", false);
+    busMessages->setCircuitPrefix(s_extraBuses[idx].first + ".");
+    s_configMutex.lock();
+    copySharedConfigLocked(s_sharedMessageMap, busMessages);
+    s_configMutex.unlock();
+    s_extraMessageMaps.push_back(busMessages);
+    s_extraMainLoops.push_back(new MainLoop(busOpt, extraDevices[idx], busMessages, s_mainLoop));
+  }
   s_mainLoop->start("mainloop");
+  for (const auto busLoop : s_extraMainLoops) {
+    busLoop->start("busloop");
+  }
+  if (opt.injectDump) {
+    injectDumpFile(s_mainLoop);
+  }
 
   // wait for end of MainLoop
   s_mainLoop->join();
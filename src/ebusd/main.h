@@ -36,6 +36,7 @@ namespace ebusd {
 /** A structure holding all program options. */
 struct options {
   const char* device;  //!< eBUS device (serial device or [udp:]ip:port) [/dev/ttyUSB0]
+  const char* busId;  //!< identifier of an additional bus, or empty for the primary bus
   bool noDeviceCheck;  //!< skip serial eBUS device test
   bool readOnly;  //!< read-only access to the device
   bool initialSend;  //!< send an initial escape symbol after connecting device
@@ -49,8 +50,17 @@ struct options {
   const char* preferLanguage;  //!< preferred language in configuration files
   bool checkConfig;  //!< check CSV config files, then stop
   bool dumpConfig;   //!< dump CSV config files, then stop
+  const char* configCache;  //!< path for caching the split rows of CSV config files, or empty to disable
+  const char* valueStore;  //!< journal file for persisting the last seen message data, or empty to disable
+  const char* scanCache;  //!< file for caching the scan identification of the slaves, or empty to disable
+  const char* sharedValues;  //!< name of the shared memory object for exporting the last data, or empty to disable
+  const char* sharedValuesGroup;  //!< group allowed to read the shared memory object, or empty for owner only
   unsigned int pollInterval;  //!< poll interval in seconds, 0 to disable [5]
+  bool adaptPollInterval;  //!< shorten the poll interval while the bus is idle (only without explicit interval)
   bool injectMessages;  //!< inject remaining arguments as already seen messages
+  const char* injectDump;  //!< dump file to inject as already seen messages, or nullptr
+  unsigned int injectSpeed;  //!< speed factor for injecting a timed dump file, 0 for as fast as possible [1]
+  unsigned int injectLoop;  //!< number of times to inject the dump file, 0 for endless [1]
 
   symbol_t address;  //!< own bus address [31]
   bool answer;  //!< answer to requests from other masters
@@ -58,8 +68,16 @@ struct options {
   unsigned int acquireRetries;  //!< number of retries for bus acquisition [3]
   unsigned int sendRetries;  //!< number of retries for failed sends [2]
   unsigned int receiveTimeout;  //!< timeout for receiving answer from slave in ms [25]
+  bool autoTune;  //!< adjust the latency and receive timeout to the measured bus timing
   unsigned int masterCount;  //!< expected number of masters for arbitration [0]
   bool generateSyn;  //!< enable AUTO-SYN symbol generation
+  bool pipeline;  //!< prepare the next own telegram during the current one and arbitrate on the next SYN
+  unsigned int laneWeights[4];  //!< weights of the request lanes for writes, reads, polls, and scans [8,4,2,1]
+  unsigned int laneMaxWaits[4];  //!< maximum wait in ms of the request lanes [1000,2000,10000,30000]
+  int rtPolicy;  //!< the realtime scheduling policy of the bus thread [SCHED_OTHER]
+  int rtPriority;  //!< the realtime priority of the bus thread [0]
+  int cpuAffinity;  //!< the CPU to pin the bus thread to, or -1 [-1]
+  bool lockMemory;  //!< lock the memory of the process and prefault the bus thread stack
 
   const char* accessLevel;  //!< default access level
   const char* aclFile;  //!< ACL file name
@@ -72,20 +90,26 @@ struct options {
   uint16_t httpPort;  //!< optional port to listen for HTTP connections, 0 to disable [0]
   const char* htmlPath;  //!< path for HTML files served by the HTTP port [/var/ebusd/html]
   bool updateCheck;  //!< perform automatic update check
+  unsigned int historySize;  //!< number of history entries per tier and numeric field, 0 to disable [0]
+  unsigned int historyFields;  //!< maximum number of numeric fields to keep the history for [256]
 
   const char* logFile;  //!< log file name [/var/log/ebusd.log]
   int logAreas;  //!< log areas [all]
   LogLevel logLevel;  //!< log level [notice]
   bool multiLog;  //!< multiple log levels adjusted with --log=...
+  bool logAsync;  //!< write the log asynchronously from a background thread
 
   unsigned int logRaw;  //!< raw log each received/sent byte on the bus (1=messages, 2=bytes)
   const char* logRawFile;  //!< name of raw log file [/var/log/ebusd.log]
   unsigned int logRawSize;  //!< maximum size of raw log file in kB [100]
+  bool logRawAsync;  //!< write the raw log file asynchronously from a background thread
 
   bool dump;  //!< binary dump received bytes
   const char* dumpFile;  //!< name of dump file [/tmp/ebusd_dump.bin]
   unsigned int dumpSize;  //!< maximum size of dump file in kB [100]
   bool dumpFlush;  //!< flush each byte
+  bool dumpAsync;  //!< write the dump file asynchronously from a background thread
+  bool dumpTimed;  //!< dump in the timed format with a timestamp per telegram
 };
 
 /**
@@ -105,6 +129,17 @@ DataFieldTemplates* getTemplates(const string& filename);
  */
 result_t loadConfigFiles(MessageMap* messages, bool verbose = false, bool denyRecursive = false);
 
+/**
+ * Reload the message definitions from configuration files into a separate @a MessageMap and swap them into the
+ * active one afterwards (only if anything changed), taking over the last data of unchanged messages.
+ * @param messages the active @a MessageMap to replace the messages in.
+ * @param scanAddresses the slave addresses for which the scan config file is to be loaded again.
+ * @param failedAddresses the slave addresses for which loading the scan config file again failed.
+ * @return the result code.
+ */
+result_t reloadConfigFiles(MessageMap* messages, const vector<symbol_t>& scanAddresses,
+    vector<symbol_t>* failedAddresses);
+
 /**
  * Load the message definitions from a configuration file matching the scan result.
  * @param messages the @a MessageMap to load the messages into.
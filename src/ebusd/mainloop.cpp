@@ -21,12 +21,18 @@
 #endif
 
 #include "ebusd/mainloop.h"
+#include <sys/stat.h>
+#include <strings.h>
 #include <iomanip>
 #include <deque>
 #include <algorithm>
+#include <cmath>
+#include "ebusd/binaryprotocol.h"
 #include "ebusd/main.h"
 #include "lib/utils/log.h"
 #include "lib/utils/httpclient.h"
+#include "lib/utils/metrics.h"
+#include "lib/utils/trace.h"
 #include "lib/ebus/data.h"
 
 namespace ebusd {
@@ -41,6 +47,126 @@ using std::ifstream;
 /** the number of seconds of permanent missing signal after which to reconnect the device. */
 #define RECONNECT_MISSING_SIGNAL 60
 
+/** the minimum size of a HTTP response body in bytes to pass on as chunk while streaming. */
+#define HTTP_CHUNK_SIZE 16384
+
+/** the minimum size of a HTTP response body in bytes to compress, if accepted by the client. */
+#define HTTP_COMPRESS_MIN_SIZE 1024
+
+/** the maximum total size in bytes of the files held in the @a StaticFileCache. */
+#define STATIC_FILE_CACHE_SIZE (16*1024*1024)
+
+/** the maximum size in bytes of a single file to hold in the @a StaticFileCache. */
+#define STATIC_FILE_MAX_SIZE (1024*1024)
+
+
+/**
+ * Get the entity tag of the encoded variant of a content, so that caches keep the variants apart.
+ * @param etag the quoted entity tag of the unencoded content.
+ * @param encoding the @a HttpEncoding of the variant.
+ * @return the entity tag of the variant.
+ */
+static string getEncodedETag(const string& etag, HttpEncoding encoding) {
+  if (encoding == he_identity || etag.length() < 2) {
+    return etag;
+  }
+  return etag.substr(0, etag.length()-1) + (encoding == he_gzip ? "-gzip\"" : "-deflate\"");
+}
+
+result_t StaticFileCache::get(const string& filename, HttpEncoding encoding, const string& ifNoneMatch,
+    string* etag, string* content, bool* encoded) {
+  time_t now;
+  time(&now);
+  m_mutex.lock();
+  auto it = m_files.find(filename);
+  if (it == m_files.end() || it->second.checked != now) {
+    // check for modification at most once per second
+    struct stat st;
+    if (stat(filename.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+      if (it != m_files.end()) {
+        erase(it);
+      }
+      m_mutex.unlock();
+      return RESULT_ERR_NOTFOUND;
+    }
+    if (it == m_files.end() || it->second.mtime != st.st_mtime || it->second.size != st.st_size) {
+      ifstream ifs;
+      ifs.open(filename.c_str(), ifstream::in | ifstream::binary);
+      if (!ifs.is_open()) {
+        if (it != m_files.end()) {
+          erase(it);
+        }
+        m_mutex.unlock();
+        return RESULT_ERR_NOTFOUND;
+      }
+      string data;
+      data.resize(static_cast<size_t>(st.st_size));
+      ifs.read(&data[0], static_cast<std::streamsize>(data.length()));
+      data.resize(static_cast<size_t>(ifs.gcount()));
+      ifs.close();
+      if (it != m_files.end()) {
+        erase(it);
+      }
+      ostringstream str;
+      str << "\"" << hex << static_cast<uint64_t>(st.st_mtime) << "-" << static_cast<uint64_t>(st.st_size) << "\"";
+      if (data.length() > STATIC_FILE_MAX_SIZE) {
+        // too large for caching
+        m_mutex.unlock();
+        *etag = getEncodedETag(str.str(), encoding);
+        if (!ifNoneMatch.empty() && ifNoneMatch == *etag) {
+          return RESULT_EMPTY;
+        }
+        *encoded = encoding != he_identity && HttpBodyWriter::compress(encoding, data, content);
+        if (!*encoded) {
+          *etag = str.str();
+          content->swap(data);
+        }
+        return RESULT_OK;
+      }
+      if (m_size + data.length() > STATIC_FILE_CACHE_SIZE) {
+        m_files.clear();
+        m_size = 0;
+      }
+      StaticFile* file = &m_files[filename];
+      file->mtime = st.st_mtime;
+      file->size = st.st_size;
+      file->etag = str.str();
+      file->content.swap(data);
+      m_size += file->content.length();
+      it = m_files.find(filename);
+    }
+    it->second.checked = now;
+  }
+  StaticFile* file = &it->second;
+  string* compressed = nullptr;
+  if (encoding != he_identity && file->content.length() >= HTTP_COMPRESS_MIN_SIZE) {
+    compressed = &file->encoded[encoding];
+    if (compressed->empty() && HttpBodyWriter::compress(encoding, file->content, compressed)) {
+      m_size += compressed->length();
+    }
+    if (compressed->empty()) {
+      compressed = nullptr;
+    }
+  }
+  *encoded = compressed != nullptr;
+  *etag = *encoded ? getEncodedETag(file->etag, encoding) : file->etag;
+  if (!ifNoneMatch.empty() && ifNoneMatch == *etag) {
+    m_mutex.unlock();
+    return RESULT_EMPTY;
+  }
+  *content = *encoded ? *compressed : file->content;
+  m_mutex.unlock();
+  return RESULT_OK;
+}
+
+void StaticFileCache::erase(map<string, StaticFile>::iterator it) {
+  m_size -= it->second.content.length();
+  for (const auto& compressed : it->second.encoded) {
+    m_size -= compressed.length();
+  }
+  m_files.erase(it);
+}
+
 
 result_t UserList::getFieldMap(const string& preferLanguage, vector<string>* row, string* errorDescription) const {
   // name,secret,level[,level]*
@@ -72,8 +198,8 @@ result_t UserList::getFieldMap(const string& preferLanguage, vector<string>* row
   return RESULT_OK;
 }
 
-result_t UserList::addFromFile(const string& filename, unsigned int lineNo, map<string, string>* row,
-    vector< map<string, string> >* subRows, string* errorDescription, bool replace) {
+result_t UserList::addFromFile(const string& filename, unsigned int lineNo, MappedRow* row,
+    vector<MappedRow>* subRows, string* errorDescription, bool replace) {
   string name = (*row)["name"];
   string secret = (*row)["secret"];
   if (name.empty()) {
@@ -98,10 +224,12 @@ result_t UserList::addFromFile(const string& filename, unsigned int lineNo, map<
 }
 
 
-MainLoop::MainLoop(const struct options& opt, Device *device, MessageMap* messages)
-  : Thread(), m_device(device), m_reconnectCount(0), m_userList(opt.accessLevel), m_messages(messages),
+MainLoop::MainLoop(const struct options& opt, Device *device, MessageMap* messages, MainLoop* primary)
+  : Thread(), m_busId(opt.busId), m_primary(primary), m_device(device), m_reconnectCount(0),
+    m_userList(opt.accessLevel), m_messages(messages),
     m_address(opt.address), m_scanConfig(opt.scanConfig), m_initialScan(opt.readOnly ? ESC : opt.initialScan),
-    m_polling(opt.pollInterval > 0), m_enableHex(opt.enableHex), m_shutdown(false), m_runUpdateCheck(opt.updateCheck) {
+    m_polling(opt.pollInterval > 0), m_enableHex(opt.enableHex), m_shutdown(false), m_runUpdateCheck(opt.updateCheck),
+    m_reload(true) {
   // open Device
   result_t result = m_device->open();
   if (result != RESULT_OK) {
@@ -111,14 +239,15 @@ MainLoop::MainLoop(const struct options& opt, Device *device, MessageMap* messag
   }
   m_device->setListener(this);
   if (opt.dumpFile[0]) {
-    m_dumpFile = new RotateFile(opt.dumpFile, opt.dumpSize, false, opt.dumpFlush ? 1 : 16);
+    m_dumpFile = new RotateFile(opt.dumpFile, opt.dumpSize, false, opt.dumpFlush ? 1 : 16, opt.dumpAsync,
+        opt.dumpTimed);
     m_dumpFile->setEnabled(opt.dump);
   } else {
     m_dumpFile = nullptr;
   }
   m_logRawEnabled = opt.logRaw != 0;
   if (opt.logRawFile[0] && strcmp(opt.logRawFile, opt.logFile) != 0) {
-    m_logRawFile = new RotateFile(opt.logRawFile, opt.logRawSize, true);
+    m_logRawFile = new RotateFile(opt.logRawFile, opt.logRawSize, true, 16, opt.logRawAsync);
     m_logRawFile->setEnabled(m_logRawEnabled);
   } else {
     m_logRawFile = nullptr;
@@ -140,31 +269,100 @@ MainLoop::MainLoop(const struct options& opt, Device *device, MessageMap* messag
       logError(lf_main, "error reading ACL file \"%s\": %s", opt.aclFile, getResultCode(result));
     }
   }
+  if (opt.valueStore[0]) {
+    // restore the last seen data before polling starts, separately for each bus
+    m_valueStore = new ValueStore(m_busId.empty() ? string(opt.valueStore) : string(opt.valueStore) + "." + m_busId);
+    if (m_valueStore->load() > 0) {
+      m_valueStore->restore(m_messages);
+    }
+    m_valueStore->start("valuestore");
+  } else {
+    m_valueStore = nullptr;
+  }
+  if (opt.sharedValues[0]) {
+    // export the last data in a shared memory object, separately for each bus
+    m_sharedValues = new SharedValuesWriter(m_busId.empty() ? string(opt.sharedValues)
+        : string(opt.sharedValues) + "." + m_busId, SHARED_VALUES_DEFAULT_SLOTS, opt.sharedValuesGroup);
+    result_t result = m_sharedValues->open();
+    if (result != RESULT_OK) {
+      logError(lf_main, "unable to create shared values %s: %s", opt.sharedValues, getResultCode(result));
+      delete m_sharedValues;
+      m_sharedValues = nullptr;
+    }
+  } else {
+    m_sharedValues = nullptr;
+  }
   // create BusHandler
   m_busHandler = new BusHandler(m_device, m_messages,
       m_address, opt.answer,
       opt.acquireRetries, opt.sendRetries,
       opt.acquireTimeout, opt.receiveTimeout,
       opt.masterCount, opt.generateSyn,
-      opt.pollInterval);
+      opt.pollInterval, opt.adaptPollInterval, opt.pipeline, opt.autoTune);
+  for (size_t lane = 0; lane < REQUEST_LANE_COUNT; lane++) {
+    m_busHandler->setRequestLane(static_cast<RequestLane>(lane), opt.laneWeights[lane], opt.laneMaxWaits[lane]);
+  }
+  m_busHandler->setScheduling(opt.rtPolicy, opt.rtPriority, opt.cpuAffinity, opt.lockMemory);
+  m_scanCacheVerifying = SYN;
+  m_scanCacheVerifySince = 0;
+  if (m_scanConfig && opt.scanCache[0]) {
+    // apply the cached identification before any bus traffic, separately for each bus
+    m_scanCache = new ScanCache(m_busId.empty() ? string(opt.scanCache) : string(opt.scanCache) + "." + m_busId);
+    if (m_scanCache->load() > 0) {
+      applyScanCache();
+    }
+  } else {
+    m_scanCache = nullptr;
+  }
   m_busHandler->start("bushandler");
 
   // create network
   m_htmlPath = opt.htmlPath;
-  m_network = new Network(opt.localOnly, opt.port, opt.httpPort, &m_netQueue);
-  m_network->start("network");
-  logInfo(lf_main, "registering data handlers");
-  if (datahandler_register(&m_userList, m_busHandler, messages, &m_dataHandlers)) {
-    logInfo(lf_main, "registered data handlers");
+  m_messages->setUpdateListener(this);
+  if (m_primary) {
+    // an additional bus is served by the network and the data handlers of the primary bus
+    m_network = nullptr;
+    for (const auto dataHandler : m_primary->m_dataHandlers) {
+      DataHandler* busDataHandler = dataHandler->createBusHandler(&m_userList, m_busHandler, messages, m_busId);
+      if (busDataHandler) {
+        m_dataHandlers.push_back(busDataHandler);
+      }
+    }
+    m_primary->m_buses.push_back(this);
   } else {
-    logError(lf_main, "error registering data handlers");
+    m_network = new Network(opt.localOnly, opt.port, opt.httpPort, &m_netQueue);
+    m_network->start("network");
+    logInfo(lf_main, "registering data handlers");
+    if (datahandler_register(&m_userList, m_busHandler, messages, &m_dataHandlers)) {
+      logInfo(lf_main, "registered data handlers");
+    } else {
+      logError(lf_main, "error registering data handlers");
+    }
   }
   m_newlyDefinedMessages = opt.enableDefine ? new MessageMap(true, "", false) : nullptr;
+  m_history = opt.historySize > 0 ? new History(opt.historySize, opt.historyFields) : nullptr;
 }
 
 MainLoop::~MainLoop() {
   m_shutdown = true;
   join();
+  m_messages->setUpdateListener(nullptr);
+  if (m_history) {
+    delete m_history;
+    m_history = nullptr;
+  }
+  if (m_valueStore) {
+    delete m_valueStore;  // writes the pending updates
+    m_valueStore = nullptr;
+  }
+  if (m_scanCache) {
+    delete m_scanCache;
+    m_scanCache = nullptr;
+  }
+  if (m_sharedValues) {
+    delete m_sharedValues;  // removes the shared memory object
+    m_sharedValues = nullptr;
+  }
 
   for (const auto dataHandler : m_dataHandlers) {
     delete dataHandler;
@@ -192,7 +390,12 @@ MainLoop::~MainLoop() {
   }
   NetMessage* msg;
   while ((msg = m_netQueue.pop()) != nullptr) {
-    delete msg;
+    if (m_primary) {
+      // still owned by the client connection of the primary bus
+      msg->setResult("ERR: shutdown", "", nullptr, time(nullptr), true);
+    } else {
+      delete msg;
+    }
   }
   if (m_newlyDefinedMessages) {
     delete m_newlyDefinedMessages;
@@ -206,11 +409,18 @@ MainLoop::~MainLoop() {
 /** the initial delay for running the update check. */
 #define CHECK_INITIAL_DELAY (2*60)
 
+/** the number of @a CommandWorker instances serving the cache lane. */
+#define CACHE_LANE_WORKERS 2
+
+/** the number of @a CommandWorker instances serving the bus lane. */
+#define BUS_LANE_WORKERS 2
+
 void MainLoop::run() {
-  bool reload = true;
-  time_t lastTaskRun, now, start, lastSignal = 0, since, sinkSince = 1, nextCheckRun;
+  time_t lastTaskRun, now, start, lastSignal = 0, sinkSince = 1, nextCheckRun;
+  uint64_t sinkCursor = 0;
   int taskDelay = 5;
   symbol_t lastScanAddress = 0;  // 0 is known to be a master
+  bool scanSeenOnly = true;  // first pass for the slaves seen themselves, then for the slaves of seen masters
   string lastScanStatus = ".";
   time(&now);
   start = now;
@@ -226,6 +436,16 @@ void MainLoop::run() {
     }
     dataHandler->start();
   }
+  for (int i = 0; i < CACHE_LANE_WORKERS+BUS_LANE_WORKERS; i++) {
+    CommandWorker* worker = new CommandWorker(this, i < CACHE_LANE_WORKERS ? &m_cacheLane : &m_busLane);
+    worker->start(i < CACHE_LANE_WORKERS ? "cachelane" : "buslane");
+    m_workers.push_back(worker);
+  }
+  ScanConfigLoader* scanConfigLoader = nullptr;
+  if (m_scanConfig) {
+    scanConfigLoader = new ScanConfigLoader(this, &m_scanLoads);
+    scanConfigLoader->start("scanconfig");
+  }
   while (!m_shutdown) {
     // pick the next message to handle
     NetMessage* netMessage = m_netQueue.pop(taskDelay);
@@ -248,7 +468,7 @@ void MainLoop::run() {
       if (m_scanConfig) {
         bool loadDelay = false;
         string scanStatus = lastScanStatus;
-        if (m_initialScan != ESC && reload && m_busHandler->hasSignal()) {
+        if (m_initialScan != ESC && m_reload && m_busHandler->hasSignal()) {
           loadDelay = true;
           result_t result;
           if (m_initialScan == SYN) {
@@ -275,6 +495,9 @@ void MainLoop::run() {
             logNotice(lf_main, "starting initial scan for %2.2x", m_initialScan);
             result = m_busHandler->scanAndWait(m_initialScan, true);
             if (result == RESULT_OK) {
+              if (m_valueStore) {
+                m_valueStore->restore(m_messages);
+              }
               ostringstream ret;
               if (m_busHandler->formatScanResult(m_initialScan, false, &ret)) {
                 logNotice(lf_main, "initial scan result: %s", ret.str().c_str());
@@ -286,27 +509,47 @@ void MainLoop::run() {
             logError(lf_main, "initial scan failed: %s", getResultCode(result));
           }
           if (result != RESULT_ERR_NO_SIGNAL) {
-            reload = false;
+            m_reload = false;
           }
         }
         if (!loadDelay) {
-          lastScanAddress = m_busHandler->getNextScanAddress(lastScanAddress);
+          // identify the next slave while the configuration of the previous ones is loaded in the background
+          lastScanAddress = m_busHandler->getNextScanAddress(lastScanAddress, scanSeenOnly);
+          if (lastScanAddress == SYN && scanSeenOnly) {
+            scanSeenOnly = false;
+            lastScanAddress = m_busHandler->getNextScanAddress(0, false);
+          }
+          unsigned int loaded, queued;
+          unsigned int total = m_busHandler->getScanProgress(&loaded, &queued);
+          ostringstream progress;
+          progress << "running " << loaded << "/" << total;
+          scanStatus = progress.str();
           if (lastScanAddress == SYN) {
-            taskDelay = 5;
             lastScanAddress = 0;
-            scanStatus = "finished";
-          } else {
-            if (scanStatus != "running") {
-              scanStatus = "running";
+            scanSeenOnly = true;
+            if (queued == 0) {
+              taskDelay = 5;
+              scanStatus = "finished";
+              if ((!m_scanCacheVerify.empty() || m_scanCacheVerifying != SYN)
+                  && now > start + SCANCACHE_VERIFY_DELAY) {
+                verifyScanCache();
+              }
+            } else {
+              taskDelay = 1;  // wait for the background loads
             }
+          } else {
             nextCheckRun = now + CHECK_INITIAL_DELAY;
-            result_t result = m_busHandler->scanAndWait(lastScanAddress, true);
+            DeferredScanLoad* load = nullptr;
+            result_t result = m_busHandler->scanAndDeferLoad(lastScanAddress, &load);
             taskDelay = (result == RESULT_ERR_NO_SIGNAL) ? 10 : 1;
             if (result != RESULT_OK) {
               logError(lf_main, "scan config %2.2x: %s", lastScanAddress, getResultCode(result));
             } else {
               logInfo(lf_main, "scan config %2.2x message received", lastScanAddress);
             }
+            if (load) {
+              m_scanLoads.push(load);
+            }
           }
         }
         if (scanStatus != lastScanStatus && !dataSinks.empty()) {
@@ -315,10 +558,12 @@ void MainLoop::run() {
             dataSink->notifyScanStatus(scanStatus);
           }
         }
-      } else if (reload && m_busHandler->hasSignal()) {
-        reload = false;
+      } else if (m_reload && m_busHandler->hasSignal()) {
+        m_reload = false;
         // execute initial instructions
+        m_commandMutex.lock();
         executeInstructions(m_messages);
+        m_commandMutex.unlock();
         if (m_messages->sizeConditions() > 0 && !m_polling) {
           logError(lf_main, "conditions require a poll interval > 0");
         }
@@ -369,14 +614,20 @@ void MainLoop::run() {
     time(&now);
     if (!dataSinks.empty()) {
       messages.clear();
+      TraceScope traceScope("notifySinks");
+      m_commandMutex.lockShared();
       m_messages->lock();
-      m_messages->findAll("", "", "*", false, true, true, true, true, true, sinkSince, now, false, &messages);
+      if (!m_messages->getUpdates(&sinkCursor, false, &messages)) {
+        messages.clear();
+        m_messages->findAll("", "", "*", false, true, true, true, true, true, sinkSince, now, false, &messages);
+      }
       for (const auto message : messages) {
         for (const auto dataSink : dataSinks) {
           dataSink->notifyUpdate(message);
         }
       }
       m_messages->unlock();
+      m_commandMutex.unlock();
       sinkSince = now;
     }
     if (netMessage == nullptr) {
@@ -386,66 +637,719 @@ void MainLoop::run() {
       netMessage->setResult("ERR: shutdown", "", nullptr, now, true);
       break;
     }
-    string request = netMessage->getRequest();
-    string user = netMessage->getUser();
-    ClientSettings settings = netMessage->getSettings(&since);
-    if (!netMessage->isListeningMode()) {
-      since = now;
-    }
-    ostringstream ostream;
-    bool connected = true;
-    if (request.length() > 0) {
-      logDebug(lf_main, ">>> %s", request.c_str());
-      result_t result = decodeMessage(request, netMessage->isHttp(), &connected, &settings, &user, &reload, &ostream);
-      if (!netMessage->isHttp() && (ostream.tellp() == 0 || result != RESULT_OK)) {
-        if (settings.mode != cm_direct) {
-          ostream.str("");
+    MainLoop* busLoop = getBusLoop(netMessage);
+    if (busLoop != this) {
+      busLoop->addMessage(netMessage);
+      continue;
+    }
+    if (getCommandLane(netMessage) == cl_cache) {
+      m_cacheLane.push(netMessage);
+    } else {
+      m_busLane.push(netMessage);
+    }
+  }
+  for (const auto worker : m_workers) {
+    worker->stop();
+  }
+  for (const auto worker : m_workers) {
+    delete worker;
+  }
+  m_workers.clear();
+  if (scanConfigLoader) {
+    scanConfigLoader->stop();
+    delete scanConfigLoader;
+  }
+  DeferredScanLoad* load;
+  while ((load = m_scanLoads.pop()) != nullptr) {
+    delete load;
+  }
+  time(&now);
+  NetMessage* netMessage;
+  while ((netMessage = m_cacheLane.pop()) != nullptr || (netMessage = m_busLane.pop()) != nullptr) {
+    netMessage->setResult("ERR: shutdown", "", nullptr, now, true);
+  }
+}
+
+CommandLane MainLoop::getCommandLane(NetMessage* message) {
+  const string& request = message->getRequest();
+  if (message->isHttp()) {
+    // only data requests with "required" or "maxage" query may wait for the bus
+    return request.find("required") != string::npos || request.find("maxage") != string::npos
+      ? cl_bus : cl_cache;
+  }
+  if (message->isBinary()) {
+    // only read frames may wait for the bus
+    for (size_t pos = 0, size; pos < request.length(); pos += size) {
+      size = getBinaryFrameSize(request, pos);
+      if (size == 0 || size == string::npos) {
+        break;
+      }
+      if (static_cast<uint8_t>(request[pos+1]) == bft_read) {
+        return cl_bus;
+      }
+    }
+    return cl_cache;
+  }
+  if (message->getSettings().mode == cm_direct) {
+    return cl_bus;
+  }
+  size_t start = request.find_first_not_of(' ');
+  if (start == string::npos) {
+    return cl_cache;  // e.g. listening mode update
+  }
+  size_t end = request.find(' ', start);
+  string cmd = request.substr(start, end == string::npos ? string::npos : end-start);
+  transform(cmd.begin(), cmd.end(), cmd.begin(), ::toupper);
+  if (cmd == "R" || cmd == "READ" || cmd == "W" || cmd == "WRITE" || cmd == "HEX" || cmd == "SCAN"
+      || cmd == "DIRECT") {
+    return cl_bus;
+  }
+  if (cmd == "RELOAD" || cmd == "DEFINE") {
+    return cl_exclusive;
+  }
+  return cl_cache;
+}
+
+MainLoop* MainLoop::getBusLoop(NetMessage* message) {
+  if (m_buses.empty()) {
+    return this;
+  }
+  const string& request = message->getRequest();
+  string busId;
+  if (message->isBinary()) {
+    // the subscriptions bind the connection to their bus, otherwise the first frame referring to a circuit decides
+    string circuit, name;
+    const map<uint32_t, uint8_t>* subscriptions = message->getSubscriptions();
+    if (!subscriptions->empty()) {
+      return getBinaryNames(subscriptions->begin()->first, &circuit, &name) ? getCircuitLoop(circuit) : this;
+    }
+    for (size_t pos = 0, size; pos < request.length(); pos += size) {
+      size = getBinaryFrameSize(request, pos);
+      if (size == 0 || size == string::npos) {
+        break;
+      }
+      uint8_t type = static_cast<uint8_t>(request[pos+1]);
+      size_t start = pos+BINARY_HEADER_SIZE;
+      if (type == bft_resolve) {
+        size_t end = request.find('\0', start);
+        if (end < pos+size) {
+          return getCircuitLoop(request.substr(start, end-start));
         }
-        ostream << getResultCode(result);
+      } else if ((type == bft_read || type == bft_subscribe) && size >= BINARY_HEADER_SIZE+4
+          && getBinaryNames(static_cast<uint32_t>(readBinaryNumber(request, start, 4)), &circuit, &name)) {
+        return getCircuitLoop(circuit);
+      }
+    }
+    return this;
+  }
+  if (message->isHttp()) {
+    // e.g. "GET /data/ID.circuit/name"
+    size_t pos = request.find(" /data/");
+    if (pos == string::npos) {
+      return this;
+    }
+    pos += 7;
+    size_t end = request.find_first_of("./? ", pos);
+    if (end == string::npos || request[end] != '.') {
+      return this;
+    }
+    busId = request.substr(pos, end-pos);
+  } else {
+    ClientSettings settings = message->getSettings();
+    if (settings.mode != cm_normal) {
+      busId = settings.busId;
+    } else {
+      istringstream stream(request);
+      string token;
+      vector<string> args;
+      while (stream >> token) {
+        args.push_back(token);
       }
-      if (ostream.tellp() > 100) {
-        logDebug(lf_main, "<<< %s ...", ostream.str().substr(0, 100).c_str());
+      if (args.size() > 2 && args[1] == "-B") {
+        busId = args[2];
       } else {
-        logDebug(lf_main, "<<< %s", ostream.str().c_str());
+        for (size_t i = 1; i + 1 < args.size(); i++) {
+          if (args[i] == "-c") {
+            size_t end = args[i+1].find('.');
+            if (end != string::npos) {
+              busId = args[i+1].substr(0, end);
+            }
+            break;
+          }
+        }
       }
-      if (ostream.tellp() == 0) {
-        ostream << "\n";  // only for HTTP
-      } else if (!netMessage->isHttp()) {
-        ostream << (settings.mode == cm_direct ? "\n" : "\n\n");
+    }
+  }
+  if (busId.empty()) {
+    return this;
+  }
+  for (const auto bus : m_buses) {
+    if (strcasecmp(bus->m_busId.c_str(), busId.c_str()) == 0) {
+      return bus;
+    }
+  }
+  return this;
+}
+
+MainLoop* MainLoop::getCircuitLoop(const string& circuit) {
+  MainLoop* primary = m_primary ? m_primary : this;
+  size_t end = circuit.find('.');
+  if (end != string::npos) {
+    string busId = circuit.substr(0, end);
+    for (const auto bus : primary->m_buses) {
+      if (strcasecmp(bus->m_busId.c_str(), busId.c_str()) == 0) {
+        return bus;
       }
     }
-    if (settings.mode == cm_listen) {
-      if (!settings.listenOnlyUnknown) {
-        string levels = getUserLevels(user);
+  }
+  return primary;
+}
+
+void MainLoop::handleNetMessage(NetMessage* netMessage) {
+  if (netMessage->isBinary()) {
+    handleBinaryMessage(netMessage);
+    return;
+  }
+  bool exclusive = getCommandLane(netMessage) == cl_exclusive;
+  time_t now, since;
+  time(&now);
+  string request = netMessage->getRequest();
+  string user = netMessage->getUser();
+  ClientSettings settings = netMessage->getSettings(&since);
+  uint64_t cursor = netMessage->getListenCursor();
+  if (!netMessage->isListeningMode()) {
+    since = now;
+    cursor = m_messages->getUpdateSequence();
+  }
+  if (exclusive) {
+    m_commandMutex.lock();
+  } else {
+    m_commandMutex.lockShared();
+  }
+  ostringstream ostream;
+  bool connected = true;
+  if (request.length() > 0) {
+    logDebug(lf_main, ">>> %s", request.c_str());
+    TraceScope traceScope("command");
+    bool reload = false;
+    result_t result = decodeMessage(request, netMessage, &connected, &settings, &user, &reload, &ostream);
+    if (settings.mode != cm_normal) {
+      settings.busId = m_busId;
+    }
+    if (reload) {
+      m_reload = true;
+    }
+    if (!netMessage->isHttp() && (ostream.tellp() == 0 || result != RESULT_OK)) {
+      if (settings.mode != cm_direct) {
+        ostream.str("");
+      }
+      ostream << getResultCode(result);
+    }
+    if (ostream.tellp() > 100) {
+      logDebug(lf_main, "<<< %s ...", ostream.str().substr(0, 100).c_str());
+    } else {
+      logDebug(lf_main, "<<< %s", ostream.str().c_str());
+    }
+    if (ostream.tellp() == 0) {
+      ostream << "\n";  // only for HTTP
+    } else if (!netMessage->isHttp()) {
+      ostream << (settings.mode == cm_direct ? "\n" : "\n\n");
+    }
+  }
+  if (settings.mode == cm_listen) {
+    if (settings.listenOnlyUnknown) {
+      cursor = m_messages->getUpdateSequence();
+    } else {
+      string levels = getUserLevels(user);
+      bool checkLevel = levels != "*";
+      deque<Message*> messages;
+      if (!m_messages->getUpdates(&cursor, true, &messages)) {
+        // the feed was dropped in the meantime, e.g. after reload
         messages.clear();
         m_messages->findAll("", "", levels, false, true, true, true, true, true, since, now, true, &messages);
-        for (const auto message : messages) {
-          ostream << message->getCircuit() << " " << message->getName() << " = " << dec;
-          message->decodeLastData(false, nullptr, -1, settings.format, &ostream);
-          ostream << endl;
-        }
       }
-      if (settings.listenWithUnknown || settings.listenOnlyUnknown) {
-        if (m_busHandler->isGrabEnabled()) {
-          m_busHandler->formatGrabResult(true, false, &ostream, true, since, now);
-        } else {
-          m_busHandler->enableGrab(true);  // needed for listening to all messages
+      for (const auto message : messages) {
+        if (message->getDstAddress() == SYN || (checkLevel && !message->hasLevel(levels, true))
+            || !message->isAvailable()) {
+          continue;
         }
+        ostream << message->getCircuit() << " " << message->getName() << " = " << dec;
+        message->decodeLastData(false, nullptr, -1, settings.format, &ostream);
+        ostream << endl;
       }
-    } else if (settings.mode == cm_direct) {
+    }
+    if (settings.listenWithUnknown || settings.listenOnlyUnknown) {
       if (m_busHandler->isGrabEnabled()) {
-        m_busHandler->formatGrabResult(false, false, &ostream, true, since, now);
+        m_busHandler->formatGrabResult(true, false, &ostream, true, since, now);
+      } else {
+        m_busHandler->enableGrab(true);  // needed for listening to all messages
       }
     }
-    // send result to client
-    netMessage->setResult(ostream.str(), user, &settings, now, !connected);
+  } else if (settings.mode == cm_direct) {
+    if (m_busHandler->isGrabEnabled()) {
+      m_busHandler->formatGrabResult(false, false, &ostream, true, since, now);
+    }
   }
+  m_commandMutex.unlock();
+  // send result to client
+  netMessage->setListenCursor(cursor);
+  netMessage->setResult(ostream.str(), user, &settings, now, !connected);
 }
 
-void MainLoop::notifyDeviceData(symbol_t symbol, bool received) {
-  if (received && m_dumpFile) {
-    m_dumpFile->write(&symbol, 1);
+/**
+ * Append a binary protocol error frame.
+ * @param requestId the request ID.
+ * @param result the error @a result_t code.
+ * @param output the @a string to append to.
+ */
+static void appendBinaryError(uint32_t requestId, result_t result, string* output) {
+  string payload;
+  appendBinaryNumber(static_cast<uint32_t>(result), 4, &payload);
+  payload.append(getResultCode(result));
+  appendBinaryFrame(bft_error, requestId, payload, output);
+}
+
+/**
+ * Append a binary protocol frame with the last data of a @a Message.
+ * @param type the @a BinaryFrameType (value or update).
+ * @param requestId the request ID.
+ * @param handle the handle of the @a Message.
+ * @param flags the requested flags.
+ * @param message the @a Message.
+ * @param output the @a string to append to.
+ */
+static void appendBinaryValue(BinaryFrameType type, uint32_t requestId, uint32_t handle, uint8_t flags,
+    const Message* message, string* output) {
+  string payload;
+  appendBinaryNumber(handle, 4, &payload);
+  appendBinaryNumber(static_cast<uint32_t>(message->getLastUpdateTime()), 4, &payload);
+  payload.push_back(static_cast<char>(flags & BINARY_FLAG_RAW));
+  if (flags & BINARY_FLAG_RAW) {
+    const MasterSymbolString& master = message->getLastMasterData();
+    payload.push_back(static_cast<char>(master.size()));
+    for (size_t pos = 0; pos < master.size(); pos++) {
+      payload.push_back(static_cast<char>(master[pos]));
+    }
+    const SlaveSymbolString& slave = message->getLastSlaveData();
+    payload.push_back(static_cast<char>(slave.size()));
+    for (size_t pos = 0; pos < slave.size(); pos++) {
+      payload.push_back(static_cast<char>(slave[pos]));
+    }
+  } else {
+    size_t count = std::min(message->getFieldCount(), static_cast<size_t>(0xff));
+    payload.push_back(static_cast<char>(count));
+    ostringstream value;
+    for (size_t index = 0; index < count; index++) {
+      value.str("");
+      if (message->decodeLastData(false, nullptr, static_cast<ssize_t>(index), OF_NUMERIC, &value) != RESULT_OK) {
+        payload.push_back(static_cast<char>(fvt_null));
+        continue;
+      }
+      const string str = value.str();
+      char* end = nullptr;
+      double number = strtod(str.c_str(), &end);
+      if (str.empty() || str == NULL_VALUE) {
+        payload.push_back(static_cast<char>(fvt_null));
+      } else if (end != nullptr && *end == 0 && std::isfinite(number)) {
+        payload.push_back(static_cast<char>(fvt_number));
+        appendBinaryDouble(number, &payload);
+      } else {
+        size_t length = std::min(str.length(), static_cast<size_t>(0xffff));
+        payload.push_back(static_cast<char>(fvt_string));
+        appendBinaryNumber(length, 2, &payload);
+        payload.append(str, 0, length);
+      }
+    }
   }
+  appendBinaryFrame(type, requestId, payload, output);
+}
+
+void MainLoop::handleBinaryMessage(NetMessage* netMessage) {
+  time_t now, since;
+  time(&now);
+  const string& request = netMessage->getRequest();
+  string user = netMessage->getUser();
+  ClientSettings settings = netMessage->getSettings(&since);
+  map<uint32_t, uint8_t>* subscriptions = netMessage->getSubscriptions();
+  uint64_t cursor = netMessage->getListenCursor();
+  if (!netMessage->isListeningMode()) {
+    since = now;
+    cursor = m_messages->getUpdateSequence();
+  }
+  string levels = getUserLevels(user);
+  bool connected = true;
+  string output;
+  vector<Message*> busMessages;
+  map<Message*, size_t> busIndexes;
+  vector<uint32_t> busRequestIds, busHandles;
+  vector<uint8_t> busFlags;
+  vector<size_t> busMessageIndexes;
+  m_commandMutex.lockShared();
+  if (!request.empty()) {
+    logDebug(lf_main, ">>> binary request of %d bytes", request.length());
+  }
+  for (size_t pos = 0; pos < request.length(); ) {
+    size_t size = getBinaryFrameSize(request, pos);
+    if (size == 0 || size == string::npos) {
+      appendBinaryError(0, RESULT_ERR_INVALID_ARG, &output);
+      connected = false;
+      break;
+    }
+    uint8_t type = static_cast<uint8_t>(request[pos+1]);
+    uint32_t requestId = static_cast<uint32_t>(readBinaryNumber(request, pos+4, 4));
+    string payload = request.substr(pos+BINARY_HEADER_SIZE, size-BINARY_HEADER_SIZE);
+    pos += size;
+    uint32_t handle = payload.length() >= 4 ? static_cast<uint32_t>(readBinaryNumber(payload, 0, 4)) : 0;
+    string circuit, name;
+    switch (type) {
+    case bft_resolve: {
+      size_t end = payload.find('\0');
+      size_t nameEnd = end == string::npos ? string::npos : payload.find('\0', end+1);
+      if (nameEnd == string::npos || nameEnd == end+1) {
+        appendBinaryError(requestId, RESULT_ERR_INVALID_ARG, &output);
+        break;
+      }
+      circuit = payload.substr(0, end);
+      name = payload.substr(end+1, nameEnd-end-1);
+      if (getCircuitLoop(circuit) != this) {
+        appendBinaryError(requestId, RESULT_ERR_INVALID_ARG, &output);  // not on the bus of this request
+        break;
+      }
+      m_messages->lock();
+      Message* message = m_messages->find(circuit, name, levels, false);
+      if (!message) {
+        message = m_messages->find(circuit, name, levels, false, true);
+      }
+      if (message) {
+        circuit = m_messages->getCircuitPrefix() + message->getCircuit();
+        name = message->getName();
+      }
+      m_messages->unlock();
+      if (!message) {
+        appendBinaryError(requestId, RESULT_ERR_NOTFOUND, &output);
+        break;
+      }
+      string reply;
+      appendBinaryNumber(getBinaryHandle(circuit, name, true), 4, &reply);
+      appendBinaryFrame(bft_handle, requestId, reply, &output);
+      break;
+    }
+    case bft_read: {
+      if (payload.length() < 7) {
+        appendBinaryError(requestId, RESULT_ERR_INVALID_ARG, &output);
+        break;
+      }
+      if (!getBinaryNames(handle, &circuit, &name)) {
+        appendBinaryError(requestId, RESULT_ERR_NOTFOUND, &output);
+        break;
+      }
+      if (getCircuitLoop(circuit) != this) {
+        appendBinaryError(requestId, RESULT_ERR_INVALID_ARG, &output);  // not on the bus of this request
+        break;
+      }
+      time_t maxAge = static_cast<time_t>(readBinaryNumber(payload, 4, 2));
+      uint8_t flags = static_cast<uint8_t>(payload[6]);
+      m_messages->lock();
+      Message* message = m_messages->find(circuit, name, levels, false);
+      Message* cacheMessage = maxAge > 0 ? m_messages->find(circuit, name, levels, false, true) : nullptr;
+      if (!cacheMessage || (message && message->getLastUpdateTime() > cacheMessage->getLastUpdateTime())) {
+        cacheMessage = message;  // message is newer/better
+      }
+      if (cacheMessage && (cacheMessage->getLastUpdateTime() + maxAge > now
+                           || (cacheMessage->isPassive() && cacheMessage->getLastUpdateTime() != 0))) {
+        appendBinaryValue(bft_value, requestId, handle, flags, cacheMessage, &output);
+      } else if (!message) {
+        appendBinaryError(requestId, cacheMessage ? RESULT_EMPTY : RESULT_ERR_NOTFOUND, &output);
+      } else if (message->getDstAddress() == SYN) {
+        appendBinaryError(requestId, RESULT_ERR_INVALID_ADDR, &output);
+      } else {
+        // read several requests for the same message only once
+        auto inserted = busIndexes.insert({message, busMessages.size()});
+        if (inserted.second) {
+          busMessages.push_back(message);
+        }
+        busMessageIndexes.push_back(inserted.first->second);
+        busRequestIds.push_back(requestId);
+        busHandles.push_back(handle);
+        busFlags.push_back(flags);
+      }
+      m_messages->unlock();
+      break;
+    }
+    case bft_subscribe:
+      if (payload.length() < 5) {
+        appendBinaryError(requestId, RESULT_ERR_INVALID_ARG, &output);
+      } else if (!getBinaryNames(handle, &circuit, &name)) {
+        appendBinaryError(requestId, RESULT_ERR_NOTFOUND, &output);
+      } else if (getCircuitLoop(circuit) != this) {
+        appendBinaryError(requestId, RESULT_ERR_INVALID_ARG, &output);  // not on the bus of this connection
+      } else {
+        (*subscriptions)[handle] = static_cast<uint8_t>(payload[4]);
+        appendBinaryFrame(bft_ok, requestId, "", &output);
+      }
+      break;
+    case bft_unsubscribe:
+      if (payload.length() < 4) {
+        appendBinaryError(requestId, RESULT_ERR_INVALID_ARG, &output);
+        break;
+      }
+      if (handle == 0) {
+        subscriptions->clear();
+      } else {
+        subscriptions->erase(handle);
+      }
+      appendBinaryFrame(bft_ok, requestId, "", &output);
+      break;
+    default:
+      appendBinaryError(requestId, RESULT_ERR_INVALID_ARG, &output);
+    }
+  }
+  if (!busMessages.empty()) {
+    // read the remaining ones from the bus together, responses are identified by the request ID
+    vector<result_t> results;
+    m_busHandler->readFromBus(busMessages, &results);
+    for (size_t idx = 0; idx < busRequestIds.size(); idx++) {
+      size_t messageIdx = busMessageIndexes[idx];
+      if (results[messageIdx] == RESULT_OK) {
+        appendBinaryValue(bft_value, busRequestIds[idx], busHandles[idx], busFlags[idx], busMessages[messageIdx],
+            &output);
+      } else {
+        appendBinaryError(busRequestIds[idx], results[messageIdx], &output);
+      }
+    }
+  }
+  if (!subscriptions->empty()) {
+    bool checkLevel = levels != "*";
+    deque<Message*> messages;
+    if (!m_messages->getUpdates(&cursor, true, &messages)) {
+      // the feed was dropped in the meantime, e.g. after reload
+      messages.clear();
+      m_messages->findAll("", "", levels, false, true, true, true, true, true, since, now, true, &messages);
+    }
+    for (const auto message : messages) {
+      if (message->getDstAddress() == SYN || (checkLevel && !message->hasLevel(levels, true))
+          || !message->isAvailable()) {
+        continue;
+      }
+      uint32_t handle = getBinaryHandle(m_messages->getCircuitPrefix() + message->getCircuit(), message->getName(),
+          false);
+      auto it = subscriptions->find(handle);
+      if (it != subscriptions->end()) {
+        appendBinaryValue(bft_update, 0, handle, it->second, message, &output);
+      }
+    }
+  }
+  m_commandMutex.unlock();
+  settings.mode = subscriptions->empty() ? cm_normal : cm_listen;
+  netMessage->setListenCursor(cursor);
+  netMessage->setResult(output, user, &settings, now, !connected);
+}
+
+uint32_t MainLoop::getBinaryHandle(const string& circuit, const string& name, bool create) {
+  if (m_primary) {
+    return m_primary->getBinaryHandle(circuit, name, create);
+  }
+  string key = circuit + "\t" + name;
+  uint32_t handle = 0;
+  m_binaryLock.lock();
+  const auto it = m_binaryHandles.find(key);
+  if (it != m_binaryHandles.end()) {
+    handle = it->second;
+  } else if (create) {
+    m_binaryNames.push_back(std::make_pair(circuit, name));
+    handle = static_cast<uint32_t>(m_binaryNames.size());
+    m_binaryHandles[key] = handle;
+  }
+  m_binaryLock.unlock();
+  return handle;
+}
+
+bool MainLoop::getBinaryNames(uint32_t handle, string* circuit, string* name) {
+  if (m_primary) {
+    return m_primary->getBinaryNames(handle, circuit, name);
+  }
+  m_binaryLock.lock();
+  bool found = handle > 0 && handle <= m_binaryNames.size();
+  if (found) {
+    *circuit = m_binaryNames[handle-1].first;
+    *name = m_binaryNames[handle-1].second;
+  }
+  m_binaryLock.unlock();
+  return found;
+}
+
+void MainLoop::notifyMessageUpdate(const Message* message) {
+  if (m_history) {
+    m_history->update(message);
+  }
+  if (m_valueStore) {
+    m_valueStore->update(message);
+  }
+  if (m_sharedValues && message->hasLevel(getUserLevels(""), true)) {
+    // the segment is readable without authentication, so only export what is visible by default
+    m_sharedValues->update(message);
+  }
+  Network* network = m_primary ? m_primary->m_network : m_network;
+  if (network != nullptr) {
+    network->notifyUpdate();
+  }
+}
+
+void ScanConfigLoader::run() {
+  while (isRunning()) {
+    DeferredScanLoad* load = m_queue->pop(1);
+    if (load != nullptr) {
+      m_mainLoop->loadScanConfig(load);
+      delete load;
+    }
+  }
+}
+
+void MainLoop::loadScanConfig(const DeferredScanLoad* load) {
+  m_commandMutex.lock();
+  result_t result = m_busHandler->loadScanConfig(load);
+  m_commandMutex.unlock();
+  if (result != RESULT_OK) {
+    logError(lf_main, "scan config %2.2x: %s", load->m_address, getResultCode(result));
+  } else {
+    logInfo(lf_main, "scan config %2.2x loaded", load->m_address);
+    if (m_valueStore) {
+      m_valueStore->restore(m_messages);
+    }
+    if (m_scanCache) {
+      updateScanCache(load->m_address);
+    }
+  }
+}
+
+void MainLoop::applyScanCache() {
+  vector<symbol_t> addresses;
+  m_scanCache->restore(m_messages, &addresses);
+  size_t loaded = 0;
+  for (const auto address : addresses) {
+    string file;
+    result_t result = loadScanConfigFile(m_messages, address, false, &file);
+    if (result != RESULT_OK) {
+      logError(lf_main, "scan cache %2.2x: %s", address, getResultCode(result));
+      continue;  // left to the regular scan
+    }
+    executeInstructions(m_messages);
+    m_busHandler->setScanConfigLoaded(address, file);
+    Message* message = m_messages->getScanMessage(address);
+    ostringstream output;
+    if (message && message->decodeLastData(true, nullptr, -1, 0, &output) == RESULT_OK) {
+      m_busHandler->setScanResult(address, 0, output.str());
+    }
+    updateScanCache(address);
+    m_scanCacheVerify.push_back(address);
+    loaded++;
+  }
+  if (loaded > 0) {
+    logNotice(lf_main, "loaded scan config files of %d slaves from scan cache", static_cast<int>(loaded));
+    if (m_valueStore) {
+      m_valueStore->restore(m_messages);
+    }
+  }
+}
+
+void MainLoop::updateScanCache(symbol_t address) {
+  m_messages->lock();
+  const vector<string>& files = m_messages->getLoadedFiles(address);
+  string file = files.empty() ? "" : files.back();
+  string comment;
+  size_t hash = 0;
+  if (!file.empty()) {
+    m_messages->getLoadedFileInfo(file, &comment, &hash);
+  }
+  m_messages->unlock();
+  if (file.empty()) {
+    return;
+  }
+  ScanCacheEntry entry;
+  if (!m_scanCache->get(address, &entry)) {
+    // newly cached
+  } else if (entry.file != file) {
+    logNotice(lf_main, "scan cache %2.2x: config file changed from %s to %s", address, entry.file.c_str(),
+        file.c_str());
+  } else if (entry.hash != hash) {
+    logNotice(lf_main, "scan cache %2.2x: config file %s changed", address, file.c_str());
+  }
+  m_scanCache->update(address, m_messages->getScanMessage(address), file, hash);
+}
+
+void MainLoop::verifyScanCache() {
+  if (m_scanCacheVerifying == SYN) {
+    symbol_t address = m_scanCacheVerify.back();
+    result_t result = m_busHandler->startScan(address);
+    if (result == RESULT_ERR_DUPLICATE) {
+      return;  // another scan is running, try again later
+    }
+    m_scanCacheVerify.pop_back();
+    if (result != RESULT_OK) {
+      logInfo(lf_main, "scan cache %2.2x: verification failed: %s", address, getResultCode(result));
+      return;
+    }
+    m_scanCacheVerifying = address;
+    time(&m_scanCacheVerifySince);
+    return;
+  }
+  if (m_busHandler->isScanRunning()) {
+    return;  // answer still pending
+  }
+  symbol_t address = m_scanCacheVerifying;
+  m_scanCacheVerifying = SYN;
+  if (!m_busHandler->hasSignal()) {
+    m_scanCacheVerify.push_back(address);  // try again with signal
+    return;
+  }
+  Message* message = m_messages->getScanMessage(address);
+  if (message == nullptr || message->getLastUpdateTime() < m_scanCacheVerifySince) {
+    logNotice(lf_main, "scan cache %2.2x: no answer, removing identification", address);
+    m_scanCache->remove(address);
+    return;
+  }
+  if (m_scanCache->matches(address, message)) {
+    logInfo(lf_main, "scan cache %2.2x: identification verified", address);
+    return;
+  }
+  logNotice(lf_main, "scan cache %2.2x: identification changed, reloading configuration", address);
+  m_scanCache->remove(address);
+  m_commandMutex.lock();
+  result_t result = reloadConfig();
+  if (result == RESULT_OK) {
+    executeInstructions(m_messages);
+  }
+  m_commandMutex.unlock();
+  if (result != RESULT_OK) {
+    logError(lf_main, "scan cache %2.2x: reload failed: %s", address, getResultCode(result));
+    return;
+  }
+  updateScanCache(address);  // cache the new identification
+}
+
+result_t MainLoop::reloadConfig() {
+  vector<symbol_t> loadedAddresses, failedAddresses;
+  m_busHandler->prepareScanConfigReload(&loadedAddresses);
+  result_t result = reloadConfigFiles(m_messages, loadedAddresses, &failedAddresses);
+  for (const auto address : failedAddresses) {
+    m_busHandler->resetScanConfigLoaded(address);
+  }
+  if (m_valueStore) {
+    m_valueStore->restore(m_messages);
+  }
+  return result;
+}
+
+void CommandWorker::run() {
+  while (isRunning()) {
+    NetMessage* netMessage = m_queue->pop(1);
+    if (netMessage != nullptr) {
+      m_mainLoop->handleNetMessage(netMessage);
+    }
+  }
+}
+
+void MainLoop::notifyDeviceData(symbol_t symbol, bool received) {
   if (!m_logRawFile && !m_logRawEnabled) {
     return;
   }
@@ -490,6 +1394,12 @@ void MainLoop::notifyDeviceData(symbol_t symbol, bool received) {
   }
 }
 
+void MainLoop::notifyDeviceReceived(const symbol_t* symbols, size_t count) {
+  if (m_dumpFile) {
+    m_dumpFile->write(symbols, count);
+  }
+}
+
 void MainLoop::notifyStatus(bool error, const char* message) {
   if (error) {
     logError(lf_bus, "device status: %s", message);
@@ -498,8 +1408,9 @@ void MainLoop::notifyStatus(bool error, const char* message) {
   }
 }
 
-result_t MainLoop::decodeMessage(const string &data, bool isHttp, bool* connected, ClientSettings* settings,
-    string* user, bool* reload, ostringstream* ostream) {
+result_t MainLoop::decodeMessage(const string &data, NetMessage* netMessage, bool* connected,
+    ClientSettings* settings, string* user, bool* reload, ostringstream* ostream) {
+  bool isHttp = netMessage->isHttp();
   string token, previous;
   istringstream stream(data);
   vector<string> args;
@@ -541,13 +1452,21 @@ result_t MainLoop::decodeMessage(const string &data, bool isHttp, bool* connecte
     }
     const char* str = args.size() > 0 ? args[0].c_str() : "";
     if (strcmp(str, "GET") == 0) {
-      return executeGet(args, connected, ostream);
+      return executeGet(args, netMessage, connected, ostream);
     }
     *connected = false;
     *ostream << "HTTP/1.0 405 Method Not Allowed\r\n\r\n";
     return RESULT_OK;
   }
 
+  if (args.size() > 2 && args[1] == "-B") {
+    // bus selection, already routed to this bus by the primary loop
+    if (strcasecmp(args[2].c_str(), m_busId.c_str()) != 0) {
+      *ostream << "ERR: unknown bus";
+      return RESULT_OK;
+    }
+    args.erase(args.begin()+1, args.begin()+3);
+  }
   string cmd = args.size() > 0 ? args[0] : "";
   transform(cmd.begin(), cmd.end(), cmd.begin(), ::toupper);
   if (cmd == "?" || cmd == "H" || cmd == "HELP") {
@@ -600,6 +1519,16 @@ result_t MainLoop::decodeMessage(const string &data, bool isHttp, bool* connecte
   if (cmd == "G" || cmd == "GRAB") {
     return executeGrab(args, ostream);
   }
+  if (cmd == "TRACE") {
+    return executeTrace(args, ostream);
+  }
+  if (cmd == "HISTORY") {
+    if (m_history) {
+      return executeHistory(args, ostream);
+    }
+    *ostream << "ERR: command not enabled";
+    return RESULT_OK;
+  }
   if (cmd == "DEFINE") {
     if (m_newlyDefinedMessages) {
       return executeDefine(args, ostream);
@@ -691,12 +1620,19 @@ result_t MainLoop::executeRead(const vector<string>& args, const string& levels,
   bool hex = false, newDefinition = false;
   OutputFormat verbosity = 0;
   time_t maxAge = 5*60;
-  string circuit, params;
+  string circuit, params, batch;
   symbol_t srcAddress = SYN, dstAddress = SYN;
   size_t pollPriority = 0;
   while (args.size() > argPos && args[argPos][0] == '-') {
     if (args[argPos] == "-h") {
       hex = true;
+    } else if (args[argPos] == "-b") {
+      argPos++;
+      if (argPos >= args.size()) {
+        argPos = 0;  // print usage
+        break;
+      }
+      batch = args[argPos];
     } else if (args[argPos] == "-def") {
       if (!m_newlyDefinedMessages) {
         *ostream << "ERR: option not enabled";
@@ -791,6 +1727,13 @@ result_t MainLoop::executeRead(const vector<string>& args, const string& levels,
   || (newDefinition && (hex || !circuit.empty() || pollPriority > 0 || args.size() != argPos + 1))) {
     argPos = 0;  // print usage
   }
+  if (argPos > 0 && !batch.empty()) {
+    if (!hex && !newDefinition && params.empty() && srcAddress == SYN && dstAddress == SYN && pollPriority == 0
+        && args.size() == argPos) {
+      return executeReadBatch(batch, circuit, levels, maxAge, verbosity, ostream);
+    }
+    argPos = 0;  // print usage
+  }
 
   if (argPos == 0 || args.size() < argPos + 1 || args.size() > argPos + 2) {
     *ostream <<
@@ -799,6 +1742,7 @@ result_t MainLoop::executeRead(const vector<string>& args, const string& levels,
         "  or:  read [-f] [-m SECONDS] [-s QQ] [-d ZZ] [-v|-V] [-n|-N] [-i VALUE[;VALUE]*] -def DEFINITION "
         "(only if enabled)\n"
         "  or:  read [-f] [-m SECONDS] [-s QQ] [-c CIRCUIT] -h ZZPBSBNN[DD]*\n"
+        "  or:  read [-f] [-m SECONDS] [-c CIRCUIT] [-v|-V] [-n|-N] -b [CIRCUIT:]NAME[,[CIRCUIT:]NAME]*\n"
         " Read value(s) or hex message.\n"
         "  -f           force reading from the bus (same as '-m 0')\n"
         "  -m SECONDS   only return cached value if age is less than SECONDS [300]\n"
@@ -820,7 +1764,10 @@ result_t MainLoop::executeRead(const vector<string>& args, const string& levels,
         "    ZZ         destination address\n"
         "    PB SB      primary/secondary command byte\n"
         "    NN         number of following data bytes\n"
-        "    DD         data byte(s) to send";
+        "    DD         data byte(s) to send\n"
+        "  -b           read several messages at once with one line per message in the result:\n"
+        "    CIRCUIT    CIRCUIT of the message (default from '-c')\n"
+        "    NAME       NAME of the message";
     return RESULT_OK;
   }
   time_t now;
@@ -863,12 +1810,23 @@ result_t MainLoop::executeRead(const vector<string>& args, const string& levels,
 
     // send message
     SlaveSymbolString slave;
-    ret = m_busHandler->sendAndWait(master, &slave);
+    ret = sendAndWaitUnlocked(master, &slave);
+    message = m_messages->find(master, false, true, false, false);
+    if (message == nullptr) {
+      // removed by a reload in the meantime
+      if (ret != RESULT_OK) {
+        logError(lf_main, "read hex: %s", getResultCode(ret));
+        return ret;
+      }
+      *ostream << slave.getStr();
+      return RESULT_OK;
+    }
 
     if (ret == RESULT_OK) {
       ret = message->storeLastData(master, slave);
       ostringstream result;
       if (ret == RESULT_OK) {
+        m_messages->notifyUpdate(message);
         ret = message->decodeLastData(false, nullptr, -1, 0, &result);
       }
       if (ret >= RESULT_OK) {
@@ -990,6 +1948,101 @@ result_t MainLoop::executeRead(const vector<string>& args, const string& levels,
   return ret;
 }
 
+result_t MainLoop::executeReadBatch(const string& batch, const string& defaultCircuit, const string& levels,
+    time_t maxAge, OutputFormat verbosity, ostringstream* ostream) {
+  vector<std::pair<string, string>> names;
+  istringstream stream(batch);
+  string token;
+  while (getline(stream, token, ',')) {
+    size_t pos = token.find(':');
+    if (pos == string::npos) {
+      names.push_back(std::make_pair(defaultCircuit, token));
+    } else {
+      names.push_back(std::make_pair(token.substr(0, pos), token.substr(pos + 1)));
+    }
+    if (names.back().second.empty()) {
+      return RESULT_ERR_INVALID_ARG;
+    }
+  }
+  if (names.empty()) {
+    return RESULT_ERR_INVALID_ARG;
+  }
+  time_t now;
+  time(&now);
+  size_t count = names.size();
+  vector<Message*> messages(count, nullptr);
+  vector<result_t> results(count, RESULT_ERR_NOTFOUND);
+  vector<string> values(count);
+  vector<Message*> busMessages;
+  vector<size_t> busIndexes;
+  // resolve all messages in one pass and answer from the cache where possible
+  m_messages->lock();
+  for (size_t idx = 0; idx < count; idx++) {
+    const string& circuit = names[idx].first;
+    const string& name = names[idx].second;
+    Message* message = m_messages->find(circuit, name, levels, false);
+    Message* cacheMessage = maxAge > 0 ? m_messages->find(circuit, name, levels, false, true) : nullptr;
+    if (!cacheMessage || (message && message->getLastUpdateTime() > cacheMessage->getLastUpdateTime())) {
+      cacheMessage = message;  // message is newer/better
+    }
+    if (cacheMessage && (cacheMessage->getLastUpdateTime() + maxAge > now
+                         || (cacheMessage->isPassive() && cacheMessage->getLastUpdateTime() != 0))) {
+      ostringstream value;
+      results[idx] = cacheMessage->decodeLastData(false, nullptr, -1, verbosity, &value);
+      messages[idx] = cacheMessage;
+      values[idx] = value.str();
+      continue;
+    }
+    if (!message) {
+      results[idx] = cacheMessage ? RESULT_EMPTY : RESULT_ERR_NOTFOUND;
+      messages[idx] = cacheMessage;
+      continue;
+    }
+    messages[idx] = message;
+    if (message->getDstAddress() == SYN) {
+      results[idx] = RESULT_ERR_INVALID_ADDR;
+      continue;
+    }
+    busMessages.push_back(message);
+    busIndexes.push_back(idx);
+  }
+  m_messages->unlock();
+  if (!busMessages.empty()) {
+    // read the remaining ones from the bus together
+    vector<result_t> busResults;
+    m_busHandler->readFromBus(busMessages, &busResults);
+    for (size_t pos = 0; pos < busIndexes.size(); pos++) {
+      size_t idx = busIndexes[pos];
+      results[idx] = busResults[pos];
+      if (results[idx] == RESULT_OK) {
+        ostringstream value;
+        results[idx] = messages[idx]->decodeLastData(false, nullptr, -1, verbosity, &value);
+        values[idx] = value.str();
+      }
+    }
+  }
+  for (size_t idx = 0; idx < count; idx++) {
+    if (idx > 0) {
+      *ostream << "\n";
+    }
+    Message* message = messages[idx];
+    if (message) {
+      *ostream << message->getCircuit() << " " << message->getName() << " = ";
+    } else {
+      *ostream << names[idx].first << " " << names[idx].second << " = ";
+    }
+    if (results[idx] == RESULT_OK) {
+      *ostream << values[idx];
+    } else if (results[idx] == RESULT_EMPTY) {
+      *ostream << "ERR: no data stored";
+    } else {
+      *ostream << getResultCode(results[idx]);
+    }
+  }
+  logInfo(lf_main, "read batch of %d messages: %d from bus", count, busMessages.size());
+  return RESULT_OK;
+}
+
 result_t MainLoop::executeWrite(const vector<string>& args, const string levels, ostringstream* ostream) {
   size_t argPos = 1;
   bool hex = false, newDefinition = false;
@@ -1087,13 +2140,28 @@ result_t MainLoop::executeWrite(const vector<string>& args, const string levels,
     }
     // send message
     SlaveSymbolString slave;
-    ret = m_busHandler->sendAndWait(master, &slave);
+    ret = sendAndWaitUnlocked(master, &slave);
+    message = m_messages->find(master, false, false, true, false);
+    if (message == nullptr) {
+      // removed by a reload in the meantime
+      if (ret != RESULT_OK) {
+        logError(lf_main, "write hex: %s", getResultCode(ret));
+        return ret;
+      }
+      if (master[1] == BROADCAST) {
+        *ostream << "done broadcast";
+      } else if (!isMaster(master[1])) {
+        *ostream << slave.getStr();
+      }
+      return RESULT_OK;
+    }
 
     if (ret == RESULT_OK) {
       // also update read messages
       ret = message->storeLastData(master, slave);
       ostringstream result;
       if (ret == RESULT_OK) {
+        m_messages->notifyUpdate(message);
         ret = message->decodeLastData(false, nullptr, -1, 0, &result);
       }
       if (ret >= RESULT_OK) {
@@ -1215,7 +2283,7 @@ result_t MainLoop::parseHexAndSend(const vector<string>& args, size_t& argPos, b
 
   // send message
   SlaveSymbolString slave;
-  ret = m_busHandler->sendAndWait(master, &slave);
+  ret = sendAndWaitUnlocked(master, &slave);
 
   if (ret == RESULT_OK) {
     if (master[1] == BROADCAST) {
@@ -1233,6 +2301,14 @@ result_t MainLoop::parseHexAndSend(const vector<string>& args, size_t& argPos, b
   return ret;
 }
 
+result_t MainLoop::sendAndWaitUnlocked(const MasterSymbolString& master, SlaveSymbolString* slave) {
+  // let a waiting reload in while the bus is busy with this round trip
+  m_commandMutex.unlock();
+  result_t ret = m_busHandler->sendAndWait(master, slave);
+  m_commandMutex.lockShared();
+  return ret;
+}
+
 result_t MainLoop::executeHex(const vector<string>& args, ostringstream* ostream) {
   size_t argPos = 1;
   result_t ret = parseHexAndSend(args, argPos, false, ostream);
@@ -1623,6 +2699,121 @@ result_t MainLoop::executeGrab(const vector<string>& args, ostringstream* ostrea
   return RESULT_OK;
 }
 
+result_t MainLoop::executeTrace(const vector<string>& args, ostringstream* ostream) {
+  if (args.size() == 2 && args[1] == "start") {
+    clearTrace();
+    *ostream << (setTraceEnabled(true) ? "trace started" : "trace continued");
+    return RESULT_OK;
+  }
+  if (args.size() == 2 && args[1] == "stop") {
+    *ostream << (setTraceEnabled(false) ? "trace stopped" : "trace not running");
+    return RESULT_OK;
+  }
+  if (args.size() == 2 && args[1] == "result") {
+    formatTrace(ostream);
+    return RESULT_OK;
+  }
+  *ostream << "usage: trace start|stop\n"
+              "  or:  trace result\n"
+              " Start or stop tracing the bus and command handling, or report the recorded events in Chrome trace"
+              " format (also available via HTTP at /trace.json).";
+  return RESULT_OK;
+}
+
+result_t MainLoop::executeHistory(const vector<string>& args, ostringstream* ostream) {
+  if (args.size() == 1) {
+    m_history->list(ostream);
+    if (ostream->tellp() == 0) {
+      return RESULT_EMPTY;
+    }
+    return RESULT_OK;
+  }
+  size_t argPos = 1;
+  HistoryTier tier = ht_raw;
+  HistoryAggregate aggregate = ha_avg;
+  time_t since = 0, until = 0, range = 0, interval = 0;
+  string circuit;
+  result_t result = RESULT_OK;
+  while (args.size() > argPos && args[argPos][0] == '-') {
+    const string& option = args[argPos];
+    argPos++;
+    if (argPos >= args.size()) {
+      argPos = 0;  // print usage
+      break;
+    }
+    const string& value = args[argPos];
+    if (option == "-t") {
+      if (!parseHistoryTier(value, &tier)) {
+        argPos = 0;  // print usage
+        break;
+      }
+    } else if (option == "-a") {
+      if (!parseHistoryAggregate(value, &aggregate)) {
+        argPos = 0;  // print usage
+        break;
+      }
+    } else if (option == "-s") {
+      since = parseInt(value.c_str(), 10, 0, 0xffffffff, &result);
+    } else if (option == "-u") {
+      until = parseInt(value.c_str(), 10, 0, 0xffffffff, &result);
+    } else if (option == "-r") {
+      range = parseInt(value.c_str(), 10, 1, 0xffffffff, &result);
+    } else if (option == "-i") {
+      interval = parseInt(value.c_str(), 10, 1, 0xffffffff, &result);
+    } else if (option == "-c") {
+      circuit = value;
+    } else {
+      argPos = 0;  // print usage
+      break;
+    }
+    if (result != RESULT_OK) {
+      return result;
+    }
+    argPos++;
+  }
+  if (argPos == 0 || circuit.empty() || args.size() < argPos + 1 || args.size() > argPos + 2) {
+    *ostream <<
+        "usage: history [-t TIER] [-s SINCE] [-u UNTIL] [-r SECONDS] [-i SECONDS] [-a AGGR] -c CIRCUIT NAME [FIELD]\n"
+        "  or:  history\n"
+        " Report the history of a numeric field, or list the fields with history.\n"
+        "  -t TIER     the tier to use: raw|1m|15m (default raw)\n"
+        "  -s SINCE    only report values since the UNIX time SINCE\n"
+        "  -u UNTIL    only report values until the UNIX time UNTIL\n"
+        "  -r SECONDS  only report values of the last SECONDS\n"
+        "  -i SECONDS  merge the values into intervals of SECONDS\n"
+        "  -a AGGR     the aggregate to report: avg|min|max|last|count (default avg)\n"
+        "  -c CIRCUIT  CIRCUIT of the message\n"
+        "  NAME        NAME of the message\n"
+        "  FIELD       name of the field (or index for unnamed fields, default first one)";
+    return RESULT_OK;
+  }
+  if (range > 0) {
+    time_t now;
+    time(&now);
+    since = now - range;
+  }
+  string field;
+  vector<HistoryBucket> buckets;
+  result = m_history->query(circuit, args[argPos], args.size() > argPos + 1 ? args[argPos + 1] : "", tier, since,
+      until, interval, &field, &buckets);
+  if (result != RESULT_OK) {
+    return result;
+  }
+  if (buckets.empty()) {
+    return RESULT_EMPTY;
+  }
+  bool first = true;
+  for (const auto& bucket : buckets) {
+    if (first) {
+      first = false;
+    } else {
+      *ostream << "\n";
+    }
+    *ostream << static_cast<int64_t>(bucket.m_time) << " " << bucket.get(aggregate);
+  }
+  return RESULT_OK;
+}
+
 result_t MainLoop::executeDefine(const vector<string>& args, ostringstream* ostream) {
   size_t argPos = 1;
   bool replace = false;
@@ -1873,8 +3064,7 @@ result_t MainLoop::executeReload(const vector<string>& args, ostringstream* ostr
                 " Reload CSV config files.";
     return RESULT_OK;
   }
-  m_busHandler->clear();
-  return loadConfigFiles(m_messages);
+  return reloadConfig();
 }
 
 result_t MainLoop::executeInfo(const vector<string>& args, const string& user, ostringstream* ostream) {
@@ -1906,15 +3096,25 @@ result_t MainLoop::executeInfo(const vector<string>& args, const string& user, o
       *ostream << "min symbol latency: " << m_busHandler->getMinSymbolLatency() << "\n"
                << "max symbol latency: " << m_busHandler->getMaxSymbolLatency() << "\n";
     }
+    *ostream << "missed deadlines: " << m_busHandler->getMissedDeadlines() << "\n"
+             << "late wakeups: " << m_busHandler->getLateWakeups() << "\n";
   } else {
     *ostream << "signal: no signal\n";
   }
+  if (m_busHandler->isAutoTune()) {
+    *ostream << "auto-tuned latency: " << m_device->getLatency() << "\n"
+             << "auto-tuned receive timeout: " << m_busHandler->getSlaveRecvTimeout() << "\n";
+  }
+  size_t pooledStrings, pooledAttributes;
+  size_t pooledBytes = StringPool::getStatistics(&pooledStrings, &pooledAttributes);
   *ostream << "reconnects: " << m_reconnectCount << "\n"
            << "masters: " << m_busHandler->getMasterCount() << "\n"
            << "messages: " << m_messages->size() << "\n"
            << "conditional: " << m_messages->sizeConditional() << "\n"
            << "poll: " << m_messages->sizePoll() << "\n"
-           << "update: " << m_messages->sizePassive();
+           << "update: " << m_messages->sizePassive() << "\n"
+           << "pooled strings: " << pooledStrings << ", attributes: " << pooledAttributes << ", bytes: "
+           << pooledBytes;
   m_busHandler->formatSeenInfo(ostream);
   return RESULT_OK;
 }
@@ -1934,6 +3134,8 @@ result_t MainLoop::executeHelp(ostringstream* ostream) {
   *ostream << "usage:\n"
       " read|r    Read value(s):         read [-f] [-m SECONDS] [-s QQ] [-d ZZ] [-c CIRCUIT] [-p PRIO] [-v|-V] [-n|-N]"
       " [-i VALUE[;VALUE]*] NAME [FIELD[.N]]\n"
+      "           Read several at once:  read [-f] [-m SECONDS] [-c CIRCUIT] [-v|-V] [-n|-N]"
+      " -b [CIRCUIT:]NAME[,[CIRCUIT:]NAME]*\n"
       "           Read by new defintion: read [-f] [-m SECONDS] [-s QQ] [-d ZZ] [-v|-V] [-n|-N] (if enabled)"
       " [-i VALUE[;VALUE]*] -def DEFINITION\n"
       "           Read hex message:      read [-f] [-m SECONDS] [-s QQ] [-c CIRCUIT] -h ZZPBSBNN[DD]*\n"
@@ -1950,6 +3152,11 @@ result_t MainLoop::executeHelp(ostringstream* ostream) {
       " info|i    Report information about the daemon, the configuration, and seen devices.\n"
       " grab|g    Grab messages:         grab [stop]\n"
       "           Report the messages:   grab result [all]\n"
+      " trace     Trace event timing:    trace start|stop\n"
+      "           Report the events:     trace result\n"
+      " history   Report field history:  history [-t TIER] [-s SINCE] [-u UNTIL] [-r SECONDS] [-i SECONDS] [-a AGGR]"
+      " -c CIRCUIT NAME [FIELD] (if enabled)\n"
+      "           List fields:           history\n"
       " define    Define new message:    define [-r] DEFINITION\n"
       " decode|d  Decode field(s):       decode [-v|-V] [-n|-N] DEFINITION DD[DD]*\n"
       " encode|e  Encode field(s):       encode DEFINITION VALUE[;VALUE]*\n"
@@ -1960,7 +3167,9 @@ result_t MainLoop::executeHelp(ostringstream* ostream) {
       " dump      Toggle binary dump of received bytes\n"
       " reload    Reload CSV config files\n"
       " quit|q    Close connection\n"
-      " help|?    Print help             help [COMMAND], COMMMAND ?";
+      " help|?    Print help             help [COMMAND], COMMMAND ?\n"
+      "With additional buses, prefix the circuit with \"ID.\" or insert \"-B ID\" after the command to select"
+      " the bus ID.";
   return RESULT_OK;
 }
 
@@ -1973,7 +3182,10 @@ bool parseBoolQuery(const string& value) {
   return value.length() == 0 || value == "1" || value == "true";
 }
 
-result_t MainLoop::executeGet(const vector<string>& args, bool* connected, ostringstream* ostream) {
+result_t MainLoop::executeGet(const vector<string>& args, NetMessage* netMessage, bool* connected,
+    ostringstream* ostream) {
+  const HttpHeaders& headers = netMessage->getHttpHeaders();
+  *connected = headers.keepAlive;
   bool required = false, full = false, withWrite = false, raw = false;
   bool withDefinition = false;
   OutputFormat verbosity = OF_NAMES;
@@ -1994,7 +3206,7 @@ result_t MainLoop::executeGet(const vector<string>& args, bool* connected, ostri
     time_t since = 0;
     size_t pollPriority = 0;
     bool exact = false;
-    string user;
+    string user, batch;
     if (args.size() > argPos) {
       string secret;
       string query = args[argPos];
@@ -2044,6 +3256,8 @@ result_t MainLoop::executeGet(const vector<string>& args, bool* connected, ostri
           raw = parseBoolQuery(value);
         } else if (qname == "def") {
           withDefinition = parseBoolQuery(value);
+        } else if (qname == "messages") {
+          batch = value;
         } else if (qname == "user") {
           user = value;
         } else if (qname == "secret") {
@@ -2058,6 +3272,13 @@ result_t MainLoop::executeGet(const vector<string>& args, bool* connected, ostri
       }
     }
 
+    HttpBodyWriter* writer = nullptr;
+    if (ret == RESULT_OK && headers.http11) {
+      // stream the body in chunks while the messages are formatted
+      formatHttpHeader(RESULT_OK, 6, headers, "", -1, headers.encoding != he_identity, ostream);
+      writer = new HttpBodyWriter(netMessage, ostream->str(), headers.encoding);
+      ostream->str("");
+    }
     *ostream << "{";
     string lastCircuit;
     time_t now;
@@ -2066,63 +3287,142 @@ result_t MainLoop::executeGet(const vector<string>& args, bool* connected, ostri
     if (ret == RESULT_OK) {
       bool first = true;
       verbosity |= OF_JSON | (full ? OF_ALL_ATTRS : 0) | (withDefinition ? OF_DEFINTION : 0);
-      deque<Message*> messages;
-      m_messages->findAll(circuit, name, getUserLevels(user), exact, true, withWrite, true, true, true, 0, 0, false,
-                          &messages);
-      string lastName;
-      for (deque<Message*>::iterator it = messages.begin(); it != messages.end(); it++) {
-        Message* message = *it;
-        symbol_t dstAddress = message->getDstAddress();
-        if (dstAddress == SYN) {
-          continue;
+      // answer identical queries from the cache as long as none of the included messages changed
+      bool store = pollPriority == 0 && maxAge < 0;
+      string cacheKey, body;
+      uint64_t sequence = 0;
+      bool cached = false;
+      if (store) {
+        ostringstream key;
+        key << circuit << FIELD_SEPARATOR << name << FIELD_SEPARATOR << exact << required << withWrite << raw
+            << FIELD_SEPARATOR << hex << verbosity << dec << FIELD_SEPARATOR << since << FIELD_SEPARATOR << batch
+            << FIELD_SEPARATOR << getUserLevels(user);
+        cacheKey = key.str();
+        sequence = m_messages->getDataSequence(exact && batch.empty() ? circuit : "");
+        m_dataCacheLock.lock();
+        const auto it = m_dataCache.find(cacheKey);
+        if (it != m_dataCache.end() && it->second.sequence == sequence) {
+          *ostream << it->second.body;
+          maxLastUp = it->second.lastUp;
+          cached = true;
         }
-        if (pollPriority > 0 && message->setPollPriority(pollPriority)) {
-          m_messages->addPollMessage(false, message);
+        m_dataCacheLock.unlock();
+      }
+      if (!cached) {
+        size_t bodyStart = static_cast<size_t>(ostream->tellp());
+        deque<Message*> messages;
+        if (batch.empty()) {
+          m_messages->findAll(circuit, name, getUserLevels(user), exact, true, withWrite, true, true, true, 0, 0, false,
+                              &messages);
+        } else {
+          // the list of "CIRCUIT:NAME" (or "NAME" within the circuit of the path) to limit to
+          istringstream batchStream(batch);
+          string token;
+          while (getline(batchStream, token, ',')) {
+            pos = token.find(':');
+            m_messages->findAll(pos == string::npos ? circuit : token.substr(0, pos),
+                pos == string::npos ? token : token.substr(pos + 1), getUserLevels(user), true, true, withWrite, true,
+                true, true, 0, 0, false, &messages);
+          }
+          std::stable_sort(messages.begin(), messages.end(), [](const Message* a, const Message* b) {
+            return a->getCircuit() < b->getCircuit()
+                || (a->getCircuit() == b->getCircuit() && a->getName() < b->getName());
+          });
+          messages.erase(std::unique(messages.begin(), messages.end()), messages.end());
         }
-        time_t lastup = message->getLastUpdateTime();
-        if (required && (lastup == 0 || (maxAge >=0 && lastup + maxAge > now))) {
-          // read directly from bus
-          if (message->isPassive()) {
-            continue;  // not possible to actively read this message
+        vector<Message*> failedMessages;
+        if (required) {
+          // read all outdated messages from the bus together
+          vector<Message*> busMessages;
+          for (const auto message : messages) {
+            time_t lastup = message->getLastUpdateTime();
+            if (message->getDstAddress() != SYN && !message->isPassive() && !message->isWrite()
+                && (lastup == 0 || (maxAge >= 0 && lastup + maxAge <= now))) {
+              busMessages.push_back(message);
+            }
+          }
+          if (!busMessages.empty()) {
+            store = false;  // may be incomplete
+            vector<result_t> busResults;
+            m_busHandler->readFromBus(busMessages, &busResults);
+            for (size_t idx = 0; idx < busMessages.size(); idx++) {
+              if (busResults[idx] != RESULT_OK) {
+                failedMessages.push_back(busMessages[idx]);
+              }
+            }
           }
-          if (m_busHandler->readFromBus(message, "") != RESULT_OK) {
+        }
+        string lastName;
+        OutputBuffer json;
+        for (deque<Message*>::iterator it = messages.begin(); it != messages.end(); it++) {
+          Message* message = *it;
+          symbol_t dstAddress = message->getDstAddress();
+          if (dstAddress == SYN) {
             continue;
           }
-        } else {
+          if (pollPriority > 0 && message->setPollPriority(pollPriority)) {
+            m_messages->addPollMessage(false, message);
+          }
+          time_t lastup = message->getLastUpdateTime();
+          if (required && (lastup == 0
+              || std::find(failedMessages.begin(), failedMessages.end(), message) != failedMessages.end())) {
+            continue;  // not possible to read this message from the bus
+          }
           if (since > 0 && lastup <= since) {
             continue;
           }
           if (lastup > maxLastUp) {
             maxLastUp = lastup;
           }
-        }
-        bool sameCircuit = message->getCircuit() == lastCircuit;
-        if (!sameCircuit) {
-          if (lastCircuit.length() > 0) {
-            *ostream << "\n  }\n },";
+          bool sameCircuit = message->getCircuit() == lastCircuit;
+          if (!sameCircuit) {
+            if (lastCircuit.length() > 0) {
+              *ostream << "\n  }\n },";
+            }
+            lastCircuit = message->getCircuit();
+            *ostream << "\n \"" << lastCircuit << "\": {";
+            if (full && m_messages->decodeCircuit(lastCircuit, verbosity, ostream)) {  // add circuit specific values
+              *ostream << ",";
+            }
+            *ostream << "\n  \"messages\": {";
+            lastName = "";
+            first = true;
           }
-          lastCircuit = message->getCircuit();
-          *ostream << "\n \"" << lastCircuit << "\": {";
-          if (full && m_messages->decodeCircuit(lastCircuit, verbosity, ostream)) {  // add circuit specific values
-            *ostream << ",";
+          name = message->getName();
+          bool same = sameCircuit && name == lastName;
+          if (!same && it+1 != messages.end()) {
+            Message* next = *(it+1);
+            same = next->getCircuit() == lastCircuit && next->getName() == name;
+          }
+          json.clear();
+          message->decodeJson(!first, same, raw, verbosity, &json);
+          ostream->write(json.data(), static_cast<std::streamsize>(json.size()));
+          lastName = name;
+          first = false;
+          if (writer && ostream->tellp() >= HTTP_CHUNK_SIZE) {
+            if (store) {
+              body.append(ostream->str(), bodyStart, string::npos);
+              bodyStart = 0;
+            }
+            writer->write(ostream, false);
           }
-          *ostream << "\n  \"messages\": {";
-          lastName = "";
-          first = true;
-        }
-        name = message->getName();
-        bool same = sameCircuit && name == lastName;
-        if (!same && it+1 != messages.end()) {
-          Message* next = *(it+1);
-          same = next->getCircuit() == lastCircuit && next->getName() == name;
         }
-        message->decodeJson(!first, same, raw, verbosity, ostream);
-        lastName = name;
-        first = false;
-      }
 
-      if (lastCircuit.length() > 0) {
-        *ostream << "\n  }\n },";
+        if (lastCircuit.length() > 0) {
+          *ostream << "\n  }\n },";
+        }
+        if (store) {
+          body.append(ostream->str(), bodyStart, string::npos);
+          m_dataCacheLock.lock();
+          if (m_dataCache.size() >= DATA_CACHE_SIZE && m_dataCache.find(cacheKey) == m_dataCache.end()) {
+            m_dataCache.clear();
+          }
+          DataCacheEntry& entry = m_dataCache[cacheKey];
+          entry.sequence = sequence;
+          entry.body.swap(body);
+          entry.lastUp = maxLastUp;
+          m_dataCacheLock.unlock();
+        }
       }
       *ostream << "\n \"global\": {"
                << "\n  \"version\": \"" << PACKAGE_VERSION "." REVISION "\"" << setw(0) << dec;
@@ -2148,6 +3448,12 @@ result_t MainLoop::executeGet(const vector<string>& args, bool* connected, ostri
           *ostream << ",\n  \"minsymbollatency\": " << m_busHandler->getMinSymbolLatency()
                    << ",\n  \"maxsymbollatency\": " << m_busHandler->getMaxSymbolLatency();
         }
+        *ostream << ",\n  \"misseddeadlines\": " << m_busHandler->getMissedDeadlines()
+                 << ",\n  \"latewakeups\": " << m_busHandler->getLateWakeups();
+      }
+      if (m_busHandler->isAutoTune()) {
+        *ostream << ",\n  \"latency\": " << m_device->getLatency()
+                 << ",\n  \"receivetimeout\": " << m_busHandler->getSlaveRecvTimeout();
       }
       if (!m_device->isReadOnly()) {
         *ostream << ",\n  \"qq\": " << static_cast<unsigned>(m_address);
@@ -2160,10 +3466,109 @@ result_t MainLoop::executeGet(const vector<string>& args, bool* connected, ostri
                << "\n}";
       type = 6;
     }
-    *connected = false;
-    return formatHttpResult(ret, type, ostream);
+    if (writer) {
+      writer->write(ostream, true);
+      delete writer;
+      return RESULT_OK;
+    }
+    return formatHttpResult(ret, type, headers, "", ostream);
   }  // request for "/data..."
 
+  if (uri.substr(0, 9) == "/history/" && m_history) {
+    // "/history/CIRCUIT/NAME[/FIELD]"
+    string circuit, name, field;
+    size_t pos = uri.find('/', 9);
+    if (pos != string::npos) {
+      circuit = uri.substr(9, pos - 9);
+      name = uri.substr(pos + 1);
+      pos = name.find('/');
+      if (pos != string::npos) {
+        field = name.substr(pos + 1);
+        name = name.substr(0, pos);
+      }
+    }
+    HistoryTier tier = ht_raw;
+    HistoryAggregate aggregate = ha_avg;
+    time_t since = 0, until = 0, interval = 0;
+    if (circuit.empty() || name.empty()) {
+      ret = RESULT_ERR_INVALID_ARG;
+    } else if (args.size() > argPos) {
+      istringstream stream(args[argPos]);
+      string token;
+      while (getline(stream, token, '&')) {
+        pos = token.find('=');
+        string qname = token.substr(0, pos);
+        string value = pos == string::npos ? "" : token.substr(pos + 1);
+        if (qname == "since") {
+          since = parseInt(value.c_str(), 10, 0, 0xffffffff, &ret);
+        } else if (qname == "until") {
+          until = parseInt(value.c_str(), 10, 0, 0xffffffff, &ret);
+        } else if (qname == "range") {
+          time_t now;
+          time(&now);
+          since = now - parseInt(value.c_str(), 10, 1, 0xffffffff, &ret);
+        } else if (qname == "interval") {
+          interval = parseInt(value.c_str(), 10, 1, 0xffffffff, &ret);
+        } else if (qname == "tier") {
+          ret = parseHistoryTier(value, &tier) ? RESULT_OK : RESULT_ERR_INVALID_ARG;
+        } else if (qname == "aggregate") {
+          ret = parseHistoryAggregate(value, &aggregate) ? RESULT_OK : RESULT_ERR_INVALID_ARG;
+        }
+        if (ret != RESULT_OK) {
+          break;
+        }
+      }
+    }
+    vector<HistoryBucket> buckets;
+    string usedField;
+    if (ret == RESULT_OK) {
+      ret = m_history->query(circuit, name, field, tier, since, until, interval, &usedField, &buckets);
+    }
+    if (ret == RESULT_OK) {
+      *ostream << "{\n \"circuit\": \"" << circuit << "\",\n \"name\": \"" << name
+               << "\",\n \"field\": \"" << usedField << "\",\n \"tier\": \"" << getHistoryTierName(tier)
+               << "\",\n \"aggregate\": \"" << getHistoryAggregateName(aggregate) << "\",\n \"values\": [";
+      bool first = true;
+      for (const auto& bucket : buckets) {
+        *ostream << (first ? "\n  [" : ",\n  [") << static_cast<int64_t>(bucket.m_time) << ", "
+                 << bucket.get(aggregate) << "]";
+        first = false;
+      }
+      *ostream << "\n ]\n}";
+    }
+    return formatHttpResult(ret, 6, headers, "", ostream);
+  }
+
+  if (uri == "/trace.json") {
+    formatTrace(ostream);
+    return formatHttpResult(RESULT_OK, 6, headers, "", ostream);
+  }
+
+  if (uri == "/metrics") {
+    m_busHandler->formatMetrics(ostream);
+    formatMetricHeader("ebusd_messages", "gauge", "Number of message definitions.", ostream);
+    formatMetricValue("ebusd_messages", "", static_cast<double>(m_messages->size()), ostream);
+    formatMetricHeader("ebusd_message_age_seconds", "gauge",
+        "Time since the last update of a polled message, or -1 if not updated yet.", ostream);
+    time_t now;
+    time(&now);
+    deque<Message*> messages;
+    m_messages->lock();
+    m_messages->findAll("", "", "*", false, true, false, false, true, false, 0, 0, false, &messages);
+    for (const auto message : messages) {
+      if (message->getPollPriority() == 0) {
+        continue;
+      }
+      time_t lastup = message->getLastUpdateTime();
+      formatMetricValue("ebusd_message_age_seconds",
+          "circuit=\"" + escapeMetricLabel(message->getCircuit()) + "\",name=\""
+          + escapeMetricLabel(message->getName()) + "\"",
+          lastup == 0 ? -1 : difftime(now, lastup), ostream);
+    }
+    m_messages->unlock();
+    return formatHttpResult(RESULT_OK, 10, headers, "", ostream);
+  }
+
   if (uri.length() < 1 || uri[0] != '/' || uri.find("//") != string::npos || uri.find("..") != string::npos) {
     ret = RESULT_ERR_INVALID_ARG;
   } else {
@@ -2197,25 +3602,39 @@ result_t MainLoop::executeGet(const vector<string>& args, bool* connected, ostri
     if (type < 0) {
       ret = RESULT_ERR_NOTFOUND;
     } else {
-      ifstream ifs;
-      ifs.open(filename.c_str(), ifstream::in | ifstream::binary);
-      if (!ifs.is_open()) {
-        ret = RESULT_ERR_NOTFOUND;
-      } else {
-        ifs >> ostream->rdbuf();
-        ifs.close();
+      string etag, content;
+      bool encoded = false;
+      ret = m_htmlFiles.get(filename, type == 3 || type == 4 ? he_identity : headers.encoding, headers.ifNoneMatch,
+          &etag, &content, &encoded);
+      if (ret == RESULT_OK || ret == RESULT_EMPTY) {
+        ostream->str("");
+        formatHttpHeader(ret, type, headers, etag, static_cast<ssize_t>(content.length()), encoded, ostream);
+        ostream->write(content.data(), static_cast<std::streamsize>(content.length()));
+        return RESULT_OK;
       }
     }
   }
-  *connected = false;
-  return formatHttpResult(ret, type, ostream);
+  return formatHttpResult(ret, type, headers, "", ostream);
 }
 
-result_t MainLoop::formatHttpResult(result_t ret, int type, ostringstream* ostream) {
+result_t MainLoop::formatHttpResult(result_t ret, int type, const HttpHeaders& headers, const string& etag,
+    ostringstream* ostream) {
   string data = ret == RESULT_OK ? ostream->str() : "";
+  string compressed;
+  bool encoded = type != 3 && type != 4 && data.length() >= HTTP_COMPRESS_MIN_SIZE
+    && HttpBodyWriter::compress(headers.encoding, data, &compressed);
   ostream->str("");
   ostream->clear();
-  *ostream << "HTTP/1.0 ";
+  formatHttpHeader(ret, type, headers, etag, static_cast<ssize_t>(encoded ? compressed.length() : data.length()),
+      encoded, ostream);
+  const string& body = encoded ? compressed : data;
+  ostream->write(body.data(), static_cast<std::streamsize>(body.length()));
+  return RESULT_OK;
+}
+
+void MainLoop::formatHttpHeader(result_t ret, int type, const HttpHeaders& headers, const string& etag,
+    ssize_t length, bool encoded, ostringstream* ostream) {
+  *ostream << (headers.http11 ? "HTTP/1.1 " : "HTTP/1.0 ");
   switch (ret) {
   case RESULT_OK:
     *ostream << "200 OK\r\nContent-Type: ";
@@ -2244,11 +3663,19 @@ result_t MainLoop::formatHttpResult(result_t ret, int type, ostringstream* ostre
     case 9:
       *ostream << "text/comma-separated-values";
       break;
+    case 10:
+      *ostream << "text/plain; version=0.0.4; charset=utf-8";
+      break;
     default:
       *ostream << "text/html";
       break;
     }
-    *ostream << "\r\nContent-Length: " << setw(0) << dec << static_cast<unsigned>(data.length());
+    if (encoded) {
+      *ostream << "\r\nContent-Encoding: " << (headers.encoding == he_gzip ? "gzip" : "deflate");
+    }
+    break;
+  case RESULT_EMPTY:
+    *ostream << "304 Not Modified";
     break;
   case RESULT_ERR_NOTFOUND:
     *ostream << "404 Not Found";
@@ -2265,8 +3692,25 @@ result_t MainLoop::formatHttpResult(result_t ret, int type, ostringstream* ostre
     *ostream << "500 Internal Server Error";
     break;
   }
-  *ostream << "\r\nServer: " PACKAGE_NAME "/" PACKAGE_VERSION "\r\n\r\n" << data;
-  return RESULT_OK;
+  if (!etag.empty()) {
+    *ostream << "\r\nETag: " << etag;
+  }
+#ifdef HAVE_ZLIB
+  if ((ret == RESULT_OK || ret == RESULT_EMPTY) && type != 3 && type != 4) {
+    *ostream << "\r\nVary: Accept-Encoding";  // the content depends on the accepted encoding
+  }
+#endif
+  if (length < 0) {
+    *ostream << "\r\nTransfer-Encoding: chunked";
+  } else if (ret != RESULT_EMPTY) {
+    *ostream << "\r\nContent-Length: " << setw(0) << dec << static_cast<size_t>(length);
+  }
+  if (!headers.keepAlive) {
+    *ostream << "\r\nConnection: close";
+  } else if (!headers.http11) {
+    *ostream << "\r\nConnection: keep-alive";
+  }
+  *ostream << "\r\nServer: " PACKAGE_NAME "/" PACKAGE_VERSION "\r\n\r\n";
 }
 
 }  // namespace ebusd
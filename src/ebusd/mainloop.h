@@ -19,14 +19,20 @@
 #ifndef EBUSD_MAINLOOP_H_
 #define EBUSD_MAINLOOP_H_
 
+#include <atomic>
 #include <string>
 #include <list>
 #include <vector>
 #include <map>
+#include <unordered_map>
 #include <algorithm>
 #include "ebusd/bushandler.h"
 #include "ebusd/datahandler.h"
+#include "ebusd/history.h"
 #include "ebusd/network.h"
+#include "ebusd/valuestore.h"
+#include "ebusd/scancache.h"
+#include "lib/ebus/sharedvalues.h"
 #include "lib/ebus/filereader.h"
 #include "lib/ebus/message.h"
 #include "lib/utils/rotatefile.h"
@@ -65,8 +71,8 @@ class UserList : public UserInfo, public MappedFileReader {
   result_t getFieldMap(const string& preferLanguage, vector<string>* row, string* errorDescription) const override;
 
   // @copydoc
-  result_t addFromFile(const string& filename, unsigned int lineNo, map<string, string>* row,
-      vector< map<string, string> >* subRows, string* errorDescription, bool replace) override;
+  result_t addFromFile(const string& filename, unsigned int lineNo, MappedRow* row,
+      vector<MappedRow>* subRows, string* errorDescription, bool replace) override;
 
   // @copydoc
   bool hasUser(const string& user) const override {
@@ -94,18 +100,166 @@ class UserList : public UserInfo, public MappedFileReader {
 };
 
 
+/**
+ * A static file held in the @a StaticFileCache.
+ */
+struct StaticFile {
+  time_t mtime;          //!< the modification time of the file
+  off_t size;            //!< the size of the file
+  time_t checked;        //!< the time the modification time and size were checked last
+  string etag;           //!< the entity tag derived from modification time and size
+  string content;        //!< the file content
+  string encoded[3];     //!< the content compressed by @a HttpEncoding (created when first requested)
+};
+
+
+/**
+ * Cache for static files served via HTTP.
+ */
+class StaticFileCache {
+ public:
+  /**
+   * Constructor.
+   */
+  StaticFileCache() : m_size(0) {}
+
+  /**
+   * Get a file from the cache, reading it from storage if not cached yet or changed since.
+   * @param filename the name of the file.
+   * @param encoding the @a HttpEncoding accepted by the client for compressing the content, or @a he_identity.
+   * @param ifNoneMatch the entity tag already known to the client, or empty.
+   * @param etag set to the entity tag of the file.
+   * @param content set to the (optionally compressed) content.
+   * @param encoded set to true when the content was compressed.
+   * @return @a RESULT_OK on success, @a RESULT_EMPTY when the entity tag matches @p ifNoneMatch (content is
+   * left untouched), or an error code.
+   */
+  result_t get(const string& filename, HttpEncoding encoding, const string& ifNoneMatch, string* etag,
+      string* content, bool* encoded);
+
+
+ private:
+  /**
+   * Remove a file from the cache.
+   * @param it the iterator of the file to remove.
+   */
+  void erase(map<string, StaticFile>::iterator it);
+
+  /** the @a Mutex for accessing the files. */
+  Mutex m_mutex;
+
+  /** the cached @a StaticFile instances by file name. */
+  map<string, StaticFile> m_files;
+
+  /** the total size of the cached content in bytes. */
+  size_t m_size;
+};
+
+
+/** the maximum number of cached HTTP data query responses. */
+#define DATA_CACHE_SIZE 64
+
+/**
+ * A HTTP data query response part held in the data cache of @a MainLoop.
+ */
+struct DataCacheEntry {
+  uint64_t sequence;     //!< the data sequence number of the included messages the body was built for
+  string body;           //!< the JSON body part with the messages
+  time_t lastUp;         //!< the maximum last update time of the included messages
+};
+
+
+class MainLoop;
+
+/** the lanes for executing client commands. */
+enum CommandLane {
+  cl_cache,      //!< commands answered without bus traffic (e.g. from cache)
+  cl_bus,        //!< commands potentially waiting for the bus
+  cl_exclusive,  //!< commands modifying the configuration (executed on the bus lane without any other command)
+};
+
+/**
+ * A worker executing client commands taken from a lane queue.
+ */
+class CommandWorker : public Thread {
+ public:
+  /**
+   * Constructor.
+   * @param mainLoop the @a MainLoop executing the commands.
+   * @param queue the lane @a Queue to take the @a NetMessage instances from.
+   */
+  CommandWorker(MainLoop* mainLoop, Queue<NetMessage*>* queue)
+    : Thread(), m_mainLoop(mainLoop), m_queue(queue) {}
+
+  /**
+   * Destructor.
+   */
+  virtual ~CommandWorker() { join(); }
+
+
+ protected:
+  // @copydoc
+  void run() override;
+
+
+ private:
+  /** the @a MainLoop executing the commands. */
+  MainLoop* m_mainLoop;
+
+  /** the lane @a Queue to take the @a NetMessage instances from. */
+  Queue<NetMessage*>* m_queue;
+};
+
+
+/**
+ * A worker loading the configuration of scanned slaves in the background while the next slave is scanned.
+ */
+class ScanConfigLoader : public Thread {
+ public:
+  /**
+   * Constructor.
+   * @param mainLoop the @a MainLoop to load the configuration for.
+   * @param queue the @a Queue to take the @a DeferredScanLoad instances from.
+   */
+  ScanConfigLoader(MainLoop* mainLoop, Queue<DeferredScanLoad*>* queue)
+    : Thread(), m_mainLoop(mainLoop), m_queue(queue) {}
+
+  /**
+   * Destructor.
+   */
+  virtual ~ScanConfigLoader() { join(); }
+
+
+ protected:
+  // @copydoc
+  void run() override;
+
+
+ private:
+  /** the @a MainLoop to load the configuration for. */
+  MainLoop* m_mainLoop;
+
+  /** the @a Queue to take the @a DeferredScanLoad instances from. */
+  Queue<DeferredScanLoad*>* m_queue;
+};
+
+
 /**
  * The main loop handling requests from connected clients.
  */
-class MainLoop : public Thread, DeviceListener {
+class MainLoop : public Thread, DeviceListener, MessageUpdateListener {
+  friend class CommandWorker;
+  friend class ScanConfigLoader;
  public:
   /**
    * Construct the main loop and create network and bus handling components.
    * @param opt the program options.
    * @param device the @a Device instance.
    * @param messages the @a MessageMap instance.
+   * @param primary the @a MainLoop of the primary bus serving the network and data handler front ends for this
+   * additional bus, or nullptr for the primary bus itself.
    */
-  MainLoop(const struct options& opt, Device *device, MessageMap* messages);
+  MainLoop(const struct options& opt, Device *device, MessageMap* messages, MainLoop* primary = nullptr);
 
   /**
    * Destructor.
@@ -117,12 +271,30 @@ class MainLoop : public Thread, DeviceListener {
    */
   void shutdown() { m_shutdown = true; }
 
+  /**
+   * Return whether the shutdown was requested.
+   * @return whether the shutdown was requested.
+   */
+  bool isShutdown() const { return m_shutdown; }
+
   /**
    * Get the @a BusHandler instance.
    * @return the created @a BusHandler instance.
    */
   BusHandler* getBusHandler() { return m_busHandler; }
 
+  /**
+   * Get the @a MessageMap instance.
+   * @return the @a MessageMap instance.
+   */
+  MessageMap* getMessages() { return m_messages; }
+
+  /**
+   * Get the identifier of the bus.
+   * @return the identifier of an additional bus, or empty for the primary bus.
+   */
+  const string& getBusId() const { return m_busId; }
+
   /**
    * Add a client @a NetMessage to the queue.
    * @param message the client @a NetMessage to handle.
@@ -132,9 +304,15 @@ class MainLoop : public Thread, DeviceListener {
   // @copydoc
   void notifyDeviceData(symbol_t symbol, bool received) override;
 
+  // @copydoc
+  void notifyDeviceReceived(const symbol_t* symbols, size_t count) override;
+
   // @copydoc
   void notifyStatus(bool error, const char* message) override;
 
+  // @copydoc
+  void notifyMessageUpdate(const Message* message) override;
+
 
  protected:
   // @copydoc
@@ -142,18 +320,99 @@ class MainLoop : public Thread, DeviceListener {
 
 
  private:
+  /**
+   * Determine the lane for executing the request of a client @a NetMessage.
+   * @param message the client @a NetMessage.
+   * @return the @a CommandLane to use.
+   */
+  static CommandLane getCommandLane(NetMessage* message);
+
+  /**
+   * Determine the bus a client @a NetMessage is addressed to, either by the "-B ID" option following the command,
+   * by the bus ID prefix of the circuit name, or by the bus the client mode was entered for.
+   * @param message the client @a NetMessage.
+   * @return the @a MainLoop of the additional bus, or this instance.
+   */
+  MainLoop* getBusLoop(NetMessage* message);
+
+  /**
+   * Determine the bus a circuit name refers to by its bus ID prefix.
+   * @param circuit the circuit name, optionally prefixed by the bus ID and a dot.
+   * @return the @a MainLoop of the additional bus, or the one of the primary bus.
+   */
+  MainLoop* getCircuitLoop(const string& circuit);
+
+  /**
+   * Execute the request of a client @a NetMessage and set the result.
+   * @param message the client @a NetMessage to handle.
+   */
+  void handleNetMessage(NetMessage* message);
+
+  /**
+   * Execute the frames of a binary protocol client @a NetMessage and set the result.
+   * @param message the client @a NetMessage to handle.
+   */
+  void handleBinaryMessage(NetMessage* message);
+
+  /**
+   * Get the binary protocol handle of a circuit and message name (shared by all buses).
+   * @param circuit the circuit name including the bus ID prefix.
+   * @param name the message name.
+   * @param create whether to create a new handle if not assigned yet.
+   * @return the handle, or 0 if not assigned.
+   */
+  uint32_t getBinaryHandle(const string& circuit, const string& name, bool create);
+
+  /**
+   * Get the circuit and message name of a binary protocol handle.
+   * @param handle the handle.
+   * @param circuit set to the circuit name including the bus ID prefix.
+   * @param name set to the message name.
+   * @return true when the handle is assigned.
+   */
+  bool getBinaryNames(uint32_t handle, string* circuit, string* name);
+
+  /**
+   * Load the configuration for a slave scanned by the automatic scan without any command running.
+   * @param load the @a DeferredScanLoad to complete.
+   */
+  void loadScanConfig(const DeferredScanLoad* load);
+
+  /**
+   * Load the scan config files of the slaves in the @a ScanCache before any bus traffic.
+   */
+  void applyScanCache();
+
+  /**
+   * Store the identification and the loaded scan config file of a slave in the @a ScanCache.
+   * @param address the slave address.
+   */
+  void updateScanCache(symbol_t address);
+
+  /**
+   * Start scanning the next slave taken from the @a ScanCache again in the background, or check the answer of the
+   * previous one and reload the configuration when it answered differently.
+   */
+  void verifyScanCache();
+
+  /**
+   * Reload the configuration files and restore the scanned slaves and the persisted values.
+   * @return the result code.
+   */
+  result_t reloadConfig();
+
   /**
    * Decode and execute client message.
    * @param data the data string to decode (may be empty).
+   * @param netMessage the @a NetMessage the data was received with.
    * @param connected set to false when the client connection shall be closed.
-   * @param isHttp true for HTTP message.
    * @param settings set to the new client settings.
    * @param user set to the new user name when changed by authentication.
    * @param reload set to true when the configuration files were reloaded.
    * @param ostream the @a ostringstream to format the result string to.
    * @return the result code.
    */
-  result_t decodeMessage(const string& data, bool isHttp, bool* connected, ClientSettings* settings,
+  result_t decodeMessage(const string& data, NetMessage* netMessage, bool* connected, ClientSettings* settings,
       string* user, bool* reload, ostringstream* ostream);
 
   /**
@@ -192,6 +451,19 @@ class MainLoop : public Thread, DeviceListener {
    */
   result_t executeRead(const vector<string>& args, const string& levels, ostringstream* ostream);
 
+  /**
+   * Execute the read command for several messages at once.
+   * @param batch the comma separated list of messages to read, each optionally prefixed with the circuit and colon.
+   * @param defaultCircuit the circuit for messages without circuit prefix.
+   * @param levels the current user's access levels.
+   * @param maxAge the maximum age in seconds of cached values to return.
+   * @param verbosity the @a OutputFormat options.
+   * @param ostream the @a ostringstream to format the result string to.
+   * @return the result code.
+   */
+  result_t executeReadBatch(const string& batch, const string& defaultCircuit, const string& levels, time_t maxAge,
+      OutputFormat verbosity, ostringstream* ostream);
+
   /**
    * Execute the write command.
    * @param args the arguments passed to the command (starting with the command itself), or empty for help.
@@ -212,6 +484,15 @@ class MainLoop : public Thread, DeviceListener {
    */
   result_t parseHexAndSend(const vector<string>& args, size_t& argPos, bool isDirectMode, ostringstream* ostream);
 
+  /**
+   * Send a raw message on the bus and wait for the answer without holding the shared command lock.
+   * Any @a Message pointer obtained before is invalid afterwards and has to be looked up again.
+   * @param master the @a MasterSymbolString to send.
+   * @param slave the @a SlaveSymbolString for filling in the answer.
+   * @return the result code.
+   */
+  result_t sendAndWaitUnlocked(const MasterSymbolString& master, SlaveSymbolString* slave);
+
   /**
    * Execute the hex command.
    * @param args the arguments passed to the command (starting with the command itself), or empty for help.
@@ -263,6 +544,22 @@ class MainLoop : public Thread, DeviceListener {
    */
   result_t executeGrab(const vector<string>& args, ostringstream* ostream);
 
+  /**
+   * Execute the trace command.
+   * @param args the arguments passed to the command (starting with the command itself), or empty for help.
+   * @param ostream the @a ostringstream to format the result string to.
+   * @return the result code.
+   */
+  result_t executeTrace(const vector<string>& args, ostringstream* ostream);
+
+  /**
+   * Execute the history command.
+   * @param args the arguments passed to the command (starting with the command itself), or empty for help.
+   * @param ostream the @a ostringstream to format the result string to.
+   * @return the result code.
+   */
+  result_t executeHistory(const vector<string>& args, ostringstream* ostream);
+
   /**
    * Execute the define command.
    * @param args the arguments passed to the command (starting with the command itself), or empty for help.
@@ -356,20 +653,46 @@ class MainLoop : public Thread, DeviceListener {
   /**
    * Execute the HTTP GET command.
    * @param args the arguments passed to the command (starting with the command itself).
+   * @param netMessage the @a NetMessage the command was received with (for streaming the response).
    * @param connected set to false when the client connection shall be closed.
    * @param ostream the @a ostringstream to format the result string to.
    * @return the result code.
    */
-  result_t executeGet(const vector<string>& args, bool* connected, ostringstream* ostream);
+  result_t executeGet(const vector<string>& args, NetMessage* netMessage, bool* connected, ostringstream* ostream);
 
   /**
    * Format the HTTP answer to the result string.
    * @param ret the result code of handling the request.
    * @param type the content type.
-   * @param ostream the @a ostringstream to format the result string to.
+   * @param headers the @a HttpHeaders of the request.
+   * @param etag the entity tag of the content, or empty.
+   * @param ostream the @a ostringstream with the body to format the complete answer to.
    * @return the result code.
    */
-  result_t formatHttpResult(result_t ret, int type, ostringstream* ostream);
+  result_t formatHttpResult(result_t ret, int type, const HttpHeaders& headers, const string& etag,
+      ostringstream* ostream);
+
+  /**
+   * Format the HTTP answer header.
+   * @param ret the result code of handling the request (@a RESULT_EMPTY for not modified).
+   * @param type the content type.
+   * @param headers the @a HttpHeaders of the request.
+   * @param etag the entity tag of the content, or empty.
+   * @param length the length of the body, or -1 for chunked transfer encoding.
+   * @param encoded whether the body is compressed with the encoding accepted by the client.
+   * @param ostream the @a ostringstream to format the header to.
+   */
+  void formatHttpHeader(result_t ret, int type, const HttpHeaders& headers, const string& etag, ssize_t length,
+      bool encoded, ostringstream* ostream);
+
+  /** the identifier of an additional bus, or empty for the primary bus. */
+  const string m_busId;
+
+  /** the @a MainLoop of the primary bus, or nullptr for the primary bus itself. */
+  MainLoop* m_primary;
+
+  /** the @a MainLoop instances of the additional buses served by the front ends of this instance. */
+  vector<MainLoop*> m_buses;
 
   /** the @a Device instance. */
   Device* m_device;
@@ -398,6 +721,27 @@ class MainLoop : public Thread, DeviceListener {
   /** the @a RotateFile for dumping received data, or nullptr. */
   RotateFile* m_dumpFile;
 
+  /** the @a ValueStore for persisting the last seen message data, or nullptr. */
+  ValueStore* m_valueStore;
+
+  /** the @a ScanCache for persisting the scan identification of the slaves, or nullptr. */
+  ScanCache* m_scanCache;
+
+  /** the slave addresses taken from the @a ScanCache still to be verified by a scan. */
+  vector<symbol_t> m_scanCacheVerify;
+
+  /** the slave address currently being verified by a background scan, or @a SYN. */
+  symbol_t m_scanCacheVerifying;
+
+  /** the system time the background scan of @a m_scanCacheVerifying was started. */
+  time_t m_scanCacheVerifySince;
+
+  /** the @a SharedValuesWriter for exporting the last message data to local consumers, or nullptr. */
+  SharedValuesWriter* m_sharedValues;
+
+  /** the @a History of the numeric field values, or nullptr. */
+  History* m_history;
+
   /** the @a UserList instance. */
   UserList m_userList;
 
@@ -435,12 +779,48 @@ class MainLoop : public Thread, DeviceListener {
   /** the created @a Network instance. */
   Network* m_network;
 
-  /** the @a NetMessage @a Queue. */
-  Queue<NetMessage*> m_netQueue;
+  /** the @a NetMessageQueue. */
+  NetMessageQueue m_netQueue;
+
+  /** the @a NetMessage @a Queue for commands answered without bus traffic. */
+  Queue<NetMessage*> m_cacheLane;
+
+  /** the @a NetMessage @a Queue for commands potentially waiting for the bus. */
+  Queue<NetMessage*> m_busLane;
+
+  /** the @a CommandWorker instances serving the lanes. */
+  list<CommandWorker*> m_workers;
+
+  /** the @a DeferredScanLoad @a Queue for loading the configuration of scanned slaves in the background. */
+  Queue<DeferredScanLoad*> m_scanLoads;
+
+  /** the @a SharedMutex held shared while executing a command and exclusive for @a cl_exclusive commands. */
+  SharedMutex m_commandMutex;
+
+  /** set to true by a worker when the configuration files were reloaded. */
+  std::atomic<bool> m_reload;
+
+  /** the @a Mutex for @a m_binaryHandles and @a m_binaryNames. */
+  Mutex m_binaryLock;
+
+  /** the binary protocol handles by circuit and message name separated by tab. */
+  map<string, uint32_t> m_binaryHandles;
+
+  /** the circuit and message names by binary protocol handle minus one. */
+  vector<std::pair<string, string>> m_binaryNames;
+
+  /** the @a Mutex for @a m_dataCache. */
+  Mutex m_dataCacheLock;
+
+  /** the cached HTTP data query responses by normalized query. */
+  std::unordered_map<string, DataCacheEntry> m_dataCache;
 
   /** the path for HTML files served by the HTTP port. */
   string m_htmlPath;
 
+  /** the @a StaticFileCache for the files in @a m_htmlPath. */
+  StaticFileCache m_htmlFiles;
+
   /** the registered @a DataHandler instances. */
   list<DataHandler*> m_dataHandlers;
 
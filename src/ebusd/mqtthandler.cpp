@@ -21,14 +21,21 @@
 #endif
 
 #include "ebusd/mqtthandler.h"
+#include <string.h>
+#include <algorithm>
 #include <csignal>
 #include <deque>
+#include <functional>
+#include "lib/utils/clock.h"
 #include "lib/utils/log.h"
 
 namespace ebusd {
 
 using std::dec;
 
+/** the maximum number of cached routes for received topics. */
+#define MAX_TOPIC_ROUTES 1000
+
 #define O_HOST 1
 #define O_PORT (O_HOST+1)
 #define O_CLID (O_PORT+1)
@@ -46,6 +53,10 @@ using std::dec;
 #define O_KEYF (O_CERT+1)
 #define O_KEPA (O_KEYF+1)
 #define O_INSE (O_KEPA+1)
+#define O_QUEU (O_INSE+1)
+#define O_BATC (O_QUEU+1)
+#define O_INFL (O_BATC+1)
+#define O_RESY (O_INFL+1)
 
 /** the definition of the MQTT arguments. */
 static const struct argp_option g_mqtt_argp_options[] = {
@@ -69,6 +80,11 @@ static const struct argp_option g_mqtt_argp_options[] = {
   {"mqttignoreinvalid", O_IGIN, nullptr, 0,
    "Ignore invalid parameters during init (e.g. for DNS not resolvable yet)", 0 },
   {"mqttchanges",  O_CHGS, nullptr,       0, "Whether to only publish changed messages instead of all received", 0 },
+  {"mqttqueue",    O_QUEU, "COUNT",       0, "Keep up to COUNT topic updates pending for publishing [1000]", 0 },
+  {"mqttbatch",    O_BATC, "COUNT",       0, "Publish up to COUNT topic updates at once [100]", 0 },
+  {"mqttinflight", O_INFL, "COUNT",       0, "Allow up to COUNT topic updates not yet sent to the broker [100]", 0 },
+  {"mqttresync",   O_RESY, "RATE",        0, "Republish at most RATE changed topics per second after reconnect [50]",
+   0 },
 
 #if (LIBMOSQUITTO_MAJOR >= 1)
   {"mqttca",       O_CAFI, "CA",          0, "Use CA file or dir (ending with '/') for MQTT TLS (no default)", 0 },
@@ -100,6 +116,10 @@ static int g_version = MQTT_PROTOCOL_V31;  //!< protocol version to use
 #endif
 static bool g_ignoreInvalidParams = false;  //!< ignore invalid parameters during init
 static bool g_onlyChanges = false;        //!< whether to only publish changed messages instead of all received
+static size_t g_queueSize = 1000;         //!< the maximum number of pending topic updates
+static size_t g_batchSize = 100;          //!< the maximum number of topic updates to publish at once
+static size_t g_maxInflight = 100;        //!< the maximum number of topic updates not yet sent to the broker
+static size_t g_resyncRate = 50;          //!< the maximum number of topic updates per second during resync
 
 #if (LIBMOSQUITTO_MAJOR >= 1)
 static const char* g_cafile = nullptr;    //!< CA file for TLS
@@ -213,6 +233,38 @@ static error_t mqtt_parse_opt(int key, char *arg, struct argp_state *state) {
     g_onlyChanges = true;
     break;
 
+  case O_QUEU:  // --mqttqueue=1000
+    g_queueSize = (size_t)parseInt(arg, 10, 1, 1000000, &result);
+    if (result != RESULT_OK) {
+      argp_error(state, "invalid mqttqueue");
+      return EINVAL;
+    }
+    break;
+
+  case O_BATC:  // --mqttbatch=100
+    g_batchSize = (size_t)parseInt(arg, 10, 1, 100000, &result);
+    if (result != RESULT_OK) {
+      argp_error(state, "invalid mqttbatch");
+      return EINVAL;
+    }
+    break;
+
+  case O_INFL:  // --mqttinflight=100
+    g_maxInflight = (size_t)parseInt(arg, 10, 1, 100000, &result);
+    if (result != RESULT_OK) {
+      argp_error(state, "invalid mqttinflight");
+      return EINVAL;
+    }
+    break;
+
+  case O_RESY:  // --mqttresync=50
+    g_resyncRate = (size_t)parseInt(arg, 10, 1, 100000, &result);
+    if (result != RESULT_OK) {
+      argp_error(state, "invalid mqttresync");
+      return EINVAL;
+    }
+    break;
+
 #if (LIBMOSQUITTO_MAJOR >= 1)
     case O_CAFI:  // --mqttca=file or --mqttca=dir/
       if (arg == nullptr || arg[0] == 0) {
@@ -424,6 +476,15 @@ void on_log(struct mosquitto *mosq, void *obj, int level, const char* msg) {
 }
 #endif
 
+#if (LIBMOSQUITTO_MAJOR >= 1)
+void on_publish(struct mosquitto *mosq, void *obj, int mid) {
+  MqttHandler* handler = reinterpret_cast<MqttHandler*>(obj);
+  if (handler) {
+    handler->notifyPublished(mid);
+  }
+}
+#endif
+
 void on_message(
 #if (LIBMOSQUITTO_MAJOR >= 1)
   struct mosquitto *mosq,
@@ -439,9 +500,18 @@ void on_message(
 }
 
 
-MqttHandler::MqttHandler(UserInfo* userInfo, BusHandler* busHandler, MessageMap* messages)
-  : DataSink(userInfo, "mqtt"), DataSource(busHandler), WaitThread(), m_messages(messages), m_connected(false),
-    m_initialConnectFailed(false), m_lastUpdateCheckResult("."), m_lastScanStatus("."), m_lastErrorLogTime(0) {
+MqttHandler::MqttHandler(UserInfo* userInfo, BusHandler* busHandler, MessageMap* messages, MqttHandler* connection,
+    const string& busId)
+  : DataSink(userInfo, "mqtt"), DataSource(busHandler), WaitThread(), m_messages(messages),
+    m_connection(connection ? connection : this),
+    m_topicRoutesGeneration(0), m_connected(false), m_signal(false), m_initialConnectFailed(false),
+    m_lastUpdateCheckResult("."),
+    m_lastScanStatus("."), m_lastErrorLogTime(0),
+    m_inflight(0), m_publishedCount(0), m_coalescedCount(0), m_droppedCount(0), m_deferredCount(0),
+    m_loggedDroppedCount(0), m_sendingMid(-1), m_sendingAcked(false), m_resyncTotal(0), m_resyncPublished(0),
+    m_resyncTokens(0), m_lastResyncStatus(".") {
+  m_resyncRefillTime.tv_sec = 0;
+  m_resyncRefillTime.tv_nsec = 0;
   m_publishByField = false;
   m_mosquitto = nullptr;
   if (g_topicFields.empty()) {
@@ -464,9 +534,20 @@ MqttHandler::MqttHandler(UserInfo* userInfo, BusHandler* busHandler, MessageMap*
       }
     }
   }
+  for (const auto& field : g_topicFields) {
+    m_topicParts.push_back(field == "circuit" ? tp_circuit : field == "name" ? tp_name
+        : field == "field" ? tp_field : tp_other);
+  }
+  m_topicRoutesGeneration = m_messages->getGeneration();
   m_globalTopic = getTopic(nullptr, "global/");
   m_subscribeTopic = getTopic(nullptr, "#");
-  if (check(mosquitto_lib_init(), "unable to initialize")) {
+  if (m_connection != this) {
+    // the topics of an additional bus are distinguished by the bus ID prefix of the circuit names
+    m_globalTopic += busId+"/";
+    m_connection->m_busesMutex.lock();
+    m_connection->m_buses.push_back(this);
+    m_connection->m_busesMutex.unlock();
+  } else if (check(mosquitto_lib_init(), "unable to initialize")) {
     signal(SIGPIPE, SIG_IGN);  // needed before libmosquitto v. 1.1.3
     ostringstream clientId;
     if (g_clientId) {
@@ -529,6 +610,9 @@ MqttHandler::MqttHandler(UserInfo* userInfo, BusHandler* busHandler, MessageMap*
 #endif
     mosquitto_connect_callback_set(m_mosquitto, on_connect);
     mosquitto_message_callback_set(m_mosquitto, on_message);
+#if (LIBMOSQUITTO_MAJOR >= 1)
+    mosquitto_publish_callback_set(m_mosquitto, on_publish);
+#endif
     int ret;
 #if (LIBMOSQUITTO_MAJOR >= 1)
     ret = mosquitto_connect(m_mosquitto, g_host, g_port, 60);
@@ -551,6 +635,13 @@ MqttHandler::MqttHandler(UserInfo* userInfo, BusHandler* busHandler, MessageMap*
 
 MqttHandler::~MqttHandler() {
   join();
+  if (m_connection != this) {
+    m_connection->m_busesMutex.lock();
+    m_connection->m_buses.erase(std::remove(m_connection->m_buses.begin(), m_connection->m_buses.end(), this),
+        m_connection->m_buses.end());
+    m_connection->m_busesMutex.unlock();
+    return;
+  }
   if (m_mosquitto) {
     mosquitto_destroy(m_mosquitto);
     m_mosquitto = nullptr;
@@ -564,33 +655,34 @@ void MqttHandler::start() {
   }
 }
 
+DataHandler* MqttHandler::createBusHandler(UserInfo* userInfo, BusHandler* busHandler, MessageMap* messages,
+    const string& busId) {
+  if (!m_mosquitto) {
+    return nullptr;
+  }
+  // the additional bus has no thread of its own, its updates are published by the run() of this instance
+  return new MqttHandler(userInfo, busHandler, messages, this, busId);
+}
+
 void MqttHandler::notifyConnected() {
   if (m_mosquitto && isRunning()) {
+    m_inflight = 0;  // anything not sent before is lost with the previous connection
+    m_sentTopics.clear();
+    // the session is always clean, so a restarted broker may have lost the retained data acknowledged before
+    m_queueMutex.lock();
+    m_publishedHashes.clear();
+    m_queueMutex.unlock();
     const string sep = (g_publishFormat & OF_JSON) ? "\"" : "";
-    publishTopic(m_globalTopic+"version", sep + (PACKAGE_STRING "." REVISION) + sep, true);
-    publishTopic(m_globalTopic+"running", "true", true);
+    const string version = sep + (PACKAGE_STRING "." REVISION) + sep;
+    const string running = "true";
+    sendTopic(m_globalTopic+"version", &version, true);
+    sendTopic(m_globalTopic+"running", &running, true);
     check(mosquitto_subscribe(m_mosquitto, nullptr, m_subscribeTopic.c_str(), 0), "subscribe");
   }
 }
 
-void MqttHandler::notifyTopic(const string& topic, const string& data) {
-  size_t pos = topic.rfind('/');
-  if (pos == string::npos) {
-    return;
-  }
-  string direction = topic.substr(pos+1);
-  if (direction.empty()) {
-    return;
-  }
-  bool isWrite = direction == "set";
-  bool isList = !isWrite && direction == "list";
-  if (!isWrite && !isList && direction != "get") {
-    return;
-  }
-
-  logOtherDebug("mqtt", "received topic %s with data %s", topic.c_str(), data.c_str());
-  string remain = topic.substr(0, pos);
-  size_t last = 0;
+void MqttHandler::notifyListTopic(const string& remain, const string& data) {
+  size_t pos, last = 0;
   string circuit, name;
   bool finalField = false;
   for (size_t idx = 0; idx < g_topicStrs.size()+1 && !finalField; idx++) {
@@ -600,9 +692,6 @@ void MqttHandler::notifyTopic(const string& topic, const string& data) {
       chk = g_topicStrs[idx];
       pos = remain.find(chk, last);
       if (pos == string::npos) {
-        if (!isList) {
-          return;
-        }
         if (idx == 0 && remain+"/" == chk) {  // check for only first prefix, e.g. "ebusd/"
           break;
         }
@@ -611,11 +700,6 @@ void MqttHandler::notifyTopic(const string& topic, const string& data) {
       }
     } else if (idx-1 < g_topicFields.size()) {
       pos = remain.size();
-    } else if (last < remain.size()) {
-      if (!isList) {
-        return;
-      }
-      break;
     } else {
       break;
     }
@@ -627,9 +711,6 @@ void MqttHandler::notifyTopic(const string& topic, const string& data) {
       }
     } else {
       if (field.empty()) {
-        if (!isList) {
-          return;
-        }
         continue;
       }
       string fieldName = g_topicFields[idx-1];
@@ -644,47 +725,345 @@ void MqttHandler::notifyTopic(const string& topic, const string& data) {
       }
     }
   }
-  if (isList) {
-    logOtherInfo("mqtt", "received list topic for %s %s", circuit.c_str(), name.c_str());
-    deque<Message*> messages;
-    bool circuitPrefix = circuit.length() > 0 && circuit.find_last_of('*') == circuit.length()-1;
-    if (circuitPrefix) {
-      circuit = circuit.substr(0, circuit.length()-1);
-    }
-    bool namePrefix = name.length() > 0 && name.find_last_of('*') == name.length()-1;
-    if (namePrefix) {
-      name = name.substr(0, name.length()-1);
-    }
-    m_messages->findAll(circuit, name, m_levels, !(circuitPrefix || namePrefix), true, true,
-                        true, true, true, 0, 0, false, &messages);
-    bool onlyWithData = !data.empty();
-    for (const auto message : messages) {
-      if ((circuitPrefix && (
-          message->getCircuit().substr(0, circuit.length()) != circuit
-          || (!namePrefix && name.length() > 0 && message->getName() != name)))
-      || (namePrefix && (
-          message->getName().substr(0, name.length()) != name
-          || (!circuitPrefix && circuit.length() > 0 && message->getCircuit() != circuit)))
-      ) {
-        continue;
+  logOtherInfo("mqtt", "received list topic for %s %s", circuit.c_str(), name.c_str());
+  deque<Message*> messages;
+  bool circuitPrefix = circuit.length() > 0 && circuit.find_last_of('*') == circuit.length()-1;
+  if (circuitPrefix) {
+    circuit = circuit.substr(0, circuit.length()-1);
+  }
+  bool namePrefix = name.length() > 0 && name.find_last_of('*') == name.length()-1;
+  if (namePrefix) {
+    name = name.substr(0, name.length()-1);
+  }
+  m_messages->findAll(circuit, name, m_levels, !(circuitPrefix || namePrefix), true, true,
+                      true, true, true, 0, 0, false, &messages);
+  bool onlyWithData = !data.empty();
+  for (const auto message : messages) {
+    if ((circuitPrefix && (
+        message->getCircuit().substr(0, circuit.length()) != circuit
+        || (!namePrefix && name.length() > 0 && message->getName() != name)))
+    || (namePrefix && (
+        message->getName().substr(0, name.length()) != name
+        || (!circuitPrefix && circuit.length() > 0 && message->getCircuit() != circuit)))
+    ) {
+      continue;
+    }
+    time_t lastup = message->getLastUpdateTime();
+    if (onlyWithData && lastup == 0) {
+      continue;
+    }
+    OutputBuffer updates;
+    publishMessage(message, &updates, true);
+  }
+}
+
+bool MqttHandler::matchTopic(const string& topic, size_t length, string* circuit, string* name) const {
+  size_t last = 0;
+  for (size_t idx = 0; idx <= g_topicStrs.size(); idx++) {
+    size_t pos, chkLength = 0;
+    if (idx < g_topicStrs.size()) {
+      const string& chk = g_topicStrs[idx];
+      chkLength = chk.length();
+      pos = topic.find(chk, last);
+      if (pos == string::npos || pos + chkLength > length) {
+        return false;
       }
-      time_t lastup = message->getLastUpdateTime();
-      if (onlyWithData && lastup == 0) {
-        continue;
+    } else if (idx-1 < m_topicParts.size()) {
+      pos = length;
+    } else {
+      return last >= length;
+    }
+    if (idx == 0) {
+      if (pos > 0) {
+        return false;
+      }
+    } else {
+      if (pos == last) {
+        return false;
+      }
+      switch (m_topicParts[idx-1]) {
+      case tp_circuit:
+        circuit->assign(topic, last, pos-last);
+        break;
+      case tp_name:
+        name->assign(topic, last, pos-last);
+        break;
+      case tp_field:
+        // TODO add support for writing a single field
+        break;
+      default:
+        return false;
       }
-      ostringstream ostream;
-      publishMessage(message, &ostream, true);
     }
+    last = pos+chkLength;
+  }
+  return true;
+}
+
+bool MqttHandler::routeTopic(const string& topic, size_t length, bool isWrite, string* circuit, string* name,
+    Message** message) {
+  size_t generation = m_messages->getGeneration();
+  if (generation != m_topicRoutesGeneration) {
+    // messages were added or removed, e.g. due to reload or scan
+    m_topicRoutes.clear();
+    m_topicRoutesGeneration = generation;
+  }
+  const auto it = m_topicRoutes.find(topic);
+  if (it != m_topicRoutes.end()) {
+    *message = it->second;
+    *circuit = it->second->getCircuit();
+    *name = it->second->getName();
+    return true;
+  }
+  if (!matchTopic(topic, length, circuit, name) || name->empty()) {
+    return false;
+  }
+  *message = m_messages->find(*circuit, *name, m_levels, isWrite);
+  if (*message == nullptr) {
+    *message = m_messages->find(*circuit, *name, m_levels, isWrite, true);
+  }
+  // conditional messages are looked up each time as the available one may change
+  if (*message != nullptr && !(*message)->isConditional()) {
+    if (m_topicRoutes.size() >= MAX_TOPIC_ROUTES) {
+      m_topicRoutes.clear();
+    }
+    m_topicRoutes[topic] = *message;
+  }
+  return true;
+}
+
+/**
+ * Skip whitespace in the JSON input.
+ * @param pos the current position in the input, updated on return.
+ */
+static void skipJsonSpace(const char** pos) {
+  while (**pos == ' ' || **pos == '\t' || **pos == '\r' || **pos == '\n') {
+    (*pos)++;
+  }
+}
+
+/**
+ * Parse a JSON string starting at the opening quote.
+ * @param pos the current position in the input, updated on return.
+ * @param value the variable in which to store the unescaped string.
+ * @return true on success.
+ */
+static bool parseJsonString(const char** pos, string* value) {
+  const char* str = *pos + 1;
+  value->clear();
+  while (*str != '"') {
+    char ch = *str++;
+    if (ch == 0) {
+      return false;
+    }
+    if (ch == '\\') {
+      ch = *str++;
+      switch (ch) {
+        case 'b': ch = '\b'; break;
+        case 'f': ch = '\f'; break;
+        case 'n': ch = '\n'; break;
+        case 'r': ch = '\r'; break;
+        case 't': ch = '\t'; break;
+        case 'u': {
+          result_t result = RESULT_OK;
+          unsigned int code = parseInt(string(str, strnlen(str, 4)).c_str(), 16, 0, 0xffff, &result);
+          if (result != RESULT_OK || strnlen(str, 4) < 4) {
+            return false;
+          }
+          str += 4;
+          if (code >= 0x800) {
+            *value += static_cast<char>(0xe0 | (code >> 12));
+            *value += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+            ch = static_cast<char>(0x80 | (code & 0x3f));
+          } else if (code >= 0x80) {
+            *value += static_cast<char>(0xc0 | (code >> 6));
+            ch = static_cast<char>(0x80 | (code & 0x3f));
+          } else {
+            ch = static_cast<char>(code);
+          }
+          break;
+        }
+        case '"':
+        case '\\':
+        case '/':
+          break;
+        default:
+          return false;
+      }
+    }
+    *value += ch;
+  }
+  *pos = str + 1;
+  return true;
+}
+
+/**
+ * Parse a single JSON value to a @a FieldValue. An object is accepted as well when it contains the value in the
+ * "value" key (as published in JSON format).
+ * @param pos the current position in the input, updated on return.
+ * @param value the variable in which to store the parsed value.
+ * @return true on success.
+ */
+static bool parseJsonValue(const char** pos, FieldValue* value) {
+  skipJsonSpace(pos);
+  const char* str = *pos;
+  if (*str == '"') {
+    string strValue;
+    if (!parseJsonString(pos, &strValue)) {
+      return false;
+    }
+    *value = FieldValue(strValue);
+    return true;
+  }
+  if (*str == '{') {
+    *pos = str + 1;
+    bool found = false;
+    skipJsonSpace(pos);
+    while (**pos != '}') {
+      string key;
+      if (**pos != '"' || !parseJsonString(pos, &key)) {
+        return false;
+      }
+      skipJsonSpace(pos);
+      if (**pos != ':') {
+        return false;
+      }
+      (*pos)++;
+      FieldValue entry;
+      if (!parseJsonValue(pos, &entry)) {
+        return false;
+      }
+      if (key == "value") {
+        *value = entry;
+        found = true;
+      }
+      skipJsonSpace(pos);
+      if (**pos == ',') {
+        (*pos)++;
+        skipJsonSpace(pos);
+      } else if (**pos != '}') {
+        return false;
+      }
+    }
+    (*pos)++;
+    return found;
+  }
+  if (strncmp(str, "null", 4) == 0) {
+    *value = FieldValue();
+    *pos = str + 4;
+    return true;
+  }
+  if (strncmp(str, "true", 4) == 0) {
+    *value = FieldValue(1.0);
+    *pos = str + 4;
+    return true;
+  }
+  if (strncmp(str, "false", 5) == 0) {
+    *value = FieldValue(0.0);
+    *pos = str + 5;
+    return true;
+  }
+  char* strEnd = nullptr;
+  double number = strtod(str, &strEnd);
+  if (strEnd == nullptr || strEnd == str) {
+    return false;
+  }
+  *value = FieldValue(number);
+  *pos = strEnd;
+  return true;
+}
+
+/**
+ * Parse a JSON array or object payload to @a FieldValues of the master data fields of the @a Message.
+ * @param data the payload starting with "[" (values in field order) or "{" (values by field name).
+ * @param message the @a Message to write.
+ * @param values the @a FieldValues to fill.
+ * @return true on success.
+ */
+static bool parseJsonValues(const string& data, const Message* message, FieldValues* values) {
+  const char* pos = data.c_str();
+  skipJsonSpace(&pos);
+  bool isObject = *pos == '{';
+  char end = isObject ? '}' : ']';
+  pos++;
+  skipJsonSpace(&pos);
+  while (*pos != end) {
+    ssize_t index = static_cast<ssize_t>(values->size());
+    if (isObject) {
+      string key;
+      if (*pos != '"' || !parseJsonString(&pos, &key)) {
+        return false;
+      }
+      index = message->getMasterValueIndex(key);
+      if (index < 0) {
+        return false;
+      }
+      skipJsonSpace(&pos);
+      if (*pos != ':') {
+        return false;
+      }
+      pos++;
+    }
+    if (static_cast<size_t>(index) >= values->size()) {
+      values->resize(index + 1, FieldValue(string()));  // fields not set are treated like empty input
+    }
+    if (!parseJsonValue(&pos, &(*values)[index])) {
+      return false;
+    }
+    skipJsonSpace(&pos);
+    if (*pos == ',') {
+      pos++;
+      skipJsonSpace(&pos);
+    } else if (*pos != end) {
+      return false;
+    }
+  }
+  pos++;
+  skipJsonSpace(&pos);
+  return *pos == 0;
+}
+
+void MqttHandler::notifyTopic(const string& topic, const string& data) {
+  size_t pos = topic.rfind('/');
+  if (pos == string::npos || pos+1 >= topic.length()) {
     return;
   }
-  if (name.empty()) {
+  const char* direction = topic.c_str()+pos+1;
+  bool isWrite = strcmp(direction, "set") == 0;
+  bool isList = !isWrite && strcmp(direction, "list") == 0;
+  if (!isWrite && !isList && strcmp(direction, "get") != 0) {
     return;
   }
-  logOtherInfo("mqtt", "received %s topic for %s %s", direction.c_str(), circuit.c_str(), name.c_str());
-  Message* message = m_messages->find(circuit, name, m_levels, isWrite);
-  if (message == nullptr) {
-    message = m_messages->find(circuit, name, m_levels, isWrite, true);
+  if (m_connection == this && !isList) {
+    // hand over the topics of an additional bus identified by the bus ID prefix of the circuit name
+    string circuit, name;
+    m_busesMutex.lock();
+    MqttHandler* bus = m_buses.empty() || !matchTopic(topic, pos, &circuit, &name) ? nullptr : getBus(circuit);
+    if (bus) {
+      bus->notifyTopic(topic, data);
+    }
+    m_busesMutex.unlock();
+    if (bus) {
+      return;
+    }
   }
+
+  logOtherDebug("mqtt", "received topic %s with data %s", topic.c_str(), data.c_str());
+  if (isList) {
+    notifyListTopic(topic.substr(0, pos), data);
+    m_busesMutex.lock();
+    for (const auto bus : m_buses) {
+      bus->notifyListTopic(topic.substr(0, pos), data);
+    }
+    m_busesMutex.unlock();
+    return;
+  }
+  string circuit, name;
+  Message* message = nullptr;
+  if (!routeTopic(topic, pos, isWrite, &circuit, &name, &message)) {
+    return;
+  }
+  logOtherInfo("mqtt", "received %s topic for %s %s", direction, circuit.c_str(), name.c_str());
   if (message == nullptr) {
     logOtherError("mqtt", "%s message %s %s not found", isWrite?"write":"read", circuit.c_str(), name.c_str());
     return;
@@ -708,7 +1087,19 @@ void MqttHandler::notifyTopic(const string& topic, const string& data) {
         }
       }
     }
-    result_t result = m_busHandler->readFromBus(message, useData);
+    result_t result;
+    size_t start = isWrite ? useData.find_first_not_of(" \t\r\n") : string::npos;
+    if (start != string::npos && (useData[start] == '[' || useData[start] == '{')) {
+      // JSON payload is encoded directly without the text round trip
+      FieldValues values;
+      if (!parseJsonValues(useData, message, &values)) {
+        logOtherError("mqtt", "write %s %s: invalid JSON payload", circuit.c_str(), name.c_str());
+        return;
+      }
+      result = m_busHandler->readFromBus(message, values);
+    } else {
+      result = m_busHandler->readFromBus(message, useData);
+    }
     if (result != RESULT_OK) {
       logOtherError("mqtt", "%s %s %s: %s", isWrite?"write":"read", circuit.c_str(), name.c_str(),
           getResultCode(result));
@@ -716,8 +1107,41 @@ void MqttHandler::notifyTopic(const string& topic, const string& data) {
     }
     logOtherNotice("mqtt", "%s %s %s: %s", isWrite?"write":"read", circuit.c_str(), name.c_str(), data.c_str());
   }
-  ostringstream ostream;
-  publishMessage(message, &ostream);
+  OutputBuffer updates;
+  publishMessage(message, &updates);
+}
+
+void MqttHandler::notifyPublished(int mid) {
+  if (m_inflight > 0) {
+    m_inflight--;
+  }
+  if (mid == m_sendingMid) {
+    // acknowledged from within mosquitto_publish()
+    acknowledgeTopic(m_sendingTopic);
+    m_sendingAcked = true;
+    return;
+  }
+  auto it = m_sentTopics.find(mid);
+  if (it != m_sentTopics.end()) {
+    acknowledgeTopic(it->second);
+    m_sentTopics.erase(it);
+  }
+}
+
+void MqttHandler::acknowledgeTopic(const SentTopic& sent) {
+  m_queueMutex.lock();
+  if (sent.empty) {
+    m_publishedHashes.erase(sent.topic);
+  } else {
+    m_publishedHashes[sent.topic] = sent.hash;
+  }
+  m_queueMutex.unlock();
+}
+
+void MqttHandler::notifyUpdate(Message* message) {
+  m_updateMutex.lock();
+  DataSink::notifyUpdate(message);
+  m_updateMutex.unlock();
 }
 
 void MqttHandler::notifyUpdateCheckResult(const string& checkResult) {
@@ -736,9 +1160,26 @@ void MqttHandler::notifyScanStatus(const string& scanStatus) {
   }
 }
 
+void MqttHandler::publishSignal(bool force) {
+  bool signal = m_busHandler->hasSignal();
+  if (signal != m_signal || force) {
+    m_signal = signal;
+    publishTopic(m_globalTopic+"signal", signal ? "true" : "false", true);
+  }
+}
+
+MqttHandler* MqttHandler::getBus(const string& circuit) const {
+  for (const auto bus : m_buses) {
+    const string& prefix = bus->m_messages->getCircuitPrefix();
+    if (circuit.length() > prefix.length() && strncasecmp(circuit.c_str(), prefix.c_str(), prefix.length()) == 0) {
+      return bus;
+    }
+  }
+  return nullptr;
+}
+
 void MqttHandler::run() {
   time_t lastTaskRun, now, start, lastSignal = 0, lastUpdates = 0;
-  bool signal = false;
   string signalTopic = m_globalTopic+"signal";
   string uptimeTopic = m_globalTopic+"uptime";
   ostringstream updates;
@@ -751,6 +1192,13 @@ void MqttHandler::run() {
     bool needsWait = handleTraffic(allowReconnect);
     bool reconnected = !wasConnected && m_connected;
     allowReconnect = false;
+    m_busesMutex.lock();  // the additional buses are served by this thread as well
+    if (reconnected) {
+      startResync();
+      for (const auto bus : m_buses) {
+        bus->startResync();
+      }
+    }
     time(&now);
     bool sendSignal = reconnected;
     if (now < start) {
@@ -772,47 +1220,177 @@ void MqttHandler::run() {
     if (sendSignal) {
       if (m_busHandler->hasSignal()) {
         lastSignal = now;
-        if (!signal || reconnected) {
-          signal = true;
-          publishTopic(signalTopic, "true", true);
-        }
-      } else {
-        if (signal || reconnected) {
-          signal = false;
-          publishTopic(signalTopic, "false", true);
+      }
+      publishSignal(reconnected);
+      for (const auto bus : m_buses) {
+        bus->publishSignal(reconnected);
+      }
+    }
+    prepareUpdates(lastUpdates);
+    for (const auto bus : m_buses) {
+      bus->prepareUpdates(lastUpdates);
+    }
+    time(&lastUpdates);
+    bool resyncing = m_connected && continueResync();
+    for (const auto bus : m_buses) {
+      if (m_connected && bus->continueResync()) {
+        resyncing = true;
+      }
+    }
+    m_busesMutex.unlock();
+    bool pending = m_connected && flushQueue();
+    if (m_droppedCount != m_loggedDroppedCount && sendSignal) {
+      logOtherNotice("mqtt", "publish queue full, dropped %d updates (%d published, %d coalesced, %d deferred)",
+          static_cast<unsigned>(m_droppedCount-m_loggedDroppedCount), static_cast<unsigned>(m_publishedCount),
+          static_cast<unsigned>(m_coalescedCount), static_cast<unsigned>(m_deferredCount));
+      m_loggedDroppedCount = m_droppedCount;
+    }
+    if ((!m_connected && !Wait(5)) || (needsWait && !pending && !resyncing && !Wait(1))) {
+      break;
+    }
+  }
+  if (m_connected) {
+    flushQueue();
+  }
+  const string signalOff = "false";
+  const string scanOff = "";
+  m_busesMutex.lock();
+  for (const auto handler : m_buses) {
+    sendTopic(handler->m_globalTopic+"signal", &signalOff, true);
+    sendTopic(handler->m_globalTopic+"scan", &scanOff, true);
+    sendTopic(handler->m_globalTopic+"resync", &scanOff, true);
+  }
+  m_busesMutex.unlock();
+  sendTopic(signalTopic, &signalOff, true);
+  sendTopic(m_globalTopic+"scan", &scanOff, true);  // clear retain of scan status
+  sendTopic(m_globalTopic+"resync", &scanOff, true);  // clear retain of resync status
+}
+
+void MqttHandler::prepareUpdates(time_t since) {
+  map<uint64_t, int> updatedMessages;
+  m_updateMutex.lock();
+  updatedMessages.swap(m_updatedMessages);
+  m_updateMutex.unlock();
+  OutputBuffer updates;
+  for (const auto& it : updatedMessages) {
+    // only hold the lock while taking the current data of a single key
+    m_messages->lock();
+    const vector<Message*>* messages = m_messages->getByKey(it.first);
+    if (messages) {
+      for (auto message : *messages) {
+        if (message->getLastChangeTime() > 0 && message->isAvailable()
+        && (!g_onlyChanges || message->getLastChangeTime() > since)) {
+          updates.clear();
+          publishMessage(message, &updates, false, g_onlyChanges ? since : 0);
         }
       }
     }
-    if (!m_updatedMessages.empty()) {
-      m_messages->lock();
-      if (m_connected) {
-        for (auto it = m_updatedMessages.begin(); it != m_updatedMessages.end(); ) {
-          const vector<Message*>* messages = m_messages->getByKey(it->first);
-          if (messages) {
-            for (auto message : *messages) {
-              if (message->getLastChangeTime() > 0 && message->isAvailable()
-              && (!g_onlyChanges || message->getLastChangeTime() > lastUpdates)) {
-                updates.str("");
-                updates.clear();
-                updates << dec;
-                publishMessage(message, &updates);
-              }
-            }
-          }
-          it = m_updatedMessages.erase(it);
+    m_messages->unlock();
+  }
+}
+
+void MqttHandler::startResync() {
+  deque<Message*> messages;
+  m_messages->lock();
+  m_messages->findAll("", "", "*", false, true, true, true, true, true, 1, 0, true, &messages);
+  m_resyncKeys.clear();
+  for (const auto message : messages) {
+    // only keep the key as the messages might be replaced by a reload in the meantime
+    m_resyncKeys.push_back(message->getKey());
+  }
+  m_messages->unlock();
+  m_resyncTotal = m_resyncKeys.size();
+  m_resyncPublished = 0;
+  m_resyncTokens = static_cast<double>(g_resyncRate);
+  clockGettimeMonotonic(&m_resyncRefillTime);
+  m_lastResyncStatus = ".";
+  logOtherInfo("mqtt", "resync of %d messages started", static_cast<unsigned>(m_resyncTotal));
+}
+
+bool MqttHandler::continueResync() {
+  if (m_resyncTotal == 0) {
+    return false;
+  }
+  struct timespec now;
+  clockGettimeMonotonic(&now);
+  double elapsed = static_cast<double>(now.tv_sec-m_resyncRefillTime.tv_sec)
+    + static_cast<double>(now.tv_nsec-m_resyncRefillTime.tv_nsec)/1000000000.0;
+  m_resyncRefillTime = now;
+  if (elapsed > 0) {
+    // the bucket holds at most one second worth of tokens
+    m_resyncTokens = std::min(m_resyncTokens + elapsed*static_cast<double>(g_resyncRate),
+                              static_cast<double>(g_resyncRate));
+  }
+  OutputBuffer updates;
+  size_t checked = 0;
+  while (!m_resyncKeys.empty() && m_resyncTokens >= 1 && checked < g_batchSize) {
+    m_connection->m_queueMutex.lock();
+    bool queueFull = m_connection->m_pendingOrder.size() >= g_batchSize;
+    m_connection->m_queueMutex.unlock();
+    if (queueFull) {
+      break;  // keep the queue for regular updates and let the broker catch up first
+    }
+    uint64_t key = m_resyncKeys.front();
+    m_resyncKeys.pop_front();
+    checked++;
+    m_messages->lock();
+    const vector<Message*>* messages = m_messages->getByKey(key);
+    if (messages) {
+      for (auto message : *messages) {
+        if (message->getLastChangeTime() > 0 && message->isAvailable()) {
+          updates.clear();
+          size_t count = publishMessage(message, &updates, false, 0, true);
+          m_resyncTokens -= static_cast<double>(count);
+          m_resyncPublished += count;
         }
-        time(&lastUpdates);
-      } else {
-        m_updatedMessages.clear();
       }
-      m_messages->unlock();
     }
-    if ((!m_connected && !Wait(5)) || (needsWait && !Wait(1))) {
+    m_messages->unlock();
+  }
+  const string sep = (g_publishFormat & OF_JSON) ? "\"" : "";
+  ostringstream status;
+  bool running = !m_resyncKeys.empty();
+  if (running) {
+    status << "running " << (m_resyncTotal-m_resyncKeys.size()) << "/" << m_resyncTotal;
+  } else {
+    status << "finished " << m_resyncTotal << " messages, " << m_resyncPublished << " republished";
+  }
+  if (status.str() != m_lastResyncStatus) {
+    m_lastResyncStatus = status.str();
+    publishTopic(m_globalTopic+"resync", sep + m_lastResyncStatus + sep, true);
+  }
+  if (!running) {
+    logOtherInfo("mqtt", "resync %s", m_lastResyncStatus.c_str());
+    m_resyncTotal = 0;
+  }
+  return running;
+}
+
+bool MqttHandler::flushQueue() {
+  size_t count = 0;
+  m_queueMutex.lock();
+  while (!m_pendingOrder.empty()) {
+    if (count >= g_batchSize || m_inflight >= g_maxInflight) {
+      m_deferredCount++;
       break;
     }
+    string topic = m_pendingOrder.front();
+    m_pendingOrder.pop_front();
+    auto it = m_pendingTopics.find(topic);
+    if (it == m_pendingTopics.end()) {
+      continue;
+    }
+    PendingTopic pending = it->second;
+    m_pendingTopics.erase(it);
+    // the library is not called with the queue locked, so preparation is not blocked by a slow broker
+    m_queueMutex.unlock();
+    sendTopic(topic, pending.empty ? nullptr : &pending.data, pending.retain);
+    count++;
+    m_queueMutex.lock();
   }
-  publishTopic(signalTopic, "false", true);
-  publishTopic(m_globalTopic+"scan", "", true);  // clear retain of scan status
+  bool ret = !m_pendingOrder.empty();
+  m_queueMutex.unlock();
+  return ret;
 }
 
 bool MqttHandler::handleTraffic(bool allowReconnect) {
@@ -885,14 +1463,15 @@ string MqttHandler::getTopic(const Message* message, const string& suffix, const
   return ret.str();
 }
 
-void MqttHandler::publishMessage(const Message* message, ostringstream* updates, bool includeWithoutData) {
+size_t MqttHandler::publishMessage(const Message* message, OutputBuffer* updates, bool includeWithoutData,
+    time_t changedSince, bool onlyDifferent) {
   OutputFormat outputFormat = g_publishFormat;
   bool json = outputFormat & OF_JSON;
   bool noData = includeWithoutData && message->getLastUpdateTime() == 0;
   if (!m_publishByField) {
     if (noData) {
       publishEmptyTopic(getTopic(message));  // alternatively: , json ? "null" : "");
-      return;
+      return 1;
     }
     if (json) {
       *updates << "{";
@@ -901,48 +1480,117 @@ void MqttHandler::publishMessage(const Message* message, ostringstream* updates,
     if (result != RESULT_OK) {
       logOtherError("mqtt", "decode %s %s: %s", message->getCircuit().c_str(), message->getName().c_str(),
           getResultCode(result));
-      return;
+      return 0;
     }
     if (json) {
       *updates << "}";
     }
-    publishTopic(getTopic(message), updates->str());
-    return;
+    return publishTopic(getTopic(message), updates->str(), false, onlyDifferent) ? 1 : 0;
   }
+  size_t count = 0;
   if (json) {
     outputFormat |= OF_SHORT;
   }
   for (size_t index = 0; index < message->getFieldCount(); index++) {
+    if (changedSince > 0 && message->getLastFieldChangeTime(index) <= changedSince) {
+      continue;
+    }
     string name = message->getFieldName(index);
     if (noData) {
       publishEmptyTopic(getTopic(message, "", name));  // alternatively: , json ? "null" : "");
+      count++;
       continue;
     }
     result_t result = message->decodeLastData(false, nullptr, index, outputFormat, updates);
     if (result != RESULT_OK) {
       logOtherError("mqtt", "decode %s %s %s: %s", message->getCircuit().c_str(), message->getName().c_str(),
           name.c_str(), getResultCode(result));
-      return;
+      return count;
+    }
+    if (publishTopic(getTopic(message, "", name), updates->str(), false, onlyDifferent)) {
+      count++;
     }
-    publishTopic(getTopic(message, "", name), updates->str());
-    updates->str("");
     updates->clear();
   }
+  return count;
 }
 
-void MqttHandler::publishTopic(const string& topic, const string& data, bool retain) {
-  const char* topicStr = topic.c_str();
-  const char* dataStr = data.c_str();
-  const size_t len = strlen(dataStr);
-  logOtherDebug("mqtt", "publish %s %s", topicStr, dataStr);
-  check(mosquitto_publish(m_mosquitto, nullptr, topicStr, (uint32_t)len,
-      reinterpret_cast<const uint8_t*>(dataStr), 0, g_retain || retain), "publish");
+bool MqttHandler::publishTopic(const string& topic, const string& data, bool retain, bool onlyDifferent) {
+  return queueTopic(topic, &data, retain, onlyDifferent);
 }
 
 void MqttHandler::publishEmptyTopic(const string& topic) {
+  queueTopic(topic, nullptr, false);
+}
+
+bool MqttHandler::queueTopic(const string& topic, const string* data, bool retain, bool onlyDifferent) {
+  if (m_connection != this) {
+    return m_connection->queueTopic(topic, data, retain, onlyDifferent);
+  }
+  m_queueMutex.lock();
+  auto it = m_pendingTopics.find(topic);
+  if (onlyDifferent && it == m_pendingTopics.end()) {
+    // a still pending update has to be replaced anyway as it is older than the data acknowledged before
+    auto hashIt = m_publishedHashes.find(topic);
+    if (hashIt != m_publishedHashes.end() && hashIt->second == std::hash<string>()(*data)) {
+      m_queueMutex.unlock();
+      return false;
+    }
+  }
+  if (it != m_pendingTopics.end()) {
+    m_coalescedCount++;
+  } else {
+    while (m_pendingTopics.size() >= g_queueSize && !m_pendingOrder.empty()) {
+      // drop the oldest update as it is the most likely one to be outdated already
+      m_pendingTopics.erase(m_pendingOrder.front());
+      m_pendingOrder.pop_front();
+      m_droppedCount++;
+    }
+    it = m_pendingTopics.emplace(topic, PendingTopic()).first;
+    m_pendingOrder.push_back(topic);
+  }
+  it->second.empty = data == nullptr;
+  it->second.data = data ? *data : "";
+  it->second.retain = retain;
+  m_queueMutex.unlock();
+  return true;
+}
+
+bool MqttHandler::sendTopic(const string& topic, const string* data, bool retain) {
   const char* topicStr = topic.c_str();
-  logOtherDebug("mqtt", "publish empty %s", topicStr);
-  check(mosquitto_publish(m_mosquitto, nullptr, topicStr, 0, nullptr, 0, g_retain), "publish empty");
+  bool ret;
+#if (LIBMOSQUITTO_MAJOR >= 1)
+  m_sendingTopic.topic = topic;
+  m_sendingTopic.hash = data ? std::hash<string>()(*data) : 0;
+  m_sendingTopic.empty = data == nullptr;
+  m_sendingAcked = false;
+  int* mid = &m_sendingMid;
+#else
+  uint16_t* mid = nullptr;
+#endif
+  if (data) {
+    const char* dataStr = data->c_str();
+    const size_t len = strlen(dataStr);
+    logOtherDebug("mqtt", "publish %s %s", topicStr, dataStr);
+    ret = check(mosquitto_publish(m_mosquitto, mid, topicStr, (uint32_t)len,
+        reinterpret_cast<const uint8_t*>(dataStr), 0, g_retain || retain), "publish");
+  } else {
+    logOtherDebug("mqtt", "publish empty %s", topicStr);
+    ret = check(mosquitto_publish(m_mosquitto, mid, topicStr, 0, nullptr, 0, g_retain), "publish empty");
+  }
+  if (ret) {
+    m_publishedCount++;
+#if (LIBMOSQUITTO_MAJOR >= 1)
+    m_inflight++;
+    if (!m_sendingAcked) {
+      m_sentTopics[m_sendingMid] = m_sendingTopic;
+    }
+#endif
+  }
+#if (LIBMOSQUITTO_MAJOR >= 1)
+  m_sendingMid = -1;
+#endif
+  return ret;
 }
 
 }  // namespace ebusd
@@ -24,6 +24,8 @@
 #include <string>
 #include <list>
 #include <vector>
+#include <deque>
+#include <unordered_map>
 #include "ebusd/datahandler.h"
 #include "ebusd/bushandler.h"
 #include "lib/ebus/message.h"
@@ -37,6 +39,8 @@ namespace ebusd {
 using std::map;
 using std::string;
 using std::vector;
+using std::deque;
+using std::unordered_map;
 
 /**
  * Helper function for getting the argp definition for MQTT.
@@ -55,6 +59,14 @@ const struct argp_child* mqtthandler_getargs();
 bool mqtthandler_register(UserInfo* userInfo, BusHandler* busHandler, MessageMap* messages,
     list<DataHandler*>* handlers);
 
+/** the field kind of a part in the topic template (following the constant string of that part). */
+enum TopicPart {
+  tp_circuit,  //!< the circuit name
+  tp_name,     //!< the message name
+  tp_field,    //!< the field name
+  tp_other,    //!< any other message attribute (not usable for inbound topics)
+};
+
 /**
  * The main class supporting MQTT data handling.
  */
@@ -65,8 +77,12 @@ class MqttHandler : public DataSink, public DataSource, public WaitThread {
    * @param userInfo the @a UserInfo instance.
    * @param busHandler the @a BusHandler instance.
    * @param messages the @a MessageMap instance.
+   * @param connection the @a MqttHandler of the primary bus owning the connection to the broker, or nullptr for
+   * the primary bus itself.
+   * @param busId the ID of the additional bus (only with @p connection).
    */
-  MqttHandler(UserInfo* userInfo, BusHandler* busHandler, MessageMap* messages);
+  MqttHandler(UserInfo* userInfo, BusHandler* busHandler, MessageMap* messages, MqttHandler* connection = nullptr,
+      const string& busId = "");
 
   /**
    * Destructor.
@@ -76,6 +92,10 @@ class MqttHandler : public DataSink, public DataSource, public WaitThread {
   // @copydoc
   void start() override;
 
+  // @copydoc
+  DataHandler* createBusHandler(UserInfo* userInfo, BusHandler* busHandler, MessageMap* messages,
+      const string& busId) override;
+
   /**
    * Notify the handler of a (re-)established connection to the broker.
    */
@@ -88,6 +108,15 @@ class MqttHandler : public DataSink, public DataSource, public WaitThread {
    */
   void notifyTopic(const string& topic, const string& data);
 
+  /**
+   * Notify the handler of a finished publish.
+   * @param mid the message ID of the publish.
+   */
+  void notifyPublished(int mid);
+
+  // @copydoc
+  void notifyUpdate(Message* message) override;
+
   // @copydoc
   void notifyUpdateCheckResult(const string& checkResult) override;
 
@@ -117,30 +146,156 @@ class MqttHandler : public DataSink, public DataSource, public WaitThread {
   string getTopic(const Message* message, const string& suffix = "", const string& fieldName = "");
 
   /**
-   * Prepare a @a Message and publish as topic.
+   * Publish the signal state of the bus if it changed.
+   * @param force true to publish the signal state even if unchanged.
+   */
+  void publishSignal(bool force);
+
+  /**
+   * Get the @a MqttHandler of the additional bus responsible for a circuit.
+   * @param circuit the circuit name.
+   * @return the @a MqttHandler of the additional bus, or nullptr for the primary bus.
+   */
+  MqttHandler* getBus(const string& circuit) const;
+
+  /**
+   * Handle a received list topic.
+   * @param remain the topic string without the trailing direction.
+   * @param data the data string.
+   */
+  void notifyListTopic(const string& remain, const string& data);
+
+  /**
+   * Match a received get or set topic against the compiled topic template.
+   * @param topic the topic string.
+   * @param length the length of the topic string without the trailing direction.
+   * @param circuit the variable in which to store the circuit name.
+   * @param name the variable in which to store the message name.
+   * @return true when the topic matches the template.
+   */
+  bool matchTopic(const string& topic, size_t length, string* circuit, string* name) const;
+
+  /**
+   * Determine the @a Message for a received get or set topic using the cached route if available.
+   * @param topic the topic string.
+   * @param length the length of the topic string without the trailing direction.
+   * @param isWrite whether this is a set topic.
+   * @param circuit the variable in which to store the circuit name.
+   * @param name the variable in which to store the message name.
+   * @param message the variable in which to store the @a Message, or nullptr if not found.
+   * @return true when the topic matches the template.
+   */
+  bool routeTopic(const string& topic, size_t length, bool isWrite, string* circuit, string* name,
+      Message** message);
+
+  /**
+   * Take the updated messages noted so far, prepare them, and add them to the publish queue.
+   * @param since the time of the last preparation for checking changes against.
+   */
+  void prepareUpdates(time_t since);
+
+  /**
+   * Start the resync of all messages with data after a (re-)established connection to the broker.
+   */
+  void startResync();
+
+  /**
+   * Continue a running resync within the limit of the token bucket and publish the resync progress.
+   * @return true when the resync is still running.
+   */
+  bool continueResync();
+
+  /**
+   * Prepare a @a Message and add it to the publish queue.
    * @param message the @a Message to publish.
-   * @param updates the @a ostringstream for preparation.
+   * @param updates the @a OutputBuffer for preparation.
    * @param includeWithoutData whether to publish messages without data as well.
+   * @param changedSince the time after which a field has to be changed in order to publish its separate topic,
+   * or 0 for all fields.
+   * @param onlyDifferent whether to skip topics whose data was already acknowledged by the broker.
+   * @return the number of topic updates added to the publish queue.
    */
-  void publishMessage(const Message* message, ostringstream* updates, bool includeWithoutData = false);
+  size_t publishMessage(const Message* message, OutputBuffer* updates, bool includeWithoutData = false,
+      time_t changedSince = 0, bool onlyDifferent = false);
 
   /**
-   * Publish a topic update to MQTT.
+   * Add a topic update to the publish queue, replacing a still pending update of the same topic.
    * @param topic the topic string.
    * @param data the data string.
    * @param retain whether the topic shall be retained.
+   * @param onlyDifferent whether to skip the update if the data was already acknowledged by the broker.
+   * @return true when the update was added to the publish queue.
    */
-  void publishTopic(const string& topic, const string& data, bool retain = false);
+  bool publishTopic(const string& topic, const string& data, bool retain = false, bool onlyDifferent = false);
 
   /**
-   * Publish a topic update to MQTT without any data.
+   * Add a topic update without any data to the publish queue.
    * @param topic the topic string.
    */
   void publishEmptyTopic(const string& topic);
 
+  /**
+   * Add a topic update to the publish queue, replacing a still pending update of the same topic.
+   * When the queue is full, the oldest pending update is dropped.
+   * @param topic the topic string.
+   * @param data the data string, or nullptr for an update without data.
+   * @param retain whether the topic shall be retained.
+   * @param onlyDifferent whether to skip the update if the data was already acknowledged by the broker.
+   * @return true when the update was added to the publish queue.
+   */
+  bool queueTopic(const string& topic, const string* data, bool retain, bool onlyDifferent = false);
+
+  /**
+   * Publish the pending topic updates from the queue to MQTT within the batch and inflight limits.
+   * @return true when updates are left in the queue.
+   */
+  bool flushQueue();
+
+  /**
+   * Publish a topic update directly to MQTT.
+   * @param topic the topic string.
+   * @param data the data string, or nullptr for an update without data.
+   * @param retain whether the topic shall be retained.
+   * @return true on success.
+   */
+  bool sendTopic(const string& topic, const string* data, bool retain);
+
+  /**
+   * A topic update sent to the broker and not yet acknowledged by the library.
+   */
+  struct SentTopic {
+    string topic;  //!< the topic string
+    size_t hash;   //!< the hash of the data string
+    bool empty;    //!< whether it was published without any data
+  };
+
+  /**
+   * Remember the data of a topic update acknowledged by the library.
+   * @param sent the acknowledged @a SentTopic.
+   */
+  void acknowledgeTopic(const SentTopic& sent);
+
+  /**
+   * A pending topic update in the publish queue.
+   */
+  struct PendingTopic {
+    string data;  //!< the data string
+    bool empty;   //!< whether to publish without any data
+    bool retain;  //!< whether the topic shall be retained
+  };
+
   /** the @a MessageMap instance. */
   MessageMap* m_messages;
 
+  /** the @a MqttHandler owning the connection to the broker (this instance for the primary bus). */
+  MqttHandler* m_connection;
+
+  /** the @a MqttHandler instances of the additional buses using the connection of this instance. */
+  vector<MqttHandler*> m_buses;
+
+  /** the @a Mutex for @a m_buses. */
+  mutable Mutex m_busesMutex;
+
   /** the global topic prefix. */
   string m_globalTopic;
 
@@ -150,12 +305,24 @@ class MqttHandler : public DataSink, public DataSource, public WaitThread {
   /** whether to publish a separate topic for each message field. */
   bool m_publishByField;
 
+  /** the compiled topic template with the @a TopicPart following each constant string but the first. */
+  vector<TopicPart> m_topicParts;
+
+  /** the cached non-conditional @a Message by received get or set topic. */
+  unordered_map<string, Message*> m_topicRoutes;
+
+  /** the @a MessageMap generation for which @a m_topicRoutes is valid. */
+  size_t m_topicRoutesGeneration;
+
   /** the mosquitto structure if initialized, or nullptr. */
   struct mosquitto* m_mosquitto;
 
   /** whether the connection to the broker is established. */
   bool m_connected;
 
+  /** whether the bus had a signal when last published. */
+  bool m_signal;
+
   /** whether the initial connect failed. */
   bool m_initialConnectFailed;
 
@@ -167,6 +334,69 @@ class MqttHandler : public DataSink, public DataSource, public WaitThread {
 
   /** the last system time when a communication error was logged. */
   time_t m_lastErrorLogTime;
+
+  /** the @a Mutex for accessing @a m_updatedMessages. */
+  Mutex m_updateMutex;
+
+  /** the @a Mutex for accessing the publish queue. */
+  Mutex m_queueMutex;
+
+  /** the pending topic updates by topic. */
+  map<string, PendingTopic> m_pendingTopics;
+
+  /** the topics in @a m_pendingTopics in the order to publish. */
+  deque<string> m_pendingOrder;
+
+  /** the number of published topic updates not yet acknowledged by the library. */
+  size_t m_inflight;
+
+  /** the number of topic updates published in total. */
+  size_t m_publishedCount;
+
+  /** the number of pending topic updates replaced by a newer one of the same topic. */
+  size_t m_coalescedCount;
+
+  /** the number of pending topic updates dropped due to a full queue. */
+  size_t m_droppedCount;
+
+  /** the number of times publishing was deferred due to the batch or inflight limit. */
+  size_t m_deferredCount;
+
+  /** the value of @a m_droppedCount at the time of last logging it. */
+  size_t m_loggedDroppedCount;
+
+  /** the topic updates sent to the broker and not yet acknowledged by message ID. */
+  unordered_map<int, SentTopic> m_sentTopics;
+
+  /** the topic update currently being sent (as the library might acknowledge it before returning the ID). */
+  SentTopic m_sendingTopic;
+
+  /** the message ID of the topic update currently being sent, or -1. */
+  int m_sendingMid;
+
+  /** whether the topic update currently being sent was already acknowledged. */
+  bool m_sendingAcked;
+
+  /** the hash of the data string of each topic acknowledged by the library since the last connect. */
+  unordered_map<string, size_t> m_publishedHashes;
+
+  /** the keys of the messages still to resync. */
+  deque<uint64_t> m_resyncKeys;
+
+  /** the total number of messages in the running resync, or 0. */
+  size_t m_resyncTotal;
+
+  /** the number of topic updates republished in the running resync. */
+  size_t m_resyncPublished;
+
+  /** the available tokens of the resync token bucket. */
+  double m_resyncTokens;
+
+  /** the monotonic time of the last resync token bucket refill. */
+  struct timespec m_resyncRefillTime;
+
+  /** the last published resync progress. */
+  string m_lastResyncStatus;
 };
 
 }  // namespace ebusd
@@ -21,20 +21,86 @@
 #endif
 
 #include "ebusd/network.h"
-#ifdef HAVE_PPOLL
-#  include <poll.h>
+#include <errno.h>
+#include <poll.h>
+#ifdef HAVE_SYS_EPOLL_H
+#  include <sys/epoll.h>
 #endif
+#include <cstdlib>
 #include <cstring>
+#include <vector>
+#ifdef HAVE_ZLIB
+#  include <zlib.h>
+#endif
+#include "ebusd/binaryprotocol.h"
 #include "lib/utils/log.h"
 
 namespace ebusd {
 
+using std::hex;
+using std::dec;
+
 int Connection::m_ids = 0;
 
 #ifndef POLLRDHUP
 #define POLLRDHUP 0
 #endif
 
+/** the interval in seconds for collecting updates of connections in one of the listening modes. */
+#define LISTEN_INTERVAL 2
+
+/** the time in seconds after which an idle persistent HTTP connection is closed. */
+#define HTTP_KEEP_ALIVE_TIMEOUT 30
+
+/** the maximum number of events to handle per epoll_wait() call. */
+#define MAX_EPOLL_EVENTS 32
+
+#ifdef HAVE_ZLIB
+/**
+ * Choose the content encoding from the value of the Accept-Encoding header.
+ * @param value the lower case header value, e.g. "gzip;q=0.5, deflate".
+ * @return the preferred acceptable @a HttpEncoding (gzip on equal weight).
+ */
+static HttpEncoding parseAcceptEncoding(const string& value) {
+  float gzip = -1, deflate = -1, any = -1;
+  for (size_t start = 0; start < value.length(); ) {
+    size_t end = value.find(',', start);
+    if (end == string::npos) {
+      end = value.length();
+    }
+    string coding = value.substr(start, end-start);
+    start = end+1;
+    float quality = 1;
+    size_t pos = coding.find(';');
+    if (pos != string::npos) {
+      size_t qpos = coding.find("q=", pos);
+      if (qpos != string::npos) {
+        quality = strtof(coding.c_str()+qpos+2, nullptr);
+      }
+      coding.resize(pos);
+    }
+    coding.erase(remove(coding.begin(), coding.end(), ' '), coding.end());
+    if (coding == "gzip") {
+      gzip = quality;
+    } else if (coding == "deflate") {
+      deflate = quality;
+    } else if (coding == "*") {
+      any = quality;
+    }
+  }
+  if (gzip < 0) {
+    gzip = any;
+  }
+  if (deflate < 0) {
+    deflate = any;
+  }
+  if (gzip > 0 && gzip >= deflate) {
+    return he_gzip;
+  }
+  return deflate > 0 ? he_deflate : he_identity;
+}
+#endif
+
 bool NetMessage::add(const char* request) {
   if (request && request[0]) {
     string add = request;
@@ -44,10 +110,44 @@ bool NetMessage::add(const char* request) {
   size_t pos = m_request.find(m_isHttp ? "\n\n" : "\n");
   if (pos != string::npos) {
     if (m_isHttp) {
+      size_t end = pos;
       pos = m_request.find("\n");
+      m_httpHeaders.encoding = he_identity;
+      m_httpHeaders.ifNoneMatch.clear();
+      int connectionHeader = -1;
+      for (size_t lineStart = pos+1; lineStart < end; ) {
+        size_t lineEnd = m_request.find('\n', lineStart);
+        size_t colon = m_request.find(':', lineStart);
+        if (colon < lineEnd) {
+          string name = m_request.substr(lineStart, colon-lineStart);
+          transform(name.begin(), name.end(), name.begin(), ::tolower);
+          size_t valueStart = m_request.find_first_not_of(' ', colon+1);
+          string value = valueStart < lineEnd ? m_request.substr(valueStart, lineEnd-valueStart) : "";
+          if (name == "if-none-match") {
+            m_httpHeaders.ifNoneMatch = value;
+          } else {
+            transform(value.begin(), value.end(), value.begin(), ::tolower);
+            if (name == "connection") {
+              if (value.find("close") != string::npos) {
+                connectionHeader = 0;
+              } else if (value.find("keep-alive") != string::npos) {
+                connectionHeader = 1;
+              }
+#ifdef HAVE_ZLIB
+            } else if (name == "accept-encoding") {
+              m_httpHeaders.encoding = parseAcceptEncoding(value);
+#endif
+            }
+          }
+        }
+        lineStart = lineEnd+1;
+      }
       m_request.resize(pos);  // reduce to first line
       // typical first line: GET /ehp/outsidetemp HTTP/1.1
       pos = m_request.rfind(" HTTP/");
+      m_httpHeaders.http11 = pos != string::npos && m_request.compare(pos, 9, " HTTP/1.0") != 0
+        && m_request.compare(pos, 9, " HTTP/0.9") != 0;
+      m_httpHeaders.keepAlive = connectionHeader < 0 ? m_httpHeaders.http11 : connectionHeader == 1;
       if (pos != string::npos) {
         m_request.resize(pos);  // remove "HTTP/x.x" suffix
       }
@@ -68,129 +168,229 @@ bool NetMessage::add(const char* request) {
   return m_request.length() == 0 && isListeningMode();
 }
 
+bool NetMessage::add(const char* request, size_t length) {
+  if (!m_received && length > 0) {
+    m_received = true;
+    m_binary = !m_isHttp && static_cast<uint8_t>(request[0]) == BINARY_MAGIC;
+  }
+  if (!m_binary) {
+    return add(request);
+  }
+  m_partial.append(request, length);
+  size_t pos = 0;
+  while (pos < m_partial.length()) {
+    size_t size = getBinaryFrameSize(m_partial, pos);
+    if (size == 0) {
+      break;
+    }
+    if (size == string::npos) {
+      pos = m_partial.length();  // out of sync: pass on as invalid frame
+      break;
+    }
+    pos += size;
+  }
+  if (pos > 0) {
+    m_request.append(m_partial, 0, pos);
+    m_partial.erase(0, pos);
+  }
+  return m_request.length() > 0 || isListeningMode();
+}
 
-void Connection::run() {
-  int ret;
-  struct timespec tdiff;
-
-  // set timeout
-  tdiff.tv_sec = 2;
-  tdiff.tv_nsec = 0;
-  int notifyFD = m_notify.notifyFD();
-  int sockFD = m_socket->getFD();
-
-#ifdef HAVE_PPOLL
-  nfds_t nfds = 2;
-  struct pollfd fds[nfds];
-
-  memset(fds, 0, sizeof(fds));
-
-  fds[0].fd = notifyFD;
-  fds[0].events = POLLIN | POLLERR | POLLHUP | POLLRDHUP;
-
-  fds[1].fd = sockFD;
-  fds[1].events = POLLIN | POLLERR | POLLHUP | POLLRDHUP;
-#else
-#ifdef HAVE_PSELECT
-  int maxfd = (notifyFD > sockFD) ? notifyFD : sockFD;
-  fd_set checkfds, exceptfds;
-
-  FD_ZERO(&checkfds);
-  FD_SET(notifyFD, &checkfds);
-  FD_SET(sockFD, &checkfds);
 
-  FD_ZERO(&exceptfds);
-  FD_SET(notifyFD, &exceptfds);
-  FD_SET(sockFD, &exceptfds);
+HttpBodyWriter::HttpBodyWriter(NetMessage* message, const string& header, HttpEncoding encoding)
+  : m_message(message), m_header(header), m_stream(nullptr) {
+#ifdef HAVE_ZLIB
+  if (encoding != he_identity) {
+    m_stream = new z_stream;
+    memset(m_stream, 0, sizeof(z_stream));
+    if (deflateInit2(m_stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, encoding == he_gzip ? 15+16 : 15, 8,
+        Z_DEFAULT_STRATEGY) != Z_OK) {
+      delete m_stream;
+      m_stream = nullptr;
+    }
+  }
 #endif
+}
+
+HttpBodyWriter::~HttpBodyWriter() {
+#ifdef HAVE_ZLIB
+  if (m_stream) {
+    deflateEnd(m_stream);
+    delete m_stream;
+  }
 #endif
+}
 
-  bool closed = false;
-  NetMessage message(m_isHttp);
+#ifdef HAVE_ZLIB
+/**
+ * Deflate the input data to the output.
+ * @param stream the initialized zlib stream.
+ * @param data the input data.
+ * @param len the length of the input data.
+ * @param flush the zlib flush mode.
+ * @param output the @a string to append the compressed data to.
+ */
+static void deflateTo(z_stream* stream, const char* data, size_t len, int flush, string* output) {
+  char buf[4096];
+  stream->next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+  stream->avail_in = static_cast<uInt>(len);
+  do {
+    stream->next_out = reinterpret_cast<Bytef*>(buf);
+    stream->avail_out = sizeof(buf);
+    if (deflate(stream, flush) == Z_STREAM_ERROR) {
+      break;
+    }
+    output->append(buf, sizeof(buf)-stream->avail_out);
+  } while (stream->avail_out == 0);
+}
+#endif
 
-  while (!closed) {
-#ifdef HAVE_PPOLL
-    // wait for new fd event
-    ret = ppoll(fds, nfds, &tdiff, nullptr);
+void HttpBodyWriter::write(ostringstream* ostream, bool final) {
+  string data = ostream->str();
+  string chunk;
+#ifdef HAVE_ZLIB
+  if (m_stream) {
+    deflateTo(m_stream, data.data(), data.length(), final ? Z_FINISH : Z_SYNC_FLUSH, &chunk);
+  } else {
+    chunk.swap(data);
+  }
 #else
-#ifdef HAVE_PSELECT
-    // set readfds to inital checkfds
-    fd_set readfds = checkfds;
-    // wait for new fd event
-    ret = pselect(maxfd + 1, &readfds, nullptr, &exceptfds, &tdiff, nullptr);
-#endif
+  chunk.swap(data);
 #endif
-    bool newData = false;
-    if (ret != 0) {
-#ifdef HAVE_PPOLL
-      // new data from notify
-      if (ret < 0 || (fds[0].revents & (POLLIN | POLLERR | POLLHUP | POLLRDHUP))
-          || (fds[1].revents & (POLLERR | POLLHUP))) {
-        break;
-      }
-      // new data from socket
-      newData = fds[1].revents & POLLIN;
-      closed = fds[1].revents & POLLRDHUP;
+  ostream->str("");
+  ostream->clear();
+  *ostream << m_header;
+  m_header.clear();
+  if (!chunk.empty()) {
+    *ostream << hex << chunk.length() << dec << "\r\n";
+    ostream->write(chunk.data(), static_cast<std::streamsize>(chunk.length()));
+    *ostream << "\r\n";
+  }
+  if (final) {
+    *ostream << "0\r\n\r\n";
+    return;
+  }
+  m_message->addResult(ostream->str());
+  ostream->str("");
+}
+
+bool HttpBodyWriter::compress(HttpEncoding encoding, const string& data, string* output) {
+#ifdef HAVE_ZLIB
+  if (encoding == he_identity) {
+    return false;
+  }
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, encoding == he_gzip ? 15+16 : 15, 8,
+      Z_DEFAULT_STRATEGY) != Z_OK) {
+    return false;
+  }
+  deflateTo(&stream, data.data(), data.length(), Z_FINISH, output);
+  deflateEnd(&stream);
+  return true;
 #else
-#ifdef HAVE_PSELECT
-      // new data from notify
-      if (ret < 0 || FD_ISSET(notifyFD, &readfds) || FD_ISSET(notifyFD, &exceptfds)) {
-        break;
-      }
-      // new data from socket
-      newData = FD_ISSET(sockFD, &readfds);
-      closed = FD_ISSET(sockFD, &exceptfds);
+  return false;
 #endif
-#endif
-    }
-
-    if (newData || message.isListeningMode()) {
-      char data[256];
+}
 
-      if (!m_socket->isValid()) {
-        break;
-      }
-      if (newData) {
-        ssize_t datalen = m_socket->recv(data, sizeof(data)-1);
 
-        // remove closed socket
-        if (datalen <= 0) {
-          break;
-        }
-        data[datalen] = '\0';
-      } else {
-        data[0] = '\0';
-      }
+bool Connection::handleInput() {
+  time(&m_lastActive);
+  char data[256];
+  ssize_t datalen = m_socket->recv(data, sizeof(data)-1);
+  if (datalen < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+    return true;
+  }
+  // remove closed socket
+  if (datalen <= 0) {
+    return false;
+  }
+  data[datalen] = '\0';
+
+  // decode client data
+  if (m_message.add(data, static_cast<size_t>(datalen))) {
+    m_pending = true;
+    if (!m_netQueue->tryPush(&m_message)) {
+      // shed the load instead of blocking the network thread
+      m_pending = false;
+      logError(lf_network, "[%05d] request queue full, closing connection", getID());
+      return false;
+    }
+    logDebug(lf_network, "[%05d] wait for result", getID());
+  }
+  return true;
+}
 
-      // decode client data
-      if (message.add(data)) {
-        m_netQueue->push(&message);
+void Connection::requestUpdate() {
+  if (m_pending || m_closing || m_closed || m_outputPos < m_output.size()) {
+    return;
+  }
+  if (m_message.add(nullptr) && m_netQueue->tryPush(&m_message)) {
+    m_pending = true;  // otherwise retried with the next update
+  }
+}
 
-        // wait for result
-        logDebug(lf_network, "[%05d] wait for result", getID());
-        string result;
-        message.getResult(&result);
+bool Connection::shutdownInput() {
+  m_closing = true;
+  return m_pending || m_outputPos < m_output.size();
+}
 
-        if (!m_socket->isValid()) {
-          break;
-        }
-        m_socket->send(result.c_str(), result.size());
-      }
+bool Connection::handleResult() {
+  if (!m_pending) {
+    return !m_closed;  // already taken with a previous notification
+  }
+  string result;
+  if (m_message.fetchResult(&result)) {
+    m_pending = false;
+    if (m_message.isDisconnect()) {
+      m_closing = true;
+    }
+  }
+  if (m_closed) {
+    return false;
+  }
+  if (m_output.empty()) {
+    m_output.swap(result);
+  } else {
+    m_output.append(result);
+  }
+  return handleOutput();
+}
 
-      if (message.isDisconnect() || !m_socket->isValid()) {
-        break;
+bool Connection::handleOutput() {
+  time(&m_lastActive);
+  while (m_outputPos < m_output.size()) {
+    ssize_t sent = m_socket->send(m_output.data()+m_outputPos, m_output.size()-m_outputPos);
+    if (sent < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+        return true;  // continue as soon as the socket is writable again
       }
+      return false;
     }
+    m_outputPos += static_cast<size_t>(sent);
   }
+  m_output.clear();
+  m_outputPos = 0;
+  return !m_closing;
+}
 
-  delete m_socket;
-  m_socket = nullptr;
-  logInfo(lf_network, "[%05d] connection closed", getID());
+int Connection::getWantedEvents() const {
+  if (m_closed) {
+    return 0;
+  }
+  if (m_outputPos < m_output.size()) {
+    return POLLOUT;
+  }
+  return m_pending || m_closing ? 0 : POLLIN;
 }
 
+void Connection::notifyResult(NetMessage* message) {
+  m_network->notifyResult(this);
+}
 
-Network::Network(const bool local, const uint16_t port, const uint16_t httpPort, Queue<NetMessage*>* netQueue)
-  : Thread(), m_netQueue(netQueue), m_listening(false) {
+
+Network::Network(const bool local, const uint16_t port, const uint16_t httpPort, NetMessageQueue* netQueue)
+  : Thread(), m_netQueue(netQueue), m_updated(false), m_epollFD(-1), m_listening(false) {
   m_tcpServer = new TCPServer(port, local ? "127.0.0.1" : "0.0.0.0");
 
   if (m_tcpServer != nullptr && m_tcpServer->start() == 0) {
@@ -202,10 +402,31 @@ Network::Network(const bool local, const uint16_t port, const uint16_t httpPort,
   } else {
     m_httpServer = nullptr;
   }
+#ifdef HAVE_SYS_EPOLL_H
+  m_epollFD = epoll_create1(EPOLL_CLOEXEC);
+  if (m_epollFD >= 0) {
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = &m_notify;
+    epoll_ctl(m_epollFD, EPOLL_CTL_ADD, m_notify.notifyFD(), &event);
+    event.data.ptr = &m_wakeup;
+    epoll_ctl(m_epollFD, EPOLL_CTL_ADD, m_wakeup.notifyFD(), &event);
+    event.data.ptr = &m_results;
+    epoll_ctl(m_epollFD, EPOLL_CTL_ADD, m_results.getWakeupFD(), &event);
+    event.data.ptr = m_tcpServer;
+    epoll_ctl(m_epollFD, EPOLL_CTL_ADD, m_tcpServer->getFD(), &event);
+    if (m_httpServer) {
+      event.data.ptr = m_httpServer;
+      epoll_ctl(m_epollFD, EPOLL_CTL_ADD, m_httpServer->getFD(), &event);
+    }
+  }
+#endif
 }
 
 Network::~Network() {
   stop();
+  join();
   NetMessage* netMsg;
   while ((netMsg = m_netQueue->pop()) != nullptr) {
     netMsg->setResult("ERR: shutdown", "", nullptr, 0, true);
@@ -213,128 +434,239 @@ Network::~Network() {
   while (!m_connections.empty()) {
     Connection* connection = m_connections.back();
     m_connections.pop_back();
-    connection->stop();
-    connection->join();
     delete connection;
   }
-
+  if (m_epollFD >= 0) {
+    close(m_epollFD);
+  }
   if (m_tcpServer != nullptr) {
     delete m_tcpServer;
   }
   if (m_httpServer != nullptr) {
     delete m_httpServer;
   }
-  join();
+}
+
+void Network::notifyUpdate() {
+  m_updated.store(true);
+  m_wakeup.notify();
+}
+
+void Network::notifyResult(Connection* connection) {
+  m_results.push(connection);
 }
 
 void Network::run() {
   if (!m_listening) {
     return;
   }
-  int ret;
-  struct timespec tdiff;
-
-  // set timeout
-  tdiff.tv_sec = 1;
-  tdiff.tv_nsec = 0;
-#ifdef HAVE_PPOLL
-  int socketCount = m_httpServer ? 2 : 1;
-  nfds_t nfds = 1+socketCount;
-  struct pollfd fds[nfds];
-
-  memset(fds, 0, sizeof(fds));
-
-  fds[0].fd = m_notify.notifyFD();
-  fds[0].events = POLLIN;
-
-  fds[1].fd = m_tcpServer->getFD();
-  fds[1].events = POLLIN;
-
-  if (m_httpServer) {
-    fds[2].fd = m_httpServer->getFD();
-    fds[2].events = POLLIN;
-  }
-#else
-#ifdef HAVE_PSELECT
-  int maxfd;
-  fd_set checkfds;
-
-  FD_ZERO(&checkfds);
-  FD_SET(m_notify.notifyFD(), &checkfds);
-  FD_SET(m_tcpServer->getFD(), &checkfds);
-  if (m_httpServer) {
-    FD_SET(m_httpServer->getFD(), &checkfds);
-  }
-
-  maxfd = (m_notify.notifyFD() > m_tcpServer->getFD()) ?
-    m_notify.notifyFD() : m_tcpServer->getFD();
-  if (m_httpServer && m_httpServer->getFD() > maxfd) {
-    maxfd = m_httpServer->getFD();
-  }
-#endif
+  time_t now, lastListen;
+  time(&lastListen);
+  int timeout = 1000;
+#ifdef HAVE_SYS_EPOLL_H
+  struct epoll_event events[MAX_EPOLL_EVENTS];
 #endif
+  vector<struct pollfd> fds;
+  vector<Connection*> fdConnections;
   while (true) {
-#ifdef HAVE_PPOLL
-    // wait for new fd event
-    ret = ppoll(fds, nfds, &tdiff, nullptr);
-#else
-#ifdef HAVE_PSELECT
-    // set readfds to inital checkfds
-    fd_set readfds = checkfds;
-    // wait for new fd event
-    ret = pselect(maxfd + 1, &readfds, nullptr, nullptr, &tdiff, nullptr);
-#endif
+    bool stopped = false, newData = false, newHttpData = false, wakeup = false, results = false;
+#ifdef HAVE_SYS_EPOLL_H
+    if (m_epollFD >= 0) {
+      int count = epoll_wait(m_epollFD, events, MAX_EPOLL_EVENTS, timeout);
+      for (int i = 0; i < count; i++) {
+        void* ptr = events[i].data.ptr;
+        if (ptr == &m_notify) {
+          stopped = true;
+        } else if (ptr == &m_wakeup) {
+          wakeup = true;
+        } else if (ptr == &m_results) {
+          results = true;
+        } else if (ptr == m_tcpServer) {
+          newData = true;
+        } else if (ptr == m_httpServer) {
+          newHttpData = true;
+        } else {
+          int revents = ((events[i].events & EPOLLIN) ? POLLIN : 0) | ((events[i].events & EPOLLOUT) ? POLLOUT : 0)
+            | ((events[i].events & EPOLLRDHUP) ? POLLRDHUP : 0)
+            | ((events[i].events & (EPOLLERR | EPOLLHUP)) ? POLLHUP : 0);
+          handleEvents(static_cast<Connection*>(ptr), revents);
+        }
+      }
+    } else {
 #endif
-    if (ret == 0) {
-      cleanConnections();
-      continue;
+      // rebuild the list of file descriptors to watch
+      fds.clear();
+      fdConnections.clear();
+      struct pollfd fd;
+      memset(&fd, 0, sizeof(fd));
+      fd.events = POLLIN;
+      fd.fd = m_notify.notifyFD();
+      fds.push_back(fd);
+      fd.fd = m_wakeup.notifyFD();
+      fds.push_back(fd);
+      fd.fd = m_tcpServer->getFD();
+      fds.push_back(fd);
+      fd.fd = m_httpServer ? m_httpServer->getFD() : -1;  // negative fd is ignored by poll()
+      fds.push_back(fd);
+      fd.fd = m_results.getWakeupFD();
+      fds.push_back(fd);
+      fdConnections.resize(fds.size(), nullptr);
+      for (const auto connection : m_connections) {
+        if (connection->getEvents()) {
+          fd.fd = connection->getFD();
+          int events = connection->getEvents();
+          fd.events = static_cast<int16_t>(events | ((events & POLLIN) ? POLLRDHUP : 0));
+          fds.push_back(fd);
+          fdConnections.push_back(connection);
+        }
+      }
+      int count = poll(fds.data(), static_cast<nfds_t>(fds.size()), timeout);
+      if (count > 0) {
+        stopped = fds[0].revents != 0;
+        wakeup = fds[1].revents != 0;
+        newData = fds[2].revents != 0;
+        newHttpData = fds[3].revents != 0;
+        results = fds[4].revents != 0;
+        for (size_t i = 5; i < fds.size(); i++) {
+          if (fds[i].revents) {
+            handleEvents(fdConnections[i], fds[i].revents & (POLLIN | POLLOUT | POLLERR | POLLHUP | POLLRDHUP));
+          }
+        }
+      }
+#ifdef HAVE_SYS_EPOLL_H
     }
-    bool newData = false, isHttp = false;
-#ifdef HAVE_PPOLL
-    // new data from notify
-    if (fds[0].revents & POLLIN) {
+#endif
+    if (stopped) {
       return;
     }
-    // new data from socket
-    if (fds[1].revents & POLLIN) {
-      newData = true;
-    } else if (m_httpServer && fds[2].revents & POLLIN) {
-      newData = isHttp = true;
+    if (wakeup) {
+      m_wakeup.consume();
     }
-#else
-#ifdef HAVE_PSELECT
-    // new data from notify
-    if (FD_ISSET(m_notify.notifyFD(), &readfds)) {
-      return;
+    if (results) {
+      m_results.consumeWakeup();
     }
-    // new data from socket
-    if (FD_ISSET(m_tcpServer->getFD(), &readfds)) {
-      newData = true;
-    } else if (m_httpServer && FD_ISSET(m_httpServer->getFD(), &readfds)) {
-      newData = isHttp = true;
+    time(&now);
+    bool tick = now < lastListen || now >= lastListen + LISTEN_INTERVAL;
+    if (tick) {
+      lastListen = now;
+      m_updated.store(true);  // also collect updates not covered by notifications, e.g. of unknown messages
     }
-#endif
-#endif
+    handleResults();
+    // closed connections are removed only after all pending result notifications were taken from the queue
+    cleanConnections(tick ? now - HTTP_KEEP_ALIVE_TIMEOUT : 0);
     if (newData) {
-      TCPSocket* socket = (isHttp ? m_httpServer : m_tcpServer)->newSocket();
-      if (socket == nullptr) {
-        continue;
-      }
-      Connection* connection = new Connection(socket, isHttp, m_netQueue);
-      connection->start("connection");
-      m_connections.push_back(connection);
-      string ip = socket->getIP();
-      logInfo(lf_network, "[%05d] %s connection opened %s", connection->getID(), isHttp ? "HTTP" : "client",
-          ip.c_str());
+      acceptConnection(false);
+    }
+    if (newHttpData) {
+      acceptConnection(true);
     }
   }
 }
 
-void Network::cleanConnections() {
+void Network::acceptConnection(bool isHttp) {
+  TCPSocket* socket = (isHttp ? m_httpServer : m_tcpServer)->newSocket();
+  if (socket == nullptr) {
+    return;
+  }
+  if (m_connections.size() >= MAX_CONNECTIONS) {
+    logNotice(lf_network, "too many connections, rejecting %s", socket->getIP().c_str());
+    delete socket;
+    return;
+  }
+  socket->setNonBlocking();
+  Connection* connection = new Connection(socket, isHttp, m_netQueue, this);
+  m_connections.push_back(connection);
+  string ip = socket->getIP();
+  logInfo(lf_network, "[%05d] %s connection opened %s", connection->getID(), isHttp ? "HTTP" : "client",
+      ip.c_str());
+  int events = connection->getWantedEvents();
+#ifdef HAVE_SYS_EPOLL_H
+  if (m_epollFD >= 0) {
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN | EPOLLRDHUP;
+    event.data.ptr = connection;
+    epoll_ctl(m_epollFD, EPOLL_CTL_ADD, connection->getFD(), &event);
+  }
+#endif
+  connection->setEvents(events);
+}
+
+void Network::handleEvents(Connection* connection, int events) {
+  if (connection->isClosed()) {
+    return;
+  }
+  bool close = false;
+  if (events & POLLOUT) {
+    close = !connection->handleOutput();
+  }
+  if (!close && (events & POLLIN)) {
+    close = !connection->handleInput();
+  }
+  if (!close && (events & POLLRDHUP)) {
+    close = !connection->shutdownInput();
+  }
+  if (!close && (events & (POLLERR | POLLHUP))) {
+    close = true;
+  }
+  updateConnection(connection, close);
+}
+
+void Network::handleResults() {
+  Connection* connection;
+  while ((connection = m_results.pop()) != nullptr) {
+    if (connection->isClosed()) {
+      connection->handleResult();  // only consume the result
+      continue;
+    }
+    updateConnection(connection, !connection->handleResult());
+  }
+  if (!m_updated.exchange(false)) {
+    return;
+  }
+  for (const auto connection : m_connections) {
+    if (!connection->isClosed() && connection->isListening()) {
+      connection->requestUpdate();
+      updateConnection(connection, false);
+    }
+  }
+}
+
+void Network::updateConnection(Connection* connection, bool close) {
+  if (connection->isClosed()) {
+    return;
+  }
+  int events = close ? 0 : connection->getWantedEvents();
+#ifdef HAVE_SYS_EPOLL_H
+  if (m_epollFD >= 0 && (close || events != connection->getEvents())) {
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = ((events & POLLIN) ? EPOLLIN | EPOLLRDHUP : 0u) | ((events & POLLOUT) ? EPOLLOUT : 0u);
+    event.data.ptr = connection;
+    if (close) {
+      epoll_ctl(m_epollFD, EPOLL_CTL_DEL, connection->getFD(), &event);
+    } else {
+      epoll_ctl(m_epollFD, EPOLL_CTL_MOD, connection->getFD(), &event);
+    }
+  }
+#endif
+  connection->setEvents(events);
+  if (!close) {
+    return;
+  }
+  connection->setClosed();
+  logInfo(lf_network, "[%05d] connection closed", connection->getID());
+}
+
+void Network::cleanConnections(time_t idleSince) {
   auto it = m_connections.begin();
   while (it != m_connections.end()) {
-    if (!(*it)->isRunning()) {
-      Connection* connection = *it;
+    Connection* connection = *it;
+    if (idleSince > 0 && connection->isIdle(idleSince)) {
+      logDebug(lf_network, "[%05d] idle connection timed out", connection->getID());
+      updateConnection(connection, true);
+    }
+    if (connection->isClosed() && !connection->isPending()) {
       it = m_connections.erase(it);
       delete connection;
       logDebug(lf_network, "dead connection removed - %d", m_connections.size());
@@ -22,13 +22,18 @@
 #include <string>
 #include <cstdio>
 #include <algorithm>
+#include <atomic>
 #include <list>
+#include <map>
 #include "lib/ebus/datatype.h"
 #include "lib/utils/tcpsocket.h"
 #include "lib/utils/queue.h"
 #include "lib/utils/notify.h"
 #include "lib/utils/thread.h"
 
+/** Forward declaration for the zlib stream. */
+struct z_stream_s;
+
 namespace ebusd {
 
 /** \file ebusd/network.h
@@ -53,6 +58,44 @@ struct ClientSettings {
   OutputFormat format;     //!< the output format settings for listen mode
   bool listenWithUnknown;  //!< include unknown messages in listen mode
   bool listenOnlyUnknown;  //!< only print unknown messages in listen mode
+  string busId;            //!< the ID of the additional bus the mode was entered for, or empty
+};
+
+/** the possible HTTP content encodings. */
+enum HttpEncoding {
+  he_identity,  //!< no compression
+  he_gzip,      //!< gzip compression
+  he_deflate,   //!< deflate (zlib) compression
+};
+
+/**
+ * Combination of HTTP request header details.
+ */
+struct HttpHeaders {
+  bool http11;            //!< whether the request was sent with HTTP/1.1 or later
+  bool keepAlive;         //!< whether the connection shall be kept open after the response
+  HttpEncoding encoding;  //!< the preferred content encoding accepted by the client
+  string ifNoneMatch;     //!< the value of the If-None-Match header, or empty
+};
+
+/** Forward declaration for @a NetMessage. */
+class NetMessage;
+
+/**
+ * Interface for getting notified about the result of a @a NetMessage being set.
+ */
+class NetMessageListener {
+ public:
+  /**
+   * Destructor.
+   */
+  virtual ~NetMessageListener() {}
+
+  /**
+   * Called from the handling thread after the result of the @a NetMessage was set.
+   * @param message the @a NetMessage with the result set.
+   */
+  virtual void notifyResult(NetMessage* message) = 0;  // abstract
 };
 
 /**
@@ -63,15 +106,19 @@ class NetMessage {
   /**
    * Constructor.
    * @param isHttp whether this is a HTTP message.
+   * @param listener the @a NetMessageListener to notify when the result was set, or nullptr.
    */
-  explicit NetMessage(bool isHttp)
-    : m_isHttp(isHttp), m_resultSet(false), m_disconnect(false), m_listenSince(0) {
+  explicit NetMessage(bool isHttp, NetMessageListener* listener = nullptr)
+    : m_isHttp(isHttp), m_listener(listener), m_binary(false), m_received(false), m_resultSet(false),
+      m_disconnect(false), m_listenSince(0), m_listenCursor(0) {
+    m_httpHeaders.http11 = false;
+    m_httpHeaders.keepAlive = false;
+    m_httpHeaders.encoding = he_identity;
     m_settings.mode = cm_normal;
     m_settings.format = 0;
     m_settings.listenWithUnknown = false;
     m_settings.listenOnlyUnknown = false;
     pthread_mutex_init(&m_mutex, nullptr);
-    pthread_cond_init(&m_cond, nullptr);
   }
 
   /**
@@ -80,7 +127,6 @@ class NetMessage {
   ~NetMessage() {
     m_resultSet = true;
     pthread_mutex_destroy(&m_mutex);
-    pthread_cond_destroy(&m_cond);
   }
 
 
@@ -100,18 +146,44 @@ class NetMessage {
    */
   bool add(const char* request);
 
+  /**
+   * Add request data received from the client that might use the binary protocol.
+   * @param request the request data from the client.
+   * @param length the length of the request data.
+   * @return true when the request is complete and the response shall be prepared.
+   */
+  bool add(const char* request, size_t length);
+
   /**
    * Return whether this is a HTTP message.
    * @return whether this is a HTTP message.
    */
   bool isHttp() const { return m_isHttp; }
 
+  /**
+   * Return whether the client uses the binary protocol (see ebusd/binaryprotocol.h).
+   * @return whether the client uses the binary protocol.
+   */
+  bool isBinary() const { return m_binary; }
+
+  /**
+   * Return the subscriptions of a binary protocol client.
+   * @return the subscribed handles mapped to the requested flags.
+   */
+  std::map<uint32_t, uint8_t>* getSubscriptions() { return &m_subscriptions; }
+
   /**
    * Return the request string.
    * @return the request string.
    */
   const string& getRequest() const { return m_request; }
 
+  /**
+   * Return the details of the HTTP request headers.
+   * @return the details of the HTTP request headers.
+   */
+  const HttpHeaders& getHttpHeaders() const { return m_httpHeaders; }
+
   /**
    * Return the current user name.
    * @return the current user name.
@@ -119,24 +191,38 @@ class NetMessage {
   const string& getUser() const { return m_user; }
 
   /**
-   * Wait for the result being set and return the result string.
-   * @param result the variable in which to store the result string.
+   * Take the result string set so far without waiting.
+   * @param result the variable to which to append the result string.
+   * @return true when the complete result was set, false if only partial results were added so far.
    */
-  void getResult(string* result) {
+  bool fetchResult(string* result) {
     pthread_mutex_lock(&m_mutex);
+    result->append(m_result);
+    m_result.clear();
+    bool complete = m_resultSet;
+    if (complete) {
+      m_request.clear();
+      m_resultSet = false;
+    }
+    pthread_mutex_unlock(&m_mutex);
+    return complete;
+  }
 
-    if (!m_resultSet) {
-      pthread_cond_wait(&m_cond, &m_mutex);
+  /**
+   * Add a partial result string to be sent ahead of the complete result and notify the listener.
+   * @param result the partial result string.
+   */
+  void addResult(const string& result) {
+    pthread_mutex_lock(&m_mutex);
+    m_result.append(result);
+    if (m_listener) {
+      m_listener->notifyResult(this);
     }
-    m_request.clear();
-    *result = m_result;
-    m_result.clear();
-    m_resultSet = false;
     pthread_mutex_unlock(&m_mutex);
   }
 
   /**
-   * Set the result string and notify the waiting thread.
+   * Set the result string and notify the listener.
    * @param result the result string.
    * @param user the new user name.
    * @param settings the new client settings.
@@ -146,7 +232,11 @@ class NetMessage {
   void setResult(const string& result, const string& user, ClientSettings* settings, time_t listenUntil,
       bool disconnect) {
     pthread_mutex_lock(&m_mutex);
-    m_result = result;
+    if (m_result.empty()) {
+      m_result = result;
+    } else {
+      m_result.append(result);
+    }
     m_user = user;
     m_disconnect = disconnect;
     if (settings) {
@@ -154,7 +244,9 @@ class NetMessage {
     }
     m_listenSince = listenUntil;
     m_resultSet = true;
-    pthread_cond_signal(&m_cond);
+    if (m_listener) {
+      m_listener->notifyResult(this);  // while locked, so that the notification precedes taking the result
+    }
     pthread_mutex_unlock(&m_mutex);
   }
 
@@ -170,6 +262,18 @@ class NetMessage {
     return m_settings;
   }
 
+  /**
+   * Return the position in the update feed from which to add updates in listening mode.
+   * @return the sequence number of the next update feed entry to add.
+   */
+  uint64_t getListenCursor() const { return m_listenCursor; }
+
+  /**
+   * Set the position in the update feed from which to add updates in listening mode.
+   * @param cursor the sequence number of the next update feed entry to add.
+   */
+  void setListenCursor(uint64_t cursor) { m_listenCursor = cursor; }
+
   /**
    * Return whether this instance is in one of the listening modes.
    * @return whether this instance is in one of the listening modes.
@@ -187,9 +291,27 @@ class NetMessage {
   /** whether this is a HTTP message. */
   const bool m_isHttp;
 
-  /** the request string. */
+  /** the @a NetMessageListener to notify when the result was set, or nullptr. */
+  NetMessageListener* m_listener;
+
+  /** whether the client uses the binary protocol. */
+  bool m_binary;
+
+  /** whether any request data was received yet. */
+  bool m_received;
+
+  /** the request string (only complete frames in binary protocol). */
   string m_request;
 
+  /** the incomplete frame data received in binary protocol. */
+  string m_partial;
+
+  /** the subscribed handles mapped to the requested flags in binary protocol. */
+  std::map<uint32_t, uint8_t> m_subscriptions;
+
+  /** the details of the HTTP request headers. */
+  HttpHeaders m_httpHeaders;
+
   /** the current user name. */
   string m_user;
 
@@ -205,48 +327,197 @@ class NetMessage {
   /** mutex variable for exclusive lock. */
   pthread_mutex_t m_mutex;
 
-  /** condition variable for exclusive lock. */
-  pthread_cond_t m_cond;
-
   /** the client settings. */
   ClientSettings m_settings;
 
   /** start timestamp of listening update. */
   time_t m_listenSince;
+
+  /** the sequence number of the next update feed entry to add in listening mode. */
+  uint64_t m_listenCursor;
 };
 
+/** the capacity of the @a NetMessageQueue (each connection has at most one pending @a NetMessage). */
+#define NET_QUEUE_SIZE 256
+
+/** the queue for passing @a NetMessage instances from the @a Network to the main loop. */
+typedef RingQueue<NetMessage*, NET_QUEUE_SIZE> NetMessageQueue;
+
+/** the maximum number of simultaneously open connections (so that their pending messages fit into the queue). */
+#define MAX_CONNECTIONS NET_QUEUE_SIZE
+
+/**
+ * Writer for sending a HTTP response body in chunks while it is produced, optionally compressed.
+ */
+class HttpBodyWriter {
+ public:
+  /**
+   * Constructor.
+   * @param message the @a NetMessage to add the partial results to.
+   * @param header the HTTP response header (including the terminating empty line) to send ahead of the body.
+   * @param encoding the @a HttpEncoding to use for the body.
+   */
+  HttpBodyWriter(NetMessage* message, const string& header, HttpEncoding encoding);
+
+  /**
+   * Destructor.
+   */
+  ~HttpBodyWriter();
+
+  /**
+   * Encode the body data produced so far as chunk.
+   * @param ostream the @a ostringstream with the body data produced so far. When not final, the encoded chunk is
+   * passed on as partial result and the stream is cleared. Otherwise, the stream is replaced by the encoded last
+   * chunk and the terminating empty chunk.
+   * @param final true for the last part of the body.
+   */
+  void write(ostringstream* ostream, bool final);
+
+  /**
+   * Compress data completely.
+   * @param encoding the @a HttpEncoding to use.
+   * @param data the data to compress.
+   * @param output the @a string to append the compressed data to.
+   * @return true on success, false if the encoding is not available.
+   */
+  static bool compress(HttpEncoding encoding, const string& data, string* output);
+
+
+ private:
+  /**
+   * Hidden copy constructor.
+   * @param src the object to copy from.
+   */
+  HttpBodyWriter(const HttpBodyWriter& src);
+
+  /** the @a NetMessage to add the partial results to. */
+  NetMessage* m_message;
+
+  /** the HTTP response header not yet sent. */
+  string m_header;
+
+  /** the zlib stream for compressing the body, or nullptr. */
+  ::z_stream_s* m_stream;
+};
+
+/** Forward declaration for @a Network. */
+class Network;
+
 /**
  * class connection which handle client and baseloop communication.
  */
-class Connection : public Thread {
+class Connection : public NetMessageListener {
  public:
   /**
    * Constructor.
    * @param socket the @a TCPSocket for communication.
-   * @param isHttp whether this is a HTTP message.
-   * @param netQueue the reference to the @a NetMessage @a Queue.
+   * @param isHttp whether this is a HTTP connection.
+   * @param netQueue the reference to the @a NetMessageQueue.
+   * @param network the @a Network to notify about available results.
    */
-  Connection(TCPSocket* socket, const bool isHttp, Queue<NetMessage*>* netQueue)
-    : Thread(), m_isHttp(isHttp), m_socket(socket), m_netQueue(netQueue) {
+  Connection(TCPSocket* socket, const bool isHttp, NetMessageQueue* netQueue, Network* network)
+    : m_isHttp(isHttp), m_socket(socket), m_netQueue(netQueue), m_network(network), m_message(isHttp, this),
+      m_pending(false), m_closing(false), m_closed(false), m_outputPos(0), m_events(0) {
     m_id = ++m_ids;
+    time(&m_lastActive);
   }
 
   virtual ~Connection() { if (m_socket) delete m_socket; }
+
   /**
-   * endless loop for connection instance.
+   * Return the ID of this connection.
+   * @return the ID of this connection.
    */
-  virtual void run();
+  int getID() { return m_id; }
 
   /**
-   * Stop this connection.
+   * Return the file descriptor of the socket.
+   * @return the file descriptor of the socket.
    */
-  virtual void stop() { m_notify.notify(); Thread::stop(); }
+  int getFD() const { return m_socket->getFD(); }
 
   /**
-   * Return the ID of this connection.
-   * @return the ID of this connection.
+   * Receive available data from the client and pass a complete request on to the @a NetMessage @a Queue.
+   * @return false when the connection shall be closed.
    */
-  int getID() { return m_id; }
+  bool handleInput();
+
+  /**
+   * Handle the client having shut down its sending side, i.e. close after the pending result was sent.
+   * @return false when the connection shall be closed right away.
+   */
+  bool shutdownInput();
+
+  /**
+   * Take the result of the pending request and start sending it to the client.
+   * @return false when the connection shall be closed.
+   */
+  bool handleResult();
+
+  /**
+   * Continue sending buffered output to the client.
+   * @return false when the connection shall be closed.
+   */
+  bool handleOutput();
+
+  /**
+   * Pass an empty request on to the @a NetMessage @a Queue for collecting new updates when in one of the
+   * listening modes and idle.
+   */
+  void requestUpdate();
+
+  /**
+   * Return whether a request is waiting for its result.
+   * @return whether a request is waiting for its result.
+   */
+  bool isPending() const { return m_pending; }
+
+  /**
+   * Return whether the client is in one of the listening modes.
+   * @return whether the client is in one of the listening modes.
+   */
+  bool isListening() { return m_message.isListeningMode(); }
+
+  /**
+   * Return whether this is a HTTP connection without any activity since the specified time.
+   * @param since the time since when to check for activity.
+   * @return whether this is an idle HTTP connection.
+   */
+  bool isIdle(time_t since) const {
+    return m_isHttp && !m_pending && m_outputPos >= m_output.size() && m_lastActive < since;
+  }
+
+  /**
+   * Mark this connection as closed, i.e. not to be watched anymore.
+   */
+  void setClosed() { m_closed = true; }
+
+  /**
+   * Return whether this connection was closed.
+   * @return whether this connection was closed.
+   */
+  bool isClosed() const { return m_closed; }
+
+  /**
+   * Get the poll events to watch for.
+   * @return the poll events to watch for (POLLIN and/or POLLOUT), or 0.
+   */
+  int getWantedEvents() const;
+
+  /**
+   * Get the poll events currently registered for watching.
+   * @return the poll events currently registered for watching.
+   */
+  int getEvents() const { return m_events; }
+
+  /**
+   * Set the poll events currently registered for watching.
+   * @param events the poll events currently registered for watching.
+   */
+  void setEvents(int events) { m_events = events; }
+
+  // @copydoc
+  void notifyResult(NetMessage* message) override;
 
 
  private:
@@ -256,11 +527,35 @@ class Connection : public Thread {
   /** the @a TCPSocket for communication. */
   TCPSocket* m_socket;
 
-  /** the reference to the @a NetMessage @a Queue. */
-  Queue<NetMessage*>* m_netQueue;
+  /** the reference to the @a NetMessageQueue. */
+  NetMessageQueue* m_netQueue;
 
-  /** notification object for shutdown procedure. */
-  Notify m_notify;
+  /** the @a Network to notify about available results. */
+  Network* m_network;
+
+  /** the @a NetMessage for the requests of this connection. */
+  NetMessage m_message;
+
+  /** whether a request was passed on and is waiting for its result. */
+  bool m_pending;
+
+  /** whether the connection shall be closed after sending the remaining output. */
+  bool m_closing;
+
+  /** whether the connection was closed. */
+  bool m_closed;
+
+  /** the output not yet sent to the client. */
+  string m_output;
+
+  /** the position of the first unsent character in @a m_output. */
+  size_t m_outputPos;
+
+  /** the poll events currently registered for watching. */
+  int m_events;
+
+  /** the time of the last input or output. */
+  time_t m_lastActive;
 
   /** the ID of this connection. */
   int m_id;
@@ -270,7 +565,8 @@ class Connection : public Thread {
 };
 
 /**
- * class network which listening on tcp socket for incoming connections.
+ * class network which listening on tcp socket for incoming connections and multiplexes all @a Connection instances
+ * within a single thread.
  */
 class Network : public Thread {
  public:
@@ -279,9 +575,9 @@ class Network : public Thread {
    * @param local true to accept connections only for local host.
    * @param port the port to listen for command line connections.
    * @param httpPort the port to listen for HTTP connections, or 0.
-   * @param netQueue the reference to the @a NetMessage @a Queue.
+   * @param netQueue the reference to the @a NetMessageQueue.
    */
-  Network(const bool local, const uint16_t port, const uint16_t httpPort, Queue<NetMessage*>* netQueue);
+  Network(const bool local, const uint16_t port, const uint16_t httpPort, NetMessageQueue* netQueue);
 
   /**
    * destructor.
@@ -298,13 +594,55 @@ class Network : public Thread {
    */
   void stop() const { m_notify.notify(); usleep(100000); }
 
+  /**
+   * Wake up all connections in one of the listening modes for pushing new updates.
+   */
+  void notifyUpdate();
+
+  /**
+   * Called from the handling thread when the result of the pending request of a @a Connection is available.
+   * @param connection the @a Connection with the result available.
+   */
+  void notifyResult(Connection* connection);
+
 
  private:
+  /**
+   * Accept a new @a Connection from the @a TCPServer.
+   * @param isHttp whether to accept from the HTTP @a TCPServer.
+   */
+  void acceptConnection(bool isHttp);
+
+  /**
+   * Handle the poll events of a @a Connection.
+   * @param connection the @a Connection.
+   * @param events the poll events that occurred.
+   */
+  void handleEvents(Connection* connection, int events);
+
+  /**
+   * Handle the available results and pending update notifications.
+   */
+  void handleResults();
+
+  /**
+   * Update the poll events to watch for a @a Connection, or close it.
+   * @param connection the @a Connection.
+   * @param close true to close the @a Connection.
+   */
+  void updateConnection(Connection* connection, bool close);
+
+  /**
+   * Close idle connections and remove closed connections without pending request.
+   * @param idleSince the time since when to close connections without activity, or 0.
+   */
+  void cleanConnections(time_t idleSince);
+
   /** the list of active @a Connection instances. */
   list<Connection*> m_connections;
 
-  /** the reference to the @a NetMessage @a Queue. */
-  Queue<NetMessage*>* m_netQueue;
+  /** the reference to the @a NetMessageQueue. */
+  NetMessageQueue* m_netQueue;
 
   /** the command line @a TCPServer instance. */
   TCPServer* m_tcpServer;
@@ -315,13 +653,20 @@ class Network : public Thread {
   /** @a Notify object for shutdown procedure. */
   Notify m_notify;
 
+  /** @a Notify object for waking up on available updates. */
+  Notify m_wakeup;
+
+  /** the @a Connection instances with the result of the pending request available (waking up via its FD). */
+  RingQueue<Connection*, NET_QUEUE_SIZE> m_results;
+
+  /** whether new updates are available for connections in one of the listening modes. */
+  std::atomic<bool> m_updated;
+
+  /** the epoll file descriptor, or -1. */
+  int m_epollFD;
+
   /** true if this instance is listening. */
   bool m_listening;
-
-  /**
-   * clean inactive connections from container.
-   */
-  void cleanConnections();
 };
 
 }  // namespace ebusd
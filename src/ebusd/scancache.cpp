@@ -0,0 +1,177 @@
+/*
+ * ebusd - daemon for communication with eBUS heating systems.
+ * Copyright (C) 2021 John Baier <ebusd@ebusd.eu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "ebusd/scancache.h"
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include "lib/utils/log.h"
+
+namespace ebusd {
+
+using std::ifstream;
+using std::ofstream;
+using std::ostringstream;
+using std::hex;
+using std::dec;
+using std::setw;
+using std::setfill;
+
+/** the separator of the fields in a cache line. */
+#define CACHE_SEPARATOR '\t'
+
+/** the number of fields in a cache line. */
+#define CACHE_FIELDS 6
+
+size_t ScanCache::load() {
+  ifstream stream(m_fileName.c_str(), ifstream::in);
+  if (!stream.is_open()) {
+    return 0;
+  }
+  string line;
+  vector<string> fields;
+  m_lock.lock();
+  while (getline(stream, line)) {
+    // address, updateTime, master, slave, file, hash
+    fields.clear();
+    size_t start = 0;
+    for (size_t pos = line.find(CACHE_SEPARATOR); ; pos = line.find(CACHE_SEPARATOR, start)) {
+      fields.push_back(line.substr(start, pos == string::npos ? string::npos : pos-start));
+      if (pos == string::npos) {
+        break;
+      }
+      start = pos+1;
+    }
+    if (fields.size() != CACHE_FIELDS) {
+      continue;
+    }
+    result_t result;
+    symbol_t address = (symbol_t)parseInt(fields[0].c_str(), 16, 0, 0xff, &result);
+    if (result != RESULT_OK || !isValidAddress(address, false) || isMaster(address)) {
+      continue;
+    }
+    ScanCacheEntry& entry = m_entries[address];
+    entry.updateTime = static_cast<time_t>(strtoll(fields[1].c_str(), nullptr, 10));
+    entry.master = fields[2];
+    entry.slave = fields[3];
+    entry.file = fields[4];
+    entry.hash = static_cast<size_t>(strtoull(fields[5].c_str(), nullptr, 16));
+  }
+  size_t count = m_entries.size();
+  m_lock.unlock();
+  logInfo(lf_main, "loaded %d scan identifications from %s", static_cast<int>(count), m_fileName.c_str());
+  return count;
+}
+
+void ScanCache::restore(MessageMap* messages, vector<symbol_t>* addresses) {
+  m_lock.lock();
+  map<symbol_t, ScanCacheEntry> entries = m_entries;
+  m_lock.unlock();
+  messages->lock();
+  for (const auto& it : entries) {
+    Message* message = messages->getScanMessage(it.first);
+    MasterSymbolString master;
+    SlaveSymbolString slave;
+    if (!message || master.parseHex(it.second.master) != RESULT_OK || slave.parseHex(it.second.slave) != RESULT_OK) {
+      continue;
+    }
+    if (message->restoreLastData(master, slave, it.second.updateTime, it.second.updateTime) == RESULT_OK) {
+      addresses->push_back(it.first);
+    }
+  }
+  messages->unlock();
+}
+
+bool ScanCache::get(symbol_t address, ScanCacheEntry* entry) {
+  m_lock.lock();
+  const auto it = m_entries.find(address);
+  bool found = it != m_entries.end();
+  if (found) {
+    *entry = it->second;
+  }
+  m_lock.unlock();
+  return found;
+}
+
+bool ScanCache::matches(symbol_t address, const Message* message) {
+  string slave = message->getLastSlaveData().getStr();
+  m_lock.lock();
+  const auto it = m_entries.find(address);
+  bool match = it != m_entries.end() && it->second.slave == slave;
+  m_lock.unlock();
+  return match;
+}
+
+void ScanCache::update(symbol_t address, const Message* message, const string& file, size_t hash) {
+  if (message->getLastUpdateTime() == 0) {
+    return;
+  }
+  string master = message->getLastMasterData().getStr();
+  string slave = message->getLastSlaveData().getStr();
+  m_lock.lock();
+  ScanCacheEntry& entry = m_entries[address];
+  bool changed = entry.slave != slave || entry.file != file || entry.hash != hash;
+  entry.updateTime = message->getLastUpdateTime();
+  entry.master = master;
+  entry.slave = slave;
+  entry.file = file;
+  entry.hash = hash;
+  if (changed) {
+    saveLocked();
+  }
+  m_lock.unlock();
+}
+
+void ScanCache::remove(symbol_t address) {
+  m_lock.lock();
+  if (m_entries.erase(address) > 0) {
+    saveLocked();
+  }
+  m_lock.unlock();
+}
+
+void ScanCache::saveLocked() {
+  ostringstream content;
+  for (const auto& it : m_entries) {
+    content << hex << setw(2) << setfill('0') << static_cast<unsigned>(it.first) << dec << setw(0)
+            << CACHE_SEPARATOR << static_cast<int64_t>(it.second.updateTime)
+            << CACHE_SEPARATOR << it.second.master
+            << CACHE_SEPARATOR << it.second.slave
+            << CACHE_SEPARATOR << it.second.file
+            << CACHE_SEPARATOR << hex << it.second.hash << dec << '\n';
+  }
+  const string tempFile = m_fileName + ".tmp";
+  ofstream out(tempFile.c_str(), ofstream::out | ofstream::trunc);
+  if (out.is_open()) {
+    out << content.str();
+    out.close();
+  }
+  if (out.fail() || rename(tempFile.c_str(), m_fileName.c_str()) != 0) {
+    unlink(tempFile.c_str());
+    logError(lf_main, "unable to write scan cache %s", m_fileName.c_str());
+  }
+}
+
+}  // namespace ebusd
@@ -0,0 +1,132 @@
+/*
+ * ebusd - daemon for communication with eBUS heating systems.
+ * Copyright (C) 2021 John Baier <ebusd@ebusd.eu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EBUSD_SCANCACHE_H_
+#define EBUSD_SCANCACHE_H_
+
+#include <map>
+#include <string>
+#include <vector>
+#include "lib/ebus/message.h"
+#include "lib/utils/thread.h"
+
+namespace ebusd {
+
+/** @file ebusd/scancache.h
+ * A persistent cache of the scan identification of the slaves for a quick restart.
+ *
+ * For each slave with a loaded scan config file, the identification data
+ * together with the name and hash of the chosen config file is kept in a file
+ * with one line per slave. On start, the cached identification is applied
+ * before any bus traffic and verified by a background scan later on.
+ */
+
+using std::map;
+using std::string;
+using std::vector;
+
+/** the delay in seconds after start before verifying the cached identification in the background. */
+#define SCANCACHE_VERIFY_DELAY 60
+
+/**
+ * A cached scan identification of a slave.
+ */
+struct ScanCacheEntry {
+  time_t updateTime;  //!< the system time of the identification
+  string master;  //!< the hex master data of the identification
+  string slave;  //!< the hex slave data of the identification
+  string file;  //!< the name of the chosen config file with relative path
+  size_t hash;  //!< the hash of the chosen config file
+};
+
+/**
+ * The persistent cache of the scan identification of the slaves.
+ */
+class ScanCache {
+ public:
+  /**
+   * Constructor.
+   * @param fileName the name of the cache file.
+   */
+  explicit ScanCache(const string& fileName)
+    : m_fileName(fileName) {}
+
+  /**
+   * Load the cache file.
+   * @return the number of cached slaves.
+   */
+  size_t load();
+
+  /**
+   * Restore the cached identification into the scan @a Message of each cached slave.
+   * @param messages the @a MessageMap to restore the identification into.
+   * @param addresses the @a vector to add the slave addresses with restored identification to.
+   */
+  void restore(MessageMap* messages, vector<symbol_t>* addresses);
+
+  /**
+   * Get the cached entry of a slave.
+   * @param address the slave address.
+   * @param entry the @a ScanCacheEntry to fill.
+   * @return true when the slave is cached.
+   */
+  bool get(symbol_t address, ScanCacheEntry* entry);
+
+  /**
+   * Check whether the identification in the scan @a Message matches the cached one.
+   * @param address the slave address.
+   * @param message the scan @a Message of the slave.
+   * @return true when the slave is cached with the same identification.
+   */
+  bool matches(symbol_t address, const Message* message);
+
+  /**
+   * Store the identification and the chosen config file of a slave and write the cache file when changed.
+   * @param address the slave address.
+   * @param message the scan @a Message of the slave.
+   * @param file the name of the chosen config file with relative path.
+   * @param hash the hash of the chosen config file.
+   */
+  void update(symbol_t address, const Message* message, const string& file, size_t hash);
+
+  /**
+   * Remove the entry of a slave and write the cache file when it was cached.
+   * @param address the slave address.
+   */
+  void remove(symbol_t address);
+
+
+ private:
+  /**
+   * Write all entries to the cache file while holding the lock.
+   */
+  void saveLocked();
+
+  /** the name of the cache file. */
+  const string m_fileName;
+
+  /** the mutex for accessing the entries. */
+  Mutex m_lock;
+
+  /** the cached entries by slave address. */
+  map<symbol_t, ScanCacheEntry> m_entries;
+};
+
+}  // namespace ebusd
+
+#endif  // EBUSD_SCANCACHE_H_
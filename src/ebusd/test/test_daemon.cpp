@@ -0,0 +1,867 @@
+/*
+ * ebusd - daemon for communication with eBUS heating systems.
+ * Copyright (C) 2021 John Baier <ebusd@ebusd.eu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+#include "ebusd/binaryprotocol.h"
+#include "lib/ebus/symbol.h"
+#include "lib/utils/thread.h"
+
+using namespace ebusd;
+using std::cout;
+using std::endl;
+
+/** the maximum time in milliseconds to wait for a single response of the daemon. */
+#define RESPONSE_TIMEOUT 10000
+
+/** the slave address the @a BusEmulator answers for. */
+#define EMULATED_SLAVE 0x08
+
+static bool error = false;
+
+/**
+ * Emulates an eBUS with a single slave on the master side of a pseudo terminal: every symbol written by the daemon
+ * is echoed, a SYN is generated when the bus is idle, and each request to @a EMULATED_SLAVE is answered with a single
+ * data byte equal to the last master data byte.
+ */
+class BusEmulator : public Thread {
+ public:
+  /**
+   * Constructor.
+   */
+  BusEmulator() : Thread(), m_fd(-1), m_silent(false), m_answered(0), m_escape(false), m_skipToSyn(false) {}
+
+  /**
+   * Destructor.
+   */
+  virtual ~BusEmulator() {
+    if (m_fd >= 0) {
+      ::close(m_fd);
+    }
+  }
+
+  /**
+   * Open the pseudo terminal.
+   * @return whether the pseudo terminal was opened.
+   */
+  bool open() {
+    m_fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (m_fd < 0 || grantpt(m_fd) != 0 || unlockpt(m_fd) != 0) {
+      return false;
+    }
+    struct termios tio;
+    if (tcgetattr(m_fd, &tio) == 0) {
+      cfmakeraw(&tio);
+      tcsetattr(m_fd, TCSANOW, &tio);
+    }
+    fcntl(m_fd, F_SETFL, fcntl(m_fd, F_GETFL) | O_NONBLOCK);
+    return true;
+  }
+
+  /**
+   * @return the name of the device for the daemon.
+   */
+  string getDeviceName() const { return ptsname(m_fd); }
+
+  /**
+   * Set whether the emulated slave does not answer at all.
+   * @param silent true to let all requests time out.
+   */
+  void setSilent(bool silent) { m_silent = silent; }
+
+  /**
+   * @return the number of requests answered so far.
+   */
+  unsigned int getAnswered() const { return m_answered; }
+
+
+ protected:
+  // @copydoc
+  void run() override {
+    struct timespec lastActivity;
+    clock_gettime(CLOCK_MONOTONIC, &lastActivity);
+    while (isRunning()) {
+      struct pollfd pfd = {m_fd, POLLIN, 0};
+      int ret = poll(&pfd, 1, 2);
+      symbol_t buf[256];
+      ssize_t len = ret > 0 && (pfd.revents & POLLIN) ? read(m_fd, buf, sizeof(buf)) : 0;
+      struct timespec now;
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      if (len <= 0) {
+        if (ret > 0 && !(pfd.revents & POLLIN)) {
+          usleep(2000);  // not opened by the daemon yet
+        }
+        long idle = (now.tv_sec-lastActivity.tv_sec)*1000 + (now.tv_nsec-lastActivity.tv_nsec)/1000000;
+        if (idle >= 5) {
+          write(SYN);
+          lastActivity = now;
+        }
+        continue;
+      }
+      lastActivity = now;
+      for (ssize_t pos = 0; pos < len; pos++) {
+        write(buf[pos]);  // echo
+        handle(buf[pos]);
+      }
+    }
+  }
+
+
+ private:
+  /**
+   * Write a symbol to the daemon.
+   * @param value the symbol to write.
+   */
+  void write(symbol_t value) {
+    if (::write(m_fd, &value, 1) != 1 && errno != EAGAIN) {
+      usleep(1000);
+    }
+  }
+
+  /**
+   * Write a data symbol escaped to the daemon.
+   * @param value the symbol to write.
+   */
+  void writeEscaped(symbol_t value) {
+    if (value == ESC || value == SYN) {
+      write(ESC);
+      write(value == ESC ? 0x00 : 0x01);
+    } else {
+      write(value);
+    }
+  }
+
+  /**
+   * Handle a symbol sent by the daemon.
+   * @param value the received symbol.
+   */
+  void handle(symbol_t value) {
+    if (value == SYN) {
+      m_master.clear();
+      m_escape = false;
+      m_skipToSyn = false;
+      return;
+    }
+    if (m_skipToSyn) {
+      return;
+    }
+    if (m_escape) {
+      m_escape = false;
+      value = value == 0x00 ? ESC : SYN;
+    } else if (value == ESC) {
+      m_escape = true;
+      return;
+    }
+    m_master.push_back(value);
+    if (m_master.size() < 5 || m_master.size() < 6u+m_master[4]) {
+      return;
+    }
+    m_skipToSyn = true;  // ignore the master ACK until the next SYN
+    if (m_master[1] != EMULATED_SLAVE || m_silent) {
+      return;
+    }
+    symbol_t data[2] = {1, m_master.size() > 6 ? m_master[m_master.size()-2] : static_cast<symbol_t>(0)};
+    symbol_t crc = 0;
+    SymbolString::updateCrc(data, 2, &crc);
+    write(ACK);
+    writeEscaped(data[0]);
+    writeEscaped(data[1]);
+    writeEscaped(crc);
+    m_answered++;
+  }
+
+  /** the file descriptor of the master side of the pseudo terminal. */
+  int m_fd;
+
+  /** whether the emulated slave does not answer at all. */
+  std::atomic<bool> m_silent;
+
+  /** the number of requests answered so far. */
+  std::atomic<unsigned int> m_answered;
+
+  /** the unescaped master part of the current telegram. */
+  std::vector<symbol_t> m_master;
+
+  /** whether the last received symbol was an escape symbol. */
+  bool m_escape;
+
+  /** whether to ignore all symbols up to the next SYN. */
+  bool m_skipToSyn;
+};
+
+
+/**
+ * Find a free local TCP port.
+ * @return the port number, or 0 on error.
+ */
+static int findFreePort() {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t len = sizeof(address);
+  int port = 0;
+  if (bind(fd, (struct sockaddr*)&address, len) == 0 && getsockname(fd, (struct sockaddr*)&address, &len) == 0) {
+    port = ntohs(address.sin_port);
+  }
+  close(fd);
+  return port;
+}
+
+/**
+ * A TCP connection to the daemon.
+ */
+class Connection {
+ public:
+  /**
+   * Constructor.
+   */
+  Connection() : m_fd(-1) {}
+
+  /**
+   * Destructor.
+   */
+  ~Connection() {
+    if (m_fd >= 0) {
+      close(m_fd);
+    }
+  }
+
+  /**
+   * Connect to the local port, retrying while the daemon is starting up.
+   * @param port the port to connect to.
+   * @return whether the connection was established.
+   */
+  bool open(int port) {
+    for (int retry = 0; retry < 100; retry++) {
+      m_fd = socket(AF_INET, SOCK_STREAM, 0);
+      struct sockaddr_in address;
+      memset(&address, 0, sizeof(address));
+      address.sin_family = AF_INET;
+      address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      address.sin_port = htons(static_cast<uint16_t>(port));
+      if (connect(m_fd, (struct sockaddr*)&address, sizeof(address)) == 0) {
+        return true;
+      }
+      close(m_fd);
+      m_fd = -1;
+      usleep(50000);
+    }
+    return false;
+  }
+
+  /**
+   * Send data to the daemon.
+   * @param data the data to send.
+   * @return whether the data was sent.
+   */
+  bool send(const string& data) {
+    return ::send(m_fd, data.data(), data.length(), MSG_NOSIGNAL) == static_cast<ssize_t>(data.length());
+  }
+
+  /**
+   * Receive data from the daemon until the terminator was received.
+   * @param terminator the terminating string (included in the result).
+   * @param result the string in which to store the received data.
+   * @return whether the terminator was received in time.
+   */
+  bool receive(const string& terminator, string* result) {
+    size_t pos;
+    while ((pos = m_buffer.find(terminator)) == string::npos) {
+      if (!receiveMore()) {
+        return false;
+      }
+    }
+    *result = m_buffer.substr(0, pos+terminator.length());
+    m_buffer.erase(0, pos+terminator.length());
+    return true;
+  }
+
+  /**
+   * Receive the next binary protocol frame from the daemon.
+   * @param frame the string in which to store the received frame.
+   * @return whether a complete frame was received in time.
+   */
+  bool receiveFrame(string* frame) {
+    size_t size;
+    while ((size = getBinaryFrameSize(m_buffer, 0)) == 0) {
+      if (!receiveMore()) {
+        return false;
+      }
+    }
+    if (size == string::npos) {
+      return false;
+    }
+    *frame = m_buffer.substr(0, size);
+    m_buffer.erase(0, size);
+    return true;
+  }
+
+  /**
+   * Receive all data from the daemon until the connection is closed.
+   * @return the received data.
+   */
+  string receiveAll() {
+    while (receiveMore()) {
+      // read until closed
+    }
+    string result = m_buffer;
+    m_buffer.clear();
+    return result;
+  }
+
+  /**
+   * Send a command line and receive the response up to the terminating empty line.
+   * @param command the command line (without line feed).
+   * @return the response without the trailing empty line, or "timeout".
+   */
+  string command(const string& command) {
+    string result;
+    if (!send(command+"\n") || !receive("\n\n", &result)) {
+      return "timeout";
+    }
+    return result.substr(0, result.length()-2);
+  }
+
+
+ private:
+  /**
+   * Receive more data from the daemon into the buffer.
+   * @return whether data was received in time.
+   */
+  bool receiveMore() {
+    struct pollfd pfd = {m_fd, POLLIN, 0};
+    if (poll(&pfd, 1, RESPONSE_TIMEOUT) <= 0) {
+      return false;
+    }
+    char buf[1024];
+    ssize_t len = recv(m_fd, buf, sizeof(buf), 0);
+    if (len <= 0) {
+      return false;
+    }
+    m_buffer.append(buf, static_cast<size_t>(len));
+    return true;
+  }
+
+  /** the socket file descriptor. */
+  int m_fd;
+
+  /** the received data not consumed yet. */
+  string m_buffer;
+};
+
+
+/**
+ * Run the daemon in a child process.
+ */
+class Daemon {
+ public:
+  /**
+   * Constructor.
+   * @param binary the path to the daemon binary.
+   * @param dir the temporary directory with the configuration files.
+   */
+  Daemon(const string& binary, const string& dir) : m_binary(binary), m_dir(dir), m_pid(-1) {}
+
+  /**
+   * Destructor.
+   */
+  ~Daemon() {
+    stop();
+  }
+
+  /**
+   * Start the daemon.
+   * @param args the additional arguments.
+   * @return whether the daemon was started.
+   */
+  bool start(const std::vector<string>& args) {
+    m_pid = fork();
+    if (m_pid < 0) {
+      return false;
+    }
+    if (m_pid == 0) {
+      std::vector<const char*> argv;
+      argv.push_back(m_binary.c_str());
+      for (const auto& arg : args) {
+        argv.push_back(arg.c_str());
+      }
+      argv.push_back(nullptr);
+      int fd = ::open((m_dir+"/ebusd.log").c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+      if (fd >= 0) {
+        dup2(fd, STDOUT_FILENO);
+        dup2(fd, STDERR_FILENO);
+      }
+      execv(m_binary.c_str(), const_cast<char* const*>(argv.data()));
+      _exit(127);
+    }
+    return true;
+  }
+
+  /**
+   * Stop the daemon.
+   * @return whether the daemon stopped in time after being terminated.
+   */
+  bool stop() {
+    if (m_pid <= 0) {
+      return true;
+    }
+    kill(m_pid, SIGTERM);
+    bool stopped = false;
+    for (int retry = 0; retry < 400 && !stopped; retry++) {
+      stopped = waitpid(m_pid, nullptr, WNOHANG) == m_pid;
+      if (!stopped) {
+        usleep(50000);
+      }
+    }
+    if (!stopped) {
+      kill(m_pid, SIGKILL);
+      waitpid(m_pid, nullptr, 0);
+    }
+    m_pid = -1;
+    return stopped;
+  }
+
+
+ private:
+  /** the path to the daemon binary. */
+  const string m_binary;
+
+  /** the temporary directory. */
+  const string m_dir;
+
+  /** the process ID of the daemon, or -1. */
+  pid_t m_pid;
+};
+
+
+/**
+ * Verify a response of the daemon.
+ * @param what the description of the check.
+ * @param expected the expected response.
+ * @param got the received response.
+ */
+static void verify(const string& what, const string& expected, const string& got) {
+  if (got == expected) {
+    cout << "  " << what << ": OK" << endl;
+  } else {
+    error = true;
+    cout << "  " << what << ": error: got >" << got << "<, expected >" << expected << "<" << endl;
+  }
+}
+
+/**
+ * A @a Thread sending the same command repeatedly over an own connection.
+ */
+class CommandThread : public Thread {
+ public:
+  /**
+   * Constructor.
+   * @param port the command port of the daemon.
+   * @param command the command line to send.
+   * @param expected the expected response.
+   * @param count the number of times to send the command.
+   */
+  CommandThread(int port, const string& command, const string& expected, int count)
+    : Thread(), m_port(port), m_command(command), m_expected(expected), m_count(count), m_failures(0) {}
+
+  /**
+   * @return the number of unexpected responses.
+   */
+  int getFailures() const { return m_failures; }
+
+  /**
+   * @return the last unexpected response.
+   */
+  const string& getLastFailure() const { return m_lastFailure; }
+
+
+ protected:
+  // @copydoc
+  void run() override {
+    Connection connection;
+    if (!connection.open(m_port)) {
+      m_failures = m_count;
+      return;
+    }
+    for (int idx = 0; idx < m_count; idx++) {
+      string got = connection.command(m_command);
+      if (got != m_expected) {
+        m_failures++;
+        m_lastFailure = got;
+        if (got == "timeout") {
+          break;
+        }
+      }
+    }
+  }
+
+
+ private:
+  /** the command port of the daemon. */
+  const int m_port;
+
+  /** the command line to send. */
+  const string m_command;
+
+  /** the expected response. */
+  const string m_expected;
+
+  /** the number of times to send the command. */
+  const int m_count;
+
+  /** the number of unexpected responses. */
+  int m_failures;
+
+  /** the last unexpected response. */
+  string m_lastFailure;
+};
+
+/**
+ * Send several commands concurrently, each one repeatedly over an own connection.
+ * @param what the description of the check.
+ * @param port the command port of the daemon.
+ * @param commands the command lines to send.
+ * @param expected the expected response of each command.
+ */
+static void verifyConcurrent(const string& what, int port, const std::vector<string>& commands,
+    const std::vector<string>& expected) {
+  std::vector<CommandThread*> threads;
+  for (size_t idx = 0; idx < commands.size(); idx++) {
+    CommandThread* thread = new CommandThread(port, commands[idx], expected[idx], 20);
+    thread->start("command");
+    threads.push_back(thread);
+  }
+  int failures = 0;
+  string lastFailure;
+  for (auto thread : threads) {
+    thread->join();
+    failures += thread->getFailures();
+    if (thread->getFailures() > 0) {
+      lastFailure = thread->getLastFailure();
+    }
+    delete thread;
+  }
+  verify(what, "", failures == 0 ? "" : lastFailure);
+}
+
+/**
+ * Receive a number of binary protocol frames.
+ * @param connection the @a Connection to receive from.
+ * @param count the number of frames to receive.
+ * @param frames the @a map in which to store the received frames by request ID.
+ * @return whether all frames were received in time.
+ */
+static bool receiveFrames(Connection* connection, size_t count, std::map<uint32_t, string>* frames) {
+  frames->clear();
+  string frame;
+  for (size_t idx = 0; idx < count; idx++) {
+    if (!connection->receiveFrame(&frame)) {
+      return false;
+    }
+    (*frames)[static_cast<uint32_t>(readBinaryNumber(frame, 4, 4))] = frame;
+  }
+  return true;
+}
+
+/**
+ * Describe a received binary protocol value frame.
+ * @param frame the received frame.
+ * @return the frame type and the last value of the frame, i.e. the last slave symbol of raw data or the last
+ * number field.
+ */
+static string describeFrame(const string& frame) {
+  if (frame.empty()) {
+    return "missing";
+  }
+  uint8_t type = static_cast<uint8_t>(frame[1]);
+  string payload = frame.substr(BINARY_HEADER_SIZE);
+  if (type == bft_error) {
+    return "error " + std::to_string(static_cast<int32_t>(readBinaryNumber(payload, 0, 4)));
+  }
+  if (type == bft_handle || type == bft_ok) {
+    return type == bft_ok ? "ok" : "handle";
+  }
+  if (type != bft_value || payload.length() < 10) {
+    return "unexpected " + std::to_string(type);
+  }
+  if (payload[8] & BINARY_FLAG_RAW) {
+    return "raw " + std::to_string(static_cast<uint8_t>(payload[payload.length()-1]));
+  }
+  if (payload.length() < 19) {
+    return "empty value";
+  }
+  return "value " + std::to_string(static_cast<int>(readBinaryDouble(payload, payload.length()-8)));
+}
+
+/**
+ * Build a binary protocol resolve request frame.
+ * @param requestId the request ID.
+ * @param circuit the circuit name.
+ * @param name the message name.
+ * @return the frame.
+ */
+static string resolveFrame(uint32_t requestId, const string& circuit, const string& name) {
+  string payload = circuit + '\0' + name + '\0', frame;
+  appendBinaryFrame(bft_resolve, requestId, payload, &frame);
+  return frame;
+}
+
+/**
+ * Build a binary protocol read request frame.
+ * @param requestId the request ID.
+ * @param handle the handle to read.
+ * @param flags the flags (@a BINARY_FLAG_RAW).
+ * @return the frame.
+ */
+static string readFrame(uint32_t requestId, uint32_t handle, uint8_t flags) {
+  string payload, frame;
+  appendBinaryNumber(handle, 4, &payload);
+  appendBinaryNumber(0, 2, &payload);  // always read from the bus
+  payload.push_back(static_cast<char>(flags));
+  appendBinaryFrame(bft_read, requestId, payload, &frame);
+  return frame;
+}
+
+/**
+ * Check the binary protocol frame building.
+ */
+static void verifyBinaryFrames() {
+  cout << "binary frames:" << endl;
+  string frame;
+  verify("append", "true", appendBinaryFrame(bft_ok, 1, string(BINARY_MAX_PAYLOAD, 'x'), &frame) ? "true" : "false");
+  verify("append size", std::to_string(BINARY_HEADER_SIZE+BINARY_MAX_PAYLOAD),
+      std::to_string(getBinaryFrameSize(frame, 0)));
+  frame.clear();
+  verify("append overflow", "false",
+      appendBinaryFrame(bft_value, 2, string(BINARY_MAX_PAYLOAD+1, 'x'), &frame) ? "true" : "false");
+  verify("append overflow size", std::to_string(frame.length()), std::to_string(getBinaryFrameSize(frame, 0)));
+  verify("append overflow error", "error " + std::to_string(RESULT_ERR_OUT_OF_RANGE), describeFrame(frame));
+  verify("append overflow request", "2", std::to_string(readBinaryNumber(frame, 4, 4)));
+}
+
+/**
+ * Check the binary protocol.
+ * @param port the command port of the daemon.
+ */
+static void verifyBinary(int port) {
+  cout << "binary protocol:" << endl;
+  Connection connection;
+  if (!connection.open(port)) {
+    verify("connect", "", "failed");
+    return;
+  }
+  std::map<uint32_t, string> frames;
+  connection.send(resolveFrame(1, "bar", "bar1") + resolveFrame(2, "bar", "bar2") + resolveFrame(3, "bar", "baz"));
+  if (!receiveFrames(&connection, 3, &frames)) {
+    verify("resolve", "", "timeout");
+    return;
+  }
+  verify("resolve", "handle", describeFrame(frames[1]));
+  verify("resolve second", "handle", describeFrame(frames[2]));
+  verify("resolve unknown", "error " + std::to_string(RESULT_ERR_NOTFOUND), describeFrame(frames[3]));
+  uint32_t handle1 = static_cast<uint32_t>(readBinaryNumber(frames[1], BINARY_HEADER_SIZE, 4));
+  uint32_t handle2 = static_cast<uint32_t>(readBinaryNumber(frames[2], BINARY_HEADER_SIZE, 4));
+  connection.send(readFrame(10, handle1, 0));
+  if (!receiveFrames(&connection, 1, &frames)) {
+    verify("read", "", "timeout");
+    return;
+  }
+  verify("read", "value 1", describeFrame(frames[10]));
+  connection.send(readFrame(11, handle1, 0) + readFrame(12, handle2, BINARY_FLAG_RAW) + readFrame(13, handle1,
+      BINARY_FLAG_RAW) + readFrame(14, handle2, 0) + readFrame(15, 0xffff, 0));
+  if (!receiveFrames(&connection, 5, &frames)) {
+    verify("read with duplicate handles", "", "timeout");
+    return;
+  }
+  verify("read with duplicate handles", "value 1", describeFrame(frames[11]));
+  verify("read with duplicate handles raw", "raw 2", describeFrame(frames[12]));
+  verify("read duplicate handle raw", "raw 1", describeFrame(frames[13]));
+  verify("read duplicate handle", "value 2", describeFrame(frames[14]));
+  verify("read unknown handle", "error " + std::to_string(RESULT_ERR_NOTFOUND), describeFrame(frames[15]));
+  connection.send(readFrame(16, handle2, 0));
+  if (!receiveFrames(&connection, 1, &frames)) {
+    verify("read after duplicate handles", "", "timeout");
+    return;
+  }
+  verify("read after duplicate handles", "value 2", describeFrame(frames[16]));
+}
+
+/**
+ * Send an HTTP GET request and receive the body of the response.
+ * @param port the HTTP port of the daemon.
+ * @param uri the URI to get.
+ * @param requestHeaders the additional request header lines, each terminated by CRLF.
+ * @param responseHeaders optional variable in which to store the response headers.
+ * @return the body of the response, or "failed".
+ */
+static string httpGet(int port, const string& uri, const string& requestHeaders = "",
+    string* responseHeaders = nullptr) {
+  Connection connection;
+  if (!connection.open(port) || !connection.send("GET " + uri + " HTTP/1.0\r\n" + requestHeaders + "\r\n")) {
+    return "failed";
+  }
+  string response = connection.receiveAll();
+  size_t pos = response.find("\r\n\r\n");
+  if (responseHeaders) {
+    *responseHeaders = response.substr(0, pos);
+  }
+  return pos == string::npos ? "failed" : response.substr(pos+4);
+}
+
+/**
+ * Check the HTTP data cache.
+ * @param port the HTTP port of the daemon.
+ * @param connection the @a Connection to the command port of the daemon.
+ */
+static void verifyHttp(int port, Connection* connection) {
+  cout << "HTTP data:" << endl;
+  string before = httpGet(port, "/data/bar/part10");
+  verify("get unread", "true", before.find("\"part10\"") != string::npos ? "true" : before);
+  verify("get unread again", before, httpGet(port, "/data/bar/part10"));
+  verify("read", "16", connection->command("read -f part10"));
+  string after = httpGet(port, "/data/bar/part10");
+  verify("get after read changed", "true", after != before ? "true" : after);
+  verify("get after read", "true", after.find("\"value\": 16") != string::npos ? "true" : after);
+#ifdef HAVE_ZLIB
+  string headers, encoding;
+  const char* cases[][2] = {
+    {"gzip, deflate", "gzip"},
+    {"gzip;q=0.5, deflate", "deflate"},
+    {"gzip;q=0, deflate;q=0", "identity"},
+    {"*;q=0", "identity"},
+    {"*", "gzip"},
+  };
+  for (const auto& check : cases) {
+    httpGet(port, "/data?def&verbose", string("Accept-Encoding: ") + check[0] + "\r\n", &headers);
+    size_t pos = headers.find("Content-Encoding: ");
+    encoding = pos == string::npos ? "identity" : headers.substr(pos+18, headers.find("\r\n", pos)-pos-18);
+    verify(string("get with ") + check[0], check[1], encoding);
+    verify(string("vary with ") + check[0], "true",
+        headers.find("\r\nVary: Accept-Encoding") != string::npos ? "true" : headers);
+  }
+#endif
+}
+
+static const char* CONFIG_FILE =
+  "type,circuit,name,comment,qq,zz,pbsb,id,*name,part,type,divisor/values,unit,comment\n"
+  "r,bar,bar1,,,08,b509,0d01,,s,UCH,,,\n"
+  "r,bar,bar2,,,08,b509,0d02,,s,UCH,,,\n"
+  "r,bar,chainA,,,08,b509,0d10:1;0d11:1,v1,s,UCH,,,,v2,s,UCH,,,\n"
+  "r,bar,part10,,,08,b509,0d10,,s,UCH,,,\n"
+  "r,bar,part11,,,08,b509,0d11,,s,UCH,,,\n";
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    cout << "usage: test_daemon EBUSD" << endl;
+    return 1;
+  }
+  alarm(120);  // fail instead of hanging forever
+  char dirTemplate[] = "/tmp/ebusdtest.XXXXXX";
+  if (!mkdtemp(dirTemplate)) {
+    cout << "unable to create temp dir" << endl;
+    return 1;
+  }
+  string dir = dirTemplate;
+  {
+    std::ofstream config((dir+"/bar.csv").c_str());
+    config << CONFIG_FILE;
+  }
+  verifyBinaryFrames();
+  BusEmulator bus;
+  if (!bus.open() || !bus.start("bus")) {
+    cout << "unable to start bus emulator" << endl;
+    return 1;
+  }
+  int port = findFreePort();
+  int httpPort = findFreePort();
+  Daemon daemon(argv[1], dir);
+  std::vector<string> args = {
+    "-f", "-n", "-d", bus.getDeviceName(), "-c", dir, "-p", std::to_string(port), "--pollinterval=0",
+    "--updatecheck=off", "--pidfile="+dir+"/ebusd.pid",
+    "--httpport="+std::to_string(httpPort),
+  };
+  if (!daemon.start(args)) {
+    cout << "unable to start daemon" << endl;
+    return 1;
+  }
+  Connection connection;
+  if (!connection.open(port)) {
+    cout << "unable to connect to daemon" << endl;
+    error = true;
+  } else {
+    verifyHttp(httpPort, &connection);
+    cout << "text protocol:" << endl;
+    verify("single read", "1", connection.command("read -f bar1"));
+    verify("batch read", "bar bar1 = 1\nbar bar2 = 2", connection.command("read -f -b bar:bar1,bar:bar2"));
+    verify("batch read with duplicate", "bar bar1 = 1\nbar bar1 = 1",
+        connection.command("read -f -b bar:bar1,bar:bar1"));
+    verify("read after duplicate", "2", connection.command("read -f bar2"));
+    verify("chained read", "16;17", connection.command("read -f chainA"));
+    verifyConcurrent("concurrent batch reads", port,
+        {"read -f -b bar:bar1,bar:bar2,bar:bar1", "read -f -b bar:bar2,bar:bar1,bar:bar2"},
+        {"bar bar1 = 1\nbar bar2 = 2\nbar bar1 = 1", "bar bar2 = 2\nbar bar1 = 1\nbar bar2 = 2"});
+    verifyConcurrent("concurrent chained and single reads", port,
+        {"read -f chainA", "read -f -b bar:part11,bar:part10", "read -f chainA"},
+        {"16;17", "bar part11 = 17\nbar part10 = 16", "16;17"});
+    verifyConcurrent("concurrent chained reads in batches", port,
+        {"read -f -b bar:part11,bar:chainA,bar:part10", "read -f -b bar:chainA,bar:part10,bar:chainA"},
+        {"bar part11 = 17\nbar chainA = 16;17\nbar part10 = 16", "bar chainA = 16;17\nbar part10 = 16\nbar chainA = 16;17"});
+    verify("read after concurrent reads", "1", connection.command("read -f bar1"));
+    verifyBinary(port);
+  }
+  if (!daemon.stop()) {
+    cout << "daemon did not stop in time" << endl;
+    error = true;
+  }
+  bus.stop();
+  bus.join();
+  if (error) {
+    cout << "daemon log:" << endl;
+    std::ifstream log((dir+"/ebusd.log").c_str());
+    cout << log.rdbuf();
+  } else {
+    unlink((dir+"/ebusd.log").c_str());
+    unlink((dir+"/ebusd.pid").c_str());
+    unlink((dir+"/bar.csv").c_str());
+    rmdir(dir.c_str());
+  }
+  return error ? 1 : 0;
+}
@@ -0,0 +1,169 @@
+/*
+ * ebusd - daemon for communication with eBUS heating systems.
+ * Copyright (C) 2021 John Baier <ebusd@ebusd.eu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "ebusd/history.h"
+#include "lib/ebus/message.h"
+
+using namespace ebusd;
+using std::cout;
+using std::endl;
+
+static bool error = false;
+
+void verify(bool expectFailMatch, string type, string input,
+    bool match, string expectStr, string gotStr) {
+  if (expectFailMatch) {
+    if (match) {
+      error = true;
+      cout << "  failed " << type << " match >" << input
+              << "< error: unexpectedly succeeded" << endl;
+    } else {
+      cout << "  failed " << type << " match >" << input << "< OK" << endl;
+    }
+  } else if (match) {
+    cout << "  " << type << " match >" << input << "< OK" << endl;
+  } else {
+    error = true;
+    cout << "  " << type << " match >" << input << "< error: got >"
+            << gotStr << "<, expected >" << expectStr << "<" << endl;
+  }
+}
+
+DataFieldTemplates* templates = nullptr;
+
+namespace ebusd {
+
+DataFieldTemplates* getTemplates(const string& filename) {
+  return templates;
+}
+
+result_t loadDefinitionsFromConfigPath(FileReader* reader, const string& filename, bool verbose,
+    map<string, string>* defaults, string* errorDescription, bool replace = false) {
+  return RESULT_ERR_NOTFOUND;
+}
+
+}  // namespace ebusd
+
+/**
+ * Format the buckets for comparison.
+ * @param buckets the @a HistoryBucket instances to format.
+ * @return the buckets as "time:min/max/last/count/avg" separated by space.
+ */
+static string formatBuckets(const vector<HistoryBucket>& buckets) {
+  std::ostringstream output;
+  bool first = true;
+  for (const auto& bucket : buckets) {
+    if (!first) {
+      output << " ";
+    }
+    first = false;
+    output << bucket.m_time << ":" << bucket.get(ha_min) << "/" << bucket.get(ha_max) << "/" << bucket.get(ha_last)
+           << "/" << bucket.get(ha_count) << "/" << bucket.get(ha_avg);
+  }
+  return output.str();
+}
+
+/**
+ * Verify the result of a query.
+ * @param type the type of query.
+ * @param series the @a HistorySeries to query.
+ * @param tier the @a HistoryTier to use.
+ * @param since the start time (inclusive), or 0 for no limit.
+ * @param until the end time (inclusive), or 0 for no limit.
+ * @param interval the interval in seconds to merge the buckets into, or 0 to keep the buckets of the tier.
+ * @param expectStr the expected formatted buckets.
+ */
+static void verifyQuery(const string& type, const HistorySeries& series, HistoryTier tier, time_t since,
+    time_t until, time_t interval, const string& expectStr) {
+  vector<HistoryBucket> buckets;
+  series.query(tier, since, until, interval, &buckets);
+  string gotStr = formatBuckets(buckets);
+  verify(false, type, getHistoryTierName(tier), gotStr == expectStr, expectStr, gotStr);
+}
+
+int main() {
+  // the raw samples are kept in a ring buffer while the tiers aggregate them per period
+  HistorySeries series(4);
+  series.add(120, 1);
+  series.add(130, 3);
+  series.add(185, 2);
+  series.add(200, 6);
+  series.add(250, 4);
+  std::ostringstream samples;
+  samples << series.getSampleCount();
+  verify(false, "samples", "series", series.getSampleCount() == 5, "5", samples.str());
+  verifyQuery("add", series, ht_raw, 0, 0, 0, "130:3/3/3/1/3 185:2/2/2/1/2 200:6/6/6/1/6 250:4/4/4/1/4");
+  verifyQuery("add", series, ht_minute, 0, 0, 0, "120:1/3/3/2/2 180:2/6/6/2/4 240:4/4/4/1/4");
+  verifyQuery("add", series, ht_quarter, 0, 0, 0, "0:1/6/4/5/3.2");
+
+  // the range includes each bucket overlapping with it
+  verifyQuery("range", series, ht_raw, 185, 200, 0, "185:2/2/2/1/2 200:6/6/6/1/6");
+  verifyQuery("range", series, ht_minute, 185, 200, 0, "180:2/6/6/2/4");
+  verifyQuery("range", series, ht_minute, 180, 0, 0, "180:2/6/6/2/4 240:4/4/4/1/4");
+  verifyQuery("range", series, ht_raw, 300, 0, 0, "");
+
+  // the buckets are merged into the interval
+  verifyQuery("interval", series, ht_minute, 0, 0, 180, "0:1/3/3/2/2 180:2/6/4/3/4");
+  verifyQuery("interval", series, ht_raw, 0, 0, 100, "100:2/3/2/2/2.5 200:4/6/4/2/5");
+
+  // the numeric fields of an updated message are decoded and added at once
+  templates = new DataFieldTemplates();
+  MessageMap* messages = new MessageMap(true, "", false);
+  unsigned int lineNo = 0;
+  vector<string> row;
+  string errorDescription;
+  for (const auto line : {"#", "r,cir,first,,,08,B509,0d2800,temp,,D1C,,,,mode,,UCH,0=off;1=on,,,label,,STR:2"}) {
+    std::istringstream stream(line);
+    messages->readLineFromStream(&stream, __FILE__, false, &lineNo, &row, &errorDescription, false, nullptr,
+        nullptr);
+  }
+  MasterSymbolString master;
+  SlaveSymbolString slave;
+  master.parseHex("ff08b509030d2800");
+  slave.parseHex("042a016162");
+  Message* message = messages->find(master);
+  History history(4, 10);
+  vector<double> values;
+  bool decodeOk = message && message->storeLastData(master, slave) == RESULT_OK
+      && message->decodeLastNumericValues(&values) == RESULT_OK && values.size() == 3
+      && values[0] == 21 && values[1] == 1 && values[2] != values[2];
+  verify(false, "decode", "first", decodeOk, "1", decodeOk ? "1" : "0");
+  if (message) {
+    history.update(message);
+  }
+  std::ostringstream list;
+  history.list(&list);
+  verify(false, "update", "first", list.str() == "cir first temp = 1 samples\ncir first mode = 1 samples\n",
+      "cir first temp = 1 samples\ncir first mode = 1 samples\n", list.str());
+  vector<HistoryBucket> buckets;
+  string usedField;
+  result_t result = history.query("cir", "first", "mode", ht_raw, 0, 0, 0, &usedField, &buckets);
+  bool queryOk = result == RESULT_OK && usedField == "mode" && buckets.size() == 1 && buckets[0].m_last == 1;
+  verify(false, "query", "first", queryOk, "1", queryOk ? "1" : "0");
+  result = history.query("cir", "first", "label", ht_raw, 0, 0, 0, &usedField, &buckets);
+  verify(false, "query", "label", result == RESULT_ERR_NOTFOUND, getResultCode(RESULT_ERR_NOTFOUND),
+      getResultCode(result));
+
+  delete messages;
+  delete templates;
+  return error ? 1 : 0;
+}
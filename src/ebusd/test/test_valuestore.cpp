@@ -0,0 +1,170 @@
+/*
+ * ebusd - daemon for communication with eBUS heating systems.
+ * Copyright (C) 2021 John Baier <ebusd@ebusd.eu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <unistd.h>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "ebusd/valuestore.h"
+#include "lib/ebus/message.h"
+
+using namespace ebusd;
+using std::cout;
+using std::endl;
+
+static bool error = false;
+
+void verify(bool expectFailMatch, string type, string input,
+    bool match, string expectStr, string gotStr) {
+  if (expectFailMatch) {
+    if (match) {
+      error = true;
+      cout << "  failed " << type << " match >" << input
+              << "< error: unexpectedly succeeded" << endl;
+    } else {
+      cout << "  failed " << type << " match >" << input << "< OK" << endl;
+    }
+  } else if (match) {
+    cout << "  " << type << " match >" << input << "< OK" << endl;
+  } else {
+    error = true;
+    cout << "  " << type << " match >" << input << "< error: got >"
+            << gotStr << "<, expected >" << expectStr << "<" << endl;
+  }
+}
+
+DataFieldTemplates* templates = nullptr;
+
+namespace ebusd {
+
+DataFieldTemplates* getTemplates(const string& filename) {
+  return templates;
+}
+
+result_t loadDefinitionsFromConfigPath(FileReader* reader, const string& filename, bool verbose,
+    map<string, string>* defaults, string* errorDescription, bool replace = false) {
+  return RESULT_ERR_NOTFOUND;
+}
+
+}  // namespace ebusd
+
+/**
+ * A @a MessageUpdateListener counting the notified messages.
+ */
+class CountingListener : public MessageUpdateListener {
+ public:
+  CountingListener() : m_count(0), m_last(nullptr) {}
+
+  // @copydoc
+  void notifyMessageUpdate(const Message* message) override {
+    m_count++;
+    m_last = message;
+  }
+
+  /** the number of notified messages. */
+  size_t m_count;
+
+  /** the last notified @a Message. */
+  const Message* m_last;
+};
+
+/**
+ * Create a @a MessageMap with a single read message.
+ * @return the new @a MessageMap.
+ */
+static MessageMap* createMessages() {
+  MessageMap* messages = new MessageMap(true, "", false);
+  unsigned int lineNo = 0;
+  vector<string> row;
+  string errorDescription;
+  for (const auto line : {"#", "r,cir,first,,,08,B509,0d2800,,,UCH"}) {
+    std::istringstream stream(line);
+    messages->readLineFromStream(&stream, __FILE__, false, &lineNo, &row, &errorDescription, false, nullptr,
+        nullptr);
+  }
+  return messages;
+}
+
+int main() {
+  templates = new DataFieldTemplates();
+  std::ostringstream fileName;
+  fileName << "/tmp/ebusd_test_valuestore_" << getpid();
+  unlink(fileName.str().c_str());
+  MasterSymbolString master;
+  SlaveSymbolString slave;
+  master.parseHex("ff08b509030d2800");
+  slave.parseHex("012a");
+
+  // save the last data of an updated message
+  MessageMap* saving = createMessages();
+  Message* saved = saving->find(master);
+  ValueStore* store = new ValueStore(fileName.str());
+  bool savedOk = saved && saved->storeLastData(master, slave) == RESULT_OK;
+  if (savedOk) {
+    store->update(saved);
+  }
+  delete store;  // flushes the journal
+  verify(false, "save", "first", savedOk, "1", savedOk ? "1" : "0");
+
+  // restore it into another message map on the next start
+  MessageMap* restoring = createMessages();
+  CountingListener listener;
+  restoring->setUpdateListener(&listener);
+  store = new ValueStore(fileName.str());
+  size_t loaded = store->load();
+  size_t restored = store->restore(restoring);
+  Message* message = restoring->find(master);
+  bool restoreOk = savedOk && loaded == 1 && restored == 1 && message
+      && message->getLastSlaveData().compareTo(slave) == 0
+      && message->getLastUpdateTime() == saved->getLastUpdateTime();
+  verify(false, "restore", "first", restoreOk, "1", restoreOk ? "1" : "0");
+  bool notifyOk = listener.m_count == 1 && listener.m_last == message;
+  std::ostringstream notified;
+  notified << listener.m_count;
+  verify(false, "restore notify", "first", notifyOk, "1", notified.str());
+
+  // the data again is neither restored nor notified
+  restored = store->restore(restoring);
+  bool againOk = restored == 0 && listener.m_count == 1;
+  verify(false, "restore again", "first", againOk, "1", againOk ? "1" : "0");
+
+  // the unchanged restored data is not written to the journal again
+  if (message) {
+    store->update(message);
+  }
+  delete store;
+  std::ifstream journal(fileName.str().c_str());
+  size_t lines = 0;
+  string line;
+  while (getline(journal, line)) {
+    lines++;
+  }
+  std::ostringstream linesStr;
+  linesStr << lines;
+  verify(false, "journal", "first", lines == 1, "1", linesStr.str());
+
+  restoring->setUpdateListener(nullptr);
+  unlink(fileName.str().c_str());
+  delete restoring;
+  delete saving;
+  delete templates;
+  return error ? 1 : 0;
+}
@@ -0,0 +1,235 @@
+/*
+ * ebusd - daemon for communication with eBUS heating systems.
+ * Copyright (C) 2021 John Baier <ebusd@ebusd.eu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "ebusd/valuestore.h"
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include "lib/utils/log.h"
+
+namespace ebusd {
+
+using std::ifstream;
+using std::ofstream;
+using std::ostringstream;
+using std::vector;
+
+/** the separator of the fields in a journal line. */
+#define JOURNAL_SEPARATOR '\t'
+
+/** the number of fields in a journal line. */
+#define JOURNAL_FIELDS 7
+
+/**
+ * Split a journal line into its fields.
+ * @param line the journal line.
+ * @param fields the @a vector in which to store the fields.
+ * @return true when the expected number of fields was found.
+ */
+static bool splitLine(const string& line, vector<string>* fields) {
+  fields->clear();
+  size_t start = 0;
+  for (size_t pos = line.find(JOURNAL_SEPARATOR); ; pos = line.find(JOURNAL_SEPARATOR, start)) {
+    fields->push_back(line.substr(start, pos == string::npos ? string::npos : pos-start));
+    if (pos == string::npos) {
+      break;
+    }
+    start = pos+1;
+  }
+  return fields->size() == JOURNAL_FIELDS;
+}
+
+ValueStore::~ValueStore() {
+  join();
+  flush();
+}
+
+bool ValueStore::parseKey(const string& line, string* key) {
+  // updateTime, changeTime, type, circuit, name, master, slave
+  size_t start = line.find(JOURNAL_SEPARATOR);
+  if (start != string::npos) {
+    start = line.find(JOURNAL_SEPARATOR, start+1);
+  }
+  if (start == string::npos) {
+    return false;
+  }
+  size_t end = start;
+  for (int i = 0; i < 3 && end != string::npos; i++) {
+    end = line.find(JOURNAL_SEPARATOR, end+1);
+  }
+  if (end == string::npos) {
+    return false;
+  }
+  *key = line.substr(start+1, end-start-1);
+  return true;
+}
+
+size_t ValueStore::load() {
+  ifstream stream(m_fileName.c_str(), ifstream::in);
+  if (!stream.is_open()) {
+    return 0;
+  }
+  string line, key;
+  size_t lines = 0;
+  m_lock.lock();
+  while (getline(stream, line)) {
+    lines++;
+    if (parseKey(line, &key)) {
+      m_entries[key] = line;  // later lines supersede earlier ones
+    }
+  }
+  m_journalLines = lines;
+  size_t count = m_entries.size();
+  m_lock.unlock();
+  logInfo(lf_main, "loaded %d values from %s (%d lines)", count, m_fileName.c_str(), lines);
+  return count;
+}
+
+size_t ValueStore::restore(MessageMap* messages) {
+  m_lock.lock();
+  vector<string> lines;
+  lines.reserve(m_entries.size());
+  for (const auto& it : m_entries) {
+    lines.push_back(it.second);
+  }
+  m_lock.unlock();
+  vector<Message*> restored;
+  vector<string> fields;
+  messages->lock();
+  for (const auto& line : lines) {
+    if (!splitLine(line, &fields) || fields[2].length() != 1) {
+      continue;
+    }
+    char type = fields[2][0];
+    Message* message = messages->find(fields[3], fields[4], "*", type == 'w', type == 'u');
+    if (!message) {
+      continue;
+    }
+    MasterSymbolString master;
+    SlaveSymbolString slave;
+    if (master.parseHex(fields[5]) != RESULT_OK || slave.parseHex(fields[6]) != RESULT_OK) {
+      continue;
+    }
+    time_t updateTime = static_cast<time_t>(strtoll(fields[0].c_str(), nullptr, 10));
+    time_t changeTime = static_cast<time_t>(strtoll(fields[1].c_str(), nullptr, 10));
+    if (message->restoreLastData(master, slave, updateTime, changeTime) == RESULT_OK) {
+      restored.push_back(message);
+    }
+  }
+  messages->unlock();
+  // let the consumers know about the restored data like about any other update
+  for (const auto message : restored) {
+    messages->notifyUpdate(message);
+  }
+  size_t count = restored.size();
+  if (count > 0) {
+    logInfo(lf_main, "restored %d values from %s", count, m_fileName.c_str());
+  }
+  return count;
+}
+
+void ValueStore::update(const Message* message) {
+  if (message->getLastUpdateTime() == 0) {
+    return;
+  }
+  ostringstream key;
+  key << (message->isPassive() ? 'u' : message->isWrite() ? 'w' : 'r') << JOURNAL_SEPARATOR
+      << message->getCircuit() << JOURNAL_SEPARATOR << message->getName();
+  ostringstream line;
+  line << static_cast<int64_t>(message->getLastUpdateTime()) << JOURNAL_SEPARATOR
+       << static_cast<int64_t>(message->getLastChangeTime()) << JOURNAL_SEPARATOR
+       << key.str() << JOURNAL_SEPARATOR
+       << message->getLastMasterData().getStr() << JOURNAL_SEPARATOR
+       << message->getLastSlaveData().getStr();
+  m_lock.lock();
+  string& entry = m_entries[key.str()];
+  if (entry == line.str()) {
+    m_lock.unlock();
+    return;  // e.g. just restored
+  }
+  entry = line.str();
+  m_pending += entry;
+  m_pending += '\n';
+  m_lock.unlock();
+}
+
+void ValueStore::flush() {
+  m_lock.lock();
+  if (m_pending.empty()) {
+    m_lock.unlock();
+    return;
+  }
+  string pending;
+  pending.swap(m_pending);
+  size_t lines = m_journalLines;
+  for (const auto ch : pending) {
+    if (ch == '\n') {
+      lines++;
+    }
+  }
+  bool compact = lines > VALUESTORE_COMPACT_MIN && lines > m_entries.size()*VALUESTORE_COMPACT_FACTOR;
+  if (compact) {
+    // rewrite with only the latest line per message
+    pending.clear();
+    for (const auto& it : m_entries) {
+      pending += it.second;
+      pending += '\n';
+    }
+    lines = m_entries.size();
+  }
+  m_journalLines = lines;
+  m_lock.unlock();
+  if (!compact) {
+    ofstream out(m_fileName.c_str(), ofstream::out | ofstream::app);
+    if (out.is_open()) {
+      out << pending;
+      out.close();
+    }
+    if (out.fail()) {
+      logError(lf_main, "unable to append to value store %s", m_fileName.c_str());
+    }
+    return;
+  }
+  const string tempFile = m_fileName + ".tmp";
+  ofstream out(tempFile.c_str(), ofstream::out | ofstream::trunc);
+  if (out.is_open()) {
+    out << pending;
+    out.close();
+  }
+  if (out.fail() || rename(tempFile.c_str(), m_fileName.c_str()) != 0) {
+    unlink(tempFile.c_str());
+    logError(lf_main, "unable to compact value store %s", m_fileName.c_str());
+  } else {
+    logDebug(lf_main, "compacted value store %s to %d lines", m_fileName.c_str(), lines);
+  }
+}
+
+void ValueStore::run() {
+  while (Wait(VALUESTORE_FLUSH_INTERVAL)) {
+    flush();
+  }
+}
+
+}  // namespace ebusd
@@ -0,0 +1,126 @@
+/*
+ * ebusd - daemon for communication with eBUS heating systems.
+ * Copyright (C) 2021 John Baier <ebusd@ebusd.eu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EBUSD_VALUESTORE_H_
+#define EBUSD_VALUESTORE_H_
+
+#include <map>
+#include <string>
+#include "lib/ebus/message.h"
+#include "lib/utils/thread.h"
+
+namespace ebusd {
+
+/** @file ebusd/valuestore.h
+ * A persistent store of the last seen message data for a warm restart.
+ *
+ * The last master and slave data of each updated @a Message are appended to
+ * a journal file together with the update and change time. The journal is
+ * rewritten with only the latest line per message as soon as it grew far
+ * beyond the number of distinct messages.
+ */
+
+using std::map;
+using std::string;
+
+/** the interval in seconds for flushing the pending updates to the journal. */
+#define VALUESTORE_FLUSH_INTERVAL 10
+
+/** the minimum number of journal lines before compacting the journal. */
+#define VALUESTORE_COMPACT_MIN 1000
+
+/** the factor of journal lines per distinct message before compacting the journal. */
+#define VALUESTORE_COMPACT_FACTOR 4
+
+/**
+ * The persistent store of the last seen message data.
+ */
+class ValueStore : public WaitThread {
+ public:
+  /**
+   * Constructor.
+   * @param fileName the name of the journal file.
+   */
+  explicit ValueStore(const string& fileName)
+    : WaitThread(), m_fileName(fileName), m_journalLines(0) {}
+
+  /**
+   * Destructor.
+   */
+  virtual ~ValueStore();
+
+  /**
+   * Load the journal file.
+   * @return the number of distinct messages loaded.
+   */
+  size_t load();
+
+  /**
+   * Restore the loaded data into the matching messages unless these already have more recent data and notify the
+   * @a MessageMap about each restored message.
+   * @param messages the @a MessageMap to restore the data into.
+   * @return the number of restored messages.
+   */
+  size_t restore(MessageMap* messages);
+
+  /**
+   * Remember the last data of an updated @a Message for writing it to the journal on the next flush unless it is
+   * already stored.
+   * @param message the updated @a Message.
+   */
+  void update(const Message* message);
+
+  /**
+   * Write the pending updates to the journal file.
+   */
+  void flush();
+
+
+ protected:
+  // @copydoc
+  void run() override;
+
+
+ private:
+  /**
+   * Parse a journal line.
+   * @param line the journal line.
+   * @param key the string in which to store the message key.
+   * @return true on success, false if the line is malformed.
+   */
+  static bool parseKey(const string& line, string* key);
+
+  /** the name of the journal file. */
+  const string m_fileName;
+
+  /** the mutex for accessing the entries and pending updates. */
+  Mutex m_lock;
+
+  /** the latest journal line by message key. */
+  map<string, string> m_entries;
+
+  /** the pending journal lines not yet written to the file. */
+  string m_pending;
+
+  /** the number of lines in the journal file. */
+  size_t m_journalLines;
+};
+
+}  // namespace ebusd
+
+#endif  // EBUSD_VALUESTORE_H_
@@ -24,17 +24,12 @@
 #include <math.h>
 #include <iostream>
 #include <sstream>
-#include <iomanip>
 #include <vector>
 #include <cstring>
 #include "lib/ebus/datatype.h"
 
 namespace ebusd {
 
-using std::setfill;
-using std::setw;
-using std::dec;
-
 void contrib_tem_register() {
   DataTypeList::getInstance()->add(new TemParamDataType("TEM_P"));
 }
@@ -55,6 +50,14 @@ result_t TemParamDataType::derive(int divisor, size_t bitCount, const NumberData
 
 result_t TemParamDataType::readSymbols(size_t offset, size_t length, const SymbolString& input,
     OutputFormat outputFormat, ostream* output) const {
+  OutputBuffer buffer;
+  result_t result = appendSymbols(offset, length, input, outputFormat, &buffer);
+  output->write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+  return result;
+}
+
+result_t TemParamDataType::appendSymbols(size_t offset, size_t length, const SymbolString& input,
+    OutputFormat outputFormat, OutputBuffer* output) const {
   unsigned int value = 0;
 
   result_t result = readRawValue(offset, length, input, &value);
@@ -70,7 +73,7 @@ result_t TemParamDataType::readSymbols(size_t offset, size_t length, const Symbo
     }
     return RESULT_OK;
   }
-  int grp = 0, num = 0;
+  unsigned int grp = 0, num = 0;
   if (input.isMaster()) {
     grp = (value & 0x1f);  // grp in bits 0...5
     num = ((value >> 8) & 0x7f);  // num in bits 8...13
@@ -81,11 +84,12 @@ result_t TemParamDataType::readSymbols(size_t offset, size_t length, const Symbo
   if (outputFormat & OF_JSON) {
     *output << '"';
   }
-  *output << setfill('0') << setw(2) << dec << grp << '-' << setw(3) << num;
+  output->appendUnsigned(grp, 2);
+  *output << '-';
+  output->appendUnsigned(num, 3);
   if (outputFormat & OF_JSON) {
     *output << '"';
   }
-  *output << setfill(' ') << setw(0);  // reset
   return RESULT_OK;
 }
 
@@ -56,6 +56,10 @@ class TemParamDataType : public NumberDataType {
   result_t readSymbols(size_t offset, size_t length, const SymbolString& input,
       const OutputFormat outputFormat, ostream* output) const override;
 
+  // @copydoc
+  result_t appendSymbols(size_t offset, size_t length, const SymbolString& input,
+      const OutputFormat outputFormat, OutputBuffer* output) const override;
+
   // @copydoc
   result_t writeSymbols(size_t offset, size_t length, istringstream* input,
       SymbolString* output, size_t* usedLength) const override;
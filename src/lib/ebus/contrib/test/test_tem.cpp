@@ -69,8 +69,8 @@ class TestReader : public MappedFileReader {
     }
     return RESULT_OK;  // leave it to DataField::create
   }
-  result_t addFromFile(const string& filename, unsigned int lineNo, map<string, string>* row,
-      vector< map<string, string> >* subRows, string* errorDescription, bool replace) override {
+  result_t addFromFile(const string& filename, unsigned int lineNo, MappedRow* row,
+      vector<MappedRow>* subRows, string* errorDescription, bool replace) override {
     if (!row->empty() || subRows->empty()) {
       cout << "read line " << static_cast<unsigned>(lineNo) << ": read error: got "
           << static_cast<unsigned>(row->size()) << "/0 main, " << static_cast<unsigned>(subRows->size())
@@ -22,18 +22,24 @@
 
 #include "lib/ebus/data.h"
 #include <math.h>
+#include <cmath>
 #include <iostream>
 #include <sstream>
 #include <iomanip>
 #include <vector>
 #include <cstring>
 #include <algorithm>
+#include <map>
+#include <limits>
+#include <typeinfo>
+#include <unordered_map>
 
 namespace ebusd {
 
 using std::dec;
 using std::hex;
 using std::setw;
+using std::unordered_map;
 
 /** the week day names. */
 static const char* dayNames[] = {"Mon", "Tue", "Wed", "Thu", "Fri", "Sat", "Sun"};
@@ -50,6 +56,120 @@ static const char* defaultFieldsFieldMap[] = {
 };
 
 
+/** the @a Mutex for accessing the @a StringPool. */
+static Mutex& getStringPoolMutex() {
+  static Mutex mutex;
+  return mutex;
+}
+
+/** the interned strings of the @a StringPool with their reference count. */
+static unordered_map<string, size_t>& getPooledStrings() {
+  static unordered_map<string, size_t> strings;
+  return strings;
+}
+
+/** the interned attribute maps of the @a StringPool with their reference count. */
+static map<map<string, string>, size_t>& getPooledAttributes() {
+  static map<map<string, string>, size_t> attributes;
+  return attributes;
+}
+
+/** the approximate number of bytes used by the interned values of the @a StringPool. */
+static size_t g_pooledBytes = 0;
+
+/**
+ * Get the approximate number of bytes used by a string.
+ * @param str the string.
+ * @return the approximate number of bytes used.
+ */
+static size_t getUsedBytes(const string& str) {
+  // heap allocation only beyond the small string buffer
+  return sizeof(string) + (str.capacity() > 15 ? str.capacity() + 1 : 0);
+}
+
+/**
+ * Get the approximate number of bytes used by a pooled string.
+ * @param str the pooled string.
+ * @return the approximate number of bytes used.
+ */
+static size_t getPooledBytes(const string& str) {
+  return getUsedBytes(str) + sizeof(size_t) + 2 * sizeof(void*);  // including the count and the hash node
+}
+
+/**
+ * Get the approximate number of bytes used by a pooled attribute map.
+ * @param attributes the pooled attribute map.
+ * @return the approximate number of bytes used.
+ */
+static size_t getPooledBytes(const map<string, string>& attributes) {
+  size_t bytes = sizeof(map<string, string>) + sizeof(size_t) + 4 * sizeof(void*);  // including the tree node
+  for (const auto& entry : attributes) {
+    bytes += getUsedBytes(entry.first) + getUsedBytes(entry.second) + 4 * sizeof(void*);
+  }
+  return bytes;
+}
+
+const string& StringPool::intern(const string& str) {
+  Mutex& mutex = getStringPoolMutex();
+  mutex.lock();
+  auto result = getPooledStrings().emplace(str, 0);
+  if (result.second) {
+    g_pooledBytes += getPooledBytes(result.first->first);
+  }
+  result.first->second++;
+  const string& ret = result.first->first;
+  mutex.unlock();
+  return ret;
+}
+
+const map<string, string>& StringPool::intern(const map<string, string>& attributes) {
+  Mutex& mutex = getStringPoolMutex();
+  mutex.lock();
+  auto result = getPooledAttributes().emplace(attributes, 0);
+  if (result.second) {
+    g_pooledBytes += getPooledBytes(result.first->first);
+  }
+  result.first->second++;
+  const map<string, string>& ret = result.first->first;
+  mutex.unlock();
+  return ret;
+}
+
+void StringPool::release(const string& str) {
+  Mutex& mutex = getStringPoolMutex();
+  mutex.lock();
+  auto& strings = getPooledStrings();
+  auto it = strings.find(str);
+  if (it != strings.end() && --it->second == 0) {
+    g_pooledBytes -= getPooledBytes(it->first);
+    strings.erase(it);  // str is no longer valid from here on
+  }
+  mutex.unlock();
+}
+
+void StringPool::release(const map<string, string>& attributes) {
+  Mutex& mutex = getStringPoolMutex();
+  mutex.lock();
+  auto& pooled = getPooledAttributes();
+  auto it = pooled.find(attributes);
+  if (it != pooled.end() && --it->second == 0) {
+    g_pooledBytes -= getPooledBytes(it->first);
+    pooled.erase(it);  // attributes is no longer valid from here on
+  }
+  mutex.unlock();
+}
+
+size_t StringPool::getStatistics(size_t* strings, size_t* attributes) {
+  Mutex& mutex = getStringPoolMutex();
+  mutex.lock();
+  *strings = getPooledStrings().size();
+  *attributes = getPooledAttributes().size();
+  size_t bytes = g_pooledBytes;
+  mutex.unlock();
+  return bytes;
+}
+
+
 string AttributedItem::formatInt(size_t value) {
   ostringstream stream;
   stream << dec << static_cast<unsigned>(value);
@@ -77,35 +197,73 @@ void AttributedItem::dumpString(bool prependFieldSeparator, const string& str, o
   }
 }
 
-void AttributedItem::appendJson(bool prependFieldSeparator, const string& name, const string& value,
-    bool forceString, ostream* output) {
-  bool plain = !forceString && !value.empty();
-  if (plain) {
-    plain = value == "false" || value == "true";
-    if (!plain) {
-      const char* str = value.c_str();
-      char* strEnd = nullptr;
-      strtod(str, &strEnd);
-      plain = strEnd && !*strEnd;
+/**
+ * Return whether the value is a valid JSON number.
+ * @param value the value to check.
+ * @return true if the value is a valid JSON number.
+ */
+static bool isJsonNumber(const string& value) {
+  const char* str = value.c_str();
+  if (*str == '-') {
+    str++;
+  }
+  if (*str == '0') {
+    str++;
+  } else if (*str >= '1' && *str <= '9') {
+    while (*str >= '0' && *str <= '9') {
+      str++;
+    }
+  } else {
+    return false;
+  }
+  if (*str == '.') {
+    str++;
+    if (*str < '0' || *str > '9') {
+      return false;
+    }
+    while (*str >= '0' && *str <= '9') {
+      str++;
     }
   }
+  if (*str == 'e' || *str == 'E') {
+    str++;
+    if (*str == '+' || *str == '-') {
+      str++;
+    }
+    if (*str < '0' || *str > '9') {
+      return false;
+    }
+    while (*str >= '0' && *str <= '9') {
+      str++;
+    }
+  }
+  return *str == 0;
+}
+
+void AttributedItem::appendJson(bool prependFieldSeparator, const string& name, const string& value,
+    bool forceString, ostream* output) {
+  OutputBuffer buffer;
+  appendJson(prependFieldSeparator, name, value, forceString, &buffer);
+  output->write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+}
+
+void AttributedItem::appendJson(bool prependFieldSeparator, const string& name, const string& value,
+    bool forceString, OutputBuffer* output) {
+  bool plain = !forceString && !value.empty()
+    && (value == "false" || value == "true" || isJsonNumber(value));
   if (prependFieldSeparator) {
     *output << FIELD_SEPARATOR;
   }
-  *output << " \"" << name << "\": ";
+  *output << " \"";
+  output->appendJsonChars(name.data(), name.length());
+  *output << "\": ";
   if (plain) {
     *output << value;
-  } else {
-    *output << '"';
-    if (value.find_first_of('"') == string::npos) {  // check for nested '"'
-      *output << value;
-    } else {
-      string replaced = value;
-      replace(replaced.begin(), replaced.end(), '"', '\'');
-      *output << replaced;
-    }
-    *output << '"';
+    return;
   }
+  *output << '"';
+  output->appendJsonChars(value.data(), value.length());
+  *output << '"';
 }
 
 void AttributedItem::mergeAttributes(map<string, string>* attributes) const {
@@ -127,9 +285,10 @@ void AttributedItem::dumpAttribute(bool prependFieldSeparator, bool asJson, cons
 }
 
 bool AttributedItem::appendAttribute(OutputFormat outputFormat, const string& name, bool onlyIfNonEmpty,
-    const string& prefix, const string& suffix, ostream* output) const {
+    const string& prefix, const string& suffix, OutputBuffer* output) const {
+  static const string empty;
   const auto it = m_attributes.find(name);
-  string value = it == m_attributes.end() ? "" : it->second;
+  const string& value = it == m_attributes.end() ? empty : it->second;
   if (onlyIfNonEmpty && value.empty()) {
     return false;
   }
@@ -142,6 +301,13 @@ bool AttributedItem::appendAttribute(OutputFormat outputFormat, const string& na
 }
 
 bool AttributedItem::appendAttributes(OutputFormat outputFormat, ostream* output) const {
+  OutputBuffer buffer;
+  bool ret = appendAttributes(outputFormat, &buffer);
+  output->write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+  return ret;
+}
+
+bool AttributedItem::appendAttributes(OutputFormat outputFormat, OutputBuffer* output) const {
   bool ret = false;
   if ((outputFormat & OF_UNITS)) {
     ret = appendAttribute(outputFormat, "unit", true, "", "", output) || ret;
@@ -150,7 +316,7 @@ bool AttributedItem::appendAttributes(OutputFormat outputFormat, ostream* output
     ret = appendAttribute(outputFormat, "comment", true, "[", "]", output) || ret;
   }
   if (outputFormat & OF_ALL_ATTRS) {
-    for (const auto entry : m_attributes) {
+    for (const auto& entry : m_attributes) {
       ret = true;
       if (!entry.second.empty() && entry.first != "unit" && entry.first != "comment") {
         const string& key = entry.first;
@@ -159,7 +325,8 @@ bool AttributedItem::appendAttributes(OutputFormat outputFormat, ostream* output
             result_t result = RESULT_EMPTY;
             size_t addr = parseInt(entry.second.c_str(), 16, 0, 255, &result);
             if (result == RESULT_OK) {
-              *output << FIELD_SEPARATOR << " \"" << key << "\": " << addr;
+              *output << FIELD_SEPARATOR << " \"" << key << "\": ";
+              output->appendUnsigned(addr);
               continue;
             }
           }
@@ -180,7 +347,7 @@ string AttributedItem::getAttribute(const string& name) const {
 
 
 result_t DataField::create(bool isWriteMessage, bool isTemplate, bool isBroadcastOrMasterDestination,
-    size_t maxFieldLength, const DataFieldTemplates* templates, vector< map<string, string> >* rows,
+    size_t maxFieldLength, const DataFieldTemplates* templates, vector<MappedRow>* rows,
     string* errorDescription, const DataField** returnField) {
   // template: name[,part]basetype[:len]|template[:name][,[divisor|values][,[unit][,[comment]]]]
   // std: name[,part],basetype[:len]|template[:name][,[divisor|values][,[unit][,[comment]]]]
@@ -335,7 +502,7 @@ result_t DataField::create(bool isWriteMessage, bool isTemplate, bool isBroadcas
           *errorDescription = "field type "+typeName+" in field "+formatInt(fieldIndex);
         } else {
           SingleDataField* add = nullptr;
-          result = SingleDataField::create(firstType ? name : "", row, dataType, partType, length, divisor,
+          result = SingleDataField::create(firstType ? name : "", row.toMap(), dataType, partType, length, divisor,
             constantValue, verifyValue, &values, &add);
           if (add != nullptr) {
             fields.push_back(add);
@@ -358,12 +525,8 @@ result_t DataField::create(bool isWriteMessage, bool isTemplate, bool isBroadcas
         } else {
           fieldName = (firstType && lastType) ? name : "";
         }
-        if (lastType) {
-          result = templ->derive(fieldName, partType, divisor, values, &row, &fields);
-        } else {
-          map<string, string> attrs = row;  // don't let DataField::derive() consume the row
-          result = templ->derive(fieldName, partType, divisor, values, &attrs, &fields);
-        }
+        map<string, string> attrs = row.toMap();
+        result = templ->derive(fieldName, partType, divisor, values, &attrs, &fields);
         if (result != RESULT_OK) {
           *errorDescription = "derive field "+fieldName+" in field "+formatInt(fieldIndex);
         }
@@ -393,6 +556,15 @@ result_t DataField::create(bool isWriteMessage, bool isTemplate, bool isBroadcas
   return RESULT_OK;
 }
 
+result_t DataField::read(const SymbolString& data, size_t offset,
+    bool leadingSeparator, const char* fieldName, ssize_t fieldIndex,
+    OutputFormat outputFormat, ssize_t outputIndex, ostream* output) const {
+  OutputBuffer buffer;
+  result_t result = read(data, offset, leadingSeparator, fieldName, fieldIndex, outputFormat, outputIndex, &buffer);
+  output->write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+  return result;
+}
+
 const char* DataField::getDayName(int day) {
   if (day < 0 || day > 6) {
     return "";
@@ -505,8 +677,7 @@ result_t SingleDataField::read(const SymbolString& data, size_t offset,
   if ((data.isMaster() ? pt_masterData : pt_slaveData) != m_partType) {
     return RESULT_EMPTY;
   }
-  bool remainder = m_length == REMAIN_LEN && m_dataType->isAdjustableLength();
-  if (offset + (remainder?1:m_length) > data.getDataSize()) {
+  if (offset + (isRemainder()?1:m_length) > data.getDataSize()) {
     return RESULT_ERR_INVALID_POS;
   }
   if (isIgnored() || (fieldName != nullptr && m_name != fieldName) || fieldIndex > 0) {
@@ -518,20 +689,30 @@ result_t SingleDataField::read(const SymbolString& data, size_t offset,
 
 result_t SingleDataField::read(const SymbolString& data, size_t offset,
     bool leadingSeparator, const char* fieldName, ssize_t fieldIndex,
-    OutputFormat outputFormat, ssize_t outputIndex, ostream* output) const {
+    OutputFormat outputFormat, ssize_t outputIndex, OutputBuffer* output) const {
   if (m_partType == pt_any) {
     return RESULT_ERR_INVALID_PART;
   }
   if ((data.isMaster() ? pt_masterData : pt_slaveData) != m_partType) {
     return RESULT_OK;
   }
-  bool remainder = m_length == REMAIN_LEN && m_dataType->isAdjustableLength();
-  if (offset + (remainder?1:m_length) > data.getDataSize()) {
+  if (offset + (isRemainder()?1:m_length) > data.getDataSize()) {
     return RESULT_ERR_INVALID_POS;
   }
   if (isIgnored() || (fieldName != nullptr && m_name != fieldName) || fieldIndex > 0) {
     return RESULT_EMPTY;
   }
+  appendPrefix(leadingSeparator, fieldIndex, outputFormat, outputIndex, output);
+  result_t result = readSymbols(data, offset, outputFormat, output);
+  if (result != RESULT_OK) {
+    return result;
+  }
+  appendSuffix(outputFormat, output);
+  return RESULT_OK;
+}
+
+void SingleDataField::appendPrefix(bool leadingSeparator, ssize_t fieldIndex, OutputFormat outputFormat,
+    ssize_t outputIndex, OutputBuffer* output) const {
   bool shortFormat = outputFormat & OF_SHORT;
   if (outputFormat & OF_JSON) {
     if (leadingSeparator) {
@@ -542,7 +723,9 @@ result_t SingleDataField::read(const SymbolString& data, size_t offset,
     }
     if (outputIndex >= 0 || m_name.empty() || !(outputFormat & OF_NAMES)) {
       if (fieldIndex < 0) {
-        *output << "\"" << static_cast<signed int>(outputIndex < 0 ? 0 : outputIndex) << "\":";
+        *output << '"';
+        output->appendSigned(outputIndex < 0 ? 0 : outputIndex);
+        *output << "\":";
       }
       if (!shortFormat) {
         *output << " {\"name\": \"" << m_name << "\"" << ", \"value\": ";
@@ -563,20 +746,75 @@ result_t SingleDataField::read(const SymbolString& data, size_t offset,
       *output << m_name << "=";
     }
   }
+}
 
-  result_t result = readSymbols(data, offset, outputFormat, output);
+void SingleDataField::appendSuffix(OutputFormat outputFormat, OutputBuffer* output) const {
+  if (outputFormat & OF_SHORT) {
+    return;
+  }
+  appendAttributes(outputFormat, output);
+  if (outputFormat & OF_JSON) {
+    *output << "}";
+  }
+}
+
+/**
+ * Calculate the hash of a formatted field value.
+ * @param value the formatted value.
+ * @return the hash value (never 0 for distinguishing from an unset hash).
+ */
+static uint32_t hashValue(const string& value) {
+  uint32_t hash = 0x811c9dc5;  // 32 bit FNV-1a offset basis
+  for (const auto ch : value) {
+    hash ^= static_cast<uint8_t>(ch);
+    hash *= 0x01000193;  // 32 bit FNV-1a prime
+  }
+  return hash ? hash : 1;
+}
+
+result_t SingleDataField::hashFields(const SymbolString& data, size_t offset, vector<uint32_t>* hashes) const {
+  if (isIgnored() || (data.isMaster() ? pt_masterData : pt_slaveData) != m_partType) {
+    return RESULT_OK;
+  }
+  OutputBuffer value;
+  result_t result = read(data, offset, false, nullptr, -1, 0, -1, &value);
   if (result != RESULT_OK) {
     return result;
   }
-  if (!shortFormat) {
-    appendAttributes(outputFormat, output);
-  }
-  if (!shortFormat && (outputFormat & OF_JSON)) {
-    *output << "}";
+  if (hashes->empty()) {
+    hashes->resize(1);
   }
+  (*hashes)[0] = hashValue(value.str());
   return RESULT_OK;
 }
 
+/**
+ * Parse a value formatted with @a OF_NUMERIC.
+ * @param value the formatted value.
+ * @return the numeric value, or NaN if not numeric or not set.
+ */
+static double parseNumericValue(const string& value) {
+  char* end = nullptr;
+  double number = strtod(value.c_str(), &end);
+  if (value.empty() || end == nullptr || *end != 0 || !std::isfinite(number)) {
+    return std::numeric_limits<double>::quiet_NaN();
+  }
+  return number;
+}
+
+result_t SingleDataField::readNumericValues(const SymbolString& data, size_t offset, vector<double>* values) const {
+  if (isIgnored() || (data.isMaster() ? pt_masterData : pt_slaveData) != m_partType) {
+    return RESULT_OK;
+  }
+  OutputBuffer value;
+  result_t result = read(data, offset, false, nullptr, -1, OF_NUMERIC, -1, &value);
+  if (values->empty()) {
+    values->resize(1);
+  }
+  (*values)[0] = result == RESULT_OK ? parseNumericValue(value.str()) : std::numeric_limits<double>::quiet_NaN();
+  return result;
+}
+
 result_t SingleDataField::write(char separator, size_t offset, istringstream* input,
     SymbolString* data, size_t* usedLength) const {
   if (m_partType == pt_any) {
@@ -588,9 +826,23 @@ result_t SingleDataField::write(char separator, size_t offset, istringstream* in
   return writeSymbols(offset, input, data, usedLength);
 }
 
+result_t SingleDataField::writeValues(size_t offset, const FieldValues& values, size_t* valueIndex,
+    SymbolString* data, size_t* usedLength) const {
+  if (m_partType == pt_any) {
+    return RESULT_ERR_INVALID_PART;
+  }
+  if ((data->isMaster() ? pt_masterData : pt_slaveData) != m_partType) {
+    return RESULT_OK;
+  }
+  if (isIgnored() || *valueIndex >= values.size()) {
+    return writeValue(offset, FieldValue(string()), data, usedLength);  // same as empty input
+  }
+  return writeValue(offset, values[(*valueIndex)++], data, usedLength);
+}
+
 result_t SingleDataField::readSymbols(const SymbolString& input, size_t offset,
-    OutputFormat outputFormat, ostream* output) const {
-  return m_dataType->readSymbols(offset, m_length, input, outputFormat, output);
+    OutputFormat outputFormat, OutputBuffer* output) const {
+  return m_dataType->appendSymbols(offset, m_length, input, outputFormat, output);
 }
 
 result_t SingleDataField::writeSymbols(size_t offset, istringstream* input,
@@ -598,6 +850,11 @@ result_t SingleDataField::writeSymbols(size_t offset, istringstream* input,
   return m_dataType->writeSymbols(offset, m_length, input, output, usedLength);
 }
 
+result_t SingleDataField::writeValue(size_t offset, const FieldValue& value,
+    SymbolString* output, size_t* usedLength) const {
+  return m_dataType->writeValue(offset, m_length, value, output, usedLength);
+}
+
 const SingleDataField* SingleDataField::clone() const {
   return new SingleDataField(*this);
 }
@@ -643,8 +900,7 @@ size_t SingleDataField::getLength(PartType partType, size_t maxLength) const {
   if (partType != m_partType) {
     return 0;
   }
-  bool remainder = m_length == REMAIN_LEN && m_dataType->isAdjustableLength();
-  return remainder ? maxLength : m_length;
+  return isRemainder() ? maxLength : m_length;
 }
 
 bool SingleDataField::hasFullByteOffset(bool after, int16_t& previousFirstBit) const {
@@ -735,41 +991,48 @@ void ValueListDataField::dump(bool prependFieldSeparator, bool asJson, ostream*
 }
 
 result_t ValueListDataField::readSymbols(const SymbolString& input, size_t offset,
-    OutputFormat outputFormat, ostream* output) const {
+    OutputFormat outputFormat, OutputBuffer* output) const {
   unsigned int value = 0;
 
   result_t result = m_dataType->readRawValue(offset, m_length, input, &value);
   if (result != RESULT_OK) {
     return result;
   }
-  const auto it = m_values.find(value);
-  if (it == m_values.end() && value != m_dataType->getReplacement()) {
+  appendValue(value, m_values, m_dataType->getReplacement(), outputFormat, output);
+  return RESULT_OK;
+}
+
+void ValueListDataField::appendValue(unsigned int value, const map<unsigned int, string>& values,
+    unsigned int replacement, OutputFormat outputFormat, OutputBuffer* output) {
+  const auto it = values.find(value);
+  if (it == values.end() && value != replacement) {
     // fall back to raw value in input
-    *output << setw(0) << dec << value;
-    return RESULT_OK;
+    output->appendUnsigned(value);
+    return;
   }
-  if (it == m_values.end()) {
+  if (it == values.end()) {
     if (outputFormat & OF_JSON) {
       *output << "null";
-    } else if (value == m_dataType->getReplacement()) {
+    } else {
       *output << NULL_VALUE;
     }
   } else if (outputFormat & OF_NUMERIC) {
-    *output << setw(0) << dec << value;
+    output->appendUnsigned(value);
   } else if (outputFormat & OF_JSON) {
     if (outputFormat & OF_VALUENAME) {
-      *output << "{\"value\":" << setw(0) << dec << value;
+      *output << "{\"value\":";
+      output->appendUnsigned(value);
       *output << ",\"name\":\"" << it->second << "\"}";
     } else {
       *output << '"' << it->second << '"';
     }
   } else {
     if (outputFormat & OF_VALUENAME) {
-      *output << setw(0) << dec << value << '=';
+      output->appendUnsigned(value);
+      *output << '=';
     }
     *output << it->second;
   }
-  return RESULT_OK;
 }
 
 result_t ValueListDataField::writeSymbols(size_t offset, istringstream* input,
@@ -799,6 +1062,27 @@ result_t ValueListDataField::writeSymbols(size_t offset, istringstream* input,
   return RESULT_ERR_NOTFOUND;  // value assignment not found
 }
 
+result_t ValueListDataField::writeValue(size_t offset, const FieldValue& value,
+    SymbolString* output, size_t* usedLength) const {
+  if (value.getType() == fvt_string) {
+    istringstream input(value.getString());
+    return writeSymbols(offset, &input, output, usedLength);
+  }
+  const NumberDataType* numType = reinterpret_cast<const NumberDataType*>(m_dataType);
+  if (isIgnored() || value.getType() == fvt_null) {
+    // replacement value
+    return numType->writeRawValue(numType->getReplacement(), offset, m_length, output, usedLength);
+  }
+  double dvalue = value.getNumber();
+  if (dvalue >= 0 && dvalue < 4294967296.0) {
+    unsigned int rawValue = (unsigned int)dvalue;
+    if (m_values.find(rawValue) != m_values.end()) {
+      return numType->writeRawValue(rawValue, offset, m_length, output, usedLength);
+    }
+  }
+  return RESULT_ERR_NOTFOUND;  // value assignment not found
+}
+
 
 const ConstantDataField* ConstantDataField::clone() const {
   return new ConstantDataField(*this);
@@ -839,8 +1123,8 @@ void ConstantDataField::dump(bool prependFieldSeparator, bool asJson, ostream* o
 }
 
 result_t ConstantDataField::readSymbols(const SymbolString& input, size_t offset,
-    OutputFormat outputFormat, ostream* output) const {
-  ostringstream coutput;
+    OutputFormat outputFormat, OutputBuffer* output) const {
+  OutputBuffer coutput;
   result_t result = SingleDataField::readSymbols(input, offset, 0, &coutput);
   if (result != RESULT_OK) {
     return result;
@@ -861,6 +1145,11 @@ result_t ConstantDataField::writeSymbols(size_t offset, istringstream* input,
   return SingleDataField::writeSymbols(offset, &cinput, output, usedLength);
 }
 
+result_t ConstantDataField::writeValue(size_t offset, const FieldValue& value,
+    SymbolString* output, size_t* usedLength) const {
+  return writeSymbols(offset, nullptr, output, usedLength);  // the passed value is not used
+}
+
 
 DataFieldSet* DataFieldSet::s_identFields = nullptr;
 
@@ -923,6 +1212,63 @@ const DataFieldSet* DataFieldSet::clone() const {
   return new DataFieldSet(m_name, fields);
 }
 
+void DataFieldSet::compilePlan() {
+  m_plan.resize(m_fields.size());
+  size_t offsets[] = { 0, 0, 0 };
+  bool previousFullByteOffset[] = { true, true, true };
+  int16_t previousFirstBit[] = { -1, -1, -1 };
+  bool remainder[] = { false, false, false };
+  m_planFixed[pt_any] = false;
+  m_planFixed[pt_masterData] = m_planFixed[pt_slaveData] = true;
+  for (size_t index = 0; index < m_fields.size(); index++) {
+    const SingleDataField* field = m_fields[index];
+    PartType partType = field->getPartType();
+    if (remainder[partType]) {
+      m_planFixed[partType] = false;
+    }
+    if (!previousFullByteOffset[partType] && !field->hasFullByteOffset(false, previousFirstBit[partType])) {
+      offsets[partType]--;
+    }
+    PlanRecord& record = m_plan[index];
+    record.offset = offsets[partType];
+    record.length = field->isRemainder() ? 0 : field->getLength(partType, 0);
+    record.operation = po_field;
+    record.dataType = field->getDataType();
+    record.divisor = 1;
+    record.precision = 0;
+    record.values = nullptr;
+    // only the exact classes are decoded from the record, as a derived class might format differently
+    const DataType* dataType = record.dataType;
+    const NumberDataType* numType = typeid(*dataType) == typeid(NumberDataType)
+      ? static_cast<const NumberDataType*>(dataType) : nullptr;
+    if (field->isRemainder()) {
+      // length depends on the data
+    } else if (field->isIgnored()) {
+      record.operation = po_ignored;
+    } else if (typeid(*field) == typeid(ValueListDataField)) {
+      if (numType) {
+        record.operation = po_valueList;
+        record.values = &static_cast<const ValueListDataField*>(field)->getValues();
+      }
+    } else if (typeid(*field) != typeid(SingleDataField)) {
+      // e.g. constant value check
+    } else if (typeid(*dataType) == typeid(StringDataType)) {
+      record.operation = po_string;
+    } else if (numType && !numType->hasFlag(EXP) && !(numType->getBitCount() == 32 && numType->getDivisor() < 0)
+        && !(numType->hasFlag(FIX) && numType->hasFlag(BCD))) {
+      record.operation = po_number;
+      record.divisor = numType->getDivisor();
+      record.precision = numType->getPrecision();
+    }
+    if (field->isRemainder()) {
+      remainder[partType] = true;
+    } else {
+      offsets[partType] += field->getLength(partType, 0);
+    }
+    previousFullByteOffset[partType] = field->hasFullByteOffset(true, previousFirstBit[partType]);
+  }
+}
+
 size_t DataFieldSet::getLength(PartType partType, size_t maxLength) const {
   size_t length = 0;
   bool previousFullByteOffset[] = { true, true, true, true };
@@ -958,6 +1304,17 @@ size_t DataFieldSet::getCount(PartType partType, const char* fieldName) const {
   return count;
 }
 
+ssize_t DataFieldSet::getValueIndex(PartType partType, const char* fieldName) const {
+  ssize_t index = 0;
+  for (const auto field : m_fields) {
+    if (field->getCount(partType, fieldName) > 0) {
+      return index;
+    }
+    index += field->getCount(partType);
+  }
+  return -1;
+}
+
 string DataFieldSet::getName(ssize_t fieldIndex) const {
   if (fieldIndex < (ssize_t)m_ignoredCount) {
     return m_name;
@@ -1024,19 +1381,26 @@ result_t DataFieldSet::read(const SymbolString& data, size_t offset,
   bool previousFullByteOffset = true, found = false, findFieldIndex = fieldIndex >= 0;
   int16_t previousFirstBit = -1;
   PartType partType = data.isMaster() ? pt_masterData : pt_slaveData;
-  for (const auto field : m_fields) {
+  bool planned = m_planFixed[partType];
+  size_t baseOffset = offset;
+  for (size_t index = 0; index < m_fields.size(); index++) {
+    const SingleDataField* field = m_fields[index];
     if (field->getPartType() != partType) {
       continue;
     }
-    if (!previousFullByteOffset && !field->hasFullByteOffset(false, previousFirstBit)) {
+    if (planned) {
+      offset = baseOffset + m_plan[index].offset;
+    } else if (!previousFullByteOffset && !field->hasFullByteOffset(false, previousFirstBit)) {
       offset--;
     }
     result_t result = field->read(data, offset, fieldName, fieldIndex, output);
     if (result < RESULT_OK) {
       return result;
     }
-    offset += field->getLength(partType, data.getDataSize()-offset);
-    previousFullByteOffset = field->hasFullByteOffset(true, previousFirstBit);
+    if (!planned) {
+      offset += field->getLength(partType, data.getDataSize()-offset);
+      previousFullByteOffset = field->hasFullByteOffset(true, previousFirstBit);
+    }
     if (result != RESULT_EMPTY) {
       found = true;
     }
@@ -1060,30 +1424,41 @@ result_t DataFieldSet::read(const SymbolString& data, size_t offset,
 
 result_t DataFieldSet::read(const SymbolString& data, size_t offset,
     bool leadingSeparator, const char* fieldName, ssize_t fieldIndex,
-    OutputFormat outputFormat, ssize_t outputIndex, ostream* output) const {
+    OutputFormat outputFormat, ssize_t outputIndex, OutputBuffer* output) const {
   bool previousFullByteOffset = true, found = false, findFieldIndex = fieldIndex >= 0;
   int16_t previousFirstBit = -1;
   if (outputIndex < 0 && (!m_uniqueNames || ((outputFormat & OF_JSON) && !(outputFormat & OF_NAMES)))) {
     outputIndex = 0;
   }
   PartType partType = data.isMaster() ? pt_masterData : pt_slaveData;
-  for (const auto field : m_fields) {
+  bool planned = m_planFixed[partType];
+  size_t baseOffset = offset;
+  for (size_t index = 0; index < m_fields.size(); index++) {
+    const SingleDataField* field = m_fields[index];
     if (field->getPartType() != partType) {
       if (outputIndex >= 0 && !field->isIgnored()) {
         outputIndex++;
       }
       continue;
     }
-    if (!previousFullByteOffset && !field->hasFullByteOffset(false, previousFirstBit)) {
-      offset--;
+    result_t result;
+    if (planned) {
+      offset = baseOffset + m_plan[index].offset;
+      result = readPlanned(field, m_plan[index], data, offset, leadingSeparator, fieldName, fieldIndex,
+          outputFormat, outputIndex, output);
+    } else {
+      if (!previousFullByteOffset && !field->hasFullByteOffset(false, previousFirstBit)) {
+        offset--;
+      }
+      result = field->read(data, offset, leadingSeparator, fieldName, fieldIndex, outputFormat, outputIndex, output);
     }
-    result_t result = field->read(data, offset, leadingSeparator, fieldName, fieldIndex,
-        outputFormat, outputIndex, output);
     if (result < RESULT_OK) {
       return result;
     }
-    offset += field->getLength(partType, data.getDataSize()-offset);
-    previousFullByteOffset = field->hasFullByteOffset(true, previousFirstBit);
+    if (!planned) {
+      offset += field->getLength(partType, data.getDataSize()-offset);
+      previousFullByteOffset = field->hasFullByteOffset(true, previousFirstBit);
+    }
     if (result != RESULT_EMPTY) {
       found = true;
       leadingSeparator = true;
@@ -1108,6 +1483,140 @@ result_t DataFieldSet::read(const SymbolString& data, size_t offset,
   return RESULT_OK;
 }
 
+result_t DataFieldSet::readPlanned(const SingleDataField* field, const PlanRecord& record,
+    const SymbolString& data, size_t offset, bool leadingSeparator, const char* fieldName, ssize_t fieldIndex,
+    OutputFormat outputFormat, ssize_t outputIndex, OutputBuffer* output) const {
+  if (record.operation == po_field) {
+    return field->read(data, offset, leadingSeparator, fieldName, fieldIndex, outputFormat, outputIndex, output);
+  }
+  if (offset + record.length > data.getDataSize()) {
+    return RESULT_ERR_INVALID_POS;
+  }
+  if (record.operation == po_ignored || (fieldName != nullptr && field->getName(-1) != fieldName)
+      || fieldIndex > 0) {
+    return RESULT_EMPTY;
+  }
+  field->appendPrefix(leadingSeparator, fieldIndex, outputFormat, outputIndex, output);
+  result_t result;
+  if (record.operation == po_string) {
+    const StringDataType* strType = static_cast<const StringDataType*>(record.dataType);
+    result = strType->StringDataType::appendSymbols(offset, record.length, data, outputFormat, output);
+  } else {
+    const NumberDataType* numType = static_cast<const NumberDataType*>(record.dataType);
+    unsigned int rawValue = 0;
+    result = numType->NumberDataType::readRawValue(offset, record.length, data, &rawValue);
+    if (result == RESULT_OK && record.operation == po_valueList) {
+      ValueListDataField::appendValue(rawValue, *record.values, numType->getReplacement(), outputFormat, output);
+    } else if (result == RESULT_OK) {
+      int64_t value;
+      result = numType->convertRawValue(rawValue, &value);
+      if (result == RESULT_EMPTY) {
+        *output << ((outputFormat & OF_JSON) ? "null" : NULL_VALUE);
+        result = RESULT_OK;
+      } else if (result == RESULT_OK) {
+        output->appendFixed(value, record.divisor, record.precision);
+      }
+    }
+  }
+  if (result != RESULT_OK) {
+    return result;
+  }
+  field->appendSuffix(outputFormat, output);
+  return RESULT_OK;
+}
+
+result_t DataFieldSet::hashFields(const SymbolString& data, size_t offset, vector<uint32_t>* hashes) const {
+  bool previousFullByteOffset = true;
+  int16_t previousFirstBit = -1;
+  PartType partType = data.isMaster() ? pt_masterData : pt_slaveData;
+  bool planned = m_planFixed[partType];
+  size_t baseOffset = offset;
+  size_t fieldIndex = 0;
+  OutputBuffer value;
+  if (hashes->size() < m_fields.size() - m_ignoredCount) {
+    hashes->resize(m_fields.size() - m_ignoredCount);
+  }
+  for (size_t index = 0; index < m_fields.size(); index++) {
+    const SingleDataField* field = m_fields[index];
+    if (field->getPartType() != partType) {
+      if (!field->isIgnored()) {
+        fieldIndex++;
+      }
+      continue;
+    }
+    if (planned) {
+      offset = baseOffset + m_plan[index].offset;
+    } else if (!previousFullByteOffset && !field->hasFullByteOffset(false, previousFirstBit)) {
+      offset--;
+    }
+    if (!field->isIgnored()) {
+      value.clear();
+      result_t result;
+      if (planned) {
+        result = readPlanned(field, m_plan[index], data, offset, false, nullptr, -1, 0, -1, &value);
+      } else {
+        result = field->read(data, offset, false, nullptr, -1, 0, -1, &value);
+      }
+      if (result != RESULT_OK) {
+        return result;
+      }
+      (*hashes)[fieldIndex++] = hashValue(value.str());
+    }
+    if (!planned) {
+      offset += field->getLength(partType, data.getDataSize()-offset);
+      previousFullByteOffset = field->hasFullByteOffset(true, previousFirstBit);
+    }
+  }
+  return RESULT_OK;
+}
+
+result_t DataFieldSet::readNumericValues(const SymbolString& data, size_t offset, vector<double>* values) const {
+  bool previousFullByteOffset = true;
+  int16_t previousFirstBit = -1;
+  PartType partType = data.isMaster() ? pt_masterData : pt_slaveData;
+  bool planned = m_planFixed[partType];
+  size_t baseOffset = offset;
+  size_t fieldIndex = 0;
+  OutputBuffer value;
+  result_t ret = RESULT_OK;
+  if (values->size() < m_fields.size() - m_ignoredCount) {
+    values->resize(m_fields.size() - m_ignoredCount, std::numeric_limits<double>::quiet_NaN());
+  }
+  for (size_t index = 0; index < m_fields.size(); index++) {
+    const SingleDataField* field = m_fields[index];
+    if (field->getPartType() != partType) {
+      if (!field->isIgnored()) {
+        fieldIndex++;
+      }
+      continue;
+    }
+    if (planned) {
+      offset = baseOffset + m_plan[index].offset;
+    } else if (!previousFullByteOffset && !field->hasFullByteOffset(false, previousFirstBit)) {
+      offset--;
+    }
+    if (!field->isIgnored()) {
+      value.clear();
+      result_t result;
+      if (planned) {
+        result = readPlanned(field, m_plan[index], data, offset, false, nullptr, -1, OF_NUMERIC, -1, &value);
+      } else {
+        result = field->read(data, offset, false, nullptr, -1, OF_NUMERIC, -1, &value);
+      }
+      if (result != RESULT_OK && ret == RESULT_OK) {
+        ret = result;  // keep decoding the other fields
+      }
+      (*values)[fieldIndex++] = result == RESULT_OK ? parseNumericValue(value.str())
+        : std::numeric_limits<double>::quiet_NaN();
+    }
+    if (!planned) {
+      offset += field->getLength(partType, data.getDataSize()-offset);
+      previousFullByteOffset = field->hasFullByteOffset(true, previousFirstBit);
+    }
+  }
+  return ret;
+}
+
 result_t DataFieldSet::write(char separator, size_t offset, istringstream* input,
     SymbolString* data, size_t* usedLength) const {
   string token;
@@ -1149,6 +1658,35 @@ result_t DataFieldSet::write(char separator, size_t offset, istringstream* input
 }
 
 
+result_t DataFieldSet::writeValues(size_t offset, const FieldValues& values, size_t* valueIndex,
+    SymbolString* data, size_t* usedLength) const {
+  PartType partType = data->isMaster() ? pt_masterData : pt_slaveData;
+  bool previousFullByteOffset = true;
+  int16_t previousFirstBit = -1;
+  size_t baseOffset = offset;
+  for (const auto field : m_fields) {
+    if (field->getPartType() != partType) {
+      continue;
+    }
+    if (!previousFullByteOffset && !field->hasFullByteOffset(false, previousFirstBit)) {
+      offset--;
+    }
+    size_t fieldLength;
+    result_t result = field->writeValues(offset, values, valueIndex, data, &fieldLength);
+    if (result != RESULT_OK) {
+      return result;
+    }
+    offset += fieldLength;
+    previousFullByteOffset = field->hasFullByteOffset(true, previousFirstBit);
+  }
+
+  if (usedLength != nullptr) {
+    *usedLength = offset-baseOffset;
+  }
+  return RESULT_OK;
+}
+
+
 result_t LoadableDataFieldSet::getFieldMap(const string& preferLanguage, vector<string>* row,
     string* errorDescription) const {
   // *type,divisor/values,unit,comment
@@ -1214,8 +1752,8 @@ result_t LoadableDataFieldSet::getFieldMap(const string& preferLanguage, vector<
   return RESULT_OK;
 }
 
-result_t LoadableDataFieldSet::addFromFile(const string& filename, unsigned int lineNo, map<string, string>* row,
-    vector< map<string, string> >* subRows, string* errorDescription, bool replace) {
+result_t LoadableDataFieldSet::addFromFile(const string& filename, unsigned int lineNo, MappedRow* row,
+    vector<MappedRow>* subRows, string* errorDescription, bool replace) {
   const DataField* field = nullptr;
   result_t result = DataField::create(false, false, false, MAX_POS, m_templates, subRows, errorDescription, &field);
   if (result != RESULT_OK) {
@@ -1263,6 +1801,7 @@ result_t LoadableDataFieldSet::addFromFile(const string& filename, unsigned int
       }
     }
   }
+  compilePlan();
   return result;
 }
 
@@ -1387,8 +1926,8 @@ result_t DataFieldTemplates::getFieldMap(const string& preferLanguage, vector<st
   return RESULT_OK;
 }
 
-result_t DataFieldTemplates::addFromFile(const string& filename, unsigned int lineNo, map<string, string>* row,
-    vector< map<string, string> >* subRows, string* errorDescription, bool replace) {
+result_t DataFieldTemplates::addFromFile(const string& filename, unsigned int lineNo, MappedRow* row,
+    vector<MappedRow>* subRows, string* errorDescription, bool replace) {
   string name = (*row)["name"];  // required
   string firstFieldName;
   size_t colon = name.find(':');
@@ -1400,7 +1939,7 @@ result_t DataFieldTemplates::addFromFile(const string& filename, unsigned int li
   }
   const DataField* field = nullptr;
   if (!subRows->empty()) {
-    map<string, string>::iterator it = (*subRows)[0].find("name");
+    auto it = (*subRows)[0].find("name");
     if (it == (*subRows)[0].end() || it->second.empty()) {
       (*subRows)[0]["name"] = firstFieldName;
     }
@@ -25,6 +25,7 @@
 #include <fstream>
 #include <vector>
 #include <map>
+#include <unordered_map>
 #include <climits>
 #include "lib/ebus/symbol.h"
 #include "lib/ebus/result.h"
@@ -53,6 +54,50 @@ namespace ebusd {
 class DataFieldTemplates;
 class SingleDataField;
 
+/**
+ * A process wide pool of interned immutable strings and attribute maps for sharing among all @a AttributedItem
+ * instances (e.g. the names, units, and comments used by many messages and fields).
+ * Each interned value is reference counted and removed when the last holder released it, so values of deleted
+ * messages and fields (e.g. after a reload) do not stay in the pool.
+ */
+class StringPool {
+ public:
+  /**
+   * Intern a string.
+   * @param str the string to intern.
+   * @return the shared immutable instance equal to @a str.
+   */
+  static const string& intern(const string& str);
+
+  /**
+   * Intern an attribute map.
+   * @param attributes the attribute map to intern.
+   * @return the shared immutable instance equal to @a attributes.
+   */
+  static const map<string, string>& intern(const map<string, string>& attributes);
+
+  /**
+   * Release a string previously returned by @a intern().
+   * @param str the interned string (invalid afterwards when this was the last reference).
+   */
+  static void release(const string& str);
+
+  /**
+   * Release an attribute map previously returned by @a intern().
+   * @param attributes the interned attribute map (invalid afterwards when this was the last reference).
+   */
+  static void release(const map<string, string>& attributes);
+
+  /**
+   * Get the statistics of the pool.
+   * @param strings the variable in which to store the number of interned strings.
+   * @param attributes the variable in which to store the number of interned attribute maps.
+   * @return the approximate number of bytes used by the interned values.
+   */
+  static size_t getStatistics(size_t* strings, size_t* attributes);
+};
+
+
 /**
  * Base class for named items with optional named attributes.
  */
@@ -64,19 +109,29 @@ class AttributedItem {
    * @param attributes the additional named attributes.
    */
   AttributedItem(const string& name, const map<string, string>& attributes)
-    : m_name(name), m_attributes(attributes) {}
+    : m_name(StringPool::intern(name)), m_attributes(StringPool::intern(attributes)) {}
 
   /**
    * Constructs a new instance (without additional attributes).
    * @param name the field name.
    */
   explicit AttributedItem(const string& name)
-    : m_name(name) {}
+    : m_name(StringPool::intern(name)), m_attributes(StringPool::intern(map<string, string>())) {}
 
   /**
-   * Destructor.
+   * Copy constructor sharing the interned values of the other instance.
+   * @param other the instance to copy from.
    */
-  virtual ~AttributedItem() {}
+  AttributedItem(const AttributedItem& other)
+    : m_name(StringPool::intern(other.m_name)), m_attributes(StringPool::intern(other.m_attributes)) {}
+
+  /**
+   * Destructor releasing the interned values.
+   */
+  virtual ~AttributedItem() {
+    StringPool::release(m_name);
+    StringPool::release(m_attributes);
+  }
 
 
   /**
@@ -94,6 +149,14 @@ class AttributedItem {
    */
   static string pluck(const string& key, map<string, string>* row);
 
+  /**
+   * Remove and return a certain value from a @a MappedRow.
+   * @param key the name of the value to remove.
+   * @param row the @a MappedRow to remove the value from.
+   * @return the named value from the row, or empty if not available.
+   */
+  static string pluck(const string& key, MappedRow* row) { return row->pluck(key); }
+
   /**
    * Dump the @a string optionally embedded in @a TEXT_SEPARATOR to the output.
    * @param prependFieldSeparator whether to start with a @a FIELD_SEPARATOR.
@@ -113,6 +176,17 @@ class AttributedItem {
   static void appendJson(bool prependFieldSeparator, const string& name, const string& value,
       bool forceString, ostream* output);
 
+  /**
+   * Append a named attribute as JSON to the @a OutputBuffer.
+   * @param prependFieldSeparator whether to start with a @a FIELD_SEPARATOR.
+   * @param name the name of the attribute.
+   * @param value the value of the attribute.
+   * @param forceString true to force writing as string, false to detect the type from the value.
+   * @param output the @a OutputBuffer to append to.
+   */
+  static void appendJson(bool prependFieldSeparator, const string& name, const string& value,
+      bool forceString, OutputBuffer* output);
+
   /**
    * Merge this instance's additional named attributes into the specified attributes.
    * @param attributes the additional named attributes to merge in this instance's additional named attributes.
@@ -135,11 +209,11 @@ class AttributedItem {
    * @param onlyIfNonEmpty true to append only if the value is not empty.
    * @param prefix optional prefix to use (only for non-JSON output).
    * @param suffix optional suffix to use (only for non-JSON output).
-   * @param output the @a ostream to append the formatted value to.
+   * @param output the @a OutputBuffer to append the formatted value to.
    * @return true if data was added, false otherwise.
    */
   bool appendAttribute(OutputFormat outputFormat, const string& name, bool onlyIfNonEmpty,
-      const string& prefix, const string& suffix, ostream* output) const;
+      const string& prefix, const string& suffix, OutputBuffer* output) const;
 
   /**
    * Append the attributes to the output.
@@ -149,6 +223,14 @@ class AttributedItem {
    */
   bool appendAttributes(OutputFormat outputFormat, ostream* output) const;
 
+  /**
+   * Append the attributes to the @a OutputBuffer.
+   * @param outputFormat the @a OutputFormat options to use.
+   * @param output the @a OutputBuffer to append the formatted values to.
+   * @return true if data was added, false otherwise.
+   */
+  bool appendAttributes(OutputFormat outputFormat, OutputBuffer* output) const;
+
   /**
    * Get the item name.
    * @return the item name.
@@ -164,11 +246,11 @@ class AttributedItem {
 
 
  protected:
-  /** the field name. */
-  const string m_name;
+  /** the field name (interned in @a StringPool). */
+  const string& m_name;
 
-  /** the additional named attributes. */
-  const map<string, string> m_attributes;
+  /** the additional named attributes (interned in @a StringPool). */
+  const map<string, string>& m_attributes;
 };
 
 
@@ -223,7 +305,7 @@ class DataField : public AttributedItem {
    * Note: the caller needs to free the created instance.
    */
   static result_t create(bool isWriteMessage, bool isTemplate, bool isBroadcastOrMasterDestination,
-      size_t maxFieldLength, const DataFieldTemplates* templates, vector< map<string, string> >* rows,
+      size_t maxFieldLength, const DataFieldTemplates* templates, vector<MappedRow>* rows,
       string* errorDescription, const DataField** returnField);
 
   /**
@@ -270,6 +352,14 @@ class DataField : public AttributedItem {
    */
   virtual string getName(ssize_t fieldIndex) const = 0;
 
+  /**
+   * Get the index of the named field within @a FieldValues passed to @a writeValues().
+   * @param partType the message part of the field.
+   * @param fieldName the name of the field.
+   * @return the index of the field (excluding ignored fields and fields of other parts), or -1 if not available.
+   */
+  virtual ssize_t getValueIndex(PartType partType, const char* fieldName) const = 0;
+
   /**
    * Dump the field settings to the output.
    * @param prependFieldSeparator whether to start with a @a FIELD_SEPARATOR.
@@ -315,9 +405,48 @@ class DataField : public AttributedItem {
    * or @a RESULT_EMPTY if the field was skipped (either ignored or due to @a fieldName or @a fieldIndex),
    * or an error code.
    */
+  result_t read(const SymbolString& data, size_t offset,
+    bool leadingSeparator, const char* fieldName, ssize_t fieldIndex,
+    OutputFormat outputFormat, ssize_t outputIndex, ostream* output) const;
+
+  /**
+   * Reads the value from the @a SymbolString into an @a OutputBuffer.
+   * @param data the data @a SymbolString for reading binary data.
+   * @param offset the additional offset to add for reading binary data.
+   * @param leadingSeparator whether to prepend a separator before the formatted value.
+   * @param fieldName the optional name of a field to limit the output to.
+   * @param fieldIndex the optional index of the field to limit the output to (either named or overall), or -1.
+   * @param outputFormat the @a OutputFormat options to use.
+   * @param outputIndex the optional index of the field when using an indexed output format, or -1.
+   * @param output the @a OutputBuffer to append the formatted value to.
+   * @return @a RESULT_OK on success (or if the partType does not match),
+   * or @a RESULT_EMPTY if the field was skipped (either ignored or due to @a fieldName or @a fieldIndex),
+   * or an error code.
+   */
   virtual result_t read(const SymbolString& data, size_t offset,
     bool leadingSeparator, const char* fieldName, ssize_t fieldIndex,
-    OutputFormat outputFormat, ssize_t outputIndex, ostream* output) const = 0;
+    OutputFormat outputFormat, ssize_t outputIndex, OutputBuffer* output) const = 0;
+
+  /**
+   * Calculate a hash of the formatted value of each field stored in the part of the @a SymbolString.
+   * @param data the data @a SymbolString for reading binary data.
+   * @param offset the additional offset to add for reading binary data.
+   * @param hashes the @a vector with one hash per field (excluding ignored fields, see @a getCount()) to update
+   * for the fields stored in the part of @p data (other fields are left untouched).
+   * @return @a RESULT_OK on success, or an error code.
+   */
+  virtual result_t hashFields(const SymbolString& data, size_t offset, vector<uint32_t>* hashes) const = 0;
+
+  /**
+   * Decode the numeric value of each field stored in the part of the @a SymbolString in a single pass.
+   * @param data the data @a SymbolString for reading binary data.
+   * @param offset the additional offset to add for reading binary data.
+   * @param values the @a vector with one value per field (excluding ignored fields, see @a getCount()) to update
+   * for the fields stored in the part of @p data (other fields are left untouched). The value is NaN for a field
+   * that is not numeric, not set, or not decodable.
+   * @return @a RESULT_OK on success, or the error code of the first field not decodable.
+   */
+  virtual result_t readNumericValues(const SymbolString& data, size_t offset, vector<double>* values) const = 0;
 
   /**
    * Writes the value to the master or slave @a SymbolString.
@@ -330,6 +459,20 @@ class DataField : public AttributedItem {
    */
   virtual result_t write(char separator, size_t offset, istringstream* input,
     SymbolString* data, size_t* usedLength) const = 0;
+
+  /**
+   * Writes the typed values to the master or slave @a SymbolString.
+   * @param offset the additional offset to add for writing binary data.
+   * @param values the @a FieldValues indexed by field (excluding ignored fields, like the separated input of
+   * @a write()).
+   * @param valueIndex the variable with the index of the next value in @p values to use, updated for the
+   * consumed values.
+   * @param data the data @a SymbolString to write binary data to.
+   * @param usedLength the variable in which to store the used length in bytes, or nullptr.
+   * @return @a RESULT_OK on success, or an error code.
+   */
+  virtual result_t writeValues(size_t offset, const FieldValues& values, size_t* valueIndex,
+    SymbolString* data, size_t* usedLength) const = 0;
 };
 
 
@@ -378,12 +521,24 @@ class SingleDataField : public DataField {
       PartType partType, size_t length, int divisor, const string& constantValue,
       bool verifyValue, map<unsigned int, string>* values, SingleDataField** returnField);
 
+  /**
+   * Get the @a DataType of this field.
+   * @return the @a DataType of this field.
+   */
+  const DataType* getDataType() const { return m_dataType; }
+
   /**
    * Get whether this field is ignored.
    * @return whether this field is ignored.
    */
   bool isIgnored() const { return m_dataType->isIgnored(); }
 
+  /**
+   * Get whether this field consumes the remainder of the message part.
+   * @return whether this field consumes the remainder of the message part.
+   */
+  bool isRemainder() const { return m_length == REMAIN_LEN && m_dataType->isAdjustableLength(); }
+
   /**
    * Get the message part in which the field is stored.
    * @return the message part in which the field is stored.
@@ -417,6 +572,11 @@ class SingleDataField : public DataField {
     return isIgnored() || fieldIndex > 0 ? "" : m_name;
   }
 
+  // @copydoc
+  ssize_t getValueIndex(PartType partType, const char* fieldName) const override {
+    return getCount(partType, fieldName) > 0 ? 0 : -1;
+  }
+
   /**
    * Dump the common prefix field settings to the output (name and part type).
    * @param prependFieldSeparator whether to start with a @a FIELD_SEPARATOR.
@@ -435,9 +595,29 @@ class SingleDataField : public DataField {
   // @copydoc
   void dump(bool prependFieldSeparator, bool asJson, ostream* output) const override;
 
+  /**
+   * Append the common prefix of a read value to the output (separator, name, and JSON structure).
+   * @param leadingSeparator whether to prepend a separator before the formatted value.
+   * @param fieldIndex the optional index of the field the output is limited to, or -1.
+   * @param outputFormat the @a OutputFormat options to use.
+   * @param outputIndex the optional index of the field when using an indexed output format, or -1.
+   * @param output the @a OutputBuffer to append to.
+   */
+  void appendPrefix(bool leadingSeparator, ssize_t fieldIndex, OutputFormat outputFormat, ssize_t outputIndex,
+      OutputBuffer* output) const;
+
+  /**
+   * Append the common suffix of a read value to the output (attributes and JSON structure).
+   * @param outputFormat the @a OutputFormat options to use.
+   * @param output the @a OutputBuffer to append to.
+   */
+  void appendSuffix(OutputFormat outputFormat, OutputBuffer* output) const;
+
   // @copydoc
   bool hasField(const char* fieldName, bool numeric) const override;
 
+  using DataField::read;
+
   // @copydoc
   result_t read(const SymbolString& data, size_t offset,
       const char* fieldName, ssize_t fieldIndex, unsigned int* output) const override;
@@ -445,12 +625,22 @@ class SingleDataField : public DataField {
   // @copydoc
   result_t read(const SymbolString& data, size_t offset,
       bool leadingSeparator, const char* fieldName, ssize_t fieldIndex,
-      OutputFormat outputFormat, ssize_t outputIndex, ostream* output) const override;
+      OutputFormat outputFormat, ssize_t outputIndex, OutputBuffer* output) const override;
+
+  // @copydoc
+  result_t hashFields(const SymbolString& data, size_t offset, vector<uint32_t>* hashes) const override;
+
+  // @copydoc
+  result_t readNumericValues(const SymbolString& data, size_t offset, vector<double>* values) const override;
 
   // @copydoc
   result_t write(char separator, size_t offset, istringstream* input,
       SymbolString* data, size_t* usedLength) const override;
 
+  // @copydoc
+  result_t writeValues(size_t offset, const FieldValues& values, size_t* valueIndex,
+      SymbolString* data, size_t* usedLength) const override;
+
 
  protected:
   /**
@@ -458,11 +648,11 @@ class SingleDataField : public DataField {
    * @param input the @a SymbolString to read the binary value from.
    * @param offset the offset in the @a SymbolString.
    * @param outputFormat the @a OutputFormat options to use.
-   * @param output the ostream to append the formatted value to.
+   * @param output the @a OutputBuffer to append the formatted value to.
    * @return @a RESULT_OK on success, or an error code.
    */
   virtual result_t readSymbols(const SymbolString& input, size_t offset,
-      OutputFormat outputFormat, ostream* output) const;
+      OutputFormat outputFormat, OutputBuffer* output) const;
 
   /**
    * Internal method for writing the field to a @a SymbolString.
@@ -475,6 +665,17 @@ class SingleDataField : public DataField {
   virtual result_t writeSymbols(size_t offset, istringstream* input,
       SymbolString* output, size_t* usedLength) const;
 
+  /**
+   * Internal method for writing the typed value of the field to a @a SymbolString.
+   * @param offset the offset in the @a SymbolString.
+   * @param value the @a FieldValue to write.
+   * @param output the @a SymbolString to write the binary value to.
+   * @param usedLength the variable in which to store the used length in bytes, or nullptr.
+   * @return @a RESULT_OK on success, or an error code.
+   */
+  virtual result_t writeValue(size_t offset, const FieldValue& value,
+      SymbolString* output, size_t* usedLength) const;
+
   /** the message part in which the field is stored. */
   const PartType m_partType;
 
@@ -521,16 +722,37 @@ class ValueListDataField : public SingleDataField {
   // @copydoc
   void dump(bool prependFieldSeparator, bool asJson, ostream* output) const override;
 
+  /**
+   * Get the value=text assignments.
+   * @return the value=text assignments.
+   */
+  const map<unsigned int, string>& getValues() const { return m_values; }
+
+  /**
+   * Append the text assigned to the numeric raw value to the output.
+   * @param value the numeric raw value.
+   * @param values the value=text assignments.
+   * @param replacement the replacement value of the @a DataType.
+   * @param outputFormat the @a OutputFormat options to use.
+   * @param output the @a OutputBuffer to append to.
+   */
+  static void appendValue(unsigned int value, const map<unsigned int, string>& values, unsigned int replacement,
+      OutputFormat outputFormat, OutputBuffer* output);
+
 
  protected:
   // @copydoc
   result_t readSymbols(const SymbolString& input, size_t offset,
-      const OutputFormat outputFormat, ostream* output) const override;
+      const OutputFormat outputFormat, OutputBuffer* output) const override;
 
   // @copydoc
   result_t writeSymbols(size_t offset, istringstream* input,
       SymbolString* output, size_t* usedLength) const override;
 
+  // @copydoc
+  result_t writeValue(size_t offset, const FieldValue& value,
+      SymbolString* output, size_t* usedLength) const override;
+
 
  private:
   /** the value=text assignments. */
@@ -578,12 +800,16 @@ class ConstantDataField : public SingleDataField {
  protected:
   // @copydoc
   result_t readSymbols(const SymbolString& input, size_t offset,
-      const OutputFormat outputFormat, ostream* output) const override;
+      const OutputFormat outputFormat, OutputBuffer* output) const override;
 
   // @copydoc
   result_t writeSymbols(size_t offset, istringstream* input,
       SymbolString* output, size_t* usedLength) const override;
 
+  // @copydoc
+  result_t writeValue(size_t offset, const FieldValue& value,
+      SymbolString* output, size_t* usedLength) const override;
+
 
  private:
   /** the constant value. */
@@ -636,6 +862,7 @@ class DataFieldSet : public DataField {
     }
     m_uniqueNames = uniqueNames;
     m_ignoredCount = ignoredCount;
+    compilePlan();
   }
 
   /**
@@ -658,6 +885,9 @@ class DataFieldSet : public DataField {
   // @copydoc
   string getName(ssize_t fieldIndex) const override;
 
+  // @copydoc
+  ssize_t getValueIndex(PartType partType, const char* fieldName) const override;
+
   // @copydoc
   result_t derive(const string& name, PartType partType, int divisor,
       const map<unsigned int, string>& values, map<string, string>* attributes,
@@ -687,6 +917,8 @@ class DataFieldSet : public DataField {
   // @copydoc
   void dump(bool prependFieldSeparator, bool asJson, ostream* output) const override;
 
+  using DataField::read;
+
   // @copydoc
   result_t read(const SymbolString& data, size_t offset,
       const char* fieldName, ssize_t fieldIndex, unsigned int* output) const override;
@@ -694,18 +926,76 @@ class DataFieldSet : public DataField {
   // @copydoc
   result_t read(const SymbolString& data, size_t offset,
       bool leadingSeparator, const char* fieldName, ssize_t fieldIndex,
-      OutputFormat outputFormat, ssize_t outputIndex, ostream* output) const override;
+      OutputFormat outputFormat, ssize_t outputIndex, OutputBuffer* output) const override;
+
+  // @copydoc
+  result_t hashFields(const SymbolString& data, size_t offset, vector<uint32_t>* hashes) const override;
+
+  // @copydoc
+  result_t readNumericValues(const SymbolString& data, size_t offset, vector<double>* values) const override;
 
   // @copydoc
   result_t write(char separator, size_t offset, istringstream* input,
       SymbolString* data, size_t* usedLength) const override;
 
+  // @copydoc
+  result_t writeValues(size_t offset, const FieldValues& values, size_t* valueIndex,
+      SymbolString* data, size_t* usedLength) const override;
+
 
  private:
   /** the @a DataFieldSet containing the ident message @a SingleDataField instances, or nullptr. */
   static DataFieldSet* s_identFields;
 
  protected:
+  /**
+   * The operation of a @a PlanRecord.
+   */
+  enum PlanOperation {
+    po_number,     //!< numeric value of a @a NumberDataType with the divisor applied
+    po_valueList,  //!< text assigned to the numeric raw value of a @a ValueListDataField
+    po_string,     //!< characters or hex digits of a @a StringDataType
+    po_ignored,    //!< ignored field
+    po_field,      //!< decoded by the @a SingleDataField itself (fallback for all other fields)
+  };
+
+  /**
+   * A record of the decode plan for one field.
+   */
+  struct PlanRecord {
+    size_t offset;                             //!< the offset within the message part
+    size_t length;                             //!< the number of symbols
+    PlanOperation operation;                   //!< the decoding operation
+    const DataType* dataType;                  //!< the @a DataType to read the raw value with
+    int divisor;                               //!< the divisor (negative for reciprocal) for @a po_number
+    size_t precision;                          //!< the number of fractional digits for @a po_number
+    const map<unsigned int, string>* values;   //!< the value=text assignments for @a po_valueList, or nullptr
+  };
+
+  /**
+   * Compile the decode plan from the current @a m_fields, i.e. resolve the offset of each field within its message
+   * part and the operation for decoding it once instead of on each read.
+   */
+  void compilePlan();
+
+  /**
+   * Read the value of a single field using its @a PlanRecord (see @a DataField#read()).
+   * @param field the @a SingleDataField to read.
+   * @param record the @a PlanRecord of the field.
+   * @param data the data @a SymbolString for reading binary data.
+   * @param offset the offset of the field in the data.
+   * @param leadingSeparator whether to prepend a separator before the formatted value.
+   * @param fieldName the optional name of a field to limit the output to.
+   * @param fieldIndex the optional index of the field to limit the output to, or -1.
+   * @param outputFormat the @a OutputFormat options to use.
+   * @param outputIndex the optional index of the field when using an indexed output format, or -1.
+   * @param output the @a OutputBuffer to append the formatted value to.
+   * @return @a RESULT_OK on success, or @a RESULT_EMPTY if the field was skipped, or an error code.
+   */
+  result_t readPlanned(const SingleDataField* field, const PlanRecord& record, const SymbolString& data,
+      size_t offset, bool leadingSeparator, const char* fieldName, ssize_t fieldIndex, OutputFormat outputFormat,
+      ssize_t outputIndex, OutputBuffer* output) const;
+
   /** the @a vector of @a SingleDataField instances part of this set. */
   vector<const SingleDataField*> m_fields;
 
@@ -714,6 +1004,15 @@ class DataFieldSet : public DataField {
 
   /** the number of ignored fields. */
   size_t m_ignoredCount;
+
+  /** the decode plan with one @a PlanRecord for each field in @a m_fields. */
+  vector<PlanRecord> m_plan;
+
+  /**
+   * whether @a m_plan is usable for the message part (indexed by @a PartType), i.e. no field consuming the
+   * remainder is followed by another field in the same part.
+   */
+  bool m_planFixed[3];
 };
 
 
@@ -735,8 +1034,8 @@ class LoadableDataFieldSet : public DataFieldSet, public MappedFileReader {
   result_t getFieldMap(const string& preferLanguage, vector<string>* row, string* errorDescription) const override;
 
   // @copydoc
-  result_t addFromFile(const string& filename, unsigned int lineNo, map<string, string>* row,
-      vector< map<string, string> >* subRows, string* errorDescription, bool replace) override;
+  result_t addFromFile(const string& filename, unsigned int lineNo, MappedRow* row,
+      vector<MappedRow>* subRows, string* errorDescription, bool replace) override;
 
  private:
   /** the @a DataFieldTemplates instance to use. */
@@ -786,8 +1085,8 @@ class DataFieldTemplates : public MappedFileReader {
   result_t getFieldMap(const string& preferLanguage, vector<string>* row, string* errorDescription) const override;
 
   // @copydoc
-  result_t addFromFile(const string& filename, unsigned int lineNo, map<string, string>* row,
-      vector< map<string, string> >* subRows, string* errorDescription, bool replace) override;
+  result_t addFromFile(const string& filename, unsigned int lineNo, MappedRow* row,
+      vector<MappedRow>* subRows, string* errorDescription, bool replace) override;
 
   /**
    * Gets the template @a DataField instance with the specified name.
@@ -799,8 +1098,8 @@ class DataFieldTemplates : public MappedFileReader {
 
 
  private:
-  /** the known template @a DataField instances by name. */
-  map<string, const DataField*> m_fieldsByName;
+  /** the known template @a DataField instances by hashed name. */
+  std::unordered_map<string, const DataField*> m_fieldsByName;
 };
 
 }  // namespace ebusd
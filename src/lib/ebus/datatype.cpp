@@ -42,6 +42,19 @@ using std::setw;
 using std::endl;
 
 
+string FieldValue::str() const {
+  if (m_type == fvt_null) {
+    return NULL_VALUE;
+  }
+  if (m_type == fvt_string) {
+    return m_string;
+  }
+  ostringstream output;
+  output << setprecision(15) << m_number;
+  return output.str();
+}
+
+
 bool DataType::dump(bool asJson, size_t length, bool appendDivisor, ostream* output) const {
   if (asJson) {
     *output << "\"type\": \"" << m_id << "\"" << FIELD_SEPARATOR << " \"isbits\": "
@@ -68,6 +81,22 @@ bool DataType::dump(bool asJson, size_t length, bool appendDivisor, ostream* out
 }
 
 
+result_t DataType::appendSymbols(size_t offset, size_t length, const SymbolString& input,
+    OutputFormat outputFormat, OutputBuffer* output) const {
+  ostringstream value;
+  result_t result = readSymbols(offset, length, input, outputFormat, &value);
+  const string& str = value.str();
+  output->append(str.data(), str.length());
+  return result;
+}
+
+result_t DataType::writeValue(size_t offset, size_t length, const FieldValue& value,
+    SymbolString* output, size_t* usedLength) const {
+  istringstream input(value.str());
+  return writeSymbols(offset, length, &input, output, usedLength);
+}
+
+
 result_t StringDataType::readRawValue(size_t offset, size_t length, const SymbolString& input,
     unsigned int* value) const {
   return RESULT_EMPTY;
@@ -123,6 +152,56 @@ result_t StringDataType::readSymbols(size_t offset, size_t length, const SymbolS
   return RESULT_OK;
 }
 
+result_t StringDataType::appendSymbols(size_t offset, size_t length, const SymbolString& input,
+    OutputFormat outputFormat, OutputBuffer* output) const {
+  static const char* hexDigits = "0123456789abcdef";
+  size_t start = 0, count = length;
+  int incr = 1;
+  symbol_t symbol;
+  bool terminated = false;
+  if (count == REMAIN_LEN && input.getDataSize() > offset) {
+    count = input.getDataSize() - offset;
+  } else if (offset + count > input.getDataSize()) {
+    return RESULT_ERR_INVALID_POS;
+  }
+  if (hasFlag(REV)) {  // reverted binary representation (most significant byte first)
+    start = length - 1;
+    incr = -1;
+  }
+
+  if (outputFormat & OF_JSON) {
+    *output << '"';
+  }
+  for (size_t index = start, i = 0; i < count; index += incr, i++) {
+    symbol = input.dataAt(offset + index);
+    if (m_isHex) {
+      if (i > 0) {
+        *output << ' ';
+      }
+      *output << hexDigits[symbol >> 4] << hexDigits[symbol & 0x0f];
+    } else {
+      if (symbol == 0x00) {
+        terminated = true;
+      } else if (!terminated) {
+        if (symbol < 0x20) {
+          symbol = (symbol_t)m_replacement;
+        } else if (!isprint(symbol)) {
+          symbol = '?';
+        } else if (outputFormat & OF_JSON) {
+          if (symbol == '"' || symbol == '\\') {
+            *output << '\\';  // escape
+          }
+        }
+        *output << static_cast<char>(symbol);
+      }
+    }
+  }
+  if (outputFormat & OF_JSON) {
+    *output << '"';
+  }
+  return RESULT_OK;
+}
+
 result_t StringDataType::writeSymbols(size_t offset, size_t length, istringstream* input,
     SymbolString* output, size_t* usedLength) const {
   size_t start = 0, count = length;
@@ -591,6 +670,165 @@ result_t NumberDataType::derive(int divisor, size_t bitCount, const NumberDataTy
   return RESULT_OK;
 }
 
+/** the specialised reader function for the numeric raw value (same as @a NumberDataType::RawReader). */
+typedef result_t (*NumberRawReader)(const NumberDataType* type, size_t offset, const SymbolString& input,
+    unsigned int* value);
+
+/** the specialised writer function for the numeric raw value (same as @a NumberDataType::RawWriter). */
+typedef result_t (*NumberRawWriter)(const NumberDataType* type, unsigned int value, size_t offset,
+    SymbolString* output);
+
+/**
+ * Read the binary numeric raw value of a fixed length.
+ * @tparam Length the number of symbols.
+ * @tparam Reverse whether the most significant byte comes first.
+ * @tparam Bits whether to extract the bits defined by the first bit and bit count.
+ */
+template <size_t Length, bool Reverse, bool Bits>
+static result_t readBinaryRawValue(const NumberDataType* type, size_t offset, const SymbolString& input,
+    unsigned int* value) {
+  unsigned int val = 0;
+  for (size_t i = 0; i < Length; i++) {
+    val |= static_cast<unsigned int>(input.dataAt(offset + (Reverse ? Length - 1 - i : i))) << (8 * i);
+  }
+  if (Bits) {
+    val = (val >> type->getFirstBit()) & ((1 << type->getBitCount()) - 1);
+  }
+  *value = val;
+  return RESULT_OK;
+}
+
+/**
+ * Read the BCD or HCD numeric raw value of a fixed length.
+ * @tparam Length the number of symbols.
+ * @tparam Reverse whether the most significant byte comes first.
+ * @tparam Hcd whether each symbol holds the decimal value directly instead of two BCD digits.
+ */
+template <size_t Length, bool Reverse, bool Hcd>
+static result_t readBcdRawValue(const NumberDataType* type, size_t offset, const SymbolString& input,
+    unsigned int* value) {
+  bool checkReplacement = !type->hasFlag(REQ);
+  symbol_t replacement = (symbol_t)(type->getReplacement() & 0xff);
+  unsigned int val = 0, exp = 1;
+  for (size_t i = 0; i < Length; i++) {
+    symbol_t symbol = input.dataAt(offset + (Reverse ? Length - 1 - i : i));
+    if (checkReplacement && symbol == replacement) {
+      *value = type->getReplacement();
+      return RESULT_OK;
+    }
+    if (!Hcd) {
+      if ((symbol & 0xf0) > 0x90 || (symbol & 0x0f) > 0x09) {
+        return RESULT_ERR_OUT_OF_RANGE;  // invalid BCD
+      }
+      symbol = (symbol_t)((symbol >> 4) * 10 + (symbol & 0x0f));
+    } else if (symbol > 0x63) {
+      return RESULT_ERR_OUT_OF_RANGE;  // invalid HCD
+    }
+    val += symbol * exp;
+    exp *= 100;
+  }
+  *value = val;
+  return RESULT_OK;
+}
+
+/**
+ * Write the binary or BCD/HCD numeric raw value of a fixed length of full bytes.
+ * @tparam Length the number of symbols.
+ * @tparam Reverse whether the most significant byte comes first.
+ * @tparam Bcd whether to write BCD or HCD instead of binary.
+ * @tparam Hcd whether each symbol holds the decimal value directly instead of two BCD digits.
+ */
+template <size_t Length, bool Reverse, bool Bcd, bool Hcd>
+static result_t writeFixedRawValue(const NumberDataType* type, unsigned int value, size_t offset,
+    SymbolString* output) {
+  bool replace = Bcd && !type->hasFlag(REQ) && value == type->getReplacement();
+  unsigned int exp = 1;
+  for (size_t i = 0; i < Length; i++) {
+    symbol_t symbol;
+    if (!Bcd) {
+      symbol = (symbol_t)((value >> (8 * i)) & 0xff);
+    } else if (replace) {
+      symbol = (symbol_t)(type->getReplacement() & 0xff);
+    } else {
+      symbol = (symbol_t)((value / exp) % 100);
+      if (!Hcd) {
+        symbol = (symbol_t)(((symbol / 10) << 4) | (symbol % 10));
+      }
+      exp *= 100;
+    }
+    output->dataAt(offset + (Reverse ? Length - 1 - i : i)) = symbol;
+  }
+  return RESULT_OK;
+}
+
+/**
+ * Select the specialised reader for the number of symbols.
+ * @tparam Length the number of symbols.
+ */
+template <size_t Length>
+static NumberRawReader selectRawReaderForLength(size_t bitCount, uint16_t flags) {
+  bool reverse = (flags & REV) != 0;
+  if (flags & BCD) {
+    if (flags & HCD) {
+      return reverse ? readBcdRawValue<Length, true, true> : readBcdRawValue<Length, false, true>;
+    }
+    return reverse ? readBcdRawValue<Length, true, false> : readBcdRawValue<Length, false, false>;
+  }
+  if ((bitCount % 8) != 0) {
+    return Length == 1 ? readBinaryRawValue<1, false, true> : nullptr;
+  }
+  return reverse ? readBinaryRawValue<Length, true, false> : readBinaryRawValue<Length, false, false>;
+}
+
+/**
+ * Select the specialised writer for the number of symbols.
+ * @tparam Length the number of symbols.
+ */
+template <size_t Length>
+static NumberRawWriter selectRawWriterForLength(size_t bitCount, uint16_t flags) {
+  if ((bitCount % 8) != 0) {
+    return nullptr;  // partial bytes are merged with the neighbouring field by the generic implementation
+  }
+  bool reverse = (flags & REV) != 0;
+  if (flags & BCD) {
+    if (flags & HCD) {
+      return reverse ? writeFixedRawValue<Length, true, true, true> : writeFixedRawValue<Length, false, true, true>;
+    }
+    return reverse ? writeFixedRawValue<Length, true, true, false> : writeFixedRawValue<Length, false, true, false>;
+  }
+  return reverse ? writeFixedRawValue<Length, true, false, false> : writeFixedRawValue<Length, false, false, false>;
+}
+
+NumberDataType::RawReader NumberDataType::selectRawReader(size_t bitCount, uint16_t flags) {
+  switch ((bitCount + 7) / 8) {
+  case 1:
+    return selectRawReaderForLength<1>(bitCount, flags);
+  case 2:
+    return selectRawReaderForLength<2>(bitCount, flags);
+  case 3:
+    return selectRawReaderForLength<3>(bitCount, flags);
+  case 4:
+    return selectRawReaderForLength<4>(bitCount, flags);
+  default:
+    return nullptr;
+  }
+}
+
+NumberDataType::RawWriter NumberDataType::selectRawWriter(size_t bitCount, uint16_t flags) {
+  switch ((bitCount + 7) / 8) {
+  case 1:
+    return selectRawWriterForLength<1>(bitCount, flags);
+  case 2:
+    return selectRawWriterForLength<2>(bitCount, flags);
+  case 3:
+    return selectRawWriterForLength<3>(bitCount, flags);
+  case 4:
+    return selectRawWriterForLength<4>(bitCount, flags);
+  default:
+    return nullptr;
+  }
+}
+
 result_t NumberDataType::readRawValue(size_t offset, size_t length, const SymbolString& input,
     unsigned int* value) const {
   size_t start = 0, count = length;
@@ -600,6 +838,9 @@ result_t NumberDataType::readRawValue(size_t offset, size_t length, const Symbol
   if (offset + length > input.getDataSize()) {
     return RESULT_ERR_INVALID_POS;  // not enough data available
   }
+  if (m_rawReader && length == m_rawLength) {
+    return m_rawReader(this, offset, input, value);
+  }
   if (hasFlag(REV)) {  // reverted binary representation (most significant byte first)
     start = length - 1;
     incr = -1;
@@ -756,6 +997,68 @@ result_t NumberDataType::readSymbols(size_t offset, size_t length, const SymbolS
   return RESULT_OK;
 }
 
+result_t NumberDataType::readSignedValue(size_t offset, size_t length, const SymbolString& input,
+    int64_t* value) const {
+  unsigned int rawValue = 0;
+  result_t result = readRawValue(offset, length, input, &rawValue);
+  if (result != RESULT_OK) {
+    return result;
+  }
+  return convertRawValue(rawValue, value);
+}
+
+result_t NumberDataType::convertRawValue(unsigned int rawValue, int64_t* value) const {
+  if (!hasFlag(REQ) && rawValue == m_replacement) {
+    return RESULT_EMPTY;
+  }
+  if (hasFlag(SIG) && (rawValue & (1 << (m_bitCount - 1))) != 0) {  // negative signed value
+    if (rawValue < m_minValue) {
+      return RESULT_ERR_OUT_OF_RANGE;  // value out of range
+    }
+    if (m_bitCount == 32) {
+      *value = static_cast<int>(rawValue);
+    } else {
+      *value = static_cast<int64_t>(rawValue) - (static_cast<int64_t>(1) << m_bitCount);
+    }
+    return RESULT_OK;
+  }
+  if ((!hasFlag(SIG) && rawValue < m_minValue) || rawValue > m_maxValue) {
+    return RESULT_ERR_OUT_OF_RANGE;  // value out of range
+  }
+  *value = rawValue;
+  return RESULT_OK;
+}
+
+result_t NumberDataType::appendSymbols(size_t offset, size_t length, const SymbolString& input,
+    OutputFormat outputFormat, OutputBuffer* output) const {
+  if (hasFlag(EXP) || (m_bitCount == 32 && m_divisor < 0)) {
+    // float formatting of the stream
+    return DataType::appendSymbols(offset, length, input, outputFormat, output);
+  }
+  int64_t value;
+  result_t result = readSignedValue(offset, length, input, &value);
+  if (result == RESULT_EMPTY) {
+    *output << ((outputFormat & OF_JSON) ? "null" : NULL_VALUE);
+    return RESULT_OK;
+  }
+  if (result != RESULT_OK) {
+    return result;
+  }
+  if (m_divisor >= 0 && m_divisor <= 1 && m_bitCount < 32 && hasFlag(FIX) && hasFlag(BCD)) {
+    bool json = (outputFormat & OF_JSON) != 0;
+    if (json) {
+      *output << '"';
+    }
+    output->appendUnsigned(static_cast<uint64_t>(value), length * 2);
+    if (json) {
+      *output << '"';
+    }
+    return RESULT_OK;
+  }
+  output->appendFixed(value, m_divisor, m_precision);
+  return RESULT_OK;
+}
+
 result_t NumberDataType::writeRawValue(unsigned int value, size_t offset, size_t length,
     SymbolString* output, size_t* usedLength) const {
   size_t start = 0, count = length;
@@ -765,6 +1068,13 @@ result_t NumberDataType::writeRawValue(unsigned int value, size_t offset, size_t
   if (m_bitCount < 8 && (value & ~((1 << m_bitCount) - 1)) != 0) {
     return RESULT_ERR_OUT_OF_RANGE;
   }
+  if (m_rawWriter && length == m_rawLength) {
+    result_t result = m_rawWriter(this, value, offset, output);
+    if (result == RESULT_OK && usedLength != nullptr) {
+      *usedLength = length;
+    }
+    return result;
+  }
   if (m_firstBit > 0) {
     value <<=  m_firstBit;
   }
@@ -801,22 +1111,8 @@ result_t NumberDataType::writeRawValue(unsigned int value, size_t offset, size_t
   return RESULT_OK;
 }
 
-result_t NumberDataType::writeSymbols(size_t offset, size_t length, istringstream* input,
-    SymbolString* output, size_t* usedLength) const {
-  unsigned int value;
-
-  const string inputStr = input->str();
-  if (!hasFlag(REQ) && (isIgnored() || inputStr == NULL_VALUE)) {
-    value = m_replacement;  // replacement value
-  } else if (inputStr.empty()) {
-    return RESULT_ERR_EOF;  // input too short
-  } else if (hasFlag(EXP)) {  // IEEE 754 binary32
-    const char* str = inputStr.c_str();
-    char* strEnd = nullptr;
-    double dvalue = strtod(str, &strEnd);
-    if (strEnd == nullptr || strEnd == str || *strEnd != 0) {
-      return RESULT_ERR_INVALID_NUM;  // invalid value
-    }
+result_t NumberDataType::convertValue(double dvalue, size_t length, unsigned int* value) const {
+  if (hasFlag(EXP)) {  // IEEE 754 binary32
     if (m_divisor < 0) {
       dvalue /= -m_divisor;
     } else if (m_divisor > 1) {
@@ -825,12 +1121,12 @@ result_t NumberDataType::writeSymbols(size_t offset, size_t length, istringstrea
 #ifdef HAVE_DIRECT_FLOAT_FORMAT
     float val = static_cast<float>(dvalue);
     symbol_t* pval = reinterpret_cast<symbol_t*>(&val);
-    value = *reinterpret_cast<int32_t*>(pval);
+    *value = *reinterpret_cast<int32_t*>(pval);
 #  if HAVE_DIRECT_FLOAT_FORMAT == 2
-    value = __builtin_bswap32(value);
+    *value = __builtin_bswap32(*value);
 #  endif
 #else
-    value = 0;
+    *value = 0;
     if (dvalue != 0) {
       bool negative = dvalue < 0;
       if (negative) {
@@ -843,71 +1139,138 @@ result_t NumberDataType::writeSymbols(size_t offset, size_t length, istringstrea
       dvalue = scalbln(dvalue, -exp) - 1.0;
       unsigned int sig = (unsigned int)(dvalue * exp2(23));
       exp += 127;
-      value = (exp << 23) | sig;
+      *value = (exp << 23) | sig;
       if (negative) {
-        value |= 0x80000000;
+        *value |= 0x80000000;
       }
     }
 #endif
+    return RESULT_OK;
+  }
+  if (m_divisor < 0) {
+    dvalue = round(dvalue / -m_divisor);
+  } else {
+    dvalue = round(dvalue * m_divisor);
+  }
+  if (hasFlag(SIG)) {
+    if (dvalue < -exp2((8 * static_cast<double>(length)) - 1)
+        || dvalue >= exp2((8 * static_cast<double>(length)) - 1)) {
+      return RESULT_ERR_OUT_OF_RANGE;  // value out of range
+    }
+    if (dvalue < 0 && m_bitCount != 32) {
+      *value = static_cast<int>(dvalue + (1 << m_bitCount));
+    } else {
+      *value = static_cast<int>(dvalue);
+    }
+  } else {
+    if (dvalue < 0.0 || dvalue >= exp2(8 * static_cast<double>(length))) {
+      return RESULT_ERR_OUT_OF_RANGE;  // value out of range
+    }
+    *value = (unsigned int)dvalue;
+  }
+  return checkRange(*value);
+}
+
+result_t NumberDataType::checkRange(unsigned int value) const {
+  if (hasFlag(SIG)) {  // signed value
+    if ((value & (1 << (m_bitCount - 1))) != 0) {  // negative signed value
+      if (value < m_minValue) {
+        return RESULT_ERR_OUT_OF_RANGE;  // value out of range
+      }
+    } else if (value > m_maxValue) {
+      return RESULT_ERR_OUT_OF_RANGE;  // value out of range
+    }
+  } else if (value < m_minValue || value > m_maxValue) {
+    return RESULT_ERR_OUT_OF_RANGE;  // value out of range
+  }
+  return RESULT_OK;
+}
+
+result_t NumberDataType::writeSymbols(size_t offset, size_t length, istringstream* input,
+    SymbolString* output, size_t* usedLength) const {
+  unsigned int value;
+
+  const string inputStr = input->str();
+  if (!hasFlag(REQ) && (isIgnored() || inputStr == NULL_VALUE)) {
+    value = m_replacement;  // replacement value
+  } else if (inputStr.empty()) {
+    return RESULT_ERR_EOF;  // input too short
+  } else if (hasFlag(EXP) || m_divisor != 1) {
+    const char* str = inputStr.c_str();
+    char* strEnd = nullptr;
+    double dvalue = strtod(str, &strEnd);
+    if (strEnd == nullptr || strEnd == str || *strEnd != 0) {
+      return RESULT_ERR_INVALID_NUM;  // invalid value
+    }
+    result_t result = convertValue(dvalue, length, &value);
+    if (result != RESULT_OK) {
+      return result;
+    }
   } else {
     const char* str = inputStr.c_str();
     char* strEnd = nullptr;
-    if (m_divisor == 1) {
-      if (hasFlag(SIG)) {
-        long signedValue = strtol(str, &strEnd, 10);
-        if (signedValue < 0 && m_bitCount != 32) {
-          value = (unsigned int)(signedValue + (1 << m_bitCount));
-        } else {
-          value = (unsigned int)signedValue;
-        }
+    if (hasFlag(SIG)) {
+      long signedValue = strtol(str, &strEnd, 10);
+      if (signedValue < 0 && m_bitCount != 32) {
+        value = (unsigned int)(signedValue + (1 << m_bitCount));
       } else {
-        value = (unsigned int)strtoul(str, &strEnd, 10);
-      }
-      if (strEnd == nullptr || strEnd == str || (*strEnd != 0 && *strEnd != '.')) {
-        return RESULT_ERR_INVALID_NUM;  // invalid value
+        value = (unsigned int)signedValue;
       }
     } else {
-      double dvalue = strtod(str, &strEnd);
-      if (strEnd == nullptr || strEnd == str || *strEnd != 0) {
-        return RESULT_ERR_INVALID_NUM;  // invalid value
-      }
-      if (m_divisor < 0) {
-        dvalue = round(dvalue / -m_divisor);
-      } else {
-        dvalue = round(dvalue * m_divisor);
+      value = (unsigned int)strtoul(str, &strEnd, 10);
+    }
+    if (strEnd == nullptr || strEnd == str || (*strEnd != 0 && *strEnd != '.')) {
+      return RESULT_ERR_INVALID_NUM;  // invalid value
+    }
+    result_t result = checkRange(value);
+    if (result != RESULT_OK) {
+      return result;
+    }
+  }
+
+  return writeRawValue(value, offset, length, output, usedLength);
+}
+
+result_t NumberDataType::writeValue(size_t offset, size_t length, const FieldValue& value,
+    SymbolString* output, size_t* usedLength) const {
+  if (value.getType() == fvt_string) {
+    return DataType::writeValue(offset, length, value, output, usedLength);
+  }
+  unsigned int rawValue;
+  if (!hasFlag(REQ) && (isIgnored() || value.getType() == fvt_null)) {
+    rawValue = m_replacement;  // replacement value
+  } else if (value.getType() == fvt_null || !std::isfinite(value.getNumber())) {
+    return RESULT_ERR_INVALID_NUM;  // invalid value
+  } else if (hasFlag(EXP) || m_divisor != 1) {
+    result_t result = convertValue(value.getNumber(), length, &rawValue);
+    if (result != RESULT_OK) {
+      return result;
+    }
+  } else {
+    // integer part only, same as for a formatted value
+    double dvalue = value.getNumber();
+    if (hasFlag(SIG)) {
+      if (dvalue <= -exp2(32) || dvalue >= exp2(32)) {
+        return RESULT_ERR_OUT_OF_RANGE;  // value out of range
       }
-      if (hasFlag(SIG)) {
-        if (dvalue < -exp2((8 * static_cast<double>(length)) - 1)
-            || dvalue >= exp2((8 * static_cast<double>(length)) - 1)) {
-          return RESULT_ERR_OUT_OF_RANGE;  // value out of range
-        }
-        if (dvalue < 0 && m_bitCount != 32) {
-          value = static_cast<int>(dvalue + (1 << m_bitCount));
-        } else {
-          value = static_cast<int>(dvalue);
-        }
+      long signedValue = static_cast<long>(dvalue);
+      if (signedValue < 0 && m_bitCount != 32) {
+        rawValue = (unsigned int)(signedValue + (1 << m_bitCount));
       } else {
-        if (dvalue < 0.0 || dvalue >= exp2(8 * static_cast<double>(length))) {
-          return RESULT_ERR_OUT_OF_RANGE;  // value out of range
-        }
-        value = (unsigned int)dvalue;
+        rawValue = (unsigned int)signedValue;
       }
-    }
-
-    if (hasFlag(SIG)) {  // signed value
-      if ((value & (1 << (m_bitCount - 1))) != 0) {  // negative signed value
-        if (value < m_minValue) {
-          return RESULT_ERR_OUT_OF_RANGE;  // value out of range
-        }
-      } else if (value > m_maxValue) {
+    } else {
+      if (dvalue < 0 || dvalue >= exp2(32)) {
         return RESULT_ERR_OUT_OF_RANGE;  // value out of range
       }
-    } else if (value < m_minValue || value > m_maxValue) {
-      return RESULT_ERR_OUT_OF_RANGE;  // value out of range
+      rawValue = (unsigned int)dvalue;
+    }
+    result_t result = checkRange(rawValue);
+    if (result != RESULT_OK) {
+      return result;
     }
   }
-
-  return writeRawValue(value, offset, length, output, usedLength);
+  return writeRawValue(rawValue, offset, length, output, usedLength);
 }
 
 
@@ -1029,48 +1392,51 @@ void DataTypeList::clear() {
     delete it;
   }
   m_cleanupTypes.clear();
-  m_typesByIdLength.clear();
+  m_lookup.clear();
   m_typesById.clear();
 }
 
 result_t DataTypeList::add(const DataType* dataType) {
+  LookupEntry& entry = m_lookup[dataType->getId()];
   if (!dataType->isAdjustableLength()) {
-    ostringstream str;
     size_t bitCount = dataType->getBitCount();
-    str << dataType->getId() << LENGTH_SEPARATOR << static_cast<unsigned>(bitCount >= 8?bitCount/8:bitCount);
-    if (m_typesByIdLength.find(str.str()) != m_typesByIdLength.end()) {
-      return RESULT_ERR_DUPLICATE_NAME;  // duplicate key
+    size_t length = bitCount >= 8 ? bitCount/8 : bitCount;
+    for (const auto& it : entry.m_byLength) {
+      if (it.first == length) {
+        return RESULT_ERR_DUPLICATE_NAME;  // duplicate key
+      }
     }
-    m_typesByIdLength[str.str()] = dataType;
-    if (m_typesById.find(dataType->getId()) != m_typesById.end()) {
+    entry.m_byLength.push_back(std::make_pair(length, dataType));
+    if (entry.m_default != nullptr) {
       m_cleanupTypes.push_back(dataType);
       return RESULT_OK;  // only store first one as default
     }
-  } else if (m_typesById.find(dataType->getId()) != m_typesById.end()) {
+  } else if (entry.m_default != nullptr) {
     return RESULT_ERR_DUPLICATE_NAME;  // duplicate key
   }
+  entry.m_default = dataType;
   m_typesById[dataType->getId()] = dataType;
   m_cleanupTypes.push_back(dataType);
   return RESULT_OK;
 }
 
 const DataType* DataTypeList::get(const string& id, size_t length) const {
+  const auto it = m_lookup.find(id);
+  if (it == m_lookup.end()) {
+    return nullptr;
+  }
   if (length > 0) {
-    ostringstream str;
-    str << id << LENGTH_SEPARATOR << static_cast<unsigned>(length);
-    auto it = m_typesByIdLength.find(str.str());
-    if (it != m_typesByIdLength.end()) {
-      return it->second;
+    for (const auto& lit : it->second.m_byLength) {
+      if (lit.first == length) {
+        return lit.second;
+      }
     }
   }
-  auto it = m_typesById.find(id);
-  if (it == m_typesById.end()) {
-    return nullptr;
-  }
-  if (length > 0 && !it->second->isAdjustableLength()) {
+  const DataType* dataType = it->second.m_default;
+  if (dataType == nullptr || (length > 0 && !dataType->isAdjustableLength())) {
     return nullptr;
   }
-  return it->second;
+  return dataType;
 }
 
 }  // namespace ebusd
@@ -27,9 +27,13 @@
 #include <vector>
 #include <list>
 #include <map>
+#include <unordered_map>
+#include <utility>
 #include "lib/ebus/symbol.h"
 #include "lib/ebus/result.h"
+#include "lib/ebus/outputbuffer.h"
 #include "lib/ebus/filereader.h"
+#include "lib/utils/thread.h"
 
 namespace ebusd {
 
@@ -157,6 +161,73 @@ enum PartType {
 #define CON 0x1000
 
 
+/** the kind of value held by a @a FieldValue. */
+enum FieldValueType {
+  fvt_null,    //!< no value, i.e. the replacement value (same as @a NULL_VALUE)
+  fvt_number,  //!< a numeric value
+  fvt_string,  //!< a formatted string value
+};
+
+
+/**
+ * A typed value to write to a field, allowing numbers to be encoded without the text round trip.
+ */
+class FieldValue {
+ public:
+  /**
+   * Constructs a new null instance.
+   */
+  FieldValue() : m_type(fvt_null), m_number(0) {}
+
+  /**
+   * Constructs a new numeric instance.
+   * @param number the numeric value (not yet multiplied by the divisor).
+   */
+  explicit FieldValue(double number) : m_type(fvt_number), m_number(number) {}
+
+  /**
+   * Constructs a new string instance.
+   * @param str the formatted string value.
+   */
+  explicit FieldValue(const string& str) : m_type(fvt_string), m_number(0), m_string(str) {}
+
+  /**
+   * @return the kind of value.
+   */
+  FieldValueType getType() const { return m_type; }
+
+  /**
+   * @return the numeric value (only valid for @a fvt_number).
+   */
+  double getNumber() const { return m_number; }
+
+  /**
+   * @return the string value (only valid for @a fvt_string).
+   */
+  const string& getString() const { return m_string; }
+
+  /**
+   * Format the value as text the same way as it would be passed to @a DataType#writeSymbols().
+   * @return the formatted value.
+   */
+  string str() const;
+
+
+ private:
+  /** the kind of value. */
+  FieldValueType m_type;
+
+  /** the numeric value. */
+  double m_number;
+
+  /** the string value. */
+  string m_string;
+};
+
+/** a list of @a FieldValue instances indexed by field (excluding ignored fields). */
+typedef vector<FieldValue> FieldValues;
+
+
 /**
  * Base class for all kinds of data types.
  */
@@ -250,6 +321,19 @@ class DataType {
   virtual result_t readSymbols(size_t offset, size_t length, const SymbolString& input,
       OutputFormat outputFormat, ostream* output) const = 0;
 
+  /**
+   * Internal method for reading the field from a @a SymbolString into an @a OutputBuffer.
+   * By default, the value is formatted by @a readSymbols() and appended.
+   * @param offset the offset in the data of the @a SymbolString.
+   * @param length the number of symbols to read.
+   * @param input the @a SymbolString to read the binary value from.
+   * @param outputFormat the @a OutputFormat options to use.
+   * @param output the @a OutputBuffer to append the formatted value to.
+   * @return @a RESULT_OK on success, or an error code.
+   */
+  virtual result_t appendSymbols(size_t offset, size_t length, const SymbolString& input,
+      OutputFormat outputFormat, OutputBuffer* output) const;
+
   /**
    * Internal method for writing the field to a @a SymbolString.
    * @param offset the offset in the @a SymbolString.
@@ -262,6 +346,19 @@ class DataType {
   virtual result_t writeSymbols(size_t offset, size_t length, istringstream* input,
       SymbolString* output, size_t* usedLength) const = 0;
 
+  /**
+   * Internal method for writing the typed value to a @a SymbolString.
+   * By default, the value is formatted and passed to @a writeSymbols().
+   * @param offset the offset in the @a SymbolString.
+   * @param length the number of symbols to write, or @a REMAIN_LEN.
+   * @param value the @a FieldValue to write.
+   * @param output the @a SymbolString to write the binary value to.
+   * @param usedLength the variable in which to store the used length in bytes, or nullptr.
+   * @return @a RESULT_OK on success, or an error code.
+   */
+  virtual result_t writeValue(size_t offset, size_t length, const FieldValue& value,
+      SymbolString* output, size_t* usedLength) const;
+
 
  protected:
   /** the type identifier. */
@@ -309,6 +406,10 @@ class StringDataType : public DataType {
   result_t readSymbols(size_t offset, size_t length, const SymbolString& input,
       OutputFormat outputFormat, ostream* output) const override;
 
+  // @copydoc
+  result_t appendSymbols(size_t offset, size_t length, const SymbolString& input,
+      OutputFormat outputFormat, OutputBuffer* output) const override;
+
   // @copydoc
   result_t writeSymbols(size_t offset, size_t length, istringstream* input,
       SymbolString* output, size_t* usedLength) const override;
@@ -405,7 +506,9 @@ class NumberDataType : public DataType {
       unsigned int minValue, unsigned int maxValue, int divisor,
       const NumberDataType* baseType = nullptr)
     : DataType(id, bitCount, flags|NUM, replacement), m_minValue(minValue), m_maxValue(maxValue), m_divisor(divisor),
-      m_precision(calcPrecision(divisor)), m_firstBit(0), m_baseType(baseType) {}
+      m_precision(calcPrecision(divisor)), m_firstBit(0), m_baseType(baseType),
+      m_rawLength((bitCount+7)/8), m_rawReader(selectRawReader(bitCount, flags)),
+      m_rawWriter(selectRawWriter(bitCount, flags)) {}
 
   /**
    * Constructs a new instance for less than 8 bits.
@@ -420,7 +523,9 @@ class NumberDataType : public DataType {
   NumberDataType(const string& id, size_t bitCount, uint16_t flags, unsigned int replacement,
       int16_t firstBit, int divisor, const NumberDataType* baseType = nullptr)
     : DataType(id, bitCount, flags|NUM, replacement), m_minValue(0), m_maxValue((1 << bitCount)-1), m_divisor(divisor),
-      m_precision(0), m_firstBit(firstBit), m_baseType(baseType) {}
+      m_precision(0), m_firstBit(firstBit), m_baseType(baseType),
+      m_rawLength((bitCount+7)/8), m_rawReader(selectRawReader(bitCount, flags)),
+      m_rawWriter(selectRawWriter(bitCount, flags)) {}
 
   /**
    * Destructor.
@@ -483,6 +588,28 @@ class NumberDataType : public DataType {
   result_t readSymbols(size_t offset, size_t length, const SymbolString& input,
       const OutputFormat outputFormat, ostream* output) const override;
 
+  /**
+   * Read the numeric raw value and convert it to the signed value checked against the value range (not for #EXP).
+   * @param offset the offset in the @a SymbolString.
+   * @param length the number of symbols to read.
+   * @param input the @a SymbolString to read the binary value from.
+   * @param value the variable in which to store the signed value (without the divisor applied).
+   * @return @a RESULT_OK on success, @a RESULT_EMPTY for the replacement value, or an error code.
+   */
+  result_t readSignedValue(size_t offset, size_t length, const SymbolString& input, int64_t* value) const;
+
+  /**
+   * Convert the numeric raw value to the signed value checked against the value range (not for #EXP).
+   * @param rawValue the numeric raw value as read by @a readRawValue().
+   * @param value the variable in which to store the signed value (without the divisor applied).
+   * @return @a RESULT_OK on success, @a RESULT_EMPTY for the replacement value, or an error code.
+   */
+  result_t convertRawValue(unsigned int rawValue, int64_t* value) const;
+
+  // @copydoc
+  result_t appendSymbols(size_t offset, size_t length, const SymbolString& input,
+      OutputFormat outputFormat, OutputBuffer* output) const override;
+
   /**
    * Internal method for writing the numeric raw value to a @a SymbolString.
    * @param value the numeric raw value to write.
@@ -500,8 +627,66 @@ class NumberDataType : public DataType {
   result_t writeSymbols(size_t offset, size_t length, istringstream* input,
       SymbolString* output, size_t* usedLength) const override;
 
+  // @copydoc
+  result_t writeValue(size_t offset, size_t length, const FieldValue& value,
+      SymbolString* output, size_t* usedLength) const override;
+
 
  private:
+  /**
+   * Function for reading the numeric raw value specialised for a fixed combination of length and flags.
+   * @param type the @a NumberDataType to read.
+   * @param offset the offset in the @a SymbolString (already checked against the available data).
+   * @param input the @a SymbolString to read the binary value from.
+   * @param value the variable in which to store the numeric raw value.
+   * @return @a RESULT_OK on success, or an error code.
+   */
+  typedef result_t (*RawReader)(const NumberDataType* type, size_t offset, const SymbolString& input,
+      unsigned int* value);
+
+  /**
+   * Function for writing the numeric raw value specialised for a fixed combination of length and flags.
+   * @param type the @a NumberDataType to write.
+   * @param value the numeric raw value to write.
+   * @param offset the offset in the @a SymbolString.
+   * @param output the @a SymbolString to write the binary value to.
+   * @return @a RESULT_OK on success, or an error code.
+   */
+  typedef result_t (*RawWriter)(const NumberDataType* type, unsigned int value, size_t offset,
+      SymbolString* output);
+
+  /**
+   * Select the specialised @a RawReader for the combination of bit count and flags.
+   * @param bitCount the number of bits.
+   * @param flags the combination of flags.
+   * @return the specialised @a RawReader, or nullptr to use the generic implementation.
+   */
+  static RawReader selectRawReader(size_t bitCount, uint16_t flags);
+
+  /**
+   * Select the specialised @a RawWriter for the combination of bit count and flags.
+   * @param bitCount the number of bits.
+   * @param flags the combination of flags.
+   * @return the specialised @a RawWriter, or nullptr to use the generic implementation.
+   */
+  static RawWriter selectRawWriter(size_t bitCount, uint16_t flags);
+
+  /**
+   * Convert the value to the numeric raw value by applying the divisor and the IEEE 754 encoding (if any).
+   * @param dvalue the value to convert.
+   * @param length the number of symbols to write.
+   * @param value the variable in which to store the numeric raw value.
+   * @return @a RESULT_OK on success, or an error code.
+   */
+  result_t convertValue(double dvalue, size_t length, unsigned int* value) const;
+
+  /**
+   * Check the numeric raw value against the minimum and maximum raw value.
+   * @param value the numeric raw value to check.
+   * @return @a RESULT_OK on success, or an error code.
+   */
+  result_t checkRange(unsigned int value) const;
+
   /** the minimum raw value. */
   const unsigned int m_minValue;
 
@@ -519,6 +704,15 @@ class NumberDataType : public DataType {
 
   /** the base @a NumberDataType for derived instances. */
   const NumberDataType* m_baseType;
+
+  /** the number of symbols the specialised @a m_rawReader and @a m_rawWriter are made for. */
+  const size_t m_rawLength;
+
+  /** the specialised @a RawReader, or nullptr. */
+  const RawReader m_rawReader;
+
+  /** the specialised @a RawWriter, or nullptr. */
+  const RawWriter m_rawWriter;
 };
 
 
@@ -562,7 +756,11 @@ class DataTypeList {
    * Adds a @a DataType instance for later cleanup.
    * @param dataType the @a DataType instance to add.
    */
-  void addCleanup(const DataType* dataType) { m_cleanupTypes.push_back(dataType); }
+  void addCleanup(const DataType* dataType) {
+    m_cleanupMutex.lock();
+    m_cleanupTypes.push_back(dataType);
+    m_cleanupMutex.unlock();
+  }
 
   /**
    * Gets the @a DataType instance with the specified ID.
@@ -589,13 +787,32 @@ class DataTypeList {
   /** the known @a DataType instances by ID only. */
   map<string, const DataType*> m_typesById;
 
-  /** the known @a DataType instances by ID and length (i.e. "ID:BITS").
-   * Note: adjustable length types are stored by ID only. */
-  map<string, const DataType*> m_typesByIdLength;
+  /**
+   * The lookup entry for all @a DataType instances sharing the same ID.
+   */
+  struct LookupEntry {
+    /**
+     * Constructor.
+     */
+    LookupEntry() : m_default(nullptr) {}
+
+    /** the default @a DataType instance for the ID only (the first one added). */
+    const DataType* m_default;
+
+    /** the fixed length @a DataType instances by length (in bytes, or bits for types below 8 bits).
+     * Note: adjustable length types are stored as default only. */
+    vector<std::pair<size_t, const DataType*>> m_byLength;
+  };
+
+  /** the hashed @a LookupEntry by ID for resolving ID and length with a single lookup. */
+  std::unordered_map<string, LookupEntry> m_lookup;
 
   /** the @a DataType instances to cleanup. */
   list<const DataType*> m_cleanupTypes;
 
+  /** the @a Mutex for adding to @a m_cleanupTypes while loading in parallel. */
+  Mutex m_cleanupMutex;
+
   /** the singleton instance. */
   static DataTypeList s_instance;
 
@@ -49,6 +49,9 @@ namespace ebusd {
 
 #define MTU 1540
 
+/** the size of the read buffer, i.e. the maximum number of bytes drained from the device in a single read. */
+#define RECV_BUFFER_SIZE 256
+
 #ifndef POLLRDHUP
 #define POLLRDHUP 0
 #endif
@@ -77,11 +80,12 @@ namespace ebusd {
 Device::Device(const char* name, bool checkDevice, unsigned int latency, bool readOnly, bool initialSend,
     bool enhancedProto)
   : m_name(name), m_checkDevice(checkDevice),
-    m_latency(HOST_LATENCY_MS+latency), m_readOnly(readOnly), m_initialSend(initialSend),
-    m_enhancedProto(enhancedProto), m_fd(-1), m_listener(nullptr), m_arbitrationMaster(SYN),
-    m_arbitrationCheck(false), m_bufSize(((MAX_LEN+1+3)/4)*4), m_bufLen(0), m_bufPos(0) {
+    m_configuredLatency(HOST_LATENCY_MS+latency), m_latency(m_configuredLatency), m_readOnly(readOnly),
+    m_initialSend(initialSend), m_enhancedProto(enhancedProto), m_fd(-1), m_listener(nullptr), m_arbitrationMaster(SYN),
+    m_arbitrationCheck(false), m_bufSize(RECV_BUFFER_SIZE), m_bufLen(0), m_symLen(0), m_symPos(0) {
   m_buffer = reinterpret_cast<symbol_t*>(malloc(m_bufSize));
-  if (!m_buffer) {
+  m_symbols = reinterpret_cast<DecodedSymbol*>(malloc(m_bufSize*sizeof(DecodedSymbol)));
+  if (!m_buffer || !m_symbols) {
     m_bufSize = 0;
   }
 }
@@ -91,6 +95,9 @@ Device::~Device() {
   if (m_buffer) {
     free(m_buffer);
   }
+  if (m_symbols) {
+    free(m_symbols);
+  }
 }
 
 Device* Device::create(const char* name, unsigned int extraLatency, bool checkDevice, bool readOnly, bool initialSend) {
@@ -141,6 +148,7 @@ result_t Device::open() {
 
 result_t Device::afterOpen() {
   m_bufLen = 0;
+  m_symLen = 0;
   if (m_enhancedProto) {
     symbol_t buf[2] = makeEnhancedSequence(ENH_REQ_INIT, 0);  // TODO define additional feature flags
     if (::write(m_fd, buf, 2) != 2) {
@@ -161,6 +169,7 @@ void Device::close() {
     m_fd = -1;
   }
   m_bufLen = 0;  // flush read buffer
+  m_symLen = 0;
 }
 
 bool Device::isValid() {
@@ -356,84 +365,89 @@ bool Device::write(symbol_t value, bool startArbitration) {
 }
 
 bool Device::available() {
-  if (m_bufLen <= 0) {
-    return false;
-  }
-  if (!m_enhancedProto) {
-    return true;
-  }
-  // peek into the received enhanced proto bytes to determine symbol availability
-  for (size_t pos = 0; pos < m_bufLen; pos++) {
-    symbol_t ch = m_buffer[(pos+m_bufPos)%m_bufSize];
-    if (!(ch&ENH_BYTE_FLAG)) {
+  return m_symLen > 0;
+}
+
+void Device::decodeBuffer() {
+  symbol_t received[RECV_BUFFER_SIZE];
+  size_t receivedLen = 0;
+  size_t pos = 0;
+  while (pos < m_bufLen) {
+    symbol_t ch = m_buffer[pos];
+    uint8_t cmd = ENH_RES_RECEIVED;
+    symbol_t data = ch;
+    if (m_enhancedProto && (ch&ENH_BYTE_FLAG)) {
+      if ((ch&ENH_BYTE_MASK) == ENH_BYTE2) {
 #ifdef DEBUG_RAW_TRAFFIC
-      fprintf(stdout, "raw avail direct\n");
+        fprintf(stdout, "raw decode enhanced bad\n");
 #endif
-      return true;
-    }
-    if ((ch&ENH_BYTE_MASK) == ENH_BYTE1) {
+        if (m_listener != nullptr) {
+          m_listener->notifyStatus(true, "unexpected enhanced byte 2");
+        }
+        // skip byte from erroneous protocol
+        pos++;
+        continue;
+      }
       if (pos+1 >= m_bufLen) {
-        return false;
+        break;  // transfer not complete yet
       }
-      // peek into next byte to check if enhanced sequence is ok
-      ch = m_buffer[(pos+m_bufPos+1)%m_bufSize];
-      if (!(ch&ENH_BYTE_FLAG) || (ch&ENH_BYTE_MASK) != ENH_BYTE2) {
+      symbol_t ch2 = m_buffer[pos+1];
+      if ((ch2&ENH_BYTE_MASK) != ENH_BYTE2) {
 #ifdef DEBUG_RAW_TRAFFIC
-        fprintf(stdout, "raw avail enhanced following bad\n");
+        fprintf(stdout, "raw decode enhanced following bad\n");
 #endif
         if (m_listener != nullptr) {
-          m_listener->notifyStatus(true, "unexpected available enhanced following byte 1");
+          m_listener->notifyStatus(true, "missing enhanced byte 2");
         }
         // drop first byte of invalid sequence
-        m_bufPos = (m_bufPos + 1) % m_bufSize;
-        m_bufLen--;
-        pos--;
+        pos++;
         continue;
       }
-#ifdef DEBUG_RAW_TRAFFIC
-      fprintf(stdout, "raw avail enhanced\n");
-#endif
-      return true;
+      pos += 2;
+      data = (symbol_t)(((ch&0x03) << 6) | (ch2&0x3f));
+      cmd = (ch >> 2)&0xf;
+      switch (cmd) {
+        case ENH_RES_RECEIVED:
+        case ENH_RES_STARTED:
+        case ENH_RES_FAILED:
+        case ENH_RES_RESETTED:
+        case ENH_RES_ERROR_EBUS:
+        case ENH_RES_ERROR_HOST:
+          break;
+        default:
+          if (m_listener != nullptr) {
+            ostringstream stream;
+            stream << "unexpected enhanced command 0x" << std::setw(2) << std::setfill('0') << std::hex
+                   << static_cast<unsigned>(cmd);
+            string str = stream.str();
+            m_listener->notifyStatus(true, str.c_str());
+          }
+          continue;
+      }
+    } else {
+      pos++;
     }
-#ifdef DEBUG_RAW_TRAFFIC
-    fprintf(stdout, "raw avail enhanced bad\n");
-#endif
-    if (m_listener != nullptr) {
-      m_listener->notifyStatus(true, "unexpected available enhanced byte 2");
+    if (cmd == ENH_RES_RECEIVED || cmd == ENH_RES_STARTED || cmd == ENH_RES_FAILED) {
+      received[receivedLen++] = data;
     }
-    // skip byte from erroneous protocol
-    m_bufPos = (m_bufPos+1)%m_bufSize;
-    m_bufLen--;
-    pos--;
+    DecodedSymbol& decoded = m_symbols[(m_symPos+m_symLen)%m_bufSize];
+    decoded.m_command = cmd;
+    decoded.m_data = data;
+    m_symLen++;
+  }
+  // keep an incomplete sequence for the next read
+  if (pos > 0 && pos < m_bufLen) {
+    memmove(m_buffer, m_buffer+pos, m_bufLen-pos);
+  }
+  m_bufLen -= pos;
+  if (receivedLen > 0 && m_listener != nullptr) {
+    m_listener->notifyDeviceReceived(received, receivedLen);
   }
-  return false;
 }
 
 bool Device::read(symbol_t* value, bool isAvailable, ArbitrationState* arbitrationState, bool* incomplete) {
   if (!isAvailable) {
-    if (m_bufLen > 0 && m_bufPos != 0) {
-      if (m_bufLen > m_bufSize / 2) {
-        // more than half of input buffer consumed is taken as signal that ebusd is too slow
-        m_bufLen = 0;
-        if (m_listener != nullptr) {
-          m_listener->notifyStatus(true, "buffer overflow");
-        }
-      } else {
-        size_t tail;
-        if (m_bufPos+m_bufLen > m_bufSize) {
-          // move wrapped tail away
-          tail = (m_bufPos+m_bufLen) % m_bufSize;
-          size_t head = m_bufLen-tail;
-          memmove(m_buffer+head, m_buffer, tail);
-        } else {
-          tail = 0;
-        }
-        // move head to first position
-        memmove(m_buffer, m_buffer + m_bufPos, m_bufLen - tail);
-      }
-    }
-    m_bufPos = 0;
-    // fill up the buffer
+    // the symbol queue is empty here, so drain as much as fits into the buffer with a single read
     ssize_t size = ::read(m_fd, m_buffer + m_bufLen, m_bufSize - m_bufLen);
     if (size <= 0) {
       return false;
@@ -446,55 +460,17 @@ bool Device::read(symbol_t* value, bool isAvailable, ArbitrationState* arbitrati
     fprintf(stdout, "\n");
 #endif
     m_bufLen += size;
-  }
-  if (!available()) {
-    if (incomplete) {
-      *incomplete = m_enhancedProto && m_bufLen > 0;
-    }
-    return false;
-  }
-  if (!m_enhancedProto) {
-    *value = m_buffer[m_bufPos];
-    m_bufPos = (m_bufPos+1)%m_bufSize;
-    m_bufLen--;
-    return true;
-  }
-  while (m_bufLen > 0) {
-    symbol_t ch = m_buffer[m_bufPos];
-    if (!(ch&ENH_BYTE_FLAG)) {
-      *value = ch;
-      m_bufPos = (m_bufPos+1)%m_bufSize;
-      m_bufLen--;
-      return true;
-    }
-    uint8_t kind = ch&ENH_BYTE_MASK;
-    if (kind == ENH_BYTE1 && m_bufLen < 2) {
-      return false;  // transfer not complete yet
-    }
-    m_bufPos = (m_bufPos+1)%m_bufSize;
-    m_bufLen--;
-    if (kind == ENH_BYTE2) {
-      if (m_listener != nullptr) {
-        m_listener->notifyStatus(true, "unexpected enhanced byte 2");
-      }
-      return false;
-    }
-    // kind is ENH_BYTE1
-    symbol_t ch2 = m_buffer[m_bufPos];
-    m_bufPos = (m_bufPos + 1) % m_bufSize;
-    m_bufLen--;
-    if ((ch2 & ENH_BYTE_MASK) != ENH_BYTE2) {
-      if (m_listener != nullptr) {
-        m_listener->notifyStatus(true, "missing enhanced byte 2");
-      }
-      return false;
-    }
-    symbol_t data = (symbol_t)(((ch&0x03) << 6) | (ch2&0x3f));
-    symbol_t cmd = (ch >> 2)&0xf;
-    switch (cmd) {
+    decodeBuffer();
+  }
+  while (m_symLen > 0) {
+    const DecodedSymbol decoded = m_symbols[m_symPos];
+    m_symPos = (m_symPos+1)%m_bufSize;
+    m_symLen--;
+    symbol_t data = decoded.m_data;
+    switch (decoded.m_command) {
       case ENH_RES_STARTED:
         *arbitrationState = as_won;
-        if (m_listener != NULL) {
+        if (m_listener != nullptr) {
           m_listener->notifyDeviceData(data, false);
         }
         m_arbitrationMaster = SYN;
@@ -503,7 +479,7 @@ bool Device::read(symbol_t* value, bool isAvailable, ArbitrationState* arbitrati
         return true;
       case ENH_RES_FAILED:
         *arbitrationState = as_lost;
-        if (m_listener != NULL) {
+        if (m_listener != nullptr) {
           m_listener->notifyDeviceData(m_arbitrationMaster, false);
         }
         m_arbitrationMaster = SYN;
@@ -524,11 +500,10 @@ bool Device::read(symbol_t* value, bool isAvailable, ArbitrationState* arbitrati
           m_listener->notifyStatus(false, "reset");
         }
         break;
-      case ENH_RES_ERROR_EBUS:
-      case ENH_RES_ERROR_HOST:
+      default:  // ENH_RES_ERROR_EBUS or ENH_RES_ERROR_HOST
         if (m_listener != nullptr) {
           ostringstream stream;
-          stream << (cmd == ENH_RES_ERROR_EBUS ? "eBUS comm error: " : "host comm error: ");
+          stream << (decoded.m_command == ENH_RES_ERROR_EBUS ? "eBUS comm error: " : "host comm error: ");
           switch (data) {
             case ENH_ERR_FRAMING:
               stream << "framing";
@@ -545,17 +520,11 @@ bool Device::read(symbol_t* value, bool isAvailable, ArbitrationState* arbitrati
         }
         cancelRunningArbitration(arbitrationState);
         break;
-      default:
-        if (m_listener != nullptr) {
-          ostringstream stream;
-          stream << "unexpected enhanced command 0x" << std::setw(2) << std::setfill('0') << std::hex
-                 << static_cast<unsigned>(cmd);
-          string str = stream.str();
-          m_listener->notifyStatus(true, str.c_str());
-        }
-        return false;
     }
   }
+  if (incomplete) {
+    *incomplete = m_enhancedProto && m_bufLen > 0;
+  }
   return false;
 }
 
@@ -26,6 +26,7 @@
 #include <netdb.h>
 #include <iostream>
 #include <fstream>
+#include <atomic>
 #include "lib/ebus/result.h"
 #include "lib/ebus/symbol.h"
 
@@ -77,6 +78,13 @@ class DeviceListener {
    */
   virtual void notifyDeviceData(symbol_t symbol, bool received) = 0;  // abstract
 
+  /**
+   * Listener method that is called once per read from the device with all symbols received in that read.
+   * @param symbols the received symbols (already decoded from the enhanced protocol if necessary).
+   * @param count the number of received symbols.
+   */
+  virtual void notifyDeviceReceived(const symbol_t* symbols, size_t count) = 0;  // abstract
+
   /**
    * Called to notify a status message from the device.
    * @param error true for an error message, false for an info message.
@@ -128,6 +136,18 @@ class Device {
    */
   virtual unsigned int getLatency() const { return m_latency; }
 
+  /**
+   * Get the transfer latency of this device as configured.
+   * @return the configured transfer latency in milliseconds.
+   */
+  unsigned int getConfiguredLatency() const { return m_configuredLatency; }
+
+  /**
+   * Set the effective transfer latency of this device (e.g. determined from the measured latency).
+   * @param latency the transfer latency in milliseconds.
+   */
+  void setLatency(unsigned int latency) { m_latency = latency; }
+
   /**
    * Open the file descriptor.
    * @return the @a result_t code.
@@ -194,6 +214,12 @@ class Device {
    */
   bool isReadOnly() const { return m_readOnly; }
 
+  /**
+   * Return whether the device supports the ebusd enhanced protocol (i.e. arbitrates by itself).
+   * @return whether the device supports the ebusd enhanced protocol.
+   */
+  bool isEnhancedProto() const { return m_enhancedProto; }
+
   /**
    * Set the @a DeviceListener.
    * @param listener the @a DeviceListener.
@@ -239,14 +265,23 @@ class Device {
   virtual bool read(symbol_t* value, bool isAvailable, ArbitrationState* arbitrationState = nullptr,
                     bool* incomplete = nullptr);
 
+  /**
+   * Decode all complete symbols from the read buffer into the symbol queue and notify the listener about the received
+   * ones in a single call.
+   */
+  void decodeBuffer();
+
   /** the device name (e.g. "/dev/ttyUSB0" for serial, "127.0.0.1:1234" for network). */
   const char* m_name;
 
   /** whether to regularly check the device availability. */
   const bool m_checkDevice;
 
-  /** the bus transfer latency in milliseconds. */
-  const unsigned int m_latency;
+  /** the configured bus transfer latency in milliseconds. */
+  const unsigned int m_configuredLatency;
+
+  /** the effective bus transfer latency in milliseconds. */
+  std::atomic<unsigned int> m_latency;
 
   /** whether to allow read access to the device only. */
   const bool m_readOnly;
@@ -271,17 +306,34 @@ class Device {
   /** true when in arbitration and the next received symbol needs to be checked against the sent master address. */
   bool m_arbitrationCheck;
 
-  /** the read buffer. */
+  /**
+   * A symbol decoded from the read buffer together with the enhanced protocol command it was received with.
+   */
+  struct DecodedSymbol {
+    /** the enhanced protocol response command (received for non-enhanced protocol). */
+    uint8_t m_command;
+
+    /** the symbol or enhanced protocol data. */
+    symbol_t m_data;
+  };
+
+  /** the raw read buffer (only keeps an incomplete enhanced sequence between two reads). */
   symbol_t* m_buffer;
 
-  /** the read buffer size (multiple of 4). */
+  /** the size of the raw read buffer and the symbol queue. */
   size_t m_bufSize;
 
-  /** the read buffer fill length. */
+  /** the raw read buffer fill length. */
   size_t m_bufLen;
 
-  /** the read buffer read position. */
-  size_t m_bufPos;
+  /** the queue of @a DecodedSymbol not yet consumed by @a read(). */
+  DecodedSymbol* m_symbols;
+
+  /** the number of symbols in @a m_symbols. */
+  size_t m_symLen;
+
+  /** the read position in @a m_symbols. */
+  size_t m_symPos;
 };
 
 
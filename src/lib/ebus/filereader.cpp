@@ -18,6 +18,11 @@
 
 #include "lib/ebus/filereader.h"
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
 #include <string>
 #include <vector>
@@ -59,8 +64,168 @@ istream* FileReader::openFile(const string& filename, string* errorDescription,
   return stream;
 }
 
+/** the magic bytes at the start of a @a RowCache file. */
+static const char ROW_CACHE_MAGIC[] = "EBRC";
+
+/** the version of the @a RowCache file format (to be incremented with each change of format or splitting). */
+#define ROW_CACHE_VERSION 2
+
+/**
+ * Read a value from the mapped @a RowCache file.
+ * @param pos the pointer to the current position, updated after reading.
+ * @param end the pointer to the end of the mapped file.
+ * @param value the variable in which to store the value.
+ * @return true on success, false if the file is truncated.
+ */
+template <typename T>
+static bool readCacheValue(const char** pos, const char* end, T* value) {
+  if (*pos + sizeof(T) > end) {
+    return false;
+  }
+  memcpy(value, *pos, sizeof(T));
+  *pos += sizeof(T);
+  return true;
+}
+
+/**
+ * Write a value to the @a RowCache file.
+ * @param stream the @a ostream to write to.
+ * @param value the value to write.
+ */
+template <typename T>
+static void writeCacheValue(ostream* stream, T value) {
+  stream->write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+bool RowCache::load() {
+  m_complete = false;
+  m_rows.clear();
+  m_nextRow = 0;
+  int fd = open(m_cacheFile.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+    close(fd);
+    return false;
+  }
+  size_t length = static_cast<size_t>(st.st_size);
+  void* mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapped == MAP_FAILED) {
+    return false;
+  }
+  const char* pos = reinterpret_cast<const char*>(mapped);
+  const char* end = pos + length;
+  uint32_t version = 0, rowCount = 0;
+  int64_t mtime = 0;
+  uint64_t sourceKey = 0, hash = 0, size = 0;
+  bool valid = length > 4 && memcmp(pos, ROW_CACHE_MAGIC, 4) == 0;
+  if (valid) {
+    pos += 4;
+    valid = readCacheValue(&pos, end, &version) && version == ROW_CACHE_VERSION
+      && readCacheValue(&pos, end, &mtime) && mtime == static_cast<int64_t>(m_mtime)
+      && readCacheValue(&pos, end, &sourceKey) && sourceKey == m_sourceKey
+      && readCacheValue(&pos, end, &hash) && readCacheValue(&pos, end, &size)
+      && readCacheValue(&pos, end, &rowCount);
+  }
+  if (valid) {
+    m_rows.resize(rowCount);
+    for (auto& entry : m_rows) {
+      uint32_t lineNo = 0, fieldCount = 0;
+      if (!readCacheValue(&pos, end, &lineNo) || !readCacheValue(&pos, end, &fieldCount)
+          || fieldCount > static_cast<size_t>(end - pos)) {
+        valid = false;
+        break;
+      }
+      entry.first = lineNo;
+      entry.second.resize(fieldCount);
+      for (auto& field : entry.second) {
+        uint32_t fieldLength = 0;
+        if (!readCacheValue(&pos, end, &fieldLength) || fieldLength > static_cast<size_t>(end - pos)) {
+          valid = false;
+          break;
+        }
+        field.assign(pos, fieldLength);
+        pos += fieldLength;
+      }
+      if (!valid) {
+        break;
+      }
+    }
+  }
+  munmap(mapped, length);
+  if (!valid || pos != end) {
+    m_rows.clear();
+    return false;
+  }
+  m_hash = static_cast<size_t>(hash);
+  m_size = static_cast<size_t>(size);
+  m_complete = true;
+  return true;
+}
+
+bool RowCache::save() const {
+  if (!m_complete) {
+    return false;
+  }
+  string tempFile = m_cacheFile + ".tmp";
+  std::ofstream stream(tempFile.c_str(), std::ofstream::out | std::ofstream::binary | std::ofstream::trunc);
+  if (!stream.is_open()) {
+    return false;
+  }
+  stream.write(ROW_CACHE_MAGIC, 4);
+  writeCacheValue(&stream, static_cast<uint32_t>(ROW_CACHE_VERSION));
+  writeCacheValue(&stream, static_cast<int64_t>(m_mtime));
+  writeCacheValue(&stream, m_sourceKey);
+  writeCacheValue(&stream, static_cast<uint64_t>(m_hash));
+  writeCacheValue(&stream, static_cast<uint64_t>(m_size));
+  writeCacheValue(&stream, static_cast<uint32_t>(m_rows.size()));
+  for (const auto& entry : m_rows) {
+    writeCacheValue(&stream, static_cast<uint32_t>(entry.first));
+    writeCacheValue(&stream, static_cast<uint32_t>(entry.second.size()));
+    for (const auto& field : entry.second) {
+      writeCacheValue(&stream, static_cast<uint32_t>(field.length()));
+      stream.write(field.data(), static_cast<std::streamsize>(field.length()));
+    }
+  }
+  stream.close();
+  if (stream.fail() || rename(tempFile.c_str(), m_cacheFile.c_str()) != 0) {
+    remove(tempFile.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool RowCache::nextRow(unsigned int* lineNo, vector<string>* row) {
+  if (!hasNextRow()) {
+    return false;
+  }
+  auto& entry = m_rows[m_nextRow++];
+  *lineNo = entry.first;
+  row->swap(entry.second);
+  return true;
+}
+
+void RowCache::setComplete(size_t hash, size_t size) {
+  m_hash = hash;
+  m_size = size;
+  m_complete = true;
+  m_nextRow = 0;
+}
+
+
 result_t FileReader::readFromStream(istream* stream, const string& filename, const time_t& mtime, bool verbose,
-    map<string, string>* defaults, string* errorDescription, bool replace, size_t* hash, size_t* size) {
+    map<string, string>* defaults, string* errorDescription, bool replace, size_t* hash, size_t* size,
+    RowCache* cache) {
+  size_t localHash, localSize;
+  if (cache && !hash) {
+    hash = &localHash;
+  }
+  if (cache && !size) {
+    size = &localSize;
+  }
   if (hash) {
     *hash = 0;
   }
@@ -70,32 +235,73 @@ result_t FileReader::readFromStream(istream* stream, const string& filename, con
   unsigned int lineNo = 0;
   vector<string> row;
   result_t result = RESULT_OK;
-  while (stream->peek() != EOF && result == RESULT_OK) {
-    result = readLineFromStream(stream, filename, verbose, &lineNo, &row, errorDescription, replace, hash, size);
+  bool replay = cache && cache->isComplete();
+  string buffer;
+  if (!replay) {
+    // read the whole file at once for splitting without per character stream access
+    char chunk[4096];
+    while (stream->read(chunk, sizeof(chunk)) || stream->gcount() > 0) {
+      buffer.append(chunk, static_cast<size_t>(stream->gcount()));
+    }
+  }
+  const char* data = buffer.data();
+  const char* end = data + buffer.length();
+  while ((replay ? cache->hasNextRow() : data < end) && result == RESULT_OK) {
+    bool split;
+    if (replay) {
+      split = cache->nextRow(&lineNo, &row);
+    } else {
+      split = splitFields(&data, end, &row, &lineNo, hash, size);
+      if (split && cache) {
+        cache->addRow(lineNo, row);
+      }
+    }
+    result = addSplitRow(split, filename, verbose, lineNo, &row, errorDescription, replace);
+  }
+  if (replay) {
+    *hash = cache->getHash();
+    *size = cache->getSize();
+  } else if (cache && result == RESULT_OK) {
+    cache->setComplete(*hash, *size);
   }
   return result;
 }
 
 result_t FileReader::readLineFromStream(istream* stream, const string& filename, bool verbose,
-    unsigned int* lineNo, vector<string>* row, string* errorDescription, bool replace, size_t* hash, size_t* size) {
+    unsigned int* lineNo, vector<string>* row, string* errorDescription, bool replace, size_t* hash, size_t* size,
+    RowCache* cache) {
+  bool split;
+  if (cache && cache->isComplete()) {
+    split = cache->nextRow(lineNo, row);
+  } else {
+    split = splitFields(stream, row, lineNo, hash, size);
+    if (split && cache) {
+      cache->addRow(*lineNo, *row);
+    }
+  }
+  return addSplitRow(split, filename, verbose, *lineNo, row, errorDescription, replace);
+}
+
+result_t FileReader::addSplitRow(bool split, const string& filename, bool verbose, unsigned int lineNo,
+    vector<string>* row, string* errorDescription, bool replace) {
   result_t result;
-  if (!splitFields(stream, row, lineNo, hash, size)) {
+  if (!split) {
     *errorDescription = "blank line";
     result = RESULT_ERR_EOF;
   } else {
     *errorDescription = "";
-    result = addFromFile(filename, *lineNo, row, errorDescription, replace);
+    result = addFromFile(filename, lineNo, row, errorDescription, replace);
   }
   if (result != RESULT_OK) {
     if (!errorDescription->empty()) {
       string error;
-      formatError(filename, *lineNo, result, *errorDescription, &error);
+      formatError(filename, lineNo, result, *errorDescription, &error);
       *errorDescription = error;
       if (verbose) {
-        cout << error << endl;
+        *(m_verboseOutput ? m_verboseOutput : &cout) << error << endl;
       }
     } else if (!verbose) {
-      return formatError(filename, *lineNo, result, "", errorDescription);
+      return formatError(filename, lineNo, result, "", errorDescription);
     }
   } else if (!verbose) {
     *errorDescription = "";
@@ -118,94 +324,203 @@ void FileReader::tolower(string* str) {
   transform(str->begin(), str->end(), str->begin(), ::tolower);
 }
 
-static size_t hashFunction(const string& str) {
+static size_t hashFunction(const char* str, size_t length) {
   size_t hash = 0;
-  for (unsigned char c : str) {
-    hash = (31 * hash) ^ c;
+  for (size_t pos = 0; pos < length; pos++) {
+    hash = (31 * hash) ^ static_cast<unsigned char>(str[pos]);
   }
   return hash;
 }
 
-bool FileReader::splitFields(istream* stream, vector<string>* row, unsigned int* lineNo,
-    size_t* hash, size_t* size) {
-  row->clear();
-  string line;
-  bool quotedText = false, wasQuoted = false;
-  ostringstream field;
-  char prev = FIELD_SEPARATOR;
-  bool empty = true, read = false;
-  while (getline(*stream, line)) {
-    read = true;
-    ++(*lineNo);
-    trim(&line);
-    size_t length = line.size();
-    if (size) {
-      *size += length + 1;  // normalized with trailing endl
-    }
-    if (hash) {
-      *hash ^= (hashFunction(line) ^ (length << (7 * (*lineNo % 5)))) & 0xffffffff;
+/**
+ * The state of splitting a row into fields, potentially spanning several lines.
+ */
+class SplitState {
+ public:
+  /**
+   * Constructor.
+   * @param row the @a vector to store the fields in (existing elements are reused).
+   */
+  explicit SplitState(vector<string>* row)
+    : m_row(row), m_count(0), m_quotedText(false), m_wasQuoted(false), m_empty(true), m_prev(FIELD_SEPARATOR) {}
+
+  /**
+   * Handle the next line.
+   * @param line the start of the line (without line feed).
+   * @param length the length of the line.
+   * @param lineNo the current line number (incremented).
+   * @param hash optional pointer to a @a size_t value for combining the hash of the line with, or nullptr.
+   * @param size optional pointer to a @a size_t value to add the trimmed line length to, or nullptr.
+   * @return true when the row is complete, false when another line is needed.
+   */
+  bool nextLine(const char* line, size_t length, unsigned int* lineNo, size_t* hash, size_t* size);
+
+  /**
+   * Finish the row after the last line.
+   * @param read whether any line was read.
+   * @return true if there are more lines to read, false when there are no more lines left.
+   */
+  bool finish(bool read);
+
+
+ private:
+  /**
+   * Add the currently collected field to the row.
+   * @return whether the trimmed field was empty.
+   */
+  bool addField();
+
+  /** the @a vector to store the fields in. */
+  vector<string>* m_row;
+
+  /** the number of fields stored so far. */
+  size_t m_count;
+
+  /** whether currently within quoted text. */
+  bool m_quotedText;
+
+  /** whether the current field started with quoted text. */
+  bool m_wasQuoted;
+
+  /** whether all fields so far are empty. */
+  bool m_empty;
+
+  /** the previous character. */
+  char m_prev;
+
+  /** the currently collected field. */
+  string m_field;
+};
+
+bool SplitState::addField() {
+  size_t start = m_field.find_first_not_of(" \t");
+  size_t length = m_field.length();
+  if (start == string::npos) {
+    start = 0;  // same as trim()
+  } else {
+    length = m_field.find_last_not_of(" \t") + 1 - start;
+  }
+  if (m_count < m_row->size()) {
+    (*m_row)[m_count].assign(m_field, start, length);
+  } else {
+    m_row->emplace_back(m_field, start, length);
+  }
+  m_count++;
+  m_field.clear();
+  return length == 0;
+}
+
+bool SplitState::nextLine(const char* line, size_t length, unsigned int* lineNo, size_t* hash, size_t* size) {
+  ++(*lineNo);
+  size_t start = 0;
+  while (start < length && (line[start] == ' ' || line[start] == '\t')) {
+    start++;
+  }
+  if (start < length) {  // same as trim()
+    while (line[length-1] == ' ' || line[length-1] == '\t') {
+      length--;
     }
-    if (!quotedText && (length == 0 || line[0] == '#' || (line.length() > 1 && line[0] == '/' && line[1] == '/'))) {
-      if (*lineNo == 1) {
-        break;  // keep empty first line for applying default header
+    line += start;
+    length -= start;
+  }
+  if (size) {
+    *size += length + 1;  // normalized with trailing endl
+  }
+  if (hash) {
+    *hash ^= (hashFunction(line, length) ^ (length << (7 * (*lineNo % 5)))) & 0xffffffff;
+  }
+  if (!m_quotedText && (length == 0 || line[0] == '#' || (length > 1 && line[0] == '/' && line[1] == '/'))) {
+    // keep empty first line for applying default header, skip other empty lines and comments
+    return *lineNo == 1;
+  }
+  for (size_t pos = 0; pos < length; pos++) {
+    char ch = line[pos];
+    switch (ch) {
+    case FIELD_SEPARATOR:
+      if (m_quotedText) {
+        m_field.push_back(ch);
+      } else {
+        m_empty &= addField();
+        m_wasQuoted = false;
       }
-      continue;  // skip empty lines and comments
-    }
-    for (size_t pos = 0; pos < length; pos++) {
-      char ch = line[pos];
-      switch (ch) {
-      case FIELD_SEPARATOR:
-        if (quotedText) {
-          field << ch;
-        } else {
-          string str = field.str();
-          trim(&str);
-          empty &= str.empty();
-          row->push_back(str);
-          field.str("");
-          wasQuoted = false;
-        }
-        break;
-      case TEXT_SEPARATOR:
-        if (prev == TEXT_SEPARATOR && !quotedText) {  // double dquote
-          field << ch;
-          quotedText = true;
-        } else if (quotedText) {
-          quotedText = false;
-        } else if (prev == FIELD_SEPARATOR) {
-          quotedText = wasQuoted = true;
-        } else {
-          field << ch;
-        }
-        break;
-      case '\r':
-        break;
-      default:
-        if (prev == TEXT_SEPARATOR && !quotedText && wasQuoted) {
-          field << TEXT_SEPARATOR;  // single dquote in the middle of formerly quoted text
-          quotedText = true;
-        } else if (quotedText && pos == 0 && field.tellp() > 0 && *(field.str().end()-1) != VALUE_SEPARATOR) {
-          field << VALUE_SEPARATOR;  // add separator in between multiline field parts
-        }
-        field << ch;
-        break;
+      break;
+    case TEXT_SEPARATOR:
+      if (m_prev == TEXT_SEPARATOR && !m_quotedText) {  // double dquote
+        m_field.push_back(ch);
+        m_quotedText = true;
+      } else if (m_quotedText) {
+        m_quotedText = false;
+      } else if (m_prev == FIELD_SEPARATOR) {
+        m_quotedText = m_wasQuoted = true;
+      } else {
+        m_field.push_back(ch);
       }
-      prev = ch;
-    }
-    if (!quotedText) {
+      break;
+    case '\r':
+      break;
+    default: {
+      if (m_prev == TEXT_SEPARATOR && !m_quotedText && m_wasQuoted) {
+        m_field.push_back(TEXT_SEPARATOR);  // single dquote in the middle of formerly quoted text
+        m_quotedText = true;
+      } else if (m_quotedText && pos == 0 && !m_field.empty() && m_field[m_field.length()-1] != VALUE_SEPARATOR) {
+        m_field.push_back(VALUE_SEPARATOR);  // add separator in between multiline field parts
+      }
+      // copy the run of ordinary characters at once
+      size_t next = pos+1;
+      while (next < length && line[next] != FIELD_SEPARATOR && line[next] != TEXT_SEPARATOR && line[next] != '\r') {
+        next++;
+      }
+      m_field.append(line+pos, next-pos);
+      pos = next-1;
+      ch = line[pos];
       break;
     }
+    }
+    m_prev = ch;
   }
-  string str = field.str();
-  trim(&str);
-  if (empty && str.empty()) {
-    row->clear();
+  return !m_quotedText;
+}
+
+bool SplitState::finish(bool read) {
+  if (m_empty && m_field.empty()) {  // a trimmed field is only empty when it was empty before
+    m_row->clear();
     return read;
   }
-  row->push_back(str);
+  addField();
+  m_row->resize(m_count);
   return true;
 }
 
+bool FileReader::splitFields(istream* stream, vector<string>* row, unsigned int* lineNo,
+    size_t* hash, size_t* size) {
+  SplitState state(row);
+  string line;
+  bool read = false;
+  while (getline(*stream, line)) {
+    read = true;
+    if (state.nextLine(line.data(), line.length(), lineNo, hash, size)) {
+      break;
+    }
+  }
+  return state.finish(read);
+}
+
+bool FileReader::splitFields(const char** data, const char* end, vector<string>* row, unsigned int* lineNo,
+    size_t* hash, size_t* size) {
+  SplitState state(row);
+  bool read = false;
+  while (*data < end) {
+    const char* line = *data;
+    const char* lineEnd = reinterpret_cast<const char*>(memchr(line, '\n', static_cast<size_t>(end-line)));
+    *data = lineEnd ? lineEnd+1 : end;
+    read = true;
+    if (state.nextLine(line, static_cast<size_t>((lineEnd ? lineEnd : end)-line), lineNo, hash, size)) {
+      break;
+    }
+  }
+  return state.finish(read);
+}
+
 result_t FileReader::formatError(const string& filename, unsigned int lineNo, result_t result,
     const string& error, string* errorDescription) {
   ostringstream str;
@@ -221,6 +536,54 @@ result_t FileReader::formatError(const string& filename, unsigned int lineNo, re
 }
 
 
+MappedRow::iterator MappedRow::find(const string& name) {
+  for (auto it = m_entries.begin(); it != m_entries.end(); ++it) {
+    if (it->first == name) {
+      return it;
+    }
+  }
+  return m_entries.end();
+}
+
+MappedRow::const_iterator MappedRow::find(const string& name) const {
+  for (auto it = m_entries.begin(); it != m_entries.end(); ++it) {
+    if (it->first == name) {
+      return it;
+    }
+  }
+  return m_entries.end();
+}
+
+string& MappedRow::operator[](const string& name) {
+  const auto it = find(name);
+  if (it != m_entries.end()) {
+    return it->second;
+  }
+  m_entries.emplace_back(name, string());
+  return m_entries.back().second;
+}
+
+size_t MappedRow::erase(const string& name) {
+  const auto it = find(name);
+  if (it == m_entries.end()) {
+    return 0;
+  }
+  m_entries.erase(it);
+  return 1;
+}
+
+string MappedRow::pluck(const string& name) {
+  const auto it = find(name);
+  if (it == m_entries.end()) {
+    return "";
+  }
+  string ret;
+  ret.swap(it->second);
+  m_entries.erase(it);
+  return ret;
+}
+
+
 const string MappedFileReader::normalizeLanguage(const string& lang) {
   string normLang = lang;
   tolower(&normLang);
@@ -242,7 +605,8 @@ const string MappedFileReader::normalizeLanguage(const string& lang) {
 }
 
 result_t MappedFileReader::readFromStream(istream* stream, const string& filename, const time_t& mtime, bool verbose,
-    map<string, string>* defaults, string* errorDescription, bool replace, size_t* hash, size_t* size) {
+    map<string, string>* defaults, string* errorDescription, bool replace, size_t* hash, size_t* size,
+    RowCache* cache) {
   m_mutex.lock();
   m_columnNames.clear();
   m_lastDefaults.clear();
@@ -254,7 +618,8 @@ result_t MappedFileReader::readFromStream(istream* stream, const string& filenam
   string defaultsPart = lastSep == string::npos ? filename : filename.substr(lastSep+1);
   extractDefaultsFromFilename(defaultsPart, &m_lastDefaults[""]);
   result_t result
-  = FileReader::readFromStream(stream, filename, mtime, verbose, defaults, errorDescription, replace, hash, size);
+  = FileReader::readFromStream(stream, filename, mtime, verbose, defaults, errorDescription, replace, hash, size,
+      cache);
   m_mutex.unlock();
   return result;
 }
@@ -281,14 +646,15 @@ result_t MappedFileReader::addFromFile(const string& filename, unsigned int line
     *errorDescription = "missing field map";
     return RESULT_ERR_INVALID_ARG;
   }
-  map<string, string> rowMapped;
-  vector< map<string, string> > subRowsMapped;
+  MappedRow rowMapped;
+  rowMapped.reserve(m_columnNames.size());
+  vector<MappedRow> subRowsMapped;
   bool isDefault = m_supportsDefaults && !(*row)[0].empty() && (*row)[0][0] == '*';
   if (isDefault) {
     (*row)[0].erase(0, 1);
   }
   size_t lastRepeatStart = UINT_MAX;
-  map<string, string>* lastMappedRow = &rowMapped;
+  MappedRow* lastMappedRow = &rowMapped;
   bool empty = true;
   for (size_t colIdx = 0, colNameIdx = 0; colIdx < row->size(); colIdx++, colNameIdx++) {
     if (colNameIdx >= m_columnNames.size()) {
@@ -298,8 +664,9 @@ result_t MappedFileReader::addFromFile(const string& filename, unsigned int line
       }
       colNameIdx = lastRepeatStart;
     }
-    string columnName = m_columnNames[colNameIdx];
-    if (!columnName.empty() && columnName[0] == '*') {  // marker for next entry
+    const string& columnName = m_columnNames[colNameIdx];
+    bool isMarker = !columnName.empty() && columnName[0] == '*';
+    if (isMarker) {  // marker for next entry
       if (empty) {
         lastMappedRow->clear();
       }
@@ -307,15 +674,15 @@ result_t MappedFileReader::addFromFile(const string& filename, unsigned int line
         subRowsMapped.resize(subRowsMapped.size() + 1);
         lastMappedRow = &subRowsMapped[subRowsMapped.size() - 1];
       }
-      columnName = columnName.substr(1);
       lastRepeatStart = colNameIdx;
       empty = true;
     } else if (columnName == SKIP_COLUMN) {
       continue;
     }
-    string value = (*row)[colIdx];
+    string& value = (*row)[colIdx];
     empty &= value.empty();
-    (*lastMappedRow)[columnName] = value;
+    // move the value instead of copying it as the row is not needed afterwards
+    (*lastMappedRow)[isMarker ? columnName.substr(1) : columnName].swap(value);
   }
   if (empty) {
     lastMappedRow->clear();
@@ -329,7 +696,7 @@ result_t MappedFileReader::addFromFile(const string& filename, unsigned int line
   return addFromFile(filename, lineNo, &rowMapped, &subRowsMapped, errorDescription, replace);
 }
 
-const string MappedFileReader::combineRow(const map<string, string>& row) {
+const string MappedFileReader::combineRow(const MappedRow& row) {
   ostringstream ostream;
   bool first = true;
   for (auto entry : row) {
@@ -23,6 +23,7 @@
 #include <map>
 #include <string>
 #include <vector>
+#include <utility>
 #include <iomanip>
 #include "lib/ebus/symbol.h"
 #include "lib/ebus/result.h"
@@ -44,6 +45,7 @@ using std::string;
 using std::map;
 using std::ostream;
 using std::istream;
+using std::pair;
 
 /** the separator character used between fields. */
 #define FIELD_SEPARATOR ','
@@ -60,6 +62,227 @@ using std::istream;
 /** special marker string for skipping columns in @a MappedFileReader. */
 static const char SKIP_COLUMN[] = "\b";
 
+/**
+ * A row of a @a MappedFileReader with the values by column name.
+ * The values are kept in a flat vector in the order of the columns from @a MappedFileReader#getFieldMap(), which
+ * avoids the node allocations of a map for the few columns of each row. The accessors resemble the ones of a map.
+ */
+class MappedRow {
+ public:
+  /** the type of each entry. */
+  typedef pair<string, string> value_type;
+
+  /** the iterator type. */
+  typedef vector<value_type>::iterator iterator;
+
+  /** the constant iterator type. */
+  typedef vector<value_type>::const_iterator const_iterator;
+
+  /**
+   * Constructs a new empty instance.
+   */
+  MappedRow() {}
+
+  /**
+   * @return the iterator to the first entry.
+   */
+  iterator begin() { return m_entries.begin(); }
+
+  /**
+   * @return the iterator behind the last entry.
+   */
+  iterator end() { return m_entries.end(); }
+
+  /**
+   * @return the constant iterator to the first entry.
+   */
+  const_iterator begin() const { return m_entries.begin(); }
+
+  /**
+   * @return the constant iterator behind the last entry.
+   */
+  const_iterator end() const { return m_entries.end(); }
+
+  /**
+   * @return whether the row has no entries.
+   */
+  bool empty() const { return m_entries.empty(); }
+
+  /**
+   * @return the number of entries.
+   */
+  size_t size() const { return m_entries.size(); }
+
+  /**
+   * Remove all entries.
+   */
+  void clear() { m_entries.clear(); }
+
+  /**
+   * Reserve space for the specified number of entries.
+   * @param count the number of entries.
+   */
+  void reserve(size_t count) { m_entries.reserve(count); }
+
+  /**
+   * Find the entry of a column.
+   * @param name the column name.
+   * @return the iterator to the entry, or @a end() if not present.
+   */
+  iterator find(const string& name);
+
+  /**
+   * Find the entry of a column.
+   * @param name the column name.
+   * @return the constant iterator to the entry, or @a end() if not present.
+   */
+  const_iterator find(const string& name) const;
+
+  /**
+   * Get the value of a column, adding an empty one behind the others if not present.
+   * @param name the column name.
+   * @return a reference to the value.
+   */
+  string& operator[](const string& name);
+
+  /**
+   * Remove the entry of a column.
+   * @param name the column name.
+   * @return the number of removed entries.
+   */
+  size_t erase(const string& name);
+
+  /**
+   * Remove an entry.
+   * @param it the iterator to the entry.
+   * @return the iterator to the following entry.
+   */
+  iterator erase(iterator it) { return m_entries.erase(it); }
+
+  /**
+   * Get the value of a column and remove it from the row.
+   * @param name the column name.
+   * @return the value, or empty if not present.
+   */
+  string pluck(const string& name);
+
+  /**
+   * @return the entries as map by column name (e.g. for use as attributes).
+   */
+  map<string, string> toMap() const { return map<string, string>(m_entries.begin(), m_entries.end()); }
+
+
+ private:
+  /** the entries in column order. */
+  vector<value_type> m_entries;
+};
+
+/**
+ * The split rows of a configuration file stored in a binary cache file for skipping the parsing when unchanged.
+ */
+class RowCache {
+ public:
+  /**
+   * Constructor.
+   * @param cacheFile the name of the binary cache file.
+   * @param mtime the modification time of the source file.
+   * @param sourceKey the key identifying the state of the source file, i.e. changing whenever the content of the
+   * source file might have changed even within the same second (e.g. derived from the modification time in
+   * nanoseconds, the inode, and the size).
+   */
+  RowCache(const string& cacheFile, time_t mtime, uint64_t sourceKey)
+    : m_cacheFile(cacheFile), m_mtime(mtime), m_sourceKey(sourceKey), m_complete(false), m_hash(0), m_size(0),
+      m_nextRow(0) {}
+
+  /**
+   * Load the rows from the cache file if it matches the source file.
+   * @return true when the rows were loaded and are ready for replay.
+   */
+  bool load();
+
+  /**
+   * Save the recorded rows to the cache file.
+   * @return true on success.
+   */
+  bool save() const;
+
+  /**
+   * Return whether all rows are available, i.e. loaded from the cache file or completely recorded.
+   * @return true when all rows are available.
+   */
+  bool isComplete() const { return m_complete; }
+
+  /**
+   * Return whether another row is available for replay.
+   * @return true when another row is available.
+   */
+  bool hasNextRow() const { return m_complete && m_nextRow < m_rows.size(); }
+
+  /**
+   * Get the next row for replay, moving it out of this @a RowCache.
+   * @param lineNo the variable in which to store the line number of the row.
+   * @param row the @a vector in which to store the fields of the row.
+   * @return true when a row was available.
+   */
+  bool nextRow(unsigned int* lineNo, vector<string>* row);
+
+  /**
+   * Record a row split from the source file.
+   * @param lineNo the line number of the row.
+   * @param row the fields of the row.
+   */
+  void addRow(unsigned int lineNo, const vector<string>& row) { m_rows.emplace_back(lineNo, row); }
+
+  /**
+   * Mark the recorded rows as complete and ready for replay.
+   * @param hash the hash of the source file.
+   * @param size the normalized size of the source file.
+   */
+  void setComplete(size_t hash, size_t size);
+
+  /**
+   * @return the modification time of the source file.
+   */
+  time_t getMtime() const { return m_mtime; }
+
+  /**
+   * @return the hash of the source file.
+   */
+  size_t getHash() const { return m_hash; }
+
+  /**
+   * @return the normalized size of the source file.
+   */
+  size_t getSize() const { return m_size; }
+
+
+ private:
+  /** the name of the binary cache file. */
+  const string m_cacheFile;
+
+  /** the modification time of the source file. */
+  const time_t m_mtime;
+
+  /** the key identifying the state of the source file. */
+  const uint64_t m_sourceKey;
+
+  /** whether all rows are available. */
+  bool m_complete;
+
+  /** the hash of the source file. */
+  size_t m_hash;
+
+  /** the normalized size of the source file. */
+  size_t m_size;
+
+  /** the rows with their line number. */
+  vector<pair<unsigned int, vector<string>>> m_rows;
+
+  /** the index of the next row to replay. */
+  size_t m_nextRow;
+};
+
+
 /**
  * An abstract class that support reading definitions from a file.
  */
@@ -68,7 +291,7 @@ class FileReader {
   /**
    * Constructor.
    */
-  FileReader() {}
+  FileReader() : m_verboseOutput(nullptr) {}
 
   /**
    * Destructor.
@@ -84,6 +307,12 @@ class FileReader {
    */
   static istream* openFile(const string& filename, string* errorDescription, time_t* time = nullptr);
 
+  /**
+   * Set the stream to which the problems are written when reading verbosely.
+   * @param output the @a ostream to write the problems to, or nullptr for the standard output.
+   */
+  void setVerboseOutput(ostream* output) { m_verboseOutput = output; }
+
   /**
    * Read the definitions from a stream.
    * @param stream the @a istream to read from.
@@ -95,11 +324,13 @@ class FileReader {
    * @param replace whether to replace an already existing entry.
    * @param hash optional pointer to a @a size_t value for storing the hash of the file, or nullptr.
    * @param size optional pointer to a @a size_t value for storing the normalized size of the file, or nullptr.
+   * @param cache optional pointer to a @a RowCache to replay the rows from when complete (@p stream is not used
+   * then and may be nullptr), or to record the rows to otherwise, or nullptr.
    * @return @a RESULT_OK on success, or an error code.
    */
   virtual result_t readFromStream(istream* stream, const string& filename, const time_t& mtime, bool verbose,
       map<string, string>* defaults, string* errorDescription, bool replace = false, size_t* hash = nullptr,
-      size_t* size = nullptr);
+      size_t* size = nullptr, RowCache* cache = nullptr);
 
   /**
    * Read a single line definition from the stream.
@@ -112,10 +343,27 @@ class FileReader {
    * @param replace whether to replace an already existing entry.
    * @param hash optional pointer to a @a size_t value for updating with the hash of the line, or nullptr.
    * @param size optional pointer to a @a size_t value for updating with the normalized length of the line, or nullptr.
+   * @param cache optional pointer to a @a RowCache to replay the row from when complete, or to record the row to
+   * otherwise, or nullptr.
    * @return @a RESULT_OK on success, or an error code.
    */
   virtual result_t readLineFromStream(istream* stream, const string& filename, bool verbose,
-      unsigned int* lineNo, vector<string>* row, string* errorDescription, bool replace, size_t* hash, size_t* size);
+      unsigned int* lineNo, vector<string>* row, string* errorDescription, bool replace, size_t* hash, size_t* size,
+      RowCache* cache = nullptr);
+
+  /**
+   * Add a single line definition that was split before.
+   * @param split whether the row was split, false at the end of the file.
+   * @param filename the name of the file being read.
+   * @param verbose whether to verbosely log problems.
+   * @param lineNo the line number of the row.
+   * @param row the definition row (allowed to be modified).
+   * @param errorDescription a string in which to store the error description in case of error.
+   * @param replace whether to replace an already existing entry.
+   * @return @a RESULT_OK on success, or an error code.
+   */
+  result_t addSplitRow(bool split, const string& filename, bool verbose, unsigned int lineNo, vector<string>* row,
+      string* errorDescription, bool replace);
 
   /**
    * Add a definition that was read from a file.
@@ -153,6 +401,19 @@ class FileReader {
   static bool splitFields(istream* stream, vector<string>* row, unsigned int* lineNo,
       size_t* hash = nullptr, size_t* size = nullptr);
 
+  /**
+   * Split the next line(s) from a buffer holding the whole file into fields.
+   * @param data pointer to the current position in the buffer (advanced behind the line(s) read).
+   * @param end the end of the buffer.
+   * @param row the @a vector to which to add the fields. This will be empty for completely empty and comment lines.
+   * @param lineNo the current line number (incremented with each line read).
+   * @param hash optional pointer to a @a size_t value for combining the hash of the line with, or nullptr.
+   * @param size optional pointer to a @a size_t value to add the trimmed line length to, or nullptr.
+   * @return true if there are more lines to read, false when there are no more lines left.
+   */
+  static bool splitFields(const char** data, const char* end, vector<string>* row, unsigned int* lineNo,
+      size_t* hash = nullptr, size_t* size = nullptr);
+
   /**
    * Format the specified hash as 8 hex digits to the output stream.
    * @param hash the hash code.
@@ -173,6 +434,11 @@ class FileReader {
    */
   static result_t formatError(const string& filename, unsigned int lineNo, result_t result,
       const string& error, string* errorDescription);
+
+
+ private:
+  /** the @a ostream to which the problems are written when reading verbosely, or nullptr for the standard output. */
+  ostream* m_verboseOutput;
 };
 
 
@@ -210,7 +476,7 @@ class MappedFileReader : public FileReader {
   // @copydoc
   result_t readFromStream(istream* stream, const string& filename, const time_t& mtime, bool verbose,
       map<string, string>* defaults, string* errorDescription, bool replace = false, size_t* hash = nullptr,
-      size_t* size = nullptr) override;
+      size_t* size = nullptr, RowCache* cache = nullptr) override;
 
   /**
    * Extract default values from the file name.
@@ -221,8 +487,9 @@ class MappedFileReader : public FileReader {
    * @param hardware optional pointer to a in which to store the numeric hardware version, or nullptr.
    * @return true if the minimum parts were extracted, false otherwise.
    */
-  virtual bool extractDefaultsFromFilename(const string& filename, map<string, string>* defaults,
-      symbol_t* destAddress = nullptr, unsigned int* software = nullptr, unsigned int* hardware = nullptr) const {
+  virtual bool extractDefaultsFromFilename(const string& /*filename*/, map<string, string>* /*defaults*/,
+      symbol_t* /*destAddress*/ = nullptr, unsigned int* /*software*/ = nullptr,
+      unsigned int* /*hardware*/ = nullptr) const {
     return false;
   }
 
@@ -243,15 +510,15 @@ class MappedFileReader : public FileReader {
 
   /**
    * Add a default row that was read from a file.
-   * @param row the default row by field name.
-   * @param subRows the sub default rows, each by field name.
+   * @param row the default @a MappedRow.
+   * @param subRows the sub default @a MappedRow instances.
    * @param errorDescription a string in which to store the error description in case of error.
    * @param filename the name of the file being read.
    * @param lineNo the current line number in the file being read.
    * @return @a RESULT_OK on success, or an error code.
    */
-  virtual result_t addDefaultFromFile(const string& filename, unsigned int lineNo, map<string, string>* row,
-      vector< map<string, string> >* subRows, string* errorDescription) {
+  virtual result_t addDefaultFromFile(const string& /*filename*/, unsigned int /*lineNo*/,
+      MappedRow* /*row*/, vector<MappedRow>* /*subRows*/, string* errorDescription) {
     *errorDescription = "defaults not supported";
     return RESULT_ERR_INVALID_ARG;
   }
@@ -260,14 +527,14 @@ class MappedFileReader : public FileReader {
    * Add a definition that was read from a file.
    * @param filename the name of the file being read.
    * @param lineNo the current line number in the file being read.
-   * @param row the main definition row by field name (may be modified).
-   * @param subRows the sub definition rows, each by field name (may be modified).
+   * @param row the main definition @a MappedRow (may be modified).
+   * @param subRows the sub definition @a MappedRow instances (may be modified).
    * @param errorDescription a string in which to store the error description in case of error.
    * @param replace whether to replace an already existing entry.
    * @return @a RESULT_OK on success, or an error code.
    */
-  virtual result_t addFromFile(const string& filename, unsigned int lineNo, map<string, string>* row,
-      vector< map<string, string> >* subRows, string* errorDescription, bool replace = false) = 0;
+  virtual result_t addFromFile(const string& filename, unsigned int lineNo, MappedRow* row,
+      vector<MappedRow>* subRows, string* errorDescription, bool replace = false) = 0;
 
   /**
    * @return a reference to all previously extracted default values by type and field name.
@@ -279,7 +546,7 @@ class MappedFileReader : public FileReader {
   /**
    * @return a reference to all previously extracted sub default values by type and field name.
    */
-  map<string, vector< map<string, string> > >& getSubDefaults() {
+  map<string, vector<MappedRow> >& getSubDefaults() {
     return m_lastSubDefaults;
   }
 
@@ -288,7 +555,7 @@ class MappedFileReader : public FileReader {
    * @param row the mapped row.
    * @return the combined string.
    */
-  static const string combineRow(const map<string, string>& row);
+  static const string combineRow(const MappedRow& row);
 
  protected:
   /** a @a Mutex for access to defaults. */
@@ -308,7 +575,7 @@ class MappedFileReader : public FileReader {
   map<string, map<string, string> > m_lastDefaults;
 
   /** all previously extracted sub default values by type and field name. */
-  map<string, vector< map<string, string> > > m_lastSubDefaults;
+  map<string, vector<MappedRow> > m_lastSubDefaults;
 };
 
 }  // namespace ebusd
@@ -17,6 +17,7 @@
  */
 
 #include "lib/ebus/message.h"
+#include <algorithm>
 #include <string>
 #include <vector>
 #include <cstring>
@@ -69,6 +70,12 @@ using std::endl;
 /** the maximum poll priority for a @a Message referred to by a @a Condition. */
 #define POLL_PRIORITY_CONDITION 5
 
+/** the maximum factor by which the poll priority of a @a Message with unchanged data is backed off. */
+#define POLL_MAX_BACKOFF 8
+
+/** the number of seconds after the last poll from which an update is treated as done by another master. */
+#define POLL_PASSIVE_MARGIN 5
+
 /** the field name constant for the message level. */
 static const char* FIELNAME_LEVEL = "level";
 
@@ -94,6 +101,18 @@ static const char* defaultMessageFieldMap[] = {  // access level not included in
 /** the m_pollOrder of the last polled message. */
 static unsigned int g_lastPollOrder = 0;
 
+/** the global sequence number of changes to the last data of any @a Message. */
+static std::atomic<uint64_t> g_dataSequence(0);
+
+/** the global sequence number of changes to the data of any @a Message referred to by a @a Condition. */
+static std::atomic<uint64_t> g_conditionSequence(0);
+
+/** the maximum number of decoded values kept per @a Message for different decoding options. */
+#define MAX_DECODED_DATA 4
+
+/** the mutex guarding the decoded values of all @a Message instances. */
+static Mutex g_decodedDataMutex;
+
 extern DataFieldTemplates* getTemplates(const string& filename);
 
 extern result_t loadDefinitionsFromConfigPath(FileReader* reader, const string& filename, bool verbose,
@@ -107,14 +126,18 @@ Message::Message(const string& circuit, const string& level, const string& name,
     const DataField* data, bool deleteData,
     size_t pollPriority,
     Condition* condition)
-    : AttributedItem(name, attributes), m_circuit(circuit), m_level(level), m_isWrite(isWrite),
+    : AttributedItem(name, attributes), m_circuit(StringPool::intern(circuit)), m_busCircuit(nullptr),
+      m_level(StringPool::intern(level)),
+      m_isWrite(isWrite),
       m_isPassive(isPassive),
       m_srcAddress(srcAddress), m_dstAddress(dstAddress),
       m_id(id), m_key(createKey(id, isWrite, isPassive, srcAddress, dstAddress)),
       m_data(data), m_deleteData(deleteData),
       m_pollPriority(pollPriority),
       m_usedByCondition(false), m_isScanMessage(false), m_condition(condition),
-      m_lastUpdateTime(0), m_lastChangeTime(0), m_pollOrder(0), m_lastPollTime(0) {
+      m_lastUpdateTime(0), m_lastChangeTime(0), m_pollOrder(0), m_lastPollTime(0), m_lastPassiveUpdateTime(0),
+      m_pollUnchanged(0),
+      m_circuitSequence(nullptr), m_decodedDataNext(0), m_decodedDataGeneration(0) {
   if (circuit == "scan") {
     setScanMessage();
     m_pollPriority = 0;
@@ -124,14 +147,29 @@ Message::Message(const string& circuit, const string& level, const string& name,
 Message::Message(const string& circuit, const string& level, const string& name,
     symbol_t pb, symbol_t sb,
     bool broadcast, const DataField* data, bool deleteData)
-    : AttributedItem(name), m_circuit(circuit), m_level(level), m_isWrite(broadcast),
+    : AttributedItem(name), m_circuit(StringPool::intern(circuit)), m_busCircuit(nullptr),
+      m_level(StringPool::intern(level)),
+      m_isWrite(broadcast),
       m_isPassive(false),
       m_srcAddress(SYN), m_dstAddress(broadcast ? BROADCAST : SYN),
       m_id({pb, sb}), m_key(createKey(pb, sb, broadcast)),
       m_data(data), m_deleteData(deleteData),
       m_pollPriority(0),
       m_usedByCondition(false), m_isScanMessage(true), m_condition(nullptr),
-      m_lastUpdateTime(0), m_lastChangeTime(0), m_pollOrder(0), m_lastPollTime(0) {
+      m_lastUpdateTime(0), m_lastChangeTime(0), m_pollOrder(0), m_lastPollTime(0), m_lastPassiveUpdateTime(0),
+      m_pollUnchanged(0),
+      m_circuitSequence(nullptr), m_decodedDataNext(0), m_decodedDataGeneration(0) {
+}
+
+Message::~Message() {
+  if (m_deleteData) {
+    delete m_data;
+  }
+  StringPool::release(m_circuit);
+  StringPool::release(m_level);
+  if (m_busCircuit) {
+    StringPool::release(*m_busCircuit);
+  }
 }
 
 
@@ -253,9 +291,9 @@ static const map<string, string> noDefaults;
 
 result_t Message::create(const string& filename, const DataFieldTemplates* templates,
     const map<string, map<string, string> >& rowDefaults,
-    const map<string, vector< map<string, string> > >& subRowDefaults,
+    const map<string, vector<MappedRow> >& subRowDefaults,
     const string& typeStr, Condition* condition,
-    map<string, string>* row, vector< map<string, string> >* subRows,
+    MappedRow* row, vector<MappedRow>* subRows,
     string* errorDescription, vector<Message*>* messages) {
   // [type],[circuit],name,[comment],[QQ[;QQ]*],[ZZ],[PBSB],[ID],fields...
   result_t result;
@@ -467,6 +505,7 @@ result_t Message::create(const string& filename, const DataFieldTemplates* templ
     *errorDescription = "data length";
     return RESULT_ERR_INVALID_POS;
   }
+  const map<string, string> attributes = row->toMap();
   unsigned int index = 0;
   bool multiple = dstAddresses.size() > 1;
   char num[10];
@@ -478,10 +517,10 @@ result_t Message::create(const string& filename, const DataFieldTemplates* templ
     }
     Message* message;
     if (chainIds.size() > 1) {
-      message = new ChainedMessage(useCircuit, level, name, isWrite, *row, srcAddress, dstAddress, id, chainIds,
+      message = new ChainedMessage(useCircuit, level, name, isWrite, attributes, srcAddress, dstAddress, id, chainIds,
           chainLengths, data, index == 0, pollPriority, condition);
     } else {
-      message = new Message(useCircuit, level, name, isWrite, isPassive, *row, srcAddress, dstAddress, id, data,
+      message = new Message(useCircuit, level, name, isWrite, isPassive, attributes, srcAddress, dstAddress, id, data,
           index == 0, pollPriority, condition);
     }
     messages->push_back(message);
@@ -645,16 +684,21 @@ void Message::setUsedByCondition() {
   }
 }
 
-bool Message::isAvailable() {
+bool Message::isAvailable() const {
   return (m_condition == nullptr) || m_condition->isTrue();
 }
 
+void Message::addDependentCondition(SimpleCondition* condition) {
+  if (find(m_dependentConditions.begin(), m_dependentConditions.end(), condition) == m_dependentConditions.end()) {
+    m_dependentConditions.push_back(condition);
+  }
+}
+
 bool Message::hasField(const char* fieldName, bool numeric) const {
   return m_data->hasField(fieldName, numeric);
 }
 
-result_t Message::prepareMaster(size_t index, symbol_t srcAddress, symbol_t dstAddress,
-    char separator, istringstream* input, MasterSymbolString* master) {
+result_t Message::prepareMasterHeader(symbol_t srcAddress, symbol_t dstAddress, MasterSymbolString* master) {
   if (m_isPassive) {
     return RESULT_ERR_INVALID_ARG;  // prepare not possible
   }
@@ -670,7 +714,33 @@ result_t Message::prepareMaster(size_t index, symbol_t srcAddress, symbol_t dstA
   }
   master->push_back(m_id[0]);
   master->push_back(m_id[1]);
-  result_t result = prepareMasterPart(index, separator, input, master);
+  return RESULT_OK;
+}
+
+result_t Message::prepareMaster(size_t index, symbol_t srcAddress, symbol_t dstAddress,
+    char separator, istringstream* input, MasterSymbolString* master) {
+  result_t result = prepareMasterHeader(srcAddress, dstAddress, master);
+  if (result != RESULT_OK) {
+    return result;
+  }
+  result = prepareMasterPart(index, separator, input, master);
+  if (result != RESULT_OK) {
+    return result;
+  }
+  result = storeLastData(index, *master);
+  if (result < RESULT_OK) {
+    return result;
+  }
+  return RESULT_OK;
+}
+
+result_t Message::prepareMaster(size_t index, symbol_t srcAddress, symbol_t dstAddress,
+    const FieldValues& values, MasterSymbolString* master) {
+  result_t result = prepareMasterHeader(srcAddress, dstAddress, master);
+  if (result != RESULT_OK) {
+    return result;
+  }
+  result = prepareMasterPart(index, values, master);
   if (result != RESULT_OK) {
     return result;
   }
@@ -697,6 +767,23 @@ result_t Message::prepareMasterPart(size_t index, char separator, istringstream*
   return result;
 }
 
+result_t Message::prepareMasterPart(size_t index, const FieldValues& values, MasterSymbolString* master) {
+  if (index != 0) {
+    return RESULT_ERR_NOTFOUND;
+  }
+  master->push_back(0);  // length, will be set later
+  for (size_t i = 2; i < m_id.size(); i++) {
+    master->push_back(m_id[i]);
+  }
+  size_t valueIndex = 0;
+  result_t result = m_data->writeValues(getIdLength(), values, &valueIndex, master, nullptr);
+  if (result != RESULT_OK) {
+    return result;
+  }
+  master->adjustHeader();
+  return result;
+}
+
 result_t Message::prepareSlave(istringstream* input, SlaveSymbolString* slave) {
   if (m_isWrite) {
     return RESULT_ERR_INVALID_ARG;  // prepare not possible
@@ -712,7 +799,10 @@ result_t Message::prepareSlave(istringstream* input, SlaveSymbolString* slave) {
   if (*slave != m_lastSlaveData) {
     m_lastChangeTime = m_lastUpdateTime;
     m_lastSlaveData = *slave;
+    updateFieldChanges(m_lastSlaveData, 0);
+    invalidateDecodedData();
   }
+  increaseDataSequence();
   return result;
 }
 
@@ -733,12 +823,16 @@ result_t Message::storeLastData(size_t index, const MasterSymbolString& data) {
   case 1:  // completely different
     m_lastChangeTime = m_lastUpdateTime;
     m_lastMasterData = data;
+    invalidateDecodedData();
+    updateFieldChanges(m_lastMasterData, getIdLength());
     break;
   case 2:  // only master address is different
     m_lastMasterData = data;
+    invalidateDecodedData();
     break;
   // else: identical
   }
+  increaseDataSequence();
   return RESULT_OK;
 }
 
@@ -749,10 +843,72 @@ result_t Message::storeLastData(size_t index, const SlaveSymbolString& data) {
   if (m_lastSlaveData != data) {
     m_lastChangeTime = m_lastUpdateTime;
     m_lastSlaveData = data;
+    invalidateDecodedData();
+    updateFieldChanges(m_lastSlaveData, 0);
   }
+  increaseDataSequence();
   return RESULT_OK;
 }
 
+result_t Message::restoreLastData(const MasterSymbolString& master, const SlaveSymbolString& slave,
+    time_t updateTime, time_t changeTime) {
+  if (updateTime <= 0 || m_lastUpdateTime >= updateTime) {
+    return RESULT_EMPTY;
+  }
+  // store in this class only as the persisted data is already combined for chained messages
+  result_t result = Message::storeLastData(0, master);
+  if (result == RESULT_OK) {
+    result = Message::storeLastData(0, slave);
+  }
+  if (result != RESULT_OK) {
+    return result;
+  }
+  m_lastUpdateTime = updateTime;
+  m_lastChangeTime = changeTime > updateTime ? updateTime : changeTime;
+  for (auto& fieldChangeTime : m_lastFieldChangeTimes) {
+    fieldChangeTime = m_lastChangeTime;
+  }
+  increaseDataSequence();
+  return RESULT_OK;
+}
+
+uint64_t Message::getDataSequence() {
+  return g_dataSequence.load();
+}
+
+uint64_t Message::getConditionSequence() {
+  return g_conditionSequence.load();
+}
+
+void Message::increaseDataSequence() {
+  g_dataSequence++;
+  if (m_circuitSequence) {
+    (*m_circuitSequence)++;
+  }
+}
+
+void Message::updateFieldChanges(const SymbolString& data, size_t offset) {
+  vector<uint32_t> hashes = m_lastFieldHashes;
+  result_t result = m_data->hashFields(data, offset, &hashes);
+  if (m_lastFieldChangeTimes.size() < hashes.size()) {
+    m_lastFieldChangeTimes.resize(hashes.size(), 0);
+  }
+  for (size_t index = 0; index < hashes.size(); index++) {
+    // treat all fields as changed when the data is not decodable (any more)
+    uint32_t previous = index < m_lastFieldHashes.size() ? m_lastFieldHashes[index] : 0;
+    if (result != RESULT_OK || hashes[index] != previous) {
+      m_lastFieldChangeTimes[index] = m_lastChangeTime;
+    }
+  }
+  m_lastFieldHashes.swap(hashes);
+  if (!m_dependentConditions.empty()) {
+    g_conditionSequence++;
+  }
+  for (const auto condition : m_dependentConditions) {
+    condition->update();
+  }
+}
+
 result_t Message::decodeLastData(bool master, bool leadingSeparator, const char* fieldName,
     ssize_t fieldIndex, OutputFormat outputFormat, ostream* output) const {
   result_t result;
@@ -774,8 +930,71 @@ result_t Message::decodeLastData(bool master, bool leadingSeparator, const char*
 
 result_t Message::decodeLastData(bool leadingSeparator, const char* fieldName,
     ssize_t fieldIndex, const OutputFormat outputFormat, ostream* output) const {
-  ostream::pos_type startPos = output->tellp();
-  result_t result = m_data->read(m_lastMasterData, getIdLength(), leadingSeparator, fieldName, fieldIndex,
+  OutputBuffer buffer;
+  result_t result = decodeLastData(leadingSeparator, fieldName, fieldIndex, outputFormat, &buffer);
+  output->write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+  return result;
+}
+
+result_t Message::decodeLastData(bool leadingSeparator, const char* fieldName,
+    ssize_t fieldIndex, const OutputFormat outputFormat, OutputBuffer* output) const {
+  if (fieldName != nullptr) {
+    return decodeData(m_lastMasterData, m_lastSlaveData, leadingSeparator, fieldName, fieldIndex, outputFormat,
+        output);
+  }
+  g_decodedDataMutex.lock();
+  for (const auto& decoded : m_decodedData) {
+    if (decoded.outputFormat == outputFormat && decoded.leadingSeparator == leadingSeparator
+        && decoded.fieldIndex == fieldIndex) {
+      result_t result = decoded.result;
+      output->append(decoded.value.data(), decoded.value.size());
+      g_decodedDataMutex.unlock();
+      return result;
+    }
+  }
+  unsigned int generation = m_decodedDataGeneration;
+  g_decodedDataMutex.unlock();
+  // decode without holding the lock and keep the value only if the data was not changed in the meantime
+  OutputBuffer value;
+  result_t result = decodeData(m_lastMasterData, m_lastSlaveData, leadingSeparator, nullptr, fieldIndex,
+      outputFormat, &value);
+  DecodedData decoded = {outputFormat, leadingSeparator, fieldIndex, result, value.str()};
+  output->append(decoded.value.data(), decoded.value.size());
+  g_decodedDataMutex.lock();
+  if (generation == m_decodedDataGeneration) {
+    if (m_decodedData.size() < MAX_DECODED_DATA) {
+      m_decodedData.push_back(decoded);
+    } else {
+      m_decodedData[m_decodedDataNext] = decoded;
+      m_decodedDataNext = (m_decodedDataNext + 1) % MAX_DECODED_DATA;
+    }
+  }
+  g_decodedDataMutex.unlock();
+  return result;
+}
+
+void Message::invalidateDecodedData() {
+  g_decodedDataMutex.lock();
+  m_decodedData.clear();
+  m_decodedDataNext = 0;
+  m_decodedDataGeneration++;
+  g_decodedDataMutex.unlock();
+}
+
+result_t Message::decodeData(const MasterSymbolString& master, const SlaveSymbolString& slave,
+    bool leadingSeparator, const char* fieldName, ssize_t fieldIndex, const OutputFormat outputFormat,
+    ostream* output) const {
+  OutputBuffer buffer;
+  result_t result = decodeData(master, slave, leadingSeparator, fieldName, fieldIndex, outputFormat, &buffer);
+  output->write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+  return result;
+}
+
+result_t Message::decodeData(const MasterSymbolString& master, const SlaveSymbolString& slave,
+    bool leadingSeparator, const char* fieldName, ssize_t fieldIndex, const OutputFormat outputFormat,
+    OutputBuffer* output) const {
+  size_t startPos = output->size();
+  result_t result = m_data->read(master, getIdLength(), leadingSeparator, fieldName, fieldIndex,
       outputFormat, -1, output);
   if (result < RESULT_OK) {
     return result;
@@ -790,8 +1009,8 @@ result_t Message::decodeLastData(bool leadingSeparator, const char* fieldName,
     }
   }
   if (!skipSlaveData) {
-    bool useLeadingSeparator = leadingSeparator || output->tellp() > startPos;
-    result = m_data->read(m_lastSlaveData, 0, useLeadingSeparator, fieldName, fieldIndex, outputFormat, -1, output);
+    bool useLeadingSeparator = leadingSeparator || output->size() > startPos;
+    result = m_data->read(slave, 0, useLeadingSeparator, fieldName, fieldIndex, outputFormat, -1, output);
     if (result < RESULT_OK) {
       return result;
     }
@@ -822,6 +1041,13 @@ result_t Message::decodeLastDataNumField(const char* fieldName, ssize_t fieldInd
   return result;
 }
 
+result_t Message::decodeLastNumericValues(vector<double>* values) const {
+  values->clear();
+  result_t result = m_data->readNumericValues(m_lastMasterData, getIdLength(), values);
+  result_t slaveResult = m_data->readNumericValues(m_lastSlaveData, 0, values);
+  return result == RESULT_OK ? slaveResult : result;
+}
+
 void Message::dumpHeader(const vector<string>* fieldNames, ostream* output) {
   bool first = true;
   if (fieldNames == nullptr) {
@@ -892,7 +1118,7 @@ void Message::dumpField(const string& fieldName, bool withConditions, ostream* o
     return;
   }
   if (fieldName == "circuit") {
-    dumpString(false, m_circuit, output);
+    dumpString(false, getCircuit(), output);
     return;
   }
   if (fieldName == "level") {
@@ -934,7 +1160,7 @@ void Message::dumpField(const string& fieldName, bool withConditions, ostream* o
   dumpAttribute(false, false, fieldName, output);
 }
 
-void addData(const SymbolString& data, ostringstream* output) {
+void addData(const SymbolString& data, OutputBuffer* output) {
   if (data.size() == 0) {
     return;
   }
@@ -943,13 +1169,13 @@ void addData(const SymbolString& data, ostringstream* output) {
     if (pos > 0) {
       *output << ", ";
     }
-    *output << dec << static_cast<unsigned>(data[pos]);
+    output->appendUnsigned(data[pos]);
   }
   *output << "]";
 }
 
 void Message::decodeJson(bool leadingSeparator, bool appendDirection, bool addRaw, OutputFormat outputFormat,
-    ostringstream* output) const {
+    OutputBuffer* output) const {
   if (leadingSeparator) {
     *output << ",";
   }
@@ -966,20 +1192,23 @@ void Message::decodeJson(bool leadingSeparator, bool appendDirection, bool addRa
           << "\n    \"name\": \"" << getName() << "\""
           << ",\n    \"passive\": " << (isPassive() ? "true" : "false")
           << ",\n    \"write\": " << (isWrite() ? "true" : "false")
-          << ",\n    \"lastup\": " << setw(0) << dec << m_lastUpdateTime;
+          << ",\n    \"lastup\": ";
+  output->appendSigned(m_lastUpdateTime);
   bool hasData = getLastUpdateTime() != 0;
   if (hasData || withDefinition) {
     if (withDefinition && m_srcAddress != SYN) {
-      *output << ",\n    \"qq\": " << dec << static_cast<unsigned>(m_srcAddress);
+      *output << ",\n    \"qq\": ";
+      output->appendUnsigned(m_srcAddress);
     }
-    *output << ",\n    \"zz\": " << dec << static_cast<unsigned>(m_dstAddress);
+    *output << ",\n    \"zz\": ";
+    output->appendUnsigned(m_dstAddress);
     if (withDefinition) {
-      *output << ",\n    \"id\": [" << dec;
+      *output << ",\n    \"id\": [";
       for (auto it = m_id.begin(); it < m_id.end(); it++) {
         if (it > m_id.begin()) {
           *output << ", ";
         }
-        *output << dec << static_cast<unsigned>(*it);
+        output->appendUnsigned(*it);
       }
       *output << "]";
     }
@@ -988,24 +1217,22 @@ void Message::decodeJson(bool leadingSeparator, bool appendDirection, bool addRa
       if (addRaw) {
         addData(m_lastMasterData, output);
         addData(m_lastSlaveData, output);
-        *output << dec;
       }
-      size_t pos = (size_t)output->tellp();
+      size_t pos = output->size();
       *output << ",\n    \"fields\": {";
       result_t dret = decodeLastData(false, nullptr, -1, outputFormat, output);
       if (dret == RESULT_OK) {
         *output << "\n    }";
       } else {
-        string prefix = output->str().substr(0, pos);
-        output->str("");
-        output->clear();  // remove written fields
-        *output << prefix << ",\n    \"decodeerror\": \"" << getResultCode(dret) << "\"";
+        output->truncate(pos);  // remove written fields
+        *output << ",\n    \"decodeerror\": \"" << getResultCode(dret) << "\"";
       }
     }
     if (withDefinition) {
       *output << ",\n    \"fielddefs\": [";
-      m_data->dump(false, true, output);
-      *output << "\n    ]";
+      ostringstream fieldDefs;
+      m_data->dump(false, true, &fieldDefs);
+      *output << fieldDefs.str() << "\n    ]";
     }
   }
   *output << "\n   }";
@@ -1124,8 +1351,7 @@ bool ChainedMessage::checkId(const Message& other) const {
 
 result_t ChainedMessage::prepareMasterPart(size_t index, char separator, istringstream* input,
     MasterSymbolString* master) {
-  size_t cnt = getCount();
-  if (index >= cnt) {
+  if (index >= getCount()) {
     return RESULT_ERR_NOTFOUND;
   }
   MasterSymbolString allData;
@@ -1133,6 +1359,25 @@ result_t ChainedMessage::prepareMasterPart(size_t index, char separator, istring
   if (result != RESULT_OK) {
     return result;
   }
+  return appendMasterPart(index, allData, master);
+}
+
+result_t ChainedMessage::prepareMasterPart(size_t index, const FieldValues& values, MasterSymbolString* master) {
+  if (index >= getCount()) {
+    return RESULT_ERR_NOTFOUND;
+  }
+  MasterSymbolString allData;
+  size_t valueIndex = 0;
+  result_t result = m_data->writeValues(0, values, &valueIndex, &allData, nullptr);
+  if (result != RESULT_OK) {
+    return result;
+  }
+  return appendMasterPart(index, allData, master);
+}
+
+result_t ChainedMessage::appendMasterPart(size_t index, const MasterSymbolString& allData,
+    MasterSymbolString* master) {
+  size_t cnt = getCount();
   size_t pos = 0, addData = 0;
   if (m_isWrite) {
     addData = m_lengths[0];
@@ -1157,7 +1402,7 @@ result_t ChainedMessage::prepareMasterPart(size_t index, char separator, istring
       m_lastMasterUpdateTimes[index] = m_lastSlaveUpdateTimes[index] = 0;
     }
   }
-  return result;
+  return RESULT_OK;
 }
 
 result_t ChainedMessage::storeLastData(const MasterSymbolString& master, const SlaveSymbolString& slave) {
@@ -1393,8 +1638,35 @@ result_t splitValues(const string& valueList, vector<unsigned int>* valueRanges)
   return RESULT_OK;
 }
 
+void Condition::addDependent(Condition* condition) {
+  if (find(m_dependents.begin(), m_dependents.end(), condition) == m_dependents.end()) {
+    m_dependents.push_back(condition);
+  }
+}
+
+void Condition::update() {
+  bool isTrue = evaluate();
+  if (isTrue == m_isTrue) {
+    return;
+  }
+  m_isTrue = isTrue;
+  for (const auto condition : m_dependents) {
+    condition->update();
+  }
+}
+
+Condition* Condition::copy(map<const Condition*, Condition*>* copies) const {
+  const auto it = copies->find(this);
+  if (it != copies->end()) {
+    return it->second;
+  }
+  Condition* ret = createCopy(copies);
+  (*copies)[this] = ret;
+  return ret;
+}
+
 result_t Condition::create(const string& condName, const map<string, string>& rowDefaults,
-    map<string, string>* row, SimpleCondition** returnValue) {
+    MappedRow* row, SimpleCondition** returnValue) {
   // type=name,circuit,name=messagename,[comment],qq=[fieldname],[ZZ],pbsb=values
   string circuit = (*row)["circuit"];  // circuit[#level]
   string level;
@@ -1494,7 +1766,7 @@ SimpleCondition* SimpleCondition::derive(const string& valueList) const {
 
 void SimpleCondition::dump(bool matched, ostream* output) const {
   if (matched) {
-    if (!m_isTrue) {
+    if (!isTrue()) {
       return;
     }
     *output << "[" << m_refName;
@@ -1565,6 +1837,8 @@ result_t SimpleCondition::resolve(void (*readMessageFunc)(Message* message), Mes
     }
     m_message = message;
     message->setUsedByCondition();
+    message->addDependentCondition(this);
+    update();
     if (m_name.length() > 0 && !message->isScanMessage()) {
       messages->addPollMessage(true, message);
     }
@@ -1575,19 +1849,21 @@ result_t SimpleCondition::resolve(void (*readMessageFunc)(Message* message), Mes
   return RESULT_OK;
 }
 
-bool SimpleCondition::isTrue() {
-  if (!m_message) {
+bool SimpleCondition::evaluate() {
+  if (!m_message || m_message->getLastChangeTime() == 0) {
     return false;
   }
-  if (m_message->getLastChangeTime() > m_lastCheckTime) {
-    bool isTrue = !m_hasValues;  // for message seen check
-    if (!isTrue) {
-      isTrue = checkValue(m_message, m_field);
-    }
-    m_isTrue = isTrue;
-    m_lastCheckTime = m_message->getLastChangeTime();
-  }
-  return m_isTrue;
+  return !m_hasValues || checkValue(m_message, m_field);  // without values only for message seen check
+}
+
+Condition* SimpleCondition::createCopy(map<const Condition*, Condition*>* /*copies*/) const {
+  return new SimpleCondition(m_condName, m_refName, m_circuit, m_level, m_name, m_dstAddress, m_field, m_hasValues);
+}
+
+
+Condition* SimpleNumericCondition::createCopy(map<const Condition*, Condition*>* /*copies*/) const {
+  return new SimpleNumericCondition(m_condName, m_refName, m_circuit, m_level, m_name, m_dstAddress, m_field,
+      m_valueRanges);
 }
 
 
@@ -1606,6 +1882,10 @@ bool SimpleNumericCondition::checkValue(const Message* message, const string& fi
 }
 
 
+Condition* SimpleStringCondition::createCopy(map<const Condition*, Condition*>* /*copies*/) const {
+  return new SimpleStringCondition(m_condName, m_refName, m_circuit, m_level, m_name, m_dstAddress, m_field, m_values);
+}
+
 bool SimpleStringCondition::checkValue(const Message* message, const string& field) {
   ostringstream output;
   result_t result = message->decodeLastData(false, field.length() == 0 ? nullptr : field.c_str(), -1, 0, &output);
@@ -1637,11 +1917,13 @@ result_t CombinedCondition::resolve(void (*readMessageFunc)(Message* message), M
       *errorMessage << dummy.str();
       return ret;
     }
+    condition->addDependent(this);
   }
+  update();
   return RESULT_OK;
 }
 
-bool CombinedCondition::isTrue() {
+bool CombinedCondition::evaluate() {
   for (const auto condition : m_conditions) {
     if (!condition->isTrue()) {
       return false;
@@ -1650,9 +1932,17 @@ bool CombinedCondition::isTrue() {
   return true;
 }
 
+Condition* CombinedCondition::createCopy(map<const Condition*, Condition*>* copies) const {
+  CombinedCondition* ret = new CombinedCondition();
+  for (const auto condition : m_conditions) {
+    ret->combineAnd(condition->copy(copies));
+  }
+  return ret;
+}
+
 
 result_t Instruction::create(const string& contextPath, const string& type,
-    Condition* condition, const map<string, string>& row, const map<string, string>& defaults,
+    Condition* condition, const MappedRow& row, const map<string, string>& defaults,
     Instruction** returnValue) {
   // type[,argument]*
   bool singleton = type == "load";
@@ -1749,13 +2039,163 @@ result_t LoadInstruction::execute(MessageMap* messages, ostringstream* log) {
 }
 
 
+void MessageKeyIndex::set(uint64_t key, const vector<Message*>* messages) {
+  if ((m_size+1)*4 > m_buckets.size()*3) {
+    // keep the load factor below 75%
+    rehash(m_buckets.empty() ? 6 : 64-m_shift+1);
+  }
+  size_t mask = m_buckets.size()-1;
+  for (size_t pos = getSlot(key); ; pos = (pos+1) & mask) {
+    Bucket& bucket = m_buckets[pos];
+    if (bucket.m_messages == nullptr) {
+      bucket.m_key = key;
+      bucket.m_messages = messages;
+      m_size++;
+      return;
+    }
+    if (bucket.m_key == key) {
+      bucket.m_messages = messages;
+      return;
+    }
+  }
+}
+
+void MessageKeyIndex::erase(uint64_t key) {
+  if (m_size == 0) {
+    return;
+  }
+  size_t mask = m_buckets.size()-1;
+  size_t pos = getSlot(key);
+  while (m_buckets[pos].m_messages != nullptr && m_buckets[pos].m_key != key) {
+    pos = (pos+1) & mask;
+  }
+  if (m_buckets[pos].m_messages == nullptr) {
+    return;  // not found
+  }
+  // shift back following entries of the same probe sequence instead of leaving a tombstone
+  for (size_t next = (pos+1) & mask; m_buckets[next].m_messages != nullptr; next = (next+1) & mask) {
+    size_t slot = getSlot(m_buckets[next].m_key);
+    if (((next-slot) & mask) >= ((next-pos) & mask)) {
+      m_buckets[pos] = m_buckets[next];
+      pos = next;
+    }
+  }
+  m_buckets[pos].m_messages = nullptr;
+  m_size--;
+}
+
+void MessageKeyIndex::clear() {
+  m_buckets.clear();
+  m_size = 0;
+  m_shift = 64;
+}
+
+void MessageKeyIndex::rehash(unsigned int bits) {
+  vector<Bucket> old;
+  old.swap(m_buckets);
+  m_buckets.resize((size_t)1 << bits, Bucket{0, nullptr});
+  m_shift = 64-bits;
+  m_size = 0;
+  for (const auto& bucket : old) {
+    if (bucket.m_messages != nullptr) {
+      set(bucket.m_key, bucket.m_messages);
+    }
+  }
+}
+
+
+/** the initial value for @a hashNameKey() (64 bit FNV-1a offset basis). */
+#define NAME_KEY_HASH_INIT 0xcbf29ce484222325ULL
+
+/**
+ * Continue the hash of a name key (as used in @a MessageMap::m_messagesByName) ignoring the case.
+ * @param hash the hash calculated so far.
+ * @param str the characters to add.
+ * @param len the number of characters to add.
+ * @return the updated hash.
+ */
+static uint64_t hashNameKey(uint64_t hash, const char* str, size_t len) {
+  for (size_t pos = 0; pos < len; pos++) {
+    hash ^= (uint64_t)(unsigned char)::tolower(str[pos]);
+    hash *= 0x100000001b3ULL;  // 64 bit FNV-1a prime
+  }
+  return hash;
+}
+
+/**
+ * Calculate the hash of a name key ignoring the case.
+ * @param circuit the circuit name, or empty.
+ * @param name the message name.
+ * @param type the type character ('P' for passive, 'W' for write, 'R' for read).
+ * @return the hash of the name key.
+ */
+static uint64_t hashNameKey(const string& circuit, const string& name, char type) {
+  uint64_t hash = hashNameKey(NAME_KEY_HASH_INIT, circuit.c_str(), circuit.length());
+  char sep = FIELD_SEPARATOR;
+  hash = hashNameKey(hash, &sep, 1);
+  hash = hashNameKey(hash, name.c_str(), name.length());
+  char lowerType = static_cast<char>(::tolower(type));
+  return hashNameKey(hash, &lowerType, 1);
+}
+
+/**
+ * Check whether a part of a lowercase name key matches the specified string ignoring the case.
+ * @param key the lowercase name key.
+ * @param pos the start position of the part in the key.
+ * @param len the length of the part in the key.
+ * @param check the string to check.
+ * @param completeMatch true to require the whole part to match, false to allow a match anywhere within the part.
+ * @return whether the part matches.
+ */
+static bool matchesNameKeyPart(const string& key, size_t pos, size_t len, const string& check,
+    bool completeMatch) {
+  size_t checkLen = check.length();
+  if (completeMatch ? len != checkLen : len < checkLen) {
+    return false;
+  }
+  for (size_t start = pos; start+checkLen <= pos+len; start++) {
+    size_t idx = 0;
+    while (idx < checkLen && key[start+idx] == static_cast<char>(::tolower(check[idx]))) {
+      idx++;
+    }
+    if (idx == checkLen) {
+      return true;
+    }
+    if (completeMatch) {
+      break;
+    }
+  }
+  return false;
+}
+
+/**
+ * Check whether a lowercase name key matches the specified circuit, name, and type ignoring the case.
+ * @param key the lowercase name key.
+ * @param circuit the circuit name, or empty.
+ * @param name the message name.
+ * @param type the type character ('P' for passive, 'W' for write, 'R' for read).
+ * @return whether the name key matches.
+ */
+static bool matchesNameKey(const string& key, const string& circuit, const string& name, char type) {
+  size_t circuitLen = circuit.length();
+  size_t nameLen = name.length();
+  return key.length() == circuitLen+nameLen+2 && key[circuitLen] == FIELD_SEPARATOR
+    && key[circuitLen+nameLen+1] == type
+    && matchesNameKeyPart(key, 0, circuitLen, circuit, true)
+    && matchesNameKeyPart(key, circuitLen+1, nameLen, name, true);
+}
+
+
 vector<string> MessageMap::s_noFiles;
 
+const string MessageMap::s_noCircuit;
+
 result_t MessageMap::add(bool storeByName, Message* message, bool replace) {
   uint64_t key = message->getKey();
   bool conditional = message->isConditional();
+  // the whole insertion is done under the lock, as messages may be added while others are looked up
+  lock();
   if (!m_addAll) {
-    lock();
     const auto keyIt = m_messagesByKey.find(key);
     if (keyIt != m_messagesByKey.end()) {
       if (replace) {
@@ -1779,14 +2219,17 @@ result_t MessageMap::add(bool storeByName, Message* message, bool replace) {
         }
       }
     }
-    unlock();
   }
+  if (!m_circuitPrefix.empty() && !message->m_busCircuit && !message->m_circuit.empty()) {
+    message->m_busCircuit = &StringPool::intern(m_circuitPrefix + message->m_circuit);
+  }
+  message->m_circuitSequence = getCircuitSequence(message->getCircuit());
   bool isPassive = message->isPassive();
   if (storeByName) {
     bool isWrite = message->isWrite();
     string circuit = message->getCircuit();
     FileReader::tolower(&circuit);
-    if (circuit == "scan") {
+    if (circuit.length() == m_circuitPrefix.length()+4 && circuit.compare(m_circuitPrefix.length(), 4, "scan") == 0) {
       m_additionalScanMessages = true;
     }
     string name = message->getName();
@@ -1794,7 +2237,6 @@ result_t MessageMap::add(bool storeByName, Message* message, bool replace) {
     string suffix = FIELD_SEPARATOR + name + (isPassive ? "P" : (isWrite ? "W" : "R"));
     string nameKey = circuit + suffix;
     if (!m_addAll) {
-      lock();
       const auto nameIt = m_messagesByName.find(nameKey);
       if (nameIt != m_messagesByName.end()) {
         vector<Message*>* messages = &nameIt->second;
@@ -1816,23 +2258,22 @@ result_t MessageMap::add(bool storeByName, Message* message, bool replace) {
           return RESULT_ERR_DUPLICATE_NAME;  // duplicate key
         }
       }
-      unlock();
     }
-    m_messagesByName[nameKey].push_back(message);
+    getOrCreateByName(nameKey)->push_back(message);
     nameKey = suffix;  // also store without circuit
     const auto nameIt = m_messagesByName.find(nameKey);
     if (nameIt == m_messagesByName.end()) {
       // always store first message without circuit (in order of circuit name)
-      m_messagesByName[nameKey].push_back(message);
+      getOrCreateByName(nameKey)->push_back(message);
     } else {
       vector<Message*>* messages = &nameIt->second;
       Message* first = messages->front();
       if (circuit < first->getCircuit()) {
         // always store first message without circuit (in order of circuit name)
-        m_messagesByName[nameKey].at(0) = message;
+        messages->at(0) = message;
       } else if (m_addAll || (conditional && first->isConditional())) {
         // store further messages only if both are conditional or if storing everything
-        m_messagesByName[nameKey].push_back(message);
+        messages->push_back(message);
       }
     }
     m_messageCount++;
@@ -1851,7 +2292,13 @@ result_t MessageMap::add(bool storeByName, Message* message, bool replace) {
   if (idLength > m_maxIdLength) {
     m_maxIdLength = idLength;
   }
-  m_messagesByKey[key].push_back(message);
+  vector<Message*>* keyMessages = &m_messagesByKey[key];
+  keyMessages->push_back(message);
+  m_messageIndex.set(key, keyMessages);
+  unsigned int pbsb = (unsigned int)((key >> (8 * 4)) & 0xffff);
+  m_pbsbFilter[pbsb / 64] |= 1ULL << (pbsb % 64);
+  m_generation++;  // only after the insertion, so that a reader seeing the new generation sees the new message
+  unlock();
   return RESULT_OK;
 }
 
@@ -1860,6 +2307,7 @@ void MessageMap::remove(Message* message) {
     return;
   }
   lock();
+  m_generation++;
   uint64_t key = message->getKey();
   bool conditional = message->isConditional();
   const auto keyIt = m_messagesByKey.find(key);
@@ -1879,6 +2327,7 @@ void MessageMap::remove(Message* message) {
       }
     }
     if (messages.empty()) {
+      m_messageIndex.erase(key);
       m_messagesByKey.erase(keyIt);
     }
   }
@@ -1899,7 +2348,7 @@ void MessageMap::remove(Message* message) {
       }
     }
     if (messages.empty()) {
-      m_messagesByName.erase(nameIt);
+      nameIt = eraseByName(nameIt);
     } else {
       ++nameIt;
     }
@@ -2003,8 +2452,8 @@ result_t MessageMap::getFieldMap(const string& preferLanguage, vector<string>* r
   return RESULT_OK;
 }
 
-result_t MessageMap::addDefaultFromFile(const string& filename, unsigned int lineNo, map<string, string>* row,
-    vector< map<string, string> >* subRows, string* errorDescription) {
+result_t MessageMap::addDefaultFromFile(const string& filename, unsigned int lineNo, MappedRow* row,
+    vector<MappedRow>* subRows, string* errorDescription) {
   // check for condition in defaults
   string type = AttributedItem::pluck("type", row);
   const auto& mainDefaults = getDefaults().find("");
@@ -2078,8 +2527,7 @@ result_t MessageMap::addDefaultFromFile(const string& filename, unsigned int lin
     return RESULT_OK;
   }
   getDefaults()[type] = defaults;  // without suffix
-  vector< map<string, string> > subDefaults = *subRows;  // ensure to have a copy
-  getSubDefaults()[type] = subDefaults;
+  getSubDefaults()[type] = *subRows;  // ensure to have a copy
   return RESULT_OK;
 }
 
@@ -2217,7 +2665,8 @@ bool MessageMap::extractDefaultsFromFilename(const string& filename, map<string,
 }
 
 result_t MessageMap::readFromStream(istream* stream, const string& filename, const time_t& mtime, bool verbose,
-    map<string, string>* defaults, string* errorDescription, bool replace, size_t* hash, size_t* size) {
+    map<string, string>* defaults, string* errorDescription, bool replace, size_t* hash, size_t* size,
+    RowCache* cache) {
   size_t localHash, localSize;
   if (!hash) {
     hash = &localHash;
@@ -2226,7 +2675,8 @@ result_t MessageMap::readFromStream(istream* stream, const string& filename, con
     size = &localSize;
   }
   result_t result
-  = MappedFileReader::readFromStream(stream, filename, mtime, verbose, defaults, errorDescription, replace, hash, size);
+  = MappedFileReader::readFromStream(stream, filename, mtime, verbose, defaults, errorDescription, replace, hash, size,
+      cache);
   if (defaults) {
     string circuit = AttributedItem::pluck("circuit", defaults);
     if (!circuit.empty() && m_circuitData.find(circuit) == m_circuitData.end()) {
@@ -2245,8 +2695,8 @@ result_t MessageMap::readFromStream(istream* stream, const string& filename, con
   return result;
 }
 
-result_t MessageMap::addFromFile(const string& filename, unsigned int lineNo, map<string, string>* row,
-    vector< map<string, string> >* subRows, string* errorDescription, bool replace) {
+result_t MessageMap::addFromFile(const string& filename, unsigned int lineNo, MappedRow* row,
+    vector<MappedRow>* subRows, string* errorDescription, bool replace) {
   Condition* condition = nullptr;
   string types = AttributedItem::pluck("type", row);
   result_t result = readConditions(filename, &types, errorDescription, &condition);
@@ -2290,8 +2740,8 @@ result_t MessageMap::addFromFile(const string& filename, unsigned int lineNo, ma
     FileReader::trim(&type);
     messages.clear();
     if (hasMulti) {
-      map<string, string> newRow = *row;  // don't let Message::create() consume the row and subRows
-      vector< map<string, string> > newSubRows = *subRows;
+      MappedRow newRow = *row;  // don't let Message::create() consume the row and subRows
+      vector<MappedRow> newSubRows = *subRows;
       result = Message::create(filename, templates, getDefaults(), getSubDefaults(), type, condition,
           &newRow, &newSubRows, errorDescription, &messages);
     } else {
@@ -2329,12 +2779,16 @@ Message* MessageMap::getScanMessage(symbol_t dstAddress) {
     return nullptr;
   }
   uint64_t key = m_scanMessage->getDerivedKey(dstAddress);
+  lock();
   const vector<Message*>* msgs = getByKey(key);
+  Message* message;
   if (msgs != nullptr) {
-    return msgs->front();
+    message = msgs->front();
+  } else {
+    message = m_scanMessage->derive(dstAddress, true);
+    add(true, message);
   }
-  Message* message = m_scanMessage->derive(dstAddress, true);
-  add(true, message);
+  unlock();
   return message;
 }
 
@@ -2488,72 +2942,93 @@ bool MessageMap::getLoadedFileInfo(const string& filename, string* comment, size
 }
 
 const vector<Message*>* MessageMap::getByKey(uint64_t key) const {
-  const auto it = m_messagesByKey.find(key);
-  if (it != m_messagesByKey.end()) {
-    return &it->second;
+  return m_messageIndex.find(key);
+}
+
+vector<Message*>* MessageMap::getOrCreateByName(const string& nameKey) {
+  auto it = m_messagesByName.find(nameKey);
+  if (it == m_messagesByName.end()) {
+    it = m_messagesByName.emplace(nameKey, vector<Message*>()).first;
+    m_messagesByNameHash.emplace(hashNameKey(NAME_KEY_HASH_INIT, nameKey.c_str(), nameKey.length()), it);
   }
-  return nullptr;
+  return &it->second;
+}
+
+map<string, vector<Message*> >::iterator MessageMap::eraseByName(map<string, vector<Message*> >::iterator it) {
+  const string& nameKey = it->first;
+  auto range = m_messagesByNameHash.equal_range(hashNameKey(NAME_KEY_HASH_INIT, nameKey.c_str(),
+      nameKey.length()));
+  for (auto hashIt = range.first; hashIt != range.second; ++hashIt) {
+    if (hashIt->second == it) {
+      m_messagesByNameHash.erase(hashIt);
+      break;
+    }
+  }
+  return m_messagesByName.erase(it);
 }
 
 Message* MessageMap::find(const string& circuit, const string& name, const string& levels, bool isWrite,
     bool isPassive) const {
-  string lcircuit = circuit;
-  FileReader::tolower(&lcircuit);
-  string lname = name;
-  FileReader::tolower(&lname);
-  string suffix = FIELD_SEPARATOR + lname + (isPassive ? "P" : (isWrite ? "W" : "R"));
+  char type = isPassive ? 'P' : (isWrite ? 'W' : 'R');
+  string qualified;
+  const string& checkCircuit = qualifyCircuit(circuit, &qualified);
   for (int i = 0; i < 2; i++) {
-    string nameKey;
-    if (i == 0) {
-      nameKey = lcircuit + suffix;
-    } else if (lcircuit.empty()) {
-      nameKey = suffix;  // second try: without circuit
-    } else {
-      continue;  // not allowed without circuit
+    if (i == 1 && !circuit.empty()) {
+      break;  // not allowed without circuit
     }
-    const auto it = m_messagesByName.find(nameKey);
-    if (it != m_messagesByName.end()) {
-      Message* message = getFirstAvailable(it->second);
+    // second try: without circuit
+    const string& useCircuit = i == 0 ? checkCircuit : s_noCircuit;
+    auto range = m_messagesByNameHash.equal_range(hashNameKey(useCircuit, name, type));
+    for (auto it = range.first; it != range.second; ++it) {
+      if (!matchesNameKey(it->second->first, useCircuit, name, type)) {
+        continue;  // hash collision
+      }
+      Message* message = getFirstAvailable(it->second->second);
       if (message && message->hasLevel(levels)) {
         return message;
       }
+      break;
     }
   }
   return nullptr;
 }
 
-void MessageMap::findAll(const string& circuit, const string& name, const string& levels,
+void MessageMap::findAll(const string& circuitName, const string& name, const string& levels,
     bool completeMatch, bool withRead, bool withWrite, bool withPassive, bool includeEmptyLevel, bool onlyAvailable,
     time_t since, time_t until, bool changedSince, deque<Message*>* messages) const {
-  string lcircuit = circuit;
-  FileReader::tolower(&lcircuit);
-  string lname = name;
-  FileReader::tolower(&lname);
-  bool checkCircuit = lcircuit.length() > 0;
+  string qualified;
+  const string& circuit = completeMatch ? qualifyCircuit(circuitName, &qualified) : circuitName;
+  bool checkCircuit = circuit.length() > 0;
   bool checkLevel = levels != "*";
-  bool checkName = lname.length() > 0;
-  for (const auto it : m_messagesByName) {
-    if (it.first[0] == FIELD_SEPARATOR) {  // avoid duplicates: instances stored multiple times have a special key
+  bool checkName = name.length() > 0;
+  auto it = m_messagesByName.begin();
+  auto end = m_messagesByName.end();
+  if (checkCircuit && completeMatch) {
+    // limit to the range of keys starting with the circuit
+    string prefix = circuit;
+    FileReader::tolower(&prefix);
+    prefix += FIELD_SEPARATOR;
+    it = m_messagesByName.lower_bound(prefix);
+    prefix[prefix.length()-1] = FIELD_SEPARATOR+1;
+    end = m_messagesByName.lower_bound(prefix);
+  }
+  for (; it != end; ++it) {
+    const string& nameKey = it->first;
+    if (nameKey[0] == FIELD_SEPARATOR) {  // avoid duplicates: instances stored multiple times have a special key
       continue;
     }
-    for (const auto message : it.second) {
+    size_t circuitLen = nameKey.find(FIELD_SEPARATOR);
+    if (checkCircuit && !matchesNameKeyPart(nameKey, 0, circuitLen, circuit, completeMatch)) {
+      continue;
+    }
+    if (checkName && !matchesNameKeyPart(nameKey, circuitLen+1, nameKey.length()-circuitLen-2, name,
+        completeMatch)) {
+      continue;
+    }
+    for (const auto message : it->second) {
       if (checkLevel && !message->hasLevel(levels, includeEmptyLevel)) {
         continue;
       }
-      if (checkCircuit) {
-        string check = message->getCircuit();
-        FileReader::tolower(&check);
-        if (completeMatch ? (check != lcircuit) : (check.find(lcircuit) == check.npos)) {
-          continue;
-        }
-      }
-      if (checkName) {
-        string check = message->getName();
-        FileReader::tolower(&check);
-        if (completeMatch ? (check != lname) : (check.find(lname) == check.npos)) {
-          continue;
-        }
-      }
       if (message->isPassive()) {
         if (!withPassive) {
           continue;
@@ -2584,10 +3059,11 @@ void MessageMap::findAll(const string& circuit, const string& name, const string
   }
 }
 
-Message* MessageMap::getFirstAvailableFromIterator(const map<uint64_t, vector<Message*> >::const_iterator& it,
-    const MasterSymbolString* sameIdExtAs, bool onlyAvailable) const {
-  if (it != m_messagesByKey.end()) {
-    return getFirstAvailable(it->second, sameIdExtAs, onlyAvailable);
+Message* MessageMap::getFirstAvailableFromIndex(uint64_t key, const MasterSymbolString* sameIdExtAs,
+    bool onlyAvailable) const {
+  const vector<Message*>* messages = m_messageIndex.find(key);
+  if (messages) {
+    return getFirstAvailable(*messages, sameIdExtAs, onlyAvailable);
   }
   return nullptr;
 }
@@ -2597,6 +3073,12 @@ Message* MessageMap::find(const MasterSymbolString& master, bool anyDestination,
   if (anyDestination && master.size() >= 5 && master[4] == 0 && master[2] == 0x07 && master[3] == 0x04) {
     return m_scanMessage;
   }
+  if (master.size() >= 5) {
+    unsigned int pbsb = (unsigned int)(master[2] << 8 | master[3]);
+    if ((m_pbsbFilter[pbsb / 64] & (1ULL << (pbsb % 64))) == 0) {
+      return nullptr;  // no message with this PBSB at all
+    }
+  }
   uint64_t baseKey = Message::createKey(master,
       anyDestination || master[1] != BROADCAST ? m_maxIdLength : m_maxBroadcastIdLength, anyDestination);
   if (baseKey == INVALID_KEY) {
@@ -2620,7 +3102,7 @@ Message* MessageMap::find(const MasterSymbolString& master, bool anyDestination,
     }
     Message* message;
     if (withPassive) {
-      message = getFirstAvailableFromIterator(m_messagesByKey.find(key), &master, onlyAvailable);
+      message = getFirstAvailableFromIndex(key, &master, onlyAvailable);
       if (message) {
         return message;
       }
@@ -2629,7 +3111,7 @@ Message* MessageMap::find(const MasterSymbolString& master, bool anyDestination,
       key &= ~ID_SOURCE_MASK;
       if (withPassive) {
         // try again without specific source master
-        message = getFirstAvailableFromIterator(m_messagesByKey.find(key), &master, onlyAvailable);
+        message = getFirstAvailableFromIndex(key, &master, onlyAvailable);
         if (message) {
           return message;
         }
@@ -2637,18 +3119,16 @@ Message* MessageMap::find(const MasterSymbolString& master, bool anyDestination,
     }
     if (withRead) {
       // try again with special value for active read
-      message = getFirstAvailableFromIterator(
-        m_messagesByKey.find(key | (isWriteDest ? ID_SOURCE_ACTIVE_READ_MASTER : ID_SOURCE_ACTIVE_READ)),
-        &master, onlyAvailable);
+      message = getFirstAvailableFromIndex(
+        key | (isWriteDest ? ID_SOURCE_ACTIVE_READ_MASTER : ID_SOURCE_ACTIVE_READ), &master, onlyAvailable);
       if (message) {
         return message;
       }
     }
     if (withWrite) {
       // try again with special value for active write
-      message = getFirstAvailableFromIterator(
-        m_messagesByKey.find(key | (isWriteDest ? ID_SOURCE_ACTIVE_WRITE_MASTER : ID_SOURCE_ACTIVE_WRITE)),
-        &master, onlyAvailable);
+      message = getFirstAvailableFromIndex(
+        key | (isWriteDest ? ID_SOURCE_ACTIVE_WRITE_MASTER : ID_SOURCE_ACTIVE_WRITE), &master, onlyAvailable);
       if (message) {
         return message;
       }
@@ -2666,6 +3146,7 @@ void MessageMap::invalidateCache(Message* message) {
     return;
   }
   message->m_lastUpdateTime = 0;
+  message->increaseDataSequence();
   string circuit = message->getCircuit();
   string name = message->getName();
   deque<Message*> messages;
@@ -2673,8 +3154,75 @@ void MessageMap::invalidateCache(Message* message) {
   for (auto checkMessage : messages) {
     if (checkMessage != message) {
       checkMessage->m_lastUpdateTime = 0;
+      checkMessage->increaseDataSequence();
+    }
+  }
+}
+
+void MessageMap::notifyUpdate(Message* message) {
+  if (message == nullptr || message->getLastUpdateTime() == 0) {
+    return;
+  }
+  m_feedMutex.lock();
+  size_t pos = static_cast<size_t>(m_feedSequence % UPDATE_FEED_SIZE);
+  m_feedMessages[pos] = message;
+  m_feedChanged[pos] = message->getLastChangeTime() == message->getLastUpdateTime();
+  m_feedSequence++;
+  if (m_feedSequence - m_feedStart > UPDATE_FEED_SIZE) {
+    m_feedStart = m_feedSequence - UPDATE_FEED_SIZE;
+  }
+  m_feedMutex.unlock();
+  if (m_updateListener) {
+    m_updateListener->notifyMessageUpdate(message);
+  }
+}
+
+uint64_t MessageMap::getDataSequence(const string& circuit) const {
+  // all parts only ever increase, so their sum changes whenever any of them changed
+  uint64_t sequence = m_generation + Message::getConditionSequence();
+  if (circuit.empty()) {
+    return sequence + Message::getDataSequence();
+  }
+  string qualified;
+  string circuitKey = qualifyCircuit(circuit, &qualified);
+  FileReader::tolower(&circuitKey);
+  m_circuitSequencesMutex.lock();
+  const auto it = m_circuitSequences.find(circuitKey);
+  if (it != m_circuitSequences.end()) {
+    sequence += it->second->load();
+  }
+  m_circuitSequencesMutex.unlock();
+  return sequence;
+}
+
+uint64_t MessageMap::getUpdateSequence() {
+  m_feedMutex.lock();
+  uint64_t sequence = m_feedSequence;
+  m_feedMutex.unlock();
+  return sequence;
+}
+
+bool MessageMap::getUpdates(uint64_t* cursor, bool onlyChanged, deque<Message*>* messages) {
+  m_feedMutex.lock();
+  uint64_t sequence = *cursor;
+  bool complete = sequence >= m_feedStart;
+  if (!complete) {
+    sequence = m_feedStart;
+  }
+  unordered_set<const Message*> seen;
+  for (; sequence < m_feedSequence; sequence++) {
+    size_t pos = static_cast<size_t>(sequence % UPDATE_FEED_SIZE);
+    if (onlyChanged && !m_feedChanged[pos]) {
+      continue;
+    }
+    Message* message = m_feedMessages[pos];
+    if (seen.insert(message).second) {
+      messages->push_back(message);
     }
   }
+  *cursor = m_feedSequence;
+  m_feedMutex.unlock();
+  return complete;
 }
 
 void MessageMap::addPollMessage(bool toFront, Message* message) {
@@ -2687,7 +3235,10 @@ void MessageMap::addPollMessage(bool toFront, Message* message) {
 }
 
 bool MessageMap::decodeCircuit(const string& circuit, OutputFormat outputFormat, ostringstream* output) const {
-  const auto it = m_circuitData.find(circuit);
+  // the circuit data is stored by the plain circuit name
+  size_t prefixLen = m_circuitPrefix.length();
+  bool prefixed = prefixLen > 0 && circuit.length() > prefixLen && circuit.compare(0, prefixLen, m_circuitPrefix) == 0;
+  const auto it = m_circuitData.find(prefixed ? circuit.substr(prefixLen) : circuit);
   if (it == m_circuitData.end()) {
     return false;
   }
@@ -2700,6 +3251,11 @@ bool MessageMap::decodeCircuit(const string& circuit, OutputFormat outputFormat,
 }
 
 void MessageMap::clear() {
+  m_generation++;
+  // drop the update feed referring to the instances to free
+  m_feedMutex.lock();
+  m_feedStart = m_feedSequence;
+  m_feedMutex.unlock();
   m_loadedFiles.clear();
   m_loadedFileInfos.clear();
   // clear poll messages
@@ -2757,8 +3313,11 @@ void MessageMap::clear() {
   m_conditionalMessageCount = 0;
   m_passiveMessageCount = 0;
   m_messagesByName.clear();
+  m_messagesByNameHash.clear();
   // clear messages by key
   m_messagesByKey.clear();
+  m_messageIndex.clear();
+  memset(m_pbsbFilter, 0, sizeof(m_pbsbFilter));
   m_conditions.clear();
   m_instructions.clear();
   for (const auto it : m_circuitData) {
@@ -2769,19 +3328,244 @@ void MessageMap::clear() {
   m_additionalScanMessages = false;
 }
 
+size_t MessageMap::swapDefinitions(MessageMap* other) {
+  size_t carried = 0;
+  for (auto& it : other->m_messagesByKey) {
+    const auto previousIt = m_messagesByKey.find(it.first);
+    for (auto message : it.second) {
+      message->m_circuitSequence = getCircuitSequence(message->getCircuit());
+      if (previousIt == m_messagesByKey.end()) {
+        continue;
+      }
+      for (const auto previous : previousIt->second) {
+        if (previous->isWrite() != message->isWrite() || previous->isPassive() != message->isPassive()
+            || previous->getName() != message->getName() || previous->getCircuit() != message->getCircuit()) {
+          continue;
+        }
+        message->m_pollOrder = previous->m_pollOrder;
+        message->m_lastPollTime = previous->m_lastPollTime;
+        message->m_lastPassiveUpdateTime = previous->m_lastPassiveUpdateTime;
+        message->m_pollUnchanged = previous->m_pollUnchanged;
+        if (message->restoreLastData(previous->m_lastMasterData, previous->m_lastSlaveData,
+            previous->m_lastUpdateTime, previous->m_lastChangeTime) == RESULT_OK) {
+          carried++;
+        }
+        break;
+      }
+    }
+  }
+  other->m_pollMessages.reorder();
+  m_generation = std::max(m_generation.load(), other->m_generation.load()) + 1;
+  other->m_generation = m_generation.load();
+  // drop the update feed referring to the previous instances
+  m_feedMutex.lock();
+  m_feedStart = m_feedSequence;
+  m_feedMutex.unlock();
+  std::swap(m_additionalScanMessages, other->m_additionalScanMessages);
+  std::swap(m_loadedFiles, other->m_loadedFiles);
+  std::swap(m_loadedFileInfos, other->m_loadedFileInfos);
+  std::swap(m_maxIdLength, other->m_maxIdLength);
+  std::swap(m_maxBroadcastIdLength, other->m_maxBroadcastIdLength);
+  std::swap(m_messageCount, other->m_messageCount);
+  std::swap(m_conditionalMessageCount, other->m_conditionalMessageCount);
+  std::swap(m_passiveMessageCount, other->m_passiveMessageCount);
+  std::swap(m_messagesByName, other->m_messagesByName);
+  std::swap(m_messagesByNameHash, other->m_messagesByNameHash);
+  std::swap(m_messagesByKey, other->m_messagesByKey);
+  std::swap(m_messageIndex, other->m_messageIndex);
+  std::swap(m_pbsbFilter, other->m_pbsbFilter);
+  std::swap(m_pollMessages, other->m_pollMessages);
+  std::swap(m_conditions, other->m_conditions);
+  std::swap(m_instructions, other->m_instructions);
+  std::swap(m_circuitData, other->m_circuitData);
+  return carried;
+}
+
+result_t MessageMap::takeDefinitions(MessageMap* other) {
+  result_t overallResult = RESULT_OK;
+  for (const auto& it : other->m_messagesByName) {
+    if (it.first[0] == FIELD_SEPARATOR) {  // skip instances stored multiple times (key starting with "-")
+      continue;
+    }
+    for (const auto message : it.second) {
+      if (!message) {
+        continue;
+      }
+      result_t result = add(true, message);
+      if (result != RESULT_OK) {
+        delete message;
+        overallResult = result;
+      }
+    }
+  }
+  for (const auto& it : other->m_conditions) {
+    m_conditions[it.first] = it.second;  // keys are prefixed by the file name
+  }
+  for (const auto& it : other->m_instructions) {
+    vector<Instruction*>& instructions = m_instructions[it.first];
+    instructions.insert(instructions.end(), it.second.begin(), it.second.end());
+  }
+  for (const auto& it : other->m_loadedFiles) {
+    vector<string>& files = m_loadedFiles[it.first];
+    files.insert(files.end(), it.second.begin(), it.second.end());
+  }
+  for (const auto& it : other->m_loadedFileInfos) {
+    m_loadedFileInfos[it.first] = it.second;
+  }
+  for (const auto& it : other->m_circuitData) {
+    if (m_circuitData.find(it.first) == m_circuitData.end()) {
+      m_circuitData[it.first] = it.second;
+    } else {
+      delete it.second;
+    }
+  }
+  // forget the moved instances without freeing them
+  while (!other->m_pollMessages.empty()) {
+    other->m_pollMessages.pop();
+  }
+  other->m_messagesByName.clear();
+  other->m_messagesByNameHash.clear();
+  other->m_messagesByKey.clear();
+  other->m_messageIndex.clear();
+  memset(other->m_pbsbFilter, 0, sizeof(other->m_pbsbFilter));
+  other->m_conditions.clear();
+  other->m_instructions.clear();
+  other->m_loadedFiles.clear();
+  other->m_loadedFileInfos.clear();
+  other->m_circuitData.clear();
+  other->m_messageCount = other->m_conditionalMessageCount = other->m_passiveMessageCount = 0;
+  other->m_maxIdLength = other->m_maxBroadcastIdLength = 0;
+  other->m_additionalScanMessages = false;
+  other->m_generation++;
+  return overallResult;
+}
+
+result_t MessageMap::copyDefinitions(const MessageMap& other) {
+  result_t overallResult = RESULT_OK;
+  map<const Condition*, Condition*> copies;
+  for (const auto& it : other.m_conditions) {
+    m_conditions[it.first] = it.second->copy(&copies);  // keys are prefixed by the file name
+  }
+  for (const auto& it : other.m_messagesByName) {
+    if (it.first[0] == FIELD_SEPARATOR) {  // skip instances stored multiple times (key starting with "-")
+      continue;
+    }
+    for (const auto message : it.second) {
+      if (!message || (message->isScanMessage() && message->getDstAddress() != SYN)) {
+        continue;  // scan messages of a particular slave are derived on demand
+      }
+      Message* copy = message->derive(message->getDstAddress(), SYN, "");
+      copy->m_condition = message->m_condition ? message->m_condition->copy(&copies) : nullptr;
+      result_t result = add(true, copy);
+      if (result != RESULT_OK) {
+        delete copy;
+        overallResult = result;
+      }
+    }
+  }
+  for (const auto& it : other.m_instructions) {
+    vector<Instruction*>& instructions = m_instructions[it.first];
+    for (const auto instruction : it.second) {
+      Condition* condition = instruction->getCondition();
+      instructions.push_back(instruction->copy(condition ? condition->copy(&copies) : nullptr));
+    }
+  }
+  for (const auto& it : other.m_loadedFiles) {
+    vector<string>& files = m_loadedFiles[it.first];
+    files.insert(files.end(), it.second.begin(), it.second.end());
+  }
+  for (const auto& it : other.m_loadedFileInfos) {
+    m_loadedFileInfos[it.first] = it.second;
+  }
+  for (const auto& it : other.m_circuitData) {
+    if (m_circuitData.find(it.first) == m_circuitData.end()) {
+      m_circuitData[it.first] = new AttributedItem(*it.second);
+    }
+  }
+  return overallResult;
+}
+
+void MessageMap::setCircuitPrefix(const string& prefix) {
+  m_circuitPrefix = prefix;
+  for (const auto message : {m_scanMessage, m_broadcastScanMessage}) {
+    if (message->m_busCircuit) {
+      StringPool::release(*message->m_busCircuit);
+    }
+    message->m_busCircuit = prefix.empty() ? nullptr : &StringPool::intern(prefix + message->m_circuit);
+  }
+}
+
+const string& MessageMap::qualifyCircuit(const string& circuit, string* qualified) const {
+  size_t prefixLen = m_circuitPrefix.length();
+  if (prefixLen == 0 || circuit.empty()) {
+    return circuit;
+  }
+  if (circuit.length() > prefixLen) {
+    size_t pos = 0;
+    while (pos < prefixLen && ::tolower(circuit[pos]) == ::tolower(m_circuitPrefix[pos])) {
+      pos++;
+    }
+    if (pos == prefixLen) {
+      return circuit;  // already qualified
+    }
+  }
+  *qualified = m_circuitPrefix + circuit;
+  return *qualified;
+}
+
+std::atomic<uint64_t>* MessageMap::getCircuitSequence(const string& circuit) {
+  string circuitKey = circuit;
+  FileReader::tolower(&circuitKey);
+  m_circuitSequencesMutex.lock();
+  std::atomic<uint64_t>*& circuitSequence = m_circuitSequences[circuitKey];
+  if (!circuitSequence) {
+    circuitSequence = new std::atomic<uint64_t>(0);
+  }
+  std::atomic<uint64_t>* ret = circuitSequence;
+  m_circuitSequencesMutex.unlock();
+  return ret;
+}
+
 Message* MessageMap::getNextPoll() {
   if (m_pollMessages.empty()) {
     return nullptr;
   }
   lock();
-  Message* ret = m_pollMessages.top();
-  m_pollMessages.pop();
-  if (ret->m_pollOrder > g_lastPollOrder) {
-    g_lastPollOrder = ret->m_pollOrder;
-  }
-  ret->m_pollOrder += (unsigned int)ret->m_pollPriority;
-  time(&(ret->m_lastPollTime));
-  m_pollMessages.push(ret);  // re-insert at new position
+  Message* ret = nullptr;
+  time_t now;
+  time(&now);
+  for (size_t remain = m_pollMessages.size(); remain > 0; remain--) {
+    Message* message = m_pollMessages.top();
+    m_pollMessages.pop();
+    if (message->m_pollOrder > g_lastPollOrder) {
+      g_lastPollOrder = message->m_pollOrder;
+    }
+    if (message->m_lastPollTime > 0
+        && message->m_lastPassiveUpdateTime > message->m_lastPollTime+POLL_PASSIVE_MARGIN) {
+      // updated by another master since the last poll: treat that update as poll and skip to the next message.
+      // only the regular step applies as the skipped turn tells nothing about whether the data changes.
+      message->m_pollOrder += (unsigned int)message->m_pollPriority;
+      message->m_lastPollTime = message->m_lastPassiveUpdateTime;
+      m_pollMessages.push(message);  // re-insert at new position
+      continue;
+    }
+    if (message->m_lastPollTime > 0) {
+      // learn whether the data usually changes between two polls
+      if (message->m_lastChangeTime < message->m_lastPollTime) {
+        if (message->m_pollUnchanged+1 < POLL_MAX_BACKOFF) {
+          message->m_pollUnchanged++;
+        }
+      } else {
+        message->m_pollUnchanged = 0;
+      }
+    }
+    // back off messages with unchanged data
+    message->m_pollOrder += (unsigned int)message->m_pollPriority * (1+message->m_pollUnchanged);
+    message->m_lastPollTime = now;
+    m_pollMessages.push(message);  // re-insert at new position
+    ret = message;
+    break;
+  }
   unlock();
   return ret;
 }
@@ -2789,7 +3573,7 @@ Message* MessageMap::getNextPoll() {
 void MessageMap::dump(bool withConditions, ostream* output) const {
   bool first = true;
   Message::dumpHeader(nullptr, output);
-  *output << endl;
+  *output << '\n';
   for (const auto it : m_messagesByName) {
     if (it.first[0] == FIELD_SEPARATOR) {  // skip instances stored multiple times (key starting with "-")
       continue;
@@ -2802,7 +3586,7 @@ void MessageMap::dump(bool withConditions, ostream* output) const {
         if (first) {
           first = false;
         } else {
-          *output << endl;
+          *output << '\n';
         }
         message->dump(nullptr, withConditions, output);
       }
@@ -2814,14 +3598,15 @@ void MessageMap::dump(bool withConditions, ostream* output) const {
       if (first) {
         first = false;
       } else {
-        *output << endl;
+        *output << '\n';
       }
       message->dump(nullptr, withConditions, output);
     }
   }
   if (!first) {
-    *output << endl;
+    *output << '\n';
   }
+  output->flush();  // only once as the dump may be huge
 }
 
 }  // namespace ebusd
@@ -20,12 +20,17 @@
 #define LIB_EBUS_MESSAGE_H_
 
 #include <stdint.h>
+#include <atomic>
+#include <cstring>
 #include <string>
 #include <vector>
 #include <deque>
 #include <map>
+#include <unordered_map>
+#include <unordered_set>
 #include <queue>
 #include <functional>
+#include <algorithm>
 #include "lib/ebus/data.h"
 #include "lib/ebus/result.h"
 #include "lib/ebus/symbol.h"
@@ -62,6 +67,8 @@ namespace ebusd {
 using std::binary_function;
 using std::priority_queue;
 using std::deque;
+using std::unordered_multimap;
+using std::unordered_set;
 
 class Condition;
 class SimpleCondition;
@@ -122,7 +129,7 @@ class Message : public AttributedItem {
   /**
    * Destructor.
    */
-  virtual ~Message() { if (m_deleteData) { delete m_data; } }
+  virtual ~Message();
 
   /**
    * Calculate the key for the ID.
@@ -187,9 +194,9 @@ class Message : public AttributedItem {
    */
   static result_t create(const string& filename, const DataFieldTemplates* templates,
       const map<string, map<string, string> >& rowDefaults,
-      const map<string, vector< map<string, string> > >& subRowDefaults,
+      const map<string, vector<MappedRow> >& subRowDefaults,
       const string& typeStr, Condition* condition,
-      map<string, string>* row, vector< map<string, string> >* subRows,
+      MappedRow* row, vector<MappedRow>* subRows,
       string* errorDescription, vector<Message*>* messages);
 
   /**
@@ -241,7 +248,7 @@ class Message : public AttributedItem {
    * Get the optional circuit name.
    * @return the optional circuit name.
    */
-  string getCircuit() const { return m_circuit; }
+  string getCircuit() const { return m_busCircuit ? *m_busCircuit : m_circuit; }
 
   /**
    * Get the optional access level.
@@ -281,6 +288,15 @@ class Message : public AttributedItem {
    */
   string getFieldName(ssize_t fieldIndex) const { return m_data->getName(fieldIndex); }
 
+  /**
+   * Get the index of the named master data field within @a FieldValues passed to @a prepareMaster().
+   * @param fieldName the name of the field.
+   * @return the index of the field, or -1 if not available.
+   */
+  ssize_t getMasterValueIndex(const string& fieldName) const {
+    return m_data->getValueIndex(pt_masterData, fieldName.c_str());
+  }
+
   /**
    * Get whether this is a write message.
    * @return whether this is a write message.
@@ -384,10 +400,16 @@ class Message : public AttributedItem {
   bool isConditional() const { return m_condition != nullptr; }
 
   /**
-   * Return whether this @a Message is available (optionally depending on a @a Condition evaluation).
+   * Return whether this @a Message is available (optionally depending on the cached @a Condition state).
    * @return true when this @a Message is available.
    */
-  bool isAvailable();
+  bool isAvailable() const;
+
+  /**
+   * Add a @a SimpleCondition to re-evaluate whenever the data of this @a Message changes.
+   * @param condition the @a SimpleCondition referring to this @a Message.
+   */
+  void addDependentCondition(SimpleCondition* condition);
 
   /**
    * Return whether the field is available.
@@ -415,6 +437,29 @@ class Message : public AttributedItem {
   result_t prepareMaster(size_t index, symbol_t srcAddress, symbol_t dstAddress,
       char separator, istringstream* input, MasterSymbolString* master);
 
+  /**
+   * Prepare the master @a SymbolString for sending a query or command to the bus from typed values.
+   * @param index the index of the part to prepare.
+   * @param srcAddress the source address to set.
+   * @param dstAddress the destination address to set, or @a SYN to keep the address defined during construction.
+   * @param values the @a FieldValues indexed by field (excluding ignored fields).
+   * @param master the @a MasterSymbolString for writing symbols to.
+   * @return @a RESULT_OK on success, or an error code.
+   */
+  result_t prepareMaster(size_t index, symbol_t srcAddress, symbol_t dstAddress,
+      const FieldValues& values, MasterSymbolString* master);
+
+
+ private:
+  /**
+   * Prepare the header of the master @a SymbolString (QQ, ZZ, PB, SB).
+   * @param srcAddress the source address to set.
+   * @param dstAddress the destination address to set, or @a SYN to keep the address defined during construction.
+   * @param master the @a MasterSymbolString for writing symbols to.
+   * @return @a RESULT_OK on success, or an error code.
+   */
+  result_t prepareMasterHeader(symbol_t srcAddress, symbol_t dstAddress, MasterSymbolString* master);
+
 
  protected:
   /**
@@ -427,6 +472,15 @@ class Message : public AttributedItem {
    */
   virtual result_t prepareMasterPart(size_t index, char separator, istringstream* input, MasterSymbolString* master);
 
+  /**
+   * Prepare a part of the master data @a SymbolString for sending from typed values (everything including NN).
+   * @param index the index of the part to prepare.
+   * @param values the @a FieldValues indexed by field (excluding ignored fields).
+   * @param master the @a MasterSymbolString for writing symbols to.
+   * @return @a RESULT_OK on success, or an error code.
+   */
+  virtual result_t prepareMasterPart(size_t index, const FieldValues& values, MasterSymbolString* master);
+
 
  public:
   /**
@@ -461,6 +515,18 @@ class Message : public AttributedItem {
    */
   virtual result_t storeLastData(size_t index, const SlaveSymbolString& data);
 
+  /**
+   * Restore previously persisted last master and slave data together with their original timestamps.
+   * Nothing is changed when the @a Message already has data at least as recent as the persisted one.
+   * @param master the persisted (combined) @a MasterSymbolString.
+   * @param slave the persisted (combined) @a SlaveSymbolString.
+   * @param updateTime the persisted time of the last update.
+   * @param changeTime the persisted time of the last change.
+   * @return @a RESULT_OK on success, @a RESULT_EMPTY if already more recent data is present, or an error code.
+   */
+  result_t restoreLastData(const MasterSymbolString& master, const SlaveSymbolString& slave, time_t updateTime,
+      time_t changeTime);
+
   /**
    * Decode the value from the last stored master or slave data.
    * @param master true for decoding the master data, false for slave.
@@ -476,6 +542,7 @@ class Message : public AttributedItem {
 
   /**
    * Decode the value from the last stored master and slave data.
+   * The decoded value is cached until the last data changes, unless limited to a named field.
    * @param leadingSeparator whether to prepend a separator before the formatted value.
    * @param fieldName the optional name of a field to limit the output to.
    * @param fieldIndex the optional index of the field to limit the output to (either named or overall), or -1.
@@ -486,6 +553,47 @@ class Message : public AttributedItem {
   virtual result_t decodeLastData(bool leadingSeparator, const char* fieldName,
       ssize_t fieldIndex, OutputFormat outputFormat, ostream* output) const;
 
+  /**
+   * Decode the value from the last stored master and slave data into an @a OutputBuffer.
+   * The decoded value is cached until the last data changes, unless limited to a named field.
+   * @param leadingSeparator whether to prepend a separator before the formatted value.
+   * @param fieldName the optional name of a field to limit the output to.
+   * @param fieldIndex the optional index of the field to limit the output to (either named or overall), or -1.
+   * @param outputFormat the @a OutputFormat options to use.
+   * @param output the @a OutputBuffer to append the formatted value to.
+   * @return @a RESULT_OK on success, or an error code.
+   */
+  virtual result_t decodeLastData(bool leadingSeparator, const char* fieldName,
+      ssize_t fieldIndex, OutputFormat outputFormat, OutputBuffer* output) const;
+
+  /**
+   * Decode the value from the specified master and slave data without storing it (e.g. for decoding in parallel).
+   * @param master the @a MasterSymbolString with the master data.
+   * @param slave the @a SlaveSymbolString with the slave data.
+   * @param leadingSeparator whether to prepend a separator before the formatted value.
+   * @param fieldName the optional name of a field to limit the output to.
+   * @param fieldIndex the optional index of the field to limit the output to (either named or overall), or -1.
+   * @param outputFormat the @a OutputFormat options to use.
+   * @param output the @a ostream to append the formatted value to.
+   * @return @a RESULT_OK on success, or an error code.
+   */
+  result_t decodeData(const MasterSymbolString& master, const SlaveSymbolString& slave, bool leadingSeparator,
+      const char* fieldName, ssize_t fieldIndex, OutputFormat outputFormat, ostream* output) const;
+
+  /**
+   * Decode the value from the specified master and slave data into an @a OutputBuffer without storing it.
+   * @param master the @a MasterSymbolString with the master data.
+   * @param slave the @a SlaveSymbolString with the slave data.
+   * @param leadingSeparator whether to prepend a separator before the formatted value.
+   * @param fieldName the optional name of a field to limit the output to.
+   * @param fieldIndex the optional index of the field to limit the output to (either named or overall), or -1.
+   * @param outputFormat the @a OutputFormat options to use.
+   * @param output the @a OutputBuffer to append the formatted value to.
+   * @return @a RESULT_OK on success, or an error code.
+   */
+  result_t decodeData(const MasterSymbolString& master, const SlaveSymbolString& slave, bool leadingSeparator,
+      const char* fieldName, ssize_t fieldIndex, OutputFormat outputFormat, OutputBuffer* output) const;
+
   /**
    * Decode a particular numeric field value from the last stored data.
    * @param fieldName the name of the field to decode, or nullptr for the first field.
@@ -495,6 +603,14 @@ class Message : public AttributedItem {
    */
   virtual result_t decodeLastDataNumField(const char* fieldName, ssize_t fieldIndex, unsigned int* output) const;
 
+  /**
+   * Decode the numeric value of all fields from the last stored master and slave data in a single pass.
+   * @param values the @a vector in which to store one value per field (see @a getFieldCount()), which is NaN for a
+   * field that is not numeric, not set, or not decodable.
+   * @return @a RESULT_OK on success, or the error code of the first field not decodable.
+   */
+  result_t decodeLastNumericValues(vector<double>* values) const;
+
   /**
    * Get the last seen master data.
    * @return the last seen @a MasterSymbolString.
@@ -519,12 +635,38 @@ class Message : public AttributedItem {
    */
   time_t getLastChangeTime() const { return m_lastChangeTime; }
 
+  /**
+   * Get the global sequence number of changes to the last data of any @a Message.
+   * @return the global data sequence number.
+   */
+  static uint64_t getDataSequence();
+
+  /**
+   * Get the global sequence number of changes to the data of any @a Message referred to by a @a Condition.
+   * @return the global condition sequence number.
+   */
+  static uint64_t getConditionSequence();
+
+  /**
+   * Get the time when the value of a particular field was last changed.
+   * @param fieldIndex the index of the field (excluding ignored fields).
+   * @return the time when the field value was last changed, or 0 if the field was not decoded yet.
+   */
+  time_t getLastFieldChangeTime(size_t fieldIndex) const {
+    return fieldIndex < m_lastFieldChangeTimes.size() ? m_lastFieldChangeTimes[fieldIndex] : m_lastChangeTime;
+  }
+
   /**
    * Get the time when this message was last polled for.
    * @return the time when this message was last polled for, or 0 for never.
    */
   time_t getLastPollTime() const { return m_lastPollTime; }
 
+  /**
+   * Remember that the last data was seen in a message between other participants, i.e. not issued by ebusd itself.
+   */
+  void setPassiveUpdate() { m_lastPassiveUpdateTime = m_lastUpdateTime; }
+
   /**
    * Return whether this @a Message needs to be polled after the other one.
    * @param other the other @a Message to compare with.
@@ -561,17 +703,38 @@ class Message : public AttributedItem {
    * @param appendDirection whether to append the direction to the name key (for passive and write).
    * @param addRaw whether to add the raw symbols as well.
    * @param outputFormat the @a OutputFormat options to use.
-   * @param output the @a ostringstream to append the decoded value(s) to.
+   * @param output the @a OutputBuffer to append the decoded value(s) to.
    */
   virtual void decodeJson(bool leadingSeparator, bool appendDirection, bool addRaw, OutputFormat outputFormat,
-      ostringstream* output) const;
+      OutputBuffer* output) const;
 
  protected:
-  /** the optional circuit name. */
-  const string m_circuit;
+  /**
+   * Update the hash and change time of each field stored in the part of the last data and re-evaluate the dependent
+   * @a SimpleCondition instances.
+   * @param data the last data @a SymbolString that was changed.
+   * @param offset the additional offset to add for reading binary data.
+   */
+  void updateFieldChanges(const SymbolString& data, size_t offset);
 
-  /** the optional access level. */
-  const string m_level;
+  /**
+   * Drop the decoded values of the last data after it was changed.
+   */
+  void invalidateDecodedData();
+
+  /**
+   * Increase the global data sequence number and the one of the circuit after the last data was stored.
+   */
+  void increaseDataSequence();
+
+  /** the optional circuit name (interned in @a StringPool). */
+  const string& m_circuit;
+
+  /** the circuit name qualified by the @a MessageMap circuit prefix (interned in @a StringPool), or nullptr. */
+  const string* m_busCircuit;
+
+  /** the optional access level (interned in @a StringPool). */
+  const string& m_level;
 
   /** whether this is a write message. */
   const bool m_isWrite;
@@ -642,11 +805,49 @@ class Message : public AttributedItem {
   /** the system time when the message content was last changed, 0 for never. */
   time_t m_lastChangeTime;
 
+  /** the hash of the formatted value of each field (excluding ignored ones) from the last data, 0 for unset. */
+  vector<uint32_t> m_lastFieldHashes;
+
+  /** the system time when the value of each field (excluding ignored ones) was last changed, 0 for never. */
+  vector<time_t> m_lastFieldChangeTimes;
+
+  /** the @a SimpleCondition instances referring to this message that are re-evaluated on changed data. */
+  vector<SimpleCondition*> m_dependentConditions;
+
   /** the polling order of this message (roughly number of polls * priority). */
   unsigned int m_pollOrder;
 
   /** the system time when this message was last polled for, 0 for never. */
   time_t m_lastPollTime;
+
+  /** the system time of the last update not issued by ebusd itself, 0 for never. */
+  time_t m_lastPassiveUpdateTime;
+
+  /** the number of consecutive polls without changed data (limited to the maximum backoff). */
+  unsigned int m_pollUnchanged;
+
+  /** the data sequence number of the circuit (owned by the @a MessageMap), or nullptr. */
+  std::atomic<uint64_t>* m_circuitSequence;
+
+  /**
+   * A decoded value of the last data for a particular combination of decoding options.
+   */
+  struct DecodedData {
+    OutputFormat outputFormat;  //!< the @a OutputFormat options used
+    bool leadingSeparator;      //!< whether a separator was prepended
+    ssize_t fieldIndex;         //!< the index of the field the output was limited to, or -1
+    result_t result;            //!< the result of decoding
+    string value;               //!< the formatted value
+  };
+
+  /** the lazily decoded values of the last data (guarded by a common mutex as decoding is const). */
+  mutable vector<DecodedData> m_decodedData;
+
+  /** the index in @a m_decodedData to replace next when full. */
+  mutable size_t m_decodedDataNext;
+
+  /** the generation of the last data, increased whenever @a m_decodedData is invalidated. */
+  unsigned int m_decodedDataGeneration;
 };
 
 
@@ -704,6 +905,20 @@ class ChainedMessage : public Message {
   result_t prepareMasterPart(size_t index, const char separator, istringstream* input,
       MasterSymbolString* master) override;
 
+  // @copydoc
+  result_t prepareMasterPart(size_t index, const FieldValues& values, MasterSymbolString* master) override;
+
+
+ private:
+  /**
+   * Append a part of the already written master data of all parts for sending (everything including NN).
+   * @param index the index of the part to prepare.
+   * @param allData the @a MasterSymbolString with the master data of all parts.
+   * @param master the @a MasterSymbolString for writing symbols to.
+   * @return @a RESULT_OK on success, or an error code.
+   */
+  result_t appendMasterPart(size_t index, const MasterSymbolString& allData, MasterSymbolString* master);
+
 
  public:
   // @copydoc
@@ -795,6 +1010,110 @@ class MessagePriorityQueue
       }
     }
   }
+
+  /**
+   * Restore the heap order after the priority of contained elements changed.
+   */
+  void reorder() {
+    std::make_heap(c.begin(), c.end(), comp);
+  }
+};
+
+
+/**
+ * Open addressing hash index of the @a Message lists by key (see Message#getKey()).
+ * The buckets are kept in a single contiguous array and collisions are resolved by linear probing, which keeps
+ * a lookup within very few cache lines.
+ * Note: the index does not own the referenced lists, these have to stay valid until removed from the index.
+ */
+class MessageKeyIndex {
+ public:
+  /**
+   * Construct a new empty instance.
+   */
+  MessageKeyIndex() : m_size(0), m_shift(64) {}
+
+  /**
+   * Find the @a Message instances for the key.
+   * @param key the key of the @a Message.
+   * @return the indexed @a Message instances, or nullptr.
+   */
+  const vector<Message*>* find(uint64_t key) const {
+    if (m_size == 0) {
+      return nullptr;
+    }
+    size_t mask = m_buckets.size()-1;
+    for (size_t pos = getSlot(key); ; pos = (pos+1) & mask) {
+      const Bucket& bucket = m_buckets[pos];
+      if (bucket.m_messages == nullptr) {
+        return nullptr;
+      }
+      if (bucket.m_key == key) {
+        return bucket.m_messages;
+      }
+    }
+  }
+
+  /**
+   * Add or replace the @a Message instances for the key.
+   * @param key the key of the @a Message.
+   * @param messages the @a Message instances to reference.
+   */
+  void set(uint64_t key, const vector<Message*>* messages);
+
+  /**
+   * Remove the @a Message instances for the key.
+   * @param key the key of the @a Message.
+   */
+  void erase(uint64_t key);
+
+  /**
+   * Remove all entries.
+   */
+  void clear();
+
+  /**
+   * Get the number of indexed keys.
+   * @return the number of indexed keys.
+   */
+  size_t size() const { return m_size; }
+
+
+ private:
+  /**
+   * A single bucket of the index.
+   */
+  struct Bucket {
+    /** the key of the @a Message. */
+    uint64_t m_key;
+
+    /** the referenced @a Message instances, or nullptr for an empty bucket. */
+    const vector<Message*>* m_messages;
+  };
+
+  /**
+   * Get the preferred bucket position for the key.
+   * @param key the key of the @a Message.
+   * @return the preferred bucket position.
+   */
+  size_t getSlot(uint64_t key) const {
+    return static_cast<size_t>((key * 0x9e3779b97f4a7c15ULL) >> m_shift);
+  }
+
+  /**
+   * Resize the bucket array to the specified number of bits and re-insert all entries.
+   * @param bits the number of bits for the new bucket count.
+   */
+  void rehash(unsigned int bits);
+
+  /** the contiguous buckets (size is always a power of two, or zero). */
+  vector<Bucket> m_buckets;
+
+  /** the number of used buckets. */
+  size_t m_size;
+
+  /** the number of bits to shift the multiplied hash to the right for getting the bucket position. */
+  unsigned int m_shift;
 };
 
 
@@ -807,7 +1126,7 @@ class Condition {
    * Construct a new instance.
    */
   Condition()
-    : m_lastCheckTime(0), m_isTrue(false) { }
+    : m_isTrue(false) { }
 
   /**
    * Destructor.
@@ -823,14 +1142,21 @@ class Condition {
    * @return @a RESULT_OK on success, or an error code.
    */
   static result_t create(const string& condName, const map<string, string>& rowDefaults,
-      map<string, string>* row, SimpleCondition** returnValue);
+      MappedRow* row, SimpleCondition** returnValue);
 
   /**
    * Derive a new @a SimpleCondition from this condition.
    * @param valueList the @a string with the new list of values.
    * @return the derived @a SimpleCondition instance, or nullptr if the value list is invalid.
    */
-  virtual SimpleCondition* derive(const string& valueList) const { return nullptr; }
+  virtual SimpleCondition* derive(const string& /*valueList*/) const { return nullptr; }
+
+  /**
+   * Get an unresolved copy of this condition for use with another @a MessageMap.
+   * @param copies the copies created so far by original instance, updated with the new ones.
+   * @return the copy of this condition (the same one for each call with the same @p copies).
+   */
+  Condition* copy(map<const Condition*, Condition*>* copies) const;
 
   /**
    * Write the condition definition or resolved expression to the @a ostream.
@@ -857,18 +1183,44 @@ class Condition {
       ostringstream* errorMessage) = 0;
 
   /**
-   * Check and return whether this condition is fulfilled.
+   * Return whether this condition is fulfilled (as evaluated on the last change of the referred data).
    * @return whether this condition is fulfilled.
    */
-  virtual bool isTrue() = 0;
+  bool isTrue() const { return m_isTrue; }
+
+  /**
+   * Add a @a Condition to re-evaluate whenever the state of this condition changes.
+   * @param condition the @a Condition depending on this one.
+   */
+  void addDependent(Condition* condition);
+
+  /**
+   * Re-evaluate this condition and propagate a changed state to the dependent @a Condition instances.
+   */
+  void update();
 
 
  protected:
-  /** the system time when the condition was last checked, 0 for never. */
-  time_t m_lastCheckTime;
+  /**
+   * Evaluate this condition.
+   * @return whether this condition is fulfilled.
+   */
+  virtual bool evaluate() = 0;
 
-  /** whether the condition was @a true during the last check. */
+  /**
+   * Create a new unresolved copy of this condition.
+   * @param copies the copies created so far by original instance.
+   * @return the new copy of this condition.
+   */
+  virtual Condition* createCopy(map<const Condition*, Condition*>* copies) const = 0;
+
+
+ private:
+  /** whether the condition was @a true during the last evaluation. */
   bool m_isTrue;
+
+  /** the @a Condition instances depending on this one. */
+  vector<Condition*> m_dependents;
 };
 
 
@@ -913,9 +1265,6 @@ class SimpleCondition : public Condition {
   result_t resolve(void (*readMessageFunc)(Message* message), MessageMap* messages,
       ostringstream* errorMessage) override;
 
-  // @copydoc
-  bool isTrue() override;
-
   /**
    * Return whether the condition is based on a numeric value.
    * @return whether the condition is based on a numeric value.
@@ -924,19 +1273,23 @@ class SimpleCondition : public Condition {
 
 
  protected:
+  // @copydoc
+  bool evaluate() override;
+
+  // @copydoc
+  Condition* createCopy(map<const Condition*, Condition*>* copies) const override;
+
   /**
    * Check the values against the field in the @a Message.
    * @param message the @a Message to check against.
    * @param field the field name to check against, or empty for first field.
    * @return whether the field matches one of the valid values.
    */
-  virtual bool checkValue(const Message* message, const string& field) { return true; }
+  virtual bool checkValue(const Message* /*message*/, const string& /*field*/) { return true; }
 
   /** the value that matched in @a checkValue. */
   string m_matchedValue;
 
-
- private:
   /** the condition name. */
   const string m_condName;
 
@@ -962,6 +1315,8 @@ class SimpleCondition : public Condition {
   /** whether a value has to be checked against. */
   const bool m_hasValues;
 
+
+ private:
   /** the resolved @a Message instance, or nullptr. */
   Message* m_message;
 };
@@ -995,6 +1350,9 @@ class SimpleNumericCondition : public SimpleCondition {
 
 
  protected:
+  // @copydoc
+  Condition* createCopy(map<const Condition*, Condition*>* copies) const override;
+
   // @copydoc
   bool checkValue(const Message* message, const string& field) override;
 
@@ -1036,6 +1394,9 @@ class SimpleStringCondition : public SimpleCondition {
 
 
  protected:
+  // @copydoc
+  Condition* createCopy(map<const Condition*, Condition*>* copies) const override;
+
   // @copydoc
   bool checkValue(const Message* message, const string& field) override;
 
@@ -1072,8 +1433,13 @@ class CombinedCondition : public Condition {
   result_t resolve(void (*readMessageFunc)(Message* message), MessageMap* messages,
       ostringstream* errorMessage) override;
 
+
+ protected:
   // @copydoc
-  bool isTrue() override;
+  bool evaluate() override;
+
+  // @copydoc
+  Condition* createCopy(map<const Condition*, Condition*>* copies) const override;
 
 
  private:
@@ -1113,7 +1479,7 @@ class Instruction {
    * @return @a RESULT_OK on success, or an error code.
    */
   static result_t create(const string& relPath, const string& type,
-      Condition* condition, const map<string, string>& row, const map<string, string>& defaults,
+      Condition* condition, const MappedRow& row, const map<string, string>& defaults,
       Instruction** returnValue);
 
   /**
@@ -1144,6 +1510,13 @@ class Instruction {
    */
   virtual result_t execute(MessageMap* messages, ostringstream* log) = 0;
 
+  /**
+   * Create a copy of this instruction for use with another @a MessageMap.
+   * @param condition the copy of the @a Condition this instruction requires, or null.
+   * @return the new copy of this instruction.
+   */
+  virtual Instruction* copy(Condition* condition) const = 0;
+
 
  protected:
   /** the @a Condition this instruction requires, or null. */
@@ -1183,6 +1556,11 @@ class LoadInstruction : public Instruction {
   // @copydoc
   result_t execute(MessageMap* messages, ostringstream* log) override;
 
+  // @copydoc
+  Instruction* copy(Condition* condition) const override {
+    return new LoadInstruction(m_singleton, m_defaults, m_filename, condition);
+  }
+
 
  private:
   /** the relative name of the file to load. */
@@ -1190,6 +1568,28 @@ class LoadInstruction : public Instruction {
 };
 
 
+/** the maximum number of entries kept in the update feed of a @a MessageMap. */
+#define UPDATE_FEED_SIZE 1024
+
+
+/**
+ * Interface for listening to entries added to the update feed of a @a MessageMap.
+ */
+class MessageUpdateListener {
+ public:
+  /**
+   * Destructor.
+   */
+  virtual ~MessageUpdateListener() {}
+
+  /**
+   * Called from the updating thread after a @a Message was added to the update feed.
+   * @param message the updated @a Message.
+   */
+  virtual void notifyMessageUpdate(const Message* message) = 0;  // abstract
+};
+
+
 /**
  * Helper class for information about a loaded file.
  */
@@ -1220,10 +1620,12 @@ class MessageMap : public MappedFileReader {
    * @param preferLanguage the preferred language to use, or empty.
    * @param deleteData whether to delete the scan message @a DataField during @a Message destruction.
    */
-  explicit MessageMap(bool addAll = false, const string& preferLanguage = "", bool deleteData = true)
+  explicit MessageMap(bool addAll = false, const string& /*preferLanguage*/ = "", bool deleteData = true)
   : MappedFileReader::MappedFileReader(true),
     m_addAll(addAll), m_additionalScanMessages(false), m_maxIdLength(0), m_maxBroadcastIdLength(0),
-    m_messageCount(0), m_conditionalMessageCount(0), m_passiveMessageCount(0) {
+    m_messageCount(0), m_conditionalMessageCount(0), m_passiveMessageCount(0), m_generation(0),
+    m_feedStart(0), m_feedSequence(0), m_updateListener(nullptr) {
+    memset(m_pbsbFilter, 0, sizeof(m_pbsbFilter));
     m_scanMessage = Message::createScanMessage(false, deleteData);
     m_broadcastScanMessage = Message::createScanMessage(true, false);
   }
@@ -1233,6 +1635,10 @@ class MessageMap : public MappedFileReader {
    */
   virtual ~MessageMap() {
     clear();
+    for (const auto& it : m_circuitSequences) {
+      delete it.second;
+    }
+    m_circuitSequences.clear();
     if (m_scanMessage) {
       delete m_scanMessage;
       m_scanMessage = nullptr;
@@ -1263,8 +1669,8 @@ class MessageMap : public MappedFileReader {
   result_t getFieldMap(const string& preferLanguage, vector<string>* row, string* errorDescription) const override;
 
   // @copydoc
-  result_t addDefaultFromFile(const string& filename, unsigned int lineNo, map<string, string>* row,
-      vector< map<string, string> >* subRows, string* errorDescription) override;
+  result_t addDefaultFromFile(const string& filename, unsigned int lineNo, MappedRow* row,
+      vector<MappedRow>* subRows, string* errorDescription) override;
 
   /**
    * Read the @a Condition instance(s) from the types field.
@@ -1284,11 +1690,11 @@ class MessageMap : public MappedFileReader {
   // @copydoc
   result_t readFromStream(istream* stream, const string& filename, const time_t& mtime, bool verbose,
       map<string, string>* defaults, string* errorDescription, bool replace = false, size_t* hash = nullptr,
-      size_t* size = nullptr) override;
+      size_t* size = nullptr, RowCache* cache = nullptr) override;
 
   // @copydoc
-  result_t addFromFile(const string& filename, unsigned int lineNo, map<string, string>* row,
-      vector< map<string, string> >* subRows, string* errorDescription, bool replace) override;
+  result_t addFromFile(const string& filename, unsigned int lineNo, MappedRow* row,
+      vector<MappedRow>* subRows, string* errorDescription, bool replace) override;
 
   /**
    * Get the scan @a Message instance for the specified address.
@@ -1411,15 +1817,14 @@ class MessageMap : public MappedFileReader {
     time_t since, time_t until, bool changedSince, deque<Message*>* messages) const;
 
   /**
-   * Get the first available @a Message from the first map iterator entry.
-   * @param it the map iterator with list of @a Message instances to check.
+   * Get the first available @a Message from the entry in the key index.
+   * @param key the key of the @a Message instances to check.
    * @param sameIdExtAs the optional @a MasterSymbolString to check for having the same ID.
    * @param onlyAvailable true to include only available messages (default true), false to also include messages that
    * are currently not available (e.g. due to unresolved or false conditions).
-   * @return the first available @a Message from the first map iterator entry.
+   * @return the first available @a Message from the entry in the key index, or nullptr.
    */
-  Message* getFirstAvailableFromIterator(const map<uint64_t, vector<Message*> >::const_iterator& it,
-    const MasterSymbolString* sameIdExtAs, bool onlyAvailable) const;
+  Message* getFirstAvailableFromIndex(uint64_t key, const MasterSymbolString* sameIdExtAs, bool onlyAvailable) const;
 
   /**
    * Find the @a Message instance for the specified master data.
@@ -1442,6 +1847,42 @@ class MessageMap : public MappedFileReader {
    */
   void invalidateCache(Message* message);
 
+  /**
+   * Set the @a MessageUpdateListener to notify about entries added to the update feed.
+   * @param listener the @a MessageUpdateListener, or nullptr.
+   */
+  void setUpdateListener(MessageUpdateListener* listener) { m_updateListener = listener; }
+
+  /**
+   * Add a @a Message to the update feed after its last data was stored.
+   * @param message the updated @a Message.
+   */
+  void notifyUpdate(Message* message);
+
+  /**
+   * Get the sequence number of the next entry to be added to the update feed.
+   * @return the sequence number of the next entry to be added to the update feed.
+   */
+  uint64_t getUpdateSequence();
+
+  /**
+   * Get a sequence number that changes whenever the last data of any of the messages of a circuit, the set of
+   * stored messages, or the data referred to by any @a Condition changed.
+   * @param circuit the circuit name, or empty for all circuits.
+   * @return the data sequence number.
+   */
+  uint64_t getDataSequence(const string& circuit) const;
+
+  /**
+   * Get the @a Message instances added to the update feed since the cursor (each one only once).
+   * @param cursor the sequence number of the first entry to check, updated to the next sequence number.
+   * @param onlyChanged true to include only entries with changed data, false to include all updates.
+   * @param messages the @a deque to which to add the updated @a Message instances.
+   * @return true on success, false if the entries at the cursor were dropped from the feed in the meantime
+   * (in which case the caller needs to fall back to @a findAll()).
+   */
+  bool getUpdates(uint64_t* cursor, bool onlyChanged, deque<Message*>* messages);
+
   /**
    * Add a @a Message to the list of instances to poll.
    * @param toFront whether to add the @a Message to the very front of the poll queue.
@@ -1473,6 +1914,46 @@ class MessageMap : public MappedFileReader {
    */
   void clear();
 
+  /**
+   * Replace all @a Message instances, conditions, instructions, and loaded files with the ones from another instance
+   * and move the previous ones over to that instance (to be freed together with it). @a Message instances with the
+   * same key, circuit, name, and direction take over the last data and the poll state of their predecessor.
+   * @param other the @a MessageMap holding the replacement (not used by anyone else).
+   * @return the number of @a Message instances that took over the last data.
+   */
+  size_t swapDefinitions(MessageMap* other);
+
+  /**
+   * Move all @a Message instances, conditions, instructions, and loaded files from another instance over to this
+   * one, leaving the other one empty. This allows loading independent files into separate instances in parallel.
+   * @param other the @a MessageMap with the definitions of files not loaded into this instance yet (not used by anyone
+   * else).
+   * @return @a RESULT_OK on success, or an error code if a @a Message could not be added (only when not adding all).
+   */
+  result_t takeDefinitions(MessageMap* other);
+
+  /**
+   * Add copies of all @a Message instances, conditions, instructions, and loaded files of another instance (sharing
+   * the decoding @a DataField instances with it), e.g. for using the same parsed configuration on several buses.
+   * @param other the @a MessageMap to copy from (needs to outlive this instance and may not be modified meanwhile).
+   * @return @a RESULT_OK on success, or an error code if a @a Message could not be added (only when not adding all).
+   */
+  result_t copyDefinitions(const MessageMap& other);
+
+  /**
+   * Set the prefix for the circuit names of all @a Message instances added from now on (e.g. the bus ID followed by a
+   * dot). The circuit names passed to the lookup methods are qualified with the prefix unless they already start
+   * with it.
+   * @param prefix the circuit prefix, or empty.
+   */
+  void setCircuitPrefix(const string& prefix);
+
+  /**
+   * Get the prefix for the circuit names of the @a Message instances.
+   * @return the circuit prefix, or empty.
+   */
+  const string& getCircuitPrefix() const { return m_circuitPrefix; }
+
   /**
    * Get the number of all stored @a Message instances.
    * @return the the number of all stored @a Message instances.
@@ -1485,6 +1966,13 @@ class MessageMap : public MappedFileReader {
    */
   size_t sizeConditional() const { return m_conditionalMessageCount; }
 
+  /**
+   * Get the generation of the stored @a Message instances that is increased whenever an instance is added or removed
+   * (e.g. for invalidating cached @a Message pointers).
+   * @return the generation of the stored @a Message instances.
+   */
+  size_t getGeneration() const { return m_generation; }
+
   /**
    * Get the number of stored passive @a Message instances.
    * @return the the number of stored passive @a Message instances.
@@ -1499,6 +1987,8 @@ class MessageMap : public MappedFileReader {
 
   /**
    * Get the next @a Message to poll.
+   * Messages updated by another master since their last poll are skipped, and messages with data not changing
+   * between polls are polled less frequently.
    * @return the next @a Message to poll, or nullptr.
    * Note: the caller may not free the returned instance.
    */
@@ -1525,12 +2015,47 @@ class MessageMap : public MappedFileReader {
 
 
  private:
+  /**
+   * Get the @a Message instances stored under the name key, creating a new entry if necessary.
+   * @param nameKey the lowercase name key.
+   * @return the @a Message instances stored under the name key.
+   */
+  vector<Message*>* getOrCreateByName(const string& nameKey);
+
+  /**
+   * Erase an entry from @a m_messagesByName and its hash index.
+   * @param it the iterator of the entry to erase.
+   * @return the iterator following the erased entry.
+   */
+  map<string, vector<Message*> >::iterator eraseByName(map<string, vector<Message*> >::iterator it);
+
+  /**
+   * Get the data sequence number of a circuit, creating a new one if necessary.
+   * @param circuit the circuit name.
+   * @return the data sequence number (kept until destruction).
+   */
+  std::atomic<uint64_t>* getCircuitSequence(const string& circuit);
+
+  /**
+   * Qualify a circuit name with the circuit prefix.
+   * @param circuit the circuit name.
+   * @param qualified the @a string in which to store the qualified circuit name if necessary.
+   * @return either @p circuit if it is empty or already qualified, or @p qualified.
+   */
+  const string& qualifyCircuit(const string& circuit, string* qualified) const;
+
   /** empty vector for @a getLoadedFiles(). */
   static vector<string> s_noFiles;
 
+  /** empty circuit name for lookup without circuit. */
+  static const string s_noCircuit;
+
   /** whether to add all messages, even if duplicate. */
   const bool m_addAll;
 
+  /** the prefix for the circuit names of the @a Message instances, or empty. */
+  string m_circuitPrefix;
+
   /** the @a Message instance used for scanning a slave. */
   Message* m_scanMessage;
 
@@ -1561,12 +2086,24 @@ class MessageMap : public MappedFileReader {
   /** the number of distinct passive @a Message instances stored in @a m_messagesByKey. */
   size_t m_passiveMessageCount;
 
+  /** the generation of the stored @a Message instances (see @a getGeneration()). */
+  std::atomic<size_t> m_generation;
+
   /** the known @a Message instances by lowercase circuit (optional), name, and type. */
   map<string, vector<Message*> > m_messagesByName;
 
+  /** the entries of @a m_messagesByName by hash of the name key for lookup without building the key. */
+  unordered_multimap<uint64_t, map<string, vector<Message*> >::iterator> m_messagesByNameHash;
+
   /** the known @a Message instances by key. */
   map<uint64_t, vector<Message*> > m_messagesByKey;
 
+  /** the hash index of the entries in @a m_messagesByKey for fast lookup of received messages. */
+  MessageKeyIndex m_messageIndex;
+
+  /** bitmap of the primary and secondary command bytes (PBSB) used by any of the keys in @a m_messagesByKey. */
+  uint64_t m_pbsbFilter[(1 << 16) / 64];
+
   /** the known @a Message instances to poll, by priority. */
   MessagePriorityQueue m_pollMessages;
 
@@ -1578,6 +2115,30 @@ class MessageMap : public MappedFileReader {
 
   /** additional attributes by circuit name. */
   map<string, AttributedItem*> m_circuitData;
+
+  /** the data sequence numbers by lower case circuit name (kept until destruction). */
+  map<string, std::atomic<uint64_t>*> m_circuitSequences;
+
+  /** the @a Mutex for @a m_circuitSequences. */
+  mutable Mutex m_circuitSequencesMutex;
+
+  /** the @a Mutex for the update feed. */
+  Mutex m_feedMutex;
+
+  /** the update feed of @a Message instances indexed by sequence number modulo @a UPDATE_FEED_SIZE. */
+  Message* m_feedMessages[UPDATE_FEED_SIZE];
+
+  /** whether the data of the corresponding entry in @a m_feedMessages changed. */
+  bool m_feedChanged[UPDATE_FEED_SIZE];
+
+  /** the sequence number of the oldest valid entry in the update feed. */
+  uint64_t m_feedStart;
+
+  /** the sequence number of the next entry to be added to the update feed. */
+  uint64_t m_feedSequence;
+
+  /** the @a MessageUpdateListener to notify about entries added to the update feed, or nullptr. */
+  MessageUpdateListener* m_updateListener;
 };
 
 }  // namespace ebusd
@@ -0,0 +1,118 @@
+/*
+ * ebusd - daemon for communication with eBUS heating systems.
+ * Copyright (C) 2014-2018 John Baier <ebusd@ebusd.eu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lib/ebus/outputbuffer.h"
+#include <cstdio>
+
+namespace ebusd {
+
+/** the limit below which an integer is represented exactly in a float. */
+#define FLOAT_EXACT_LIMIT (1 << 24)
+
+void OutputBuffer::appendUnsigned(uint64_t value, size_t width) {
+  char buf[20];
+  size_t pos = sizeof(buf);
+  do {
+    buf[--pos] = static_cast<char>('0' + value % 10);
+    value /= 10;
+  } while (value > 0);
+  size_t digits = sizeof(buf)-pos;
+  if (width > digits) {
+    m_data.append(width-digits, '0');
+  }
+  m_data.append(buf+pos, digits);
+}
+
+void OutputBuffer::appendSigned(int64_t value) {
+  if (value < 0) {
+    m_data.push_back('-');
+    appendUnsigned(0-static_cast<uint64_t>(value));
+  } else {
+    appendUnsigned(static_cast<uint64_t>(value));
+  }
+}
+
+void OutputBuffer::appendFixed(int64_t value, int divisor, size_t precision) {
+  if (divisor < 0) {
+    // the float product is exact as long as it is within the float mantissa
+    int64_t product = value * -divisor;
+    if (product > -FLOAT_EXACT_LIMIT && product < FLOAT_EXACT_LIMIT) {
+      appendSigned(product);
+    } else {
+      appendFloat(static_cast<double>(static_cast<float>(value) * static_cast<float>(-divisor)), 0);
+    }
+    return;
+  }
+  if (divisor <= 1) {
+    appendSigned(value);
+    return;
+  }
+  uint64_t scale = 1;
+  for (size_t digit = 0; digit < precision; digit++) {
+    scale *= 10;
+  }
+  // the float quotient rounds to the exact decimal digits for a power of ten as long as the error of the float
+  // division stays below half of the last digit, i.e. for values within half of the float mantissa
+  if (scale != static_cast<uint64_t>(divisor) || value <= -FLOAT_EXACT_LIMIT/2 || value >= FLOAT_EXACT_LIMIT/2) {
+    appendFloat(static_cast<double>(static_cast<float>(value) / static_cast<float>(divisor)), precision);
+    return;
+  }
+  uint64_t absValue;
+  if (value < 0) {
+    m_data.push_back('-');
+    absValue = 0-static_cast<uint64_t>(value);
+  } else {
+    absValue = static_cast<uint64_t>(value);
+  }
+  appendUnsigned(absValue / scale);
+  m_data.push_back('.');
+  appendUnsigned(absValue % scale, precision);
+}
+
+void OutputBuffer::appendFloat(double value, size_t precision) {
+  char buf[80];
+  int length = snprintf(buf, sizeof(buf), "%.*f", static_cast<int>(precision), value);
+  if (length > 0) {
+    m_data.append(buf, static_cast<size_t>(length) < sizeof(buf) ? static_cast<size_t>(length) : sizeof(buf)-1);
+  }
+}
+
+void OutputBuffer::appendJsonChars(const char* str, size_t length) {
+  static const char* hex = "0123456789abcdef";
+  size_t start = 0;
+  for (size_t pos = 0; pos < length; pos++) {
+    unsigned char ch = static_cast<unsigned char>(str[pos]);
+    if (ch >= 0x20 && ch != '"' && ch != '\\') {
+      continue;
+    }
+    m_data.append(str+start, pos-start);
+    start = pos+1;
+    if (ch == '"') {
+      m_data.push_back('\'');
+    } else if (ch == '\\') {
+      m_data.append("\\\\");
+    } else {
+      m_data.append("\\u00");
+      m_data.push_back(hex[ch >> 4]);
+      m_data.push_back(hex[ch & 0x0f]);
+    }
+  }
+  m_data.append(str+start, length-start);
+}
+
+}  // namespace ebusd
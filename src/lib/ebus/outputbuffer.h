@@ -0,0 +1,170 @@
+/*
+ * ebusd - daemon for communication with eBUS heating systems.
+ * Copyright (C) 2014-2018 John Baier <ebusd@ebusd.eu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIB_EBUS_OUTPUTBUFFER_H_
+#define LIB_EBUS_OUTPUTBUFFER_H_
+
+#include <stdint.h>
+#include <string>
+
+namespace ebusd {
+
+/** @file lib/ebus/outputbuffer.h
+ * An append-only buffer for formatting decoded values without going through
+ * a locale aware stream.
+ */
+
+using std::string;
+
+/**
+ * An append-only character buffer for formatted output.
+ * Numbers are formatted by hand, so no stream state or locale is involved. The buffer keeps its capacity when
+ * cleared, so a reused instance does not allocate once it has grown to the typical output size.
+ */
+class OutputBuffer {
+ public:
+  /**
+   * Constructs a new empty instance.
+   */
+  OutputBuffer() {}
+
+  /**
+   * Clear the content while keeping the allocated capacity.
+   */
+  void clear() { m_data.clear(); }
+
+  /**
+   * @return the number of characters in the buffer.
+   */
+  size_t size() const { return m_data.size(); }
+
+  /**
+   * @return true if the buffer is empty.
+   */
+  bool empty() const { return m_data.empty(); }
+
+  /**
+   * @return the characters in the buffer (not terminated).
+   */
+  const char* data() const { return m_data.data(); }
+
+  /**
+   * @return the content of the buffer.
+   */
+  const string& str() const { return m_data; }
+
+  /**
+   * Drop the characters appended after the specified size.
+   * @param size the size to truncate to.
+   */
+  void truncate(size_t size) {
+    if (size < m_data.size()) {
+      m_data.resize(size);
+    }
+  }
+
+  /**
+   * Append characters to the buffer.
+   * @param str the characters to append.
+   * @param length the number of characters to append.
+   */
+  void append(const char* str, size_t length) { m_data.append(str, length); }
+
+  /**
+   * Append a single character.
+   * @param ch the character to append.
+   * @return this instance.
+   */
+  OutputBuffer& operator<<(char ch) {
+    m_data.push_back(ch);
+    return *this;
+  }
+
+  /**
+   * Append a terminated string.
+   * @param str the string to append.
+   * @return this instance.
+   */
+  OutputBuffer& operator<<(const char* str) {
+    m_data.append(str);
+    return *this;
+  }
+
+  /**
+   * Append a string.
+   * @param str the string to append.
+   * @return this instance.
+   */
+  OutputBuffer& operator<<(const string& str) {
+    m_data.append(str);
+    return *this;
+  }
+
+  /**
+   * Prevent implicitly appending a number as character, use the explicit append methods instead.
+   */
+  template <typename T>
+  OutputBuffer& operator<<(T) = delete;
+
+  /**
+   * Append the decimal representation of an unsigned value.
+   * @param value the value to append.
+   * @param width the minimum number of digits to fill with leading zeros.
+   */
+  void appendUnsigned(uint64_t value, size_t width = 0);
+
+  /**
+   * Append the decimal representation of a signed value.
+   * @param value the value to append.
+   */
+  void appendSigned(int64_t value);
+
+  /**
+   * Append a raw value with the divisor applied, formatted exactly like the float based calculation of a
+   * @a NumberDataType (i.e. with the precision digits for a divisor, or the rounded product for a multiplier).
+   * The digits are calculated by hand when the result is exact, otherwise the float value is formatted.
+   * @param value the raw value.
+   * @param divisor the divisor (negative for reciprocal).
+   * @param precision the number of fractional digits to append for a divisor greater than 1.
+   */
+  void appendFixed(int64_t value, int divisor, size_t precision);
+
+  /**
+   * Append a floating point value in fixed notation.
+   * @param value the value to append.
+   * @param precision the number of fractional digits.
+   */
+  void appendFloat(double value, size_t precision);
+
+  /**
+   * Append the characters of a JSON string while escaping them as needed (without the enclosing quotes).
+   * A nested '"' is replaced by '\'' for compatibility.
+   * @param str the characters to append.
+   * @param length the number of characters to append.
+   */
+  void appendJsonChars(const char* str, size_t length);
+
+
+ private:
+  /** the buffered characters. */
+  string m_data;
+};
+
+}  // namespace ebusd
+
+#endif  // LIB_EBUS_OUTPUTBUFFER_H_
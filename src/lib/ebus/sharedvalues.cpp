@@ -0,0 +1,282 @@
+/*
+ * ebusd - daemon for communication with eBUS heating systems.
+ * Copyright (C) 2021 John Baier <ebusd@ebusd.eu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "lib/ebus/sharedvalues.h"
+#include <fcntl.h>
+#include <grp.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+
+namespace ebusd {
+
+/**
+ * Build the slot index key of a message.
+ * @param type the message type: 'r' for read, 'w' for write, 'u' for passive.
+ * @param circuit the circuit name.
+ * @param name the message name.
+ * @return the slot index key.
+ */
+static string getSlotKey(char type, const string& circuit, const string& name) {
+  string key;
+  key.reserve(circuit.length()+name.length()+2);
+  key += type;
+  key += circuit;
+  key += '\t';
+  key += name;
+  return key;
+}
+
+/**
+ * Copy a string to a fixed size zero terminated field.
+ * @param str the string to copy.
+ * @param field the field to copy to with @a SHARED_VALUES_NAME_SIZE characters.
+ */
+static void copyName(const string& str, char* field) {
+  size_t len = std::min(str.length(), static_cast<size_t>(SHARED_VALUES_NAME_SIZE-1));
+  memcpy(field, str.c_str(), len);
+  memset(field+len, 0, SHARED_VALUES_NAME_SIZE-len);
+}
+
+SharedValuesWriter::~SharedValuesWriter() {
+  if (m_header) {
+    munmap(m_header, m_size);
+    m_header = nullptr;
+    m_slots = nullptr;
+    shm_unlink(m_name.c_str());
+  }
+}
+
+result_t SharedValuesWriter::open() {
+  if (m_header) {
+    return RESULT_OK;
+  }
+  gid_t gid = 0;
+  if (!m_group.empty()) {
+    struct group* grp = getgrnam(m_group.c_str());
+    if (grp == nullptr) {
+      return RESULT_ERR_NOTFOUND;
+    }
+    gid = grp->gr_gid;
+  }
+  shm_unlink(m_name.c_str());  // drop a leftover segment with a possibly different layout
+  int fd = shm_open(m_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd < 0) {
+    return RESULT_ERR_DEVICE;
+  }
+  size_t size = sizeof(SharedValuesHeader) + m_slotCount*sizeof(SharedValueSlot);
+  if ((!m_group.empty() && (fchown(fd, static_cast<uid_t>(-1), gid) != 0 || fchmod(fd, 0640) != 0))
+      || ftruncate(fd, static_cast<off_t>(size)) != 0) {
+    ::close(fd);
+    shm_unlink(m_name.c_str());
+    return RESULT_ERR_DEVICE;
+  }
+  void* addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (addr == MAP_FAILED) {
+    shm_unlink(m_name.c_str());
+    return RESULT_ERR_DEVICE;
+  }
+  m_size = size;
+  m_header = reinterpret_cast<SharedValuesHeader*>(addr);
+  m_slots = reinterpret_cast<SharedValueSlot*>(reinterpret_cast<char*>(addr) + sizeof(SharedValuesHeader));
+  m_header->version = SHARED_VALUES_VERSION;
+  m_header->slotSize = static_cast<uint16_t>(sizeof(SharedValueSlot));
+  m_header->slotCount = m_slotCount;
+  m_header->usedSlots.store(0, std::memory_order_relaxed);
+  m_header->startTime = static_cast<int64_t>(time(nullptr));
+  std::atomic_thread_fence(std::memory_order_release);
+  m_header->magic = SHARED_VALUES_MAGIC;  // the segment is complete now
+  return RESULT_OK;
+}
+
+void SharedValuesWriter::update(const Message* message) {
+  if (!m_header || message->getLastUpdateTime() == 0) {
+    return;
+  }
+  const MasterSymbolString& master = message->getLastMasterData();
+  const SlaveSymbolString& slave = message->getLastSlaveData();
+  if (master.size() > SHARED_VALUES_DATA_SIZE || slave.size() > SHARED_VALUES_DATA_SIZE) {
+    return;  // too long for a slot
+  }
+  char type = message->isPassive() ? 'u' : message->isWrite() ? 'w' : 'r';
+  string key = getSlotKey(type, message->getCircuit(), message->getName());
+  m_lock.lock();
+  uint32_t index;
+  bool assign = false;
+  const auto it = m_slotIndex.find(key);
+  if (it != m_slotIndex.end()) {
+    index = it->second;
+  } else if (m_slotIndex.size() < m_slotCount) {
+    index = static_cast<uint32_t>(m_slotIndex.size());
+    m_slotIndex[key] = index;
+    assign = true;
+  } else {
+    m_lock.unlock();
+    return;  // no more free slots
+  }
+  SharedValueSlot* slot = m_slots+index;
+  uint32_t sequence = slot->sequence.load(std::memory_order_relaxed);
+  slot->sequence.store(sequence+1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  if (assign) {
+    slot->type = type;
+    copyName(message->getCircuit(), slot->circuit);
+    copyName(message->getName(), slot->name);
+  }
+  slot->key = message->getKey();  // changes when a reload defines the message differently
+  slot->updateTime = static_cast<int64_t>(message->getLastUpdateTime());
+  slot->changeTime = static_cast<int64_t>(message->getLastChangeTime());
+  slot->masterLength = static_cast<uint8_t>(master.size());
+  for (size_t pos = 0; pos < master.size(); pos++) {
+    slot->master[pos] = master[pos];
+  }
+  slot->slaveLength = static_cast<uint8_t>(slave.size());
+  for (size_t pos = 0; pos < slave.size(); pos++) {
+    slot->slave[pos] = slave[pos];
+  }
+  slot->sequence.store(sequence+2, std::memory_order_release);
+  if (assign) {
+    m_header->usedSlots.store(index+1, std::memory_order_release);
+  }
+  m_lock.unlock();
+}
+
+
+result_t SharedValuesReader::open(const string& name) {
+  close();
+  int fd = shm_open(name.c_str(), O_RDONLY, 0);
+  if (fd < 0) {
+    return RESULT_ERR_NOTFOUND;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(SharedValuesHeader)) {
+    ::close(fd);
+    return RESULT_ERR_INVALID_ARG;
+  }
+  size_t size = static_cast<size_t>(st.st_size);
+  void* addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (addr == MAP_FAILED) {
+    return RESULT_ERR_DEVICE;
+  }
+  const SharedValuesHeader* header = reinterpret_cast<const SharedValuesHeader*>(addr);
+  if (header->magic != SHARED_VALUES_MAGIC || header->version != SHARED_VALUES_VERSION
+      || header->slotSize != sizeof(SharedValueSlot)
+      || sizeof(SharedValuesHeader) + header->slotCount*sizeof(SharedValueSlot) > size) {
+    munmap(addr, size);
+    return RESULT_ERR_INVALID_ARG;
+  }
+  std::atomic_thread_fence(std::memory_order_acquire);
+  m_size = size;
+  m_header = header;
+  m_slots = reinterpret_cast<const SharedValueSlot*>(reinterpret_cast<const char*>(addr)
+      + sizeof(SharedValuesHeader));
+  return RESULT_OK;
+}
+
+void SharedValuesReader::close() {
+  if (m_header) {
+    munmap(const_cast<SharedValuesHeader*>(m_header), m_size);
+    m_header = nullptr;
+    m_slots = nullptr;
+  }
+}
+
+uint32_t SharedValuesReader::getUsedSlots() const {
+  return m_header ? m_header->usedSlots.load(std::memory_order_acquire) : 0;
+}
+
+bool SharedValuesReader::find(char type, const string& circuit, const string& name, uint32_t* slot) const {
+  uint32_t used = getUsedSlots();
+  for (uint32_t index = 0; index < used; index++) {
+    const SharedValueSlot* entry = m_slots+index;  // identity is immutable once the slot is assigned
+    if (entry->type == type && strncmp(entry->circuit, circuit.c_str(), SHARED_VALUES_NAME_SIZE) == 0
+        && strncmp(entry->name, name.c_str(), SHARED_VALUES_NAME_SIZE) == 0) {
+      *slot = index;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool SharedValuesReader::read(uint32_t slot, SharedValue* value) const {
+  if (slot >= getUsedSlots()) {
+    return false;
+  }
+  const SharedValueSlot* entry = m_slots+slot;
+  SharedValueSlot copy;
+  uint32_t sequence;
+  do {
+    sequence = entry->sequence.load(std::memory_order_acquire);
+    if (sequence & 1) {
+      continue;  // being written
+    }
+    copy.key = entry->key;
+    copy.updateTime = entry->updateTime;
+    copy.changeTime = entry->changeTime;
+    copy.masterLength = std::min(entry->masterLength, static_cast<uint8_t>(SHARED_VALUES_DATA_SIZE));
+    copy.slaveLength = std::min(entry->slaveLength, static_cast<uint8_t>(SHARED_VALUES_DATA_SIZE));
+    memcpy(copy.master, entry->master, copy.masterLength);
+    memcpy(copy.slave, entry->slave, copy.slaveLength);
+    std::atomic_thread_fence(std::memory_order_acquire);
+  } while ((sequence & 1) || entry->sequence.load(std::memory_order_relaxed) != sequence);
+  value->type = entry->type;
+  value->key = copy.key;
+  value->circuit.assign(entry->circuit, strnlen(entry->circuit, SHARED_VALUES_NAME_SIZE));
+  value->name.assign(entry->name, strnlen(entry->name, SHARED_VALUES_NAME_SIZE));
+  value->updateTime = static_cast<time_t>(copy.updateTime);
+  value->changeTime = static_cast<time_t>(copy.changeTime);
+  value->master.clear();
+  for (size_t pos = 0; pos < copy.masterLength; pos++) {
+    value->master.push_back(copy.master[pos]);
+  }
+  value->slave.clear();
+  for (size_t pos = 0; pos < copy.slaveLength; pos++) {
+    value->slave.push_back(copy.slave[pos]);
+  }
+  return true;
+}
+
+size_t SharedValuesReader::restore(MessageMap* messages) const {
+  size_t count = 0;
+  uint32_t used = getUsedSlots();
+  SharedValue value;
+  messages->lock();
+  for (uint32_t slot = 0; slot < used; slot++) {
+    if (!read(slot, &value)) {
+      continue;
+    }
+    Message* message = messages->find(value.circuit, value.name, "*", value.type == 'w', value.type == 'u');
+    if (message && message->restoreLastData(value.master, value.slave, value.updateTime, value.changeTime)
+        == RESULT_OK) {
+      count++;
+    }
+  }
+  messages->unlock();
+  return count;
+}
+
+}  // namespace ebusd
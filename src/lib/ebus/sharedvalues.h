@@ -0,0 +1,243 @@
+/*
+ * ebusd - daemon for communication with eBUS heating systems.
+ * Copyright (C) 2021 John Baier <ebusd@ebusd.eu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIB_EBUS_SHAREDVALUES_H_
+#define LIB_EBUS_SHAREDVALUES_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <map>
+#include <string>
+#include "lib/ebus/message.h"
+#include "lib/ebus/result.h"
+#include "lib/ebus/symbol.h"
+#include "lib/utils/thread.h"
+
+namespace ebusd {
+
+/** @file lib/ebus/sharedvalues.h
+ * A read-only shared memory segment with the last data of the messages for local consumers.
+ *
+ * The segment starts with a @a SharedValuesHeader followed by a fixed number
+ * of @a SharedValueSlot entries. The daemon assigns a slot to each updated
+ * @a Message on its first update and keeps the slot for the same message type,
+ * circuit and name, so consumers may remember the slot of a message. The key
+ * of a slot follows the message, e.g. when a reload changed its definition.
+ *
+ * Each slot is protected by a sequence counter (seqlock): the writer makes the
+ * counter odd before and even after changing the slot, and a reader retries
+ * when it saw an odd or changed counter. Readers therefore never block the
+ * writer, and the writer does no work per reader.
+ *
+ * The raw master and slave data is decoded by the consumer itself using a
+ * @a MessageMap read from the same configuration (see SharedValuesReader#restore()).
+ */
+
+using std::map;
+using std::string;
+
+/** the magic number at the start of the shared values segment ("eBSV"). */
+#define SHARED_VALUES_MAGIC 0x65425356
+
+/** the version of the shared values segment layout. */
+#define SHARED_VALUES_VERSION 1
+
+/** the default number of slots in the shared values segment. */
+#define SHARED_VALUES_DEFAULT_SLOTS 1024
+
+/** the maximum length of the circuit and of the name of a slot including the terminating zero. */
+#define SHARED_VALUES_NAME_SIZE 48
+
+/** the maximum length of the master and of the slave data of a slot. */
+#define SHARED_VALUES_DATA_SIZE 96
+
+/**
+ * The header of the shared values segment.
+ */
+struct SharedValuesHeader {
+  uint32_t magic;  //!< the magic number @a SHARED_VALUES_MAGIC
+  uint16_t version;  //!< the layout version @a SHARED_VALUES_VERSION
+  uint16_t slotSize;  //!< the size of a single @a SharedValueSlot
+  uint32_t slotCount;  //!< the number of available slots
+  std::atomic<uint32_t> usedSlots;  //!< the number of assigned slots
+  int64_t startTime;  //!< the system time the segment was created
+};
+
+/**
+ * A single message slot in the shared values segment.
+ */
+struct SharedValueSlot {
+  std::atomic<uint32_t> sequence;  //!< the sequence counter, odd while the slot is being written
+  char type;  //!< the message type: 'r' for read, 'w' for write, 'u' for passive
+  uint8_t masterLength;  //!< the length of the master data
+  uint8_t slaveLength;  //!< the length of the slave data
+  uint8_t reserved;  //!< reserved for alignment
+  uint64_t key;  //!< the message key (see Message#getKey())
+  int64_t updateTime;  //!< the system time of the last update
+  int64_t changeTime;  //!< the system time of the last change
+  char circuit[SHARED_VALUES_NAME_SIZE];  //!< the zero terminated circuit name
+  char name[SHARED_VALUES_NAME_SIZE];  //!< the zero terminated message name
+  symbol_t master[SHARED_VALUES_DATA_SIZE];  //!< the unescaped master data
+  symbol_t slave[SHARED_VALUES_DATA_SIZE];  //!< the unescaped slave data
+};
+
+/**
+ * A consistent copy of a @a SharedValueSlot taken by a @a SharedValuesReader.
+ */
+struct SharedValue {
+  char type;  //!< the message type: 'r' for read, 'w' for write, 'u' for passive
+  uint64_t key;  //!< the message key (see Message#getKey())
+  time_t updateTime;  //!< the system time of the last update
+  time_t changeTime;  //!< the system time of the last change
+  string circuit;  //!< the circuit name
+  string name;  //!< the message name
+  MasterSymbolString master;  //!< the master data
+  SlaveSymbolString slave;  //!< the slave data
+};
+
+/**
+ * The daemon side of the shared values segment.
+ */
+class SharedValuesWriter {
+ public:
+  /**
+   * Constructor.
+   * @param name the name of the shared memory object (e.g. "/ebusd").
+   * @param slotCount the number of slots.
+   * @param group the name of the group allowed to read the shared memory object, or empty for the owner only.
+   */
+  SharedValuesWriter(const string& name, uint32_t slotCount, const string& group = "")
+    : m_name(name), m_slotCount(slotCount), m_group(group), m_size(0), m_header(nullptr), m_slots(nullptr) {}
+
+  /**
+   * Destructor removing the shared memory object.
+   */
+  ~SharedValuesWriter();
+
+  /**
+   * Create the shared memory object.
+   * @return the result code.
+   */
+  result_t open();
+
+  /**
+   * Copy the last data of an updated @a Message to its slot.
+   * @param message the updated @a Message.
+   */
+  void update(const Message* message);
+
+
+ private:
+  /** the name of the shared memory object. */
+  const string m_name;
+
+  /** the number of slots. */
+  const uint32_t m_slotCount;
+
+  /** the name of the group allowed to read the shared memory object, or empty for the owner only. */
+  const string m_group;
+
+  /** the size of the mapped segment. */
+  size_t m_size;
+
+  /** the mapped @a SharedValuesHeader, or nullptr. */
+  SharedValuesHeader* m_header;
+
+  /** the mapped slots, or nullptr. */
+  SharedValueSlot* m_slots;
+
+  /** the mutex for assigning and writing the slots. */
+  Mutex m_lock;
+
+  /** the assigned slot index by message type, circuit, and name. */
+  map<string, uint32_t> m_slotIndex;
+};
+
+/**
+ * The consumer side of the shared values segment.
+ */
+class SharedValuesReader {
+ public:
+  /**
+   * Constructor.
+   */
+  SharedValuesReader() : m_size(0), m_header(nullptr), m_slots(nullptr) {}
+
+  /**
+   * Destructor.
+   */
+  ~SharedValuesReader() { close(); }
+
+  /**
+   * Map the shared memory object read-only.
+   * @param name the name of the shared memory object (e.g. "/ebusd").
+   * @return the result code.
+   */
+  result_t open(const string& name);
+
+  /**
+   * Unmap the shared memory object.
+   */
+  void close();
+
+  /**
+   * Get the number of assigned slots.
+   * @return the number of assigned slots.
+   */
+  uint32_t getUsedSlots() const;
+
+  /**
+   * Find the slot of a message.
+   * @param type the message type: 'r' for read, 'w' for write, 'u' for passive.
+   * @param circuit the circuit name.
+   * @param name the message name.
+   * @param slot the variable in which to store the slot index.
+   * @return true when the slot was found.
+   */
+  bool find(char type, const string& circuit, const string& name, uint32_t* slot) const;
+
+  /**
+   * Take a consistent copy of a slot.
+   * @param slot the slot index.
+   * @param value the @a SharedValue to fill.
+   * @return true on success, false if the slot is not assigned.
+   */
+  bool read(uint32_t slot, SharedValue* value) const;
+
+  /**
+   * Restore the data of all slots into the matching messages for decoding (see Message#decodeLastData()).
+   * @param messages the @a MessageMap read from the same configuration as the daemon.
+   * @return the number of restored messages.
+   */
+  size_t restore(MessageMap* messages) const;
+
+
+ private:
+  /** the size of the mapped segment. */
+  size_t m_size;
+
+  /** the mapped @a SharedValuesHeader, or nullptr. */
+  const SharedValuesHeader* m_header;
+
+  /** the mapped slots, or nullptr. */
+  const SharedValueSlot* m_slots;
+};
+
+}  // namespace ebusd
+
+#endif  // LIB_EBUS_SHAREDVALUES_H_
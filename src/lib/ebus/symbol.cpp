@@ -21,16 +21,16 @@
 #include <iomanip>
 #include <string>
 #include <vector>
+#include <algorithm>
+#if defined(__SSE2__)
+#  include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#  include <arm_neon.h>
+#endif
 #include "lib/ebus/result.h"
 
 namespace ebusd {
 
-using std::ostringstream;
-using std::nouppercase;
-using std::setw;
-using std::hex;
-using std::setfill;
-
 /**
  * CRC8 lookup table for the polynom 0x9b = x^8 + x^7 + x^4 + x^3 + x^1 + 1.
  */
@@ -99,79 +99,350 @@ int parseSignedInt(const char* str, int base, int minValue, int maxValue,
 }
 
 
+/**
+ * The lookup tables for adding 2, 3, and 4 symbols at once, i.e. the CRC lookup table applied 2, 3, and 4 times.
+ * As the CRC is linear, adding the symbols a, b, c, d to the CRC x is equal to
+ * T4[x] ^ T3[a] ^ T2[b] ^ T[c] ^ d.
+ */
+class CrcSliceTables {
+ public:
+  /**
+   * Constructor.
+   */
+  CrcSliceTables() {
+    for (unsigned int value = 0; value < 256; value++) {
+      symbol_t crc = CRC_LOOKUP_TABLE[value];
+      for (unsigned int slice = 0; slice < 3; slice++) {
+        crc = CRC_LOOKUP_TABLE[crc];
+        m_tables[slice][value] = crc;
+      }
+    }
+  }
+
+  /** the lookup tables for 2, 3, and 4 times. */
+  symbol_t m_tables[3][256];
+};
+
+/**
+ * Get the @a CrcSliceTables.
+ * @return the @a CrcSliceTables.
+ */
+static const CrcSliceTables& getCrcSliceTables() {
+  static const CrcSliceTables tables;
+  return tables;
+}
+
 void SymbolString::updateCrc(symbol_t value, symbol_t* crc) {
   *crc = CRC_LOOKUP_TABLE[*crc]^value;
 }
 
-result_t SymbolString::parseHex(const string& str) {
-  result_t result;
-  for (size_t i = 0; i < str.size(); i += 2) {
-    symbol_t value = (symbol_t)parseInt(str.substr(i, 2).c_str(), 16, 0, 0xff, &result);
-    if (result != RESULT_OK) {
-      return result;
+void SymbolString::updateCrc(const symbol_t* values, size_t count, symbol_t* crc) {
+  const CrcSliceTables& slices = getCrcSliceTables();
+  symbol_t current = *crc;
+  size_t pos = 0;
+  while (pos < count) {
+    if (pos+4 <= count) {
+      symbol_t a = values[pos], b = values[pos+1], c = values[pos+2], d = values[pos+3];
+      if (a != ESC && a != SYN && b != ESC && b != SYN && c != ESC && c != SYN && d != ESC && d != SYN) {
+        current = (symbol_t)(slices.m_tables[2][current] ^ slices.m_tables[1][a] ^ slices.m_tables[0][b]
+            ^ CRC_LOOKUP_TABLE[c] ^ d);
+        pos += 4;
+        continue;
+      }
+    }
+    symbol_t value = values[pos++];
+    if (value == ESC) {
+      updateCrc(ESC, &current);
+      updateCrc(0x00, &current);
+    } else if (value == SYN) {
+      updateCrc(ESC, &current);
+      updateCrc(0x01, &current);
+    } else {
+      updateCrc(value, &current);
     }
-    m_data.push_back(value);
   }
+  *crc = current;
+}
+
+void SymbolString::reserve(size_t capacity) {
+  if (capacity <= m_capacity) {
+    return;
+  }
+  size_t newCapacity = m_capacity*2;
+  if (newCapacity < capacity) {
+    newCapacity = capacity;
+  }
+  symbol_t* data = new symbol_t[newCapacity];
+  memcpy(data, m_data, m_size);
+  if (m_data != m_inline) {
+    delete[] m_data;
+  }
+  m_data = data;
+  m_capacity = newCapacity;
+}
+
+/**
+ * The lookup tables for converting between symbols and hex characters.
+ */
+class HexTables {
+ public:
+  /**
+   * Constructor.
+   */
+  HexTables() {
+    static const char digits[] = "0123456789abcdef";
+    for (unsigned int value = 0; value < 256; value++) {
+      m_pairs[value][0] = digits[value >> 4];
+      m_pairs[value][1] = digits[value & 0x0f];
+      m_nibbles[value] = HEX_INVALID;
+    }
+    for (unsigned int value = 0; value < 16; value++) {
+      m_nibbles[static_cast<unsigned char>(digits[value])] = (symbol_t)value;
+      if (value >= 10) {
+        m_nibbles[static_cast<unsigned char>(digits[value] - 'a' + 'A')] = (symbol_t)value;
+      }
+    }
+  }
+
+  /** the marker for an invalid character in @a m_nibbles. */
+  static const symbol_t HEX_INVALID = 0xff;
+
+  /** the lower case hex character pair for each symbol. */
+  char m_pairs[256][2];
+
+  /** the nibble value for each hex character, or @a HEX_INVALID. */
+  symbol_t m_nibbles[256];
+};
+
+/**
+ * Get the @a HexTables.
+ * @return the @a HexTables.
+ */
+static const HexTables& getHexTables() {
+  static const HexTables tables;
+  return tables;
+}
+
+#if defined(__SSE2__)
+/**
+ * Convert 16 nibble values to lower case hex characters.
+ * @param nibbles the nibble values (0 to 15).
+ * @return the hex characters.
+ */
+static inline __m128i nibblesToHex(__m128i nibbles) {
+  __m128i letters = _mm_and_si128(_mm_cmpgt_epi8(nibbles, _mm_set1_epi8(9)), _mm_set1_epi8('a' - '0' - 10));
+  return _mm_add_epi8(_mm_add_epi8(nibbles, _mm_set1_epi8('0')), letters);
+}
+
+/**
+ * Convert 16 hex characters to nibble values.
+ * @param chars the hex characters.
+ * @param valid set to 0xff for each valid hex character, 0 otherwise.
+ * @return the nibble values (undefined for invalid characters).
+ */
+static inline __m128i hexToNibbles(__m128i chars, __m128i* valid) {
+  __m128i digits = _mm_sub_epi8(chars, _mm_set1_epi8('0'));
+  __m128i isDigit = _mm_cmpeq_epi8(_mm_min_epu8(digits, _mm_set1_epi8(9)), digits);
+  __m128i letters = _mm_sub_epi8(_mm_or_si128(chars, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+  __m128i isLetter = _mm_cmpeq_epi8(_mm_min_epu8(letters, _mm_set1_epi8(5)), letters);
+  *valid = _mm_or_si128(isDigit, isLetter);
+  return _mm_or_si128(_mm_and_si128(isDigit, digits),
+      _mm_and_si128(isLetter, _mm_add_epi8(letters, _mm_set1_epi8(10))));
+}
+
+/**
+ * Convert 16 symbols to 32 hex characters.
+ * @param values the 16 symbols.
+ * @param out the 32 characters to write.
+ */
+static inline void encodeHexBlock(const symbol_t* values, char* out) {
+  __m128i mask = _mm_set1_epi8(0x0f);
+  __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(values));
+  __m128i high = _mm_and_si128(_mm_srli_epi16(in, 4), mask);
+  __m128i low = _mm_and_si128(in, mask);
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(out), nibblesToHex(_mm_unpacklo_epi8(high, low)));
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(out+16), nibblesToHex(_mm_unpackhi_epi8(high, low)));
+}
+
+/**
+ * Convert 32 hex characters to 16 symbols.
+ * @param str the 32 characters.
+ * @param values the 16 symbols to write.
+ * @return false if any of the characters is not a valid hex character (nothing is written then).
+ */
+static inline bool decodeHexBlock(const char* str, symbol_t* values) {
+  __m128i valid0, valid1;
+  __m128i first = hexToNibbles(_mm_loadu_si128(reinterpret_cast<const __m128i*>(str)), &valid0);
+  __m128i second = hexToNibbles(_mm_loadu_si128(reinterpret_cast<const __m128i*>(str+16)), &valid1);
+  if (_mm_movemask_epi8(_mm_and_si128(valid0, valid1)) != 0xffff) {
+    return false;
+  }
+  // each 16 bit lane holds the high nibble in the lower and the low nibble in the upper byte
+  __m128i mask = _mm_set1_epi16(0x00ff);
+  first = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(first, mask), 4), _mm_srli_epi16(first, 8));
+  second = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(second, mask), 4), _mm_srli_epi16(second, 8));
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(values), _mm_packus_epi16(first, second));
+  return true;
+}
+#define HAVE_HEX_BLOCK
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+/**
+ * Convert 16 nibble values to lower case hex characters.
+ * @param nibbles the nibble values (0 to 15).
+ * @return the hex characters.
+ */
+static inline uint8x16_t nibblesToHex(uint8x16_t nibbles) {
+  uint8x16_t letters = vandq_u8(vcgtq_u8(nibbles, vdupq_n_u8(9)), vdupq_n_u8('a' - '0' - 10));
+  return vaddq_u8(vaddq_u8(nibbles, vdupq_n_u8('0')), letters);
+}
+
+/**
+ * Convert 16 hex characters to nibble values.
+ * @param chars the hex characters.
+ * @param valid set to 0xff for each valid hex character, 0 otherwise.
+ * @return the nibble values (undefined for invalid characters).
+ */
+static inline uint8x16_t hexToNibbles(uint8x16_t chars, uint8x16_t* valid) {
+  uint8x16_t digits = vsubq_u8(chars, vdupq_n_u8('0'));
+  uint8x16_t isDigit = vcleq_u8(digits, vdupq_n_u8(9));
+  uint8x16_t letters = vsubq_u8(vorrq_u8(chars, vdupq_n_u8(0x20)), vdupq_n_u8('a'));
+  uint8x16_t isLetter = vcleq_u8(letters, vdupq_n_u8(5));
+  *valid = vorrq_u8(isDigit, isLetter);
+  return vbslq_u8(isDigit, digits, vaddq_u8(letters, vdupq_n_u8(10)));
+}
+
+/**
+ * Convert 16 symbols to 32 hex characters.
+ * @param values the 16 symbols.
+ * @param out the 32 characters to write.
+ */
+static inline void encodeHexBlock(const symbol_t* values, char* out) {
+  uint8x16_t in = vld1q_u8(values);
+  uint8x16x2_t chars;
+  chars.val[0] = nibblesToHex(vshrq_n_u8(in, 4));
+  chars.val[1] = nibblesToHex(vandq_u8(in, vdupq_n_u8(0x0f)));
+  vst2q_u8(reinterpret_cast<uint8_t*>(out), chars);
+}
+
+/**
+ * Convert 32 hex characters to 16 symbols.
+ * @param str the 32 characters.
+ * @param values the 16 symbols to write.
+ * @return false if any of the characters is not a valid hex character (nothing is written then).
+ */
+static inline bool decodeHexBlock(const char* str, symbol_t* values) {
+  uint8x16x2_t chars = vld2q_u8(reinterpret_cast<const uint8_t*>(str));
+  uint8x16_t validHigh, validLow;
+  uint8x16_t high = hexToNibbles(chars.val[0], &validHigh);
+  uint8x16_t low = hexToNibbles(chars.val[1], &validLow);
+  uint8x16_t valid = vandq_u8(validHigh, validLow);
+  uint8x8_t folded = vand_u8(vget_low_u8(valid), vget_high_u8(valid));
+  if (vget_lane_u64(vreinterpret_u64_u8(folded), 0) != UINT64_MAX) {
+    return false;
+  }
+  vst1q_u8(values, vorrq_u8(vshlq_n_u8(high, 4), low));
+  return true;
+}
+#define HAVE_HEX_BLOCK
+#endif
+
+void SymbolString::encodeHex(const symbol_t* values, size_t count, string* output) {
+  size_t start = output->size();
+  output->resize(start + count*2);
+  char* out = &(*output)[start];
+  size_t pos = 0;
+#ifdef HAVE_HEX_BLOCK
+  for (; pos+16 <= count; pos += 16, out += 32) {
+    encodeHexBlock(values+pos, out);
+  }
+#endif
+  const HexTables& tables = getHexTables();
+  for (; pos < count; pos++, out += 2) {
+    const char* pair = tables.m_pairs[values[pos]];
+    out[0] = pair[0];
+    out[1] = pair[1];
+  }
+}
+
+result_t SymbolString::decodeHex(const char* str, size_t length, symbol_t* values, size_t* count) {
+  size_t pos = 0, cnt = 0;
+#ifdef HAVE_HEX_BLOCK
+  for (; pos+32 <= length; pos += 32, cnt += 16) {
+    if (!decodeHexBlock(str+pos, values+cnt)) {
+      break;  // let the scalar loop convert up to the invalid character
+    }
+  }
+#endif
+  const HexTables& tables = getHexTables();
+  for (; pos < length; pos += 2) {
+    symbol_t high = tables.m_nibbles[static_cast<unsigned char>(str[pos])];
+    symbol_t low = pos+1 < length ? tables.m_nibbles[static_cast<unsigned char>(str[pos+1])] : (symbol_t)0;
+    if (high == HexTables::HEX_INVALID || low == HexTables::HEX_INVALID) {
+      *count = cnt;
+      return RESULT_ERR_INVALID_NUM;
+    }
+    // a single trailing character is taken as the low nibble
+    values[cnt++] = pos+1 < length ? (symbol_t)((high << 4) | low) : high;
+  }
+  *count = cnt;
   return RESULT_OK;
 }
 
+result_t SymbolString::parseHex(const string& str) {
+  reserve(m_size + (str.size()+1)/2);
+  size_t count = 0;
+  result_t result = decodeHex(str.data(), str.size(), m_data+m_size, &count);
+  m_size += count;
+  return result;
+}
+
 result_t SymbolString::parseHexEscaped(const string& str) {
-  result_t result;
+  symbol_t buffer[64];
   bool inEscape = false;
-  for (size_t i = 0; i < str.size(); i += 2) {
-    symbol_t value = (symbol_t)parseInt(str.substr(i, 2).c_str(), 16, 0, 0xff, &result);
-    if (result != RESULT_OK) {
-      return result;
-    }
-    if (inEscape) {
-      if (value == 0x00) {
-        m_data.push_back(ESC);
-        inEscape = false;
-      } else if (value == 0x01) {
-        m_data.push_back(SYN);
-        inEscape = false;
-      } else {
+  for (size_t offset = 0; offset < str.size(); offset += sizeof(buffer)*2) {
+    size_t count = 0;
+    result_t result = decodeHex(str.data()+offset, std::min(str.size()-offset, sizeof(buffer)*2), buffer, &count);
+    for (size_t i = 0; i < count; i++) {
+      symbol_t value = buffer[i];
+      if (inEscape) {
+        if (value == 0x00) {
+          push_back(ESC);
+          inEscape = false;
+        } else if (value == 0x01) {
+          push_back(SYN);
+          inEscape = false;
+        } else {
+          return RESULT_ERR_ESC;  // invalid escape sequence
+        }
+      } else if (value == ESC) {
+        inEscape = true;
+      } else if (value == SYN) {
         return RESULT_ERR_ESC;  // invalid escape sequence
+      } else {
+        push_back(value);
       }
-    } else if (value == ESC) {
-      inEscape = true;
-    } else if (value == SYN) {
-      return RESULT_ERR_ESC;  // invalid escape sequence
-    } else {
-      m_data.push_back(value);
+    }
+    if (result != RESULT_OK) {
+      return result;
     }
   }
   return inEscape ? RESULT_ERR_ESC : RESULT_OK;
 }
 
 const string SymbolString::getStr(size_t skipFirstSymbols) const {
-  ostringstream sstr;
-  for (size_t i = 0; i < m_data.size(); i++) {
-    if (skipFirstSymbols > 0) {
-      skipFirstSymbols--;
-    } else {
-      sstr << nouppercase << setw(2) << hex
-          << setfill('0') << static_cast<unsigned>(m_data[i]);
-    }
+  string str;
+  if (skipFirstSymbols < m_size) {
+    encodeHex(m_data+skipFirstSymbols, m_size-skipFirstSymbols, &str);
   }
-  return sstr.str();
+  return str;
 }
 
 symbol_t SymbolString::calcCrc() const {
-  symbol_t crc = 0;
-  for (size_t i = 0; i < m_data.size(); i++) {
-    symbol_t value = m_data[i];
-    if (value == ESC) {
-      updateCrc(ESC, &crc);
-      updateCrc(0x00, &crc);
-    } else if (value == SYN) {
-      updateCrc(ESC, &crc);
-      updateCrc(0x01, &crc);
-    } else {
-      updateCrc(value, &crc);
-    }
+  if (m_crcLen < m_size) {
+    updateCrc(m_data+m_crcLen, m_size-m_crcLen, &m_crc);
+    m_crcLen = m_size;
   }
-  return crc;
+  return m_crc;
 }
 
 
@@ -243,4 +514,78 @@ bool isValidAddress(symbol_t addr, bool allowBroadcast) {
   return addr != SYN && addr != ESC && (allowBroadcast || addr != BROADCAST);
 }
 
+/**
+ * Read the next part of a telegram from the unescaped symbols, i.e. the optional header, the length byte NN, the
+ * data bytes, the CRC, and the following acknowledge including the single repetition after a #NAK.
+ * @param symbols the unescaped symbols.
+ * @param pos the position to start reading at, updated to the position after the acknowledge.
+ * @param headerLen the number of symbols before the length byte NN.
+ * @param acknowledged whether the part is followed by an acknowledge.
+ * @param part the @a SymbolString to fill with the read part (without CRC).
+ * @return @a RESULT_OK on success, or an error code.
+ */
+static result_t readTelegramPart(const vector<symbol_t>& symbols, size_t* pos, size_t headerLen, bool acknowledged,
+    SymbolString* part) {
+  for (int repeat = 0; ; repeat++) {
+    part->clear();
+    size_t end = *pos+headerLen+1;
+    if (end > symbols.size()) {
+      return RESULT_ERR_EOF;
+    }
+    end += symbols[end-1];
+    if (end+1 > symbols.size()) {
+      return RESULT_ERR_EOF;
+    }
+    part->append(symbols.data()+*pos, end-*pos);
+    *pos = end;
+    result_t result = symbols[(*pos)++] == part->calcCrc() ? RESULT_OK : RESULT_ERR_CRC;
+    if (!acknowledged || *pos >= symbols.size()) {
+      return result;  // acknowledge might also be cut off at the end of the data
+    }
+    symbol_t ack = symbols[(*pos)++];
+    if (ack == ACK) {
+      return result;
+    }
+    if (ack != NAK) {
+      return RESULT_ERR_ACK;
+    }
+    if (repeat > 0) {
+      return RESULT_ERR_NAK;
+    }
+  }
+}
+
+result_t splitTelegram(const symbol_t* data, size_t len, MasterSymbolString* master, SlaveSymbolString* slave) {
+  master->clear();
+  slave->clear();
+  vector<symbol_t> symbols;
+  size_t pos = 0;
+  while (pos < len && data[pos] == SYN) {
+    pos++;
+  }
+  for (; pos < len && data[pos] != SYN; pos++) {
+    symbol_t symbol = data[pos];
+    if (symbol == ESC) {
+      if (++pos >= len || data[pos] > 0x01) {
+        return RESULT_ERR_ESC;  // invalid escape sequence
+      }
+      symbol = data[pos] == 0x00 ? ESC : SYN;
+    }
+    symbols.push_back(symbol);
+  }
+  if (symbols.empty()) {
+    return RESULT_EMPTY;
+  }
+  pos = 0;
+  bool broadcast = symbols.size() > 1 && symbols[1] == BROADCAST;
+  result_t result = readTelegramPart(symbols, &pos, 4, !broadcast, master);
+  if (result != RESULT_OK || broadcast || isMaster(symbols[1])) {
+    return result;
+  }
+  if (pos >= symbols.size()) {
+    return RESULT_ERR_EOF;
+  }
+  return readTelegramPart(symbols, &pos, 0, true, slave);
+}
+
 }  // namespace ebusd
@@ -112,6 +112,12 @@ unsigned int parseInt(const char* str, int base, unsigned int minValue, unsigned
 int parseSignedInt(const char* str, int base, int minValue, int maxValue,
     result_t* result, size_t* length = nullptr);
 
+/**
+ * The number of symbols a @a SymbolString holds without allocating heap memory (covering the longest telegram part
+ * allowed by the specification with 16 data bytes as well as the usual excess lengths).
+ */
+#define SYMBOL_STRING_INLINE_SIZE 32
+
 /**
  * A string of unescaped bus symbols.
  */
@@ -121,9 +127,37 @@ class SymbolString {
    * Creates a new empty instance.
    * @param isMaster whether this instance if for the master part.
    */
-  explicit SymbolString(bool isMaster = false) { m_isMaster = isMaster; }
+  explicit SymbolString(bool isMaster = false)
+    : m_data(m_inline), m_size(0), m_capacity(SYMBOL_STRING_INLINE_SIZE), m_crc(0), m_crcLen(0),
+      m_isMaster(isMaster) {}
 
  public:
+  /**
+   * Destructor.
+   */
+  ~SymbolString() {
+    if (m_data != m_inline) {
+      delete[] m_data;
+    }
+  }
+
+  /**
+   * Copy the symbols and the master flag from the other instance.
+   * @param other the @a SymbolString to copy from.
+   * @return this instance.
+   */
+  SymbolString& operator=(const SymbolString& other) {
+    if (this != &other) {
+      reserve(other.m_size);
+      memcpy(m_data, other.m_data, other.m_size);
+      m_size = other.m_size;
+      m_crc = other.m_crc;
+      m_crcLen = other.m_crcLen;
+      m_isMaster = other.m_isMaster;
+    }
+    return *this;
+  }
+
   /**
    * Update the CRC by adding a value.
    * @param value the escaped value to add to the current CRC.
@@ -131,6 +165,33 @@ class SymbolString {
    */
   static void updateCrc(symbol_t value, symbol_t* crc);
 
+  /**
+   * Update the CRC by adding a sequence of unescaped values (using a multi-byte kernel for sequences without symbols
+   * to escape).
+   * @param values the unescaped values to add to the current CRC.
+   * @param count the number of values.
+   * @param crc the current CRC to update.
+   */
+  static void updateCrc(const symbol_t* values, size_t count, symbol_t* crc);
+
+  /**
+   * Append the lower case hex characters of a sequence of symbols (using a vectorized kernel where available).
+   * @param values the symbols to convert.
+   * @param count the number of symbols.
+   * @param output the @a string to append the hex characters to.
+   */
+  static void encodeHex(const symbol_t* values, size_t count, string* output);
+
+  /**
+   * Convert a sequence of hex characters to symbols (using a vectorized kernel where available).
+   * @param str the hex characters (a single trailing character is taken as low nibble).
+   * @param length the number of characters.
+   * @param values the buffer for at least (@a length+1)/2 symbols.
+   * @param count set to the number of symbols converted (also up to an invalid character).
+   * @return @a RESULT_OK on success, or @a RESULT_ERR_INVALID_NUM on an invalid character.
+   */
+  static result_t decodeHex(const char* str, size_t length, symbol_t* values, size_t* count);
+
   /**
    * Return whether this instance if for the master part.
    * @return whether this instance if for the master part.
@@ -164,9 +225,10 @@ class SymbolString {
    * @return the reference to the symbol at the specified index.
    */
   symbol_t& operator[](const size_t index) {
-    if (index >= m_data.size()) {
-      m_data.resize(index+1, 0);
+    if (index >= m_size) {
+      resize(index+1);
     }
+    invalidateCrc(index);
     return m_data[index];
   }
 
@@ -176,7 +238,7 @@ class SymbolString {
    * @return the reference to the symbol at the specified index, or SYN if not available.
    */
   symbol_t operator[](size_t index) const {
-    if (index >= m_data.size()) {
+    if (index >= m_size) {
       return SYN;
     }
     return m_data[index];
@@ -188,7 +250,7 @@ class SymbolString {
    * @return true if this instance is equal to the other instance.
    */
   bool operator == (const SymbolString& other) {
-    return m_isMaster == other.m_isMaster && m_data == other.m_data;
+    return m_isMaster == other.m_isMaster && m_size == other.m_size && memcmp(m_data, other.m_data, m_size) == 0;
   }
 
   /**
@@ -197,7 +259,7 @@ class SymbolString {
    * @return true if this instance is different from the other instance.
    */
   bool operator != (const SymbolString& other) {
-    return m_isMaster != other.m_isMaster || m_data != other.m_data;
+    return !(*this == other);
   }
 
   /**
@@ -208,19 +270,19 @@ class SymbolString {
    * 2 if both instances are a master part and the data only differs in the first byte (the master address).
    */
   int compareTo(const SymbolString& other) const {
-    if (m_data.size() != other.m_data.size() || m_isMaster != other.m_isMaster) {
+    if (m_size != other.m_size || m_isMaster != other.m_isMaster) {
       return 1;
     }
-    if (m_data == other.m_data) {
+    if (memcmp(m_data, other.m_data, m_size) == 0) {
       return 0;
     }
     if (!m_isMaster) {
       return 1;
     }
-    if (m_data.size() == 1) {
+    if (m_size == 1) {
       return 2;
     }
-    if (equal(m_data.begin()+1, m_data.end(), other.m_data.begin()+1)) {
+    if (memcmp(m_data+1, other.m_data+1, m_size-1) == 0) {
       return 2;
     }
     return 1;
@@ -230,13 +292,47 @@ class SymbolString {
    * Append a symbol to the end of the symbol string.
    * @param value the symbol to append.
    */
-  void push_back(symbol_t value) { m_data.push_back(value); }
+  void push_back(symbol_t value) {
+    if (m_size >= m_capacity) {
+      reserve(m_size+1);
+    }
+    if (m_crcLen == m_size) {
+      if (value == ESC) {
+        updateCrc(ESC, &m_crc);
+        updateCrc(0x00, &m_crc);
+      } else if (value == SYN) {
+        updateCrc(ESC, &m_crc);
+        updateCrc(0x01, &m_crc);
+      } else {
+        updateCrc(value, &m_crc);
+      }
+      m_crcLen++;
+    }
+    m_data[m_size++] = value;
+  }
+
+  /**
+   * Append several symbols to the end of the symbol string.
+   * @param values the symbols to append.
+   * @param count the number of symbols to append.
+   */
+  void append(const symbol_t* values, size_t count) {
+    if (m_size+count > m_capacity) {
+      reserve(m_size+count);
+    }
+    if (m_crcLen == m_size) {
+      updateCrc(values, count, &m_crc);
+      m_crcLen += count;
+    }
+    memcpy(m_data+m_size, values, count);
+    m_size += count;
+  }
 
   /**
    * Return the number of symbols in this symbol string.
    * @return the number of available symbols.
    */
-  size_t size() const { return m_data.size(); }
+  size_t size() const { return m_size; }
 
   /**
    * Adjust the header NN field to the number of data bytes DD.
@@ -244,12 +340,13 @@ class SymbolString {
    */
   bool adjustHeader() {
     size_t lengthOffset = (m_isMaster ? 4 : 0);
-    if (m_data.size() <= lengthOffset) {
-      m_data.resize(lengthOffset+1);
-    } else if (m_data.size() >= lengthOffset+255) {
+    if (m_size <= lengthOffset) {
+      resize(lengthOffset+1);
+    } else if (m_size >= lengthOffset+255) {
       return false;
     }
-    m_data[lengthOffset] = (symbol_t)(m_data.size() - lengthOffset - 1);
+    invalidateCrc(lengthOffset);
+    m_data[lengthOffset] = (symbol_t)(m_size - lengthOffset - 1);
     return true;
   }
 
@@ -265,11 +362,11 @@ class SymbolString {
    */
   size_t getDataSize() const {
     size_t lengthOffset = (m_isMaster ? 4 : 0);
-    if (m_data.size() <= lengthOffset) {
+    if (m_size <= lengthOffset) {
       return 0;
     }
     size_t ret = m_data[lengthOffset];
-    return m_data.size() < lengthOffset + 1 + ret ? m_data.size() - lengthOffset - 1 : ret;
+    return m_size < lengthOffset + 1 + ret ? m_size - lengthOffset - 1 : ret;
   }
 
   /**
@@ -278,10 +375,10 @@ class SymbolString {
    */
   size_t getCalculatedDataSize() const {
     size_t lengthOffset = (m_isMaster ? 4 : 0);
-    if (m_data.size() <= lengthOffset) {
+    if (m_size <= lengthOffset) {
       return 0;
     }
-    return m_data.size() - lengthOffset - 1;
+    return m_size - lengthOffset - 1;
   }
 
   /**
@@ -291,7 +388,7 @@ class SymbolString {
    */
   symbol_t dataAt(size_t index) const {
     size_t offset = (m_isMaster ? 5 : 1) + index;
-    if (offset < m_data.size()) {
+    if (offset < m_size) {
       return m_data[offset];
     }
     return 0;
@@ -304,9 +401,10 @@ class SymbolString {
    */
   symbol_t& dataAt(size_t index) {
     size_t offset = (m_isMaster ? 5 : 1) + index;
-    if (offset >= m_data.size()) {
-      m_data.resize(offset+1, 0);
+    if (offset >= m_size) {
+      resize(offset+1);
     }
+    invalidateCrc(offset);
     return m_data[offset];
   }
 
@@ -316,14 +414,14 @@ class SymbolString {
    */
   bool isComplete() {
     size_t lengthOffset = (m_isMaster ? 4 : 0);
-    if (m_data.size() < lengthOffset + 1) {
+    if (m_size < lengthOffset + 1) {
       return false;
     }
-    return m_data.size() >= lengthOffset + 1 + m_data[lengthOffset];
+    return m_size >= lengthOffset + 1 + m_data[lengthOffset];
   }
 
   /**
-   * Calculate the CRC.
+   * Calculate the CRC (continuing from the CRC accumulated while appending symbols).
    * @return the calculated CRC.
    */
   symbol_t calcCrc() const;
@@ -331,7 +429,11 @@ class SymbolString {
   /**
    * Clear the symbols.
    */
-  void clear() { m_data.clear(); }
+  void clear() {
+    m_size = 0;
+    m_crc = 0;
+    m_crcLen = 0;
+  }
 
 
  private:
@@ -340,10 +442,59 @@ class SymbolString {
    * @param str the @a SymbolString to copy from.
    */
   SymbolString(const SymbolString& str)
-    : m_data(str.m_data), m_isMaster(str.m_isMaster) {}
+    : m_data(m_inline), m_size(0), m_capacity(SYMBOL_STRING_INLINE_SIZE), m_crc(0), m_crcLen(0),
+      m_isMaster(str.m_isMaster) {
+    *this = str;
+  }
+
+  /**
+   * Make sure the storage is able to hold the specified number of symbols.
+   * @param capacity the minimum number of symbols to hold.
+   */
+  void reserve(size_t capacity);
 
-  /** the string of unescaped symbols. */
-  vector<symbol_t> m_data;
+  /**
+   * Resize to the specified number of symbols, filling up new symbols with zero.
+   * @param size the new number of symbols.
+   */
+  void resize(size_t size) {
+    if (size > m_size) {
+      reserve(size);
+      memset(m_data+m_size, 0, size-m_size);
+    } else {
+      invalidateCrc(size);
+    }
+    m_size = size;
+  }
+
+  /**
+   * Drop the accumulated CRC from the specified position on as the symbol there might get modified.
+   * @param index the index of the first symbol no longer covered by the accumulated CRC.
+   */
+  void invalidateCrc(size_t index) {
+    if (index < m_crcLen) {
+      m_crc = 0;
+      m_crcLen = 0;
+    }
+  }
+
+  /** the string of unescaped symbols (either @a m_inline or allocated on the heap). */
+  symbol_t* m_data;
+
+  /** the number of symbols in @a m_data. */
+  size_t m_size;
+
+  /** the number of symbols @a m_data is able to hold. */
+  size_t m_capacity;
+
+  /** the CRC accumulated over the first @a m_crcLen symbols. */
+  mutable symbol_t m_crc;
+
+  /** the number of symbols covered by @a m_crc. */
+  mutable size_t m_crcLen;
+
+  /** the inline storage used as long as the symbols fit in. */
+  symbol_t m_inline[SYMBOL_STRING_INLINE_SIZE];
 
   /** whether this instance is for the master part. */
   bool m_isMaster;
@@ -419,6 +570,19 @@ unsigned int getMasterNumber(symbol_t addr);
  */
 bool isValidAddress(symbol_t addr, bool allowBroadcast = true);
 
+/**
+ * Split the escaped symbols of a single telegram as seen on the bus (e.g. from a dump file) into the master and slave
+ * part and verify the CRCs and acknowledges (including the single repetition after a #NAK).
+ * @param data the escaped symbols of the telegram, optionally surrounded by #SYN symbols.
+ * @param len the number of symbols in @a data.
+ * @param master the @a MasterSymbolString to fill with the master part (without CRC).
+ * @param slave the @a SlaveSymbolString to fill with the slave part (without CRC), or to clear for broadcast and
+ * master-master telegrams.
+ * @return @a RESULT_OK on success, @a RESULT_EMPTY if @a data contains no telegram at all,
+ * @a RESULT_ERR_EOF if the telegram is incomplete, or another error code.
+ */
+result_t splitTelegram(const symbol_t* data, size_t len, MasterSymbolString* master, SlaveSymbolString* slave);
+
 }  // namespace ebusd
 
 #endif  // LIB_EBUS_SYMBOL_H_
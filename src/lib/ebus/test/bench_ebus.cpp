@@ -0,0 +1,512 @@
+/*
+ * ebusd - daemon for communication with eBUS heating systems.
+ * Copyright (C) 2021 John Baier <ebusd@ebusd.eu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <time.h>
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <deque>
+#include <pthread.h>
+#include "lib/ebus/message.h"
+#include "lib/utils/queue.h"
+
+using namespace ebusd;
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::ofstream;
+using std::ostringstream;
+using std::istringstream;
+using std::setw;
+using std::setfill;
+using std::hex;
+using std::deque;
+
+/** the global templates used for loading the config files. */
+static DataFieldTemplates* s_templates = nullptr;
+
+/** the path of the config files to load. */
+static string s_configPath;
+
+namespace ebusd {
+
+DataFieldTemplates* getTemplates(const string& filename) {
+  return s_templates;
+}
+
+result_t loadDefinitionsFromConfigPath(FileReader* reader, const string& filename, bool verbose,
+    map<string, string>* defaults, string* errorDescription, bool replace = false) {
+  time_t mtime = 0;
+  istream* stream = FileReader::openFile(s_configPath + "/" + filename, errorDescription, &mtime);
+  if (!stream) {
+    return RESULT_ERR_NOTFOUND;
+  }
+  result_t result = reader->readFromStream(stream, filename, mtime, verbose, defaults, errorDescription, replace);
+  delete stream;
+  return result;
+}
+
+}  // namespace ebusd
+
+/** a single benchmark result. */
+struct BenchResult {
+  string name;  //!< the benchmark name
+  size_t iterations;  //!< the number of measured iterations
+  double nsPerOp;  //!< the average duration of a single iteration in nanoseconds
+};
+
+/** the collected benchmark results. */
+static vector<BenchResult> s_results;
+
+/** the number of failed operations within the benchmarks. */
+static size_t s_failures = 0;
+
+/**
+ * Get the current monotonic time in nanoseconds.
+ * @return the current monotonic time in nanoseconds.
+ */
+static int64_t getNanos() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<int64_t>(ts.tv_sec)*1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * Run a single benchmark after a short warm up and store the result.
+ * @param name the benchmark name.
+ * @param iterations the number of iterations to measure.
+ * @param func the function to execute per iteration with the iteration number, returning false on failure.
+ */
+template<typename F>
+static void bench(const string& name, size_t iterations, F func) {
+  for (size_t i = 0; i < iterations / 10; i++) {
+    func(i);
+  }
+  int64_t start = getNanos();
+  for (size_t i = 0; i < iterations; i++) {
+    if (!func(i)) {
+      s_failures++;
+    }
+  }
+  int64_t end = getNanos();
+  s_results.push_back({name, iterations, static_cast<double>(end - start) / static_cast<double>(iterations)});
+}
+
+/**
+ * Benchmark parsing of hex strings and CRC calculation.
+ */
+static void benchSymbol() {
+  vector<string> hexStrings;
+  for (unsigned int i = 0; i < 256; i++) {
+    ostringstream str;
+    str << hex << setfill('0') << "10" << setw(2) << ((i * 7) & 0xff) << "b509" << "08";
+    for (unsigned int j = 0; j < 8; j++) {
+      str << setw(2) << ((i + j * 31) & 0xff);
+    }
+    hexStrings.push_back(str.str());
+  }
+  bench("SymbolString::parseHex", 200000, [&hexStrings](size_t i) {
+    MasterSymbolString master;
+    return master.parseHex(hexStrings[i & 0xff]) == RESULT_OK;
+  });
+  MasterSymbolString master;
+  master.parseHex(hexStrings[0]);
+  bench("SymbolString::getStr", 200000, [&master](size_t i) {
+    return master.getStr(i & 1).size() > 0;
+  });
+  vector<symbol_t> dump;
+  for (unsigned int i = 0; i < 4096; i++) {
+    dump.push_back((symbol_t)(i * 13));
+  }
+  string dumpHex;
+  bench("SymbolString::encodeHex/4k", 2000, [&dump, &dumpHex](size_t i) {
+    dumpHex.clear();
+    SymbolString::encodeHex(dump.data(), dump.size(), &dumpHex);
+    return dumpHex.size() == dump.size()*2;
+  });
+  bench("SymbolString::decodeHex/4k", 2000, [&dump, &dumpHex](size_t i) {
+    size_t count = 0;
+    return SymbolString::decodeHex(dumpHex.data(), dumpHex.size(), dump.data(), &count) == RESULT_OK;
+  });
+  volatile symbol_t crc = 0;
+  bench("SymbolString::calcCrc", 1000000, [&master, &crc](size_t i) {
+    master[5] = (symbol_t)i;  // invalidates the cached CRC
+    crc = master.calcCrc();
+    return true;
+  });
+}
+
+/**
+ * Benchmark reading and writing of all built-in data types.
+ */
+static void benchDataTypes() {
+  SlaveSymbolString slave;
+  slave.parseHex("10" "0102030405060708090a" "1112131415161718");
+  DataTypeList* types = DataTypeList::getInstance();
+  for (auto it = types->begin(); it != types->end(); it++) {
+    const DataType* type = it->second;
+    size_t bitCount = type->getBitCount();
+    size_t length = type->isAdjustableLength() ? 4 : bitCount >= 8 ? bitCount / 8 : 1;
+    ostringstream value;
+    if (type->readSymbols(0, length, slave, 0, &value) != RESULT_OK) {
+      cerr << "unable to read type " << type->getId() << endl;
+      s_failures++;
+      continue;
+    }
+    bench("DataType::readSymbols/" + type->getId(), 100000, [type, length, &slave](size_t i) {
+      ostringstream output;
+      return type->readSymbols(i & 3, length, slave, 0, &output) == RESULT_OK;
+    });
+    const string valueStr = value.str();
+    bench("DataType::writeSymbols/" + type->getId(), 100000, [type, length, &valueStr](size_t i) {
+      SlaveSymbolString output;
+      istringstream input(valueStr);
+      return type->writeSymbols(0, length, &input, &output, nullptr) == RESULT_OK;
+    });
+  }
+}
+
+/**
+ * Benchmark reading of a typical @a DataFieldSet.
+ */
+static void benchDataFieldSet() {
+  const char* definitions[][3] = {
+    {"temp", "D2C", ""},
+    {"state", "UCH", "0=off;1=on;2=auto"},
+    {"pressure", "UIN", "1000"},
+    {"", "IGN:1", ""},
+    {"date", "BDA", ""},
+    {"name", "STR:4", ""},
+  };
+  vector<MappedRow> rows;
+  for (const auto& definition : definitions) {
+    MappedRow row;
+    row["name"] = definition[0];
+    row["part"] = "s";
+    row["type"] = definition[1];
+    row["divisor/values"] = definition[2];
+    rows.push_back(row);
+  }
+  DataFieldTemplates templates;
+  const DataField* fields = nullptr;
+  string errorDescription;
+  if (DataField::create(false, false, false, MAX_POS, &templates, &rows, &errorDescription, &fields) != RESULT_OK) {
+    cerr << "unable to create fields: " << errorDescription << endl;
+    s_failures++;
+    return;
+  }
+  SlaveSymbolString slave;
+  slave.parseHex("0f" "3412" "01" "a00f" "00" "01010120" "41424344");
+  bench("DataFieldSet::read", 200000, [fields, &slave](size_t i) {
+    ostringstream output;
+    return fields->read(slave, 0, false, nullptr, -1, 0, -1, &output) == RESULT_OK;
+  });
+  bench("DataFieldSet::read/json", 200000, [fields, &slave](size_t i) {
+    ostringstream output;
+    return fields->read(slave, 0, false, nullptr, -1, OF_NAMES|OF_JSON, -1, &output) == RESULT_OK;
+  });
+  delete fields;
+}
+
+/**
+ * Write a synthetic config directory with templates and several message files.
+ * @param path the directory to write to.
+ * @param fileCount the number of message files to write.
+ * @param messageCount the number of messages per file.
+ * @return whether all files were written.
+ */
+static bool writeConfig(const string& path, unsigned int fileCount, unsigned int messageCount) {
+  ofstream templates((path + "/_templates.csv").c_str());
+  templates << "#\n"
+               "temp,D2C,,°C,temperature\n"
+               "press,UIN,1000,bar,pressure\n"
+               "onoff,UCH,0=off;1=on,,state\n"
+               "tempstate,temp;onoff,,,temperature with state\n";
+  if (!templates.good()) {
+    return false;
+  }
+  for (unsigned int file = 0; file < fileCount; file++) {
+    ostringstream name;
+    name << path << "/circuit" << file << ".csv";
+    ofstream stream(name.str().c_str());
+    stream << "# type,circuit,name,comment,QQ,ZZ,PBSB,ID,field,part,type,divider/values,unit,comment\n";
+    for (unsigned int message = 0; message < messageCount; message++) {
+      stream << "r,c" << file << ",m" << message << ",message " << message << ",,"
+             << hex << setfill('0') << setw(2) << (0x08 + (file % 4) * 0x10) << ",b5" << setw(2) << (0x10 + file)
+             << "," << setw(2) << (message & 0xff) << setw(2) << (message >> 8) << std::dec;
+      switch (message % 4) {
+      case 0:
+        stream << ",,s,temp,,,";
+        break;
+      case 1:
+        stream << ",,s,tempstate,,,";
+        break;
+      case 2:
+        stream << ",value,s,press,,,,state,s,onoff,,,";
+        break;
+      default:
+        stream << ",,s,IGN:1,,,,value,s,SIN,10,,";
+        break;
+      }
+      stream << "\n";
+    }
+    if (!stream.good()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Load all config files from @a s_configPath and its sub directories.
+ * @param relPath the relative path from which to read the files (without trailing "/").
+ * @param messages the @a MessageMap to load the messages into.
+ * @return the number of files that failed to load.
+ */
+static size_t loadConfig(const string& relPath, MessageMap* messages) {
+  string path = s_configPath + (relPath.empty() ? "" : "/" + relPath);
+  DIR* dir = opendir(path.c_str());
+  if (dir == nullptr) {
+    return 1;
+  }
+  vector<string> files, dirs;
+  struct dirent* entry;
+  while ((entry = readdir(dir))) {
+    string name = entry->d_name;
+    struct stat st;
+    if (name[0] == '.' || stat((path + "/" + name).c_str(), &st) != 0) {
+      continue;
+    }
+    string relName = relPath.empty() ? name : relPath + "/" + name;
+    if (S_ISDIR(st.st_mode)) {
+      dirs.push_back(relName);
+    } else if (name.length() > 4 && name.substr(name.length() - 4) == ".csv") {
+      if (name == "_templates.csv") {
+        files.insert(files.begin(), relName);
+      } else {
+        files.push_back(relName);
+      }
+    }
+  }
+  closedir(dir);
+  size_t failed = 0;
+  string errorDescription;
+  for (const auto& name : files) {
+    FileReader* reader = messages;
+    if (name.length() >= 14 && name.substr(name.length() - 14) == "_templates.csv") {
+      reader = s_templates;
+    }
+    if (loadDefinitionsFromConfigPath(reader, name, false, nullptr, &errorDescription, reader == s_templates)
+        != RESULT_OK) {
+      failed++;
+    }
+  }
+  for (const auto& name : dirs) {
+    failed += loadConfig(name, messages);
+  }
+  return failed;
+}
+
+/**
+ * Benchmark loading of the config directory and lookups in the loaded @a MessageMap.
+ */
+static void benchMessageMap() {
+  string tempPath;
+  if (s_configPath.empty()) {
+    char dirName[] = "/tmp/bench_ebusXXXXXX";
+    if (!mkdtemp(dirName)) {
+      cerr << "unable to create temporary directory" << endl;
+      s_failures++;
+      return;
+    }
+    tempPath = s_configPath = dirName;
+    if (!writeConfig(s_configPath, 10, 200)) {
+      cerr << "unable to write config files" << endl;
+      s_failures++;
+    }
+  }
+  bench("MessageMap::load", 10, [](size_t i) {
+    s_templates = new DataFieldTemplates();
+    MessageMap* messages = new MessageMap(false, "", false);  // keep the shared scan fields for the next instance
+    size_t failed = loadConfig("", messages);
+    bool loaded = messages->size() > 0;
+    delete messages;
+    delete s_templates;
+    s_templates = nullptr;
+    return failed == 0 && loaded;
+  });
+  s_templates = new DataFieldTemplates();
+  MessageMap* messages = new MessageMap(false, "", false);  // keep the shared scan fields for the next instance
+  if (loadConfig("", messages) != 0) {
+    cerr << "unable to load config files from " << s_configPath << endl;
+    s_failures++;
+  }
+  // collect the master data and names of all loaded messages
+  vector<MasterSymbolString*> masters;
+  deque<Message*> all;
+  messages->findAll("", "", "*", false, true, false, false, true, false, 0, 0, false, &all);
+  vector<Message*> loaded;
+  for (const auto message : all) {
+    MasterSymbolString* master = new MasterSymbolString();
+    istringstream input;
+    if (message->getCount() == 1 && message->prepareMaster(0, 0x10,
+        message->getDstAddress() == SYN ? 0x08 : SYN, UI_FIELD_SEPARATOR, &input, master) == RESULT_OK) {
+      loaded.push_back(message);
+      masters.push_back(master);
+    } else {
+      delete master;
+    }
+  }
+  if (masters.empty()) {
+    cerr << "no messages loaded" << endl;
+    s_failures++;
+  } else {
+    bench("MessageMap::find/key", 500000, [messages, &masters](size_t i) {
+      return messages->find(*masters[i % masters.size()]) != nullptr;
+    });
+    bench("MessageMap::find/name", 500000, [messages, &loaded](size_t i) {
+      const Message* message = loaded[i % loaded.size()];
+      return messages->find(message->getCircuit(), message->getName(), "", false) != nullptr;
+    });
+    SlaveSymbolString slave;
+    slave.parseHex("0534120180");
+    Message* message = loaded[0];
+    message->storeLastData(*masters[0], slave);
+    OutputBuffer output;
+    bench("Message::decodeJson", 200000, [message, &output](size_t i) {
+      output.clear();
+      message->decodeJson(false, false, false, OF_JSON, &output);
+      return !output.empty();
+    });
+  }
+  for (const auto master : masters) {
+    delete master;
+  }
+  delete messages;
+  delete s_templates;
+  s_templates = nullptr;
+  if (!tempPath.empty()) {
+    DIR* dir = opendir(tempPath.c_str());
+    struct dirent* entry;
+    while (dir && (entry = readdir(dir))) {
+      if (entry->d_name[0] != '.') {
+        unlink((tempPath + "/" + entry->d_name).c_str());
+      }
+    }
+    if (dir) {
+      closedir(dir);
+    }
+    rmdir(tempPath.c_str());
+  }
+}
+
+/**
+ * The two queues for passing an item back and forth between two threads.
+ * @param Q the queue type.
+ */
+template<typename Q>
+struct PingPong {
+  Q requests;  //!< the queue for passing the item to the echo thread
+  Q replies;  //!< the queue for passing the item back
+};
+
+/** the item terminating the echo thread. */
+static int s_stopItem = 0;
+
+/**
+ * Echo each item from the requests back to the replies until the stop item is received.
+ * @param arg pointer to the @a PingPong instance.
+ * @return nullptr.
+ */
+template<typename Q>
+static void* echoThread(void* arg) {
+  PingPong<Q>* pingPong = static_cast<PingPong<Q>*>(arg);
+  while (true) {
+    int* item = pingPong->requests.pop(1);
+    if (item == &s_stopItem) {
+      break;
+    }
+    if (item) {
+      pingPong->replies.push(item);
+    }
+  }
+  return nullptr;
+}
+
+/**
+ * Benchmark the round trip of an item through two queues with a waiting consumer thread on each side.
+ * @param name the benchmark name.
+ * @param iterations the number of iterations to measure.
+ */
+template<typename Q>
+static void benchHandoff(const string& name, size_t iterations) {
+  PingPong<Q> pingPong;
+  pthread_t thread;
+  if (pthread_create(&thread, nullptr, echoThread<Q>, &pingPong) != 0) {
+    s_failures++;
+    return;
+  }
+  int item = 0;
+  bench(name, iterations, [&pingPong, &item](size_t i) {
+    pingPong.requests.push(&item);
+    return pingPong.replies.pop(1) == &item;
+  });
+  pingPong.requests.push(&s_stopItem);
+  pthread_join(thread, nullptr);
+}
+
+/**
+ * Benchmark the cross-thread handoff latency of the queue implementations.
+ */
+static void benchQueue() {
+  benchHandoff<Queue<int*>>("Queue::handoff", 20000);
+  benchHandoff<RingQueue<int*, 64>>("RingQueue::handoff", 20000);
+}
+
+/**
+ * Run all benchmarks and write the results in JSON format to stdout.
+ * Usage: bench_ebus [CONFIGPATH] with CONFIGPATH the optional local directory of the config files to load instead
+ * of a synthetic one.
+ */
+int main(int argc, char** argv) {
+  if (argc > 1) {
+    s_configPath = argv[1];
+  }
+  benchSymbol();
+  benchDataTypes();
+  benchDataFieldSet();
+  benchMessageMap();
+  benchQueue();
+  cout << "{\n \"benchmarks\": [";
+  bool first = true;
+  for (const auto& result : s_results) {
+    cout << (first ? "\n" : ",\n") << "  {\"name\": \"" << result.name << "\", \"iterations\": " << result.iterations
+         << ", \"ns_per_op\": " << std::fixed << std::setprecision(1) << result.nsPerOp << "}";
+    first = false;
+  }
+  cout << "\n ],\n \"failures\": " << s_failures << "\n}" << endl;
+  return s_failures > 0 ? 1 : 0;
+}
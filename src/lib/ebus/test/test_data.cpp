@@ -48,6 +48,29 @@ void verify(bool expectFailMatch, string type, string input,
   }
 }
 
+/**
+ * Convert the formatted input to typed values, i.e. numbers where possible.
+ * @param input the formatted input with the values separated by @a UI_FIELD_SEPARATOR.
+ * @param split whether to split the input into several values.
+ * @param values the @a FieldValues to add to.
+ */
+void parseValues(const string& input, bool split, FieldValues* values) {
+  istringstream stream(input);
+  string token;
+  while (split ? getline(stream, token, UI_FIELD_SEPARATOR) : getline(stream, token, '\0')) {
+    const char* str = token.c_str();
+    char* strEnd = nullptr;
+    double number = strtod(str, &strEnd);
+    if (token == NULL_VALUE) {
+      values->push_back(FieldValue());
+    } else if (strEnd != str && *strEnd == 0) {
+      values->push_back(FieldValue(number));
+    } else {
+      values->push_back(FieldValue(token));
+    }
+  }
+}
+
 class TestReader : public MappedFileReader {
  public:
   TestReader(DataFieldTemplates* templates, bool isSet, bool isMasterDest)
@@ -68,8 +91,8 @@ class TestReader : public MappedFileReader {
     }
     return RESULT_OK;  // leave it to DataField::create
   }
-  result_t addFromFile(const string& filename, unsigned int lineNo, map<string, string>* row,
-      vector< map<string, string> >* subRows, string* errorDescription, bool replace) override {
+  result_t addFromFile(const string& filename, unsigned int lineNo, MappedRow* row,
+      vector<MappedRow>* subRows, string* errorDescription, bool replace) override {
     if (!row->empty() || subRows->empty()) {
       cout << "read line " << static_cast<unsigned>(lineNo) << ": read error: got "
           << static_cast<unsigned>(row->size()) << "/0 main, " << static_cast<unsigned>(subRows->size())
@@ -88,6 +111,198 @@ class TestReader : public MappedFileReader {
 };
 
 
+/**
+ * Check the escaping of JSON attribute values.
+ */
+void checkJsonEscape() {
+  // entry: value, expected JSON string
+  string checks[][2] = {
+    {"plain text",          "\"plain text\""},
+    {"say \"hi\"",          "\"say 'hi'\""},
+    {"C:\\dir\\",           "\"C:\\\\dir\\\\\""},
+    {"tab\tline\nend",      "\"tab\\u0009line\\u000aend\""},
+    {string("nul\0x", 5),   "\"nul\\u0000x\""},
+    {"\x1f\x7f",            "\"\\u001f\x7f\""},
+    {"05",                  "\"05\""},
+  };
+  for (const auto& check : checks) {
+    ostringstream output;
+    AttributedItem::appendJson(false, "n", check[0], false, &output);
+    verify(false, "json escape", check[0], true, " \"n\": " + check[1], output.str());
+  }
+  ostringstream output;
+  AttributedItem::appendJson(false, "a\\b", "1", false, &output);
+  verify(false, "json escape name", "a\\b", true, " \"a\\\\b\": 1", output.str());
+}
+
+/**
+ * Format the raw value with the divisor through the float calculation of the stream based formatting.
+ * @param value the raw value.
+ * @param divisor the divisor (negative for reciprocal).
+ * @return the formatted value.
+ */
+string formatFloat(int64_t value, int divisor) {
+  ostringstream output;
+  if (divisor < 0) {
+    output << std::fixed << std::setprecision(0) << (static_cast<float>(value) * static_cast<float>(-divisor));
+  } else if (divisor <= 1) {
+    output << value;
+  } else {
+    output << std::setprecision(static_cast<int>(NumberDataType::calcPrecision(divisor))) << std::fixed
+           << (static_cast<float>(value) / static_cast<float>(divisor));
+  }
+  return output.str();
+}
+
+void checkFixedFormat() {
+  // entry: value, divisor, expected
+  string checks[][3] = {
+    {"123",      "10",   "12.3"},
+    {"-5",       "10",   "-0.5"},
+    {"0",        "100",  "0.00"},
+    {"7",        "1000", "0.007"},
+    {"-1234",    "100",  "-12.34"},
+    {"8388607",  "10",   "838860.7"},
+    {"16777217", "10",   "1677721.6"},  // beyond the float mantissa
+    {"3",        "4",    "0.8"},
+    {"1",        "3",    "0.3"},
+    {"-3",       "-10",  "-30"},
+    {"42",       "1",    "42"},
+    {"-42",      "0",    "-42"},
+  };
+  for (const auto& check : checks) {
+    OutputBuffer output;
+    int divisor = static_cast<int>(strtol(check[1].c_str(), nullptr, 10));
+    output.appendFixed(strtoll(check[0].c_str(), nullptr, 10), divisor,
+        NumberDataType::calcPrecision(divisor));
+    verify(false, "fixed format", check[0] + "/" + check[1], true, check[2], output.str());
+  }
+  int divisors[] = {2, 3, 4, 10, 16, 60, 100, 1000, 3600, 10000, -3, -100};
+  for (const auto divisor : divisors) {
+    string expect, got;
+    for (int64_t value = -8400000; value <= 8400000 && expect == got; value += 997) {
+      OutputBuffer output;
+      output.appendFixed(value, divisor, NumberDataType::calcPrecision(divisor));
+      expect = formatFloat(value, divisor);
+      got = output.str();
+    }
+    verify(false, "fixed format float", std::to_string(divisor), true, expect, got);
+  }
+}
+
+void checkBufferFormat() {
+  // all numeric types with a few divisors on varying data have to format the same as through the stream
+  DataTypeList* types = DataTypeList::getInstance();
+  int divisors[] = {0, 10, 100, 3, -10};
+  unsigned int seed = 1;
+  for (auto it = types->begin(); it != types->end(); it++) {
+    const DataType* baseType = it->second;
+    for (const auto divisor : divisors) {
+      const DataType* type = baseType;
+      if (divisor != 0) {
+        if (!baseType->isNumeric() || baseType->getBitCount() < 8) {
+          continue;
+        }
+        const NumberDataType* derived;
+        if (reinterpret_cast<const NumberDataType*>(baseType)->derive(divisor, 0, &derived) != RESULT_OK) {
+          continue;
+        }
+        type = derived;
+      }
+      size_t length = type->isAdjustableLength() ? 4 : (type->getBitCount()+7)/8;
+      string expect, got;
+      for (int round = 0; round < 200 && expect == got; round++) {
+        SlaveSymbolString slave;
+        slave.push_back(static_cast<symbol_t>(length));
+        for (size_t pos = 0; pos < length; pos++) {
+          seed = seed * 1103515245 + 12345;
+          slave.push_back(static_cast<symbol_t>(round < 5 ? (round == 0 ? 0 : 0xff) : seed >> 16));
+        }
+        OutputFormat outputFormat = (round & 1) ? OF_JSON : 0;
+        ostringstream stream;
+        result_t result = type->readSymbols(0, length, slave, outputFormat, &stream);
+        expect = getResultCode(result) + string(" ") + stream.str();
+        OutputBuffer output;
+        result = type->appendSymbols(0, length, slave, outputFormat, &output);
+        got = getResultCode(result) + string(" ") + output.str();
+      }
+      verify(false, "buffer format", type->getId() + "/" + std::to_string(divisor), true, expect, got);
+    }
+  }
+}
+
+void checkPlanFormat() {
+  // the plan of a field set has to format the same as the fields themselves
+  DataTypeList* types = DataTypeList::getInstance();
+  struct {
+    const char* type;
+    size_t length;
+    int divisor;
+    bool values;
+  } defs[] = {
+    {"UCH", 1, 10, false}, {"D2C", 2, 0, false}, {"SIN", 2, -3, false}, {"UCH", 1, 0, true}, {"STR", 3, 0, false},
+    {"HEX", 2, 0, false}, {"IGN", 1, 0, false}, {"PIN", 2, 0, false}, {"EXP", 4, 0, false}, {"ULG", 4, 1000, false},
+    {"BCD", 1, 0, false},
+  };
+  vector<const SingleDataField*> fields;
+  map<string, string> attributes;
+  attributes["unit"] = "u";
+  attributes["comment"] = "c\"q";
+  size_t length = 0;
+  for (const auto& def : defs) {
+    map<unsigned int, string> values;
+    if (def.values) {
+      values[0] = "zero";
+      values[1] = "one";
+      values[0x80] = "half";
+    }
+    SingleDataField* field = nullptr;
+    result_t result = SingleDataField::create("f" + std::to_string(fields.size()), attributes,
+        types->get(def.type, def.length), pt_slaveData, def.length, def.divisor, "", false, &values, &field);
+    if (result != RESULT_OK) {
+      cout << "  create plan field " << def.type << " error: " << getResultCode(result) << endl;
+      error = true;
+      return;
+    }
+    fields.push_back(field);
+    length += def.length;
+  }
+  DataFieldSet set("plan", fields);
+  OutputFormat formats[] = {0, OF_NAMES, OF_NAMES|OF_UNITS|OF_COMMENTS, OF_NUMERIC, OF_VALUENAME, OF_JSON,
+    OF_JSON|OF_NAMES, OF_JSON|OF_NAMES|OF_SHORT, OF_JSON|OF_NAMES|OF_UNITS|OF_COMMENTS|OF_VALUENAME};
+  unsigned int seed = 7;
+  string expect, got;
+  for (int round = 0; round < 300 && expect == got; round++) {
+    SlaveSymbolString slave;
+    slave.push_back(static_cast<symbol_t>(length));
+    for (size_t pos = 0; pos < length; pos++) {
+      seed = seed * 1103515245 + 12345;
+      slave.push_back(static_cast<symbol_t>(round < 3 ? round * 0x7f : seed >> 16));
+    }
+    OutputFormat outputFormat = formats[round % (sizeof(formats)/sizeof(formats[0]))];
+    OutputBuffer output;
+    result_t result = set.read(slave, 0, false, nullptr, -1, outputFormat, -1, &output);
+    got = getResultCode(result) + string(" ") + output.str();
+    output.clear();
+    bool indexed = (outputFormat & OF_JSON) && !(outputFormat & OF_NAMES);
+    size_t offset = 0;
+    ssize_t outputIndex = 0;
+    result = RESULT_OK;
+    for (const auto field : fields) {
+      if (!field->isIgnored()) {
+        result = field->read(slave, offset, !output.empty(), nullptr, -1, outputFormat, indexed ? outputIndex++ : -1,
+            &output);
+        if (result != RESULT_OK) {
+          break;
+        }
+      }
+      offset += field->getLength(pt_slaveData, 0);
+    }
+    expect = getResultCode(result) + string(" ") + output.str();
+  }
+  verify(false, "plan format", "set", expect == got, expect, got);
+}
+
 int main() {
   // entry: definition, decoded value, master data, slave data, flags
   // definition: name,part,type[:len][,[divisor|values][,[unit][,[comment]]]]
@@ -695,6 +910,30 @@ int main() {
         bool match = mstr == writeMstr && sstr == writeSstr;
         verify(failedWriteMatch, "write", expectStr, match, mstr.getStr() + " " + sstr.getStr(),
             writeMstr.getStr() + " " + writeSstr.getStr());
+        if (match) {
+          // the typed values have to result in the same data
+          FieldValues values;
+          bool split = fields->isSet() && static_cast<const DataFieldSet*>(fields)->size() > 1;
+          parseValues(expectStr, split, &values);
+          MasterSymbolString valuesMstr;
+          valuesMstr.parseHex(mstr.getStr().substr(0, 8));
+          SlaveSymbolString valuesSstr;
+          size_t valueIndex = 0;
+          result = fields->writeValues(0, values, &valueIndex, &valuesMstr, nullptr);
+          if (result >= RESULT_OK) {
+            result = fields->writeValues(0, values, &valueIndex, &valuesSstr, nullptr);
+          }
+          if (result < RESULT_OK) {
+            cout << "  write values " << fields->getName(-1) << " >" << expectStr
+                    << "< error: " << getResultCode(result) << endl;
+            error = true;
+          } else {
+            valuesMstr.adjustHeader();
+            valuesSstr.adjustHeader();
+            verify(false, "write values", expectStr, mstr == valuesMstr && sstr == valuesSstr,
+                mstr.getStr() + " " + sstr.getStr(), valuesMstr.getStr() + " " + valuesSstr.getStr());
+          }
+        }
       }
     }
     delete fields;
@@ -703,5 +942,10 @@ int main() {
 
   delete templates;
 
+  checkJsonEscape();
+  checkFixedFormat();
+  checkBufferFormat();
+  checkPlanFormat();
+
   return error ? 1 : 0;
 }
@@ -16,8 +16,11 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <unistd.h>
+#include <cstdio>
 #include <iostream>
 #include <iomanip>
+#include <sstream>
 #include <string>
 #include <vector>
 #include "lib/ebus/filereader.h"
@@ -79,6 +82,26 @@ class NoopReader : public FileReader {
   }
 };
 
+class CollectReader : public FileReader {
+ public:
+  result_t addFromFile(const string& filename, unsigned int lineNo, vector<string>* row, string* errorDescription,
+    bool replace) override {
+    m_rows << lineNo << ":";
+    for (const auto& field : *row) {
+      m_rows << field << "|";
+    }
+    m_rows << endl;
+    return RESULT_OK;
+  }
+  string getRows() {
+    string rows = m_rows.str();
+    m_rows.str("");
+    return rows;
+  }
+ private:
+  ostringstream m_rows;
+};
+
 class TestReader : public MappedFileReader {
  public:
   TestReader(size_t expectedCols, size_t langCols)
@@ -97,8 +120,8 @@ class TestReader : public MappedFileReader {
         static_cast<unsigned>(m_expectedCols+m_langCols) << endl;
     return RESULT_ERR_EOF;
   }
-  result_t addFromFile(const string& filename, unsigned int lineNo, map<string, string>* row,
-      vector< map<string, string> >* subRows, string* errorDescription, bool replace) override {
+  result_t addFromFile(const string& filename, unsigned int lineNo, MappedRow* row,
+      vector<MappedRow>* subRows, string* errorDescription, bool replace) override {
     if (row->empty() || (m_expectedCols == 3) != subRows->empty()) {
       cout << "read line " << static_cast<unsigned>(baseLine + lineNo) << ": read error: got "
           << static_cast<unsigned>(row->size()) << "/3 main, " << static_cast<unsigned>(subRows->size())
@@ -158,7 +181,7 @@ class TestReader : public MappedFileReader {
         return RESULT_EMPTY;
       }
 
-      vector< map<string, string> >& subDefaults = getSubDefaults()[""];
+      vector<MappedRow>& subDefaults = getSubDefaults()[""];
       for (size_t colIdx = 0; colIdx < 2; colIdx++) {
         string col = resultsubline[colIdx*2];
         string got = (*row)[col];
@@ -250,6 +273,81 @@ int main(int argc, char** argv) {
     error = true;
   }
 
+  // record the rows to a cache file and replay them from there
+  string input = ifs.str();
+  ifs.clear();
+  ifs.str(input);
+  char cacheFile[] = "/tmp/test_filereader_XXXXXX";
+  int fd = mkstemp(cacheFile);
+  if (fd >= 0) {
+    close(fd);
+  }
+  NoopReader noopReader;
+  RowCache record(cacheFile, 1, input.length());
+  result_t result = noopReader.readFromStream(&ifs, "", 1, false, nullptr, &errorDescription, false, nullptr, nullptr,
+      &record);
+  if (result != RESULT_OK || !record.save()) {
+    cout << "row cache save: error " << getResultCode(result) << endl;
+    error = true;
+  } else {
+    cout << "row cache save: OK" << endl;
+  }
+  RowCache replay(cacheFile, 1, input.length());
+  hash = 0, size = 0;
+  if (!replay.load()) {
+    cout << "row cache load: error" << endl;
+    error = true;
+  } else {
+    result = noopReader.readFromStream(nullptr, "", 1, false, nullptr, &errorDescription, false, &hash, &size,
+        &replay);
+    if (result != RESULT_OK || hash != expectHash || size != expectSize) {
+      cout << "row cache replay: error " << getResultCode(result) << ", got 0x" << hex << hash << "/" << dec << size
+           << endl;
+      error = true;
+    } else {
+      cout << "row cache replay: OK" << endl;
+    }
+  }
+  RowCache stale(cacheFile, 2, input.length());
+  if (stale.load()) {
+    cout << "row cache stale: error unexpectedly loaded" << endl;
+    error = true;
+  } else {
+    cout << "row cache stale: OK" << endl;
+  }
+  RowCache staleKey(cacheFile, 1, input.length()+1);
+  if (staleKey.load()) {
+    cout << "row cache stale key: error unexpectedly loaded" << endl;
+    error = true;
+  } else {
+    cout << "row cache stale key: OK" << endl;
+  }
+  remove(cacheFile);
+
+  // split the rows into a memory only cache first and replay them after the rewind as done for parallel loading
+  ifs.clear();
+  ifs.str(input);
+  CollectReader collectReader;
+  collectReader.readFromStream(&ifs, "", 1, false, nullptr, &errorDescription);
+  string expectRows = collectReader.getRows();
+  ifs.clear();
+  ifs.str(input);
+  RowCache memory("", 1, 0);
+  result = noopReader.readFromStream(&ifs, "", 1, false, nullptr, &errorDescription, false, nullptr, nullptr,
+      &memory);
+  if (result != RESULT_OK || expectRows.empty() || !memory.isComplete() || !memory.hasNextRow()) {
+    cout << "row cache split: error " << getResultCode(result) << endl;
+    error = true;
+  } else {
+    cout << "row cache split: OK" << endl;
+    hash = 0, size = 0;
+    result = collectReader.readFromStream(nullptr, "", 1, false, nullptr, &errorDescription, false, &hash, &size,
+        &memory);
+    verify(false, "row cache split replay", "rows", result == RESULT_OK && hash == expectHash && size == expectSize,
+        expectRows, collectReader.getRows());
+    verify(false, "row cache split replayed", "rows", !memory.hasNextRow(), "", "");
+  }
+
   ifs.clear();
   baseLine = __LINE__+1;
   ifs.str(
@@ -267,7 +365,7 @@ int main(int argc, char** argv) {
   lineNo = 0;
   map<string, string> defaults;
   reader2.getDefaults()[""]["col 3"] = ";default of col 3";
-  vector< map<string, string> >& subDefaults = reader2.getSubDefaults()[""];
+  vector<MappedRow>& subDefaults = reader2.getSubDefaults()[""];
   subDefaults.resize(1);
   subDefaults[0]["subcol 2"] = ";default of sub 0 subcol 2";
   while (ifs.peek() != EOF) {
@@ -290,5 +388,22 @@ int main(int argc, char** argv) {
     error = true;
   }
 
+  // the mapped row keeps the column order while behaving like a map
+  MappedRow mapped;
+  mapped["type"] = "r";
+  mapped["name"] = "first";
+  mapped["comment"] = "c";
+  mapped["type"] = "w";
+  string plucked = mapped.pluck("name");
+  mapped.erase("missing");
+  string got = MappedFileReader::combineRow(mapped) + " " + plucked + " " + mapped.pluck("name")
+      + (mapped.find("comment") == mapped.end() ? " missing" : " found");
+  string expect = "type: \"w\", comment: \"c\" first  found";
+  verify(false, "mapped row", "type,name,comment", got == expect, expect, got);
+  map<string, string> asMap = mapped.toMap();
+  got = asMap.begin()->first + "=" + asMap.begin()->second + " " + asMap.rbegin()->first + "=" + asMap.rbegin()->second;
+  expect = "comment=c type=w";
+  verify(false, "mapped row", "map", got == expect, expect, got);
+
   return error ? 1 : 0;
 }
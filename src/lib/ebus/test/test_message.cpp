@@ -16,7 +16,9 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <pthread.h>
 #include <unistd.h>
+#include <atomic>
 #include <iostream>
 #include <fstream>
 #include <iomanip>
@@ -24,10 +26,12 @@
 #include <vector>
 #include <map>
 #include "lib/ebus/message.h"
+#include "lib/ebus/sharedvalues.h"
 
 using namespace ebusd;
 using std::cout;
 using std::endl;
+using std::to_string;
 
 static bool error = false;
 
@@ -78,6 +82,447 @@ result_t loadDefinitionsFromConfigPath(FileReader* reader, const string& filenam
 
 }  // namespace ebusd
 
+void verifyEqual(string type, string input, string expectStr, string gotStr) {
+  verify(false, type, input, gotStr == expectStr, expectStr, gotStr);
+}
+
+bool readDefinitions(MessageMap* messages, const string& definitions) {
+  istringstream stream("#\n" + definitions);
+  unsigned int lineNo = 0;
+  vector<string> row;
+  string errorDescription;
+  while (stream.peek() != EOF) {
+    result_t result = messages->readLineFromStream(&stream, __FILE__, false, &lineNo, &row, &errorDescription, false,
+        nullptr, nullptr);
+    if (result != RESULT_OK) {
+      cout << "  read definitions error: " << getResultCode(result) << ", " << errorDescription << endl;
+      error = true;
+      return false;
+    }
+  }
+  return true;
+}
+
+string decodeLastData(const Message* message, OutputFormat outputFormat = 0) {
+  if (!message) {
+    return "not found";
+  }
+  ostringstream output;
+  result_t result = message->decodeLastData(false, nullptr, -1, outputFormat, &output);
+  return result == RESULT_OK ? output.str() : getResultCode(result);
+}
+
+string getSharedName(const string& suffix) {
+  ostringstream name;
+  name << "/ebusd_test_" << getpid() << "_" << suffix;
+  return name.str();
+}
+
+static const char* swapDefinitions = "r,cir,first,,,08,B509,0d2800,,,power\nr,cir,second,,,08,B509,0d2900,,,power";
+
+void checkSwapDefinitions() {
+  MessageMap* active = new MessageMap(true, "", false);
+  MessageMap* reloaded = new MessageMap(true, "", false);
+  MasterSymbolString master;
+  SlaveSymbolString slave;
+  master.parseHex("ff08b509030d2800");
+  slave.parseHex("012a");
+  if (readDefinitions(active, swapDefinitions) && readDefinitions(reloaded, swapDefinitions)) {
+    Message* message = active->find(master);
+    if (message) {
+      message->storeLastData(master, slave);
+    }
+    size_t carried = active->swapDefinitions(reloaded);
+    Message* swapped = active->find(master);
+    verifyEqual("swap definitions", "carried", "1", to_string(carried));
+    verifyEqual("swap definitions", "size", "2", to_string(active->size()));
+    verifyEqual("swap definitions", "first", "42", decodeLastData(swapped));
+    verifyEqual("swap definitions", "first slave", "012a", swapped ? swapped->getLastSlaveData().getStr() : "");
+    verifyEqual("swap definitions", "first update time", message ? to_string(message->getLastUpdateTime()) : "",
+        swapped ? to_string(swapped->getLastUpdateTime()) : "");
+    verifyEqual("swap definitions", "previous first", "42", decodeLastData(reloaded->find(master)));
+    Message* second = active->find("cir", "second", "", false);
+    verifyEqual("swap definitions", "second update time", "0",
+        second ? to_string(second->getLastUpdateTime()) : "not found");
+  }
+  delete reloaded;
+  delete active;
+}
+
+void checkSharedValues() {
+  MessageMap* messages = new MessageMap(true, "", false);
+  MessageMap* consumer = new MessageMap(true, "", false);
+  MasterSymbolString master;
+  SlaveSymbolString slave;
+  master.parseHex("ff08b509030d2800");
+  slave.parseHex("012a");
+  string name = getSharedName("values");
+  SharedValuesWriter writer(name, 4);
+  SharedValuesReader reader;
+  Message* message = nullptr;
+  if (readDefinitions(messages, swapDefinitions) && readDefinitions(consumer, swapDefinitions)) {
+    message = messages->find(master);
+  }
+  verifyEqual("shared values", "open writer", getResultCode(RESULT_OK), getResultCode(writer.open()));
+  if (message) {
+    message->storeLastData(master, slave);
+    writer.update(message);
+    verifyEqual("shared values", "open reader", getResultCode(RESULT_OK), getResultCode(reader.open(name)));
+    verifyEqual("shared values", "used slots", "1", to_string(reader.getUsedSlots()));
+    uint32_t slot = 0;
+    SharedValue value;
+    if (reader.find('r', "cir", "first", &slot) && reader.read(slot, &value)) {
+      verifyEqual("shared values", "circuit", "cir", value.circuit);
+      verifyEqual("shared values", "name", "first", value.name);
+      verifyEqual("shared values", "master", master.getStr(), value.master.getStr());
+      verifyEqual("shared values", "slave", slave.getStr(), value.slave.getStr());
+    } else {
+      verify(false, "shared values", "find", false, "cir first", "not found");
+    }
+    verifyEqual("shared values", "restored", "1", to_string(reader.restore(consumer)));
+    verifyEqual("shared values", "consumer first", "42", decodeLastData(consumer->find(master)));
+  }
+  reader.close();
+  delete consumer;
+  delete messages;
+}
+
+void checkSharedValuesRekeyed() {
+  // a reloaded definition with a different key keeps the slot but refreshes the key
+  MessageMap* messages = new MessageMap(true, "", false);
+  MessageMap* rekeyed = new MessageMap(true, "", false);
+  MasterSymbolString master, rekeyMaster;
+  SlaveSymbolString slave;
+  master.parseHex("ff08b509030d2800");
+  rekeyMaster.parseHex("ff08b509030d2a00");
+  slave.parseHex("012a");
+  string name = getSharedName("rekeyed");
+  SharedValuesWriter writer(name, 4);
+  SharedValuesReader reader;
+  Message* message = nullptr;
+  Message* rekeyedMessage = nullptr;
+  if (readDefinitions(messages, swapDefinitions)
+      && readDefinitions(rekeyed, "r,cir,first,,,08,B509,0d2a00,,,power")) {
+    message = messages->find(master);
+    rekeyedMessage = rekeyed->find(rekeyMaster);
+  }
+  if (message && rekeyedMessage && writer.open() == RESULT_OK) {
+    message->storeLastData(master, slave);
+    writer.update(message);
+    rekeyedMessage->storeLastData(rekeyMaster, slave);
+    writer.update(rekeyedMessage);
+    verifyEqual("shared values rekeyed", "open reader", getResultCode(RESULT_OK), getResultCode(reader.open(name)));
+    verifyEqual("shared values rekeyed", "used slots", "1", to_string(reader.getUsedSlots()));
+    uint32_t slot = 0;
+    SharedValue value;
+    if (reader.find('r', "cir", "first", &slot) && reader.read(slot, &value)) {
+      verify(false, "shared values rekeyed", "key", value.key == rekeyedMessage->getKey()
+          && value.key != message->getKey(), to_string(rekeyedMessage->getKey()), to_string(value.key));
+      verifyEqual("shared values rekeyed", "master", rekeyMaster.getStr(), value.master.getStr());
+    } else {
+      verify(false, "shared values rekeyed", "find", false, "cir first", "not found");
+    }
+  } else {
+    verify(false, "shared values rekeyed", "prepare", false, "messages and segment", "missing");
+  }
+  reader.close();
+  delete rekeyed;
+  delete messages;
+}
+
+/** the state shared between the main thread and the thread running @a runSharedWriter(). */
+struct SharedWriterRun {
+  SharedValuesWriter* writer;  //!< the @a SharedValuesWriter
+  Message* messages[2];  //!< the alternately written instances of the same message with different data
+  std::atomic<bool> stop;  //!< set by the reader when done
+  unsigned int updates;  //!< the number of updates done
+};
+
+void* runSharedWriter(void* arg) {
+  SharedWriterRun* run = reinterpret_cast<SharedWriterRun*>(arg);
+  while (!run->stop.load()) {
+    run->writer->update(run->messages[run->updates%2]);
+    run->updates++;
+  }
+  return nullptr;
+}
+
+void checkSharedValuesConcurrent() {
+  // a reader running concurrently with the writer only ever sees completely written slots
+  MessageMap* messages[2] = {new MessageMap(true, "", false), new MessageMap(true, "", false)};
+  string name = getSharedName("concurrent");
+  SharedValuesWriter writer(name, 4);
+  SharedValuesReader reader;
+  SharedWriterRun run;
+  run.writer = &writer;
+  run.stop = false;
+  run.updates = 0;
+  MasterSymbolString master;
+  SlaveSymbolString slaves[2];
+  master.parseHex("ff08b509030d2f00");
+  slaves[0].parseHex("10" + string(32, '1'));
+  slaves[1].parseHex("10" + string(32, '2'));
+  for (size_t index = 0; index < 2; index++) {
+    run.messages[index] = nullptr;
+    if (readDefinitions(messages[index], "r,cir,block,,,08,B509,0d2f00,,,HEX:16")) {
+      run.messages[index] = messages[index]->find(master);
+    }
+    if (run.messages[index]) {
+      run.messages[index]->storeLastData(master, slaves[index]);
+    }
+  }
+  uint32_t slot = 0;
+  pthread_t thread;
+  if (!run.messages[0] || !run.messages[1] || writer.open() != RESULT_OK) {
+    verify(false, "shared values concurrent", "prepare", false, "messages and segment", "missing");
+  } else if ((writer.update(run.messages[0]), reader.open(name)) != RESULT_OK
+      || !reader.find('r', "cir", "block", &slot)) {
+    verify(false, "shared values concurrent", "find", false, "cir block", "not found");
+  } else if (pthread_create(&thread, nullptr, runSharedWriter, &run) != 0) {
+    verify(false, "shared values concurrent", "start", false, "writer thread", "not started");
+  } else {
+    string torn;
+    SharedValue value;
+    for (unsigned int reads = 0; reads < 1000000 && torn.empty(); reads++) {
+      if (!reader.read(slot, &value)) {
+        torn = "unassigned";
+      } else if (value.master != master || (value.slave != slaves[0] && value.slave != slaves[1])) {
+        torn = value.master.getStr() + "/" + value.slave.getStr();
+      }
+    }
+    run.stop = true;
+    pthread_join(thread, nullptr);
+    verify(false, "shared values concurrent", "read", torn.empty(), "complete slave data", torn);
+    verify(false, "shared values concurrent", "updates", run.updates > 0, "some", to_string(run.updates));
+  }
+  reader.close();
+  delete messages[1];
+  delete messages[0];
+}
+
+void checkDataSequence() {
+  // the data sequence of a circuit only changes with the data of its own messages
+  MessageMap* messages = new MessageMap(true, "", false);
+  MasterSymbolString master;
+  SlaveSymbolString slave;
+  master.parseHex("ff08b509030d2800");
+  slave.parseHex("012c");
+  Message* message = nullptr;
+  if (readDefinitions(messages, string(swapDefinitions) + "\nr,other,third,,,08,B509,0d2a00,,,power")) {
+    message = messages->find(master);
+  }
+  if (!message) {
+    verify(false, "data sequence", "find", false, "cir first", "not found");
+    delete messages;
+    return;
+  }
+  uint64_t sequenceCir = messages->getDataSequence("cir");
+  uint64_t sequenceOther = messages->getDataSequence("OTHER");
+  uint64_t sequenceAll = messages->getDataSequence("");
+  message->storeLastData(master, slave);
+  verify(false, "data sequence", "cir after update", messages->getDataSequence("Cir") != sequenceCir,
+      "not " + to_string(sequenceCir), to_string(messages->getDataSequence("Cir")));
+  verifyEqual("data sequence", "other after update", to_string(sequenceOther),
+      to_string(messages->getDataSequence("other")));
+  verify(false, "data sequence", "all after update", messages->getDataSequence("") != sequenceAll,
+      "not " + to_string(sequenceAll), to_string(messages->getDataSequence("")));
+  sequenceCir = messages->getDataSequence("cir");
+  sequenceOther = messages->getDataSequence("other");
+  readDefinitions(messages, "r,other,fourth,,,08,B509,0d2b00,,,power");
+  verify(false, "data sequence", "cir after adding", messages->getDataSequence("cir") != sequenceCir,
+      "not " + to_string(sequenceCir), to_string(messages->getDataSequence("cir")));
+  verify(false, "data sequence", "other after adding", messages->getDataSequence("other") != sequenceOther,
+      "not " + to_string(sequenceOther), to_string(messages->getDataSequence("other")));
+  delete messages;
+}
+
+void checkCopyDefinitions() {
+  // copy the parsed definitions to the map of another bus with its own conditions and qualified circuit names
+  MessageMap* base = new MessageMap(false, "", false);
+  MessageMap* bus = new MessageMap(false, "", false);
+  bus->setCircuitPrefix("bus2.");
+  string errorDescription;
+  if (readDefinitions(base, "r,cir,state,,,08,B509,0d2c00,,,UCH\n*[on],cir,state,,,,1\n"
+      "[on]r,cir,power,,,08,B509,0d2d00,,,UCH")) {
+    verifyEqual("copy definitions", "copy", getResultCode(RESULT_OK), getResultCode(bus->copyDefinitions(*base)));
+    verifyEqual("copy definitions", "size", to_string(base->size()), to_string(bus->size()));
+    verifyEqual("copy definitions", "conditions", to_string(base->sizeConditions()),
+        to_string(bus->sizeConditions()));
+    verifyEqual("copy definitions", "resolve", getResultCode(RESULT_OK),
+        getResultCode(bus->resolveConditions(false, &errorDescription)));
+  }
+  MasterSymbolString master;
+  SlaveSymbolString slave;
+  master.parseHex("ff08b509030d2c00");
+  slave.parseHex("0101");
+  Message* copied = bus->find(master);
+  verifyEqual("copy definitions", "circuit", "bus2.cir", copied ? copied->getCircuit() : "not found");
+  verifyEqual("copy definitions", "name", "state", copied ? copied->getName() : "not found");
+  Message* original = base->find(master);
+  verifyEqual("copy definitions", "original circuit", "cir", original ? original->getCircuit() : "not found");
+  verifyEqual("copy definitions", "power before condition", "not found",
+      bus->find("cir", "power", "", false) ? "found" : "not found");
+  if (copied && copied != original) {
+    copied->storeLastData(master, slave);  // the condition of the copy is fulfilled only
+    verifyEqual("copy definitions", "state", "1", decodeLastData(copied));
+    verifyEqual("copy definitions", "original update time", "0",
+        original ? to_string(original->getLastUpdateTime()) : "not found");
+    Message* copiedPower = bus->find("bus2.cir", "power", "", false);
+    verifyEqual("copy definitions", "power circuit", "bus2.cir",
+        copiedPower ? copiedPower->getCircuit() : "not found");
+    verifyEqual("copy definitions", "power conditional", "1",
+        copiedPower ? to_string(copiedPower->isConditional()) : "not found");
+    verifyEqual("copy definitions", "original power", "not found",
+        base->find("cir", "power", "", false) ? "found" : "not found");
+  } else {
+    verify(false, "copy definitions", "instance", false, "own copy", copied ? "shared instance" : "not found");
+  }
+  delete bus;
+  delete base;
+}
+
+string getPollName(MessageMap* messages) {
+  Message* message = messages->getNextPoll();
+  return message ? message->getName() : "none";
+}
+
+void checkPollPassive() {
+  // an update by a client of ebusd does not replace the next poll
+  MessageMap* messages = new MessageMap(true, "", false);
+  MasterSymbolString master;
+  SlaveSymbolString slave;
+  slave.parseHex("012a");
+  if (readDefinitions(messages, "r1,cir,polled,,,08,B509,0d2b00,,,power")) {
+    master.parseHex("ff08b509030d2b00");
+    Message* polled = messages->getNextPoll();
+    verifyEqual("poll client", "first", "polled", polled ? polled->getName() : "none");
+    if (polled) {
+      time_t later = polled->getLastPollTime()+10;
+      polled->restoreLastData(master, slave, later, later);
+      verifyEqual("poll client", "next", "polled", getPollName(messages));
+    }
+  }
+  delete messages;
+
+  // only an update seen between other participants replaces the next poll, and the next message is polled instead
+  messages = new MessageMap(true, "", false);
+  if (readDefinitions(messages, "r1,cir,one,,,08,B509,0d3000,,,power\nr1,cir,two,,,08,B509,0d3100,,,power")) {
+    MasterSymbolString masterOne, masterTwo;
+    masterOne.parseHex("ff08b509030d3000");
+    masterTwo.parseHex("ff08b509030d3100");
+    Message* one = messages->find(masterOne);
+    Message* two = messages->find(masterTwo);
+    string first = getPollName(messages);
+    string second = getPollName(messages);
+    verify(false, "poll passive", "round", first != second && first != "none" && second != "none", "one and two",
+        first + " and " + second);
+    if (one && two) {
+      time_t later = two->getLastPollTime();
+      for (unsigned int round = 1; round <= 4; round++) {
+        later += 10;
+        one->restoreLastData(masterOne, slave, later, one->getLastChangeTime());  // seen with unchanged data
+        one->setPassiveUpdate();
+        slave[1] = static_cast<symbol_t>(round);
+        two->restoreLastData(masterTwo, slave, later, later);  // changed data read by a client of ebusd
+        verifyEqual("poll passive", "skipped " + to_string(round), "two", getPollName(messages));
+      }
+      // the passive updates count as polls only and do not back off as for unchanged data
+      verifyEqual("poll passive", "after skipped", "one", getPollName(messages));
+    }
+  }
+  delete messages;
+}
+
+/**
+ * Store new data for a message referenced by conditions and return the availability of the dependent messages.
+ * @param reference the referenced @a Message, or nullptr to store nothing.
+ * @param master the master data of the referenced message in hex.
+ * @param slave the new slave data of the referenced message in hex.
+ * @param dependents the dependent @a Message instances.
+ * @return the availability of each dependent message as "1" or "0".
+ */
+string getAvailability(Message* reference, const string& master, const string& slave,
+    const vector<Message*>& dependents) {
+  if (reference) {
+    MasterSymbolString mstr;
+    SlaveSymbolString sstr;
+    mstr.parseHex(master);
+    sstr.parseHex(slave);
+    reference->storeLastData(mstr, sstr);
+  }
+  string ret;
+  for (const auto message : dependents) {
+    ret += message == nullptr ? "-" : message->isAvailable() ? "1" : "0";
+  }
+  return ret;
+}
+
+void checkConditionUpdates() {
+  // the conditions are re-evaluated when the data of the referenced messages changes
+  MessageMap* messages = new MessageMap(false, "", false);
+  string errorDescription;
+  if (!readDefinitions(messages, "r,cir,code,,,08,B509,0d3500,,,UCH\nr,cir,temp,,,08,B509,0d3600,,,UCH\n"
+      "*[code],cir,code,,,,4;6\n*[warm],cir,temp,,,,20-30\n"
+      "[code]r,cir,simple,,,08,B509,0d3700,,,UCH\n[warm]r,cir,range,,,08,B509,0d3800,,,UCH\n"
+      "[code][warm]r,cir,combined,,,08,B509,0d3900,,,UCH")) {
+    delete messages;
+    return;
+  }
+  verifyEqual("condition update", "resolve", getResultCode(RESULT_OK),
+      getResultCode(messages->resolveConditions(false, &errorDescription)));
+  Message* found[5];
+  for (size_t index = 0; index < 5; index++) {
+    MasterSymbolString master;
+    master.parseHex("ff08b509030d3" + to_string(5+index) + "00");
+    found[index] = messages->find(master, false, true, true, true, false);
+  }
+  Message* code = found[0];
+  Message* temp = found[1];
+  vector<Message*> dependents = {found[2], found[3], found[4]};
+  verifyEqual("condition update", "references", "code temp", string(code ? code->getName() : "-") + " "
+      + (temp ? temp->getName() : "-"));
+  if (!code || !temp) {
+    delete messages;
+    return;
+  }
+  // the availability of the simple, range, and combined dependents
+  verifyEqual("condition update", "initial", "000", getAvailability(nullptr, "", "", dependents));
+  // entry: description, referenced message (0=code, 1=temp), slave data, availability of simple/range/combined
+  const char* updates[][4] = {
+    {"code matching",       "0", "0104", "100"},
+    {"temp in range",       "1", "0114", "111"},
+    {"temp at range end",   "1", "011e", "111"},
+    {"temp above range",    "1", "011f", "100"},
+    {"temp back in range",  "1", "0119", "111"},
+    {"code other matching", "0", "0106", "111"},
+    {"code not matching",   "0", "0105", "010"},
+    {"temp below range",    "1", "0113", "000"},
+  };
+  for (const auto& update : updates) {
+    bool isCode = update[1][0] == '0';
+    verifyEqual("condition update", update[0], update[3], getAvailability(isCode ? code : temp,
+        isCode ? "ff08b509030d3500" : "ff08b509030d3600", update[2], dependents));
+  }
+  delete messages;
+}
+
+void checkStringPool() {
+  // the values interned for deleted messages and fields are removed from the pool
+  size_t strings, attributes, moreStrings, moreAttributes;
+  size_t bytes = StringPool::getStatistics(&strings, &attributes);
+  MessageMap* messages = new MessageMap(true, "", false);
+  readDefinitions(messages, "r,pooledcircuit,pooledname,pooled comment,,08,B509,0d3200,pooledfield,,UCH,,pooledunit,"
+      "pooled field comment");
+  bool added = messages->size() == 1 && StringPool::getStatistics(&moreStrings, &moreAttributes) > bytes
+      && moreStrings > strings && moreAttributes > attributes;
+  verify(false, "string pool", "added", added, "more than " + to_string(strings) + " strings",
+      to_string(moreStrings) + " strings");
+  delete messages;
+  size_t remainBytes = StringPool::getStatistics(&moreStrings, &moreAttributes);
+  verifyEqual("string pool", "removed", to_string(strings) + "/" + to_string(attributes) + "/" + to_string(bytes),
+      to_string(moreStrings) + "/" + to_string(moreAttributes) + "/" + to_string(remainBytes));
+}
+
 int main() {
   // message:   [type],[circuit],name,[comment],[QQ[;QQ]*],[ZZ],[PBSB],[ID],fields...
   // field:     name,part,type[:len][,[divisor|values][,[unit][,[comment]]]]
@@ -139,6 +584,11 @@ int main() {
     {"r,ehp,bad,invalid pos,,50,B5ff,000102,,m,HEX:8;tempsensor;tempsensor;tempsensor;tempsensor;power;power,,,", "", "", "", "c" },
     {"r,ehp,bad,invalid pos,,50,B5ff,,,s,HEX:8;tempsensor;tempsensor;tempsensor;tempsensor;tempsensor;power;power,,,", "", "", "", "c" },
     {"r,ehp,ApplianceCode,,,08,b509,0d4301,,,UCH,", "9", "ff08b509030d4301", "0109", "d" },
+    {"r,cir,cached,,,08,B509,0d2e00,,,power", "42", "ff08b509030d2e00", "012a", "d"},
+    {"", "42", "ff08b509030d2e00", "012a", "kd"},
+    {"", "\n     \"power\": {\"value\": 42}", "ff08b509030d2e00", "012a", "kj"},
+    {"", "43", "ff08b509030d2e00", "012b", "kd"},
+    {"", "5", "ff08b509030d2e00", "0105", "ka"},
     {"*r,ehp,,,,08,b509,0d", "", "", "", "" },
     {"*w,ehp,,,,08,b509,0e", "", "", "", "" },
     {"*[brinetowater],ehp,ApplianceCode,,,,4;6;8;9;10", "", "", "", "" },
@@ -235,6 +685,7 @@ int main() {
     bool failedPrepareMatch = flags.find('P') != string::npos;
     bool multi = flags.find('*') != string::npos;
     bool withInput = flags.find('i') != string::npos;
+    bool answer = flags.find('a') != string::npos;
     result_t result = RESULT_EMPTY;
     istringstream isstr(check[0]);
     lineNo = baseLine + i;
@@ -390,12 +841,34 @@ int main() {
         cout << "  find error: different" << endl;
         error = true;
       }
+      if (message->isAvailable()) {
+        string circuit = message->getCircuit();
+        string name = message->getName();
+        transform(circuit.begin(), circuit.end(), circuit.begin(), ::toupper);
+        transform(name.begin(), name.end(), name.begin(), ::toupper);
+        foundMessage = messages->find(circuit, name, "*", message->isWrite(), message->isPassive());
+        if (foundMessage && foundMessage->getCircuit() == message->getCircuit()
+            && foundMessage->getName() == message->getName()) {
+          cout << "  find by name OK" << endl;
+        } else {
+          cout << "  find by name error: message not found by " << circuit << " " << name << endl;
+          error = true;
+        }
+      }
     }
 
     if (message->isPassive() || decode) {
       time_t lastUpdateTime = message->getLastUpdateTime();
       time_t lastChangeTime = message->getLastChangeTime();
+      vector<string> lastFieldValues;
+      vector<time_t> lastFieldChangeTimes;
       if (checkUpdateTime || checkSameChangeTime) {
+        for (size_t index = 0; index < message->getFieldCount(); index++) {
+          ostringstream value;
+          message->decodeLastData(false, nullptr, index, 0, &value);
+          lastFieldValues.push_back(value.str());
+          lastFieldChangeTimes.push_back(message->getLastFieldChangeTime(index));
+        }
         sleep(2);
       }
       for (size_t index = 0; index < message->getCount(); index++) {
@@ -404,8 +877,9 @@ int main() {
       ostringstream output;
       if (withMessageDump) {
         if (decodeJson) {
-          message->decodeJson(false, false, false, OF_JSON|OF_DEFINTION, &output);
-          string str = output.str();
+          OutputBuffer json;
+          message->decodeJson(false, false, false, OF_JSON|OF_DEFINTION, &json);
+          string str = json.str();
           size_t start = str.find("\"lastup\": ");
           if (start != string::npos) {
             start += 10;
@@ -454,8 +928,37 @@ int main() {
             cout << "  change time OK" << endl;
           }
         }
+        bool fieldsMatch = true;
+        for (size_t index = 0; index < lastFieldValues.size(); index++) {
+          ostringstream value;
+          message->decodeLastData(false, nullptr, index, 0, &value);
+          bool changed = value.str() != lastFieldValues[index];
+          if (changed != (message->getLastFieldChangeTime(index) != lastFieldChangeTimes[index])) {
+            cout << "  field change time error: field " << index << (changed ? " not updated" : " unexpectedly updated")
+                 << endl;
+            fieldsMatch = false;
+            error = true;
+          }
+        }
+        if (fieldsMatch) {
+          cout << "  field change time OK" << endl;
+        }
       }
     }
+    if (answer) {
+      istringstream input(inputStr);
+      SlaveSymbolString answerSstr;
+      result = message->prepareSlave(&input, &answerSstr);
+      if (result != RESULT_OK) {
+        cout << "  \"" << inputStr << "\": prepare slave error: " << getResultCode(result) << endl;
+        error = true;
+        continue;
+      }
+      verify(false, "prepare slave", inputStr, answerSstr == *sstrs[0], sstrs[0]->getStr(), answerSstr.getStr());
+      string answerStr = decodeLastData(message);
+      verify(false, "decode answer", inputStr, answerStr == inputStr, inputStr, answerStr);
+      continue;
+    }
     if (!message->isPassive() && (withInput || !decode)) {
       istringstream input(inputStr);
       MasterSymbolString writeMstr;
@@ -479,9 +982,48 @@ int main() {
 
       bool match = writeMstr == *mstrs[0];
       verify(failedPrepareMatch, "prepare", inputStr, match, mstrs[0]->getStr(), writeMstr.getStr());
+      if (!match) {
+        continue;
+      }
+
+      // the typed values have to result in the same master data
+      FieldValues values;
+      istringstream valueInput(inputStr);
+      string token;
+      while (getline(valueInput, token, UI_FIELD_SEPARATOR)) {
+        const char* str = token.c_str();
+        char* strEnd = nullptr;
+        double number = strtod(str, &strEnd);
+        if (token == NULL_VALUE) {
+          values.push_back(FieldValue());
+        } else if (strEnd != str && *strEnd == 0) {
+          values.push_back(FieldValue(number));
+        } else {
+          values.push_back(FieldValue(token));
+        }
+      }
+      MasterSymbolString valuesMstr;
+      result = message->prepareMaster(0, 0xff, SYN, values, &valuesMstr);
+      if (result != RESULT_OK) {
+        cout << "  \"" << inputStr << "\": prepare values error: " << getResultCode(result) << endl;
+        error = true;
+        continue;
+      }
+      verify(false, "prepare values", inputStr, valuesMstr == writeMstr, writeMstr.getStr(), valuesMstr.getStr());
     }
   }
 
+  checkSwapDefinitions();
+  checkSharedValues();
+  checkSharedValuesRekeyed();
+  checkSharedValuesConcurrent();
+  checkDataSequence();
+
+  checkPollPassive();
+  checkCopyDefinitions();
+  checkConditionUpdates();
+  checkStringPool();
+
   delete templates;
   delete messages;
   for (vector<MasterSymbolString*>::iterator it = mstrs.begin(); it != mstrs.end(); it++) {
@@ -0,0 +1,200 @@
+/*
+ * ebusd - daemon for communication with eBUS heating systems.
+ * Copyright (C) 2014-2018 John Baier <ebusd@ebusd.eu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <time.h>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <map>
+#include "lib/ebus/message.h"
+
+using namespace ebusd;
+using std::cout;
+using std::endl;
+
+static bool error = false;
+
+namespace ebusd {
+
+DataFieldTemplates* getTemplates(const string& filename) {
+  return nullptr;
+}
+
+result_t loadDefinitionsFromConfigPath(FileReader* reader, const string& filename, bool verbose,
+    map<string, string>* defaults, string* errorDescription, bool replace = false) {
+  return RESULT_ERR_NOTFOUND;
+}
+
+}  // namespace ebusd
+
+/** the number of times to replay the telegrams for the benchmark. */
+#define REPLAY_COUNT 50
+
+/**
+ * Read the master parts of all telegrams from a raw dump file as written by ebusd with --dumpfile.
+ * @param filename the name of the dump file.
+ * @param telegrams the vector to add the master parts to.
+ */
+void readDump(const string& filename, vector<vector<symbol_t>>* telegrams) {
+  std::ifstream stream(filename.c_str(), std::ifstream::binary);
+  vector<symbol_t> telegram;
+  bool escape = false;
+  while (stream.good()) {
+    int value = stream.get();
+    if (value < 0) {
+      break;
+    }
+    symbol_t symbol = (symbol_t)value;
+    if (symbol == SYN) {
+      if (telegram.size() >= 5 && telegram.size() >= 5u+telegram[4]) {
+        telegram.resize(5u+telegram[4]);
+        telegrams->push_back(telegram);
+      }
+      telegram.clear();
+      escape = false;
+      continue;
+    }
+    if (escape) {
+      escape = false;
+      telegram.push_back(symbol == 0x00 ? ESC : SYN);
+    } else if (symbol == ESC) {
+      escape = true;
+    } else {
+      telegram.push_back(symbol);
+    }
+  }
+}
+
+/**
+ * Create a set of telegrams similar to the ones seen on a typical bus.
+ * @param telegrams the vector to add the master parts to.
+ */
+void createTelegrams(vector<vector<symbol_t>>* telegrams) {
+  unsigned int seed = 1;
+  for (unsigned int i = 0; i < 5000; i++) {
+    seed = seed * 1103515245 + 12345;
+    symbol_t id = (symbol_t)(seed >> 16);
+    if (i % 2 == 0) {
+      telegrams->push_back({0x10, 0x08, 0xb5, 0x09, 0x03, 0x0d, id, 0x00});
+    } else if (i % 5 == 1) {
+      telegrams->push_back({0x10, 0xfe, 0x07, 0x00, 0x09, 0x00, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00});
+    } else {
+      telegrams->push_back({0x31, 0x15, (symbol_t)(0xb5+(id & 1)), id, 0x01, id});
+    }
+  }
+}
+
+int main(int argc, char** argv) {
+  vector<vector<symbol_t>> telegrams;
+  if (argc > 1) {
+    readDump(argv[1], &telegrams);
+    cout << "read " << telegrams.size() << " telegrams from " << argv[1] << endl;
+  }
+  if (telegrams.empty()) {
+    createTelegrams(&telegrams);
+  }
+  // collect the keys of all ID lengths and source variants as looked up during MessageMap::find()
+  vector<uint64_t> lookups;
+  for (const auto& telegram : telegrams) {
+    MasterSymbolString master;
+    for (const auto symbol : telegram) {
+      master.push_back(symbol);
+    }
+    for (size_t idLength = 0; idLength <= 4; idLength++) {
+      uint64_t key = Message::createKey(master, idLength);
+      lookups.push_back(key);
+      lookups.push_back(key & ~(0x1fLL << (8 * 7)));
+      lookups.push_back(key | (0x1fLL << (8 * 7)));
+    }
+  }
+  // add every third key to both the map and index, some of them with several messages
+  map<uint64_t, vector<Message*>> byKey;
+  MessageKeyIndex index;
+  for (size_t pos = 0; pos < lookups.size(); pos += 3) {
+    vector<Message*>* messages = &byKey[lookups[pos]];
+    messages->push_back(reinterpret_cast<Message*>(messages->size()+1));
+    index.set(lookups[pos], messages);
+  }
+  if (index.size() != byKey.size()) {
+    cout << "index size: error got " << index.size() << ", expected " << byKey.size() << endl;
+    error = true;
+  }
+  size_t mismatches = 0;
+  for (const auto key : lookups) {
+    const auto it = byKey.find(key);
+    if (index.find(key) != (it == byKey.end() ? nullptr : &it->second)) {
+      mismatches++;
+    }
+  }
+  // remove every other key again and check that all remaining are still found
+  size_t removed = 0;
+  for (auto it = byKey.begin(); it != byKey.end(); ) {
+    if ((removed++) % 2 == 0) {
+      index.erase(it->first);
+      it = byKey.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  for (const auto key : lookups) {
+    const auto it = byKey.find(key);
+    if (index.find(key) != (it == byKey.end() ? nullptr : &it->second)) {
+      mismatches++;
+    }
+  }
+  if (mismatches > 0 || index.size() != byKey.size()) {
+    cout << "index lookup: error " << mismatches << " mismatches" << endl;
+    error = true;
+  } else {
+    cout << "index lookup: OK" << endl;
+  }
+
+  // benchmark the map against the index
+  struct timespec start, end;
+  size_t found = 0;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i = 0; i < REPLAY_COUNT; i++) {
+    for (const auto key : lookups) {
+      if (byKey.find(key) != byKey.end()) {
+        found++;
+      }
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double mapNs = static_cast<double>((end.tv_sec-start.tv_sec)*1000000000LL + (end.tv_nsec-start.tv_nsec));
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i = 0; i < REPLAY_COUNT; i++) {
+    for (const auto key : lookups) {
+      if (index.find(key) != nullptr) {
+        found--;
+      }
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double indexNs = static_cast<double>((end.tv_sec-start.tv_sec)*1000000000LL + (end.tv_nsec-start.tv_nsec));
+  if (found != 0) {
+    cout << "benchmark: error different results" << endl;
+    error = true;
+  }
+  double count = static_cast<double>(lookups.size()) * REPLAY_COUNT;
+  cout << "benchmark " << lookups.size() << " lookups from " << telegrams.size() << " telegrams: map "
+       << (mapNs / count) << " ns, index " << (indexNs / count) << " ns per lookup" << endl;
+
+  return error ? 1 : 0;
+}
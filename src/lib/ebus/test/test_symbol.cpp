@@ -119,6 +119,138 @@ int main(int argc, char** argv) {
     verify(false, "data size", "0427a90015a901", sstr.getDataSize() == 4, expectStr, gotStr);
   }
 
+  // check the multi-byte CRC kernel and the accumulated CRC against adding single symbols
+  bool crcMatch = true;
+  unsigned int seed = 1;
+  for (size_t len = 0; len < 40 && crcMatch; len++) {
+    symbol_t data[40];
+    symbol_t expectCrc = 0;
+    mstr.clear();
+    for (size_t pos = 0; pos < len; pos++) {
+      seed = seed * 1103515245 + 12345;
+      symbol_t value = (seed >> 16) % 5 == 0 ? (symbol_t)(ESC + ((seed >> 20) & 1)) : (symbol_t)(seed >> 16);
+      data[pos] = value;
+      if (value == ESC || value == SYN) {
+        SymbolString::updateCrc(ESC, &expectCrc);
+        SymbolString::updateCrc(value == ESC ? 0x00 : 0x01, &expectCrc);
+      } else {
+        SymbolString::updateCrc(value, &expectCrc);
+      }
+      mstr.push_back(value);
+    }
+    symbol_t gotCrc = 0;
+    SymbolString::updateCrc(data, len, &gotCrc);
+    crcMatch = gotCrc == expectCrc && mstr.calcCrc() == expectCrc;
+    if (crcMatch) {
+      sstr.clear();
+      sstr.append(data, len/3);
+      if (len/3 > 0) {
+        sstr[0] = data[0];  // drops the accumulated CRC
+      }
+      sstr.append(data+len/3, len-len/3);
+      crcMatch = sstr.size() == len && sstr.calcCrc() == expectCrc;
+      sstr.clear();
+      sstr.append(data, len/3);
+      sstr.append(data+len/3, len-len/3);
+      crcMatch = crcMatch && sstr.size() == len && sstr.calcCrc() == expectCrc;
+    }
+    if (crcMatch && len > 5) {
+      // modify a symbol in the middle and back again to enforce recalculation
+      mstr[len/2] = (symbol_t)(data[len/2]+1);
+      crcMatch = mstr.calcCrc() != expectCrc;
+      mstr[len/2] = data[len/2];
+      crcMatch = crcMatch && mstr.calcCrc() == expectCrc;
+    }
+  }
+  if (crcMatch) {
+    cout << "CRC kernel OK" << endl;
+  } else {
+    cout << "CRC kernel error" << endl;
+    error = true;
+  }
+
+  // check the hex kernels against the stream conversion for all lengths around the block size
+  bool hexMatch = true;
+  for (size_t len = 0; len < 70 && hexMatch; len++) {
+    symbol_t data[70], parsed[70];
+    ostringstream ostr;
+    for (size_t pos = 0; pos < len; pos++) {
+      seed = seed * 1103515245 + 12345;
+      data[pos] = (symbol_t)(seed >> 16);
+      ostr << nouppercase << setw(2) << hex << setfill('0') << static_cast<unsigned>(data[pos]);
+    }
+    string encoded;
+    SymbolString::encodeHex(data, len, &encoded);
+    size_t count = 0;
+    hexMatch = encoded == ostr.str() && SymbolString::decodeHex(encoded.data(), encoded.size(), parsed, &count)
+        == RESULT_OK && count == len && memcmp(data, parsed, len) == 0;
+    for (char& ch : encoded) {
+      ch = static_cast<char>(toupper(ch));
+    }
+    hexMatch = hexMatch && SymbolString::decodeHex(encoded.data(), encoded.size(), parsed, &count) == RESULT_OK
+        && count == len && memcmp(data, parsed, len) == 0;
+    if (hexMatch && len > 0) {
+      encoded[len] = 'g';
+      hexMatch = SymbolString::decodeHex(encoded.data(), encoded.size(), parsed, &count) == RESULT_ERR_INVALID_NUM
+          && count == len/2 && memcmp(data, parsed, count) == 0;
+    }
+  }
+  mstr.clear();
+  hexMatch = hexMatch && mstr.parseHex("10fe5") == RESULT_OK && mstr.getStr() == "10fe05"
+      && mstr.getStr(2) == "05" && mstr.parseHex("1x") == RESULT_ERR_INVALID_NUM;
+  if (hexMatch) {
+    cout << "hex kernel OK" << endl;
+  } else {
+    cout << "hex kernel error" << endl;
+    error = true;
+  }
+
+  // split telegrams from escaped bus symbols including a repetition of the slave part after a NAK
+  MasterSymbolString expectMaster;
+  SlaveSymbolString expectSlave;
+  expectMaster.parseHex("1008b5110101");
+  expectSlave.parseHex("03a90aaa");
+  vector<symbol_t> bus;
+  auto appendEscaped = [&bus](const SymbolString& part, symbol_t crc) {
+    for (size_t pos = 0; pos <= part.size(); pos++) {
+      symbol_t value = pos < part.size() ? part[pos] : crc;
+      if (value == ESC || value == SYN) {
+        bus.push_back(ESC);
+        bus.push_back(value == ESC ? 0x00 : 0x01);
+      } else {
+        bus.push_back(value);
+      }
+    }
+  };
+  bus.push_back(SYN);
+  appendEscaped(expectMaster, expectMaster.calcCrc());
+  bus.push_back(ACK);
+  appendEscaped(expectSlave, (symbol_t)(expectSlave.calcCrc()+1));
+  bus.push_back(NAK);
+  appendEscaped(expectSlave, expectSlave.calcCrc());
+  bus.push_back(ACK);
+  bus.push_back(SYN);
+  result = splitTelegram(bus.data(), bus.size(), &mstr, &sstr);
+  verify(false, "split", "MS repeated", result == RESULT_OK, expectMaster.getStr() + "/" + expectSlave.getStr(),
+      mstr.getStr() + "/" + sstr.getStr());
+  result = splitTelegram(bus.data(), bus.size()-8, &mstr, &sstr);
+  verify(false, "split", "MS incomplete", result == RESULT_ERR_EOF, "", "");
+  bus[bus.size()-2] = NAK;
+  result = splitTelegram(bus.data(), bus.size(), &mstr, &sstr);
+  verify(false, "split", "MS twice NAK", result == RESULT_ERR_NAK, "", "");
+  bus.clear();
+  expectMaster.clear();
+  expectMaster.parseHex("10feb5050427a915aa");
+  appendEscaped(expectMaster, expectMaster.calcCrc());
+  bus.push_back(SYN);
+  result = splitTelegram(bus.data(), bus.size(), &mstr, &sstr);
+  verify(false, "split", "BC", result == RESULT_OK, expectMaster.getStr() + "/", mstr.getStr() + "/" + sstr.getStr());
+  bus[3]++;  // corrupt SB
+  result = splitTelegram(bus.data(), bus.size(), &mstr, &sstr);
+  verify(false, "split", "BC CRC", result == RESULT_ERR_CRC, "", "");
+  result = splitTelegram(bus.data(), 0, &mstr, &sstr);
+  verify(false, "split", "empty", result == RESULT_EMPTY, "", "");
+
   int masterCnt = 0, slaveCnt = 0;
   for (int i=0; i<256; i++) {
     symbol_t address = static_cast<symbol_t>(i);
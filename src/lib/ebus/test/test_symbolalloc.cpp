@@ -0,0 +1,145 @@
+/*
+ * ebusd - daemon for communication with eBUS heating systems.
+ * Copyright (C) 2014-2020 John Baier <ebusd@ebusd.eu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <time.h>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include "lib/ebus/symbol.h"
+
+using namespace ebusd;
+using std::cout;
+using std::endl;
+
+/** the number of heap allocations done via operator new. */
+static size_t allocations = 0;
+
+void* operator new(size_t size) {
+  allocations++;
+  void* ptr = malloc(size == 0 ? 1 : size);
+  if (!ptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+void* operator new[](size_t size) {
+  return operator new(size);
+}
+
+void operator delete(void* ptr) noexcept {
+  free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+  free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+  free(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept {
+  free(ptr);
+}
+
+/** the number of telegrams to process for the benchmark. */
+#define TELEGRAM_COUNT 100000
+
+static bool error = false;
+
+/**
+ * Process a single telegram the way it is done on the per-telegram path, i.e. receive the master and slave parts
+ * symbol by symbol, verify the CRCs and copy both to the last seen data.
+ * @param number the number of the telegram for varying the content.
+ * @param lastMaster the last seen master part to update.
+ * @param lastSlave the last seen slave part to update.
+ * @return the combined CRCs for making sure the work is not optimized away.
+ */
+static unsigned int processTelegram(unsigned int number, MasterSymbolString* lastMaster,
+    SlaveSymbolString* lastSlave) {
+  MasterSymbolString master;
+  SlaveSymbolString slave;
+  master.push_back(0x10);
+  master.push_back(0x08);
+  master.push_back(0xb5);
+  master.push_back(0x09);
+  master.push_back(16);
+  for (unsigned int i = 0; i < 16; i++) {
+    master.push_back((symbol_t)(number+i));
+  }
+  slave.push_back(16);
+  for (unsigned int i = 0; i < 16; i++) {
+    slave.push_back((symbol_t)(number*i));
+  }
+  unsigned int crc = master.calcCrc() + slave.calcCrc();
+  if (master.compareTo(*lastMaster) != 0) {
+    *lastMaster = master;
+  }
+  if (slave.compareTo(*lastSlave) != 0) {
+    *lastSlave = slave;
+  }
+  return crc + static_cast<unsigned int>(lastMaster->getDataSize()) + lastSlave->dataAt(0);
+}
+
+int main() {
+  // check that longer strings exceeding the inline storage still keep all symbols
+  MasterSymbolString longer;
+  for (unsigned int i = 0; i < 3*SYMBOL_STRING_INLINE_SIZE; i++) {
+    longer.push_back((symbol_t)i);
+  }
+  MasterSymbolString copy;
+  copy = longer;
+  bool match = copy.size() == 3*SYMBOL_STRING_INLINE_SIZE && copy == longer;
+  for (unsigned int i = 0; match && i < 3*SYMBOL_STRING_INLINE_SIZE; i++) {
+    match = copy[i] == (symbol_t)i;
+  }
+  copy.clear();
+  copy.push_back(0x01);
+  longer = copy;
+  const MasterSymbolString& shorter = longer;
+  match = match && shorter.size() == 1 && shorter[0] == 0x01 && shorter[1] == SYN;
+  if (match) {
+    cout << "long string: OK" << endl;
+  } else {
+    cout << "long string: error" << endl;
+    error = true;
+  }
+
+  MasterSymbolString lastMaster;
+  SlaveSymbolString lastSlave;
+  unsigned int check = 0;
+  struct timespec start, end;
+  size_t before = allocations;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (unsigned int i = 0; i < TELEGRAM_COUNT; i++) {
+    check += processTelegram(i, &lastMaster, &lastSlave);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  size_t count = allocations - before;
+  double ns = static_cast<double>((end.tv_sec-start.tv_sec)*1000000000LL + (end.tv_nsec-start.tv_nsec));
+  cout << "benchmark " << TELEGRAM_COUNT << " telegrams: " << count << " allocations, "
+       << (ns / TELEGRAM_COUNT) << " ns per telegram (check " << check << ")" << endl;
+  if (count > 0) {
+    cout << "allocations: error got " << count << ", expected 0" << endl;
+    error = true;
+  } else {
+    cout << "allocations: OK" << endl;
+  }
+  return error ? 1 : 0;
+}
@@ -44,4 +44,12 @@ void clockGettime(struct timespec* t) {
 #endif
 }
 
+void clockGettimeMonotonic(struct timespec* t) {
+#if defined(__MACH__) || !defined(CLOCK_MONOTONIC)
+  clockGettime(t);
+#else
+  clock_gettime(CLOCK_MONOTONIC, t);
+#endif
+}
+
 }  // namespace ebusd
@@ -31,6 +31,12 @@ namespace ebusd {
  */
 void clockGettime(struct timespec* t);
 
+/**
+ * Get the monotonic system clock (falls back to the real time system clock where not available).
+ * @param t the @a timespec in which to store the time.
+ */
+void clockGettimeMonotonic(struct timespec* t);
+
 }  // namespace ebusd
 
 #endif  // LIB_UTILS_CLOCK_H_
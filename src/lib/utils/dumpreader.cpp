@@ -0,0 +1,146 @@
+/*
+ * ebusd - daemon for communication with eBUS heating systems.
+ * Copyright (C) 2021 John Baier <ebusd@ebusd.eu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lib/utils/dumpreader.h"
+#include <unistd.h>
+#include <cstring>
+#include "lib/utils/clock.h"
+#include "lib/utils/rotatefile.h"
+
+namespace ebusd {
+
+/** the maximum time in microseconds to wait in a single call to usleep(). */
+#define DUMP_READER_MAX_SLEEP 1000000
+
+/**
+ * Get the monotonic time in microseconds.
+ * @return the monotonic time in microseconds.
+ */
+static uint64_t getMonotonicMicros() {
+  struct timespec ts;
+  clockGettimeMonotonic(&ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000ULL + static_cast<uint64_t>(ts.tv_nsec / 1000);
+}
+
+DumpReader::~DumpReader() {
+  if (m_stream) {
+    fclose(m_stream);
+    m_stream = nullptr;
+  }
+}
+
+bool DumpReader::open() {
+  if (m_stream) {
+    fclose(m_stream);
+  }
+  m_stream = fopen(m_fileName.c_str(), "rb");
+  if (!m_stream) {
+    return false;
+  }
+  char magic[ROTATE_FILE_TIMED_MAGIC_LEN];
+  m_timed = fread(magic, 1, sizeof(magic), m_stream) == sizeof(magic)
+    && memcmp(magic, ROTATE_FILE_TIMED_MAGIC, sizeof(magic)) == 0;
+  if (!m_timed) {
+    rewind(m_stream);
+  }
+  m_passes = 0;
+  m_passHasRecords = false;
+  m_firstTimestamp = 0;
+  return true;
+}
+
+bool DumpReader::next(vector<uint8_t>* data, uint64_t* timestamp) {
+  if (!m_stream) {
+    return false;
+  }
+  uint64_t recordTime = 0;
+  while (!readRecord(data, &recordTime)) {
+    m_passes++;
+    if ((m_count > 0 && m_passes >= m_count) || !m_passHasRecords) {
+      return false;  // done or nothing readable at all
+    }
+    fseek(m_stream, m_timed ? ROTATE_FILE_TIMED_MAGIC_LEN : 0, SEEK_SET);
+    m_passHasRecords = false;
+    m_firstTimestamp = 0;
+  }
+  m_passHasRecords = true;
+  if (m_timed) {
+    waitFor(recordTime);
+  }
+  if (timestamp) {
+    *timestamp = recordTime;
+  }
+  return true;
+}
+
+bool DumpReader::readRecord(vector<uint8_t>* data, uint64_t* timestamp) {
+  data->clear();
+  if (!m_timed) {
+    int ch;
+    while ((ch = fgetc(m_stream)) != EOF) {
+      data->push_back(static_cast<uint8_t>(ch));
+      if (ch == ROTATE_FILE_TIMED_DELIMITER) {
+        break;
+      }
+    }
+    *timestamp = 0;
+    return !data->empty();
+  }
+  uint8_t header[10];
+  if (fread(header, 1, sizeof(header), m_stream) != sizeof(header)) {
+    return false;
+  }
+  if (memcmp(header, ROTATE_FILE_TIMED_MAGIC, ROTATE_FILE_TIMED_MAGIC_LEN) == 0) {
+    // magic of a concatenated file
+    fseek(m_stream, static_cast<long>(ROTATE_FILE_TIMED_MAGIC_LEN) - static_cast<long>(sizeof(header)), SEEK_CUR);
+    return readRecord(data, timestamp);
+  }
+  uint64_t micros = 0;
+  for (size_t pos = 0; pos < 8; pos++) {
+    micros |= static_cast<uint64_t>(header[pos]) << (8 * pos);
+  }
+  size_t length = static_cast<size_t>(header[8]) | (static_cast<size_t>(header[9]) << 8);
+  data->resize(length);
+  if (length > 0 && fread(data->data(), 1, length, m_stream) != length) {
+    data->clear();
+    return false;
+  }
+  *timestamp = micros;
+  return true;
+}
+
+void DumpReader::waitFor(uint64_t timestamp) {
+  uint64_t now = getMonotonicMicros();
+  if (m_firstTimestamp == 0 || timestamp < m_firstTimestamp) {
+    // first record of a pass or clock jumped backwards
+    m_firstTimestamp = timestamp;
+    m_startTime = now;
+    return;
+  }
+  if (m_speed <= 0) {
+    return;
+  }
+  uint64_t due = m_startTime + static_cast<uint64_t>(static_cast<double>(timestamp - m_firstTimestamp) / m_speed);
+  while (now < due) {
+    uint64_t remain = due - now;
+    usleep(static_cast<useconds_t>(remain > DUMP_READER_MAX_SLEEP ? DUMP_READER_MAX_SLEEP : remain));
+    now = getMonotonicMicros();
+  }
+}
+
+}  // namespace ebusd
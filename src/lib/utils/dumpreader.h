@@ -0,0 +1,134 @@
+/*
+ * ebusd - daemon for communication with eBUS heating systems.
+ * Copyright (C) 2021 John Baier <ebusd@ebusd.eu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIB_UTILS_DUMPREADER_H_
+#define LIB_UTILS_DUMPREADER_H_
+
+#include <stdint.h>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace ebusd {
+
+/** \file lib/utils/dumpreader.h
+ * Helper for replaying dump files as written by @a RotateFile.
+ */
+
+using std::string;
+using std::vector;
+
+/**
+ * Helper class for reading a dump file written by @a RotateFile (either in plain binary or in the timed format) in
+ * chunks of single telegrams.
+ *
+ * In the timed format, @a next() waits until the record is due according to the original timestamps relative to the
+ * first record divided by the speed factor.
+ */
+class DumpReader {
+ public:
+  /**
+   * Construct a new instance.
+   * @param fileName the name of the dump file to read.
+   * @param speed the factor for speeding up the original timing (e.g. 10 for ten times faster),
+   * or 0 for reading as fast as possible.
+   * @param count the number of times to read the file, or 0 for endless looping.
+   */
+  DumpReader(const string& fileName, double speed = 1, unsigned int count = 1)
+    : m_fileName(fileName), m_speed(speed), m_count(count), m_stream(nullptr), m_timed(false), m_passes(0),
+      m_passHasRecords(false), m_firstTimestamp(0), m_startTime(0) {}
+
+  /**
+   * Destructor.
+   */
+  virtual ~DumpReader();
+
+  /**
+   * Open the dump file and determine its format.
+   * @return true on success.
+   */
+  bool open();
+
+  /**
+   * Return whether the dump file is in the timed format.
+   * @return whether the dump file is in the timed format.
+   */
+  bool isTimed() const { return m_timed; }
+
+  /**
+   * Return the number of times the end of the file was reached so far.
+   * @return the number of times the end of the file was reached so far.
+   */
+  unsigned int getPasses() const { return m_passes; }
+
+  /**
+   * Read the next telegram from the dump file, waiting until it is due in the timed format.
+   * @param data the vector to fill with the bytes of the telegram (up to and including the ending SYN symbol).
+   * @param timestamp optional pointer to the variable in which to store the original timestamp in microseconds since
+   * the epoch (0 if the dump file is not in the timed format).
+   * @return true when a telegram was read, false at the end of the file (after the last loop) or on error.
+   */
+  bool next(vector<uint8_t>* data, uint64_t* timestamp = nullptr);
+
+
+ private:
+  /**
+   * Read the next record from the current position.
+   * @param data the vector to fill with the bytes.
+   * @param timestamp the variable in which to store the original timestamp.
+   * @return true when a record was read, false at the end of the file.
+   */
+  bool readRecord(vector<uint8_t>* data, uint64_t* timestamp);
+
+  /**
+   * Wait until the record with the timestamp is due.
+   * @param timestamp the original timestamp of the record in microseconds.
+   */
+  void waitFor(uint64_t timestamp);
+
+  /** the name of the dump file to read. */
+  const string m_fileName;
+
+  /** the factor for speeding up the original timing, or 0 for reading as fast as possible. */
+  const double m_speed;
+
+  /** the number of times to read the file, or 0 for endless looping. */
+  const unsigned int m_count;
+
+  /** the opened file, or nullptr. */
+  FILE* m_stream;
+
+  /** whether the dump file is in the timed format. */
+  bool m_timed;
+
+  /** the number of times the end of the file was reached so far. */
+  unsigned int m_passes;
+
+  /** whether at least one record was read in the current pass. */
+  bool m_passHasRecords;
+
+  /** the original timestamp of the first record in the current pass in microseconds, or 0. */
+  uint64_t m_firstTimestamp;
+
+  /** the monotonic time in microseconds at which the first record of the current pass was returned. */
+  uint64_t m_startTime;
+};
+
+}  // namespace ebusd
+
+#endif  // LIB_UTILS_DUMPREADER_H_
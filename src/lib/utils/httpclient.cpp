@@ -17,7 +17,10 @@
  */
 
 #include "lib/utils/httpclient.h"
+#include <strings.h>
 #include <cstring>
+#include <cstdio>
+#include <ctime>
 #include <cstdlib>
 #include <sstream>
 
@@ -71,15 +74,13 @@ bool HttpClient::parseUrl(const string& url, string* proto, string* host, uint16
 
 bool HttpClient::connect(const string& host, const uint16_t port, const string& userAgent, const int timeout) {
   disconnect();
-  m_socket = m_client.connect(host, port, timeout);
-  if (!m_socket) {
-    return false;
-  }
+  // remember the target even on failure for a later reconnect
   m_host = host;
   m_port = port;
   m_timeout = timeout;
   m_userAgent = userAgent;
-  return true;
+  m_socket = m_client.connect(host, port, timeout);
+  return m_socket != nullptr;
 }
 
 bool HttpClient::reconnect() {
@@ -112,6 +113,10 @@ bool HttpClient::get(const string& uri, const string& body, string* response, ti
   return request("GET", uri, body, response, time);
 }
 
+bool HttpClient::getIfModified(const string& uri, string* response, time_t* time, string* etag, bool* notModified) {
+  return request("GET", uri, "", response, time, etag, notModified);
+}
+
 bool HttpClient::post(const string& uri, const string& body, string* response) {
   return request("POST", uri, body, response);
 }
@@ -123,17 +128,68 @@ const int indexToMonth[] = {
   -1, -1,  4, -1, -1, -1, -1, -1,  // 24-31
 };
 
-bool HttpClient::request(const string& method, const string& uri, const string& body, string* response, time_t* time) {
-  if (!ensureConnected()) {
-    *response = "not connected";
-    return false;
+const char* const dayNames[] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+
+const char* const monthNames[] = {
+  "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec",
+};
+
+/**
+ * Find a header in the received headers.
+ * @param headers the received headers starting with the status line and ending with "\r\n".
+ * @param name the header name including the trailing colon.
+ * @return the position of the header value, or string::npos if not found.
+ */
+static size_t findHeader(const string& headers, const char* name) {
+  size_t len = strlen(name);
+  for (size_t pos = headers.find("\r\n"); pos != string::npos; pos = headers.find("\r\n", pos+2)) {
+    if (pos+2+len <= headers.length() && strncasecmp(headers.c_str()+pos+2, name, len) == 0) {
+      pos += 2+len;
+      while (pos < headers.length() && headers[pos] == ' ') {
+        pos++;
+      }
+      return pos;
+    }
   }
+  return string::npos;
+}
+
+/**
+ * Get the value of a header in the received headers.
+ * @param headers the received headers starting with the status line and ending with "\r\n".
+ * @param name the header name including the trailing colon.
+ * @return the header value, or empty if not found.
+ */
+static string getHeader(const string& headers, const char* name) {
+  size_t pos = findHeader(headers, name);
+  if (pos == string::npos) {
+    return "";
+  }
+  return headers.substr(pos, headers.find("\r\n", pos)-pos);
+}
+
+bool HttpClient::request(const string& method, const string& uri, const string& body, string* response, time_t* time,
+    string* etag, bool* notModified) {
   ostringstream ostr;
-  ostr << method << " " << uri << " HTTP/1.0\r\n"
+  ostr << method << " " << uri << " HTTP/1.1\r\n"
        << "Host: " << m_host << "\r\n";
   if (!m_userAgent.empty()) {
     ostr << "User-Agent: " << m_userAgent << "\r\n";
   }
+  if (notModified) {
+    *notModified = false;
+    if (etag && !etag->empty()) {
+      ostr << "If-None-Match: " << *etag << "\r\n";
+    }
+    if (time && *time > 0) {
+      struct tm t;
+      gmtime_r(time, &t);
+      char str[32];
+      snprintf(str, sizeof(str), "%s, %02d %s %04d %02d:%02d:%02d GMT", dayNames[t.tm_wday], t.tm_mday,
+          monthNames[t.tm_mon], t.tm_year+1900, t.tm_hour, t.tm_min, t.tm_sec);
+      ostr << "If-Modified-Since: " << str << "\r\n";
+    }
+  }
   if (body.empty()) {
     ostr << "\r\n";
   } else {
@@ -145,28 +201,44 @@ bool HttpClient::request(const string& method, const string& uri, const string&
   string str = ostr.str();
   size_t len = str.size();
   const char* cstr = str.c_str();
-  for (size_t pos = 0; pos < len; ) {
-    ssize_t sent = m_socket->send(cstr + pos, len - pos);
-    if (sent < 0) {
-      disconnect();
-      *response = "send error";
+  string result;
+  size_t pos;
+  // a kept alive connection might have been closed by the server in the meantime, so retry once on a new one
+  bool reused = m_socket && m_socket->isValid();
+  while (true) {
+    if (!ensureConnected()) {
+      *response = "not connected";
       return false;
     }
-    pos += sent;
-  }
-  string result;
-  size_t pos = readUntil(" ", 4 * 1024, &result);  // max 4k headers
-  if (pos == string::npos || pos > 8 || result.substr(0, 5) != "HTTP/") {
+    bool sent = true;
+    for (pos = 0; pos < len; ) {
+      ssize_t count = m_socket->send(cstr + pos, len - pos);
+      if (count < 0) {
+        sent = false;
+        break;
+      }
+      pos += count;
+    }
+    result.clear();
+    pos = sent ? readUntil(" ", 4 * 1024, &result) : string::npos;  // max 4k headers
+    if (pos != string::npos && pos <= 8 && result.substr(0, 5) == "HTTP/") {
+      break;
+    }
     disconnect();
-    *response = "receive error (headers)";
-    return false;
+    if (!reused || !result.empty()) {
+      *response = sent ? "receive error (headers)" : "send error";
+      return false;
+    }
+    reused = false;
   }
-  if (result.substr(pos+1, 6) != "200 OK") {
+  bool isNotModified = notModified && result.substr(pos+1, 3) == "304";
+  if (!isNotModified && result.substr(pos+1, 6) != "200 OK") {
     disconnect();
     size_t endpos = result.find("\r\n", pos+1);
     *response = "receive error: " + result.substr(pos+1, endpos == string::npos ? endpos : endpos-pos-1);
     return false;
   }
+  bool keepAlive = result.substr(0, pos) == "HTTP/1.1";
   pos = readUntil("\r\n\r\n", 4 * 1024, &result);  // max 4k headers
   if (pos == string::npos) {
     disconnect();
@@ -175,13 +247,19 @@ bool HttpClient::request(const string& method, const string& uri, const string&
   }
   string headers = result.substr(0, pos+2);  // including final \r\n
   const char* hdrs = headers.c_str();
-  *response = result.substr(pos+4);
+  result.erase(0, pos+4);
+  if (strcasecmp(getHeader(headers, "Connection:").c_str(), "close") == 0) {
+    keepAlive = false;
+  }
+  if (etag) {
+    *etag = getHeader(headers, "ETag:");
+  }
   if (time) {
-    pos = headers.find("\r\nLast-Modified: ");
-    if (pos != string::npos && headers.substr(pos+42, 4) == " GMT") {
+    pos = findHeader(headers, "Last-Modified:");
+    if (pos != string::npos && headers.substr(pos+25, 4) == " GMT") {
       // Last-Modified: Wed, 21 Oct 2015 07:28:00 GMT
       struct tm t;
-      pos += strlen("\r\nLast-Modified: ") + 5;
+      pos += 5;
       char* strEnd = nullptr;
       t.tm_mday = static_cast<int>(strtol(hdrs + pos, &strEnd, 10));
       if (strEnd != hdrs + pos + 2 || t.tm_mday < 1 || t.tm_mday > 31) {
@@ -215,21 +293,87 @@ bool HttpClient::request(const string& method, const string& uri, const string&
       }
     }
   }
-  pos = headers.find("\r\nContent-Length: ");
+  if (isNotModified) {
+    // no body for 304
+    *notModified = true;
+    if (!keepAlive) {
+      disconnect();
+    }
+    return true;
+  }
+  if (strcasecmp(getHeader(headers, "Transfer-Encoding:").c_str(), "chunked") == 0) {
+    bool ret = readChunked(&result, response);
+    if (!ret) {
+      *response = "receive error (chunked)";
+    }
+    if (!ret || !keepAlive) {
+      disconnect();
+    }
+    return ret;
+  }
+  pos = findHeader(headers, "Content-Length:");
   if (pos == string::npos) {
+    // body ends with the connection
+    readUntil("", string::npos, &result);
     disconnect();
+    *response = result;
     return true;
   }
   char* strEnd = nullptr;
-  unsigned long length = strtoul(hdrs + pos + strlen("\r\nContent-Length: "), &strEnd, 10);
+  unsigned long length = strtoul(hdrs + pos, &strEnd, 10);
   if (strEnd == nullptr || *strEnd != '\r') {
     disconnect();
     *response = "invalid content length ";
     return false;
   }
-  pos = readUntil("", length, response);
-  disconnect();
-  return pos == length;
+  pos = readUntil("", length, &result);
+  if (pos < length || !keepAlive) {
+    disconnect();
+  }
+  if (pos < length) {
+    *response = "receive error (body)";
+    return false;
+  }
+  result.resize(length);
+  *response = result;
+  return true;
+}
+
+bool HttpClient::readChunked(string* buffer, string* response) {
+  response->clear();
+  size_t pos = 0;
+  while (true) {
+    size_t end = readUntil("\r\n", string::npos, buffer);
+    if (end == string::npos) {
+      return false;
+    }
+    char* strEnd = nullptr;
+    unsigned long size = strtoul(buffer->c_str()+pos, &strEnd, 16);
+    if (strEnd == buffer->c_str()+pos) {
+      return false;
+    }
+    pos = end+2;
+    if (size == 0) {
+      // skip optional trailers up to the final empty line
+      buffer->erase(0, pos);
+      while (true) {
+        end = readUntil("\r\n", string::npos, buffer);
+        if (end == string::npos) {
+          return false;
+        }
+        if (end == 0) {
+          return true;
+        }
+        buffer->erase(0, end+2);
+      }
+    }
+    if (readUntil("", pos+size+2, buffer) < pos+size+2) {
+      return false;
+    }
+    response->append(*buffer, pos, size);
+    buffer->erase(0, pos+size+2);
+    pos = 0;
+  }
 }
 
 size_t HttpClient::readUntil(const string& delim, const size_t length, string* result) {
@@ -253,7 +397,7 @@ size_t HttpClient::readUntil(const string& delim, const size_t length, string* r
     size_t oldLength = result->length();
     *result += string(m_buffer, 0, static_cast<unsigned>(received));
     if (findDelim) {
-      pos = result->find(delim, oldLength - (delim.length() - 1));
+      pos = result->find(delim, oldLength < delim.length() ? 0 : oldLength - (delim.length() - 1));
     }
   }
   return findDelim ? pos : result->length();
@@ -104,6 +104,19 @@ class HttpClient {
    */
   bool get(const string& uri, const string& body, string* response, time_t* time = nullptr);
 
+  /**
+   * Execute a conditional GET request only retrieving the content when it differs from a cached copy.
+   * @param uri the URI string.
+   * @param response the response body from the server (or the HTTP header on error), unchanged when not modified.
+   * @param time pointer to the modification time of the cached copy or 0 if unknown, updated with the modification
+   * time of the file.
+   * @param etag pointer to the entity tag of the cached copy or empty if unknown, updated with the entity tag of the
+   * file.
+   * @param notModified pointer to a bool to set to true when the cached copy is still valid.
+   * @return true on success (including when not modified), false on error.
+   */
+  bool getIfModified(const string& uri, string* response, time_t* time, string* etag, bool* notModified);
+
   /**
    * Execute a POST request.
    * @param uri the URI string.
@@ -120,9 +133,13 @@ class HttpClient {
    * @param body the optional body to send.
    * @param response the response body from the server (or the HTTP header on error).
    * @param time optional pointer to a @a time_t value for storing the modification time of the file, or nullptr.
+   * @param etag optional pointer to a string for storing the entity tag of the file, or nullptr.
+   * @param notModified optional pointer to a bool to set when the server answered "304 Not Modified" for the
+   * modification time and entity tag passed in @a time and @a etag, or nullptr for an unconditional request.
    * @return true on success, false on error.
    */
-  bool request(const string& method, const string& uri, const string& body, string* response, time_t* time = nullptr);
+  bool request(const string& method, const string& uri, const string& body, string* response, time_t* time = nullptr,
+      string* etag = nullptr, bool* notModified = nullptr);
 
  private:
   /**
@@ -134,14 +151,22 @@ class HttpClient {
    */
   size_t readUntil(const string& delim, const size_t length, string* result);
 
+  /**
+   * Read a body with chunked transfer encoding from the connected socket.
+   * @param buffer the data already received after the headers, used for further receiving.
+   * @param response the string in which to store the decoded body.
+   * @return true on success, false on error.
+   */
+  bool readChunked(string* buffer, string* response);
+
  private:
   /** the @a TCPClient handling the traffic. */
   TCPClient m_client;
 
-  /** the name of the host last successfully connected to. */
+  /** the name of the host last connected to. */
   string m_host;
 
-  /** the port last successfully connected to. */
+  /** the port last connected to. */
   uint16_t m_port;
 
   /** the timeout in seconds. */
@@ -28,6 +28,8 @@
 #include <stdarg.h>
 #include <string.h>
 #include <syslog.h>
+#include <pthread.h>
+#include <atomic>
 #include "lib/utils/clock.h"
 
 namespace ebusd {
@@ -72,6 +74,74 @@ static FILE* s_logFile = stdout;
 /** whether to log to syslog. */
 static bool s_useSyslog = false;
 
+/** the number of slots in the asynchronous log ring buffer. */
+#define LOG_RING_SLOTS 512
+
+/** the maximum length of a single line in the asynchronous log ring buffer (including the terminating 0). */
+#define LOG_SLOT_SIZE 1024
+
+/** the maximum length of a facility name in the asynchronous log ring buffer (including the terminating 0). */
+#define LOG_FACILITY_SIZE 16
+
+/** the maximum time in milliseconds the asynchronous log writer waits for new lines before looking again. */
+#define LOG_WRITER_WAIT 100
+
+/**
+ * A slot in the asynchronous log ring buffer.
+ */
+struct LogSlot {
+  /** the sequence number for synchronizing the producers and the writer. */
+  std::atomic<size_t> sequence;
+
+  /** the time of the log line. */
+  struct timespec time;
+
+  /** the facility name. */
+  char facility[LOG_FACILITY_SIZE];
+
+  /** the @a LogLevel. */
+  LogLevel level;
+
+  /** the formatted message. */
+  char text[LOG_SLOT_SIZE];
+};
+
+/** whether to write the log asynchronously. */
+static std::atomic<bool> s_logAsync(false);
+
+/** the asynchronous log ring buffer, or nullptr. */
+static LogSlot* s_logRing = nullptr;
+
+/** the position of the next slot to claim by a producer. */
+static std::atomic<size_t> s_logEnqueuePos(0);
+
+/** the position of the next slot to write (only accessed with @a s_logWriteMutex locked). */
+static size_t s_logDequeuePos = 0;
+
+/** the number of log lines dropped due to a full ring buffer. */
+static std::atomic<unsigned long> s_logDropped(0);
+
+/** the number of dropped log lines already reported (only accessed with @a s_logWriteMutex locked). */
+static unsigned long s_logDroppedReported = 0;
+
+/** whether the writer thread is waiting for new lines. */
+static std::atomic<bool> s_logWriterIdle(false);
+
+/** whether the writer thread was started. */
+static bool s_logWriterStarted = false;
+
+/** the mutex for writing the ring buffer and changing the log file. */
+static pthread_mutex_t s_logWriteMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** the condition for waking up the writer thread. */
+static pthread_cond_t s_logWriterCond = PTHREAD_COND_INITIALIZER;
+
+/** the second of the cached timestamp prefix (only accessed with @a s_logWriteMutex locked). */
+static time_t s_logPrefixSecond = -1;
+
+/** the cached timestamp prefix up to the seconds (only accessed with @a s_logWriteMutex locked). */
+static char s_logPrefix[32];
+
 LogFacility parseLogFacility(const char* facility) {
   if (!facility) {
     return lf_COUNT;
@@ -145,23 +215,39 @@ LogLevel getFacilityLogLevel(LogFacility facility) {
   return s_facilityLogLevel[facility];
 }
 
+/**
+ * Close the log file if necessary (with @a s_logWriteMutex locked).
+ */
+static void closeLogFileLocked();
+
 bool setLogFile(const char* filename) {
   if (filename[0] == 0) {
-    closeLogFile();
+    pthread_mutex_lock(&s_logWriteMutex);
+    closeLogFileLocked();
     openlog("ebusd", LOG_NDELAY|LOG_PID, LOG_USER);
     s_useSyslog = true;
+    pthread_mutex_unlock(&s_logWriteMutex);
     return true;
   }
   FILE* newFile = fopen(filename, "a");
   if (newFile == nullptr) {
     return false;
   }
-  closeLogFile();
+  pthread_mutex_lock(&s_logWriteMutex);
+  closeLogFileLocked();
   s_logFile = newFile;
+  pthread_mutex_unlock(&s_logWriteMutex);
   return true;
 }
 
-void closeLogFile() {
+/**
+ * Write all lines pending in the ring buffer (with @a s_logWriteMutex locked).
+ * @return the number of lines written.
+ */
+static size_t flushLogLocked();
+
+static void closeLogFileLocked() {
+  flushLogLocked();
   if (s_logFile != nullptr) {
     if (s_logFile != stdout) {
       fclose(s_logFile);
@@ -174,6 +260,167 @@ void closeLogFile() {
   }
 }
 
+void closeLogFile() {
+  pthread_mutex_lock(&s_logWriteMutex);
+  closeLogFileLocked();
+  pthread_mutex_unlock(&s_logWriteMutex);
+}
+
+/**
+ * Write a single log line to the log file or syslog (with @a s_logWriteMutex locked).
+ * @param time the time of the log line.
+ * @param facility the facility name.
+ * @param level the @a LogLevel.
+ * @param text the formatted message.
+ */
+static void writeLogLine(const struct timespec& time, const char* facility, const LogLevel level, const char* text) {
+  if (s_useSyslog) {
+    syslog(s_syslogLevels[level], "[%s %s] %s", facility, s_levelNames[level], text);
+    return;
+  }
+  if (time.tv_sec != s_logPrefixSecond) {
+    struct tm td;
+    localtime_r(&time.tv_sec, &td);
+    strftime(s_logPrefix, sizeof(s_logPrefix), "%Y-%m-%d %H:%M:%S", &td);
+    s_logPrefixSecond = time.tv_sec;
+  }
+  fprintf(s_logFile, "%s.%03ld [%s %s] %s\n", s_logPrefix, time.tv_nsec/1000000, facility, s_levelNames[level],
+    text);
+}
+
+static size_t flushLogLocked() {
+  if (!s_logRing || (s_logFile == nullptr && !s_useSyslog)) {
+    return 0;  // keep the lines for a newly opened log file
+  }
+  size_t count = 0;
+  while (true) {
+    LogSlot* slot = &s_logRing[s_logDequeuePos % LOG_RING_SLOTS];
+    if (slot->sequence.load(std::memory_order_acquire) != s_logDequeuePos + 1) {
+      break;  // empty or not yet completely written by the producer
+    }
+    writeLogLine(slot->time, slot->facility, slot->level, slot->text);
+    slot->sequence.store(s_logDequeuePos + LOG_RING_SLOTS, std::memory_order_release);
+    s_logDequeuePos++;
+    count++;
+  }
+  unsigned long dropped = s_logDropped.load(std::memory_order_relaxed);
+  if (dropped != s_logDroppedReported) {
+    struct timespec ts;
+    clockGettime(&ts);
+    char text[64];
+    snprintf(text, sizeof(text), "dropped %lu log lines", dropped - s_logDroppedReported);
+    writeLogLine(ts, s_facilityNames[lf_main], ll_notice, text);
+    s_logDroppedReported = dropped;
+    count++;
+  }
+  if (count > 0 && s_logFile != nullptr) {
+    fflush(s_logFile);
+  }
+  return count;
+}
+
+void flushLog() {
+  pthread_mutex_lock(&s_logWriteMutex);
+  flushLogLocked();
+  pthread_mutex_unlock(&s_logWriteMutex);
+}
+
+/**
+ * The main method of the asynchronous log writer thread.
+ * @return nullptr.
+ */
+static void* runLogWriter(void*) {
+  pthread_mutex_lock(&s_logWriteMutex);
+  while (true) {
+    if (flushLogLocked() > 0) {
+      continue;  // more lines might have been queued meanwhile
+    }
+    struct timespec until;
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_nsec += LOG_WRITER_WAIT * 1000000L;
+    if (until.tv_nsec >= 1000000000L) {
+      until.tv_sec++;
+      until.tv_nsec -= 1000000000L;
+    }
+    s_logWriterIdle.store(true);
+    pthread_cond_timedwait(&s_logWriterCond, &s_logWriteMutex, &until);
+    s_logWriterIdle.store(false);
+  }
+  return nullptr;
+}
+
+bool setLogAsync(bool async) {
+  if (!async) {
+    s_logAsync.store(false);
+    flushLog();
+    return true;
+  }
+  if (!s_logRing) {
+    s_logRing = new LogSlot[LOG_RING_SLOTS];
+    for (size_t pos = 0; pos < LOG_RING_SLOTS; pos++) {
+      s_logRing[pos].sequence.store(pos, std::memory_order_relaxed);
+    }
+  }
+  if (!s_logWriterStarted) {
+    pthread_t thread;
+    if (pthread_create(&thread, nullptr, runLogWriter, nullptr) != 0) {
+      return false;
+    }
+    pthread_detach(thread);
+#ifdef HAVE_PTHREAD_SETNAME_NP
+#ifndef __MACH__
+    pthread_setname_np(thread, "logwriter");
+#endif
+#endif
+    s_logWriterStarted = true;
+    atexit(flushLog);
+  }
+  s_logAsync.store(true);
+  return true;
+}
+
+unsigned long getLogDroppedCount() {
+  return s_logDropped.load(std::memory_order_relaxed);
+}
+
+/**
+ * Queue a log line in the asynchronous log ring buffer.
+ * @param facility the facility name.
+ * @param level the @a LogLevel.
+ * @param message the message format.
+ * @param ap the variable arguments.
+ * @return true when the line was queued, false when the ring buffer is full.
+ */
+static bool queueLogLine(const char* facility, const LogLevel level, const char* message, va_list ap) {
+  size_t pos = s_logEnqueuePos.load(std::memory_order_relaxed);
+  LogSlot* slot;
+  while (true) {
+    slot = &s_logRing[pos % LOG_RING_SLOTS];
+    size_t sequence = slot->sequence.load(std::memory_order_acquire);
+    if (sequence == pos) {
+      if (s_logEnqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (sequence < pos) {
+      return false;  // full
+    } else {
+      pos = s_logEnqueuePos.load(std::memory_order_relaxed);
+    }
+  }
+  clockGettime(&slot->time);
+  strncpy(slot->facility, facility, LOG_FACILITY_SIZE-1);
+  slot->facility[LOG_FACILITY_SIZE-1] = 0;
+  slot->level = level;
+  int length = vsnprintf(slot->text, LOG_SLOT_SIZE, message, ap);
+  if (length < 0) {
+    slot->text[0] = 0;
+  } else if (length >= LOG_SLOT_SIZE) {
+    memcpy(slot->text + LOG_SLOT_SIZE - 4, "...", 4);  // mark truncated
+  }
+  slot->sequence.store(pos + 1, std::memory_order_release);
+  return true;
+}
+
 bool needsLog(const LogFacility facility, const LogLevel level) {
   if (s_logFile == nullptr && !s_useSyslog) {
     return false;
@@ -185,6 +432,14 @@ void logWrite(const char* facility, const LogLevel level, const char* message, v
   if (s_logFile == nullptr && !s_useSyslog) {
     return;
   }
+  if (s_logAsync.load(std::memory_order_relaxed)) {
+    if (!queueLogLine(facility, level, message, ap)) {
+      s_logDropped.fetch_add(1, std::memory_order_relaxed);
+    } else if (s_logWriterIdle.load(std::memory_order_relaxed)) {
+      pthread_cond_signal(&s_logWriterCond);
+    }
+    return;
+  }
   char* buf;
   if (vasprintf(&buf, message, ap) >= 0 && buf) {
     if (s_useSyslog) {
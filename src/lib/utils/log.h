@@ -108,6 +108,26 @@ bool setLogFile(const char* filename);
  */
 void closeLogFile();
 
+/**
+ * Enable or disable writing the log asynchronously.
+ * When enabled, the log lines are queued in a preallocated ring buffer and written in batches by a background thread.
+ * When the ring buffer is full, lines are dropped and counted instead of blocking the logging thread.
+ * @param async true to write asynchronously, false to write synchronously again.
+ * @return true on success, false on error.
+ */
+bool setLogAsync(bool async);
+
+/**
+ * Write all log lines still pending in the ring buffer.
+ */
+void flushLog();
+
+/**
+ * Get the number of log lines dropped so far due to a full ring buffer.
+ * @return the number of dropped log lines.
+ */
+unsigned long getLogDroppedCount();
+
 /**
  * Return whether logging is needed for the specified facility and level.
  * @param facility the @a LogFacility of the message to check.
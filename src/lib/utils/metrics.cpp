@@ -0,0 +1,129 @@
+/*
+ * ebusd - daemon for communication with eBUS heating systems.
+ * Copyright (C) 2021 John Baier <ebusd@ebusd.eu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "lib/utils/metrics.h"
+#include <algorithm>
+#include <cstdio>
+
+namespace ebusd {
+
+void formatMetricHeader(const char* name, const char* type, const char* help, ostream* output) {
+  *output << "# HELP " << name << " " << help << "\n"
+          << "# TYPE " << name << " " << type << "\n";
+}
+
+void formatMetricValue(const string& name, const string& labels, double value, ostream* output) {
+  char str[32];
+  snprintf(str, sizeof(str), "%.9g", value);
+  *output << name;
+  if (!labels.empty()) {
+    *output << "{" << labels << "}";
+  }
+  *output << " " << str << "\n";
+}
+
+string escapeMetricLabel(const string& value) {
+  string ret;
+  ret.reserve(value.length());
+  for (const auto ch : value) {
+    if (ch == '\\' || ch == '"') {
+      ret += '\\';
+      ret += ch;
+    } else if (ch == '\n') {
+      ret += "\\n";
+    } else {
+      ret += ch;
+    }
+  }
+  return ret;
+}
+
+void Counter::format(const char* name, const char* help, ostream* output) const {
+  formatMetricHeader(name, "counter", help, output);
+  formatMetricValue(string(name) + "_total", "", static_cast<double>(get()), output);
+}
+
+Histogram::Histogram(std::initializer_list<uint64_t> bounds, double scale)
+  : m_size(0), m_scale(scale), m_count(0), m_sum(0) {
+  for (const auto bound : bounds) {
+    if (m_size >= HISTOGRAM_MAX_BUCKETS) {
+      break;
+    }
+    m_bounds[m_size++] = bound;
+  }
+  for (auto& bucket : m_buckets) {
+    bucket.store(0, std::memory_order_relaxed);
+  }
+}
+
+void Histogram::observe(uint64_t value) {
+  size_t pos = 0;
+  while (pos < m_size && value > m_bounds[pos]) {
+    pos++;
+  }
+  m_buckets[pos].fetch_add(1, std::memory_order_relaxed);
+  m_sum.fetch_add(value, std::memory_order_relaxed);
+  m_count.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Histogram::format(const char* name, const char* help, const string& labels, ostream* output) const {
+  if (help) {
+    formatMetricHeader(name, "histogram", help, output);
+  }
+  string bucketName = string(name) + "_bucket";
+  string prefix = labels.empty() ? "le=\"" : labels + ",le=\"";
+  uint64_t cumulative = 0;
+  char str[32];
+  for (size_t pos = 0; pos < m_size; pos++) {
+    cumulative += m_buckets[pos].load(std::memory_order_relaxed);
+    snprintf(str, sizeof(str), "%.9g", static_cast<double>(m_bounds[pos]) * m_scale);
+    formatMetricValue(bucketName, prefix + str + "\"", static_cast<double>(cumulative), output);
+  }
+  cumulative += m_buckets[m_size].load(std::memory_order_relaxed);
+  formatMetricValue(bucketName, prefix + "+Inf\"", static_cast<double>(cumulative), output);
+  // use the bucket total as count to stay consistent with the buckets read without locking
+  formatMetricValue(string(name) + "_sum", labels,
+      static_cast<double>(m_sum.load(std::memory_order_relaxed)) * m_scale, output);
+  formatMetricValue(string(name) + "_count", labels, static_cast<double>(cumulative), output);
+}
+
+void PercentileWindow::observe(uint64_t value) {
+  m_values[m_next] = value;
+  m_next = (m_next+1) % PERCENTILE_WINDOW_SIZE;
+  if (m_count < PERCENTILE_WINDOW_SIZE) {
+    m_count++;
+  }
+}
+
+uint64_t PercentileWindow::getPercentile(unsigned int percent) const {
+  if (m_count == 0) {
+    return 0;
+  }
+  uint64_t values[PERCENTILE_WINDOW_SIZE];
+  std::copy(m_values, m_values+m_count, values);
+  size_t rank = (m_count*(percent > 100 ? 100 : percent)+99)/100;  // nearest rank
+  size_t pos = rank > 0 ? rank-1 : 0;
+  std::nth_element(values, values+pos, values+m_count);
+  return values[pos];
+}
+
+}  // namespace ebusd
@@ -0,0 +1,210 @@
+/*
+ * ebusd - daemon for communication with eBUS heating systems.
+ * Copyright (C) 2021 John Baier <ebusd@ebusd.eu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIB_UTILS_METRICS_H_
+#define LIB_UTILS_METRICS_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <initializer_list>
+#include <ostream>
+#include <string>
+
+namespace ebusd {
+
+/** \file lib/utils/metrics.h
+ * Lock-free counters and histograms formatted in the Prometheus text exposition format, and a window of recent
+ * values for estimating percentiles.
+ */
+
+using std::ostream;
+using std::string;
+
+/** the maximum number of bucket bounds of a @a Histogram. */
+#define HISTOGRAM_MAX_BUCKETS 16
+
+/** the number of most recent values kept by a @a PercentileWindow. */
+#define PERCENTILE_WINDOW_SIZE 128
+
+/**
+ * Format the HELP and TYPE lines of a metric.
+ * @param name the metric name.
+ * @param type the metric type (e.g. "counter").
+ * @param help the help text.
+ * @param output the @a ostream to format to.
+ */
+void formatMetricHeader(const char* name, const char* type, const char* help, ostream* output);
+
+/**
+ * Format a single metric sample.
+ * @param name the metric name (including a suffix like "_total").
+ * @param labels the formatted labels without braces, or empty.
+ * @param value the value.
+ * @param output the @a ostream to format to.
+ */
+void formatMetricValue(const string& name, const string& labels, double value, ostream* output);
+
+/**
+ * Escape a label value.
+ * @param value the label value.
+ * @return the escaped label value.
+ */
+string escapeMetricLabel(const string& value);
+
+/**
+ * A monotonically increasing counter that is updated without locking.
+ */
+class Counter {
+ public:
+  /**
+   * Construct a new instance.
+   */
+  Counter() : m_value(0) {}
+
+  /**
+   * Increment the counter.
+   * @param value the value to add.
+   */
+  void add(uint64_t value = 1) { m_value.fetch_add(value, std::memory_order_relaxed); }
+
+  /**
+   * Get the current value.
+   * @return the current value.
+   */
+  uint64_t get() const { return m_value.load(std::memory_order_relaxed); }
+
+  /**
+   * Format the counter with header.
+   * @param name the metric name (without "_total" suffix).
+   * @param help the help text.
+   * @param output the @a ostream to format to.
+   */
+  void format(const char* name, const char* help, ostream* output) const;
+
+
+ private:
+  /** the current value. */
+  std::atomic<uint64_t> m_value;
+};
+
+/**
+ * A histogram with fixed upper bucket bounds that is updated without locking.
+ */
+class Histogram {
+ public:
+  /**
+   * Construct a new instance.
+   * @param bounds the ascending upper bounds of the buckets in the unit of the observed values (at most
+   * @a HISTOGRAM_MAX_BUCKETS).
+   * @param scale the factor for converting the observed values to the exported unit (e.g. 0.001 for values in
+   * milliseconds exported as seconds).
+   */
+  Histogram(std::initializer_list<uint64_t> bounds, double scale = 1);
+
+  /**
+   * Add an observed value.
+   * @param value the observed value.
+   */
+  void observe(uint64_t value);
+
+  /**
+   * Get the number of observed values.
+   * @return the number of observed values.
+   */
+  uint64_t getCount() const { return m_count.load(std::memory_order_relaxed); }
+
+  /**
+   * Format the histogram.
+   * @param name the metric name.
+   * @param help the help text, or nullptr to omit the header (for further label sets of the same metric).
+   * @param labels the formatted labels without braces, or empty.
+   * @param output the @a ostream to format to.
+   */
+  void format(const char* name, const char* help, const string& labels, ostream* output) const;
+
+
+ private:
+  /** the number of bucket bounds. */
+  size_t m_size;
+
+  /** the factor for converting the observed values to the exported unit. */
+  const double m_scale;
+
+  /** the ascending upper bounds of the buckets. */
+  uint64_t m_bounds[HISTOGRAM_MAX_BUCKETS];
+
+  /** the number of values per bucket (not cumulative, the last one for values above all bounds). */
+  std::atomic<uint64_t> m_buckets[HISTOGRAM_MAX_BUCKETS+1];
+
+  /** the number of observed values. */
+  std::atomic<uint64_t> m_count;
+
+  /** the sum of observed values. */
+  std::atomic<uint64_t> m_sum;
+};
+
+/**
+ * A window of the most recently observed values for estimating percentiles (not updated without locking, so
+ * only to be used from a single thread).
+ */
+class PercentileWindow {
+ public:
+  /**
+   * Construct a new instance.
+   */
+  PercentileWindow() : m_count(0), m_next(0) {}
+
+  /**
+   * Add an observed value and replace the oldest one when the window is full.
+   * @param value the observed value.
+   */
+  void observe(uint64_t value);
+
+  /**
+   * Get the number of values in the window.
+   * @return the number of values in the window.
+   */
+  size_t getCount() const { return m_count; }
+
+  /**
+   * Get the estimated percentile of the values in the window.
+   * @param percent the percentile to estimate (0-100).
+   * @return the smallest value in the window not exceeded by @a percent of the values, or 0 if empty.
+   */
+  uint64_t getPercentile(unsigned int percent) const;
+
+  /**
+   * Remove all values from the window.
+   */
+  void clear() { m_count = m_next = 0; }
+
+
+ private:
+  /** the values in the window. */
+  uint64_t m_values[PERCENTILE_WINDOW_SIZE];
+
+  /** the number of values in the window. */
+  size_t m_count;
+
+  /** the position in @a m_values of the next value. */
+  size_t m_next;
+};
+
+}  // namespace ebusd
+
+#endif  // LIB_UTILS_METRICS_H_
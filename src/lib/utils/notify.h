@@ -63,6 +63,15 @@ class Notify {
    */
   ssize_t notify() const { return write(m_sendfd, "1", 1); }
 
+  /**
+   * consume pending notify events from file descriptor (only to be called when it is readable).
+   * @return result of reading notifications.
+   */
+  ssize_t consume() const {
+    char buf[64];
+    return read(m_recvfd, buf, sizeof(buf));
+  }
+
  private:
   /** file descriptor to watch */
   int m_recvfd;
@@ -0,0 +1,91 @@
+/*
+ * ebusd - daemon for communication with eBUS heating systems.
+ * Copyright (C) 2021 John Baier <ebusd@ebusd.eu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "lib/utils/queue.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#ifdef HAVE_SYS_EVENTFD_H
+#  include <sys/eventfd.h>
+#endif
+
+namespace ebusd {
+
+WakeupEvent::WakeupEvent() : m_recvfd(-1), m_sendfd(-1) {
+#ifdef HAVE_SYS_EVENTFD_H
+  m_recvfd = m_sendfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (m_recvfd >= 0) {
+    return;
+  }
+#endif
+  int pipefd[2];
+  if (pipe(pipefd) == 0) {
+    m_recvfd = pipefd[0];
+    m_sendfd = pipefd[1];
+    fcntl(m_recvfd, F_SETFL, O_NONBLOCK);
+    fcntl(m_sendfd, F_SETFL, O_NONBLOCK);
+  }
+}
+
+WakeupEvent::~WakeupEvent() {
+  if (m_sendfd >= 0 && m_sendfd != m_recvfd) {
+    close(m_sendfd);
+  }
+  if (m_recvfd >= 0) {
+    close(m_recvfd);
+  }
+}
+
+void WakeupEvent::notify() const {
+#ifdef HAVE_SYS_EVENTFD_H
+  if (m_sendfd == m_recvfd) {
+    uint64_t value = 1;
+    ssize_t ret = write(m_sendfd, &value, sizeof(value));
+    (void)ret;  // counter overflow is not relevant as the reader is notified anyway
+    return;
+  }
+#endif
+  ssize_t ret = write(m_sendfd, "1", 1);
+  (void)ret;  // a full pipe already notifies the reader
+}
+
+bool WakeupEvent::wait(int timeoutMillis) const {
+  struct pollfd fd;
+  fd.fd = m_recvfd;
+  fd.events = POLLIN;
+  fd.revents = 0;
+  int ret = poll(&fd, 1, timeoutMillis);
+  if (ret <= 0) {
+    return false;
+  }
+  consume();
+  return true;
+}
+
+void WakeupEvent::consume() const {
+  char buf[64];
+  while (read(m_recvfd, buf, sizeof(buf)) == static_cast<ssize_t>(sizeof(buf))) {
+    // drain all pending notifications of a pipe
+  }
+}
+
+}  // namespace ebusd
@@ -21,6 +21,9 @@
 
 #include <pthread.h>
 #include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <atomic>
 #include <list>
 #include "lib/utils/clock.h"
 
@@ -151,6 +154,17 @@ class Queue {
     return item;
   }
 
+  /**
+   * Return the number of items in the queue.
+   * @return the number of items in the queue.
+   */
+  size_t size() {
+    pthread_mutex_lock(&m_mutex);
+    size_t size = m_queue.size();
+    pthread_mutex_unlock(&m_mutex);
+    return size;
+  }
+
 
  private:
   /** the queue itself */
@@ -163,6 +177,548 @@ class Queue {
   pthread_cond_t m_cond;
 };
 
+
+/**
+ * Thread safe template class for queuing items in a fixed number of prioritized lanes.
+ * The lanes are served by descending priority (lane 0 first) with each lane being limited to its weight in
+ * consecutive turns while a lower lane is waiting, and a lane whose first item waited longer than the lane's
+ * maximum wait time is served first (starvation protection). The scheduling decision only looks at the head of
+ * each non-empty lane (tracked in a bit mask) and is thus linear in the number of lanes but independent of the
+ * number of queued items.
+ * @param T the item type.
+ * @param N the number of lanes (at most 64).
+ */
+template <typename T, size_t N>
+class LaneQueue {
+  static_assert(N >= 1 && N <= 64, "lane count has to fit into the lane mask");
+
+ public:
+  /**
+   * Constructor.
+   */
+  LaneQueue() : m_size(0), m_nonEmpty(0), m_selected(N) {
+    pthread_mutex_init(&m_mutex, nullptr);
+    for (size_t lane = 0; lane < N; lane++) {
+      m_weights[lane] = m_credits[lane] = 1;
+      m_maxWaits[lane] = 0;
+    }
+  }
+
+  /**
+   * Destructor.
+   */
+  ~LaneQueue() {
+    pthread_mutex_destroy(&m_mutex);
+  }
+
+
+ private:
+  /**
+   * Hidden copy constructor.
+   * @param src the object to copy from.
+   */
+  LaneQueue(const LaneQueue& src);
+
+
+ public:
+  /**
+   * Set the scheduling parameters of a lane.
+   * @param lane the lane index.
+   * @param weight the number of consecutive turns the lane gets while a lower lane is waiting (at least 1).
+   * @param maxWait the maximum time in milliseconds the first item of the lane may wait before the lane is served
+   * first, or 0 for no limit.
+   */
+  void setLane(size_t lane, unsigned int weight, unsigned int maxWait) {
+    if (lane >= N) {
+      return;
+    }
+    pthread_mutex_lock(&m_mutex);
+    m_weights[lane] = m_credits[lane] = weight < 1 ? 1 : weight;
+    m_maxWaits[lane] = maxWait;
+    pthread_mutex_unlock(&m_mutex);
+  }
+
+  /**
+   * Add an item to the end of a lane.
+   * @param item the item to add.
+   * @param lane the lane index (an invalid index is mapped to the last lane).
+   */
+  void push(T item, size_t lane) {
+    pthread_mutex_lock(&m_mutex);
+    if (lane >= N) {
+      lane = N-1;
+    }
+    m_lanes[lane].push_back(Entry(item, now()));
+    m_nonEmpty |= 1ULL << lane;
+    m_size++;
+    pthread_mutex_unlock(&m_mutex);
+  }
+
+  /**
+   * Remove the next item from the queue as decided by the scheduling.
+   * @param waitMillis optional pointer to a variable in which to store the time in milliseconds the item was queued.
+   * @param lane optional pointer to a variable in which to store the lane of the item.
+   * @return the item, or nullptr if no item is available.
+   */
+  T pop(uint64_t* waitMillis = nullptr, size_t* lane = nullptr) {
+    T item = nullptr;
+    pthread_mutex_lock(&m_mutex);
+    size_t selected = select();
+    if (selected < N) {
+      item = take(selected, m_lanes[selected].begin(), waitMillis);
+      if (lane) {
+        *lane = selected;
+      }
+    }
+    pthread_mutex_unlock(&m_mutex);
+    return item;
+  }
+
+  /**
+   * Remove the specified item from the queue.
+   * This takes constant time for the item returned by @a peek() and is linear in the number of queued items
+   * otherwise.
+   * @param item the item to remove.
+   * @param waitMillis optional pointer to a variable in which to store the time in milliseconds the item was queued.
+   * @param lane optional pointer to a variable in which to store the lane of the item.
+   * @return whether the item was removed.
+   */
+  bool remove(T item, uint64_t* waitMillis = nullptr, size_t* lane = nullptr) {
+    bool result = false;
+    pthread_mutex_lock(&m_mutex);
+    if (m_selected < N && m_lanes[m_selected].front().m_item == item) {
+      if (lane) {
+        *lane = m_selected;
+      }
+      take(m_selected, m_lanes[m_selected].begin(), waitMillis);
+      pthread_mutex_unlock(&m_mutex);
+      return true;
+    }
+    for (size_t idx = 0; idx < N && !result; idx++) {
+      if (!(m_nonEmpty & (1ULL << idx))) {
+        continue;
+      }
+      for (auto it = m_lanes[idx].begin(); it != m_lanes[idx].end(); ++it) {
+        if (it->m_item == item) {
+          take(idx, it, waitMillis);
+          if (lane) {
+            *lane = idx;
+          }
+          result = true;
+          break;
+        }
+      }
+    }
+    pthread_mutex_unlock(&m_mutex);
+    return result;
+  }
+
+  /**
+   * Return the next item to be removed as decided by the scheduling without removing it.
+   * The decision is kept until the item is removed, i.e. subsequent calls return the same item even when other
+   * items with higher priority were added in the meantime.
+   * @return the item, or nullptr if no item is available.
+   */
+  T peek() {
+    T item = nullptr;
+    pthread_mutex_lock(&m_mutex);
+    size_t selected = select();
+    if (selected < N) {
+      item = m_lanes[selected].front().m_item;
+    }
+    pthread_mutex_unlock(&m_mutex);
+    return item;
+  }
+
+  /**
+   * Return the number of items in the queue.
+   * @return the number of items in the queue.
+   */
+  size_t size() {
+    pthread_mutex_lock(&m_mutex);
+    size_t size = m_size;
+    pthread_mutex_unlock(&m_mutex);
+    return size;
+  }
+
+
+ private:
+  /** a queued item with the time it was added. */
+  struct Entry {
+    /**
+     * Constructor.
+     * @param item the item.
+     * @param time the monotonic time in milliseconds the item was added.
+     */
+    Entry(T item, uint64_t time) : m_item(item), m_time(time) {}
+
+    /** the item. */
+    T m_item;
+
+    /** the monotonic time in milliseconds the item was added. */
+    uint64_t m_time;
+  };
+
+  /**
+   * Get the current monotonic time.
+   * @return the current monotonic time in milliseconds.
+   */
+  static uint64_t now() {
+    struct timespec t;
+    clockGettimeMonotonic(&t);
+    return static_cast<uint64_t>(t.tv_sec)*1000 + static_cast<uint64_t>(t.tv_nsec/1000000);
+  }
+
+  /**
+   * Decide about the lane to serve next (while holding the mutex).
+   * @return the selected lane index, or N if the queue is empty.
+   */
+  size_t select() {
+    if (m_selected < N || m_size == 0) {
+      return m_selected;
+    }
+    uint64_t time = now();
+    size_t first = N, credited = N;
+    uint64_t mask = m_nonEmpty;
+    for (size_t lane = 0; mask != 0; lane++, mask >>= 1) {
+      if (!(mask & 1)) {
+        continue;
+      }
+      if (m_maxWaits[lane] > 0 && time - m_lanes[lane].front().m_time >= m_maxWaits[lane]) {
+        m_selected = lane;  // overdue: serve regardless of priority and credits
+        return m_selected;
+      }
+      if (first == N) {
+        first = lane;
+      }
+      if (credited == N && m_credits[lane] > 0) {
+        credited = lane;
+      }
+    }
+    if (credited == N) {
+      // all waiting lanes used up their turns: start a new round
+      for (size_t lane = 0; lane < N; lane++) {
+        m_credits[lane] = m_weights[lane];
+      }
+      credited = first;
+    }
+    m_selected = credited;
+    return m_selected;
+  }
+
+  /**
+   * Remove an entry from a lane (while holding the mutex).
+   * @param lane the lane index.
+   * @param it the iterator of the entry to remove.
+   * @param waitMillis optional pointer to a variable in which to store the time in milliseconds the item was queued.
+   * @return the removed item.
+   */
+  T take(size_t lane, typename list<Entry>::iterator it, uint64_t* waitMillis) {
+    T item = it->m_item;
+    if (waitMillis) {
+      *waitMillis = now() - it->m_time;
+    }
+    if (it == m_lanes[lane].begin()) {
+      if (m_credits[lane] > 0) {
+        m_credits[lane]--;
+      }
+      if (lane == m_selected) {
+        m_selected = N;
+      }
+    }
+    m_lanes[lane].erase(it);
+    if (m_lanes[lane].empty()) {
+      m_nonEmpty &= ~(1ULL << lane);
+    }
+    m_size--;
+    return item;
+  }
+
+  /** the queued entries of each lane. */
+  list<Entry> m_lanes[N];
+
+  /** the weight of each lane. */
+  unsigned int m_weights[N];
+
+  /** the remaining turns of each lane in the current round. */
+  unsigned int m_credits[N];
+
+  /** the maximum wait time in milliseconds of each lane, or 0 for no limit. */
+  unsigned int m_maxWaits[N];
+
+  /** the total number of queued items. */
+  size_t m_size;
+
+  /** the bit mask of the lanes having queued items (bit 0 for lane 0). */
+  uint64_t m_nonEmpty;
+
+  /** the lane selected for being served next, or N if not yet decided. */
+  size_t m_selected;
+
+  /** mutex variable for exclusive lock */
+  pthread_mutex_t m_mutex;
+};
+
+
+/**
+ * A file descriptor based event for waking up a single waiting thread (eventfd where available, pipe otherwise).
+ */
+class WakeupEvent {
+ public:
+  /**
+   * Constructor.
+   */
+  WakeupEvent();
+
+  /**
+   * Destructor.
+   */
+  ~WakeupEvent();
+
+
+ private:
+  /**
+   * Hidden copy constructor.
+   * @param src the object to copy from.
+   */
+  WakeupEvent(const WakeupEvent& src);
+
+
+ public:
+  /**
+   * Get the file descriptor that becomes readable when notified (e.g. for adding to an epoll set).
+   * @return the file descriptor.
+   */
+  int getFD() const { return m_recvfd; }
+
+  /**
+   * Notify the waiting thread.
+   */
+  void notify() const;
+
+  /**
+   * Wait for being notified and consume the notifications.
+   * @param timeoutMillis the maximum time in milliseconds to wait.
+   * @return true if notified, false on timeout.
+   */
+  bool wait(int timeoutMillis) const;
+
+  /**
+   * Consume pending notifications (only to be called when the file descriptor is readable).
+   */
+  void consume() const;
+
+
+ private:
+  /** the file descriptor to watch. */
+  int m_recvfd;
+
+  /** the file descriptor to notify (same as @a m_recvfd for eventfd). */
+  int m_sendfd;
+};
+
+
+/**
+ * Thread safe template class for queuing items in a bounded ring buffer without allocation and locking.
+ * Any number of threads may add items, while waiting for items is only supported for a single consumer thread,
+ * which is woken up via a @a WakeupEvent only when it actually waits.
+ * @param T the item type (a pointer).
+ * @param N the capacity (a power of two).
+ */
+template <typename T, size_t N>
+class RingQueue {
+  static_assert(N >= 2 && (N & (N-1)) == 0, "capacity has to be a power of two");
+
+ public:
+  /**
+   * Constructor.
+   */
+  RingQueue() : m_enqueuePos(0), m_dequeuePos(0), m_waiting(false), m_notifyAlways(false) {
+    for (size_t pos = 0; pos < N; pos++) {
+      m_slots[pos].m_sequence.store(pos, std::memory_order_relaxed);
+      m_slots[pos].m_item = nullptr;
+    }
+  }
+
+
+ private:
+  /**
+   * Hidden copy constructor.
+   * @param src the object to copy from.
+   */
+  RingQueue(const RingQueue& src);
+
+
+ public:
+  /**
+   * Add an item to the end of queue if there is space left.
+   * @param item the item to add.
+   * @return true if the item was added, false if the queue is full.
+   */
+  bool tryPush(T item) {
+    size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+    Slot* slot;
+    while (true) {
+      slot = &m_slots[pos & (N-1)];
+      intptr_t diff = static_cast<intptr_t>(slot->m_sequence.load(std::memory_order_acquire) - pos);
+      if (diff == 0) {
+        if (m_enqueuePos.compare_exchange_weak(pos, pos+1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;  // full
+      } else {
+        pos = m_enqueuePos.load(std::memory_order_relaxed);
+      }
+    }
+    slot->m_item = item;
+    slot->m_sequence.store(pos+1, std::memory_order_release);
+    std::atomic_thread_fence(std::memory_order_seq_cst);  // pairs with the fence in pop()
+    if (m_notifyAlways.load(std::memory_order_relaxed) || m_waiting.load(std::memory_order_relaxed)) {
+      m_wakeup.notify();
+    }
+    return true;
+  }
+
+  /**
+   * Add an item to the end of queue, waiting for space while the queue is full.
+   * @param item the item to add.
+   */
+  void push(T item) {
+    while (!tryPush(item)) {
+      usleep(100);
+    }
+  }
+
+  /**
+   * Remove the first item from the queue optionally waiting for the queue being non-empty.
+   * Waiting is only allowed for a single consumer thread at a time.
+   * @param timeout the maximum time in seconds to wait for the queue being filled, or 0 for no wait.
+   * @return the item, or nullptr if no item is available within the specified time.
+   */
+  T pop(int timeout = 0) {
+    T item;
+    if (tryPop(&item) || timeout <= 0) {
+      return item;
+    }
+    struct timespec now;
+    clockGettimeMonotonic(&now);
+    int64_t end = toMillis(now) + timeout*1000LL;
+    while (true) {
+      m_waiting.store(true, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);  // pairs with the fence in tryPush()
+      if (tryPop(&item)) {
+        break;
+      }
+      clockGettimeMonotonic(&now);
+      int64_t remain = end - toMillis(now);
+      if (remain <= 0) {
+        break;
+      }
+      m_wakeup.wait(static_cast<int>(remain));
+      m_waiting.store(false, std::memory_order_relaxed);
+      if (tryPop(&item)) {
+        break;
+      }
+    }
+    m_waiting.store(false, std::memory_order_relaxed);
+    return item;
+  }
+
+  /**
+   * Get the file descriptor that becomes readable whenever an item was added, for waiting on the queue together
+   * with other file descriptors (e.g. in an epoll set). Once called, every added item notifies the descriptor and
+   * the consumer has to call @a consumeWakeup() when it is readable before taking the items via @a pop().
+   * @return the file descriptor.
+   */
+  int getWakeupFD() {
+    m_notifyAlways.store(true);
+    return m_wakeup.getFD();
+  }
+
+  /**
+   * Consume pending notifications of the file descriptor returned by @a getWakeupFD().
+   */
+  void consumeWakeup() {
+    m_wakeup.consume();
+  }
+
+  /**
+   * Return the (approximate) number of items in the queue.
+   * @return the number of items in the queue.
+   */
+  size_t size() {
+    size_t dequeuePos = m_dequeuePos.load(std::memory_order_relaxed);
+    size_t enqueuePos = m_enqueuePos.load(std::memory_order_relaxed);
+    return enqueuePos > dequeuePos ? enqueuePos - dequeuePos : 0;
+  }
+
+
+ private:
+  /** a slot in the ring buffer. */
+  struct Slot {
+    /** the sequence number for synchronizing producers and consumers. */
+    std::atomic<size_t> m_sequence;
+
+    /** the item. */
+    T m_item;
+  };
+
+  /**
+   * Convert a @a timespec to milliseconds.
+   * @param t the @a timespec.
+   * @return the milliseconds.
+   */
+  static int64_t toMillis(const struct timespec& t) {
+    return static_cast<int64_t>(t.tv_sec)*1000 + t.tv_nsec/1000000;
+  }
+
+  /**
+   * Remove the first item from the queue without waiting.
+   * @param item the variable in which to store the item, or nullptr if the queue is empty.
+   * @return true if an item was removed.
+   */
+  bool tryPop(T* item) {
+    size_t pos = m_dequeuePos.load(std::memory_order_relaxed);
+    Slot* slot;
+    while (true) {
+      slot = &m_slots[pos & (N-1)];
+      intptr_t diff = static_cast<intptr_t>(slot->m_sequence.load(std::memory_order_acquire) - (pos+1));
+      if (diff == 0) {
+        if (m_dequeuePos.compare_exchange_weak(pos, pos+1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        *item = nullptr;  // empty
+        return false;
+      } else {
+        pos = m_dequeuePos.load(std::memory_order_relaxed);
+      }
+    }
+    *item = slot->m_item;
+    slot->m_sequence.store(pos+N, std::memory_order_release);
+    return true;
+  }
+
+  /** the ring buffer slots. */
+  Slot m_slots[N];
+
+  /** the position for adding the next item. */
+  std::atomic<size_t> m_enqueuePos;
+
+  /** the position for removing the next item. */
+  std::atomic<size_t> m_dequeuePos;
+
+  /** whether the consumer is currently waiting for an item. */
+  std::atomic<bool> m_waiting;
+
+  /** whether every added item notifies the @a WakeupEvent (see @a getWakeupFD()). */
+  std::atomic<bool> m_notifyAlways;
+
+  /** the @a WakeupEvent for the waiting consumer. */
+  WakeupEvent m_wakeup;
+};
+
 }  // namespace ebusd
 
 #endif  // LIB_UTILS_QUEUE_H_
@@ -22,34 +22,99 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <cstdlib>
+#include <cstdio>
 #include <cstring>
+#include <ctime>
 #include <fstream>
 #include <string>
 #include "lib/utils/clock.h"
+#include "lib/utils/log.h"
 
 namespace ebusd {
 
-using std::streamsize;
+
+/** the interval in milliseconds for writing the collected data in asynchronous mode. */
+#define ROTATE_FILE_WRITE_INTERVAL 200
+
+/** the size of the collected data in asynchronous mode for waking up the writer before the interval ends. */
+#define ROTATE_FILE_WAKEUP_SIZE (16*1024)
+
+/** the maximum size of the collected data in asynchronous mode before dropping further data. */
+#define ROTATE_FILE_MAX_PENDING (1024*1024)
+
+/** the maximum size of a single record in timed mode. */
+#define ROTATE_FILE_MAX_RECORD 4096
+
+/**
+ * The @a Thread writing the collected data of an asynchronous @a RotateFile.
+ */
+class RotateFileWriter : public NotifiableThread {
+ public:
+  /**
+   * Constructor.
+   * @param file the @a RotateFile to write.
+   */
+  explicit RotateFileWriter(RotateFile* file) : NotifiableThread(), m_file(file) {}
+
+
+ protected:
+  // @copydoc
+  void run() override {
+    while (isRunning()) {
+      waitNotified(ROTATE_FILE_WRITE_INTERVAL);
+      m_file->writePending();
+    }
+  }
+
+
+ private:
+  /** the @a RotateFile to write. */
+  RotateFile* m_file;
+};
 
 RotateFile::~RotateFile() {
+  if (m_writer) {
+    m_writer->join();
+    delete m_writer;
+    m_writer = nullptr;
+  }
+  if (m_enabled) {
+    emitRecord();
+    writePending();
+  }
   if (m_stream) {
     fclose(m_stream);
     m_stream = nullptr;
   }
 }
 
+void RotateFile::open() {
+  m_stream = fopen(m_fileName.c_str(), m_textMode ? "w" : "wb");
+  m_fileSize = 0;
+  if (m_stream && m_timed) {
+    fwrite(ROTATE_FILE_TIMED_MAGIC, 1, ROTATE_FILE_TIMED_MAGIC_LEN, m_stream);
+    m_fileSize = ROTATE_FILE_TIMED_MAGIC_LEN;
+  }
+}
+
 bool RotateFile::setEnabled(bool enabled) {
   if (enabled == m_enabled) {
     return false;
   }
+  if (!enabled) {
+    emitRecord();
+    writePending();
+  }
+  if (m_async) {
+    m_fileMutex.lock();
+  }
   m_enabled = enabled;
   if (m_stream) {
     fclose(m_stream);
     m_stream = nullptr;
   }
   if (enabled) {
-    m_stream = fopen(m_fileName.c_str(), m_textMode ? "w" : "wb");
-    m_fileSize = 0;
+    open();
 #ifdef FORWARD_RAW_TTY
     if (!m_textMode && isatty(fileno(m_stream)) == 1) {
       int fd = fileno(m_stream);
@@ -67,48 +132,146 @@ bool RotateFile::setEnabled(bool enabled) {
     }
 #endif
   }
+  if (m_async) {
+    m_fileMutex.unlock();
+    if (enabled && !m_writer) {
+      m_writer = new RotateFileWriter(this);
+      if (!m_writer->start("rotatefile")) {
+        delete m_writer;
+        m_writer = nullptr;
+      }
+    }
+  }
   return true;
 }
 
 void RotateFile::write(const unsigned char* value, const size_t size, const bool received, const bool bytes) {
-  if (!m_enabled || !m_stream) {
+  if (!m_enabled || (!m_async && !m_stream)) {
     return;
   }
   if (m_textMode) {
     struct timespec ts;
-    struct tm td;
     clockGettime(&ts);
-    localtime_r(&ts.tv_sec, &td);
-    fprintf(m_stream, "%04d-%02d-%02d %02d:%02d:%02d.%03ld ",
-      td.tm_year+1900, td.tm_mon+1, td.tm_mday,
-      td.tm_hour, td.tm_min, td.tm_sec, ts.tv_nsec/1000000);
+    if (ts.tv_sec != m_prefixSecond) {
+      struct tm td;
+      localtime_r(&ts.tv_sec, &td);
+      strftime(m_prefix, sizeof(m_prefix), "%Y-%m-%d %H:%M:%S", &td);
+      m_prefixSecond = ts.tv_sec;
+    }
+    string line;
+    line.reserve(32 + (bytes ? 3 : 1) * size);
+    char str[32];
+    snprintf(str, sizeof(str), ".%03ld ", ts.tv_nsec/1000000);
+    line.append(m_prefix).append(str);
     if (bytes) {
-      fprintf(m_stream, received ? "<" : ">");
+      static const char hexDigits[] = "0123456789abcdef";
+      line.push_back(received ? '<' : '>');
       for (unsigned int pos = 0; pos < size; pos++) {
-        fprintf(m_stream, "%2.2x ", value[pos]);
+        line.push_back(hexDigits[value[pos] >> 4]);
+        line.push_back(hexDigits[value[pos] & 0x0f]);
+        line.push_back(' ');
       }
-      m_fileSize += 25+3*size+1;
     } else {
-      fwrite(value, 1, size, m_stream);
-      m_fileSize += size+1;
+      line.append(reinterpret_cast<const char*>(value), size);
+    }
+    line.push_back('\n');
+    emit(line.data(), line.length());
+  } else if (m_timed) {
+    for (size_t pos = 0; pos < size; pos++) {
+      unsigned char ch = value[pos];
+      if (!m_recordStarted && ch != ROTATE_FILE_TIMED_DELIMITER) {
+        clockGettime(&m_recordTime);
+        m_recordStarted = true;
+      }
+      m_record.push_back(static_cast<char>(ch));
+      if ((m_recordStarted && ch == ROTATE_FILE_TIMED_DELIMITER) || m_record.length() >= ROTATE_FILE_MAX_RECORD) {
+        emitRecord();
+      }
     }
-    fprintf(m_stream, "\n");
-    fflush(m_stream);
   } else {
-    fwrite(value, (streamsize)size, 1, m_stream);
-    m_fileSize += size;
-    m_flushSize += size;
-    if (m_flushSize >= m_flushBuffer) {
-      fflush(m_stream);
-      m_flushSize = 0;
+    emit(reinterpret_cast<const char*>(value), size);
+  }
+}
+
+void RotateFile::emitRecord() {
+  if (m_record.empty()) {
+    return;
+  }
+  if (!m_recordStarted) {
+    clockGettime(&m_recordTime);
+  }
+  uint64_t micros = static_cast<uint64_t>(m_recordTime.tv_sec) * 1000000ULL
+    + static_cast<uint64_t>(m_recordTime.tv_nsec / 1000);
+  size_t length = m_record.length();
+  char header[10];
+  for (size_t pos = 0; pos < 8; pos++) {
+    header[pos] = static_cast<char>((micros >> (8 * pos)) & 0xff);
+  }
+  header[8] = static_cast<char>(length & 0xff);
+  header[9] = static_cast<char>((length >> 8) & 0xff);
+  m_record.insert(0, header, sizeof(header));
+  emit(m_record.data(), m_record.length());
+  m_record.clear();
+  m_recordStarted = false;
+}
+
+void RotateFile::emit(const char* data, size_t size) {
+  if (!m_async || !m_writer) {
+    if (m_stream) {
+      writeToFile(data, size, false);
     }
+    return;
+  }
+  m_pendingMutex.lock();
+  bool wakeup = false;
+  if (m_pending.length() + size > ROTATE_FILE_MAX_PENDING) {
+    m_droppedBytes += size;
+  } else {
+    m_pending.append(data, size);
+    wakeup = m_pending.length() >= ROTATE_FILE_WAKEUP_SIZE;
+  }
+  m_pendingMutex.unlock();
+  if (wakeup) {
+    m_writer->notify();
+  }
+}
+
+void RotateFile::writePending() {
+  if (!m_async) {
+    return;
+  }
+  string data;
+  m_pendingMutex.lock();
+  data.swap(m_pending);
+  uint64_t dropped = m_droppedBytes;
+  m_droppedBytes = 0;
+  m_pendingMutex.unlock();
+  if (dropped > 0) {
+    logNotice(lf_main, "dropped %lld bytes for %s", static_cast<long long>(dropped), m_fileName.c_str());
+  }
+  if (data.empty()) {
+    return;
+  }
+  m_fileMutex.lock();
+  if (m_stream) {
+    writeToFile(data.data(), data.length(), true);
+  }
+  m_fileMutex.unlock();
+}
+
+void RotateFile::writeToFile(const char* data, size_t size, bool flush) {
+  fwrite(data, 1, size, m_stream);
+  m_fileSize += size;
+  m_flushSize += size;
+  if (flush || m_textMode || m_flushSize >= m_flushBuffer) {
+    fflush(m_stream);
+    m_flushSize = 0;
   }
   if (m_fileSize >= m_maxSize * 1024LL) {
     string oldfile = string(m_fileName)+".old";
     if (rename(m_fileName.c_str(), oldfile.c_str()) == 0) {
       fclose(m_stream);
-      m_stream = fopen(m_fileName.c_str(), m_textMode ? "w" : "wb");
-      m_fileSize = 0;
+      open();
     }
   }
 }
@@ -24,6 +24,7 @@
 #include <iostream>
 #include <fstream>
 #include <string>
+#include "lib/utils/thread.h"
 
 namespace ebusd {
 
@@ -33,10 +34,30 @@ namespace ebusd {
 
 using std::string;
 
+/** the magic header of a dump file in the timed format. */
+#define ROTATE_FILE_TIMED_MAGIC "EBDT\x01\0\0\0"
+
+/** the length of @a ROTATE_FILE_TIMED_MAGIC. */
+#define ROTATE_FILE_TIMED_MAGIC_LEN 8
+
+/** the byte delimiting the telegrams in the timed format (the eBUS SYN symbol). */
+#define ROTATE_FILE_TIMED_DELIMITER 0xaa
+
+class RotateFileWriter;
+
 /**
  * Helper class for writing to a rotating file with maximum size.
+ *
+ * In asynchronous mode, the data is collected in memory and written, flushed and rotated by a background thread.
+ *
+ * In timed mode (binary only), the file starts with @a ROTATE_FILE_TIMED_MAGIC and each telegram is written as one
+ * record consisting of the timestamp in microseconds since the epoch (64 bit little endian), the number of bytes
+ * (16 bit little endian), and the bytes themselves up to and including the @a ROTATE_FILE_TIMED_DELIMITER ending
+ * the telegram.
  */
 class RotateFile {
+  friend class RotateFileWriter;
+
  public:
   /**
    * Construct a new instance.
@@ -44,11 +65,14 @@ class RotateFile {
    * @param maxSize the maximum size of the file to write to.
    * @param textMode whether to write each byte with prefixed timestamp and direction as text.
    * @param flushBuffer the size of the flush buffer.
+   * @param async whether to write asynchronously from a background thread.
+   * @param timed whether to write binary data in the timed format.
    */
   RotateFile(const string fileName, const unsigned int maxSize, const bool textMode = false,
-             const unsigned int flushBuffer = 16)
+             const unsigned int flushBuffer = 16, const bool async = false, const bool timed = false)
     : m_enabled(false), m_fileName(fileName), m_maxSize(maxSize), m_textMode(textMode), m_stream(), m_fileSize(0),
-      m_flushSize(0), m_flushBuffer(flushBuffer) {}
+      m_flushSize(0), m_flushBuffer(flushBuffer), m_async(async), m_timed(timed && !textMode), m_writer(nullptr),
+      m_droppedBytes(0), m_recordStarted(false), m_prefixSecond(-1) {}
 
   /**
    * Destructor.
@@ -69,7 +93,7 @@ class RotateFile {
   bool isEnabled() { return m_enabled; }
 
   /**
-   * Write a number of bytes to the stream.
+   * Write a number of bytes to the stream (expected to be called from a single thread only).
    * @param value the pointer to the bytes to write.
    * @param size the number of bytes to write.
    * @param received @a true on reception, @a false on sending (only relevant in text mode).
@@ -80,6 +104,36 @@ class RotateFile {
 
 
  private:
+  /**
+   * Open the file (with @a m_fileMutex locked in asynchronous mode).
+   */
+  void open();
+
+  /**
+   * Hand over formatted data for writing directly or via the background thread.
+   * @param data the data to write.
+   * @param size the number of bytes to write.
+   */
+  void emit(const char* data, size_t size);
+
+  /**
+   * Write formatted data to the file and rotate it if necessary (with @a m_fileMutex locked in asynchronous mode).
+   * @param data the data to write.
+   * @param size the number of bytes to write.
+   * @param flush whether to flush the file afterwards.
+   */
+  void writeToFile(const char* data, size_t size, bool flush);
+
+  /**
+   * Write all data collected so far (called by the background thread in asynchronous mode).
+   */
+  void writePending();
+
+  /**
+   * Emit the telegram record collected so far in timed mode.
+   */
+  void emitRecord();
+
   /** whether writing to the file is enabled. */
   bool m_enabled;
 
@@ -103,6 +157,42 @@ class RotateFile {
 
   /** the size of the flush buffer. */
   const unsigned int m_flushBuffer;
+
+  /** whether to write asynchronously from a background thread. */
+  const bool m_async;
+
+  /** whether to write binary data in the timed format. */
+  const bool m_timed;
+
+  /** the background @a RotateFileWriter, or nullptr. */
+  RotateFileWriter* m_writer;
+
+  /** the @a Mutex for accessing @a m_pending and @a m_droppedBytes. */
+  Mutex m_pendingMutex;
+
+  /** the formatted data not yet written in asynchronous mode. */
+  string m_pending;
+
+  /** the number of bytes dropped due to a full @a m_pending. */
+  uint64_t m_droppedBytes;
+
+  /** the @a Mutex for accessing @a m_stream in asynchronous mode. */
+  Mutex m_fileMutex;
+
+  /** the telegram record collected so far in timed mode. */
+  string m_record;
+
+  /** whether the telegram in @a m_record already started (i.e. has the timestamp set). */
+  bool m_recordStarted;
+
+  /** the timestamp of the telegram in @a m_record. */
+  struct timespec m_recordTime;
+
+  /** the second of the cached timestamp prefix in text mode. */
+  time_t m_prefixSecond;
+
+  /** the cached timestamp prefix up to the seconds in text mode. */
+  char m_prefix[32];
 };
 
 }  // namespace ebusd
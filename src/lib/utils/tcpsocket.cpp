@@ -44,6 +44,11 @@ bool TCPSocket::isValid() {
   return fcntl(m_sfd, F_GETFL) != -1;
 }
 
+bool TCPSocket::setNonBlocking() {
+  int flags = fcntl(m_sfd, F_GETFL);
+  return flags != -1 && fcntl(m_sfd, F_SETFL, flags | O_NONBLOCK) != -1;
+}
+
 
 TCPSocket* TCPClient::connect(const string& server, const uint16_t& port, int timeout) {
   socketaddress address;
@@ -102,6 +102,12 @@ class TCPSocket {
    */
   bool isValid();
 
+  /**
+   * Switch the socket to non-blocking mode for @a send and @a recv.
+   * @return true on success.
+   */
+  bool setNonBlocking();
+
   /**
    * Set the timeout for @a send and @a recv.
    * @param timeout the timeout in seconds.
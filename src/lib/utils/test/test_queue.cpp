@@ -0,0 +1,145 @@
+/*
+ * ebusd - daemon for communication with eBUS heating systems.
+ * Copyright (C) 2021 John Baier <ebusd@ebusd.eu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <unistd.h>
+#include <iostream>
+#include <string>
+#include "lib/utils/queue.h"
+
+using namespace ebusd;
+using std::cout;
+using std::endl;
+using std::string;
+using std::to_string;
+
+static bool error = false;
+
+void verify(const string& type, const string& input, const string& expectStr, const string& gotStr) {
+  if (expectStr == gotStr) {
+    cout << "  " << type << " match >" << input << "< OK" << endl;
+  } else {
+    error = true;
+    cout << "  " << type << " match >" << input << "< error: got >"
+            << gotStr << "<, expected >" << expectStr << "<" << endl;
+  }
+}
+
+/** the number of lanes in the tested queues. */
+#define LANES 4
+
+/** the items to queue, identified by their index. */
+static int items[32];
+
+/**
+ * Get the index of a queued item.
+ * @param item the item, or nullptr.
+ * @return the index of the item, or "none".
+ */
+static string getIndex(int* item) {
+  return item ? to_string(item-items) : "none";
+}
+
+/**
+ * Pop items from the queue and return their lanes.
+ * @param queue the @a LaneQueue to pop from.
+ * @param count the number of items to pop.
+ * @return the lane of each popped item, or "-" for no item.
+ */
+static string popLanes(LaneQueue<int*, LANES>* queue, size_t count) {
+  string lanes;
+  for (size_t idx = 0; idx < count; idx++) {
+    size_t lane = LANES;
+    lanes += queue->pop(nullptr, &lane) ? to_string(lane) : "-";
+  }
+  return lanes;
+}
+
+void checkWeights() {
+  // a busy lane gets its weight in consecutive turns while a lower lane is waiting
+  LaneQueue<int*, LANES> queue;
+  queue.setLane(0, 3, 0);
+  queue.setLane(2, 2, 0);
+  for (size_t idx = 0; idx < 8; idx++) {
+    queue.push(&items[idx], 0);
+    queue.push(&items[8+idx], 2);
+  }
+  verify("weights", "3:2", "0002200022002222-", popLanes(&queue, 17));
+  verify("weights", "empty", "0", to_string(queue.size()));
+}
+
+void checkStarvation() {
+  // a lower lane is served even while a higher lane is refilled all the time
+  LaneQueue<int*, LANES> queue;
+  queue.setLane(0, 4, 0);
+  queue.push(&items[0], 0);
+  queue.push(&items[1], 3);
+  string lanes;
+  for (size_t idx = 0; idx < 10 && lanes.find('3') == string::npos; idx++) {
+    lanes += popLanes(&queue, 1);
+    queue.push(&items[0], 0);
+  }
+  verify("starvation", "refilled lane 0", "00003", lanes);
+}
+
+void checkMaxWait() {
+  // an overdue lane is served before a lane with a higher priority
+  LaneQueue<int*, LANES> queue;
+  queue.setLane(2, 1, 5);
+  queue.push(&items[2], 2);
+  queue.push(&items[0], 0);
+  verify("max wait", "not yet due", "0", popLanes(&queue, 1));
+  queue.push(&items[1], 0);
+  usleep(20000);
+  uint64_t waited = 0;
+  size_t lane = LANES;
+  int* item = queue.pop(&waited, &lane);
+  verify("max wait", "overdue", "2/2", getIndex(item) + "/" + to_string(lane));
+  verify("max wait", "waited", "true", waited >= 5 ? "true" : "false");
+  verify("max wait", "remaining", "0-", popLanes(&queue, 2));
+}
+
+void checkPeekRemove() {
+  // a peeked item stays selected until it is removed, even when a higher lane gets an item in the meantime
+  LaneQueue<int*, LANES> queue;
+  queue.push(&items[1], 1);
+  queue.push(&items[2], 1);
+  int* peeked = queue.peek();
+  verify("peek", "first", "1", getIndex(peeked));
+  queue.push(&items[0], 0);
+  verify("peek", "after higher lane", "1", getIndex(queue.peek()));
+  size_t lane = LANES;
+  bool removed = queue.remove(peeked, nullptr, &lane);
+  verify("peek", "remove", "true/1", string(removed ? "true" : "false") + "/" + to_string(lane));
+  verify("peek", "next", "0", getIndex(queue.peek()));
+  // an item not selected is removed as well without changing the selection
+  lane = LANES;
+  removed = queue.remove(&items[2], nullptr, &lane);
+  verify("peek", "remove other", "true/1", string(removed ? "true" : "false") + "/" + to_string(lane));
+  verify("peek", "remove missing", "false", queue.remove(&items[2]) ? "true" : "false");
+  verify("peek", "still next", "0", getIndex(queue.peek()));
+  verify("peek", "pop", "0", getIndex(queue.pop()));
+  verify("peek", "empty", "none/0", getIndex(queue.peek()) + "/" + to_string(queue.size()));
+}
+
+int main() {
+  checkWeights();
+  checkStarvation();
+  checkMaxWait();
+  checkPeekRemove();
+  return error ? 1 : 0;
+}
@@ -21,6 +21,12 @@
 #endif
 
 #include "lib/utils/thread.h"
+#include <sched.h>
+#ifdef HAVE_MLOCKALL
+#  include <sys/mman.h>
+#endif
+#include <cerrno>
+#include <cstring>
 #include "lib/utils/clock.h"
 
 namespace ebusd {
@@ -63,6 +69,54 @@ bool Thread::join() {
   return result == 0;
 }
 
+int Thread::setScheduling(int policy, int priority, int cpu) {
+  if (policy != SCHED_OTHER) {
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = priority;
+    int result = pthread_setschedparam(pthread_self(), policy, &param);
+    if (result != 0) {
+      return result;
+    }
+  }
+  if (cpu >= 0) {
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    int result = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    if (result != 0) {
+      return result;
+    }
+#else
+    return ENOSYS;
+#endif
+  }
+  return 0;
+}
+
+int Thread::lockMemory() {
+#ifdef HAVE_MLOCKALL
+#ifdef MCL_ONFAULT
+  // lock only the touched pages to not commit the full stack reservation of every thread
+  int flags = MCL_CURRENT | MCL_FUTURE | MCL_ONFAULT;
+#else
+  int flags = MCL_CURRENT | MCL_FUTURE;
+#endif
+  if (mlockall(flags) != 0) {
+    return errno;
+  }
+  // touch the stack so that it is faulted in and locked before it is needed
+  volatile char stack[STACK_PREFAULT_SIZE];
+  for (size_t pos = 0; pos < sizeof(stack); pos += 1024) {
+    stack[pos] = 0;
+  }
+  return 0;
+#else
+  return ENOSYS;
+#endif
+}
+
 void Thread::enter() {
   m_running = true;
   run();
@@ -134,4 +188,45 @@ bool NotifiableThread::waitNotified(int millis) {
   return notified;
 }
 
+
+SharedMutex::SharedMutex() {
+#ifdef HAVE_PTHREAD_RWLOCKATTR_SETKIND_NP
+  // the default of glibc prefers readers which lets an exclusive owner wait forever under continuous shared use
+  pthread_rwlockattr_t attr;
+  pthread_rwlockattr_init(&attr);
+  pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+  pthread_rwlock_init(&m_lock, &attr);
+  pthread_rwlockattr_destroy(&attr);
+#else
+  pthread_rwlock_init(&m_lock, nullptr);
+#endif
+  pthread_mutex_init(&m_writerGate, nullptr);
+}
+
+SharedMutex::~SharedMutex() {
+  pthread_rwlock_destroy(&m_lock);
+  pthread_mutex_destroy(&m_writerGate);
+}
+
+void SharedMutex::lockShared() {
+#ifdef HAVE_PTHREAD_RWLOCKATTR_SETKIND_NP
+  pthread_rwlock_rdlock(&m_lock);
+#else
+  pthread_mutex_lock(&m_writerGate);
+  pthread_rwlock_rdlock(&m_lock);
+  pthread_mutex_unlock(&m_writerGate);
+#endif
+}
+
+void SharedMutex::lock() {
+#ifdef HAVE_PTHREAD_RWLOCKATTR_SETKIND_NP
+  pthread_rwlock_wrlock(&m_lock);
+#else
+  // keep new shared owners out while waiting for the current ones
+  pthread_mutex_lock(&m_writerGate);
+  pthread_rwlock_wrlock(&m_lock);
+  pthread_mutex_unlock(&m_writerGate);
+#endif
+}
+
 }  // namespace ebusd
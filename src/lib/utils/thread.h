@@ -20,11 +20,15 @@
 #define LIB_UTILS_THREAD_H_
 
 #include <pthread.h>
+#include <cstddef>
 
 namespace ebusd {
 
 /** \file lib/utils/thread.h */
 
+/** the number of stack bytes to prefault in @a Thread::lockMemory(). */
+#define STACK_PREFAULT_SIZE (64*1024)
+
 /**
  * Wrapper class for pthread.
  */
@@ -77,6 +81,22 @@ class Thread {
    */
   pthread_t self() { return m_threadid; }
 
+  /**
+   * Set the realtime scheduling and the CPU affinity of the calling thread.
+   * @param policy the scheduling policy (SCHED_FIFO or SCHED_RR), or SCHED_OTHER to keep the scheduling.
+   * @param priority the realtime priority.
+   * @param cpu the CPU to pin the thread to, or -1 to keep the affinity.
+   * @return 0 on success, or the error number of the failed call.
+   */
+  static int setScheduling(int policy, int priority, int cpu);
+
+  /**
+   * Lock the current and future memory pages of the process and prefault @a STACK_PREFAULT_SIZE bytes of the
+   * stack of the calling thread.
+   * @return 0 on success, or the error number of the failed call.
+   */
+  static int lockMemory();
+
 
  protected:
   /**
@@ -214,6 +234,48 @@ class Mutex {
   pthread_mutex_t m_mutex;
 };
 
+
+/**
+ * A mutex allowing either multiple shared owners or a single exclusive owner.
+ * A waiting exclusive owner is preferred over new shared owners, so that continuous shared use can not starve it.
+ */
+class SharedMutex {
+ public:
+  /**
+   * Constructor.
+   */
+  SharedMutex();
+
+  /**
+   * Destructor.
+   */
+  virtual ~SharedMutex();
+
+  /**
+   * Lock this mutex for shared access.
+   */
+  void lockShared();
+
+  /**
+   * Lock this mutex for exclusive access.
+   */
+  void lock();
+
+  /**
+   * Unlock this mutex from either shared or exclusive access.
+   */
+  void inline unlock() {
+    pthread_rwlock_unlock(&m_lock);
+  }
+
+ private:
+  /** the read/write lock. */
+  pthread_rwlock_t m_lock;
+
+  /** the mutex held by a waiting exclusive owner to hold off new shared owners (if not preferred by @a m_lock). */
+  pthread_mutex_t m_writerGate;
+};
+
 }  // namespace ebusd
 
 #endif  // LIB_UTILS_THREAD_H_
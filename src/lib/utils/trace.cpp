@@ -0,0 +1,241 @@
+/*
+ * ebusd - daemon for communication with eBUS heating systems.
+ * Copyright (C) 2021 John Baier <ebusd@ebusd.eu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "lib/utils/trace.h"
+#include <pthread.h>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include "lib/utils/clock.h"
+#include "lib/utils/thread.h"
+
+namespace ebusd {
+
+/**
+ * A single recorded event.
+ */
+struct TraceEvent {
+  /** the start time in nanoseconds. */
+  uint64_t m_start;
+
+  /** the duration in nanoseconds for a complete event, or UINT64_MAX for an instant event. */
+  uint64_t m_duration;
+
+  /** the static event name. */
+  const char* m_name;
+
+  /** the optional static argument string, or nullptr. */
+  const char* m_arg;
+};
+
+/**
+ * The events recorded by a single thread.
+ */
+struct TraceBuffer {
+  /** the thread name. */
+  char m_threadName[16];
+
+  /** the total number of events written so far (only written by the owning thread). */
+  std::atomic<uint64_t> m_written;
+
+  /** whether this buffer is owned by a running thread. */
+  std::atomic<bool> m_owned;
+
+  /** the ring of events. */
+  TraceEvent m_events[TRACE_BUFFER_EVENTS];
+};
+
+std::atomic<bool> g_traceEnabled(false);
+
+/** the @a Mutex for @a s_traceBuffers. */
+static Mutex s_traceMutex;
+
+/** the allocated buffers (never freed, released buffers are reused by new threads). */
+static TraceBuffer* s_traceBuffers[TRACE_MAX_THREADS];
+
+/** the number of allocated buffers. */
+static size_t s_traceBufferCount = 0;
+
+/**
+ * Helper for releasing the buffer of a thread on exit.
+ */
+class TraceBufferHolder {
+ public:
+  /**
+   * Construct a new instance.
+   */
+  TraceBufferHolder() : m_buffer(nullptr), m_failed(false) {}
+
+  /**
+   * Destructor releasing the buffer.
+   */
+  ~TraceBufferHolder() {
+    if (m_buffer) {
+      m_buffer->m_owned.store(false, std::memory_order_release);
+    }
+  }
+
+  /** the buffer of this thread, or nullptr. */
+  TraceBuffer* m_buffer;
+
+  /** whether no buffer was available for this thread. */
+  bool m_failed;
+};
+
+/** the buffer holder of the current thread. */
+static thread_local TraceBufferHolder s_traceHolder;
+
+/**
+ * Get the buffer of the calling thread, acquiring one if necessary.
+ * @return the @a TraceBuffer, or nullptr if none is available.
+ */
+static TraceBuffer* getTraceBuffer() {
+  if (s_traceHolder.m_buffer || s_traceHolder.m_failed) {
+    return s_traceHolder.m_buffer;
+  }
+  TraceBuffer* buffer = nullptr;
+  s_traceMutex.lock();
+  for (size_t pos = 0; pos < s_traceBufferCount; pos++) {
+    if (!s_traceBuffers[pos]->m_owned.load(std::memory_order_acquire)) {
+      buffer = s_traceBuffers[pos];
+      break;
+    }
+  }
+  if (!buffer && s_traceBufferCount < TRACE_MAX_THREADS) {
+    buffer = new TraceBuffer();
+    s_traceBuffers[s_traceBufferCount++] = buffer;
+  }
+  if (buffer) {
+    buffer->m_owned.store(true, std::memory_order_relaxed);
+    buffer->m_written.store(0, std::memory_order_relaxed);
+    buffer->m_threadName[0] = 0;
+#ifdef HAVE_PTHREAD_SETNAME_NP
+#ifndef __MACH__
+    pthread_getname_np(pthread_self(), buffer->m_threadName, sizeof(buffer->m_threadName));
+#endif
+#endif
+  }
+  s_traceMutex.unlock();
+  s_traceHolder.m_buffer = buffer;
+  s_traceHolder.m_failed = buffer == nullptr;
+  return buffer;
+}
+
+/**
+ * Add an event to the buffer of the calling thread.
+ * @param name the static event name.
+ * @param start the start time in nanoseconds.
+ * @param duration the duration in nanoseconds, or UINT64_MAX for an instant event.
+ * @param arg the optional static argument string, or nullptr.
+ */
+static void addTraceEvent(const char* name, uint64_t start, uint64_t duration, const char* arg) {
+  TraceBuffer* buffer = getTraceBuffer();
+  if (!buffer) {
+    return;
+  }
+  uint64_t written = buffer->m_written.load(std::memory_order_relaxed);
+  TraceEvent& event = buffer->m_events[written % TRACE_BUFFER_EVENTS];
+  event.m_start = start;
+  event.m_duration = duration;
+  event.m_name = name;
+  event.m_arg = arg;
+  buffer->m_written.store(written+1, std::memory_order_release);
+}
+
+bool setTraceEnabled(bool enable) {
+  return g_traceEnabled.exchange(enable) != enable;
+}
+
+void clearTrace() {
+  s_traceMutex.lock();
+  for (size_t pos = 0; pos < s_traceBufferCount; pos++) {
+    s_traceBuffers[pos]->m_written.store(0, std::memory_order_relaxed);
+  }
+  s_traceMutex.unlock();
+}
+
+uint64_t getTraceTime() {
+  struct timespec t;
+  clockGettimeMonotonic(&t);
+  return static_cast<uint64_t>(t.tv_sec)*1000000000ULL + static_cast<uint64_t>(t.tv_nsec);
+}
+
+void traceInstant(const char* name, const char* arg) {
+  if (isTraceEnabled()) {
+    addTraceEvent(name, getTraceTime(), UINT64_MAX, arg);
+  }
+}
+
+void traceComplete(const char* name, uint64_t start, const char* arg) {
+  if (isTraceEnabled()) {
+    uint64_t now = getTraceTime();
+    addTraceEvent(name, start, now >= start ? now-start : 0, arg);
+  }
+}
+
+/**
+ * Format a time in nanoseconds as microseconds with fraction.
+ * @param nanos the time in nanoseconds.
+ * @param output the @a ostream to format to.
+ */
+static void formatTraceMicros(uint64_t nanos, ostream* output) {
+  char str[32];
+  snprintf(str, sizeof(str), "%" PRIu64 ".%03u", nanos/1000, static_cast<unsigned>(nanos%1000));
+  *output << str;
+}
+
+void formatTrace(ostream* output) {
+  *output << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+  bool first = true;
+  s_traceMutex.lock();
+  for (size_t pos = 0; pos < s_traceBufferCount; pos++) {
+    const TraceBuffer* buffer = s_traceBuffers[pos];
+    uint64_t written = buffer->m_written.load(std::memory_order_acquire);
+    if (written == 0) {
+      continue;
+    }
+    *output << (first ? "\n" : ",\n")
+            << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << (pos+1)
+            << ",\"args\":{\"name\":\"" << (buffer->m_threadName[0] ? buffer->m_threadName : "thread") << "\"}}";
+    first = false;
+    uint64_t start = written > TRACE_BUFFER_EVENTS ? written-TRACE_BUFFER_EVENTS : 0;
+    for (uint64_t index = start; index < written; index++) {
+      const TraceEvent& event = buffer->m_events[index % TRACE_BUFFER_EVENTS];
+      *output << ",\n{\"name\":\"" << event.m_name << "\",\"ph\":\""
+              << (event.m_duration == UINT64_MAX ? "i\",\"s\":\"t" : "X") << "\",\"pid\":1,\"tid\":" << (pos+1)
+              << ",\"ts\":";
+      formatTraceMicros(event.m_start, output);
+      if (event.m_duration != UINT64_MAX) {
+        *output << ",\"dur\":";
+        formatTraceMicros(event.m_duration, output);
+      }
+      if (event.m_arg) {
+        *output << ",\"args\":{\"arg\":\"" << event.m_arg << "\"}";
+      }
+      *output << "}";
+    }
+  }
+  s_traceMutex.unlock();
+  *output << "\n]}";
+}
+
+}  // namespace ebusd
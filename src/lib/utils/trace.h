@@ -0,0 +1,125 @@
+/*
+ * ebusd - daemon for communication with eBUS heating systems.
+ * Copyright (C) 2021 John Baier <ebusd@ebusd.eu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIB_UTILS_TRACE_H_
+#define LIB_UTILS_TRACE_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <ostream>
+
+namespace ebusd {
+
+/** \file lib/utils/trace.h
+ * Low overhead tracing of events into per-thread buffers with export to the Chrome trace event format (also
+ * readable by Perfetto).
+ */
+
+using std::ostream;
+
+/** the number of events kept per thread (older ones are overwritten). */
+#define TRACE_BUFFER_EVENTS 8192
+
+/** the maximum number of threads with a trace buffer. */
+#define TRACE_MAX_THREADS 32
+
+/** whether tracing is currently enabled (only to be used by @a isTraceEnabled()). */
+extern std::atomic<bool> g_traceEnabled;
+
+/**
+ * Return whether tracing is currently enabled.
+ * @return whether tracing is currently enabled.
+ */
+inline bool isTraceEnabled() { return g_traceEnabled.load(std::memory_order_relaxed); }
+
+/**
+ * Enable or disable tracing.
+ * @param enable true to enable, false to disable tracing.
+ * @return true when the tracing was changed.
+ */
+bool setTraceEnabled(bool enable);
+
+/**
+ * Remove all recorded events.
+ */
+void clearTrace();
+
+/**
+ * Get the current monotonic time for tracing.
+ * @return the current monotonic time in nanoseconds.
+ */
+uint64_t getTraceTime();
+
+/**
+ * Record an instant event in the buffer of the calling thread (if tracing is enabled).
+ * @param name the static event name.
+ * @param arg the optional static argument string, or nullptr.
+ */
+void traceInstant(const char* name, const char* arg = nullptr);
+
+/**
+ * Record a complete event ending now in the buffer of the calling thread (if tracing is enabled).
+ * @param name the static event name.
+ * @param start the start time from @a getTraceTime().
+ * @param arg the optional static argument string, or nullptr.
+ */
+void traceComplete(const char* name, uint64_t start, const char* arg = nullptr);
+
+/**
+ * Format all recorded events in the Chrome trace event JSON format.
+ * @param output the @a ostream to format to.
+ */
+void formatTrace(ostream* output);
+
+/**
+ * Helper for recording the duration of a scope as complete event.
+ */
+class TraceScope {
+ public:
+  /**
+   * Construct a new instance and remember the start time when tracing is enabled.
+   * @param name the static event name.
+   * @param arg the optional static argument string, or nullptr.
+   */
+  explicit TraceScope(const char* name, const char* arg = nullptr)
+    : m_name(isTraceEnabled() ? name : nullptr), m_arg(arg), m_start(m_name ? getTraceTime() : 0) {}
+
+  /**
+   * Destructor recording the complete event.
+   */
+  ~TraceScope() {
+    if (m_name) {
+      traceComplete(m_name, m_start, m_arg);
+    }
+  }
+
+
+ private:
+  /** the static event name, or nullptr when tracing was disabled at construction. */
+  const char* m_name;
+
+  /** the optional static argument string, or nullptr. */
+  const char* m_arg;
+
+  /** the start time from @a getTraceTime(). */
+  const uint64_t m_start;
+};
+
+}  // namespace ebusd
+
+#endif  // LIB_UTILS_TRACE_H_
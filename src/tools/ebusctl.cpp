@@ -26,10 +26,13 @@
 #  include <poll.h>
 #endif
 #include <cstdio>
+#include <iomanip>
 #include <iostream>
 #include <cstdlib>
 #include <sstream>
 #include <string>
+#include <vector>
+#include "ebusd/binaryprotocol.h"
 #include "lib/utils/tcpsocket.h"
 
 namespace ebusd {
@@ -39,12 +42,15 @@ using std::cin;
 using std::cout;
 using std::string;
 using std::endl;
+using std::istringstream;
+using std::vector;
 
 /** A structure holding all program options. */
 struct options {
   const char* server;     //!< ebusd server host (name or ip) [localhost]
   uint16_t port;          //!< ebusd server port [8888]
   uint16_t timeout;       //!< ebusd connect/send/receive timeout
+  bool binary;            //!< use the binary protocol
 
   char* const *args;      //!< arguments to pass to ebusd
   unsigned int argCount;  //!< number of arguments to pass to ebusd
@@ -55,6 +61,7 @@ static struct options opt = {
   "localhost",  // server
   8888,         // port
   0,            // timeout
+  false,        // binary
 
   nullptr,         // args
   0             // argCount
@@ -71,7 +78,11 @@ static const char argpdoc[] =
   "Client for acessing " PACKAGE " via TCP.\n"
   "\v"
   "If given, send COMMAND together with CMDOPT options to " PACKAGE ".\n"
-  "Use 'help' as COMMAND for help on available " PACKAGE " commands.";
+  "Use 'help' as COMMAND for help on available " PACKAGE " commands.\n"
+  "With the binary protocol, only these commands are available:\n"
+  "  read [-m SECONDS] [-r] [-c CIRCUIT] [CIRCUIT:]NAME...\n"
+  "  listen [-r] [-c CIRCUIT] [CIRCUIT:]NAME...\n"
+  "with -m for the maximum age of a cached value [300], and -r for the raw data instead of the field values.";
 
 /** the description of the accepted arguments. */
 static char argpargsdoc[] = "\nCOMMAND [CMDOPT...]";
@@ -82,6 +93,7 @@ static const struct argp_option argpoptions[] = {
   {"server",  's', "HOST",  0, "Connect to " PACKAGE " on HOST (name or IP) [localhost]", 0 },
   {"port",    'p', "PORT",  0, "Connect to " PACKAGE " on PORT [8888]", 0 },
   {"timeout", 't', "SECS",  0, "Timeout for connection to " PACKAGE ", 0 for none [0]", 0 },
+  {"binary",  'b', nullptr, 0, "Use the compact binary protocol", 0 },
 
   {nullptr,     0, nullptr, 0, nullptr, 0 },
 };
@@ -121,6 +133,9 @@ error_t parse_opt(int key, char *arg, struct argp_state *state) {
     }
     opt->timeout = (uint16_t)value;
     break;
+  case 'b':  // --binary
+    opt->binary = true;
+    break;
   case ARGP_KEY_ARGS:
     opt->args = state->argv + state->next;
     opt->argCount = state->argc - state->next;
@@ -246,14 +261,236 @@ string fetchData(ebusd::TCPSocket* socket, bool listening) {
   return ostream.str();
 }
 
-bool connect(const char* host, uint16_t port, int timeout, char* const *args, int argCount) {
+/**
+ * Receive the next frame of the binary protocol.
+ * @param socket the @a TCPSocket to receive from.
+ * @param buffer the buffer with the data received so far.
+ * @param type set to the frame type.
+ * @param requestId set to the request ID.
+ * @param payload set to the payload.
+ * @return true on success, false if the connection was closed or the data is invalid.
+ */
+bool receiveFrame(ebusd::TCPSocket* socket, string* buffer, uint8_t* type, uint32_t* requestId, string* payload) {
+  char data[1024];
+  while (true) {
+    size_t size = getBinaryFrameSize(*buffer, 0);
+    if (size == string::npos) {
+      return false;
+    }
+    if (size > 0) {
+      *type = static_cast<uint8_t>((*buffer)[1]);
+      *requestId = static_cast<uint32_t>(readBinaryNumber(*buffer, 4, 4));
+      *payload = buffer->substr(BINARY_HEADER_SIZE, size-BINARY_HEADER_SIZE);
+      buffer->erase(0, size);
+      return true;
+    }
+    ssize_t datalen = socket->recv(data, sizeof(data));
+    if (datalen <= 0) {
+      return false;
+    }
+    buffer->append(data, static_cast<size_t>(datalen));
+  }
+}
+
+/**
+ * Format the response payload of the binary protocol.
+ * @param type the frame type.
+ * @param payload the payload.
+ * @return the formatted value or error.
+ */
+string formatFrame(uint8_t type, const string& payload) {
+  if (type == bft_error) {
+    return payload.length() > 4 ? payload.substr(4) : "ERR: invalid response";
+  }
+  if ((type != bft_value && type != bft_update) || payload.length() < 10) {
+    return "ERR: invalid response";
+  }
+  ostringstream ostream;
+  size_t pos = 9;
+  if (payload[8] & BINARY_FLAG_RAW) {
+    for (int part = 0; part < 2 && pos < payload.length(); part++) {
+      if (part > 0) {
+        ostream << " / ";
+      }
+      size_t length = static_cast<uint8_t>(payload[pos++]);
+      for (; length > 0 && pos < payload.length(); length--) {
+        ostream << std::hex << std::setw(2) << std::setfill('0') << static_cast<unsigned>(payload[pos++] & 0xff);
+      }
+    }
+    return ostream.str();
+  }
+  size_t count = static_cast<uint8_t>(payload[pos++]);
+  for (size_t index = 0; index < count && pos < payload.length(); index++) {
+    if (index > 0) {
+      ostream << ";";
+    }
+    uint8_t fieldType = static_cast<uint8_t>(payload[pos++]);
+    if (fieldType == 1 && pos + 8 <= payload.length()) {  // number
+      ostream << readBinaryDouble(payload, pos);
+      pos += 8;
+    } else if (fieldType == 2 && pos + 2 <= payload.length()) {  // string
+      size_t length = static_cast<size_t>(readBinaryNumber(payload, pos, 2));
+      ostream << payload.substr(pos + 2, length);
+      pos += 2 + length;
+    } else {
+      ostream << "-";
+    }
+  }
+  return ostream.str();
+}
+
+/**
+ * Execute a read or listen command using the binary protocol.
+ * @param socket the @a TCPSocket to use.
+ * @param args the command and its arguments.
+ * @return true on success, false if the connection failed.
+ */
+bool binaryCommand(ebusd::TCPSocket* socket, const vector<string>& args) {
+  string cmd = args[0];
+  bool listen = strcasecmp(cmd.c_str(), "L") == 0 || strcasecmp(cmd.c_str(), "LISTEN") == 0;
+  if (!listen && strcasecmp(cmd.c_str(), "R") != 0 && strcasecmp(cmd.c_str(), "READ") != 0) {
+    cout << "ERR: command not available in binary protocol" << endl << endl;
+    return true;
+  }
+  unsigned long maxAge = 5*60;
+  uint8_t flags = 0;
+  string circuit;
+  vector<std::pair<string, string>> names;
+  for (size_t argPos = 1; argPos < args.size(); argPos++) {
+    const string& arg = args[argPos];
+    if (arg == "-r") {
+      flags |= BINARY_FLAG_RAW;
+    } else if ((arg == "-m" || arg == "-c") && argPos + 1 < args.size()) {
+      if (arg == "-c") {
+        circuit = args[++argPos];
+        continue;
+      }
+      char* strEnd = nullptr;
+      maxAge = strtoul(args[++argPos].c_str(), &strEnd, 10);
+      if (strEnd == nullptr || *strEnd != 0 || maxAge > 0xffff) {
+        cout << "ERR: invalid argument" << endl << endl;
+        return true;
+      }
+    } else {
+      size_t pos = arg.find(':');
+      if (pos == string::npos) {
+        names.push_back(std::make_pair(circuit, arg));
+      } else {
+        names.push_back(std::make_pair(arg.substr(0, pos), arg.substr(pos + 1)));
+      }
+    }
+  }
+  if (names.empty()) {
+    cout << "ERR: invalid argument" << endl << endl;
+    return true;
+  }
+  // resolve all names at once
+  string request, buffer, payload;
+  for (size_t idx = 0; idx < names.size(); idx++) {
+    appendBinaryFrame(bft_resolve, static_cast<uint32_t>(idx+1), names[idx].first + '\0' + names[idx].second + '\0',
+      &request);
+  }
+  socket->send(request.data(), request.size());
+  vector<uint32_t> handles(names.size(), 0);
+  vector<string> results(names.size());
+  uint8_t type;
+  uint32_t requestId;
+  size_t pending = names.size();
+  for (; pending > 0; pending--) {
+    if (!receiveFrame(socket, &buffer, &type, &requestId, &payload)) {
+      return false;
+    }
+    if (requestId < 1 || requestId > names.size()) {
+      continue;
+    }
+    if (type == bft_handle && payload.length() >= 4) {
+      handles[requestId-1] = static_cast<uint32_t>(readBinaryNumber(payload, 0, 4));
+    } else {
+      results[requestId-1] = formatFrame(type, payload);
+    }
+  }
+  // then read or subscribe to all resolved handles at once
+  request.clear();
+  for (size_t idx = 0; idx < names.size(); idx++) {
+    if (handles[idx] == 0) {
+      continue;
+    }
+    string data;
+    appendBinaryNumber(handles[idx], 4, &data);
+    if (!listen) {
+      appendBinaryNumber(maxAge, 2, &data);
+    }
+    data.push_back(static_cast<char>(flags));
+    appendBinaryFrame(listen ? bft_subscribe : bft_read, static_cast<uint32_t>(idx+1), data, &request);
+    pending++;
+  }
+  if (pending > 0) {
+    socket->send(request.data(), request.size());
+  }
+  for (; pending > 0; pending--) {
+    if (!receiveFrame(socket, &buffer, &type, &requestId, &payload)) {
+      return false;
+    }
+    if (requestId >= 1 && requestId <= names.size() && type != bft_ok) {
+      results[requestId-1] = formatFrame(type, payload);
+    }
+  }
+  for (size_t idx = 0; idx < names.size(); idx++) {
+    if (!listen || !results[idx].empty()) {
+      cout << names[idx].first << " " << names[idx].second << " = " << results[idx] << endl;
+    }
+  }
+  if (!listen) {
+    cout << endl;
+    return true;
+  }
+  // print pushed updates until the connection gets closed
+  while (receiveFrame(socket, &buffer, &type, &requestId, &payload)) {
+    if (type != bft_update || payload.length() < 4) {
+      continue;
+    }
+    uint32_t handle = static_cast<uint32_t>(readBinaryNumber(payload, 0, 4));
+    for (size_t idx = 0; idx < names.size(); idx++) {
+      if (handles[idx] == handle) {
+        cout << names[idx].first << " " << names[idx].second << " = " << formatFrame(type, payload) << endl;
+        break;
+      }
+    }
+  }
+  return false;
+}
+
+bool connect(const char* host, uint16_t port, int timeout, bool binary, char* const *args, int argCount) {
   TCPClient* client = new TCPClient();
   TCPSocket* socket = client->connect(host, port, timeout);
   bool ret;
 
   bool once = args != nullptr && argCount > 0;
   ret = socket != nullptr;
-  if (ret) {
+  if (ret && binary) {
+    do {
+      vector<string> command;
+      if (!once) {
+        cout << host << ": ";
+        string message, token;
+        getline(cin, message);
+        istringstream stream(message);
+        while (stream >> token) {
+          command.push_back(token);
+        }
+      } else {
+        command.assign(args, args + argCount);
+      }
+      if (command.empty()) {
+        continue;
+      }
+      if (strcasecmp(command[0].c_str(), "Q") == 0 || strcasecmp(command[0].c_str(), "QUIT") == 0) {
+        break;
+      }
+      ret = binaryCommand(socket, command);
+    } while (ret && !once && !cin.eof());
+    delete socket;
+  } else if (ret) {
     string message, sendmessage;
     do {
       bool listening = false;
@@ -322,7 +559,7 @@ int main(int argc, char* argv[]) {
   if (argp_parse(&argp, argc, argv, ARGP_IN_ORDER, nullptr, &opt) != 0) {
     return EINVAL;
   }
-  bool success = connect(opt.server, opt.port, opt.timeout, opt.args, opt.argCount);
+  bool success = connect(opt.server, opt.port, opt.timeout, opt.binary, opt.args, opt.argCount);
 
   exit(success ? EXIT_SUCCESS : EXIT_FAILURE);
 }
@@ -0,0 +1,628 @@
+/*
+ * ebusd - daemon for communication with eBUS heating systems.
+ * Copyright (C) 2021 John Baier <ebusd@ebusd.eu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <argp.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <string>
+#include <vector>
+#include "lib/ebus/message.h"
+#include "lib/ebus/symbol.h"
+#include "lib/utils/rotatefile.h"
+#include "lib/utils/thread.h"
+
+namespace ebusd {
+
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::ofstream;
+using std::ostream;
+using std::ostringstream;
+using std::setw;
+using std::setfill;
+
+/** the approximate number of dump file bytes decoded by a worker in one go. */
+#define CHUNK_SIZE (1024*1024)
+
+/** the number of chunks per thread to decode before writing the output. */
+#define CHUNKS_PER_ROUND 4
+
+/** the length of a record header in a timed dump file (timestamp and length). */
+#define TIMED_HEADER_LEN 10
+
+/** A structure holding all program options. */
+struct options {
+  const char* configPath;  //!< path to the local CSV configuration files [/etc/ebusd]
+  bool json;  //!< whether to emit JSON lines instead of CSV [false]
+  unsigned int threads;  //!< number of threads for decoding, 0 for number of CPUs [0]
+  const char* outputFile;  //!< file to write the output to, or nullptr for stdout
+};
+
+/** the program options. */
+static struct options opt = {
+  "/etc/ebusd",  // configPath
+  false,  // json
+  0,  // threads
+  nullptr,  // outputFile
+};
+
+/** the dump files to decode. */
+static vector<string> s_dumpFiles;
+
+/** the global @a DataFieldTemplates. */
+static DataFieldTemplates s_globalTemplates;
+
+/** the @a DataFieldTemplates by relative path (may also carry @a s_globalTemplates). */
+static map<string, DataFieldTemplates*> s_templatesByPath;
+
+/** the version string of the program. */
+const char *argp_program_version = "ebusdecode of """ PACKAGE_STRING "";
+
+/** the report bugs to address of the program. */
+const char *argp_program_bug_address = "" PACKAGE_BUGREPORT "";
+
+/** the documentation of the program. */
+static const char argpdoc[] =
+  "Decode the telegrams from one or more " PACKAGE " DUMPFILEs offline using the local CSV config files.\n"
+  "\v"
+  "The DUMPFILEs may be plain (--dumpfile) or timed (--dumptimed) dumps. They are split at telegram boundaries and "
+  "decoded in parallel, while the output keeps the order of the telegrams.\n"
+  "\n"
+  "The csv format emits one row per decoded field with the columns time, circuit, name, field, and value. "
+  "The json format emits one object per decoded message and line. The time is only set for timed DUMPFILEs.\n";
+
+/** the description of the accepted arguments. */
+static char argpargsdoc[] = "DUMPFILE...";
+
+/** the definition of the known program arguments. */
+static const struct argp_option argpoptions[] = {
+  {"configpath", 'c', "PATH",   0, "Read CSV config files from local PATH [/etc/ebusd]", 0 },
+  {"format",     'f', "FORMAT", 0, "Output FORMAT (csv or json) [csv]", 0 },
+  {"threads",    'j', "COUNT",  0, "Decode in COUNT threads (0=number of CPUs) [0]", 0 },
+  {"output",     'o', "FILE",   0, "Write the output to FILE [stdout]", 0 },
+
+  {nullptr,        0, nullptr,  0, nullptr, 0 },
+};
+
+/**
+ * The program argument parsing function.
+ * @param key the key from @a argpoptions.
+ * @param arg the option argument, or nullptr.
+ * @param state the parsing state.
+ */
+error_t parse_opt(int key, char *arg, struct argp_state *state) {
+  struct options *opt = (struct options*)state->input;
+  char* strEnd = nullptr;
+  switch (key) {
+  case 'c':  // --configpath=/etc/ebusd
+    if (arg == nullptr || arg[0] == 0 || strstr(arg, "://") != nullptr) {
+      argp_error(state, "invalid configpath");
+      return EINVAL;
+    }
+    opt->configPath = arg;
+    break;
+  case 'f':  // --format=csv
+    if (arg == nullptr || (strcmp("csv", arg) != 0 && strcmp("json", arg) != 0)) {
+      argp_error(state, "invalid format");
+      return EINVAL;
+    }
+    opt->json = strcmp("json", arg) == 0;
+    break;
+  case 'j':  // --threads=0
+    opt->threads = (unsigned int)strtoul(arg, &strEnd, 10);
+    if (strEnd == nullptr || strEnd == arg || *strEnd != 0 || opt->threads > 256) {
+      argp_error(state, "invalid threads");
+      return EINVAL;
+    }
+    break;
+  case 'o':  // --output=FILE
+    if (arg == nullptr || arg[0] == 0) {
+      argp_error(state, "invalid output");
+      return EINVAL;
+    }
+    opt->outputFile = arg;
+    break;
+  case ARGP_KEY_ARG:
+    if (arg == nullptr || arg[0] == 0 || strcmp("/", arg) == 0) {
+      argp_error(state, "invalid dumpfile");
+      return EINVAL;
+    }
+    s_dumpFiles.push_back(arg);
+    break;
+  case ARGP_KEY_NO_ARGS:
+    argp_error(state, "missing dumpfile");
+    return EINVAL;
+  default:
+    return ARGP_ERR_UNKNOWN;
+  }
+  return 0;
+}
+
+DataFieldTemplates* getTemplates(const string& filename) {
+  string path;
+  size_t pos = filename.find_last_of('/');
+  if (pos != string::npos) {
+    path = filename.substr(0, pos);
+  }
+  const auto it = s_templatesByPath.find(path);
+  if (it != s_templatesByPath.end()) {
+    return it->second;
+  }
+  return &s_globalTemplates;
+}
+
+result_t loadDefinitionsFromConfigPath(FileReader* reader, const string& filename, bool verbose,
+    map<string, string>* defaults, string* errorDescription, bool replace = false) {
+  time_t mtime = 0;
+  istream* stream = FileReader::openFile(string(opt.configPath) + "/" + filename, errorDescription, &mtime);
+  if (!stream) {
+    return RESULT_ERR_NOTFOUND;
+  }
+  result_t result = reader->readFromStream(stream, filename, mtime, verbose, defaults, errorDescription, replace);
+  delete(stream);
+  return result;
+}
+
+/**
+ * Read the templates and message definitions from the specified path and all sub directories.
+ * @param relPath the relative path from which to read the files (without trailing "/").
+ * @param messages the @a MessageMap to load the messages into.
+ */
+static void readConfigFiles(const string& relPath, MessageMap* messages) {
+  string path = string(opt.configPath) + (relPath.empty() ? "" : "/" + relPath);
+  DIR* dir = opendir(path.c_str());
+  if (dir == nullptr) {
+    cerr << "unable to read config path " << path << endl;
+    return;
+  }
+  vector<string> files, dirs;
+  bool hasTemplates = false;
+  string relPathWithSlash = relPath.empty() ? "" : relPath + "/";
+  struct dirent* entry;
+  while ((entry = readdir(dir))) {
+    string name = entry->d_name;
+    if (name[0] == '.') {
+      continue;
+    }
+    struct stat st;
+    if (stat((path + "/" + name).c_str(), &st) != 0) {
+      continue;
+    }
+    if (S_ISDIR(st.st_mode)) {
+      dirs.push_back(relPathWithSlash + name);
+    } else if (S_ISREG(st.st_mode) && name.length() > 4 && name.substr(name.length() - 4) == ".csv") {
+      if (name == "_templates.csv") {
+        hasTemplates = true;
+      } else {
+        files.push_back(relPathWithSlash + name);
+      }
+    }
+  }
+  closedir(dir);
+  std::sort(files.begin(), files.end());
+  std::sort(dirs.begin(), dirs.end());
+  string errorDescription;
+  if (hasTemplates) {
+    DataFieldTemplates* templates = relPath.empty() ? &s_globalTemplates : new DataFieldTemplates(s_globalTemplates);
+    s_templatesByPath[relPath] = templates;
+    result_t result = loadDefinitionsFromConfigPath(templates, relPathWithSlash + "_templates.csv", false, nullptr,
+        &errorDescription, true);
+    if (result != RESULT_OK) {
+      cerr << "error reading templates in " << (relPath.empty() ? "/" : relPath) << ": " << getResultCode(result)
+           << ", last error: " << errorDescription << endl;
+    }
+  }
+  for (const auto& name : files) {
+    errorDescription.clear();
+    result_t result = loadDefinitionsFromConfigPath(messages, name, false, nullptr, &errorDescription);
+    if (result != RESULT_OK) {
+      cerr << "error reading file " << name << ": " << getResultCode(result) << ", last error: "
+           << errorDescription << endl;
+    }
+  }
+  for (const auto& name : dirs) {
+    readConfigFiles(name, messages);
+  }
+}
+
+/**
+ * A part of a dump file decoded in one go.
+ */
+struct Chunk {
+  const uint8_t* data;  //!< the start of the chunk within the dump file
+  size_t length;  //!< the length of the chunk in bytes
+  string output;  //!< the formatted output
+  unsigned int decoded;  //!< the number of decoded telegrams
+  unsigned int unknown;  //!< the number of valid telegrams without matching message
+  unsigned int invalid;  //!< the number of invalid or incomplete telegrams
+};
+
+/**
+ * Append a value to a CSV row, quoted if necessary.
+ * @param value the value to append.
+ * @param output the @a ostream to append to.
+ */
+static void appendCsvValue(const string& value, ostream* output) {
+  if (value.find_first_of(",\"\r\n") == string::npos) {
+    *output << value;
+    return;
+  }
+  *output << '"';
+  for (const auto ch : value) {
+    if (ch == '"') {
+      *output << '"';
+    }
+    *output << ch;
+  }
+  *output << '"';
+}
+
+/**
+ * Format a timestamp as UTC ISO 8601 date and time with milliseconds.
+ * @param micros the timestamp in microseconds since the epoch, or 0 for none.
+ * @return the formatted timestamp, or empty for none.
+ */
+static string formatTime(uint64_t micros) {
+  if (micros == 0) {
+    return "";
+  }
+  time_t seconds = static_cast<time_t>(micros / 1000000);
+  struct tm tm;
+  gmtime_r(&seconds, &tm);
+  char str[32];
+  size_t len = strftime(str, sizeof(str), "%Y-%m-%dT%H:%M:%S", &tm);
+  snprintf(str + len, sizeof(str) - len, ".%03dZ", static_cast<int>((micros / 1000) % 1000));
+  return str;
+}
+
+/**
+ * Decode a single telegram and append the output.
+ * @param messages the @a MessageMap to determine the @a Message from.
+ * @param data the escaped symbols of the telegram.
+ * @param length the number of symbols in @a data.
+ * @param micros the timestamp in microseconds since the epoch, or 0 for none.
+ * @param chunk the @a Chunk to append the output to and to update the counters of.
+ */
+static void decodeTelegram(const MessageMap* messages, const uint8_t* data, size_t length, uint64_t micros,
+    Chunk* chunk) {
+  MasterSymbolString master;
+  SlaveSymbolString slave;
+  result_t result = splitTelegram(data, length, &master, &slave);
+  if (result == RESULT_EMPTY) {
+    return;
+  }
+  if (result != RESULT_OK) {
+    chunk->invalid++;
+    return;
+  }
+  Message* message = messages->find(master, false, true, true, true, false);
+  if (message == nullptr || dynamic_cast<ChainedMessage*>(message) != nullptr) {
+    // chained messages need several telegrams combined, which is not possible across chunks
+    chunk->unknown++;
+    return;
+  }
+  string time = formatTime(micros);
+  ostringstream output;
+  if (opt.json) {
+    output << "{\"time\":";
+    if (time.empty()) {
+      output << "null";
+    } else {
+      output << "\"" << time << "\"";
+    }
+    output << ",\"circuit\":\"" << message->getCircuit() << "\",\"name\":\"" << message->getName()
+           << "\",\"fields\":{";
+    result = message->decodeData(master, slave, false, nullptr, -1, OF_NAMES|OF_JSON|OF_SHORT, &output);
+    if (result != RESULT_OK && result != RESULT_EMPTY) {
+      chunk->invalid++;
+      return;
+    }
+    output << "}}\n";
+  } else {
+    for (size_t index = 0; index < message->getFieldCount(); index++) {
+      ostringstream value;
+      result = message->decodeData(master, slave, false, nullptr, static_cast<ssize_t>(index), OF_NAMES, &value);
+      if (result == RESULT_ERR_NOTFOUND || result == RESULT_EMPTY) {
+        continue;
+      }
+      if (result != RESULT_OK) {
+        chunk->invalid++;
+        return;
+      }
+      // the field name is taken from the formatted value as it might not be unique
+      string nameValue = value.str();
+      size_t pos = nameValue.find('=');
+      output << time << ",";
+      appendCsvValue(message->getCircuit(), &output);
+      output << ",";
+      appendCsvValue(message->getName(), &output);
+      output << ",";
+      appendCsvValue(nameValue.substr(0, pos == string::npos ? 0 : pos), &output);
+      output << ",";
+      appendCsvValue(pos == string::npos ? nameValue : nameValue.substr(pos + 1), &output);
+      output << "\n";
+    }
+  }
+  chunk->output += output.str();
+  chunk->decoded++;
+}
+
+/**
+ * Decode all telegrams of a @a Chunk.
+ * @param messages the @a MessageMap to determine the @a Message from.
+ * @param timed whether the chunk consists of records of a timed dump file.
+ * @param chunk the @a Chunk to decode.
+ */
+static void decodeChunk(const MessageMap* messages, bool timed, Chunk* chunk) {
+  const uint8_t* pos = chunk->data;
+  const uint8_t* end = chunk->data + chunk->length;
+  while (pos < end) {
+    if (!timed) {
+      const uint8_t* next = static_cast<const uint8_t*>(memchr(pos, SYN, static_cast<size_t>(end - pos)));
+      if (next == nullptr) {
+        next = end;
+      }
+      decodeTelegram(messages, pos, static_cast<size_t>(next - pos), 0, chunk);
+      pos = next + 1;
+      continue;
+    }
+    uint64_t micros = 0;
+    for (size_t index = 0; index < 8; index++) {
+      micros |= static_cast<uint64_t>(pos[index]) << (8 * index);
+    }
+    size_t length = static_cast<size_t>(pos[8]) | (static_cast<size_t>(pos[9]) << 8);
+    decodeTelegram(messages, pos + TIMED_HEADER_LEN, length, micros, chunk);
+    pos += TIMED_HEADER_LEN + length;
+  }
+}
+
+/**
+ * Split the content of a dump file into chunks on telegram boundaries.
+ * @param data the content of the dump file.
+ * @param length the length of the content.
+ * @param timed whether the content consists of records of a timed dump file (without the magic header).
+ * @param chunks the @a vector to add the @a Chunk instances to.
+ */
+static void splitChunks(const uint8_t* data, size_t length, bool timed, vector<Chunk>* chunks) {
+  size_t start = 0;
+  while (start < length) {
+    size_t end = start;
+    if (timed) {
+      // walk the record headers, skipping the magic of concatenated files
+      while (end < length && end - start < CHUNK_SIZE) {
+        if (length - end >= ROTATE_FILE_TIMED_MAGIC_LEN
+            && memcmp(data + end, ROTATE_FILE_TIMED_MAGIC, ROTATE_FILE_TIMED_MAGIC_LEN) == 0) {
+          if (end > start) {
+            break;
+          }
+          start = end = end + ROTATE_FILE_TIMED_MAGIC_LEN;
+          continue;
+        }
+        if (length - end < TIMED_HEADER_LEN) {
+          length = end;  // truncated record
+          break;
+        }
+        size_t recordLength = TIMED_HEADER_LEN + (static_cast<size_t>(data[end + 8])
+            | (static_cast<size_t>(data[end + 9]) << 8));
+        if (length - end < recordLength) {
+          length = end;  // truncated record
+          break;
+        }
+        end += recordLength;
+      }
+    } else {
+      end = start + CHUNK_SIZE < length ? start + CHUNK_SIZE : length;
+      const uint8_t* next = static_cast<const uint8_t*>(memchr(data + end, SYN, length - end));
+      end = next == nullptr ? length : static_cast<size_t>(next - data) + 1;
+    }
+    if (end > start) {
+      chunks->push_back({data + start, end - start, "", 0, 0, 0});
+    }
+    start = end;
+  }
+}
+
+/**
+ * A @a Thread decoding the next pending @a Chunk until all are done.
+ */
+class DecodeThread : public Thread {
+ public:
+  /**
+   * Constructor.
+   * @param messages the @a MessageMap to determine the @a Message from.
+   * @param timed whether the chunks consist of records of a timed dump file.
+   * @param chunks the @a Chunk instances to decode.
+   * @param nextChunk the index of the next @a Chunk to decode (shared between all instances).
+   * @param mutex the @a Mutex for accessing @a nextChunk.
+   */
+  DecodeThread(const MessageMap* messages, bool timed, vector<Chunk>* chunks, size_t* nextChunk, Mutex* mutex)
+    : Thread(), m_messages(messages), m_timed(timed), m_chunks(chunks), m_nextChunk(nextChunk), m_mutex(mutex) {}
+
+
+ protected:
+  // @copydoc
+  void run() override {
+    while (true) {
+      m_mutex->lock();
+      size_t index = (*m_nextChunk)++;
+      m_mutex->unlock();
+      if (index >= m_chunks->size()) {
+        break;
+      }
+      decodeChunk(m_messages, m_timed, &(*m_chunks)[index]);
+    }
+  }
+
+
+ private:
+  /** the @a MessageMap to determine the @a Message from. */
+  const MessageMap* m_messages;
+
+  /** whether the chunks consist of records of a timed dump file. */
+  const bool m_timed;
+
+  /** the @a Chunk instances to decode. */
+  vector<Chunk>* m_chunks;
+
+  /** the index of the next @a Chunk to decode. */
+  size_t* m_nextChunk;
+
+  /** the @a Mutex for accessing @a m_nextChunk. */
+  Mutex* m_mutex;
+};
+
+/**
+ * Decode a single dump file.
+ * @param messages the @a MessageMap to determine the @a Message from.
+ * @param fileName the name of the dump file.
+ * @param output the @a ostream to write the output to.
+ * @param decoded the variable in which to add the number of decoded telegrams.
+ * @param unknown the variable in which to add the number of unknown telegrams.
+ * @param invalid the variable in which to add the number of invalid telegrams.
+ * @return whether the file was readable.
+ */
+static bool decodeFile(const MessageMap* messages, const string& fileName, ostream* output,
+    unsigned long* decoded, unsigned long* unknown, unsigned long* invalid) {
+  int fd = open(fileName.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return false;
+  }
+  size_t length = static_cast<size_t>(st.st_size);
+  if (length == 0) {
+    close(fd);
+    return true;
+  }
+  void* mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapped == MAP_FAILED) {
+    return false;
+  }
+  madvise(mapped, length, MADV_SEQUENTIAL);
+  const uint8_t* data = static_cast<const uint8_t*>(mapped);
+  bool timed = length >= ROTATE_FILE_TIMED_MAGIC_LEN
+      && memcmp(data, ROTATE_FILE_TIMED_MAGIC, ROTATE_FILE_TIMED_MAGIC_LEN) == 0;
+  vector<Chunk> chunks;
+  splitChunks(data, length, timed, &chunks);
+  size_t roundSize = static_cast<size_t>(opt.threads) * CHUNKS_PER_ROUND;
+  for (size_t roundStart = 0; roundStart < chunks.size(); roundStart += roundSize) {
+    size_t roundEnd = roundStart + roundSize < chunks.size() ? roundStart + roundSize : chunks.size();
+    vector<Chunk> round(chunks.begin() + static_cast<ssize_t>(roundStart),
+        chunks.begin() + static_cast<ssize_t>(roundEnd));
+    size_t nextChunk = 0;
+    Mutex mutex;
+    vector<DecodeThread*> threads;
+    for (unsigned int i = 0; i < opt.threads && i < round.size(); i++) {
+      DecodeThread* thread = new DecodeThread(messages, timed, &round, &nextChunk, &mutex);
+      if (!thread->start("decode")) {
+        delete thread;
+        break;
+      }
+      threads.push_back(thread);
+    }
+    for (auto thread : threads) {
+      thread->join();
+      delete thread;
+    }
+    for (const auto& chunk : round) {
+      *output << chunk.output;
+      *decoded += chunk.decoded;
+      *unknown += chunk.unknown;
+      *invalid += chunk.invalid;
+    }
+  }
+  munmap(mapped, length);
+  return true;
+}
+
+/**
+ * Main function.
+ * @param argc the number of command line arguments.
+ * @param argv the command line arguments.
+ * @return the exit code.
+ */
+int main(int argc, char* argv[]) {
+  struct argp argp = { argpoptions, parse_opt, argpargsdoc, argpdoc, nullptr, nullptr, nullptr };
+  setenv("ARGP_HELP_FMT", "no-dup-args-note", 0);
+  if (argp_parse(&argp, argc, argv, ARGP_IN_ORDER, nullptr, &opt) != 0) {
+    return EINVAL;
+  }
+  if (opt.threads == 0) {
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    opt.threads = count > 0 ? static_cast<unsigned int>(count) : 1;
+  }
+  MessageMap messages(false);
+  readConfigFiles("", &messages);
+  cerr << "found messages: " << messages.size() << endl;
+  ofstream fileOutput;
+  ostream* output = &cout;
+  if (opt.outputFile) {
+    fileOutput.open(opt.outputFile);
+    if (!fileOutput.is_open()) {
+      cerr << "unable to open output file " << opt.outputFile << endl;
+      return EXIT_FAILURE;
+    }
+    output = &fileOutput;
+  }
+  if (!opt.json) {
+    *output << "time,circuit,name,field,value\n";
+  }
+  int ret = EXIT_SUCCESS;
+  unsigned long decoded = 0, unknown = 0, invalid = 0;
+  for (const auto& fileName : s_dumpFiles) {
+    if (!decodeFile(&messages, fileName, output, &decoded, &unknown, &invalid)) {
+      cerr << "error reading file " << fileName << endl;
+      ret = EXIT_FAILURE;
+    }
+  }
+  output->flush();
+  cerr << "decoded " << decoded << " telegrams, " << unknown << " unknown, " << invalid << " invalid" << endl;
+  for (const auto& it : s_templatesByPath) {
+    if (it.second != &s_globalTemplates) {
+      delete it.second;
+    }
+  }
+  s_templatesByPath.clear();
+  messages.clear();
+  return ret;
+}
+
+}  // namespace ebusd
+
+int main(int argc, char* argv[]) {
+  return ebusd::main(argc, argv);
+}
@@ -25,27 +25,32 @@
 #include <string.h>
 #include <iostream>
 #include <cstdlib>
-#include <fstream>
 #include <iomanip>
+#include <vector>
 #include "lib/ebus/device.h"
 #include "lib/ebus/result.h"
+#include "lib/ebus/symbol.h"
+#include "lib/utils/dumpreader.h"
 
 namespace ebusd {
 
 using std::hex;
-using std::fstream;
 using std::cout;
 using std::endl;
 using std::setw;
 using std::setfill;
-using std::ios;
+using std::string;
+using std::vector;
 using ebusd::result_t;
 using ebusd::Device;
+using ebusd::SymbolString;
 
 /** A structure holding all program options. */
 struct options {
   const char* device;  //!< device to write to [/dev/ttyUSB60]
   unsigned int time;  //!< delay between bytes in us [10000]
+  unsigned int speed;  //!< speed factor for a timed dump file, 0 for as fast as possible [1]
+  unsigned int loop;  //!< number of times to feed the dump file, 0 for endless [1]
 
   const char* dumpFile;  //!< dump file to read
 };
@@ -54,6 +59,8 @@ struct options {
 static struct options opt = {
   "/dev/ttyUSB60",  // device
   10000,  // time
+  1,  // speed
+  1,  // loop
 
   "/tmp/ebus_dump.bin",  // dumpFile
 };
@@ -70,6 +77,9 @@ static const char argpdoc[] =
   "\v"
   "With no DUMPFILE, /tmp/ebus_dump.bin is used.\n"
   "\n"
+  "A plain DUMPFILE is fed byte by byte with the delay set by --time, while a DUMPFILE written with --dumptimed is "
+  "fed telegram by telegram with the recorded timing divided by --speed.\n"
+  "\n"
   "Example for setting up two pseudo terminals with 'socat':\n"
   "  1. 'socat -d -d pty,raw,echo=0 pty,raw,echo=0'\n"
   "  2. create symbol links to appropriate devices, e.g.\n"
@@ -85,6 +95,9 @@ static char argpargsdoc[] = "[DUMPFILE]";
 static const struct argp_option argpoptions[] = {
   {"device", 'd', "DEV",     0, "Write to DEV (serial device) [/dev/ttyUSB60]", 0 },
   {"time",   't', "USEC",    0, "Delay each byte by USEC us [10000]", 0 },
+  {"speed",  's', "FACTOR",  0, "Feed a timed DUMPFILE FACTOR times faster than recorded (0=as fast as possible) [1]",
+    0 },
+  {"loop",   'l', "COUNT",   0, "Feed the DUMPFILE COUNT times (0=endless) [1]", 0 },
 
   {nullptr,    0, nullptr,   0, nullptr, 0 },
 };
@@ -114,6 +127,20 @@ error_t parse_opt(int key, char *arg, struct argp_state *state) {
       return EINVAL;
     }
     break;
+  case 's':  // --speed=1
+    opt->speed = (unsigned int)strtoul(arg, &strEnd, 10);
+    if (strEnd == nullptr || strEnd == arg || *strEnd != 0 || opt->speed > 1000000) {
+      argp_error(state, "invalid speed");
+      return EINVAL;
+    }
+    break;
+  case 'l':  // --loop=1
+    opt->loop = (unsigned int)strtoul(arg, &strEnd, 10);
+    if (strEnd == nullptr || strEnd == arg || *strEnd != 0) {
+      argp_error(state, "invalid loop");
+      return EINVAL;
+    }
+    break;
   case ARGP_KEY_ARG:
     if (state->arg_num == 0) {
       if (arg == nullptr || arg[0] == 0 || strcmp("/", arg) == 0) {
@@ -157,19 +184,26 @@ int main(int argc, char* argv[]) {
     cout << "device " << opt.device << " not available" << endl;
   } else {
     cout << "device opened" << endl;
-    fstream file(opt.dumpFile, ios::in | ios::binary);
-    if (file.is_open()) {
-      while (true) {
-        symbol_t byte = (symbol_t)file.get();
-        if (file.eof()) {
-          break;
+    DumpReader reader(opt.dumpFile, opt.speed, opt.loop);
+    if (reader.open()) {
+      vector<uint8_t> data;
+      while (reader.next(&data)) {
+        if (reader.isTimed()) {
+          string str;
+          SymbolString::encodeHex(data.data(), data.size(), &str);
+          cout << str << endl;
+          for (const auto byte : data) {
+            device->send(byte);
+          }
+          continue;
+        }
+        for (const auto byte : data) {
+          cout << hex << setw(2) << setfill('0')
+               << static_cast<unsigned>(byte) << endl;
+          device->send(byte);
+          usleep(opt.time);
         }
-        cout << hex << setw(2) << setfill('0')
-             << static_cast<unsigned>(byte) << endl;
-        device->send(byte);
-        usleep(opt.time);
       }
-      file.close();
     } else {
       cout << "error opening file " << opt.dumpFile << endl;
     }
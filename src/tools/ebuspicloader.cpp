@@ -24,12 +24,14 @@
 #include <termios.h>
 #include <unistd.h>
 #include <argp.h>
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 #include <cstdlib>
 #include <iomanip>
 #include <string>
 #include <cstring>
+#include <vector>
 #include "intelhex/intelhexclass.h"
 
 
@@ -51,6 +53,8 @@ static const struct argp_option argpoptions[] = {
     {"mask",    'm', "MASK",  0, "set fix IP mask (e.g. 24)", 0 },
     {"macip",   'M', nullptr, 0, "set the MAC address suffix from the IP address", 0 },
     {"flash",   'f', "FILE",  0, "flash the FILE to the device", 0 },
+    {"diff",    'D', nullptr, 0, "only flash the blocks differing from the device", 0 },
+    {"window",  'w', "COUNT", 0, "keep up to COUNT write frames in flight [1]", 0 },
     {"reset",   'r', nullptr, 0, "reset the device at the end on success", 0 },
     {"slow",    's', nullptr, 0, "use low speed for transfer", 0 },
     {nullptr,          0,        nullptr,    0, nullptr, 0 },
@@ -66,6 +70,8 @@ static uint8_t setMaskLen = 0x1f;
 static char* flashFile = nullptr;
 static bool reset = false;
 static bool lowSpeed = false;
+static bool flashDiff = false;
+static uint8_t flashWindow = 1;
 
 bool parseByte(const char *arg, uint8_t minValue, uint8_t maxValue, uint8_t *result) {
   char* strEnd = nullptr;
@@ -163,6 +169,15 @@ error_t parse_opt(int key, char *arg, struct argp_state *state) {
       }
       flashFile = arg;
       break;
+    case 'D':
+      flashDiff = true;
+      break;
+    case 'w':
+      if (arg == nullptr || arg[0] == 0 || !parseByte(arg, 1, 16, &flashWindow)) {
+        argp_error(state, "invalid window");
+        return EINVAL;
+      }
+      break;
     case 'r':
       reset = true;
       break;
@@ -238,6 +253,12 @@ typedef union
 #define END_BOOT 0x0400
 // size of boot block in bytes
 #define END_BOOT_BYTES (END_BOOT*2)
+// size of erase block in bytes
+#define ERASE_FLASH_BLOCK_BYTES (ERASE_FLASH_BLOCKSIZE*2)
+// number of erase blocks compared at once before comparing the single blocks in differential mode
+#define DIFF_GROUP_BLOCKS 16
+// time to wait for a potential nonsense tail after the last response
+#define WAIT_TAIL_MILLIS WAIT_BYTE_TRANSFERRED_MILLIS
 
 long long getTime() {
   struct timespec ts;
@@ -245,7 +266,7 @@ long long getTime() {
   return ts.tv_sec*1000+ts.tv_nsec/1000000;
 }
 
-ssize_t waitWrite(int fd, uint8_t *data, size_t len, int timeoutMillis) {
+ssize_t waitWrite(int fd, const uint8_t *data, size_t len, int timeoutMillis) {
   int ret;
   struct pollfd pfd;
   pfd.fd = fd;
@@ -297,8 +318,7 @@ ssize_t waitRead(int fd, uint8_t *data, size_t len, int timeoutMillis) {
   return ret;
 }
 
-ssize_t sendReceiveFrame(int fd, frame_t& frame, size_t sendDataLen, ssize_t fixReceiveDataLen,
-                         int responseTimeoutExtraMillis = 0, bool hideErrors = false) {
+ssize_t sendFrame(int fd, const frame_t& frame, size_t sendDataLen, bool hideErrors = false) {
   // send 0x55 for auto baud detection in PIC
   unsigned char ch = STX;
   ssize_t cnt = waitWrite(fd, &ch, 1, WAIT_BYTE_TRANSFERRED_MILLIS);
@@ -312,11 +332,10 @@ ssize_t sendReceiveFrame(int fd, frame_t& frame, size_t sendDataLen, ssize_t fix
     if (!hideErrors) {
       std::cerr << "write sync timed out" << std::endl;
     }
-    return cnt;
+    return -1;
   }
   // wait for bitrate detection to finish in PIC
   usleep(WAIT_BITRATE_DETECTION_MICROS);
-  uint8_t writeCommand = frame.command;
   size_t len = FRAME_HEADER_LEN+sendDataLen;
   for (size_t pos=0; pos < len; ) {
     cnt = waitWrite(fd, frame.buffer+pos, len-pos, WAIT_BYTE_TRANSFERRED_MILLIS);
@@ -334,7 +353,13 @@ ssize_t sendReceiveFrame(int fd, frame_t& frame, size_t sendDataLen, ssize_t fix
     }
     pos += cnt;
   }
-  cnt = waitRead(fd, &ch, 1, WAIT_RESPONSE_TIMEOUT_MILLIS + responseTimeoutExtraMillis);
+  return 0;
+}
+
+ssize_t receiveFrame(int fd, frame_t& frame, uint8_t writeCommand, ssize_t fixReceiveDataLen,
+                     int responseTimeoutExtraMillis = 0, bool hideErrors = false, bool readTail = true) {
+  unsigned char ch = 0;
+  ssize_t cnt = waitRead(fd, &ch, 1, WAIT_RESPONSE_TIMEOUT_MILLIS + responseTimeoutExtraMillis);
   if (cnt < 0) {
     if (!hideErrors) {
       std::cerr << "read sync failed" << std::endl;
@@ -355,7 +380,7 @@ ssize_t sendReceiveFrame(int fd, frame_t& frame, size_t sendDataLen, ssize_t fix
     return -1;
   }
   // read the answer from the device
-  len = FRAME_HEADER_LEN;  // start with the header itself
+  size_t len = FRAME_HEADER_LEN;  // start with the header itself
   for (size_t pos=0; pos < len; ) {
     cnt = waitRead(fd, frame.buffer+pos, len-pos, WAIT_BYTE_TRANSFERRED_MILLIS);
     if (cnt < 0) {
@@ -380,8 +405,10 @@ ssize_t sendReceiveFrame(int fd, frame_t& frame, size_t sendDataLen, ssize_t fix
       fixReceiveDataLen = 0;
     }
   }
-  uint8_t dummy[4];
-  waitRead(fd, dummy, 4, WAIT_BYTE_TRANSFERRED_MILLIS);  // read away potential nonsense tail
+  if (readTail) {
+    uint8_t dummy[4];
+    waitRead(fd, dummy, 4, WAIT_TAIL_MILLIS);  // read away potential nonsense tail
+  }
   if (frame.command != writeCommand) {
     if (!hideErrors) {
       std::cerr << "unexpected answer" << std::endl;
@@ -391,6 +418,15 @@ ssize_t sendReceiveFrame(int fd, frame_t& frame, size_t sendDataLen, ssize_t fix
   return 0;
 }
 
+ssize_t sendReceiveFrame(int fd, frame_t& frame, size_t sendDataLen, ssize_t fixReceiveDataLen,
+                         int responseTimeoutExtraMillis = 0, bool hideErrors = false) {
+  ssize_t ret = sendFrame(fd, frame, sendDataLen, hideErrors);
+  if (ret != 0) {
+    return ret;
+  }
+  return receiveFrame(fd, frame, frame.command, fixReceiveDataLen, responseTimeoutExtraMillis, hideErrors);
+}
+
 int readVersion(int fd, bool verbose = true) {
   frame_t frame;
   memset(frame.buffer, 0, FRAME_MAX_LEN);
@@ -530,8 +566,7 @@ int readFlash(int fd, uint16_t address, bool skipHigh = false, bool print = true
   return 0;
 }
 
-int writeFlash(int fd, uint16_t address, uint16_t len, uint8_t* data, bool hideErrors = false) {
-  frame_t frame;
+void prepareWriteFlash(frame_t& frame, uint16_t address, uint16_t len, const uint8_t* data) {
   memset(frame.buffer, 0, FRAME_MAX_LEN);
   frame.command = WRITE_FLASH;
   frame.data_length = len;
@@ -540,6 +575,11 @@ int writeFlash(int fd, uint16_t address, uint16_t len, uint8_t* data, bool hideE
   frame.address_L = address&0xff;
   frame.address_H = (address>>8)&0xff;
   memcpy(frame.data, data, len);
+}
+
+int writeFlash(int fd, uint16_t address, uint16_t len, const uint8_t* data, bool hideErrors = false) {
+  frame_t frame;
+  prepareWriteFlash(frame, address, len, data);
   ssize_t ret = sendReceiveFrame(fd, frame, len, 1, len*30, hideErrors);
   if (ret != 0) {
     return ret;
@@ -550,6 +590,32 @@ int writeFlash(int fd, uint16_t address, uint16_t len, uint8_t* data, bool hideE
   return 0;
 }
 
+size_t writeFlashWindow(int fd, const uint16_t* addresses, const uint8_t* const* data, size_t count, uint16_t len) {
+  // send all frames first and collect the responses afterwards, which requires the bootloader to keep receiving
+  // while writing the flash. on the first failure, the number of blocks written in sequence so far is returned.
+  frame_t frame;
+  size_t sent = 0;
+  for (; sent < count; sent++) {
+    prepareWriteFlash(frame, addresses[sent], len, data[sent]);
+    if (sendFrame(fd, frame, len, true) != 0) {
+      break;
+    }
+  }
+  size_t written = 0;
+  for (; written < sent; written++) {
+    if (receiveFrame(fd, frame, WRITE_FLASH, 1, len*30, true, written+1 == sent) != 0
+        || frame.data[0] != COMMAND_SUCCESS) {
+      break;
+    }
+  }
+  if (written < count) {
+    // throw away the responses of the remaining frames
+    usleep(WAIT_TAIL_MILLIS*1000);
+    tcflush(fd, TCIFLUSH);
+  }
+  return written;
+}
+
 int eraseFlash(int fd, uint16_t address, uint16_t len) {
   frame_t frame;
   memset(frame.buffer, 0, FRAME_MAX_LEN);
@@ -639,6 +705,14 @@ int openSerial(std::string port) {
   return fd;
 }
 
+uint16_t calcBlockChecksum(const uint8_t* data, size_t len) {
+  uint16_t checkSum = 0;
+  for (size_t pos = 0; pos < len; pos++) {
+    checkSum += ((uint16_t)data[pos]) << ((pos&0x1)*8);
+  }
+  return checkSum;
+}
+
 void closeSerial(int fd) {
   tcsetattr(fd, TCSANOW, &termios_original);
   close(fd);
@@ -743,59 +817,127 @@ bool flashPic(int fd) {
     return false;
   }
   ih.begin();
-  uint8_t buf[WRITE_FLASH_BLOCKSIZE];
   unsigned long nextAddr = ih.currentAddress();
   if (nextAddr != END_BOOT_BYTES) {
     std::cerr << "unexpected start address in file: 0x" << std::hex << std::setfill('0') << std::setw(4)
               << static_cast<unsigned>(nextAddr) << std::endl;
     return false;
   }
-  unsigned long blockStart = END_BOOT_BYTES;
-  uint16_t checkSum = 0;
-  int eraseRes = eraseFlash(fd, blockStart/2, (endAddr-blockStart)/2);
-  if (eraseRes != 0) {
-    std::cerr << "erasing flash failed: " << static_cast<signed>(-eraseRes-1) << std::endl;
-    return false;
+  // read the whole image up to the end of the last erase block with blank values for the gaps
+  unsigned long endBlock = END_BOOT_BYTES
+    + ((endAddr-END_BOOT_BYTES)/ERASE_FLASH_BLOCK_BYTES+1)*ERASE_FLASH_BLOCK_BYTES;
+  std::vector<uint8_t> image(endBlock-END_BOOT_BYTES);
+  std::vector<bool> blank(image.size()/WRITE_FLASH_BLOCKSIZE, true);
+  for (size_t pos = 0; pos < image.size(); pos++, nextAddr++) {
+    unsigned long addr = ih.currentAddress();
+    uint8_t value = (pos&0x1) == 1 ? 0x3f : 0xff;
+    if (addr == nextAddr && ih.getData(&value)) {
+      ih.incrementAddress();
+      blank[pos/WRITE_FLASH_BLOCKSIZE] = false;
+    }
+    image[pos] = value;
+  }
+  uint16_t checkSum = calcBlockChecksum(image.data(), image.size());
+  size_t eraseBlocks = image.size()/ERASE_FLASH_BLOCK_BYTES;
+  std::vector<bool> changed(eraseBlocks, true);
+  size_t changedBlocks = eraseBlocks;
+  if (flashDiff) {
+    // the checksum only serves for skipping identical blocks, the whole image is verified at the end anyway
+    changedBlocks = 0;
+    for (size_t group = 0; group < eraseBlocks; group += DIFF_GROUP_BLOCKS) {
+      size_t groupEnd = std::min(group+DIFF_GROUP_BLOCKS, eraseBlocks);
+      size_t offset = group*ERASE_FLASH_BLOCK_BYTES;
+      size_t len = (groupEnd-group)*ERASE_FLASH_BLOCK_BYTES;
+      int picSum = calcChecksum(fd, (END_BOOT_BYTES+offset)/2, len);
+      if (picSum >= 0 && picSum == calcBlockChecksum(image.data()+offset, len)) {
+        for (size_t block = group; block < groupEnd; block++) {
+          changed[block] = false;
+        }
+        continue;
+      }
+      for (size_t block = group; block < groupEnd; block++) {
+        offset = block*ERASE_FLASH_BLOCK_BYTES;
+        picSum = calcChecksum(fd, (END_BOOT_BYTES+offset)/2, ERASE_FLASH_BLOCK_BYTES);
+        changed[block] = picSum < 0 || picSum != calcBlockChecksum(image.data()+offset, ERASE_FLASH_BLOCK_BYTES);
+        if (changed[block]) {
+          changedBlocks++;
+        }
+      }
+    }
+    std::cout << "comparing flash: " << std::dec << static_cast<unsigned>(changedBlocks) << " of "
+              << static_cast<unsigned>(eraseBlocks) << " blocks differ." << std::endl;
+  }
+  for (size_t block = 0; block < eraseBlocks; ) {
+    if (!changed[block]) {
+      block++;
+      continue;
+    }
+    // erase adjacent changed blocks at once
+    size_t blockEnd = block+1;
+    while (blockEnd < eraseBlocks && changed[blockEnd]) {
+      blockEnd++;
+    }
+    int eraseRes = eraseFlash(fd, (END_BOOT_BYTES+block*ERASE_FLASH_BLOCK_BYTES)/2,
+                              (blockEnd-block)*ERASE_FLASH_BLOCKSIZE);
+    if (eraseRes != 0) {
+      std::cerr << "erasing flash failed: " << static_cast<signed>(-eraseRes-1) << std::endl;
+      return false;
+    }
+    block = blockEnd;
   }
   std::cout << "erasing flash: done." << std::endl;
-  std::cout << "flashing: 0x" << std::hex << std::setfill('0') << std::setw(4) << static_cast<unsigned>(nextAddr/2)
-            << " - 0x" << static_cast<unsigned>(endAddr/2) << std::endl;
-  size_t blocks = 0;
-  while (blockStart < endAddr) {
-    bool blank = true;
-    for (int pos = 0; pos < WRITE_FLASH_BLOCKSIZE; pos++, nextAddr++) {
-      unsigned long addr = ih.currentAddress();
-      uint8_t value = (pos&0x1) == 1 ? 0x3f : 0xff;
-      if (addr == nextAddr && ih.getData(&value)) {
-        ih.incrementAddress();
-        blank = false;
-      }
-      buf[pos] = value;
-      checkSum += ((uint16_t)value) << ((pos&0x1)*8);
+  std::vector<uint16_t> addresses;
+  std::vector<const uint8_t*> data;
+  for (size_t pos = 0; pos < image.size(); pos += WRITE_FLASH_BLOCKSIZE) {
+    if (changed[pos/ERASE_FLASH_BLOCK_BYTES] && !blank[pos/WRITE_FLASH_BLOCKSIZE]) {
+      addresses.push_back((uint16_t)((END_BOOT_BYTES+pos)/2));
+      data.push_back(image.data()+pos);
     }
-    if (!blank) {
-      if (blocks == 0) {
-        std::cout << std::endl << "0x" << std::hex << std::setfill('0') << std::setw(4)
-                  << static_cast<unsigned>(blockStart/2) << " ";
+  }
+  std::cout << "flashing: 0x" << std::hex << std::setfill('0') << std::setw(4)
+            << static_cast<unsigned>(END_BOOT_BYTES/2) << " - 0x" << static_cast<unsigned>(endAddr/2) << std::endl;
+  size_t window = flashWindow;
+  bool windowFailed = false;
+  size_t blocks = 0;
+  for (size_t idx = 0; idx < addresses.size(); ) {
+    size_t count = std::min(window, addresses.size()-idx);
+    size_t written = 0;
+    if (count > 1) {
+      written = writeFlashWindow(fd, &addresses[idx], &data[idx], count, WRITE_FLASH_BLOCKSIZE);
+      if (written < count) {
+        // the bootloader did not keep up, continue with one frame at a time
+        window = 1;
+        windowFailed = true;
       }
-      if (writeFlash(fd, blockStart/2, WRITE_FLASH_BLOCKSIZE, buf, true) != 0) {
+    } else {
+      if (writeFlash(fd, addresses[idx], WRITE_FLASH_BLOCKSIZE, data[idx], true) != 0) {
         // repeat once silently:
-        if (writeFlash(fd, blockStart/2, WRITE_FLASH_BLOCKSIZE, buf) != 0) {
+        if (writeFlash(fd, addresses[idx], WRITE_FLASH_BLOCKSIZE, data[idx]) != 0) {
           std::cerr << "unable to write flash at 0x" << std::hex << std::setfill('0') << std::setw(4)
-                    << static_cast<unsigned>(blockStart/2) << std::endl;
+                    << static_cast<unsigned>(addresses[idx]) << std::endl;
           return false;
         }
       }
+      written = 1;
+    }
+    for (size_t pos = idx; pos < idx+written; pos++) {
+      if (blocks == 0) {
+        std::cout << std::endl << "0x" << std::hex << std::setfill('0') << std::setw(4)
+                  << static_cast<unsigned>(addresses[pos]) << " ";
+      }
       std::cout << ".";
       if (++blocks >= 64) {
         blocks = 0;
       }
-      std::cout.flush();
     }
-    blockStart += WRITE_FLASH_BLOCKSIZE;
+    std::cout.flush();
+    idx += written;
   }
   std::cout << std::endl << "flashing finished." << std::endl;
-  int picSum = calcChecksum(fd, startAddr/2, blockStart-startAddr);
+  if (windowFailed) {
+    std::cout << "write window not supported by the bootloader, continued without it." << std::endl;
+  }
+  int picSum = calcChecksum(fd, startAddr/2, endBlock-startAddr);
   if (picSum < 0) {
     std::cout << "unable to read checksum." << std::endl;
     return false;